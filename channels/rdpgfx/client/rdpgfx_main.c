@@ -1784,6 +1784,12 @@ static UINT rdpgfx_on_close(IWTSVirtualChannelCallback* pChannelCallback)
 			return CHANNEL_RC_NO_MEMORY;
 	}
 
+	/* Let the client persist the cache before the slots are evicted */
+	if (context)
+	{
+		IFCALL(context->OnClose, context);
+	}
+
 	count = HashTable_GetKeys(gfx->SurfaceTable, &pKeys);
 
 	for (index = 0; index < count; index++)
@@ -1815,11 +1821,6 @@ static UINT rdpgfx_on_close(IWTSVirtualChannelCallback* pChannelCallback)
 		}
 	}
 
-	if (context)
-	{
-		IFCALL(context->OnClose, context);
-	}
-
 	return CHANNEL_RC_OK;
 }
 
@@ -2120,6 +2121,7 @@ RdpgfxClientContext* rdpgfx_client_context_new(rdpSettings* settings)
 	context->CapsAdvertise = rdpgfx_send_caps_advertise_pdu;
 	context->FrameAcknowledge = rdpgfx_send_frame_acknowledge_pdu;
 	context->CacheImportOffer = rdpgfx_send_cache_import_offer_pdu;
+	context->MaxCacheSlots = gfx->MaxCacheSlot;
 	context->QoeFrameAcknowledge = rdpgfx_send_qoe_frame_acknowledge_pdu;
 
 	gfx->iface.pInterface = (void*)context;
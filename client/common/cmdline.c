@@ -2490,6 +2490,15 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 			if (enable)
 				settings->SupportGraphicsPipeline = TRUE;
 		}
+		CommandLineSwitchCase(arg, "gfx-threads")
+		{
+			LONGLONG val;
+
+			if (!value_to_int(arg->Value, &val, 0, UINT16_MAX))
+				return COMMAND_LINE_ERROR_UNEXPECTED_VALUE;
+
+			settings->GfxDecodeThreads = (UINT32)val;
+		}
 		CommandLineSwitchCase(arg, "gfx-progressive")
 		{
 			settings->GfxProgressive = enable;
@@ -2713,6 +2722,10 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 
 			settings->TlsSecLevel = (UINT32)val;
 		}
+		CommandLineSwitchCase(arg, "tls-offload")
+		{
+			settings->TlsKernelOffload = enable;
+		}
 		CommandLineSwitchCase(arg, "cert-name")
 		{
 			if (!copy_value(arg->Value, &settings->CertificateName))
@@ -2833,6 +2846,26 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 		{
 			settings->BitmapCacheEnabled = enable;
 		}
+		CommandLineSwitchCase(arg, "persist-cache")
+		{
+			UINT32 i;
+			settings->BitmapCachePersistEnabled = enable;
+
+			for (i = 0; i < settings->BitmapCacheV2NumCells; i++)
+				settings->BitmapCacheV2CellInfo[i].persistent = enable;
+		}
+		CommandLineSwitchCase(arg, "persist-cache-file")
+		{
+			UINT32 i;
+
+			if (!copy_value(arg->Value, &settings->BitmapCachePersistFile))
+				return COMMAND_LINE_ERROR_MEMORY;
+
+			settings->BitmapCachePersistEnabled = TRUE;
+
+			for (i = 0; i < settings->BitmapCacheV2NumCells; i++)
+				settings->BitmapCacheV2CellInfo[i].persistent = TRUE;
+		}
 		CommandLineSwitchCase(arg, "offscreen-cache")
 		{
 			settings->OffscreenSupportLevel = (UINT32)enable;
@@ -23,6 +23,9 @@ else()
 	option(WITH_SSE2 "Enable SSE2 optimization." OFF)
 endif()
 
+cmake_dependent_option(WITH_AVX2 "Enable AVX2 optimization (selected at runtime)." ON "WITH_SSE2" OFF)
+cmake_dependent_option(WITH_AVX512 "Enable AVX-512 optimization (selected at runtime)." ON "WITH_AVX2" OFF)
+
 if(TARGET_ARCH MATCHES "ARM")
 	if (NOT DEFINED WITH_NEON)
 		option(WITH_NEON "Enable NEON optimization." ON)
@@ -81,6 +84,8 @@ option(WITH_CHANNELS "Build virtual channel plugins" ON)
 
 option(WITH_WINPR_TOOLS "Build WinPR helper binaries" ON)
 
+option(WITH_BENCHMARK "Build the freerdp-bench primitives and codec benchmark" OFF)
+
 cmake_dependent_option(WITH_CLIENT_CHANNELS "Build virtual channel plugins" ON
 	"WITH_CLIENT_COMMON;WITH_CHANNELS" OFF)
 
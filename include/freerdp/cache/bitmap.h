@@ -56,6 +56,9 @@ struct rdp_bitmap_cache
 	rdpUpdate* update;
 	rdpContext* context;
 	rdpSettings* settings;
+	struct rdp_persistent_cache* persistent;
+	UINT64** persistentKeys;
+	UINT32* persistentCounts;
 };
 
 #ifdef __cplusplus
@@ -331,6 +331,8 @@ struct _RDPGFX_CACHE_ENTRY_METADATA
 };
 typedef struct _RDPGFX_CACHE_ENTRY_METADATA RDPGFX_CACHE_ENTRY_METADATA;
 
+#define RDPGFX_CACHE_ENTRY_MAX_COUNT 5462
+
 struct _RDPGFX_CACHE_IMPORT_OFFER_PDU
 {
 	UINT16 cacheEntriesCount;
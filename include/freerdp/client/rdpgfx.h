@@ -146,6 +146,9 @@ struct _rdpgfx_client_context
 	pcRdpgfxMapWindowForSurface MapWindowForSurface;
 	pcRdpgfxUnmapWindowForSurface UnmapWindowForSurface;
 
+	/* Number of cache slots negotiated with the server, valid slots are below this */
+	UINT16 MaxCacheSlots;
+
 	CRITICAL_SECTION mux;
 	PROFILER_DEFINE(SurfaceProfiler)
 };
@@ -48,7 +48,9 @@ typedef struct _H264_CONTEXT_SUBSYSTEM H264_CONTEXT_SUBSYSTEM;
 enum _H264_RATECONTROL_MODE
 {
 	H264_RATECONTROL_VBR = 0,
-	H264_RATECONTROL_CQP
+	H264_RATECONTROL_CQP,
+	H264_RATECONTROL_CBR, /* BitRate held per frame, for links with a fixed bandwidth */
+	H264_RATECONTROL_CRF  /* constant quality with QP as rate factor, the bit rate floats */
 };
 typedef enum _H264_RATECONTROL_MODE H264_RATECONTROL_MODE;
 
@@ -62,7 +64,7 @@ struct _H264_CONTEXT
 	H264_RATECONTROL_MODE RateControlMode;
 	UINT32 BitRate;
 	FLOAT FrameRate;
-	UINT32 QP;
+	UINT32 QP; /* quantizer for CQP, rate factor for CRF */
 	UINT32 NumberOfThreads;
 
 	UINT32 iStride[3];
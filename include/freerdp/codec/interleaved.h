@@ -21,6 +21,7 @@
 #define FREERDP_CODEC_INTERLEAVED_H
 
 typedef struct _BITMAP_INTERLEAVED_CONTEXT BITMAP_INTERLEAVED_CONTEXT;
+typedef struct _BITMAP_INTERLEAVED_CONTEXT_PRIV BITMAP_INTERLEAVED_CONTEXT_PRIV;
 
 #include <freerdp/api.h>
 #include <freerdp/types.h>
@@ -28,6 +29,11 @@ typedef struct _BITMAP_INTERLEAVED_CONTEXT BITMAP_INTERLEAVED_CONTEXT;
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/bitmap.h>
 
+/* Speed/ratio trade-off of interleaved_compress */
+#define INTERLEAVED_LEVEL_FAST 0
+#define INTERLEAVED_LEVEL_DEFAULT 1
+#define INTERLEAVED_LEVEL_BEST 2
+
 struct _BITMAP_INTERLEAVED_CONTEXT
 {
 	BOOL Compressor;
@@ -36,6 +42,8 @@ struct _BITMAP_INTERLEAVED_CONTEXT
 	BYTE* TempBuffer;
 
 	wStream* bts;
+
+	BITMAP_INTERLEAVED_CONTEXT_PRIV* priv;
 };
 
 #ifdef __cplusplus
@@ -50,6 +58,12 @@ extern "C"
 	                                        UINT32 nYDst, UINT32 nDstWidth, UINT32 nDstHeight,
 	                                        const gdiPalette* palette);
 
+	/**
+	 * Compresses a bitmap of any size into a single RLE stream.
+	 * The stream always covers a width rounded up to a multiple of 4, the extra
+	 * columns repeat the last pixel of each row. That padded width has to be used
+	 * as the bitmap width when decoding.
+	 */
 	FREERDP_API BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved, BYTE* pDstData,
 	                                      UINT32* pDstSize, UINT32 nWidth, UINT32 nHeight,
 	                                      const BYTE* pSrcData, UINT32 SrcFormat, UINT32 nSrcStep,
@@ -58,6 +72,13 @@ extern "C"
 
 	FREERDP_API BOOL bitmap_interleaved_context_reset(BITMAP_INTERLEAVED_CONTEXT* interleaved);
 
+	/**
+	 * Selects how hard interleaved_compress searches for the smallest encoding,
+	 * one of the INTERLEAVED_LEVEL_* values. The default is INTERLEAVED_LEVEL_DEFAULT.
+	 */
+	FREERDP_API BOOL bitmap_interleaved_context_set_level(BITMAP_INTERLEAVED_CONTEXT* interleaved,
+	                                                      UINT32 level);
+
 	FREERDP_API BITMAP_INTERLEAVED_CONTEXT* bitmap_interleaved_context_new(BOOL Compressor);
 	FREERDP_API void bitmap_interleaved_context_free(BITMAP_INTERLEAVED_CONTEXT* interleaved);
 
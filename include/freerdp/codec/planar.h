@@ -25,6 +25,7 @@
 #include <winpr/crt.h>
 
 typedef struct _BITMAP_PLANAR_CONTEXT BITMAP_PLANAR_CONTEXT;
+typedef struct _BITMAP_PLANAR_CONTEXT_PRIV BITMAP_PLANAR_CONTEXT_PRIV;
 
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/bitmap.h>
@@ -97,6 +98,13 @@ struct _BITMAP_PLANAR_CONTEXT
 
 	BYTE* pTempData;
 	UINT32 nTempStep;
+
+	/* encoder routines, replaced by optimized versions at runtime */
+	void (*split_color_row)(const BYTE* pSrc, UINT32 format, UINT32 width, BYTE* planes[4]);
+	void (*delta_encode_row)(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst, UINT32 width);
+	UINT32 (*rle_scan_bytes)(const BYTE* pInput, UINT32 size, BOOL match);
+
+	BITMAP_PLANAR_CONTEXT_PRIV* priv;
 };
 
 #ifdef __cplusplus
@@ -116,6 +124,13 @@ extern "C"
 	                                                                     UINT32 height);
 	FREERDP_API void freerdp_bitmap_planar_context_free(BITMAP_PLANAR_CONTEXT* context);
 
+	/**
+	 * Encode large bitmaps as bands of rows on a thread pool.
+	 * The output is identical to the single threaded encoder.
+	 */
+	FREERDP_API BOOL freerdp_bitmap_planar_context_set_threading(BITMAP_PLANAR_CONTEXT* context,
+	                                                             BOOL enable);
+
 	FREERDP_API BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar, const BYTE* pSrcData,
 	                                   UINT32 SrcSize, UINT32 nSrcWidth, UINT32 nSrcHeight,
 	                                   BYTE* pDstData, UINT32 DstFormat, UINT32 nDstStep,
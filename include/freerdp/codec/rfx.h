@@ -196,6 +196,13 @@ extern "C"
 
 	FREERDP_API BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height);
 
+	/**
+	 * Skips tiles whose content did not change since the last message encoded with this
+	 * context. Every encoded message must be sent, the client keeps the skipped tiles.
+	 * Enabling forgets the previously encoded content, as does rfx_context_reset.
+	 */
+	FREERDP_API BOOL rfx_context_set_tile_hashing(RFX_CONTEXT* context, BOOL enable);
+
 	FREERDP_API RFX_CONTEXT* rfx_context_new(BOOL encoder);
 	FREERDP_API void rfx_context_free(RFX_CONTEXT* context);
 
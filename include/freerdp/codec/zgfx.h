@@ -32,6 +32,11 @@
 
 #define ZGFX_SEGMENTED_MAXSIZE 65535
 
+#define ZGFX_COMPRESSION_LEVEL_NONE 0
+#define ZGFX_COMPRESSION_LEVEL_FAST 1
+#define ZGFX_COMPRESSION_LEVEL_DEFAULT 4
+#define ZGFX_COMPRESSION_LEVEL_MAX 9
+
 typedef struct _ZGFX_CONTEXT ZGFX_CONTEXT;
 
 #ifdef __cplusplus
@@ -47,6 +52,8 @@ extern "C"
 	                                        const BYTE* pUncompressed, UINT32 uncompressedSize,
 	                                        UINT32* pFlags);
 
+	FREERDP_API void zgfx_set_compression_level(ZGFX_CONTEXT* zgfx, DWORD CompressionLevel);
+
 	FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush);
 
 	FREERDP_API ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor);
@@ -525,6 +525,12 @@ struct rdp_gdi
 	GeometryClientContext* geometry;
 
 	wLog* log;
+
+	/* graphics pipeline cache entries offered to the server on connect */
+	struct rdp_gfx_persistent_cache* gfxCache;
+
+	/* decodes graphics pipeline surface commands on worker threads */
+	struct gdi_gfx_decoder* gfxDecoder;
 };
 
 #ifdef __cplusplus
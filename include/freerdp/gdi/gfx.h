@@ -42,6 +42,7 @@ struct gdi_gfx_surface
 	UINT64 windowId;
 	UINT32 outputTargetWidth;
 	UINT32 outputTargetHeight;
+	struct gdi_gfx_surface_queue* queue;
 };
 typedef struct gdi_gfx_surface gdiGfxSurface;
 
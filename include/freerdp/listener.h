@@ -21,6 +21,7 @@
 #define FREERDP_LISTENER_H
 
 typedef struct rdp_freerdp_listener freerdp_listener;
+typedef struct rdp_freerdp_event_loop freerdp_event_loop;
 
 #include <freerdp/api.h>
 #include <freerdp/types.h>
@@ -44,6 +45,9 @@ extern "C"
 	typedef void (*psListenerClose)(freerdp_listener* instance);
 	typedef BOOL (*psPeerAccepted)(freerdp_listener* instance, freerdp_peer* client);
 
+	typedef BOOL (*psEventLoopHandleCallback)(freerdp_peer* client, HANDLE handle, void* arg);
+	typedef void (*psEventLoopPeerRemoved)(freerdp_peer* client, void* arg);
+
 	struct rdp_freerdp_listener
 	{
 		void* info;
@@ -67,6 +71,45 @@ extern "C"
 	FREERDP_API freerdp_listener* freerdp_listener_new(void);
 	FREERDP_API void freerdp_listener_free(freerdp_listener* instance);
 
+	/**
+	 * An event loop drives a listener and many peers from a fixed number of
+	 * threads instead of one thread per connection. Each peer is served by a
+	 * single loop thread, all callbacks of a peer are called on that thread.
+	 *
+	 * Peers added with freerdp_event_loop_add_peer have their transport handles
+	 * checked with CheckFileDescriptor, followed by the channel manager if one
+	 * was set with freerdp_event_loop_add_channel_manager. Output that did not
+	 * fit the socket is drained once it becomes writable.
+	 * When a check fails or freerdp_event_loop_remove_peer is called the peer
+	 * is taken off the loop and PeerRemoved is called, which may free it.
+	 *
+	 * A peer added before the security handshake is done runs the handshake
+	 * on a thread of its own, TLS and NLA accept block. It joins a loop thread
+	 * afterwards, or is removed from the handshake thread when the handshake
+	 * fails or does not finish within the handshake timeout (30 seconds).
+	 *
+	 * On Linux the handles are waited for with epoll, other platforms fall back
+	 * to WaitForMultipleObjects with a limited number of handles per thread.
+	 */
+	FREERDP_API freerdp_event_loop* freerdp_event_loop_new(DWORD threads);
+	FREERDP_API void freerdp_event_loop_free(freerdp_event_loop* loop);
+
+	FREERDP_API BOOL freerdp_event_loop_add_listener(freerdp_event_loop* loop,
+	                                                 freerdp_listener* instance);
+	FREERDP_API BOOL freerdp_event_loop_add_peer(freerdp_event_loop* loop, freerdp_peer* client,
+	                                             psEventLoopPeerRemoved PeerRemoved, void* arg);
+	FREERDP_API BOOL freerdp_event_loop_add_channel_manager(freerdp_event_loop* loop,
+	                                                        freerdp_peer* client, HANDLE hServer);
+	FREERDP_API BOOL freerdp_event_loop_add_handle(freerdp_event_loop* loop, freerdp_peer* client,
+	                                               HANDLE handle,
+	                                               psEventLoopHandleCallback callback, void* arg);
+	FREERDP_API BOOL freerdp_event_loop_remove_handle(freerdp_event_loop* loop,
+	                                                  freerdp_peer* client, HANDLE handle);
+	FREERDP_API BOOL freerdp_event_loop_remove_peer(freerdp_event_loop* loop,
+	                                                freerdp_peer* client);
+	FREERDP_API BOOL freerdp_event_loop_set_handshake_timeout(freerdp_event_loop* loop,
+	                                                          DWORD timeout);
+
 #ifdef __cplusplus
 }
 #endif
@@ -47,6 +47,7 @@ typedef struct rdp_shadow_server rdpShadowServer;
 typedef struct rdp_shadow_screen rdpShadowScreen;
 typedef struct rdp_shadow_surface rdpShadowSurface;
 typedef struct rdp_shadow_encoder rdpShadowEncoder;
+typedef struct rdp_shadow_encode_cache rdpShadowEncodeCache;
 typedef struct rdp_shadow_capture rdpShadowCapture;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
@@ -127,6 +128,7 @@ struct rdp_shadow_server
 	rdpShadowSurface* lobby;
 	rdpShadowCapture* capture;
 	rdpShadowSubsystem* subsystem;
+	rdpShadowEncodeCache* encodeCache;
 
 	DWORD port;
 	BOOL mayView;
@@ -310,6 +312,10 @@ extern "C"
 	FREERDP_API int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth,
 	                                       UINT32 nHeight, BYTE* pData2, UINT32 nStep2,
 	                                       RECTANGLE_16* rect);
+	FREERDP_API int shadow_capture_compare_region(const BYTE* pData1, UINT32 nStep1,
+	                                              UINT32 nWidth, UINT32 nHeight,
+	                                              const BYTE* pData2, UINT32 nStep2,
+	                                              REGION16* region);
 
 	FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
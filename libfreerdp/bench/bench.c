@@ -0,0 +1,604 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Primitives and Codec Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * freerdp-bench runs the primitives and the codecs on a fixed set of synthetic
+ * corpora and writes the throughput as JSON, so numbers of different builds and
+ * releases can be compared directly.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+
+#include "bench.h"
+
+#define BENCH_STREAM_SIZE (1024 * 1024)
+
+static const char* const bench_words[] = {
+	"the",     "remote", "desktop", "protocol", "session", "window",  "server",  "client",
+	"channel", "bitmap", "surface", "update",   "cursor",  "monitor", "display", "keyboard",
+	"mouse",   "file",   "folder",  "open",     "close",   "save",    "edit",    "view",
+	"of",      "and",    "to",      "in",       "is",      "for",     "with",    "on"
+};
+
+static void usage_and_exit(void)
+{
+	printf("freerdp-bench: primitives and codec benchmark\n");
+	printf("Usage: freerdp-bench [-i <iterations>] [-t <seconds>] [-s <width>x<height>] "
+	       "[-f <filter>] [-o <file>] [-l]\n");
+	printf("\t-i\tminimum number of iterations per benchmark (default 3)\n");
+	printf("\t-t\tminimum run time per benchmark in seconds (default 0.25)\n");
+	printf("\t-s\tsize of the image corpora (default 1920x1080)\n");
+	printf("\t-f\tonly run benchmarks whose group/name/variant contains <filter>\n");
+	printf("\t-o\twrite the JSON results to <file> instead of stdout\n");
+	printf("\t-l\tlist the benchmarks without running them\n");
+	exit(1);
+}
+
+/* Cheap integer hash, the corpora must be identical on every platform and build */
+static UINT32 bench_hash(UINT32 a, UINT32 b, UINT32 c)
+{
+	UINT32 h = (a * 0x9E3779B1) ^ (b * 0x85EBCA77) ^ (c * 0xC2B2AE3D);
+	h ^= h >> 15;
+	h *= 0x2C1B3C6D;
+	h ^= h >> 12;
+	return h;
+}
+
+static void bench_write_pixel(BYTE* dst, UINT32 rgb)
+{
+	dst[0] = rgb & 0xFF;
+	dst[1] = (rgb >> 8) & 0xFF;
+	dst[2] = (rgb >> 16) & 0xFF;
+	dst[3] = 0xFF;
+}
+
+/**
+ * A desktop with a task bar and overlapping windows filled with text.
+ * Glyphs only depend on the character, so repeated characters are identical.
+ */
+static UINT32 bench_desktop_pixel(UINT32 x, UINT32 y, UINT32 width, UINT32 height)
+{
+	size_t i;
+	const UINT32 windows[][4] = { { width / 10, height * 2 / 3, width / 3, height / 4 },
+		                          { width * 3 / 8, height / 3, width / 2, height / 2 },
+		                          { width / 16, height / 12, width / 2, height / 2 } };
+
+	if (y + 40 >= height)
+		return 0x245EDC;
+
+	for (i = 0; i < ARRAYSIZE(windows); i++)
+	{
+		UINT32 cx, cy, line, row, col, c;
+		const UINT32 wx = windows[i][0];
+		const UINT32 wy = windows[i][1];
+
+		if ((x < wx) || (y < wy) || (x >= wx + windows[i][2]) || (y >= wy + windows[i][3]))
+			continue;
+
+		cx = x - wx;
+		cy = y - wy;
+
+		if (cy < 24)
+		{
+			const UINT32 v = cx * 255 / windows[i][2];
+			return 0x0A246A + ((v / 2) << 16) + ((v * 3 / 4) << 8) + (v / 2);
+		}
+
+		if ((cx < 4) || (cy < 28))
+			return 0xFFFFFF;
+
+		cx -= 4;
+		cy -= 28;
+		line = cy / 16;
+		row = cy % 16;
+		col = cx % 8;
+
+		if ((row >= 12) || (col == 7))
+			return 0xFFFFFF;
+
+		c = bench_hash((UINT32)i, line, cx / 8) % 32;
+
+		if (c >= 26)
+			return 0xFFFFFF;
+
+		return ((bench_hash(c, col, row) % 3) == 0) ? 0x000000 : 0xFFFFFF;
+	}
+
+	return 0x3A6EA5;
+}
+
+/* Smooth gradients with a little grain, close to photographic content */
+static UINT32 bench_photo_pixel(UINT32 x, UINT32 y, UINT32 width, UINT32 height)
+{
+	const UINT32 grain = bench_hash(x, y, 2) % 16;
+	const UINT32 r = (x * 239 / width) + grain;
+	const UINT32 g = (y * 239 / height) + grain;
+	const UINT32 b = ((x + y) * 239 / (width + height)) + grain;
+	return (r << 16) | (g << 8) | b;
+}
+
+static UINT32 bench_noise_pixel(UINT32 x, UINT32 y, UINT32 width, UINT32 height)
+{
+	WINPR_UNUSED(width);
+	WINPR_UNUSED(height);
+	return bench_hash(x, y, 1) & 0xFFFFFF;
+}
+
+static UINT32 bench_solid_pixel(UINT32 x, UINT32 y, UINT32 width, UINT32 height)
+{
+	WINPR_UNUSED(x);
+	WINPR_UNUSED(y);
+	WINPR_UNUSED(width);
+	WINPR_UNUSED(height);
+	return 0x3A6EA5;
+}
+
+static BOOL bench_image_init(BENCH_IMAGE* image, const char* name, UINT32 width, UINT32 height,
+                             UINT32 (*pixel)(UINT32, UINT32, UINT32, UINT32))
+{
+	UINT32 x, y;
+	image->name = name;
+	image->width = width;
+	image->height = height;
+	image->stride = width * 4;
+	/* some SIMD routines read a few bytes past the end of a line */
+	image->data = _aligned_malloc(1ull * image->stride * height + 64, 32);
+
+	if (!image->data)
+		return FALSE;
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* line = &image->data[1ull * y * image->stride];
+
+		for (x = 0; x < width; x++)
+			bench_write_pixel(&line[x * 4], pixel(x, y, width, height));
+	}
+
+	return TRUE;
+}
+
+/* Word salad as a stand in for the text heavy PDUs seen by the bulk compressors */
+static BOOL bench_text_stream_init(BENCH_STREAM* stream)
+{
+	UINT32 pos = 0;
+	UINT32 index = 0;
+	stream->name = "text";
+	stream->size = BENCH_STREAM_SIZE;
+	stream->data = malloc(stream->size);
+
+	if (!stream->data)
+		return FALSE;
+
+	while (pos < stream->size)
+	{
+		const UINT32 h = bench_hash(index++, 0, 3);
+		const char* word = bench_words[h % ARRAYSIZE(bench_words)];
+		const char separator = ((h >> 8) % 12 == 0) ? '\n' : ' ';
+		size_t len = strlen(word);
+
+		if (len > stream->size - pos)
+			len = stream->size - pos;
+
+		memcpy(&stream->data[pos], word, len);
+		pos += (UINT32)len;
+
+		if (pos < stream->size)
+			stream->data[pos++] = (BYTE)separator;
+	}
+
+	return TRUE;
+}
+
+/* The first lines of the desktop image, similar to uncompressed bitmap updates */
+static BOOL bench_bitmap_stream_init(BENCH_STREAM* stream, const BENCH_IMAGE* image)
+{
+	const size_t available = 1ull * image->stride * image->height;
+	stream->name = "desktop";
+	stream->size = BENCH_STREAM_SIZE;
+
+	if (available < stream->size)
+		stream->size = (UINT32)available;
+
+	stream->data = malloc(stream->size);
+
+	if (!stream->data)
+		return FALSE;
+
+	memcpy(stream->data, image->data, stream->size);
+	return TRUE;
+}
+
+static BOOL bench_corpora_init(BENCH_CONTEXT* bench)
+{
+	const UINT32 w = bench->width;
+	const UINT32 h = bench->height;
+
+	if (!bench_image_init(&bench->images[0], "desktop", w, h, bench_desktop_pixel) ||
+	    !bench_image_init(&bench->images[1], "photo", w, h, bench_photo_pixel) ||
+	    !bench_image_init(&bench->images[2], "noise", w, h, bench_noise_pixel) ||
+	    !bench_image_init(&bench->images[3], "solid", w, h, bench_solid_pixel))
+		return FALSE;
+
+	if (!bench_text_stream_init(&bench->streams[0]) ||
+	    !bench_bitmap_stream_init(&bench->streams[1], &bench->images[0]))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void bench_corpora_free(BENCH_CONTEXT* bench)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(bench->images); i++)
+		_aligned_free(bench->images[i].data);
+
+	for (i = 0; i < ARRAYSIZE(bench->streams); i++)
+		free(bench->streams[i].data);
+}
+
+static void bench_write_string(FILE* fp, const char* str)
+{
+	const char* cur;
+	fputc('"', fp);
+
+	for (cur = str ? str : ""; *cur; cur++)
+	{
+		const unsigned char c = (unsigned char)*cur;
+
+		switch (c)
+		{
+			case '"':
+				fputs("\\\"", fp);
+				break;
+
+			case '\\':
+				fputs("\\\\", fp);
+				break;
+
+			case '\n':
+				fputs("\\n", fp);
+				break;
+
+			case '\r':
+				fputs("\\r", fp);
+				break;
+
+			case '\t':
+				fputs("\\t", fp);
+				break;
+
+			default:
+				if (c < 0x20)
+					fprintf(fp, "\\u%04x", c);
+				else
+					fputc(c, fp);
+
+				break;
+		}
+	}
+
+	fputc('"', fp);
+}
+
+static const char* bench_bool(DWORD feature)
+{
+	return IsProcessorFeaturePresentEx(feature) ? "true" : "false";
+}
+
+static void bench_write_header(BENCH_CONTEXT* bench)
+{
+	FILE* fp = bench->out;
+	fprintf(fp, "{\n  \"version\": ");
+	bench_write_string(fp, freerdp_get_version_string());
+	fprintf(fp, ",\n  \"revision\": ");
+	bench_write_string(fp, freerdp_get_build_revision());
+	fprintf(fp, ",\n  \"build_config\": ");
+	bench_write_string(fp, freerdp_get_build_config());
+	fprintf(fp,
+	        ",\n  \"cpu\": { \"sse2\": %s, \"sse3\": %s, \"ssse3\": %s, \"sse41\": %s, "
+	        "\"avx2\": %s, \"avx512f\": %s, \"avx512bw\": %s, \"neon\": %s }",
+	        IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE) ? "true" : "false",
+	        IsProcessorFeaturePresent(PF_SSE3_INSTRUCTIONS_AVAILABLE) ? "true" : "false",
+	        bench_bool(PF_EX_SSSE3), bench_bool(PF_EX_SSE41), bench_bool(PF_EX_AVX2),
+	        bench_bool(PF_EX_AVX512F), bench_bool(PF_EX_AVX512BW),
+	        IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE) ? "true" : "false");
+	fprintf(fp,
+	        ",\n  \"settings\": { \"width\": %" PRIu32 ", \"height\": %" PRIu32
+	        ", \"min_iterations\": %" PRIu32 ", \"min_seconds\": %.3f }",
+	        bench->width, bench->height, bench->minIterations, bench->minSeconds);
+	fprintf(fp, ",\n  \"results\": [");
+}
+
+static void bench_write_footer(BENCH_CONTEXT* bench)
+{
+	fprintf(bench->out, "\n  ]\n}\n");
+}
+
+static void bench_begin_result(BENCH_CONTEXT* bench, const char* group, const char* name,
+                               const char* variant)
+{
+	FILE* fp = bench->out;
+	fprintf(fp, "%s\n    { \"group\": ", (bench->results++ > 0) ? "," : "");
+	bench_write_string(fp, group);
+	fprintf(fp, ", \"name\": ");
+	bench_write_string(fp, name);
+	fprintf(fp, ", \"variant\": ");
+	bench_write_string(fp, variant);
+}
+
+BOOL bench_enabled(BENCH_CONTEXT* bench, const char* group, const char* name,
+                   const char* variant)
+{
+	char key[256];
+	_snprintf(key, sizeof(key), "%s/%s/%s", group, name, variant);
+
+	if (bench->filter && !strstr(key, bench->filter))
+		return FALSE;
+
+	if (bench->list)
+	{
+		printf("%s\n", key);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOL bench_measure(BENCH_CONTEXT* bench, bench_fn_t fn, void* arg, UINT32* pIterations,
+                   double* pSeconds)
+{
+	UINT32 iterations = 0;
+
+	if (!fn(arg))
+		return FALSE;
+
+	stopwatch_reset(bench->stopwatch);
+
+	while ((iterations < bench->minIterations) ||
+	       (stopwatch_get_elapsed_time_in_seconds(bench->stopwatch) < bench->minSeconds))
+	{
+		BOOL rc;
+		stopwatch_start(bench->stopwatch);
+		rc = fn(arg);
+		stopwatch_stop(bench->stopwatch);
+
+		if (!rc)
+			return FALSE;
+
+		iterations++;
+	}
+
+	*pIterations = iterations;
+	*pSeconds = stopwatch_get_elapsed_time_in_seconds(bench->stopwatch);
+	return TRUE;
+}
+
+void bench_report(BENCH_CONTEXT* bench, const char* group, const char* name,
+                  const char* variant, const char* corpus, UINT32 width, UINT32 height,
+                  UINT64 bytes, UINT64 pixels, UINT64 compressed, UINT32 iterations,
+                  double seconds)
+{
+	FILE* fp = bench->out;
+	/* guard against a timer that did not advance */
+	const double s = (seconds > 0.0) ? seconds : 1e-6;
+	bench_begin_result(bench, group, name, variant);
+	fprintf(fp, ", \"corpus\": ");
+	bench_write_string(fp, corpus);
+	fprintf(fp,
+	        ", \"width\": %" PRIu32 ", \"height\": %" PRIu32 ", \"iterations\": %" PRIu32
+	        ", \"seconds\": %.6f, \"mb_per_s\": %.3f",
+	        width, height, iterations, seconds, (double)bytes * iterations / s / 1000000.0);
+
+	if (pixels > 0)
+		fprintf(fp, ", \"pixels_per_s\": %.0f", (double)pixels * iterations / s);
+	else
+		fprintf(fp, ", \"pixels_per_s\": null");
+
+	if (compressed > 0)
+		fprintf(fp, ", \"ratio\": %.4f }", (double)bytes / (double)compressed);
+	else
+		fprintf(fp, ", \"ratio\": null }");
+
+	fflush(fp);
+}
+
+void bench_report_ops(BENCH_CONTEXT* bench, const char* group, const char* name,
+                      const char* variant, UINT32 threads, UINT64 ops, UINT32 iterations,
+                      double seconds)
+{
+	FILE* fp = bench->out;
+	const double s = (seconds > 0.0) ? seconds : 1e-6;
+	bench_begin_result(bench, group, name, variant);
+	fprintf(fp,
+	        ", \"threads\": %" PRIu32 ", \"iterations\": %" PRIu32
+	        ", \"seconds\": %.6f, \"ops_per_s\": %.0f }",
+	        threads, iterations, seconds, (double)ops * iterations / s);
+	fflush(fp);
+}
+
+void bench_report_skipped(BENCH_CONTEXT* bench, const char* group, const char* name,
+                          const char* variant, const char* reason)
+{
+	bench_begin_result(bench, group, name, variant);
+	fprintf(bench->out, ", \"skipped\": ");
+	bench_write_string(bench->out, reason);
+	fprintf(bench->out, " }");
+	fflush(bench->out);
+}
+
+static BOOL bench_parse_size(const char* str, UINT32* pWidth, UINT32* pHeight)
+{
+	char* end = NULL;
+	unsigned long width, height;
+	errno = 0;
+	width = strtoul(str, &end, 10);
+
+	if ((errno != 0) || !end || ((*end != 'x') && (*end != 'X')))
+		return FALSE;
+
+	height = strtoul(end + 1, &end, 10);
+
+	if ((errno != 0) || !end || (*end != '\0'))
+		return FALSE;
+
+	/* interleaved needs a width that is a multiple of 4, the YUV primitives even sizes */
+	if ((width < 64) || (height < 64) || (width > 8192) || (height > 8192) || (width % 4) ||
+	    (height % 2))
+		return FALSE;
+
+	*pWidth = (UINT32)width;
+	*pHeight = (UINT32)height;
+	return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+	int index;
+	int rc = 1;
+	const char* output = NULL;
+	BENCH_CONTEXT bench = { 0 };
+	bench.minIterations = 3;
+	bench.minSeconds = 0.25;
+	bench.width = 1920;
+	bench.height = 1080;
+	bench.out = stdout;
+
+	for (index = 1; index < argc; index++)
+	{
+		const char* arg = argv[index];
+
+		if (strcmp("-l", arg) == 0)
+		{
+			bench.list = TRUE;
+			continue;
+		}
+		else if ((strcmp("-h", arg) == 0) || (strcmp("--help", arg) == 0))
+		{
+			usage_and_exit();
+		}
+
+		if ((strcmp("-i", arg) != 0) && (strcmp("-t", arg) != 0) && (strcmp("-s", arg) != 0) &&
+		    (strcmp("-f", arg) != 0) && (strcmp("-o", arg) != 0))
+		{
+			printf("unknown option '%s'\n\n", arg);
+			usage_and_exit();
+		}
+
+		if (++index == argc)
+		{
+			printf("missing value for '%s'\n\n", arg);
+			usage_and_exit();
+		}
+
+		if (strcmp("-i", arg) == 0)
+		{
+			char* end = NULL;
+			unsigned long val;
+			errno = 0;
+			val = strtoul(argv[index], &end, 10);
+
+			if ((errno != 0) || !end || (*end != '\0') || (val == 0) || (val > UINT32_MAX))
+			{
+				printf("invalid iteration count '%s'\n\n", argv[index]);
+				usage_and_exit();
+			}
+
+			bench.minIterations = (UINT32)val;
+		}
+		else if (strcmp("-t", arg) == 0)
+		{
+			char* end = NULL;
+			errno = 0;
+			bench.minSeconds = strtod(argv[index], &end);
+
+			if ((errno != 0) || !end || (*end != '\0') || (bench.minSeconds < 0.0))
+			{
+				printf("invalid run time '%s'\n\n", argv[index]);
+				usage_and_exit();
+			}
+		}
+		else if (strcmp("-s", arg) == 0)
+		{
+			if (!bench_parse_size(argv[index], &bench.width, &bench.height))
+			{
+				printf("invalid size '%s', the width must be a multiple of 4, the height even "
+				       "and both within 64-8192\n\n",
+				       argv[index]);
+				usage_and_exit();
+			}
+		}
+		else if (strcmp("-f", arg) == 0)
+		{
+			bench.filter = argv[index];
+		}
+		else
+		{
+			output = argv[index];
+		}
+	}
+
+	if (!bench.list && output)
+	{
+		bench.out = fopen(output, "w");
+
+		if (!bench.out)
+		{
+			fprintf(stderr, "failed to open '%s': %s\n", output, strerror(errno));
+			return 1;
+		}
+	}
+
+	bench.stopwatch = stopwatch_create();
+
+	if (!bench.stopwatch || !bench_corpora_init(&bench))
+	{
+		fprintf(stderr, "failed to allocate the benchmark corpora\n");
+		goto fail;
+	}
+
+	if (!bench.list)
+		bench_write_header(&bench);
+
+	if (!bench_primitives(&bench) || !bench_codecs(&bench) || !bench_streams(&bench) ||
+	    !bench_tls(&bench) || !bench_wait(&bench) || !bench_wlog(&bench))
+		goto fail;
+
+	if (!bench.list)
+		bench_write_footer(&bench);
+
+	rc = 0;
+fail:
+	bench_corpora_free(&bench);
+	stopwatch_free(bench.stopwatch);
+
+	if (bench.out && (bench.out != stdout))
+		fclose(bench.out);
+
+	return rc;
+}
@@ -0,0 +1,106 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Primitives and Codec Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_BENCH_H
+#define FREERDP_BENCH_H
+
+#include <stdio.h>
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/utils/stopwatch.h>
+
+#define BENCH_IMAGE_CORPORA 4
+
+typedef BOOL (*bench_fn_t)(void* arg);
+
+/* A synthetic BGRX32 test image */
+typedef struct
+{
+	const char* name;
+	BYTE* data;
+	UINT32 width;
+	UINT32 height;
+	UINT32 stride;
+} BENCH_IMAGE;
+
+/* A synthetic byte stream for the bulk compressors */
+typedef struct
+{
+	const char* name;
+	BYTE* data;
+	UINT32 size;
+} BENCH_STREAM;
+
+typedef struct
+{
+	UINT32 minIterations;
+	double minSeconds;
+	UINT32 width;
+	UINT32 height;
+	const char* filter;
+	BOOL list;
+	FILE* out;
+	size_t results;
+	STOPWATCH* stopwatch;
+	BENCH_IMAGE images[BENCH_IMAGE_CORPORA];
+	BENCH_STREAM streams[2];
+} BENCH_CONTEXT;
+
+/**
+ * Returns TRUE if the benchmark group/name/variant passes the filter.
+ * In list mode the key is printed instead and FALSE is returned.
+ */
+BOOL bench_enabled(BENCH_CONTEXT* bench, const char* group, const char* name,
+                   const char* variant);
+
+/**
+ * Calls fn once to warm up and then repeatedly until both the minimum number of
+ * iterations and the minimum run time are reached. Only the calls are timed.
+ */
+BOOL bench_measure(BENCH_CONTEXT* bench, bench_fn_t fn, void* arg, UINT32* pIterations,
+                   double* pSeconds);
+
+/**
+ * Writes one result object. bytes and pixels are the amount of data processed by
+ * a single iteration, compressed is the encoded size (0 if not applicable).
+ */
+void bench_report(BENCH_CONTEXT* bench, const char* group, const char* name,
+                  const char* variant, const char* corpus, UINT32 width, UINT32 height,
+                  UINT64 bytes, UINT64 pixels, UINT64 compressed, UINT32 iterations,
+                  double seconds);
+
+/**
+ * Writes one result object for a benchmark that is not about data, ops is the
+ * number of operations all threads together complete in a single iteration.
+ */
+void bench_report_ops(BENCH_CONTEXT* bench, const char* group, const char* name,
+                      const char* variant, UINT32 threads, UINT64 ops, UINT32 iterations,
+                      double seconds);
+
+/* Writes a result object for a benchmark that could not run */
+void bench_report_skipped(BENCH_CONTEXT* bench, const char* group, const char* name,
+                          const char* variant, const char* reason);
+
+BOOL bench_primitives(BENCH_CONTEXT* bench);
+BOOL bench_codecs(BENCH_CONTEXT* bench);
+BOOL bench_streams(BENCH_CONTEXT* bench);
+BOOL bench_tls(BENCH_CONTEXT* bench);
+BOOL bench_wait(BENCH_CONTEXT* bench);
+BOOL bench_wlog(BENCH_CONTEXT* bench);
+
+#endif /* FREERDP_BENCH_H */
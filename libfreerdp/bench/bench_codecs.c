@@ -0,0 +1,919 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Codec Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Every codec encodes the same frame repeatedly, the decoder runs on the output
+ * of the first (cold) encode. The MB/s figures of both directions are based on
+ * the uncompressed size so they can be compared, the ratio is uncompressed size
+ * divided by the size of the first encode.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <freerdp/codec/bulk.h>
+#include <freerdp/codec/clear.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/interleaved.h>
+#include <freerdp/codec/mppc.h>
+#include <freerdp/codec/ncrush.h>
+#include <freerdp/codec/nsc.h>
+#include <freerdp/codec/planar.h>
+#include <freerdp/codec/progressive.h>
+#include <freerdp/codec/region.h>
+#include <freerdp/codec/rfx.h>
+#include <freerdp/codec/xcrush.h>
+#include <freerdp/codec/zgfx.h>
+#include <freerdp/settings.h>
+
+#include "bench.h"
+
+/* planar and interleaved are used for bitmap updates, which are sent in tiles */
+#define BENCH_TILE_SIZE 64
+
+/* the bulk compressors only handle PDUs below 16k */
+#define BENCH_BULK_CHUNK_SIZE 16383
+
+typedef struct
+{
+	const BENCH_IMAGE* image;
+	const BENCH_STREAM* stream;
+	void* encoder;
+	void* decoder;
+	wStream* s;
+	/* result of the last encode */
+	const BYTE* out;
+	UINT32 outSize;
+	/* copy of the first encode, the decoder input */
+	BYTE* encoded;
+	UINT32 encodedSize;
+	/* per tile (image codecs) or per chunk (bulk codecs) sizes and flags */
+	UINT32* sizes;
+	UINT32* flags;
+	UINT32 count;
+	BOOL capture;
+	BYTE* dst;
+	REGION16 region;
+} BENCH_CODEC_STATE;
+
+typedef struct
+{
+	const char* name;
+	BOOL (*init)(BENCH_CODEC_STATE* state);
+	void (*uninit)(BENCH_CODEC_STATE* state);
+	bench_fn_t encode;
+	bench_fn_t decode;
+} BENCH_CODEC;
+
+static UINT32 bench_tile_count(const BENCH_IMAGE* image)
+{
+	const UINT32 cols = (image->width + BENCH_TILE_SIZE - 1) / BENCH_TILE_SIZE;
+	const UINT32 rows = (image->height + BENCH_TILE_SIZE - 1) / BENCH_TILE_SIZE;
+	return cols * rows;
+}
+
+static void bench_stream_output(BENCH_CODEC_STATE* state)
+{
+	state->out = Stream_Buffer(state->s);
+	state->outSize = (UINT32)Stream_GetPosition(state->s);
+}
+
+static BOOL rfx_init(BENCH_CODEC_STATE* state)
+{
+	const BENCH_IMAGE* image = state->image;
+	RFX_CONTEXT* encoder = rfx_context_new(TRUE);
+	RFX_CONTEXT* decoder = rfx_context_new(FALSE);
+	state->encoder = encoder;
+	state->decoder = decoder;
+
+	if (!encoder || !decoder)
+		return FALSE;
+
+	rfx_context_set_pixel_format(encoder, PIXEL_FORMAT_BGRX32);
+	rfx_context_set_pixel_format(decoder, PIXEL_FORMAT_BGRX32);
+	return rfx_context_reset(encoder, image->width, image->height) &&
+	       rfx_context_reset(decoder, image->width, image->height);
+}
+
+static void rfx_uninit(BENCH_CODEC_STATE* state)
+{
+	rfx_context_free(state->encoder);
+	rfx_context_free(state->decoder);
+}
+
+static BOOL rfx_encode(void* arg)
+{
+	BOOL rc;
+	RFX_MESSAGE* message;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	const RFX_RECT rect = { 0, 0, (UINT16)image->width, (UINT16)image->height };
+	Stream_SetPosition(state->s, 0);
+	message = rfx_encode_message(state->encoder, &rect, 1, image->data, (int)image->width,
+	                             (int)image->height, (int)image->stride);
+
+	if (!message)
+		return FALSE;
+
+	rc = rfx_write_message(state->encoder, state->s, message);
+	rfx_message_free(state->encoder, message);
+	bench_stream_output(state);
+	return rc;
+}
+
+static BOOL rfx_decode(void* arg)
+{
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	region16_clear(&state->region);
+	return rfx_process_message(state->decoder, state->encoded, state->encodedSize, 0, 0,
+	                           state->dst, PIXEL_FORMAT_BGRX32, image->stride, image->height,
+	                           &state->region);
+}
+
+static BOOL nsc_init(BENCH_CODEC_STATE* state)
+{
+	const BENCH_IMAGE* image = state->image;
+	NSC_CONTEXT* encoder = nsc_context_new();
+	NSC_CONTEXT* decoder = nsc_context_new();
+	state->encoder = encoder;
+	state->decoder = decoder;
+
+	if (!encoder || !decoder)
+		return FALSE;
+
+	return nsc_context_reset(encoder, image->width, image->height) &&
+	       nsc_context_set_parameters(encoder, NSC_COLOR_FORMAT, PIXEL_FORMAT_BGRX32);
+}
+
+static void nsc_uninit(BENCH_CODEC_STATE* state)
+{
+	nsc_context_free(state->encoder);
+	nsc_context_free(state->decoder);
+}
+
+static BOOL nsc_encode(void* arg)
+{
+	BOOL rc;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	Stream_SetPosition(state->s, 0);
+	rc = nsc_compose_message(state->encoder, state->s, image->data, image->width, image->height,
+	                         image->stride);
+	bench_stream_output(state);
+	return rc;
+}
+
+static BOOL nsc_decode(void* arg)
+{
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	return nsc_process_message(state->decoder, 32, image->width, image->height, state->encoded,
+	                           state->encodedSize, state->dst, PIXEL_FORMAT_BGRX32,
+	                           image->stride, 0, 0, image->width, image->height,
+	                           FREERDP_FLIP_NONE);
+}
+
+static BOOL planar_init(BENCH_CODEC_STATE* state)
+{
+	state->encoder = freerdp_bitmap_planar_context_new(PLANAR_FORMAT_HEADER_RLE, BENCH_TILE_SIZE,
+	                                                   BENCH_TILE_SIZE);
+	state->decoder = freerdp_bitmap_planar_context_new(0, BENCH_TILE_SIZE, BENCH_TILE_SIZE);
+	return state->encoder && state->decoder;
+}
+
+static void planar_uninit(BENCH_CODEC_STATE* state)
+{
+	freerdp_bitmap_planar_context_free(state->encoder);
+	freerdp_bitmap_planar_context_free(state->decoder);
+}
+
+static BOOL planar_encode(void* arg)
+{
+	UINT32 x, y;
+	UINT32 index = 0;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	Stream_SetPosition(state->s, 0);
+
+	for (y = 0; y < image->height; y += BENCH_TILE_SIZE)
+	{
+		const UINT32 h = MIN(BENCH_TILE_SIZE, image->height - y);
+
+		for (x = 0; x < image->width; x += BENCH_TILE_SIZE)
+		{
+			const UINT32 w = MIN(BENCH_TILE_SIZE, image->width - x);
+			UINT32 size = w * h * 4 * 2 + 64;
+
+			if (!Stream_EnsureRemainingCapacity(state->s, size))
+				return FALSE;
+
+			if (!freerdp_bitmap_compress_planar(
+			        state->encoder, &image->data[1ull * y * image->stride + x * 4],
+			        PIXEL_FORMAT_BGRX32, w, h, image->stride, Stream_Pointer(state->s), &size))
+				return FALSE;
+
+			Stream_Seek(state->s, size);
+			state->sizes[index++] = size;
+		}
+	}
+
+	bench_stream_output(state);
+	return TRUE;
+}
+
+static BOOL planar_decode(void* arg)
+{
+	UINT32 x, y;
+	UINT32 index = 0;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	const BYTE* src = state->encoded;
+
+	for (y = 0; y < image->height; y += BENCH_TILE_SIZE)
+	{
+		const UINT32 h = MIN(BENCH_TILE_SIZE, image->height - y);
+
+		for (x = 0; x < image->width; x += BENCH_TILE_SIZE)
+		{
+			const UINT32 w = MIN(BENCH_TILE_SIZE, image->width - x);
+			const UINT32 size = state->sizes[index++];
+
+			if (!planar_decompress(state->decoder, src, size, w, h, state->dst,
+			                       PIXEL_FORMAT_BGRX32, image->stride, x, y, w, h, FALSE))
+				return FALSE;
+
+			src += size;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Whole frames in one call, encoded in bands of rows on the thread pool */
+static BOOL planar_mt_init(BENCH_CODEC_STATE* state)
+{
+	const BENCH_IMAGE* image = state->image;
+	state->encoder = freerdp_bitmap_planar_context_new(PLANAR_FORMAT_HEADER_RLE, image->width,
+	                                                   image->height);
+	state->decoder = freerdp_bitmap_planar_context_new(0, image->width, image->height);
+
+	if (!state->encoder || !state->decoder)
+		return FALSE;
+
+	return freerdp_bitmap_planar_context_set_threading(state->encoder, TRUE);
+}
+
+static BOOL planar_mt_encode(void* arg)
+{
+	UINT32 size;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	size = image->width * image->height * 4 * 2 + 64;
+
+	if (!Stream_EnsureCapacity(state->s, size))
+		return FALSE;
+
+	if (!freerdp_bitmap_compress_planar(state->encoder, image->data, PIXEL_FORMAT_BGRX32,
+	                                    image->width, image->height, image->stride,
+	                                    Stream_Buffer(state->s), &size))
+		return FALSE;
+
+	state->out = Stream_Buffer(state->s);
+	state->outSize = size;
+	return TRUE;
+}
+
+static BOOL planar_mt_decode(void* arg)
+{
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	return planar_decompress(state->decoder, state->encoded, state->encodedSize, image->width,
+	                         image->height, state->dst, PIXEL_FORMAT_BGRX32, image->stride, 0, 0,
+	                         image->width, image->height, TRUE);
+}
+
+static BOOL interleaved_init(BENCH_CODEC_STATE* state)
+{
+	state->encoder = bitmap_interleaved_context_new(TRUE);
+	state->decoder = bitmap_interleaved_context_new(FALSE);
+	return state->encoder && state->decoder;
+}
+
+static void interleaved_uninit(BENCH_CODEC_STATE* state)
+{
+	bitmap_interleaved_context_free(state->encoder);
+	bitmap_interleaved_context_free(state->decoder);
+}
+
+static BOOL interleaved_encode(void* arg)
+{
+	UINT32 x, y;
+	UINT32 index = 0;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	Stream_SetPosition(state->s, 0);
+
+	for (y = 0; y < image->height; y += BENCH_TILE_SIZE)
+	{
+		const UINT32 h = MIN(BENCH_TILE_SIZE, image->height - y);
+
+		for (x = 0; x < image->width; x += BENCH_TILE_SIZE)
+		{
+			const UINT32 w = MIN(BENCH_TILE_SIZE, image->width - x);
+			UINT32 size = w * h * 4 + 64;
+
+			if (!Stream_EnsureRemainingCapacity(state->s, size))
+				return FALSE;
+
+			if (!interleaved_compress(state->encoder, Stream_Pointer(state->s), &size, w, h,
+			                          image->data, PIXEL_FORMAT_BGRX32, image->stride, x, y, NULL,
+			                          24))
+				return FALSE;
+
+			Stream_Seek(state->s, size);
+			state->sizes[index++] = size;
+		}
+	}
+
+	bench_stream_output(state);
+	return TRUE;
+}
+
+static BOOL interleaved_decode(void* arg)
+{
+	UINT32 x, y;
+	UINT32 index = 0;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+	const BYTE* src = state->encoded;
+
+	for (y = 0; y < image->height; y += BENCH_TILE_SIZE)
+	{
+		const UINT32 h = MIN(BENCH_TILE_SIZE, image->height - y);
+
+		for (x = 0; x < image->width; x += BENCH_TILE_SIZE)
+		{
+			const UINT32 w = MIN(BENCH_TILE_SIZE, image->width - x);
+			const UINT32 size = state->sizes[index++];
+
+			if (!interleaved_decompress(state->decoder, src, size, w, h, 24, state->dst,
+			                            PIXEL_FORMAT_BGRX32, image->stride, x, y, w, h, NULL))
+				return FALSE;
+
+			src += size;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_init(BENCH_CODEC_STATE* state)
+{
+	state->encoder = clear_context_new(TRUE);
+	state->decoder = clear_context_new(FALSE);
+	return state->encoder && state->decoder;
+}
+
+static void clear_uninit(BENCH_CODEC_STATE* state)
+{
+	clear_context_free(state->encoder);
+	clear_context_free(state->decoder);
+}
+
+static BOOL clear_encode(void* arg)
+{
+	BYTE* data = NULL;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+
+	if (clear_compress(state->encoder, image->data, image->stride * image->height,
+	                   PIXEL_FORMAT_BGRX32, image->width, image->height, image->stride, &data,
+	                   &state->outSize) < 0)
+		return FALSE;
+
+	state->out = data;
+	return TRUE;
+}
+
+static BOOL clear_decode(void* arg)
+{
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+
+	/* the decoder checks the sequence number, every pass replays the first message */
+	if (!clear_context_reset(state->decoder))
+		return FALSE;
+
+	return clear_decompress(state->decoder, state->encoded, state->encodedSize, image->width,
+	                        image->height, state->dst, PIXEL_FORMAT_BGRX32, image->stride, 0, 0,
+	                        image->width, image->height, NULL) >= 0;
+}
+
+static BOOL progressive_init(BENCH_CODEC_STATE* state)
+{
+	const BENCH_IMAGE* image = state->image;
+	state->encoder = progressive_context_new(TRUE);
+	state->decoder = progressive_context_new(FALSE);
+
+	if (!state->encoder || !state->decoder)
+		return FALSE;
+
+	return progressive_create_surface_context(state->decoder, 0, image->width, image->height) >=
+	       0;
+}
+
+static void progressive_uninit(BENCH_CODEC_STATE* state)
+{
+	progressive_context_free(state->encoder);
+	progressive_context_free(state->decoder);
+}
+
+/* Every frame invalidates the whole surface, so each encode sends the first pass */
+static BOOL progressive_encode(void* arg)
+{
+	BYTE* data = NULL;
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	const BENCH_IMAGE* image = state->image;
+
+	if (progressive_compress(state->encoder, image->data, image->stride * image->height,
+	                         PIXEL_FORMAT_BGRX32, image->width, image->height, image->stride,
+	                         NULL, 0, &data, &state->outSize) <= 0)
+		return FALSE;
+
+	state->out = data;
+	return TRUE;
+}
+
+static BOOL progressive_decode(void* arg)
+{
+	BENCH_CODEC_STATE* state = (BENCH_CODEC_STATE*)arg;
+	return progressive_decompress(state->decoder, state->encoded, state->encodedSize, state->dst,
+	                              PIXEL_FORMAT_BGRX32, state->image->stride, 0, 0, NULL,
+	                              0) >= 0;
+}
+
+static const BENCH_CODEC bench_image_codecs[] = {
+	{ "rfx", rfx_init, rfx_uninit, rfx_encode, rfx_decode },
+	{ "nsc", nsc_init, nsc_uninit, nsc_encode, nsc_decode },
+	{ "planar", planar_init, planar_uninit, planar_encode, planar_decode },
+	{ "planar-mt", planar_mt_init, planar_uninit, planar_mt_encode, planar_mt_decode },
+	{ "interleaved", interleaved_init, interleaved_uninit, interleaved_encode,
+	  interleaved_decode },
+	{ "clear", clear_init, clear_uninit, clear_encode, clear_decode },
+	{ "progressive", progressive_init, progressive_uninit, progressive_encode,
+	  progressive_decode }
+};
+
+/**
+ * The bulk compressors keep a history across PDUs, so a pass always starts from
+ * a reset context and compresses (or decompresses) all chunks of the stream in order.
+ */
+typedef enum
+{
+	BENCH_BULK_MPPC,
+	BENCH_BULK_NCRUSH,
+	BENCH_BULK_XCRUSH,
+	BENCH_BULK_ZGFX
+} BENCH_BULK_TYPE;
+
+typedef struct
+{
+	BENCH_CODEC_STATE state;
+	BENCH_BULK_TYPE type;
+	BYTE buffer[65536];
+} BENCH_BULK_STATE;
+
+static BOOL bench_bulk_init(BENCH_BULK_STATE* bulk)
+{
+	switch (bulk->type)
+	{
+		case BENCH_BULK_MPPC:
+			bulk->state.encoder = mppc_context_new(PACKET_COMPR_TYPE_64K, TRUE);
+			bulk->state.decoder = mppc_context_new(PACKET_COMPR_TYPE_64K, FALSE);
+			break;
+
+		case BENCH_BULK_NCRUSH:
+			bulk->state.encoder = ncrush_context_new(TRUE);
+			bulk->state.decoder = ncrush_context_new(FALSE);
+			break;
+
+		case BENCH_BULK_XCRUSH:
+			bulk->state.encoder = xcrush_context_new(TRUE);
+			bulk->state.decoder = xcrush_context_new(FALSE);
+			break;
+
+		case BENCH_BULK_ZGFX:
+			bulk->state.encoder = zgfx_context_new(TRUE);
+			bulk->state.decoder = zgfx_context_new(FALSE);
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	return bulk->state.encoder && bulk->state.decoder;
+}
+
+static void bench_bulk_uninit(BENCH_BULK_STATE* bulk)
+{
+	switch (bulk->type)
+	{
+		case BENCH_BULK_MPPC:
+			mppc_context_free(bulk->state.encoder);
+			mppc_context_free(bulk->state.decoder);
+			break;
+
+		case BENCH_BULK_NCRUSH:
+			ncrush_context_free(bulk->state.encoder);
+			ncrush_context_free(bulk->state.decoder);
+			break;
+
+		case BENCH_BULK_XCRUSH:
+			xcrush_context_free(bulk->state.encoder);
+			xcrush_context_free(bulk->state.decoder);
+			break;
+
+		case BENCH_BULK_ZGFX:
+			zgfx_context_free(bulk->state.encoder);
+			zgfx_context_free(bulk->state.decoder);
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void bench_bulk_reset(BENCH_BULK_STATE* bulk, void* context)
+{
+	switch (bulk->type)
+	{
+		case BENCH_BULK_MPPC:
+			mppc_context_reset(context, FALSE);
+			break;
+
+		case BENCH_BULK_NCRUSH:
+			ncrush_context_reset(context, FALSE);
+			break;
+
+		case BENCH_BULK_XCRUSH:
+			xcrush_context_reset(context, FALSE);
+			break;
+
+		case BENCH_BULK_ZGFX:
+			zgfx_context_reset(context, FALSE);
+			break;
+
+		default:
+			break;
+	}
+}
+
+static BOOL bench_bulk_encode(void* arg)
+{
+	UINT32 index;
+	BENCH_BULK_STATE* bulk = (BENCH_BULK_STATE*)arg;
+	BENCH_CODEC_STATE* state = &bulk->state;
+	const BENCH_STREAM* stream = state->stream;
+	bench_bulk_reset(bulk, state->encoder);
+	Stream_SetPosition(state->s, 0);
+	state->outSize = 0;
+
+	for (index = 0; index < state->count; index++)
+	{
+		int status;
+		const UINT32 offset = index * BENCH_BULK_CHUNK_SIZE;
+		const UINT32 size = MIN(BENCH_BULK_CHUNK_SIZE, stream->size - offset);
+		BYTE* src = &stream->data[offset];
+		BYTE* pDstData = bulk->buffer;
+		UINT32 DstSize = sizeof(bulk->buffer);
+		UINT32 flags = 0;
+
+		switch (bulk->type)
+		{
+			case BENCH_BULK_MPPC:
+				status = mppc_compress(state->encoder, src, size, &pDstData, &DstSize, &flags);
+				break;
+
+			case BENCH_BULK_NCRUSH:
+				status = ncrush_compress(state->encoder, src, size, &pDstData, &DstSize, &flags);
+				break;
+
+			case BENCH_BULK_XCRUSH:
+				status = xcrush_compress(state->encoder, src, size, &pDstData, &DstSize, &flags);
+				break;
+
+			case BENCH_BULK_ZGFX:
+			{
+				const size_t start = Stream_GetPosition(state->s);
+				status = zgfx_compress_to_stream(state->encoder, state->s, src, size, &flags);
+				pDstData = Stream_Buffer(state->s) + start;
+				DstSize = (UINT32)(Stream_GetPosition(state->s) - start);
+				/* zgfx packets are always framed, they are passed to the decoder as is */
+				flags = PACKET_COMPRESSED;
+			}
+			break;
+
+			default:
+				return FALSE;
+		}
+
+		if (status < 0)
+			return FALSE;
+
+		if (state->capture)
+		{
+			if ((bulk->type != BENCH_BULK_ZGFX) &&
+			    !Stream_EnsureRemainingCapacity(state->s, DstSize))
+				return FALSE;
+
+			if (bulk->type != BENCH_BULK_ZGFX)
+				Stream_Write(state->s, pDstData, DstSize);
+
+			state->sizes[index] = DstSize;
+			state->flags[index] = flags;
+		}
+		else if (bulk->type == BENCH_BULK_ZGFX)
+			Stream_SetPosition(state->s, 0);
+
+		state->outSize += DstSize;
+	}
+
+	state->out = Stream_Buffer(state->s);
+	return TRUE;
+}
+
+static BOOL bench_bulk_decode(void* arg)
+{
+	UINT32 index;
+	BENCH_BULK_STATE* bulk = (BENCH_BULK_STATE*)arg;
+	BENCH_CODEC_STATE* state = &bulk->state;
+	const BENCH_STREAM* stream = state->stream;
+	BYTE* src = state->encoded;
+	bench_bulk_reset(bulk, state->decoder);
+
+	for (index = 0; index < state->count; index++)
+	{
+		int status = 0;
+		BYTE* pDstData = NULL;
+		UINT32 DstSize = 0;
+		const UINT32 size = state->sizes[index];
+		const UINT32 flags = state->flags[index];
+		const UINT32 expected =
+		    MIN(BENCH_BULK_CHUNK_SIZE, stream->size - index * BENCH_BULK_CHUNK_SIZE);
+
+		/* uncompressed PDUs are handed on as they are, see bulk_decompress */
+		if (flags & (PACKET_COMPRESSED | PACKET_AT_FRONT | PACKET_FLUSHED))
+		{
+			switch (bulk->type)
+			{
+				case BENCH_BULK_MPPC:
+					status = mppc_decompress(state->decoder, src, size, &pDstData, &DstSize, flags);
+					break;
+
+				case BENCH_BULK_NCRUSH:
+					status =
+					    ncrush_decompress(state->decoder, src, size, &pDstData, &DstSize, flags);
+					break;
+
+				case BENCH_BULK_XCRUSH:
+					status =
+					    xcrush_decompress(state->decoder, src, size, &pDstData, &DstSize, flags);
+					break;
+
+				case BENCH_BULK_ZGFX:
+					status = zgfx_decompress(state->decoder, src, size, &pDstData, &DstSize, 0);
+					free(pDstData);
+					break;
+
+				default:
+					return FALSE;
+			}
+
+			if ((status < 0) || (DstSize != expected))
+				return FALSE;
+		}
+
+		src += size;
+	}
+
+	return TRUE;
+}
+
+static const struct
+{
+	const char* name;
+	BENCH_BULK_TYPE type;
+} bench_bulk_codecs[] = { { "mppc", BENCH_BULK_MPPC },
+	                      { "ncrush", BENCH_BULK_NCRUSH },
+	                      { "xcrush", BENCH_BULK_XCRUSH },
+	                      { "zgfx", BENCH_BULK_ZGFX } };
+
+static void bench_codec_state_free(BENCH_CODEC_STATE* state)
+{
+	Stream_Free(state->s, TRUE);
+	free(state->encoded);
+	free(state->sizes);
+	free(state->flags);
+	_aligned_free(state->dst);
+	region16_uninit(&state->region);
+}
+
+/* Runs the encoder once on a fresh context and keeps the result for the decoder */
+static BOOL bench_codec_capture(BENCH_CODEC_STATE* state, bench_fn_t encode, void* arg)
+{
+	BOOL rc;
+	state->capture = TRUE;
+	rc = encode(arg);
+	state->capture = FALSE;
+
+	if (!rc || (state->outSize == 0))
+		return FALSE;
+
+	state->encoded = malloc(state->outSize);
+
+	if (!state->encoded)
+		return FALSE;
+
+	memcpy(state->encoded, state->out, state->outSize);
+	state->encodedSize = state->outSize;
+	return TRUE;
+}
+
+static void bench_codec_run(BENCH_CONTEXT* bench, BENCH_CODEC_STATE* state, const char* name,
+                            BOOL encode, BOOL decode, bench_fn_t encodeFn, bench_fn_t decodeFn,
+                            void* arg)
+{
+	size_t i;
+	const BENCH_IMAGE* image = state->image;
+	const BENCH_STREAM* stream = state->stream;
+	const char* corpus = image ? image->name : stream->name;
+	const UINT32 width = image ? image->width : 0;
+	const UINT32 height = image ? image->height : 0;
+	const UINT64 bytes = image ? 1ull * image->stride * image->height : stream->size;
+	const UINT64 pixels = 1ull * width * height;
+	const struct
+	{
+		const char* variant;
+		BOOL enabled;
+		bench_fn_t fn;
+	} passes[] = { { "encode", encode, encodeFn }, { "decode", decode, decodeFn } };
+
+	for (i = 0; i < ARRAYSIZE(passes); i++)
+	{
+		UINT32 iterations = 0;
+		double seconds = 0.0;
+
+		if (!passes[i].enabled)
+			continue;
+
+		if (!bench_measure(bench, passes[i].fn, arg, &iterations, &seconds))
+		{
+			bench_report_skipped(bench, "codecs", name, passes[i].variant, "failed");
+			continue;
+		}
+
+		bench_report(bench, "codecs", name, passes[i].variant, corpus, width, height, bytes,
+		             pixels, state->encodedSize, iterations, seconds);
+	}
+}
+
+static BOOL bench_image_codec(BENCH_CONTEXT* bench, const BENCH_CODEC* codec,
+                              const BENCH_IMAGE* image)
+{
+	BOOL rc = FALSE;
+	BENCH_CODEC_STATE state = { 0 };
+	const size_t size = 1ull * image->stride * image->height;
+	const BOOL encode = bench_enabled(bench, "codecs", codec->name, "encode");
+	const BOOL decode = bench_enabled(bench, "codecs", codec->name, "decode");
+
+	if (!encode && !decode)
+		return TRUE;
+
+	state.image = image;
+	region16_init(&state.region);
+	state.count = bench_tile_count(image);
+	state.sizes = calloc(state.count, sizeof(UINT32));
+	state.dst = _aligned_malloc(size + 64, 32);
+	state.s = Stream_New(NULL, size + 4096);
+
+	if (!state.sizes || !state.dst || !state.s)
+		goto fail;
+
+	if (!codec->init(&state) || !bench_codec_capture(&state, codec->encode, &state))
+	{
+		if (encode)
+			bench_report_skipped(bench, "codecs", codec->name, "encode", "failed");
+
+		if (decode)
+			bench_report_skipped(bench, "codecs", codec->name, "decode", "failed");
+	}
+	else
+		bench_codec_run(bench, &state, codec->name, encode, decode, codec->encode,
+		                codec->decode, &state);
+
+	codec->uninit(&state);
+	rc = TRUE;
+fail:
+	bench_codec_state_free(&state);
+	return rc;
+}
+
+static BOOL bench_bulk_codec(BENCH_CONTEXT* bench, const char* name, BENCH_BULK_TYPE type,
+                             const BENCH_STREAM* stream)
+{
+	BOOL rc = FALSE;
+	BENCH_BULK_STATE* bulk;
+	const BOOL encode = bench_enabled(bench, "codecs", name, "encode");
+	const BOOL decode = bench_enabled(bench, "codecs", name, "decode");
+
+	if (!encode && !decode)
+		return TRUE;
+
+	bulk = calloc(1, sizeof(BENCH_BULK_STATE));
+
+	if (!bulk)
+		return FALSE;
+
+	bulk->type = type;
+	bulk->state.stream = stream;
+	region16_init(&bulk->state.region);
+	bulk->state.count = (stream->size + BENCH_BULK_CHUNK_SIZE - 1) / BENCH_BULK_CHUNK_SIZE;
+	bulk->state.sizes = calloc(bulk->state.count, sizeof(UINT32));
+	bulk->state.flags = calloc(bulk->state.count, sizeof(UINT32));
+	bulk->state.s = Stream_New(NULL, stream->size + 4096);
+
+	if (!bulk->state.sizes || !bulk->state.flags || !bulk->state.s)
+		goto fail;
+
+	if (!bench_bulk_init(bulk) ||
+	    !bench_codec_capture(&bulk->state, bench_bulk_encode, bulk))
+	{
+		if (encode)
+			bench_report_skipped(bench, "codecs", name, "encode", "failed");
+
+		if (decode)
+			bench_report_skipped(bench, "codecs", name, "decode", "failed");
+	}
+	else
+		bench_codec_run(bench, &bulk->state, name, encode, decode, bench_bulk_encode,
+		                bench_bulk_decode, bulk);
+
+	bench_bulk_uninit(bulk);
+	rc = TRUE;
+fail:
+	bench_codec_state_free(&bulk->state);
+	free(bulk);
+	return rc;
+}
+
+BOOL bench_codecs(BENCH_CONTEXT* bench)
+{
+	size_t i, j;
+
+	for (i = 0; i < ARRAYSIZE(bench_image_codecs); i++)
+	{
+		for (j = 0; j < ARRAYSIZE(bench->images); j++)
+		{
+			if (!bench_image_codec(bench, &bench_image_codecs[i], &bench->images[j]))
+				return FALSE;
+
+			/* list every benchmark once, not once per corpus */
+			if (bench->list)
+				break;
+		}
+	}
+
+	for (i = 0; i < ARRAYSIZE(bench_bulk_codecs); i++)
+	{
+		for (j = 0; j < ARRAYSIZE(bench->streams); j++)
+		{
+			if (!bench_bulk_codec(bench, bench_bulk_codecs[i].name, bench_bulk_codecs[i].type,
+			                      &bench->streams[j]))
+				return FALSE;
+
+			if (bench->list)
+				break;
+		}
+	}
+
+	return TRUE;
+}
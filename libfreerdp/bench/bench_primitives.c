@@ -0,0 +1,476 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Primitives Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include <winpr/crt.h>
+
+#include <freerdp/primitives.h>
+
+#include "bench.h"
+
+/* All primitives run on the photo corpus, their speed hardly depends on the content */
+#define BENCH_PRIM_CORPUS 1
+
+typedef struct
+{
+	const BENCH_IMAGE* image;
+	prim_size_t roi;
+	UINT32 len;
+	BYTE* alpha;
+	BYTE* dst;
+	INT16* rgb16[3];
+	INT16* ycbcr16[3];
+	INT16* dst16[3];
+	BYTE* yuv420[3];
+	BYTE* aux420[3];
+	UINT32 yuv420Step[3];
+	BYTE* yuv444[3];
+	UINT32 yuv444Step[3];
+} BENCH_PRIM_DATA;
+
+typedef struct
+{
+	const char* name;
+	size_t offset;
+	/* bytes read per pixel, used for the MB/s figure */
+	double bytesPerPixel;
+	pstatus_t (*fn)(const primitives_t* prims, BENCH_PRIM_DATA* data);
+} BENCH_PRIM_ENTRY;
+
+typedef struct
+{
+	const primitives_t* prims;
+	const BENCH_PRIM_ENTRY* entry;
+	BENCH_PRIM_DATA* data;
+} BENCH_PRIM_ARG;
+
+static pstatus_t bench_copy(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->copy(data->image->data, data->dst, (INT32)data->len * 4);
+}
+
+static pstatus_t bench_copy_8u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->copy_8u(data->image->data, data->dst, (INT32)data->len * 4);
+}
+
+static pstatus_t bench_copy_8u_AC4r(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	const BENCH_IMAGE* image = data->image;
+	return prims->copy_8u_AC4r(image->data, (INT32)image->stride, data->dst, (INT32)image->stride,
+	                           (INT32)image->width, (INT32)image->height);
+}
+
+static pstatus_t bench_set_8u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->set_8u(0xA5, data->dst, data->len * 4);
+}
+
+static pstatus_t bench_set_32s(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->set_32s(-0x5A5A5A5A, (INT32*)data->dst, data->len);
+}
+
+static pstatus_t bench_set_32u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->set_32u(0xA5A5A5A5, (UINT32*)data->dst, data->len);
+}
+
+static pstatus_t bench_zero(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->zero(data->dst, data->len * 4ull);
+}
+
+static pstatus_t bench_add_16s(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->add_16s(data->rgb16[0], data->rgb16[1], data->dst16[0], data->len);
+}
+
+static pstatus_t bench_andC_32u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->andC_32u((const UINT32*)data->image->data, 0xFFF0F0F0, (UINT32*)data->dst,
+	                       (INT32)data->len);
+}
+
+static pstatus_t bench_orC_32u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->orC_32u((const UINT32*)data->image->data, 0xFF000000, (UINT32*)data->dst,
+	                      (INT32)data->len);
+}
+
+static pstatus_t bench_lShiftC_16s(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->lShiftC_16s(data->rgb16[0], 2, data->dst16[0], data->len);
+}
+
+static pstatus_t bench_lShiftC_16u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->lShiftC_16u((const UINT16*)data->rgb16[0], 2, (UINT16*)data->dst16[0],
+	                          data->len);
+}
+
+static pstatus_t bench_rShiftC_16s(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->rShiftC_16s(data->rgb16[0], 2, data->dst16[0], data->len);
+}
+
+static pstatus_t bench_rShiftC_16u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->rShiftC_16u((const UINT16*)data->rgb16[0], 2, (UINT16*)data->dst16[0],
+	                          data->len);
+}
+
+static pstatus_t bench_shiftC_16s(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->shiftC_16s(data->rgb16[0], -2, data->dst16[0], data->len);
+}
+
+static pstatus_t bench_shiftC_16u(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->shiftC_16u((const UINT16*)data->rgb16[0], -2, (UINT16*)data->dst16[0],
+	                         data->len);
+}
+
+static pstatus_t bench_alphaComp_argb(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	const BENCH_IMAGE* image = data->image;
+	return prims->alphaComp_argb(data->alpha, image->stride, image->data, image->stride,
+	                             data->dst, image->stride, image->width, image->height);
+}
+
+static pstatus_t bench_sign_16s(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->sign_16s(data->ycbcr16[1], data->dst16[0], data->len);
+}
+
+static pstatus_t bench_yCbCrToRGB_16s8u_P3AC4R(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->yCbCrToRGB_16s8u_P3AC4R((const INT16**)data->ycbcr16, data->roi.width * 2,
+	                                      data->dst, data->image->stride, PIXEL_FORMAT_BGRX32,
+	                                      &data->roi);
+}
+
+static pstatus_t bench_yCbCrToRGB_16s16s_P3P3(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->yCbCrToRGB_16s16s_P3P3((const INT16**)data->ycbcr16,
+	                                     (INT32)data->roi.width * 2, data->dst16,
+	                                     (INT32)data->roi.width * 2, &data->roi);
+}
+
+static pstatus_t bench_RGBToYCbCr_16s16s_P3P3(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->RGBToYCbCr_16s16s_P3P3((const INT16**)data->rgb16, (INT32)data->roi.width * 2,
+	                                     data->dst16, (INT32)data->roi.width * 2, &data->roi);
+}
+
+static pstatus_t bench_RGBToRGB_16s8u_P3AC4R(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->RGBToRGB_16s8u_P3AC4R((const INT16**)data->rgb16, data->roi.width * 2,
+	                                    data->dst, data->image->stride, PIXEL_FORMAT_BGRX32,
+	                                    &data->roi);
+}
+
+static pstatus_t bench_YCoCgToRGB_8u_AC4R(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	const BENCH_IMAGE* image = data->image;
+	return prims->YCoCgToRGB_8u_AC4R(image->data, (INT32)image->stride, data->dst,
+	                                 PIXEL_FORMAT_BGRX32, (INT32)image->stride, image->width,
+	                                 image->height, 2, TRUE);
+}
+
+static pstatus_t bench_YUV420ToRGB_8u_P3AC4R(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->YUV420ToRGB_8u_P3AC4R((const BYTE**)data->yuv420, data->yuv420Step, data->dst,
+	                                    data->image->stride, PIXEL_FORMAT_BGRX32, &data->roi);
+}
+
+static pstatus_t bench_YUV444ToRGB_8u_P3AC4R(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->YUV444ToRGB_8u_P3AC4R((const BYTE**)data->yuv444, data->yuv444Step, data->dst,
+	                                    data->image->stride, PIXEL_FORMAT_BGRX32, &data->roi);
+}
+
+static pstatus_t bench_RGBToYUV420_8u_P3AC4R(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->RGBToYUV420_8u_P3AC4R(data->image->data, PIXEL_FORMAT_BGRX32,
+	                                    data->image->stride, data->yuv420, data->yuv420Step,
+	                                    &data->roi);
+}
+
+static pstatus_t bench_RGBToYUV444_8u_P3AC4R(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->RGBToYUV444_8u_P3AC4R(data->image->data, PIXEL_FORMAT_BGRX32,
+	                                    data->image->stride, data->yuv444, data->yuv444Step,
+	                                    &data->roi);
+}
+
+/* Combines a luma and a chroma (v1) frame, as the AVC444 decoder does */
+static pstatus_t bench_YUV420CombineToYUV444(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	pstatus_t status;
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)data->roi.width, (UINT16)data->roi.height };
+	status = prims->YUV420CombineToYUV444(AVC444_LUMA, (const BYTE**)data->yuv420,
+	                                      data->yuv420Step, data->roi.width, data->roi.height,
+	                                      data->yuv444, data->yuv444Step, &rect);
+
+	if (status != PRIMITIVES_SUCCESS)
+		return status;
+
+	return prims->YUV420CombineToYUV444(AVC444_CHROMAv1, (const BYTE**)data->aux420,
+	                                    data->yuv420Step, data->roi.width, data->roi.height,
+	                                    data->yuv444, data->yuv444Step, &rect);
+}
+
+static pstatus_t bench_YUV444SplitToYUV420(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->YUV444SplitToYUV420((const BYTE**)data->yuv444, data->yuv444Step, data->yuv420,
+	                                  data->yuv420Step, data->aux420, data->yuv420Step,
+	                                  &data->roi);
+}
+
+static pstatus_t bench_RGBToAVC444YUV(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->RGBToAVC444YUV(data->image->data, PIXEL_FORMAT_BGRX32, data->image->stride,
+	                             data->yuv420, data->yuv420Step, data->aux420, data->yuv420Step,
+	                             &data->roi);
+}
+
+static pstatus_t bench_RGBToAVC444YUVv2(const primitives_t* prims, BENCH_PRIM_DATA* data)
+{
+	return prims->RGBToAVC444YUVv2(data->image->data, PIXEL_FORMAT_BGRX32, data->image->stride,
+	                               data->yuv420, data->yuv420Step, data->aux420,
+	                               data->yuv420Step, &data->roi);
+}
+
+#define BENCH_PRIM(_name, _bpp) \
+	{ #_name, offsetof(primitives_t, _name), _bpp, bench_##_name }
+
+static const BENCH_PRIM_ENTRY bench_prim_entries[] = {
+	BENCH_PRIM(copy, 4.0),
+	BENCH_PRIM(copy_8u, 4.0),
+	BENCH_PRIM(copy_8u_AC4r, 4.0),
+	BENCH_PRIM(set_8u, 4.0),
+	BENCH_PRIM(set_32s, 4.0),
+	BENCH_PRIM(set_32u, 4.0),
+	BENCH_PRIM(zero, 4.0),
+	BENCH_PRIM(add_16s, 4.0),
+	BENCH_PRIM(andC_32u, 4.0),
+	BENCH_PRIM(orC_32u, 4.0),
+	BENCH_PRIM(lShiftC_16s, 2.0),
+	BENCH_PRIM(lShiftC_16u, 2.0),
+	BENCH_PRIM(rShiftC_16s, 2.0),
+	BENCH_PRIM(rShiftC_16u, 2.0),
+	BENCH_PRIM(shiftC_16s, 2.0),
+	BENCH_PRIM(shiftC_16u, 2.0),
+	BENCH_PRIM(alphaComp_argb, 8.0),
+	BENCH_PRIM(sign_16s, 2.0),
+	BENCH_PRIM(yCbCrToRGB_16s8u_P3AC4R, 6.0),
+	BENCH_PRIM(yCbCrToRGB_16s16s_P3P3, 6.0),
+	BENCH_PRIM(RGBToYCbCr_16s16s_P3P3, 6.0),
+	BENCH_PRIM(RGBToRGB_16s8u_P3AC4R, 6.0),
+	BENCH_PRIM(YCoCgToRGB_8u_AC4R, 4.0),
+	BENCH_PRIM(YUV420ToRGB_8u_P3AC4R, 1.5),
+	BENCH_PRIM(YUV444ToRGB_8u_P3AC4R, 3.0),
+	BENCH_PRIM(RGBToYUV420_8u_P3AC4R, 4.0),
+	BENCH_PRIM(RGBToYUV444_8u_P3AC4R, 4.0),
+	BENCH_PRIM(YUV420CombineToYUV444, 3.0),
+	BENCH_PRIM(YUV444SplitToYUV420, 3.0),
+	BENCH_PRIM(RGBToAVC444YUV, 4.0),
+	BENCH_PRIM(RGBToAVC444YUVv2, 4.0),
+};
+
+static BOOL bench_prim_call(void* arg)
+{
+	BENCH_PRIM_ARG* call = (BENCH_PRIM_ARG*)arg;
+	return call->entry->fn(call->prims, call->data) == PRIMITIVES_SUCCESS;
+}
+
+static void bench_prim_data_free(BENCH_PRIM_DATA* data)
+{
+	size_t i;
+	_aligned_free(data->alpha);
+	_aligned_free(data->dst);
+
+	for (i = 0; i < 3; i++)
+	{
+		_aligned_free(data->rgb16[i]);
+		_aligned_free(data->ycbcr16[i]);
+		_aligned_free(data->dst16[i]);
+		_aligned_free(data->yuv420[i]);
+		_aligned_free(data->aux420[i]);
+		_aligned_free(data->yuv444[i]);
+	}
+}
+
+static BOOL bench_prim_data_init(BENCH_PRIM_DATA* data, const BENCH_IMAGE* image)
+{
+	size_t i, x;
+	/* the SIMD routines may read or write a little past the end of the last line */
+	const size_t pixels = 1ull * image->width * image->height + 64;
+	/* the AVC444 auxiliary frame is padded to a multiple of 16 lines */
+	const size_t planeSize = 1ull * image->width * ((image->height + 15) & ~15u) + 64;
+	data->image = image;
+	data->roi.width = image->width;
+	data->roi.height = image->height;
+	data->len = image->width * image->height;
+	data->alpha = _aligned_malloc(pixels * 4, 32);
+	data->dst = _aligned_malloc(pixels * 4, 32);
+
+	if (!data->alpha || !data->dst)
+		return FALSE;
+
+	for (i = 0; i < 3; i++)
+	{
+		data->rgb16[i] = _aligned_malloc(pixels * sizeof(INT16), 32);
+		data->ycbcr16[i] = _aligned_malloc(pixels * sizeof(INT16), 32);
+		data->dst16[i] = _aligned_malloc(pixels * sizeof(INT16), 32);
+		data->yuv420[i] = _aligned_malloc(planeSize, 32);
+		data->aux420[i] = _aligned_malloc(planeSize, 32);
+		data->yuv444[i] = _aligned_malloc(planeSize, 32);
+
+		if (!data->rgb16[i] || !data->ycbcr16[i] || !data->dst16[i] || !data->yuv420[i] ||
+		    !data->aux420[i] || !data->yuv444[i])
+			return FALSE;
+
+		data->yuv420Step[i] = (i > 0) ? image->width / 2 : image->width;
+		data->yuv444Step[i] = image->width;
+		memset(data->yuv420[i], 0x80 + (int)i * 3, planeSize);
+		memset(data->aux420[i], 0x80 - (int)i * 3, planeSize);
+		memset(data->yuv444[i], 0x80 + (int)i * 5, planeSize);
+	}
+
+	/* planar 16 bit input in the ranges the RemoteFX decoder produces */
+	for (x = 0; x < pixels; x++)
+	{
+		const BYTE* src = &image->data[(x % data->len) * 4];
+
+		for (i = 0; i < 3; i++)
+		{
+			data->rgb16[i][x] = src[2 - i];
+			data->ycbcr16[i][x] = (INT16)((src[2 - i] << 4) - 2048);
+		}
+
+		/* a mix of opaque, transparent and blended pixels */
+		memcpy(&data->alpha[x * 4], src, 3);
+		data->alpha[x * 4 + 3] = (BYTE)((x % 3 == 0) ? 0xFF : (x * 7) & 0xFF);
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_prim_table(BENCH_CONTEXT* bench, const char* variant, const primitives_t* prims,
+                             const primitives_t* generic, const char* reason,
+                             BENCH_PRIM_DATA* data)
+{
+	size_t i;
+	const void* null = NULL;
+
+	for (i = 0; i < ARRAYSIZE(bench_prim_entries); i++)
+	{
+		UINT32 iterations = 0;
+		double seconds = 0.0;
+		const BENCH_PRIM_ENTRY* entry = &bench_prim_entries[i];
+		const BYTE* fn = prims ? (const BYTE*)prims + entry->offset : NULL;
+		BENCH_PRIM_ARG arg = { prims, entry, data };
+
+		if (!bench_enabled(bench, "primitives", entry->name, variant))
+			continue;
+
+		if (!prims)
+		{
+			bench_report_skipped(bench, "primitives", entry->name, variant, reason);
+			continue;
+		}
+
+		/* all members are function pointers of the same size */
+		if (memcmp(fn, &null, sizeof(__copy_t)) == 0)
+		{
+			bench_report_skipped(bench, "primitives", entry->name, variant, "not implemented");
+			continue;
+		}
+
+		if ((prims != generic) &&
+		    (memcmp(fn, (const BYTE*)generic + entry->offset, sizeof(__copy_t)) == 0))
+		{
+			bench_report_skipped(bench, "primitives", entry->name, variant,
+			                     "uses the generic implementation");
+			continue;
+		}
+
+		if (!bench_measure(bench, bench_prim_call, &arg, &iterations, &seconds))
+		{
+			bench_report_skipped(bench, "primitives", entry->name, variant, "failed");
+			continue;
+		}
+
+		bench_report(bench, "primitives", entry->name, variant, data->image->name,
+		             data->image->width, data->image->height,
+		             (UINT64)(entry->bytesPerPixel * data->len), data->len, 0, iterations,
+		             seconds);
+	}
+
+	return TRUE;
+}
+
+BOOL bench_primitives(BENCH_CONTEXT* bench)
+{
+	BOOL rc = FALSE;
+	primitives_t generic = { 0 };
+	primitives_t optimized = { 0 };
+#if defined(WITH_OPENCL)
+	primitives_t opencl = { 0 };
+#endif
+	const primitives_t* cpu = NULL;
+	const primitives_t* gpu = NULL;
+	const char* gpuReason = "not built with OpenCL";
+	BENCH_PRIM_DATA data = { 0 };
+
+	if (!bench_prim_data_init(&data, &bench->images[BENCH_PRIM_CORPUS]))
+		goto fail;
+
+	/* all tables are set up on first use of the autodetected one */
+	primitives_get();
+
+	if (!primitives_init(&generic, PRIMITIVES_PURE_SOFT))
+		goto fail;
+
+	if (primitives_init(&optimized, PRIMITIVES_ONLY_CPU))
+		cpu = &optimized;
+
+#if defined(WITH_OPENCL)
+	gpuReason = "no OpenCL device";
+
+	if (primitives_init(&opencl, PRIMITIVES_ONLY_GPU) && opencl.YUV420ToRGB_8u_P3AC4R)
+		gpu = &opencl;
+#endif
+
+	if (!bench_prim_table(bench, "generic", &generic, &generic, NULL, &data) ||
+	    !bench_prim_table(bench, "optimized", cpu, &generic, "no optimized primitives", &data) ||
+	    !bench_prim_table(bench, "opencl", gpu, &generic, gpuReason, &data))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	bench_prim_data_free(&data);
+	return rc;
+}
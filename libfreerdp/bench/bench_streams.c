@@ -0,0 +1,144 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Stream Pool Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Several threads share one stream pool and take and release streams the way
+ * the transport and the channels do per PDU, holding a few of them at a time.
+ * An operation is one take and the matching release.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+
+#include "bench.h"
+
+#define BENCH_STREAMPOOL_OPS 20000
+#define BENCH_STREAMPOOL_HELD 4
+#define BENCH_STREAMPOOL_MAX_THREADS 16
+
+typedef struct
+{
+	wStreamPool* pool;
+	UINT32 threads;
+	BOOL failed;
+} BENCH_STREAMPOOL_STATE;
+
+static DWORD WINAPI bench_streampool_thread(LPVOID arg)
+{
+	UINT32 x;
+	wStream* held[BENCH_STREAMPOOL_HELD] = { 0 };
+	BENCH_STREAMPOOL_STATE* state = (BENCH_STREAMPOOL_STATE*)arg;
+	/* A mix of input PDUs, channel chunks and fast-path updates */
+	const size_t sizes[] = { 64, 1600, 16384, 200, 1600, 4096 };
+
+	for (x = 0; x < BENCH_STREAMPOOL_OPS; x++)
+	{
+		const UINT32 slot = x % BENCH_STREAMPOOL_HELD;
+		wStream* s = StreamPool_Take(state->pool, sizes[x % ARRAYSIZE(sizes)]);
+
+		if (!s)
+		{
+			state->failed = TRUE;
+			break;
+		}
+
+		Stream_Write_UINT32(s, x);
+
+		if (held[slot])
+			Stream_Release(held[slot]);
+
+		held[slot] = s;
+	}
+
+	for (x = 0; x < BENCH_STREAMPOOL_HELD; x++)
+	{
+		if (held[x])
+			Stream_Release(held[x]);
+	}
+
+	return 0;
+}
+
+static BOOL bench_streampool_run(void* arg)
+{
+	UINT32 x;
+	UINT32 started = 0;
+	HANDLE threads[BENCH_STREAMPOOL_MAX_THREADS];
+	BENCH_STREAMPOOL_STATE* state = (BENCH_STREAMPOOL_STATE*)arg;
+
+	for (x = 0; x < state->threads; x++)
+	{
+		threads[x] = CreateThread(NULL, 0, bench_streampool_thread, state, 0, NULL);
+
+		if (!threads[x])
+		{
+			state->failed = TRUE;
+			break;
+		}
+
+		started++;
+	}
+
+	for (x = 0; x < started; x++)
+	{
+		WaitForSingleObject(threads[x], INFINITE);
+		CloseHandle(threads[x]);
+	}
+
+	return !state->failed;
+}
+
+BOOL bench_streams(BENCH_CONTEXT* bench)
+{
+	size_t i;
+	const UINT32 threads[] = { 1, 4, BENCH_STREAMPOOL_MAX_THREADS };
+
+	for (i = 0; i < ARRAYSIZE(threads); i++)
+	{
+		BOOL rc;
+		char variant[32];
+		UINT32 iterations = 0;
+		double seconds = 0.0;
+		BENCH_STREAMPOOL_STATE state = { 0 };
+		_snprintf(variant, sizeof(variant), "%" PRIu32 "-thread%s", threads[i],
+		          (threads[i] > 1) ? "s" : "");
+
+		if (!bench_enabled(bench, "winpr", "streampool", variant))
+			continue;
+
+		state.threads = threads[i];
+		state.pool = StreamPool_New(TRUE, 16384);
+
+		if (!state.pool)
+			return FALSE;
+
+		rc = bench_measure(bench, bench_streampool_run, &state, &iterations, &seconds);
+		StreamPool_Free(state.pool);
+
+		if (!rc)
+			return FALSE;
+
+		bench_report_ops(bench, "winpr", "streampool", variant, threads[i],
+		                 1ull * threads[i] * BENCH_STREAMPOOL_OPS, iterations, seconds);
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,365 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * TLS Throughput Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * A server and a client connect over loopback TCP with the library TLS code,
+ * the server writes PDU sized chunks which a client thread reads and checks.
+ * The "userspace" variant encrypts with OpenSSL, the "kernel" variant enables
+ * TlsKernelOffload and is skipped when the kernel TLS layer is not available.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/winsock.h>
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <freerdp/settings.h>
+#include <freerdp/crypto/tls.h>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifdef HAVE_LINUX_TLS_H
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+#include "bench.h"
+
+#define BENCH_TLS_PDU 16384
+#define BENCH_TLS_BYTES (8 * 1024 * 1024)
+
+static char bench_tls_hostname[] = "localhost";
+
+typedef struct
+{
+	rdpSettings* serverSettings;
+	rdpSettings* clientSettings;
+	rdpTls* server;
+	rdpTls* client;
+	SOCKET serverSocket;
+	SOCKET clientSocket;
+	BYTE* data;
+} BENCH_TLS_STATE;
+
+static char* bench_tls_pem(BIO* bio)
+{
+	char* pem;
+	char* data = NULL;
+	const long length = BIO_get_mem_data(bio, &data);
+
+	if (length <= 0)
+		return NULL;
+
+	pem = (char*)calloc((size_t)length + 1, sizeof(char));
+
+	if (pem)
+		CopyMemory(pem, data, (size_t)length);
+
+	return pem;
+}
+
+/* A throw away self signed certificate for the server */
+static BOOL bench_tls_credentials(rdpSettings* settings)
+{
+	BOOL rc = FALSE;
+	EVP_PKEY* pkey = NULL;
+	X509_NAME* name;
+	X509* x509 = X509_new();
+	BIO* keyBio = BIO_new(BIO_s_mem());
+	BIO* certBio = BIO_new(BIO_s_mem());
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+
+	if (!x509 || !keyBio || !certBio || !ctx)
+		goto out;
+
+	if ((EVP_PKEY_keygen_init(ctx) <= 0) || (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0) ||
+	    (EVP_PKEY_keygen(ctx, &pkey) <= 0))
+		goto out;
+
+	name = X509_get_subject_name(x509);
+
+	if (!X509_set_version(x509, 2) || !ASN1_INTEGER_set(X509_get_serialNumber(x509), 1) ||
+	    !X509_gmtime_adj(X509_get_notBefore(x509), 0) ||
+	    !X509_gmtime_adj(X509_get_notAfter(x509), 3600) || !X509_set_pubkey(x509, pkey) ||
+	    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const BYTE*)"localhost", -1, -1,
+	                                0) ||
+	    !X509_set_issuer_name(x509, name) || !X509_sign(x509, pkey, EVP_sha256()))
+		goto out;
+
+	if (!PEM_write_bio_PrivateKey(keyBio, pkey, NULL, NULL, 0, NULL, NULL) ||
+	    !PEM_write_bio_X509(certBio, x509))
+		goto out;
+
+	settings->PrivateKeyContent = bench_tls_pem(keyBio);
+	settings->CertificateContent = bench_tls_pem(certBio);
+	rc = settings->PrivateKeyContent && settings->CertificateContent;
+out:
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+	X509_free(x509);
+	BIO_free(keyBio);
+	BIO_free(certBio);
+	return rc;
+}
+
+static BOOL bench_tls_socketpair(SOCKET* pServer, SOCKET* pClient)
+{
+	const int on = 1;
+	struct sockaddr_in addr = { 0 };
+	socklen_t length = sizeof(addr);
+	SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	*pServer = INVALID_SOCKET;
+	*pClient = INVALID_SOCKET;
+
+	if (listener == INVALID_SOCKET)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+	    (listen(listener, 1) != 0) ||
+	    (getsockname(listener, (struct sockaddr*)&addr, &length) != 0))
+		goto out;
+
+	*pClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if ((*pClient == INVALID_SOCKET) ||
+	    (connect(*pClient, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+		goto out;
+
+	*pServer = accept(listener, NULL, NULL);
+
+	if (*pServer == INVALID_SOCKET)
+		goto out;
+
+	/* like freerdp_tcp_connect and the listener do */
+	setsockopt(*pServer, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+	setsockopt(*pClient, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+out:
+	closesocket(listener);
+	return (*pServer != INVALID_SOCKET) && (*pClient != INVALID_SOCKET);
+}
+
+static BOOL bench_tls_offloaded(SOCKET s)
+{
+#ifdef HAVE_LINUX_TLS_H
+	struct tls12_crypto_info_aes_gcm_256 info;
+	socklen_t length = sizeof(info);
+	const BOOL rc = getsockopt(s, SOL_TLS, TLS_TX, &info, &length) == 0;
+	SecureZeroMemory(&info, sizeof(info));
+	return rc;
+#else
+	WINPR_UNUSED(s);
+	return FALSE;
+#endif
+}
+
+static DWORD WINAPI bench_tls_client_thread(LPVOID arg)
+{
+	int status;
+	size_t offset = 0;
+	BOOL mismatch = FALSE;
+	BYTE buffer[BENCH_TLS_PDU];
+	BENCH_TLS_STATE* state = (BENCH_TLS_STATE*)arg;
+	BIO* bio = BIO_new_socket((int)state->clientSocket, BIO_NOCLOSE);
+
+	if (!bio)
+		return 1;
+
+	if (tls_connect(state->client, bio) < 1)
+	{
+		/* Do not leave the server waiting for the handshake */
+		shutdown(state->clientSocket, SD_BOTH);
+		return 1;
+	}
+
+	/* Check everything against the data written until the server closes the connection,
+	 * every iteration of the measurement writes the whole buffer again */
+	do
+	{
+		status = BIO_read(state->client->bio, buffer, sizeof(buffer));
+
+		if (status > 0)
+		{
+			const size_t length = (size_t)status;
+			const size_t first = MIN(length, BENCH_TLS_BYTES - offset);
+
+			if ((memcmp(buffer, &state->data[offset], first) != 0) ||
+			    (memcmp(&buffer[first], state->data, length - first) != 0))
+				mismatch = TRUE;
+
+			offset = (offset + length) % BENCH_TLS_BYTES;
+		}
+	} while ((status > 0) || BIO_should_retry(state->client->bio));
+
+	if (mismatch)
+	{
+		fprintf(stderr, "crypto/tls-write: the client received corrupted data\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static BOOL bench_tls_write(void* arg)
+{
+	size_t offset;
+	BENCH_TLS_STATE* state = (BENCH_TLS_STATE*)arg;
+
+	for (offset = 0; offset < BENCH_TLS_BYTES; offset += BENCH_TLS_PDU)
+	{
+		if (tls_write_all(state->server, &state->data[offset], BENCH_TLS_PDU) != BENCH_TLS_PDU)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_tls_run(BENCH_CONTEXT* bench, BENCH_TLS_STATE* state, const char* variant,
+                          BOOL offload)
+{
+	BOOL rc = FALSE;
+	BIO* bio;
+	HANDLE thread = NULL;
+	UINT32 iterations = 0;
+	double seconds = 0.0;
+
+	if (!bench_tls_socketpair(&state->serverSocket, &state->clientSocket))
+		goto out;
+
+	state->serverSettings->TlsKernelOffload = offload;
+	state->clientSettings->TlsKernelOffload = FALSE;
+	state->server = tls_new(state->serverSettings);
+	state->client = tls_new(state->clientSettings);
+
+	if (!state->server || !state->client)
+		goto out;
+
+	state->client->hostname = bench_tls_hostname;
+	state->client->port = 3389;
+	thread = CreateThread(NULL, 0, bench_tls_client_thread, state, 0, NULL);
+	bio = BIO_new_socket((int)state->serverSocket, BIO_NOCLOSE);
+
+	if (!thread || !bio)
+		goto out;
+
+	if (!tls_accept(state->server, bio, state->serverSettings))
+		goto out;
+
+	if (offload && !bench_tls_offloaded(state->serverSocket))
+	{
+		bench_report_skipped(bench, "crypto", "tls-write", variant,
+		                     "kernel TLS offload not available");
+		rc = TRUE;
+		goto out;
+	}
+
+	if (!bench_measure(bench, bench_tls_write, state, &iterations, &seconds))
+		goto out;
+
+	bench_report(bench, "crypto", "tls-write", variant, "loopback", 0, 0, BENCH_TLS_BYTES, 0, 0,
+	             iterations, seconds);
+	rc = TRUE;
+out:
+	/* Unblocks the reading client */
+	if (state->serverSocket != INVALID_SOCKET)
+		shutdown(state->serverSocket, SD_BOTH);
+
+	if (thread)
+	{
+		DWORD exitCode = 0;
+		WaitForSingleObject(thread, INFINITE);
+
+		/* A client that saw other bytes than the server wrote fails the run */
+		if (rc && (!GetExitCodeThread(thread, &exitCode) || (exitCode != 0)))
+			rc = FALSE;
+
+		CloseHandle(thread);
+	}
+
+	tls_free(state->client);
+	tls_free(state->server);
+	state->client = NULL;
+	state->server = NULL;
+
+	if (state->serverSocket != INVALID_SOCKET)
+		closesocket(state->serverSocket);
+
+	if (state->clientSocket != INVALID_SOCKET)
+		closesocket(state->clientSocket);
+
+	return rc;
+}
+
+BOOL bench_tls(BENCH_CONTEXT* bench)
+{
+	size_t i;
+	BOOL rc = FALSE;
+	WSADATA wsaData;
+	BENCH_TLS_STATE state = { 0 };
+	const BOOL run[] = { bench_enabled(bench, "crypto", "tls-write", "userspace"),
+		                 bench_enabled(bench, "crypto", "tls-write", "kernel") };
+
+	if (!run[0] && !run[1])
+		return TRUE;
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return FALSE;
+
+	state.serverSettings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
+	state.clientSettings = freerdp_settings_new(0);
+	state.data = (BYTE*)malloc(BENCH_TLS_BYTES);
+
+	if (!state.serverSettings || !state.clientSettings || !state.data)
+		goto out;
+
+	for (i = 0; i < BENCH_TLS_BYTES; i++)
+		state.data[i] = (BYTE)((i * 2654435761u) >> 24);
+
+	state.clientSettings->IgnoreCertificate = TRUE;
+
+	if (!bench_tls_credentials(state.serverSettings))
+		goto out;
+
+	if (run[0] && !bench_tls_run(bench, &state, "userspace", FALSE))
+		goto out;
+
+	if (run[1] && !bench_tls_run(bench, &state, "kernel", TRUE))
+		goto out;
+
+	rc = TRUE;
+out:
+	free(state.data);
+	freerdp_settings_free(state.clientSettings);
+	freerdp_settings_free(state.serverSettings);
+	WSACleanup();
+	return rc;
+}
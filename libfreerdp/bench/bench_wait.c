@@ -0,0 +1,153 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Wait Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * A set of events is waited on the way a main loop does, with the last event
+ * signaled before every wait. An operation is one SetEvent, one wait that
+ * returns the event and one ResetEvent, both paths make the same three
+ * system calls for it.
+ * The "poll" variants use WaitForMultipleObjects, which passes every handle
+ * to the kernel on each call, the "waitset" variants keep them registered.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include "bench.h"
+
+#define BENCH_WAIT_OPS 10000
+#define BENCH_WAIT_MAX_HANDLES 1024
+
+typedef struct
+{
+	DWORD count;
+	HANDLE handles[BENCH_WAIT_MAX_HANDLES];
+	WINPR_WAIT_SET* set;
+} BENCH_WAIT_STATE;
+
+static BOOL bench_wait_poll(void* arg)
+{
+	UINT32 x;
+	BENCH_WAIT_STATE* state = (BENCH_WAIT_STATE*)arg;
+	HANDLE signaled = state->handles[state->count - 1];
+
+	for (x = 0; x < BENCH_WAIT_OPS; x++)
+	{
+		SetEvent(signaled);
+
+		if (WaitForMultipleObjects(state->count, state->handles, FALSE, INFINITE) !=
+		    WAIT_OBJECT_0 + state->count - 1)
+			return FALSE;
+
+		ResetEvent(signaled);
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_wait_set(void* arg)
+{
+	UINT32 x;
+	DWORD ready;
+	HANDLE handle;
+	BENCH_WAIT_STATE* state = (BENCH_WAIT_STATE*)arg;
+	HANDLE signaled = state->handles[state->count - 1];
+
+	for (x = 0; x < BENCH_WAIT_OPS; x++)
+	{
+		SetEvent(signaled);
+
+		if ((WaitForWaitSet(state->set, INFINITE, &handle, 1, &ready) != WAIT_OBJECT_0) ||
+		    (handle != signaled))
+			return FALSE;
+
+		ResetEvent(signaled);
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_wait_run(BENCH_CONTEXT* bench, DWORD count, BOOL waitset)
+{
+	DWORD x;
+	BOOL rc = FALSE;
+	char variant[32];
+	UINT32 iterations = 0;
+	double seconds = 0.0;
+	BENCH_WAIT_STATE* state;
+
+	_snprintf(variant, sizeof(variant), "%s-%" PRIu32, waitset ? "waitset" : "poll", count);
+
+	if (!bench_enabled(bench, "winpr", "wait", variant))
+		return TRUE;
+
+	if (!(state = (BENCH_WAIT_STATE*)calloc(1, sizeof(BENCH_WAIT_STATE))))
+		return FALSE;
+
+	state->count = count;
+
+	if (waitset && !(state->set = CreateWaitSet()))
+		goto out;
+
+	for (x = 0; x < count; x++)
+	{
+		if (!(state->handles[x] = CreateEvent(NULL, TRUE, FALSE, NULL)))
+			goto out;
+
+		if (waitset && !WaitSetAddHandle(state->set, state->handles[x]))
+			goto out;
+	}
+
+	if (!bench_measure(bench, waitset ? bench_wait_set : bench_wait_poll, state, &iterations,
+	                   &seconds))
+		goto out;
+
+	bench_report_ops(bench, "winpr", "wait", variant, 1, BENCH_WAIT_OPS, iterations, seconds);
+	rc = TRUE;
+out:
+	FreeWaitSet(state->set);
+
+	for (x = 0; x < count; x++)
+	{
+		if (state->handles[x])
+			CloseHandle(state->handles[x]);
+	}
+
+	free(state);
+	return rc;
+}
+
+BOOL bench_wait(BENCH_CONTEXT* bench)
+{
+	size_t i;
+	const DWORD counts[] = { 4, MAXIMUM_WAIT_OBJECTS };
+
+	for (i = 0; i < ARRAYSIZE(counts); i++)
+	{
+		if (!bench_wait_run(bench, counts[i], FALSE) || !bench_wait_run(bench, counts[i], TRUE))
+			return FALSE;
+	}
+
+#ifndef _WIN32
+	/* More handles than WaitForMultipleObjects accepts */
+	if (!bench_wait_run(bench, BENCH_WAIT_MAX_HANDLES, TRUE))
+		return FALSE;
+#endif
+	return TRUE;
+}
@@ -0,0 +1,133 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Logging Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Latency of a logging call as seen by the thread that logs, an operation is
+ * one formatted message written with the file appender.
+ * The "disabled" variant logs below the level of the logger, the "sync"
+ * variant formats and writes on the calling thread and "async" only copies
+ * the message into the ring of the thread. Messages that find the ring full
+ * are dropped, "async-flush" includes the time to write everything out.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/wlog.h>
+
+#include "bench.h"
+
+#define BENCH_WLOG_OPS 256
+#define BENCH_WLOG_FILE "freerdp-bench-wlog.log"
+
+typedef struct
+{
+	wLog* log;
+	DWORD level;
+	BOOL flush;
+} BENCH_WLOG_STATE;
+
+static BOOL bench_wlog_print(void* arg)
+{
+	UINT32 x;
+	BENCH_WLOG_STATE* state = (BENCH_WLOG_STATE*)arg;
+
+	for (x = 0; x < BENCH_WLOG_OPS; x++)
+		WLog_Print(state->log, state->level, "sent %" PRIu32 " bytes on channel %s", x, "rdpgfx");
+
+	if (state->flush)
+		return WLog_Flush();
+
+	return TRUE;
+}
+
+static BOOL bench_wlog_run(BENCH_CONTEXT* bench, BENCH_WLOG_STATE* state, const char* variant,
+                           BOOL async)
+{
+	BOOL rc;
+	UINT32 iterations = 0;
+	double seconds = 0.0;
+
+	if (!bench_enabled(bench, "winpr", "wlog", variant))
+		return TRUE;
+
+	if (!WLog_SetAsync(async))
+		return FALSE;
+
+	rc = bench_measure(bench, bench_wlog_print, state, &iterations, &seconds);
+	WLog_SetAsync(FALSE);
+
+	if (!rc)
+		return FALSE;
+
+	bench_report_ops(bench, "winpr", "wlog", variant, 1, BENCH_WLOG_OPS, iterations, seconds);
+	return TRUE;
+}
+
+BOOL bench_wlog(BENCH_CONTEXT* bench)
+{
+	BOOL rc = FALSE;
+	char* path = NULL;
+	char* file = NULL;
+	BENCH_WLOG_STATE state = { 0 };
+	wLogAppender* appender;
+
+	if (!(path = GetKnownPath(KNOWN_PATH_TEMP)) || !(file = GetCombinedPath(path, BENCH_WLOG_FILE)))
+		goto out;
+
+	/* A logger of its own, the output of everything else stays where it was */
+	if (!(state.log = WLog_Get("com.freerdp.bench.wlog")) ||
+	    !WLog_SetLogAppenderType(state.log, WLOG_APPENDER_FILE) ||
+	    !(appender = WLog_GetLogAppender(state.log)) ||
+	    !WLog_ConfigureAppender(appender, "outputfilepath", path) ||
+	    !WLog_ConfigureAppender(appender, "outputfilename", BENCH_WLOG_FILE) ||
+	    !WLog_SetLogLevel(state.log, WLOG_DEBUG))
+		goto out;
+
+	state.level = WLOG_TRACE;
+
+	if (!bench_wlog_run(bench, &state, "disabled", FALSE))
+		goto out;
+
+	state.level = WLOG_DEBUG;
+
+	if (!bench_wlog_run(bench, &state, "sync", FALSE) ||
+	    !bench_wlog_run(bench, &state, "async", TRUE))
+		goto out;
+
+	state.flush = TRUE;
+
+	if (!bench_wlog_run(bench, &state, "async-flush", TRUE))
+		goto out;
+
+	rc = TRUE;
+out:
+	if (state.log)
+	{
+		WLog_CloseAppender(state.log);
+		WLog_SetLogLevel(state.log, WLOG_OFF);
+	}
+
+	if (file)
+		DeleteFileA(file);
+
+	free(file);
+	free(path);
+	return rc;
+}
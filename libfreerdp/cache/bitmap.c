@@ -37,12 +37,17 @@
 #include "../core/graphics.h"
 
 #include "bitmap.h"
+#include "persistent.h"
 
 #define TAG FREERDP_TAG("cache.bitmap")
 
 static rdpBitmap* bitmap_cache_get(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index);
 static BOOL bitmap_cache_put(rdpBitmapCache* bitmap_cache, UINT32 id, UINT32 index,
                              rdpBitmap* bitmap);
+static rdpBitmap* bitmap_cache_load(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index);
+static void bitmap_cache_persist(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index,
+                                 const rdpBitmap* bitmap, UINT32 key1, UINT32 key2);
+static void bitmap_cache_release(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index);
 
 static BOOL update_gdi_memblt(rdpContext* context, MEMBLT_ORDER* memblt)
 {
@@ -52,8 +57,13 @@ static BOOL update_gdi_memblt(rdpContext* context, MEMBLT_ORDER* memblt)
 	if (memblt->cacheId == 0xFF)
 		bitmap = offscreen_cache_get(cache->offscreen, memblt->cacheIndex);
 	else
+	{
 		bitmap = bitmap_cache_get(cache->bitmap, (BYTE)memblt->cacheId, memblt->cacheIndex);
 
+		if (!bitmap)
+			bitmap = bitmap_cache_load(cache->bitmap, (BYTE)memblt->cacheId, memblt->cacheIndex);
+	}
+
 	/* XP-SP2 servers sometimes ask for cached bitmaps they've never defined. */
 	if (bitmap == NULL)
 		return TRUE;
@@ -73,8 +83,13 @@ static BOOL update_gdi_mem3blt(rdpContext* context, MEM3BLT_ORDER* mem3blt)
 	if (mem3blt->cacheId == 0xFF)
 		bitmap = offscreen_cache_get(cache->offscreen, mem3blt->cacheIndex);
 	else
+	{
 		bitmap = bitmap_cache_get(cache->bitmap, (BYTE)mem3blt->cacheId, mem3blt->cacheIndex);
 
+		if (!bitmap)
+			bitmap = bitmap_cache_load(cache->bitmap, (BYTE)mem3blt->cacheId, mem3blt->cacheIndex);
+	}
+
 	/* XP-SP2 servers sometimes ask for cached bitmaps they've never defined. */
 	if (!bitmap)
 		return TRUE;
@@ -167,6 +182,11 @@ static BOOL update_gdi_cache_bitmap_v2(rdpContext* context, CACHE_BITMAP_V2_ORDE
 	}
 
 	Bitmap_Free(context, prevBitmap);
+
+	if (cacheBitmapV2->flags & CBR2_PERSISTENT_KEY_PRESENT)
+		bitmap_cache_persist(cache->bitmap, cacheBitmapV2->cacheId, cacheBitmapV2->cacheIndex,
+		                     bitmap, cacheBitmapV2->key1, cacheBitmapV2->key2);
+
 	return bitmap_cache_put(cache->bitmap, cacheBitmapV2->cacheId, cacheBitmapV2->cacheIndex,
 	                        bitmap);
 }
@@ -206,6 +226,8 @@ static BOOL update_gdi_cache_bitmap_v3(rdpContext* context, CACHE_BITMAP_V3_ORDE
 
 	prevBitmap = bitmap_cache_get(cache->bitmap, cacheBitmapV3->cacheId, cacheBitmapV3->cacheIndex);
 	Bitmap_Free(context, prevBitmap);
+	bitmap_cache_persist(cache->bitmap, cacheBitmapV3->cacheId, cacheBitmapV3->cacheIndex, bitmap,
+	                     cacheBitmapV3->key1, cacheBitmapV3->key2);
 	return bitmap_cache_put(cache->bitmap, cacheBitmapV3->cacheId, cacheBitmapV3->cacheIndex,
 	                        bitmap);
 }
@@ -252,10 +274,120 @@ BOOL bitmap_cache_put(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index, rdpB
 		return FALSE;
 	}
 
+	bitmap_cache_release(bitmapCache, id, index);
 	bitmapCache->cells[id].entries[index] = bitmap;
 	return TRUE;
 }
 
+/**
+ * Resolve a cache index the server assigned from the persistent key list and load the bitmap
+ * from disk on first use.
+ */
+static rdpBitmap* bitmap_cache_load(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index)
+{
+	UINT64 key;
+	rdpBitmap* bitmap;
+	PERSISTENT_CACHE_ENTRY entry = { 0 };
+	rdpContext* context = bitmapCache->context;
+
+	if (!bitmapCache->persistent || (id >= bitmapCache->maxCells) ||
+	    (index >= bitmapCache->persistentCounts[id]))
+		return NULL;
+
+	key = bitmapCache->persistentKeys[id][index];
+
+	if (!key || !persistent_cache_get(bitmapCache->persistent, key, &entry))
+		return NULL;
+
+	bitmap = Bitmap_Alloc(context);
+
+	if (!bitmap)
+		return NULL;
+
+	Bitmap_SetDimensions(bitmap, (UINT16)entry.width, (UINT16)entry.height);
+	bitmap->format = entry.format;
+	bitmap->length = entry.size;
+	bitmap->data = (BYTE*)_aligned_malloc(bitmap->length, 16);
+
+	if (!bitmap->data)
+		goto fail;
+
+	CopyMemory(bitmap->data, entry.data, entry.size);
+
+	if (!bitmap->New(context, bitmap))
+		goto fail;
+
+	if (!bitmap_cache_put(bitmapCache, id, index, bitmap))
+		goto fail;
+
+	return bitmap;
+fail:
+	Bitmap_Free(context, bitmap);
+	return NULL;
+}
+
+static void bitmap_cache_persist(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index,
+                                 const rdpBitmap* bitmap, UINT32 key1, UINT32 key2)
+{
+	const UINT64 key = ((UINT64)key2 << 32) | key1;
+
+	if (!bitmapCache->persistent || !bitmap->data)
+		return;
+
+	if (!persistent_cache_put(bitmapCache->persistent, key, id, bitmap->width, bitmap->height,
+	                          bitmap->format, bitmap->data))
+		WLog_DBG(TAG, "bitmap %" PRIu32 ":%" PRIu32 " not stored in persistent cache", id,
+		         index);
+}
+
+/* Once an announced index holds a bitmap in memory its entry on disk may be evicted again */
+static void bitmap_cache_release(rdpBitmapCache* bitmapCache, UINT32 id, UINT32 index)
+{
+	if (!bitmapCache->persistent || (id >= bitmapCache->maxCells) ||
+	    (index >= bitmapCache->persistentCounts[id]))
+		return;
+
+	persistent_cache_pin(bitmapCache->persistent, bitmapCache->persistentKeys[id][index], FALSE);
+}
+
+BOOL bitmap_cache_announce_persistent_keys(rdpBitmapCache* bitmapCache)
+{
+	UINT32 i, x;
+
+	if (!bitmapCache || !bitmapCache->persistent)
+		return TRUE;
+
+	persistent_cache_unpin_all(bitmapCache->persistent);
+
+	for (i = 0; i < bitmapCache->maxCells; i++)
+	{
+		const UINT32 number = MIN(bitmapCache->cells[i].number, UINT16_MAX);
+
+		if (!bitmapCache->persistentKeys[i])
+			continue;
+
+		bitmapCache->persistentCounts[i] = persistent_cache_get_keys(
+		    bitmapCache->persistent, i, bitmapCache->persistentKeys[i], number);
+
+		for (x = 0; x < bitmapCache->persistentCounts[i]; x++)
+			persistent_cache_pin(bitmapCache->persistent, bitmapCache->persistentKeys[i][x], TRUE);
+	}
+
+	return TRUE;
+}
+
+const UINT64* bitmap_cache_get_persistent_keys(rdpBitmapCache* bitmapCache, UINT32 id,
+                                               UINT32* count)
+{
+	*count = 0;
+
+	if (!bitmapCache || !bitmapCache->persistent || (id >= bitmapCache->maxCells))
+		return NULL;
+
+	*count = bitmapCache->persistentCounts[id];
+	return bitmapCache->persistentKeys[id];
+}
+
 void bitmap_cache_register_callbacks(rdpUpdate* update)
 {
 	rdpCache* cache = update->context->cache;
@@ -269,6 +401,48 @@ void bitmap_cache_register_callbacks(rdpUpdate* update)
 	update->BitmapUpdate = gdi_bitmap_update;
 }
 
+/**
+ * The server assigns the indices of a persistent cell in the order the keys were announced in
+ * the persistent key list, the announced keys are kept to map indices back to keys.
+ */
+static BOOL bitmap_cache_open_persistent(rdpBitmapCache* bitmapCache)
+{
+	UINT32 i;
+	char* filename;
+	rdpSettings* settings = bitmapCache->settings;
+	bitmapCache->persistentKeys = (UINT64**)calloc(bitmapCache->maxCells, sizeof(UINT64*));
+	bitmapCache->persistentCounts = (UINT32*)calloc(bitmapCache->maxCells, sizeof(UINT32));
+
+	if (!bitmapCache->persistentKeys || !bitmapCache->persistentCounts)
+		return FALSE;
+
+	if (!persistent_cache_enabled(settings))
+		return TRUE;
+
+	filename = persistent_cache_get_filename(settings);
+	bitmapCache->persistent = persistent_cache_open(filename, PERSISTENT_CACHE_MAX_ENTRIES);
+	free(filename);
+
+	/* Caching continues in memory only */
+	if (!bitmapCache->persistent)
+		return TRUE;
+
+	for (i = 0; i < bitmapCache->maxCells; i++)
+	{
+		const UINT32 number = MIN(bitmapCache->cells[i].number, UINT16_MAX);
+
+		if (!settings->BitmapCacheV2CellInfo[i].persistent || (number == 0))
+			continue;
+
+		bitmapCache->persistentKeys[i] = (UINT64*)calloc(number, sizeof(UINT64));
+
+		if (!bitmapCache->persistentKeys[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 {
 	int i;
@@ -298,6 +472,9 @@ rdpBitmapCache* bitmap_cache_new(rdpSettings* settings)
 			goto fail;
 	}
 
+	if (settings->BitmapCachePersistEnabled && !bitmap_cache_open_persistent(bitmapCache))
+		goto fail;
+
 	return bitmapCache;
 fail:
 
@@ -307,6 +484,16 @@ fail:
 			free(bitmapCache->cells[i].entries);
 	}
 
+	if (bitmapCache->persistentKeys)
+	{
+		for (i = 0; i < (int)bitmapCache->maxCells; i++)
+			free(bitmapCache->persistentKeys[i]);
+	}
+
+	persistent_cache_close(bitmapCache->persistent);
+	free(bitmapCache->persistentKeys);
+	free(bitmapCache->persistentCounts);
+	free(bitmapCache->cells);
 	free(bitmapCache);
 	return NULL;
 }
@@ -329,6 +516,15 @@ void bitmap_cache_free(rdpBitmapCache* bitmapCache)
 			free(bitmapCache->cells[i].entries);
 		}
 
+		if (bitmapCache->persistentKeys)
+		{
+			for (i = 0; i < (int)bitmapCache->maxCells; i++)
+				free(bitmapCache->persistentKeys[i]);
+		}
+
+		persistent_cache_close(bitmapCache->persistent);
+		free(bitmapCache->persistentKeys);
+		free(bitmapCache->persistentCounts);
 		free(bitmapCache->cells);
 		free(bitmapCache);
 	}
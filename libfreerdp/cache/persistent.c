@@ -0,0 +1,563 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Bitmap Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/file.h>
+
+#include <freerdp/log.h>
+#include <freerdp/codec/color.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
+
+#include "persistent.h"
+
+#define TAG FREERDP_TAG("cache.persistent")
+
+#define PERSISTENT_CACHE_SIGNATURE "FRDPBMC"
+#define PERSISTENT_CACHE_VERSION 1
+#define PERSISTENT_CACHE_FILENAME "bitmapcache.bmc"
+
+#define PERSISTENT_CACHE_SLOT_VALID 0x0001
+
+/**
+ * The file is a fixed size header followed by maxEntries fixed size slots, so the file size
+ * is bounded and a slot can be addressed without any index. Every slot starts with a small
+ * header describing the bitmap stored in it.
+ */
+typedef struct
+{
+	char signature[8];
+	UINT32 version;
+	UINT32 maxEntries;
+	UINT32 slotSize;
+	UINT32 reserved;
+	UINT64 clock;
+} PERSISTENT_CACHE_HEADER;
+
+typedef struct
+{
+	UINT64 key;
+	UINT64 lastUsed;
+	UINT16 flags;
+	UINT16 cellId;
+	UINT16 width;
+	UINT16 height;
+	UINT32 format;
+	UINT32 size;
+} PERSISTENT_CACHE_SLOT;
+
+#define PERSISTENT_CACHE_SLOT_SIZE (sizeof(PERSISTENT_CACHE_SLOT) + PERSISTENT_CACHE_MAX_DATA_SIZE)
+
+struct rdp_persistent_cache
+{
+	UINT32 maxEntries;
+	size_t size;
+	BYTE* base;
+	PERSISTENT_CACHE_HEADER* header;
+
+	/* In memory copies of the slot keys and LRU stamps, a key of 0 marks a free slot */
+	UINT64* keys;
+	UINT64* stamps;
+
+	/* Slots announced in the persistent key list of the connection, they are not evicted */
+	BOOL* pinned;
+
+	/* Hash index over the keys, buckets and chains hold slot + 1 and 0 ends a chain */
+	UINT32* buckets;
+	UINT32* chain;
+	UINT32 bucketMask;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+typedef struct
+{
+	UINT64 key;
+	UINT64 stamp;
+	UINT32 slot;
+} PERSISTENT_CACHE_KEY;
+
+static PERSISTENT_CACHE_SLOT* persistent_cache_slot(rdpPersistentCache* cache, UINT32 index)
+{
+	return (PERSISTENT_CACHE_SLOT*)(cache->base + sizeof(PERSISTENT_CACHE_HEADER) +
+	                                (size_t)index * PERSISTENT_CACHE_SLOT_SIZE);
+}
+
+static BOOL persistent_cache_header_valid(const PERSISTENT_CACHE_HEADER* header,
+                                          UINT32 maxEntries)
+{
+	if (strncmp(header->signature, PERSISTENT_CACHE_SIGNATURE, sizeof(header->signature)) != 0)
+		return FALSE;
+
+	if (header->version != PERSISTENT_CACHE_VERSION)
+		return FALSE;
+
+	if (header->maxEntries != maxEntries)
+		return FALSE;
+
+	return header->slotSize == PERSISTENT_CACHE_SLOT_SIZE;
+}
+
+#ifdef _WIN32
+static BOOL persistent_cache_map(rdpPersistentCache* cache, const char* filename)
+{
+	DWORD read = 0;
+	PERSISTENT_CACHE_HEADER header = { 0 };
+	cache->file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS,
+	                          FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (cache->file == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	/* Drop a file with a different layout, the mapping below zero fills it again */
+	if (!ReadFile(cache->file, &header, sizeof(header), &read, NULL) ||
+	    (read != sizeof(header)) || !persistent_cache_header_valid(&header, cache->maxEntries))
+	{
+		if ((SetFilePointer(cache->file, 0, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER) ||
+		    !SetEndOfFile(cache->file))
+			return FALSE;
+	}
+
+	cache->mapping = CreateFileMappingA(cache->file, NULL, PAGE_READWRITE,
+	                                    (DWORD)((UINT64)cache->size >> 32),
+	                                    (DWORD)(cache->size & 0xFFFFFFFF), NULL);
+
+	if (!cache->mapping)
+		return FALSE;
+
+	cache->base = (BYTE*)MapViewOfFile(cache->mapping, FILE_MAP_ALL_ACCESS, 0, 0, cache->size);
+	return cache->base != NULL;
+}
+
+static void persistent_cache_unmap(rdpPersistentCache* cache)
+{
+	if (cache->base)
+	{
+		FlushViewOfFile(cache->base, cache->size);
+		UnmapViewOfFile(cache->base);
+	}
+
+	if (cache->mapping)
+		CloseHandle(cache->mapping);
+
+	if (cache->file && (cache->file != INVALID_HANDLE_VALUE))
+		CloseHandle(cache->file);
+}
+#else
+static BOOL persistent_cache_map(rdpPersistentCache* cache, const char* filename)
+{
+	void* base;
+	PERSISTENT_CACHE_HEADER header = { 0 };
+	cache->fd = open(filename, O_RDWR | O_CREAT, 0600);
+
+	if (cache->fd < 0)
+		return FALSE;
+
+	/* The slots are shared through the mapping, a second session must not touch them */
+	if (flock(cache->fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		WLog_WARN(TAG, "'%s' is in use by another session", filename);
+		return FALSE;
+	}
+
+	/* Drop a file with a different layout, extending it again zero fills all slots */
+	if ((read(cache->fd, &header, sizeof(header)) != sizeof(header)) ||
+	    !persistent_cache_header_valid(&header, cache->maxEntries))
+	{
+		if (ftruncate(cache->fd, 0) != 0)
+			return FALSE;
+	}
+
+	if (ftruncate(cache->fd, (off_t)cache->size) != 0)
+		return FALSE;
+
+	base = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+
+	if (base == MAP_FAILED)
+		return FALSE;
+
+	cache->base = (BYTE*)base;
+	return TRUE;
+}
+
+static void persistent_cache_unmap(rdpPersistentCache* cache)
+{
+	if (cache->base)
+	{
+		msync(cache->base, cache->size, MS_SYNC);
+		munmap(cache->base, cache->size);
+	}
+
+	if (cache->fd >= 0)
+		close(cache->fd);
+}
+#endif
+
+/**
+ * BitmapCachePersistEnabled is also set when the server supports persistent keys, the user
+ * enables the cache on disk by marking the bitmap cache cells persistent.
+ */
+BOOL persistent_cache_enabled(const rdpSettings* settings)
+{
+	UINT32 index;
+
+	if (!settings || !settings->BitmapCachePersistEnabled)
+		return FALSE;
+
+	for (index = 0; index < settings->BitmapCacheV2NumCells; index++)
+	{
+		if (settings->BitmapCacheV2CellInfo[index].persistent)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+char* persistent_cache_get_filename(const rdpSettings* settings)
+{
+	if (!settings)
+		return NULL;
+
+	if (settings->BitmapCachePersistFile)
+		return _strdup(settings->BitmapCachePersistFile);
+
+	if (!settings->ConfigPath)
+		return NULL;
+
+	if (!PathFileExistsA(settings->ConfigPath))
+	{
+		if (!PathMakePathA(settings->ConfigPath, 0))
+		{
+			WLog_ERR(TAG, "error creating directory '%s'", settings->ConfigPath);
+			return NULL;
+		}
+
+		WLog_INFO(TAG, "creating directory %s", settings->ConfigPath);
+	}
+
+	return GetCombinedPath(settings->ConfigPath, PERSISTENT_CACHE_FILENAME);
+}
+
+static UINT32 persistent_cache_hash(const rdpPersistentCache* cache, UINT64 key)
+{
+	return (UINT32)((key * 0x9E3779B97F4A7C15ULL) >> 32) & cache->bucketMask;
+}
+
+static void persistent_cache_index_add(rdpPersistentCache* cache, UINT32 index)
+{
+	const UINT32 bucket = persistent_cache_hash(cache, cache->keys[index]);
+	cache->chain[index] = cache->buckets[bucket];
+	cache->buckets[bucket] = index + 1;
+}
+
+static void persistent_cache_index_remove(rdpPersistentCache* cache, UINT32 index)
+{
+	UINT32* link = &cache->buckets[persistent_cache_hash(cache, cache->keys[index])];
+
+	while (*link)
+	{
+		if (*link == index + 1)
+		{
+			*link = cache->chain[index];
+			cache->chain[index] = 0;
+			return;
+		}
+
+		link = &cache->chain[*link - 1];
+	}
+}
+
+rdpPersistentCache* persistent_cache_open(const char* filename, UINT32 maxEntries)
+{
+	UINT32 buckets = 1;
+	UINT32 index;
+	rdpPersistentCache* cache;
+
+	if (!filename)
+		return NULL;
+
+	if ((maxEntries == 0) || (maxEntries > PERSISTENT_CACHE_MAX_ENTRIES))
+		maxEntries = PERSISTENT_CACHE_MAX_ENTRIES;
+
+	cache = (rdpPersistentCache*)calloc(1, sizeof(rdpPersistentCache));
+
+	if (!cache)
+		return NULL;
+
+#ifndef _WIN32
+	cache->fd = -1;
+#endif
+	cache->maxEntries = maxEntries;
+	cache->size = sizeof(PERSISTENT_CACHE_HEADER) + (size_t)maxEntries * PERSISTENT_CACHE_SLOT_SIZE;
+	cache->keys = (UINT64*)calloc(maxEntries, sizeof(UINT64));
+	cache->stamps = (UINT64*)calloc(maxEntries, sizeof(UINT64));
+	cache->pinned = (BOOL*)calloc(maxEntries, sizeof(BOOL));
+	cache->chain = (UINT32*)calloc(maxEntries, sizeof(UINT32));
+
+	while (buckets < 2 * maxEntries)
+		buckets <<= 1;
+
+	cache->bucketMask = buckets - 1;
+	cache->buckets = (UINT32*)calloc(buckets, sizeof(UINT32));
+
+	if (!cache->keys || !cache->stamps || !cache->pinned || !cache->chain || !cache->buckets)
+		goto fail;
+
+	if (!persistent_cache_map(cache, filename))
+	{
+		WLog_WARN(TAG, "persistent bitmap cache '%s' not available, caching in memory only",
+		          filename);
+		goto fail;
+	}
+
+	cache->header = (PERSISTENT_CACHE_HEADER*)cache->base;
+
+	if (!persistent_cache_header_valid(cache->header, maxEntries))
+	{
+		ZeroMemory(cache->header, sizeof(PERSISTENT_CACHE_HEADER));
+		CopyMemory(cache->header->signature, PERSISTENT_CACHE_SIGNATURE,
+		           sizeof(PERSISTENT_CACHE_SIGNATURE));
+		cache->header->version = PERSISTENT_CACHE_VERSION;
+		cache->header->maxEntries = maxEntries;
+		cache->header->slotSize = PERSISTENT_CACHE_SLOT_SIZE;
+	}
+
+	for (index = 0; index < maxEntries; index++)
+	{
+		const PERSISTENT_CACHE_SLOT* slot = persistent_cache_slot(cache, index);
+
+		if (!(slot->flags & PERSISTENT_CACHE_SLOT_VALID))
+			continue;
+
+		cache->keys[index] = slot->key;
+		cache->stamps[index] = slot->lastUsed;
+		persistent_cache_index_add(cache, index);
+	}
+
+	return cache;
+fail:
+	persistent_cache_close(cache);
+	return NULL;
+}
+
+void persistent_cache_close(rdpPersistentCache* cache)
+{
+	if (!cache)
+		return;
+
+	persistent_cache_unmap(cache);
+	free(cache->keys);
+	free(cache->stamps);
+	free(cache->pinned);
+	free(cache->chain);
+	free(cache->buckets);
+	free(cache);
+}
+
+static int persistent_cache_key_compare(const void* pa, const void* pb)
+{
+	const PERSISTENT_CACHE_KEY* a = (const PERSISTENT_CACHE_KEY*)pa;
+	const PERSISTENT_CACHE_KEY* b = (const PERSISTENT_CACHE_KEY*)pb;
+
+	/* Most recently used first, ties keep slot order to stay deterministic */
+	if (a->stamp != b->stamp)
+		return (a->stamp > b->stamp) ? -1 : 1;
+
+	return (a->slot < b->slot) ? -1 : ((a->slot > b->slot) ? 1 : 0);
+}
+
+UINT32 persistent_cache_get_keys(rdpPersistentCache* cache, UINT32 cellId, UINT64* keys,
+                                 UINT32 maxKeys)
+{
+	UINT32 index;
+	UINT32 count = 0;
+	PERSISTENT_CACHE_KEY* entries;
+
+	if (!cache || !keys || (maxKeys == 0))
+		return 0;
+
+	entries = (PERSISTENT_CACHE_KEY*)calloc(cache->maxEntries, sizeof(PERSISTENT_CACHE_KEY));
+
+	if (!entries)
+		return 0;
+
+	for (index = 0; index < cache->maxEntries; index++)
+	{
+		if (!cache->keys[index] || (persistent_cache_slot(cache, index)->cellId != cellId))
+			continue;
+
+		entries[count].key = cache->keys[index];
+		entries[count].stamp = cache->stamps[index];
+		entries[count].slot = index;
+		count++;
+	}
+
+	qsort(entries, count, sizeof(PERSISTENT_CACHE_KEY), persistent_cache_key_compare);
+	count = MIN(count, maxKeys);
+
+	for (index = 0; index < count; index++)
+		keys[index] = entries[index].key;
+
+	free(entries);
+	return count;
+}
+
+static BOOL persistent_cache_find(rdpPersistentCache* cache, UINT64 key, UINT32* slot)
+{
+	UINT32 next = cache->buckets[persistent_cache_hash(cache, key)];
+
+	while (next)
+	{
+		if (cache->keys[next - 1] == key)
+		{
+			*slot = next - 1;
+			return TRUE;
+		}
+
+		next = cache->chain[next - 1];
+	}
+
+	return FALSE;
+}
+
+BOOL persistent_cache_pin(rdpPersistentCache* cache, UINT64 key, BOOL pin)
+{
+	UINT32 index;
+
+	if (!cache || !key || !persistent_cache_find(cache, key, &index))
+		return FALSE;
+
+	cache->pinned[index] = pin;
+	return TRUE;
+}
+
+void persistent_cache_unpin_all(rdpPersistentCache* cache)
+{
+	if (cache)
+		ZeroMemory(cache->pinned, cache->maxEntries * sizeof(BOOL));
+}
+
+static void persistent_cache_touch(rdpPersistentCache* cache, UINT32 index)
+{
+	const UINT64 stamp = ++cache->header->clock;
+	cache->stamps[index] = stamp;
+	persistent_cache_slot(cache, index)->lastUsed = stamp;
+}
+
+BOOL persistent_cache_get(rdpPersistentCache* cache, UINT64 key, PERSISTENT_CACHE_ENTRY* entry)
+{
+	UINT32 index;
+	const PERSISTENT_CACHE_SLOT* slot;
+
+	if (!cache || !entry || !key)
+		return FALSE;
+
+	if (!persistent_cache_find(cache, key, &index))
+		return FALSE;
+
+	slot = persistent_cache_slot(cache, index);
+
+	if ((slot->size > PERSISTENT_CACHE_MAX_DATA_SIZE) || (slot->size == 0))
+		return FALSE;
+
+	persistent_cache_touch(cache, index);
+	entry->key = slot->key;
+	entry->cellId = slot->cellId;
+	entry->width = slot->width;
+	entry->height = slot->height;
+	entry->format = slot->format;
+	entry->size = slot->size;
+	entry->data = (const BYTE*)&slot[1];
+	return TRUE;
+}
+
+BOOL persistent_cache_put(rdpPersistentCache* cache, UINT64 key, UINT32 cellId, UINT32 width,
+                          UINT32 height, UINT32 format, const BYTE* data)
+{
+	UINT32 index;
+	UINT32 size;
+	PERSISTENT_CACHE_SLOT* slot;
+
+	if (!cache || !data || !key || (cellId > UINT16_MAX))
+		return FALSE;
+
+	size = width * height * GetBytesPerPixel(format);
+
+	if ((width > UINT16_MAX) || (height > UINT16_MAX) || (size == 0) ||
+	    (size > PERSISTENT_CACHE_MAX_DATA_SIZE))
+		return FALSE;
+
+	if (!persistent_cache_find(cache, key, &index))
+	{
+		UINT32 x;
+		index = cache->maxEntries;
+
+		/* Take a free slot or evict the least recently used one that was not announced */
+		for (x = 0; x < cache->maxEntries; x++)
+		{
+			if (!cache->keys[x])
+			{
+				index = x;
+				break;
+			}
+
+			if (!cache->pinned[x] &&
+			    ((index == cache->maxEntries) || (cache->stamps[x] < cache->stamps[index])))
+				index = x;
+		}
+
+		if (index == cache->maxEntries)
+			return FALSE;
+
+		if (cache->keys[index])
+			persistent_cache_index_remove(cache, index);
+	}
+	else
+		persistent_cache_index_remove(cache, index);
+
+	/* Invalidate the slot first so an interrupted write never yields a stale key */
+	slot = persistent_cache_slot(cache, index);
+	slot->flags = 0;
+	cache->keys[index] = 0;
+	CopyMemory(&slot[1], data, size);
+	slot->cellId = (UINT16)cellId;
+	slot->width = (UINT16)width;
+	slot->height = (UINT16)height;
+	slot->format = format;
+	slot->size = size;
+	slot->key = key;
+	slot->flags = PERSISTENT_CACHE_SLOT_VALID;
+	cache->keys[index] = key;
+	persistent_cache_index_add(cache, index);
+	persistent_cache_touch(cache, index);
+	return TRUE;
+}
@@ -0,0 +1,62 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Bitmap Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CACHE_PERSISTENT_H
+#define FREERDP_LIB_CACHE_PERSISTENT_H
+
+typedef struct rdp_persistent_cache rdpPersistentCache;
+
+#include <freerdp/api.h>
+#include <freerdp/settings.h>
+
+#include <winpr/wtypes.h>
+
+/* Upper bound of the number of bitmaps (and therefore the file size) kept on disk */
+#define PERSISTENT_CACHE_MAX_ENTRIES 4096
+
+/* Bitmap cache v2/v3 cells hold tiles of at most 64x64 pixels */
+#define PERSISTENT_CACHE_MAX_DATA_SIZE (64 * 64 * 4)
+
+typedef struct
+{
+	UINT64 key;
+	UINT32 cellId;
+	UINT32 width;
+	UINT32 height;
+	UINT32 format;
+	UINT32 size;
+	const BYTE* data; /* points into the mapping, valid until the next put */
+} PERSISTENT_CACHE_ENTRY;
+
+FREERDP_LOCAL BOOL persistent_cache_enabled(const rdpSettings* settings);
+FREERDP_LOCAL char* persistent_cache_get_filename(const rdpSettings* settings);
+
+FREERDP_LOCAL rdpPersistentCache* persistent_cache_open(const char* filename, UINT32 maxEntries);
+FREERDP_LOCAL void persistent_cache_close(rdpPersistentCache* cache);
+
+FREERDP_LOCAL UINT32 persistent_cache_get_keys(rdpPersistentCache* cache, UINT32 cellId,
+                                               UINT64* keys, UINT32 maxKeys);
+FREERDP_LOCAL BOOL persistent_cache_get(rdpPersistentCache* cache, UINT64 key,
+                                        PERSISTENT_CACHE_ENTRY* entry);
+/* Pinned entries are announced to the server and are not evicted until unpinned */
+FREERDP_LOCAL BOOL persistent_cache_pin(rdpPersistentCache* cache, UINT64 key, BOOL pin);
+FREERDP_LOCAL void persistent_cache_unpin_all(rdpPersistentCache* cache);
+FREERDP_LOCAL BOOL persistent_cache_put(rdpPersistentCache* cache, UINT64 key, UINT32 cellId,
+                                        UINT32 width, UINT32 height, UINT32 format,
+                                        const BYTE* data);
+
+#endif /* FREERDP_LIB_CACHE_PERSISTENT_H */
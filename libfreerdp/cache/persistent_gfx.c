@@ -0,0 +1,345 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Graphics Pipeline Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/stream.h>
+
+#include <freerdp/log.h>
+#include <freerdp/codec/color.h>
+
+#include "persistent.h"
+#include "persistent_gfx.h"
+
+#define TAG FREERDP_TAG("cache.persistent")
+
+#define PERSISTENT_GFX_CACHE_SIGNATURE "FRDPGFX"
+#define PERSISTENT_GFX_CACHE_VERSION 1
+#define PERSISTENT_GFX_CACHE_SUFFIX ".gfx"
+#define PERSISTENT_GFX_CACHE_HEADER_SIZE 16
+#define PERSISTENT_GFX_CACHE_ENTRY_HEADER_SIZE 16
+
+/**
+ * The file is a header followed by the cache entries back to back. Each entry holds the
+ * cache key, the dimensions and pixel format and the bitmap rows without padding. Only the
+ * entry headers are read when the file is opened, the bitmaps are read when the server
+ * accepted them in the cache import reply.
+ */
+typedef struct
+{
+	UINT64 cacheKey;
+	UINT32 width;
+	UINT32 height;
+	UINT32 format;
+	INT64 offset;
+} PERSISTENT_GFX_CACHE_INDEX;
+
+struct rdp_gfx_persistent_cache
+{
+	FILE* fp;
+	UINT32 count;
+	PERSISTENT_GFX_CACHE_INDEX* entries;
+};
+
+char* persistent_gfx_cache_get_filename(const rdpSettings* settings)
+{
+	size_t length;
+	char* gfxFilename;
+	char* filename = persistent_cache_get_filename(settings);
+
+	if (!filename)
+		return NULL;
+
+	length = strlen(filename) + sizeof(PERSISTENT_GFX_CACHE_SUFFIX);
+	gfxFilename = (char*)malloc(length);
+
+	if (gfxFilename)
+		sprintf_s(gfxFilename, length, "%s%s", filename, PERSISTENT_GFX_CACHE_SUFFIX);
+
+	free(filename);
+	return gfxFilename;
+}
+
+static BOOL persistent_gfx_cache_read_header(rdpGfxPersistentCache* cache, UINT32* count)
+{
+	UINT32 version;
+	BYTE buffer[PERSISTENT_GFX_CACHE_HEADER_SIZE];
+	wStream sbuffer = { 0 };
+	wStream* s = &sbuffer;
+
+	if (fread(buffer, sizeof(buffer), 1, cache->fp) != 1)
+		return FALSE;
+
+	if (memcmp(buffer, PERSISTENT_GFX_CACHE_SIGNATURE, sizeof(PERSISTENT_GFX_CACHE_SIGNATURE)) !=
+	    0)
+		return FALSE;
+
+	Stream_StaticInit(s, buffer, sizeof(buffer));
+	Stream_Seek(s, 8);             /* signature (8 bytes) */
+	Stream_Read_UINT32(s, version); /* version (4 bytes) */
+	Stream_Read_UINT32(s, *count);  /* count (4 bytes) */
+	return (version == PERSISTENT_GFX_CACHE_VERSION) && (*count <= RDPGFX_CACHE_ENTRY_MAX_COUNT);
+}
+
+rdpGfxPersistentCache* persistent_gfx_cache_open(const char* filename)
+{
+	UINT32 index;
+	UINT32 count = 0;
+	rdpGfxPersistentCache* cache;
+
+	if (!filename)
+		return NULL;
+
+	cache = (rdpGfxPersistentCache*)calloc(1, sizeof(rdpGfxPersistentCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->fp = fopen(filename, "rb");
+
+	/* A missing or foreign file is an empty cache */
+	if (!cache->fp || !persistent_gfx_cache_read_header(cache, &count) || (count == 0))
+		return cache;
+
+	cache->entries =
+	    (PERSISTENT_GFX_CACHE_INDEX*)calloc(count, sizeof(PERSISTENT_GFX_CACHE_INDEX));
+
+	if (!cache->entries)
+		goto fail;
+
+	for (index = 0; index < count; index++)
+	{
+		UINT16 width, height;
+		BYTE buffer[PERSISTENT_GFX_CACHE_ENTRY_HEADER_SIZE];
+		wStream sbuffer = { 0 };
+		wStream* s = &sbuffer;
+		PERSISTENT_GFX_CACHE_INDEX* entry = &cache->entries[index];
+
+		if (fread(buffer, sizeof(buffer), 1, cache->fp) != 1)
+			break;
+
+		Stream_StaticInit(s, buffer, sizeof(buffer));
+		Stream_Read_UINT64(s, entry->cacheKey); /* cacheKey (8 bytes) */
+		Stream_Read_UINT16(s, width);           /* width (2 bytes) */
+		Stream_Read_UINT16(s, height);          /* height (2 bytes) */
+		Stream_Read_UINT32(s, entry->format);   /* format (4 bytes) */
+		entry->width = width;
+		entry->height = height;
+		entry->offset = _ftelli64(cache->fp);
+
+		if ((width == 0) || (height == 0) || (GetBytesPerPixel(entry->format) != 4) ||
+		    (entry->offset < 0))
+			break;
+
+		/* A truncated entry ends the cache, everything before it is still usable */
+		if (_fseeki64(cache->fp, (INT64)width * height * 4, SEEK_CUR) != 0)
+			break;
+
+		cache->count++;
+	}
+
+	if (cache->count > 0)
+	{
+		PERSISTENT_GFX_CACHE_INDEX* last = &cache->entries[cache->count - 1];
+		const INT64 end = last->offset + (INT64)last->width * last->height * 4;
+
+		if ((_fseeki64(cache->fp, 0, SEEK_END) != 0) || (_ftelli64(cache->fp) < end))
+			cache->count--;
+	}
+
+	return cache;
+fail:
+	persistent_gfx_cache_free(cache);
+	return NULL;
+}
+
+void persistent_gfx_cache_free(rdpGfxPersistentCache* cache)
+{
+	if (!cache)
+		return;
+
+	if (cache->fp)
+		fclose(cache->fp);
+
+	free(cache->entries);
+	free(cache);
+}
+
+UINT16 persistent_gfx_cache_get_offer(rdpGfxPersistentCache* cache,
+                                      RDPGFX_CACHE_ENTRY_METADATA* entries, UINT16 maxEntries,
+                                      UINT64 maxSize)
+{
+	UINT16 count = 0;
+	UINT64 size = 0;
+
+	if (!cache || !entries)
+		return 0;
+
+	while ((count < cache->count) && (count < maxEntries) &&
+	       (count < RDPGFX_CACHE_ENTRY_MAX_COUNT))
+	{
+		const PERSISTENT_GFX_CACHE_INDEX* entry = &cache->entries[count];
+		const UINT32 length = entry->width * entry->height * 4;
+
+		if (size + length > maxSize)
+			break;
+
+		entries[count].cacheKey = entry->cacheKey;
+		entries[count].bitmapLength = length;
+		size += length;
+		count++;
+	}
+
+	/* The import reply refers to entries by their position in the offer */
+	cache->count = count;
+	return count;
+}
+
+BOOL persistent_gfx_cache_get_info(rdpGfxPersistentCache* cache, UINT32 index,
+                                   PERSISTENT_GFX_CACHE_ENTRY* entry)
+{
+	if (!cache || !entry || (index >= cache->count))
+		return FALSE;
+
+	entry->cacheKey = cache->entries[index].cacheKey;
+	entry->width = cache->entries[index].width;
+	entry->height = cache->entries[index].height;
+	entry->format = cache->entries[index].format;
+	entry->scanline = entry->width * 4;
+	entry->data = NULL;
+	return TRUE;
+}
+
+BOOL persistent_gfx_cache_read(rdpGfxPersistentCache* cache, UINT32 index, BYTE* data,
+                               UINT32 scanline)
+{
+	UINT32 y;
+	const PERSISTENT_GFX_CACHE_INDEX* entry;
+
+	if (!cache || !data || (index >= cache->count))
+		return FALSE;
+
+	entry = &cache->entries[index];
+
+	if ((scanline < entry->width * 4) || (_fseeki64(cache->fp, entry->offset, SEEK_SET) != 0))
+		return FALSE;
+
+	for (y = 0; y < entry->height; y++)
+	{
+		if (fread(&data[y * scanline], entry->width * 4, 1, cache->fp) != 1)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL persistent_gfx_cache_write(FILE* fp, const PERSISTENT_GFX_CACHE_ENTRY* entries,
+                                       UINT32 count)
+{
+	UINT32 index, y;
+	BYTE buffer[PERSISTENT_GFX_CACHE_HEADER_SIZE];
+	wStream sbuffer = { 0 };
+	wStream* s = &sbuffer;
+	Stream_StaticInit(s, buffer, sizeof(buffer));
+	Stream_Write(s, PERSISTENT_GFX_CACHE_SIGNATURE, 8); /* signature (8 bytes) */
+	Stream_Write_UINT32(s, PERSISTENT_GFX_CACHE_VERSION); /* version (4 bytes) */
+	Stream_Write_UINT32(s, count);                        /* count (4 bytes) */
+
+	if (fwrite(buffer, sizeof(buffer), 1, fp) != 1)
+		return FALSE;
+
+	for (index = 0; index < count; index++)
+	{
+		const PERSISTENT_GFX_CACHE_ENTRY* entry = &entries[index];
+		Stream_SetPosition(s, 0);
+		Stream_Write_UINT64(s, entry->cacheKey);        /* cacheKey (8 bytes) */
+		Stream_Write_UINT16(s, (UINT16)entry->width);  /* width (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)entry->height); /* height (2 bytes) */
+		Stream_Write_UINT32(s, entry->format);         /* format (4 bytes) */
+
+		if (fwrite(buffer, PERSISTENT_GFX_CACHE_ENTRY_HEADER_SIZE, 1, fp) != 1)
+			return FALSE;
+
+		for (y = 0; y < entry->height; y++)
+		{
+			if (fwrite(&entry->data[y * entry->scanline], entry->width * 4, 1, fp) != 1)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+BOOL persistent_gfx_cache_save(const char* filename, const PERSISTENT_GFX_CACHE_ENTRY* entries,
+                               UINT32 count)
+{
+	FILE* fp;
+	UINT32 index;
+	size_t length;
+	char* tmpFilename;
+	BOOL rc = FALSE;
+
+	if (!filename || (!entries && (count > 0)) || (count > RDPGFX_CACHE_ENTRY_MAX_COUNT))
+		return FALSE;
+
+	for (index = 0; index < count; index++)
+	{
+		const PERSISTENT_GFX_CACHE_ENTRY* entry = &entries[index];
+
+		if (!entry->data || (entry->width == 0) || (entry->width > UINT16_MAX) ||
+		    (entry->height == 0) || (entry->height > UINT16_MAX) ||
+		    (GetBytesPerPixel(entry->format) != 4) || (entry->scanline < entry->width * 4))
+			return FALSE;
+	}
+
+	/* Write a new file and swap it in so an interrupted save keeps the previous cache */
+	length = strlen(filename) + 5;
+	tmpFilename = (char*)malloc(length);
+
+	if (!tmpFilename)
+		return FALSE;
+
+	sprintf_s(tmpFilename, length, "%s.new", filename);
+	fp = fopen(tmpFilename, "wb");
+
+	if (!fp)
+	{
+		WLog_ERR(TAG, "failed to create '%s'", tmpFilename);
+		goto fail;
+	}
+
+	rc = persistent_gfx_cache_write(fp, entries, count);
+
+	if (fclose(fp) != 0)
+		rc = FALSE;
+
+	if (rc)
+		rc = MoveFileExA(tmpFilename, filename, MOVEFILE_REPLACE_EXISTING);
+
+	if (!rc)
+		DeleteFileA(tmpFilename);
+
+fail:
+	free(tmpFilename);
+	return rc;
+}
@@ -0,0 +1,56 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Persistent Graphics Pipeline Cache
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CACHE_PERSISTENT_GFX_H
+#define FREERDP_LIB_CACHE_PERSISTENT_GFX_H
+
+typedef struct rdp_gfx_persistent_cache rdpGfxPersistentCache;
+
+#include <freerdp/api.h>
+#include <freerdp/settings.h>
+#include <freerdp/channels/rdpgfx.h>
+
+#include <winpr/wtypes.h>
+
+typedef struct
+{
+	UINT64 cacheKey;
+	UINT32 width;
+	UINT32 height;
+	UINT32 format;
+	UINT32 scanline;
+	const BYTE* data;
+} PERSISTENT_GFX_CACHE_ENTRY;
+
+FREERDP_LOCAL char* persistent_gfx_cache_get_filename(const rdpSettings* settings);
+
+FREERDP_LOCAL rdpGfxPersistentCache* persistent_gfx_cache_open(const char* filename);
+FREERDP_LOCAL void persistent_gfx_cache_free(rdpGfxPersistentCache* cache);
+
+FREERDP_LOCAL UINT16 persistent_gfx_cache_get_offer(rdpGfxPersistentCache* cache,
+                                                    RDPGFX_CACHE_ENTRY_METADATA* entries,
+                                                    UINT16 maxEntries, UINT64 maxSize);
+FREERDP_LOCAL BOOL persistent_gfx_cache_get_info(rdpGfxPersistentCache* cache, UINT32 index,
+                                                 PERSISTENT_GFX_CACHE_ENTRY* entry);
+FREERDP_LOCAL BOOL persistent_gfx_cache_read(rdpGfxPersistentCache* cache, UINT32 index,
+                                             BYTE* data, UINT32 scanline);
+
+FREERDP_LOCAL BOOL persistent_gfx_cache_save(const char* filename,
+                                             const PERSISTENT_GFX_CACHE_ENTRY* entries,
+                                             UINT32 count);
+
+#endif /* FREERDP_LIB_CACHE_PERSISTENT_GFX_H */
@@ -0,0 +1,256 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/thread.h>
+
+#include <freerdp/codec/color.h>
+
+#include "../persistent.h"
+
+#define TEST_ENTRIES 8
+#define TEST_SIZE 64
+
+static void test_fill(BYTE* data, UINT64 key)
+{
+	size_t index;
+
+	for (index = 0; index < TEST_SIZE * TEST_SIZE * 4; index++)
+		data[index] = (BYTE)(key * 31 + index);
+}
+
+static BOOL test_get(rdpPersistentCache* cache, UINT64 key)
+{
+	BYTE data[TEST_SIZE * TEST_SIZE * 4];
+	PERSISTENT_CACHE_ENTRY entry = { 0 };
+
+	if (!persistent_cache_get(cache, key, &entry))
+		return FALSE;
+
+	test_fill(data, key);
+
+	if ((entry.key != key) || (entry.cellId != key % 2) || (entry.width != TEST_SIZE) ||
+	    (entry.height != TEST_SIZE) || (entry.format != PIXEL_FORMAT_BGRX32) ||
+	    (entry.size != sizeof(data)) || (memcmp(entry.data, data, sizeof(data)) != 0))
+	{
+		printf("entry %" PRIu64 " does not match\n", key);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_roundtrip(const char* filename)
+{
+	UINT64 key;
+	BOOL rc = FALSE;
+	BYTE data[TEST_SIZE * TEST_SIZE * 4];
+	rdpPersistentCache* cache = persistent_cache_open(filename, TEST_ENTRIES);
+
+	if (!cache)
+		return FALSE;
+
+	for (key = 1; key <= TEST_ENTRIES; key++)
+	{
+		test_fill(data, key);
+
+		if (!persistent_cache_put(cache, key, key % 2, TEST_SIZE, TEST_SIZE,
+		                          PIXEL_FORMAT_BGRX32, data))
+			goto fail;
+	}
+
+	/* Bitmaps larger than a cache tile and the reserved key are rejected */
+	if (persistent_cache_put(cache, 0, 0, TEST_SIZE, TEST_SIZE, PIXEL_FORMAT_BGRX32, data) ||
+	    persistent_cache_put(cache, 100, 0, TEST_SIZE + 1, TEST_SIZE, PIXEL_FORMAT_BGRX32, data))
+		goto fail;
+
+	for (key = 1; key <= TEST_ENTRIES; key++)
+	{
+		if (!test_get(cache, key))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	persistent_cache_close(cache);
+	return rc;
+}
+
+static BOOL test_reopen(const char* filename)
+{
+	UINT32 count;
+	UINT64 keys[TEST_ENTRIES] = { 0 };
+	BOOL rc = FALSE;
+	rdpPersistentCache* cache = persistent_cache_open(filename, TEST_ENTRIES);
+
+	if (!cache)
+		return FALSE;
+
+	/* Keys of a cell are listed most recently used first */
+	count = persistent_cache_get_keys(cache, 1, keys, TEST_ENTRIES);
+
+	if ((count != TEST_ENTRIES / 2) || (keys[0] != 7) || (keys[1] != 5) || (keys[2] != 3) ||
+	    (keys[3] != 1))
+	{
+		printf("unexpected keys for cell 1 after reopening\n");
+		goto fail;
+	}
+
+	if (persistent_cache_get_keys(cache, 0, keys, 2) != 2)
+		goto fail;
+
+	if ((keys[0] != 8) || (keys[1] != 6))
+		goto fail;
+
+	if (!test_get(cache, 8) || !test_get(cache, 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	persistent_cache_close(cache);
+	return rc;
+}
+
+static BOOL test_eviction(const char* filename)
+{
+	UINT64 key;
+	BOOL rc = FALSE;
+	BYTE data[TEST_SIZE * TEST_SIZE * 4];
+	rdpPersistentCache* cache = persistent_cache_open(filename, TEST_ENTRIES);
+
+	if (!cache)
+		return FALSE;
+
+	for (key = 1; key <= TEST_ENTRIES; key++)
+	{
+		if (!test_get(cache, key))
+			goto fail;
+	}
+
+	/* Key 2 is the least recently used entry once key 1 was used again */
+	if (!test_get(cache, 1))
+		goto fail;
+
+	test_fill(data, 10);
+
+	if (!persistent_cache_put(cache, 10, 0, TEST_SIZE, TEST_SIZE, PIXEL_FORMAT_BGRX32, data))
+		goto fail;
+
+	if (test_get(cache, 2) || !test_get(cache, 1) || !test_get(cache, 10))
+	{
+		printf("least recently used entry was not evicted\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	persistent_cache_close(cache);
+	return rc;
+}
+
+static BOOL test_put(rdpPersistentCache* cache, UINT64 key)
+{
+	BYTE data[TEST_SIZE * TEST_SIZE * 4];
+	test_fill(data, key);
+	return persistent_cache_put(cache, key, key % 2, TEST_SIZE, TEST_SIZE, PIXEL_FORMAT_BGRX32,
+	                            data);
+}
+
+static BOOL test_pinning(const char* filename)
+{
+	UINT64 key;
+	BOOL rc = FALSE;
+	rdpPersistentCache* cache = persistent_cache_open(filename, TEST_ENTRIES);
+
+	if (!cache)
+		return FALSE;
+
+	/* The file belongs to the first session, a second one caches in memory only */
+	if (persistent_cache_open(filename, TEST_ENTRIES))
+	{
+		printf("persistent cache opened twice\n");
+		goto fail;
+	}
+
+	/* Announced entries survive even when key 5, used most recently, is the only candidate */
+	for (key = 1; key <= 10; key++)
+		persistent_cache_pin(cache, key, key != 5);
+
+	if (!test_get(cache, 5) || !test_put(cache, 11))
+		goto fail;
+
+	for (key = 1; key <= 10; key++)
+	{
+		if ((key != 2) && (key != 9) && (test_get(cache, key) != (key != 5)))
+		{
+			printf("pinned entry %" PRIu64 " was evicted\n", key);
+			goto fail;
+		}
+	}
+
+	if (!persistent_cache_pin(cache, 11, TRUE) || test_put(cache, 12))
+		goto fail;
+
+	persistent_cache_unpin_all(cache);
+
+	if (!test_put(cache, 12) || !test_get(cache, 12))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	persistent_cache_close(cache);
+	return rc;
+}
+
+static BOOL test_layout_change(const char* filename)
+{
+	UINT64 keys[TEST_ENTRIES];
+	BOOL rc;
+	rdpPersistentCache* cache = persistent_cache_open(filename, TEST_ENTRIES / 2);
+
+	if (!cache)
+		return FALSE;
+
+	rc = (persistent_cache_get_keys(cache, 0, keys, TEST_ENTRIES) == 0) &&
+	     (persistent_cache_get_keys(cache, 1, keys, TEST_ENTRIES) == 0);
+	persistent_cache_close(cache);
+	return rc;
+}
+
+int TestPersistentCache(int argc, char* argv[])
+{
+	int rc = -1;
+	char name[64];
+	char* filename;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+	sprintf_s(name, sizeof(name), "TestPersistentCache-%" PRIu32 ".bmc", GetCurrentProcessId());
+	filename = GetKnownSubPath(KNOWN_PATH_TEMP, name);
+
+	if (!filename)
+		return -1;
+
+	DeleteFileA(filename);
+
+	if (!test_roundtrip(filename))
+		goto fail;
+
+	if (!test_reopen(filename))
+		goto fail;
+
+	if (!test_eviction(filename))
+		goto fail;
+
+	if (!test_pinning(filename))
+		goto fail;
+
+	if (!test_layout_change(filename))
+		goto fail;
+
+	rc = 0;
+fail:
+	DeleteFileA(filename);
+	free(filename);
+	return rc;
+}
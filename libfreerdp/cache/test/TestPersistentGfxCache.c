@@ -0,0 +1,242 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/thread.h>
+
+#include <freerdp/codec/color.h>
+
+#include "../persistent_gfx.h"
+
+#define TEST_ENTRIES 5
+
+static const UINT32 test_width[TEST_ENTRIES] = { 64, 1, 17, 200, 3 };
+static const UINT32 test_height[TEST_ENTRIES] = { 64, 1, 5, 3, 300 };
+
+static BYTE* test_create_entry(PERSISTENT_GFX_CACHE_ENTRY* entry, UINT32 index)
+{
+	UINT32 x;
+	BYTE* data;
+	entry->cacheKey = 0x1122334455667700ull + index;
+	entry->width = test_width[index];
+	entry->height = test_height[index];
+	entry->format = PIXEL_FORMAT_BGRX32;
+	entry->scanline = entry->width * 4 + 12;
+	data = (BYTE*)calloc(entry->height, entry->scanline);
+
+	if (!data)
+		return NULL;
+
+	for (x = 0; x < entry->height * entry->scanline; x++)
+		data[x] = (BYTE)(x * 7 + index);
+
+	entry->data = data;
+	return data;
+}
+
+static BOOL test_compare(const PERSISTENT_GFX_CACHE_ENTRY* entry, const BYTE* data,
+                         UINT32 scanline)
+{
+	UINT32 y;
+
+	for (y = 0; y < entry->height; y++)
+	{
+		if (memcmp(&entry->data[y * entry->scanline], &data[y * scanline], entry->width * 4) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_roundtrip(const char* filename, const PERSISTENT_GFX_CACHE_ENTRY* entries)
+{
+	UINT32 index;
+	BOOL rc = FALSE;
+	RDPGFX_CACHE_ENTRY_METADATA offer[TEST_ENTRIES] = { 0 };
+	rdpGfxPersistentCache* cache = persistent_gfx_cache_open(filename);
+
+	if (!cache)
+		return FALSE;
+
+	if (persistent_gfx_cache_get_offer(cache, offer, TEST_ENTRIES, UINT64_MAX) != TEST_ENTRIES)
+		goto fail;
+
+	for (index = 0; index < TEST_ENTRIES; index++)
+	{
+		BYTE* data;
+		PERSISTENT_GFX_CACHE_ENTRY info = { 0 };
+		const PERSISTENT_GFX_CACHE_ENTRY* entry = &entries[index];
+
+		if ((offer[index].cacheKey != entry->cacheKey) ||
+		    (offer[index].bitmapLength != entry->width * entry->height * 4))
+			goto fail;
+
+		if (!persistent_gfx_cache_get_info(cache, index, &info) ||
+		    (info.cacheKey != entry->cacheKey) || (info.width != entry->width) ||
+		    (info.height != entry->height) || (info.format != entry->format))
+			goto fail;
+
+		data = (BYTE*)calloc(info.height, info.scanline);
+
+		if (!data)
+			goto fail;
+
+		if (!persistent_gfx_cache_read(cache, index, data, info.scanline) ||
+		    !test_compare(entry, data, info.scanline))
+		{
+			printf("entry %" PRIu32 " does not match\n", index);
+			free(data);
+			goto fail;
+		}
+
+		free(data);
+	}
+
+	rc = TRUE;
+fail:
+	persistent_gfx_cache_free(cache);
+	return rc;
+}
+
+static BOOL test_offer_limits(const char* filename)
+{
+	BOOL rc = FALSE;
+	PERSISTENT_GFX_CACHE_ENTRY info;
+	RDPGFX_CACHE_ENTRY_METADATA offer[TEST_ENTRIES] = { 0 };
+	rdpGfxPersistentCache* cache = persistent_gfx_cache_open(filename);
+
+	if (!cache)
+		return FALSE;
+
+	/* Only the first two entries fit, later entries can not be imported */
+	if (persistent_gfx_cache_get_offer(cache, offer, TEST_ENTRIES, 64 * 64 * 4 + 4) != 2)
+		goto fail;
+
+	if (persistent_gfx_cache_get_info(cache, 2, &info))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	persistent_gfx_cache_free(cache);
+	return rc;
+}
+
+static BOOL test_truncated(const char* filename)
+{
+	FILE* fp;
+	INT64 size;
+	BYTE* buffer;
+	BOOL rc = FALSE;
+	RDPGFX_CACHE_ENTRY_METADATA offer[TEST_ENTRIES] = { 0 };
+	rdpGfxPersistentCache* cache;
+	fp = fopen(filename, "rb");
+
+	if (!fp)
+		return FALSE;
+
+	_fseeki64(fp, 0, SEEK_END);
+	size = _ftelli64(fp);
+	_fseeki64(fp, 0, SEEK_SET);
+	buffer = (BYTE*)malloc((size_t)size);
+
+	if (!buffer || (fread(buffer, (size_t)size, 1, fp) != 1))
+	{
+		fclose(fp);
+		free(buffer);
+		return FALSE;
+	}
+
+	fclose(fp);
+
+	/* Cut into the bitmap of the last entry */
+	fp = fopen(filename, "wb");
+
+	if (fp)
+	{
+		rc = fwrite(buffer, (size_t)size - 10, 1, fp) == 1;
+		fclose(fp);
+	}
+
+	free(buffer);
+
+	if (!rc)
+		return FALSE;
+
+	rc = FALSE;
+	cache = persistent_gfx_cache_open(filename);
+
+	if (!cache)
+		return FALSE;
+
+	if (persistent_gfx_cache_get_offer(cache, offer, TEST_ENTRIES, UINT64_MAX) != TEST_ENTRIES - 1)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	persistent_gfx_cache_free(cache);
+	return rc;
+}
+
+int TestPersistentGfxCache(int argc, char* argv[])
+{
+	int rc = -1;
+	UINT32 index;
+	char name[64];
+	char* filename;
+	rdpGfxPersistentCache* cache;
+	PERSISTENT_GFX_CACHE_ENTRY entries[TEST_ENTRIES] = { 0 };
+	BYTE* data[TEST_ENTRIES] = { 0 };
+	RDPGFX_CACHE_ENTRY_METADATA offer[TEST_ENTRIES];
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+	sprintf_s(name, sizeof(name), "TestPersistentGfxCache-%" PRIu32 ".gfx",
+	          GetCurrentProcessId());
+	filename = GetKnownSubPath(KNOWN_PATH_TEMP, name);
+
+	if (!filename)
+		return -1;
+
+	DeleteFileA(filename);
+
+	for (index = 0; index < TEST_ENTRIES; index++)
+	{
+		data[index] = test_create_entry(&entries[index], index);
+
+		if (!data[index])
+			goto fail;
+	}
+
+	/* A missing file is an empty cache */
+	cache = persistent_gfx_cache_open(filename);
+
+	if (!cache || (persistent_gfx_cache_get_offer(cache, offer, TEST_ENTRIES, UINT64_MAX) != 0))
+	{
+		persistent_gfx_cache_free(cache);
+		goto fail;
+	}
+
+	persistent_gfx_cache_free(cache);
+
+	if (!persistent_gfx_cache_save(filename, entries, TEST_ENTRIES))
+		goto fail;
+
+	if (!test_roundtrip(filename, entries))
+		goto fail;
+
+	if (!test_offer_limits(filename))
+		goto fail;
+
+	if (!test_truncated(filename))
+		goto fail;
+
+	rc = 0;
+fail:
+
+	for (index = 0; index < TEST_ENTRIES; index++)
+		free(data[index]);
+
+	DeleteFileA(filename);
+	free(filename);
+	return rc;
+}
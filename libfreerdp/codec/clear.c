@@ -40,11 +40,20 @@
 #define CLEARCODEC_VBAR_SIZE 32768
 #define CLEARCODEC_VBAR_SHORT_SIZE 16384
 
+#define CLEARCODEC_GLYPH_MAX_PIXELS 1024
+#define CLEARCODEC_GLYPH_HASH_SIZE 4096
+#define CLEARCODEC_BAND_MAX_HEIGHT 52
+#define CLEARCODEC_CELL_WIDTH 64
+#define CLEARCODEC_RLEX_MAX_COLORS 127
+
 struct _CLEAR_GLYPH_ENTRY
 {
 	UINT32 size;
 	UINT32 count;
 	UINT32* pixels;
+	UINT32 width;
+	UINT32 height;
+	UINT32 hash;
 };
 typedef struct _CLEAR_GLYPH_ENTRY CLEAR_GLYPH_ENTRY;
 
@@ -53,9 +62,29 @@ struct _CLEAR_VBAR_ENTRY
 	UINT32 size;
 	UINT32 count;
 	BYTE* pixels;
+	UINT32 hash;
 };
 typedef struct _CLEAR_VBAR_ENTRY CLEAR_VBAR_ENTRY;
 
+enum CLEAR_CELL_MODE
+{
+	CLEAR_CELL_RESIDUAL,
+	CLEAR_CELL_BANDS,
+	CLEAR_CELL_RLEX,
+	CLEAR_CELL_UNCOMPRESSED
+};
+
+struct _CLEAR_CELL
+{
+	UINT32 x;
+	UINT32 y;
+	UINT32 width;
+	UINT32 height;
+	UINT32 mode;
+	UINT32 colorBkg;
+};
+typedef struct _CLEAR_CELL CLEAR_CELL;
+
 struct _CLEAR_CONTEXT
 {
 	BOOL Compressor;
@@ -71,6 +100,18 @@ struct _CLEAR_CONTEXT
 	CLEAR_VBAR_ENTRY VBarStorage[CLEARCODEC_VBAR_SIZE];
 	UINT32 ShortVBarStorageCursor;
 	CLEAR_VBAR_ENTRY ShortVBarStorage[CLEARCODEC_VBAR_SHORT_SIZE];
+
+	/* encoder state, the caches above mirror the decoder */
+	wStream* buffer;
+	BOOL CacheReset;
+	UINT32* SrcPixels;
+	UINT32 SrcPixelsSize;
+	CLEAR_CELL* Cells;
+	UINT32 CellsSize;
+	UINT32 GlyphCacheCursor;
+	UINT32 GlyphHashTable[CLEARCODEC_GLYPH_HASH_SIZE];
+	UINT32 VBarHashTable[CLEARCODEC_VBAR_SIZE];
+	UINT32 ShortVBarHashTable[CLEARCODEC_VBAR_SHORT_SIZE];
 };
 
 static const UINT32 CLEAR_LOG2_FLOOR[256] = {
@@ -1143,20 +1184,900 @@ fail:
 	return rc;
 }
 
-int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData,
+static INLINE UINT32 clear_hash_pixels(const UINT32* pixels, UINT32 count)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261UL;
+
+	for (i = 0; i < count; i++)
+	{
+		hash ^= pixels[i];
+		hash *= 16777619UL;
+	}
+
+	return hash ^ count;
+}
+
+static INLINE UINT32 clear_run_length_size(UINT32 runLengthFactor)
+{
+	if (runLengthFactor < 0xFF)
+		return 1;
+
+	if (runLengthFactor < 0xFFFF)
+		return 3;
+
+	return 7;
+}
+
+static INLINE void clear_write_run_length(wStream* s, UINT32 runLengthFactor)
+{
+	if (runLengthFactor < 0xFF)
+	{
+		Stream_Write_UINT8(s, (BYTE)runLengthFactor);
+		return;
+	}
+
+	Stream_Write_UINT8(s, 0xFF);
+
+	if (runLengthFactor < 0xFFFF)
+	{
+		Stream_Write_UINT16(s, (UINT16)runLengthFactor);
+		return;
+	}
+
+	Stream_Write_UINT16(s, 0xFFFF);
+	Stream_Write_UINT32(s, runLengthFactor);
+}
+
+static INLINE void clear_write_color(wStream* s, UINT32 color)
+{
+	Stream_Write_UINT8(s, color & 0xFF);         /* b */
+	Stream_Write_UINT8(s, (color >> 8) & 0xFF);  /* g */
+	Stream_Write_UINT8(s, (color >> 16) & 0xFF); /* r */
+}
+
+/**
+ * The encoder works on 0x00RRGGBB values so that pixels can be compared,
+ * hashed and stored in the caches as plain UINT32.
+ */
+static BOOL clear_encode_load_source(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcFormat,
+                                     UINT32 nSrcStep, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 i;
+	const UINT32 count = nWidth * nHeight;
+
+	if (count > clear->SrcPixelsSize)
+	{
+		UINT32* tmp = (UINT32*)realloc(clear->SrcPixels, count * sizeof(UINT32));
+
+		if (!tmp)
+		{
+			WLog_ERR(TAG, "clear->SrcPixels realloc failed for %" PRIu32 " pixels", count);
+			return FALSE;
+		}
+
+		clear->SrcPixels = tmp;
+		clear->SrcPixelsSize = count;
+	}
+
+	if (!freerdp_image_copy((BYTE*)clear->SrcPixels, PIXEL_FORMAT_BGRX32, nWidth * 4, 0, 0, nWidth,
+	                        nHeight, pSrcData, SrcFormat, nSrcStep, 0, 0, NULL, FREERDP_FLIP_NONE))
+		return FALSE;
+
+	for (i = 0; i < count; i++)
+	{
+		const BYTE* pixel = (const BYTE*)&clear->SrcPixels[i];
+		clear->SrcPixels[i] = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+	}
+
+	return TRUE;
+}
+
+static CLEAR_GLYPH_ENTRY* clear_encode_glyph_lookup(CLEAR_CONTEXT* clear, UINT32 nWidth,
+                                                    UINT32 nHeight, UINT32 hash,
+                                                    UINT16* pGlyphIndex)
+{
+	CLEAR_GLYPH_ENTRY* glyphEntry;
+	const UINT32 index = clear->GlyphHashTable[hash % CLEARCODEC_GLYPH_HASH_SIZE];
+
+	if (index == 0)
+		return NULL;
+
+	glyphEntry = &(clear->GlyphCache[index - 1]);
+
+	if (!glyphEntry->pixels || (glyphEntry->hash != hash) || (glyphEntry->width != nWidth) ||
+	    (glyphEntry->height != nHeight) || (glyphEntry->count != nWidth * nHeight))
+		return NULL;
+
+	if (memcmp(glyphEntry->pixels, clear->SrcPixels, nWidth * nHeight * sizeof(UINT32)) != 0)
+		return NULL;
+
+	*pGlyphIndex = (UINT16)(index - 1);
+	return glyphEntry;
+}
+
+static BOOL clear_encode_glyph_insert(CLEAR_CONTEXT* clear, UINT16 glyphIndex, UINT32 nWidth,
+                                      UINT32 nHeight, UINT32 hash)
+{
+	CLEAR_GLYPH_ENTRY* glyphEntry = &(clear->GlyphCache[glyphIndex]);
+	glyphEntry->count = nWidth * nHeight;
+
+	if (glyphEntry->count > glyphEntry->size)
+	{
+		UINT32* tmp = (UINT32*)realloc(glyphEntry->pixels, glyphEntry->count * sizeof(UINT32));
+
+		if (!tmp)
+		{
+			WLog_ERR(TAG, "glyphEntry->pixels realloc %" PRIu32 " failed!", glyphEntry->count);
+			glyphEntry->count = 0;
+			return FALSE;
+		}
+
+		glyphEntry->size = glyphEntry->count;
+		glyphEntry->pixels = tmp;
+	}
+
+	CopyMemory(glyphEntry->pixels, clear->SrcPixels, glyphEntry->count * sizeof(UINT32));
+	glyphEntry->width = nWidth;
+	glyphEntry->height = nHeight;
+	glyphEntry->hash = hash;
+	clear->GlyphHashTable[hash % CLEARCODEC_GLYPH_HASH_SIZE] = glyphIndex + 1;
+	return TRUE;
+}
+
+static INLINE UINT32 clear_encode_vbar_lookup(const CLEAR_VBAR_ENTRY* storage, const UINT32* table,
+                                              UINT32 tableSize, const UINT32* pixels,
+                                              UINT32 count, UINT32 hash)
+{
+	const CLEAR_VBAR_ENTRY* entry;
+	const UINT32 index = table[hash & (tableSize - 1)];
+
+	if (index == 0)
+		return 0;
+
+	entry = &storage[index - 1];
+
+	if ((entry->hash != hash) || (entry->count != count) || (count && !entry->pixels))
+		return 0;
+
+	if (count && (memcmp(entry->pixels, pixels, count * sizeof(UINT32)) != 0))
+		return 0;
+
+	return index;
+}
+
+static INLINE BOOL clear_encode_vbar_insert(CLEAR_CONTEXT* clear, CLEAR_VBAR_ENTRY* storage,
+                                            UINT32* table, UINT32 tableSize, UINT32 index,
+                                            const UINT32* pixels, UINT32 count, UINT32 hash)
+{
+	CLEAR_VBAR_ENTRY* entry = &storage[index];
+	entry->count = count;
+
+	if (!resize_vbar_entry(clear, entry))
+		return FALSE;
+
+	if (count)
+		CopyMemory(entry->pixels, pixels, count * sizeof(UINT32));
+
+	entry->hash = hash;
+	table[hash & (tableSize - 1)] = index + 1;
+	return TRUE;
+}
+
+static void clear_encode_get_vbar(const UINT32* pixels, UINT32 nWidth, UINT32 x, UINT32 y,
+                                  UINT32 height, UINT32 colorBkg, UINT32* vBar, UINT32* pYOn,
+                                  UINT32* pYOff)
+{
+	UINT32 i;
+	UINT32 yOn = height;
+	UINT32 yOff = 0;
+
+	for (i = 0; i < height; i++)
+	{
+		vBar[i] = pixels[((y + i) * nWidth) + x];
+
+		if (vBar[i] != colorBkg)
+		{
+			if (yOn == height)
+				yOn = i;
+
+			yOff = i + 1;
+		}
+	}
+
+	if (yOn == height)
+		yOn = 0;
+
+	*pYOn = yOn;
+	*pYOff = yOff;
+}
+
+/* most frequent color of a cell, used as band background */
+static UINT32 clear_encode_cell_background(const UINT32* pixels, UINT32 nWidth,
+                                           const CLEAR_CELL* cell)
+{
+	UINT32 x, y;
+	UINT32 colors[256];
+	UINT32 counts[256] = { 0 };
+	UINT32 colorBkg = pixels[(cell->y * nWidth) + cell->x];
+	UINT32 countBkg = 0;
+
+	for (y = cell->y; y < cell->y + cell->height; y++)
+	{
+		const UINT32* pSrc = &pixels[(y * nWidth) + cell->x];
+
+		for (x = 0; x < cell->width; x++)
+		{
+			const UINT32 color = pSrc[x];
+			UINT32 slot = ((color * 2654435761UL) >> 24) & 0xFF;
+			UINT32 probe;
+
+			/* colors beyond what the table can hold are ignored */
+			for (probe = 0; probe < 8; probe++)
+			{
+				if (!counts[slot] || (colors[slot] == color))
+					break;
+
+				slot = (slot + 1) & 0xFF;
+			}
+
+			if (probe == 8)
+				continue;
+
+			colors[slot] = color;
+			counts[slot]++;
+
+			if (counts[slot] > countBkg)
+			{
+				countBkg = counts[slot];
+				colorBkg = color;
+			}
+		}
+	}
+
+	return colorBkg;
+}
+
+static UINT32 clear_encode_residual_cost(const UINT32* pixels, UINT32 nWidth,
+                                         const CLEAR_CELL* cell)
+{
+	UINT32 x, y;
+	UINT32 cost = 0;
+
+	for (y = cell->y; y < cell->y + cell->height; y++)
+	{
+		const UINT32* pSrc = &pixels[(y * nWidth) + cell->x];
+		UINT32 color = pSrc[0];
+
+		/* a run continuing from the previous pixel in raster order is free */
+		if ((y > 0) || (cell->x > 0))
+			color = pSrc[-1];
+		else
+			cost += 4;
+
+		for (x = 0; x < cell->width; x++)
+		{
+			if (pSrc[x] != color)
+			{
+				color = pSrc[x];
+				cost += 4;
+			}
+		}
+	}
+
+	return cost;
+}
+
+static UINT32 clear_encode_bands_cost(CLEAR_CONTEXT* clear, const UINT32* pixels, UINT32 nWidth,
+                                      const CLEAR_CELL* cell)
+{
+	UINT32 x;
+	UINT32 yOn, yOff;
+	UINT32 vBar[CLEARCODEC_BAND_MAX_HEIGHT];
+	UINT32 cost = 11;
+
+	for (x = cell->x; x < cell->x + cell->width; x++)
+	{
+		UINT32 count;
+		clear_encode_get_vbar(pixels, nWidth, x, cell->y, cell->height, cell->colorBkg, vBar, &yOn,
+		                      &yOff);
+
+		if (clear_encode_vbar_lookup(clear->VBarStorage, clear->VBarHashTable,
+		                             CLEARCODEC_VBAR_SIZE, vBar, cell->height,
+		                             clear_hash_pixels(vBar, cell->height)))
+		{
+			cost += 2;
+			continue;
+		}
+
+		count = yOff - yOn;
+
+		if (count && clear_encode_vbar_lookup(
+		                 clear->ShortVBarStorage, clear->ShortVBarHashTable,
+		                 CLEARCODEC_VBAR_SHORT_SIZE, &vBar[yOn], count,
+		                 clear_hash_pixels(&vBar[yOn], count)))
+			cost += 3;
+		else
+			cost += 2 + (count * 3);
+	}
+
+	return cost;
+}
+
+/**
+ * Encodes a cell with the RLEX subcodec, or only computes the encoded size if
+ * s is NULL. Returns the bitmapDataByteCount or -1 if the cell has too many colors.
+ */
+static int clear_encode_subcodec_rlex(const UINT32* pixels, UINT32 nWidth, const CLEAR_CELL* cell,
+                                      wStream* s)
+{
+	UINT32 x, y;
+	UINT32 i = 0;
+	UINT32 numBits;
+	UINT32 maxDepth;
+	UINT32 paletteCount = 0;
+	UINT32 palette[CLEARCODEC_RLEX_MAX_COLORS];
+	UINT32 slotColors[256];
+	BYTE slotIndex[256] = { 0 };
+	BYTE indices[CLEARCODEC_CELL_WIDTH * CLEARCODEC_BAND_MAX_HEIGHT];
+	const UINT32 pixelCount = cell->width * cell->height;
+	UINT32 bitmapDataByteCount;
+
+	if (pixelCount > ARRAYSIZE(indices))
+		return -1;
+
+	/* palette in order of first appearance, consecutive new colors form suites */
+	for (y = cell->y; y < cell->y + cell->height; y++)
+	{
+		const UINT32* pSrc = &pixels[(y * nWidth) + cell->x];
+
+		for (x = 0; x < cell->width; x++)
+		{
+			const UINT32 color = pSrc[x];
+			UINT32 slot = ((color * 2654435761UL) >> 24) & 0xFF;
+
+			while (slotIndex[slot] && (slotColors[slot] != color))
+				slot = (slot + 1) & 0xFF;
+
+			if (!slotIndex[slot])
+			{
+				if (paletteCount >= CLEARCODEC_RLEX_MAX_COLORS)
+					return -1;
+
+				palette[paletteCount++] = color;
+				slotColors[slot] = color;
+				slotIndex[slot] = (BYTE)paletteCount;
+			}
+
+			indices[i++] = slotIndex[slot] - 1;
+		}
+	}
+
+	numBits = CLEAR_LOG2_FLOOR[paletteCount - 1] + 1;
+	maxDepth = CLEAR_8BIT_MASKS[8 - numBits];
+	bitmapDataByteCount = 1 + (paletteCount * 3);
+
+	if (s)
+	{
+		if (!Stream_EnsureRemainingCapacity(s, bitmapDataByteCount))
+			return -1;
+
+		Stream_Write_UINT8(s, (BYTE)paletteCount);
+
+		for (x = 0; x < paletteCount; x++)
+			clear_write_color(s, palette[x]);
+	}
+
+	i = 0;
+
+	while (i < pixelCount)
+	{
+		UINT32 run = 1;
+		UINT32 suiteDepth = 0;
+		const BYTE startIndex = indices[i];
+
+		while ((i + run < pixelCount) && (indices[i + run] == startIndex))
+			run++;
+
+		/* the last pixel of the run is the first element of the suite */
+		i += run;
+
+		while ((suiteDepth < maxDepth) && (i < pixelCount) &&
+		       (indices[i] == startIndex + suiteDepth + 1))
+		{
+			suiteDepth++;
+			i++;
+		}
+
+		bitmapDataByteCount += 1 + clear_run_length_size(run - 1);
+
+		if (s)
+		{
+			if (!Stream_EnsureRemainingCapacity(s, 8))
+				return -1;
+
+			Stream_Write_UINT8(s, (BYTE)((suiteDepth << numBits) | (startIndex + suiteDepth)));
+			clear_write_run_length(s, run - 1);
+		}
+	}
+
+	return (int)bitmapDataByteCount;
+}
+
+static BOOL clear_encode_subcodec_uncompressed(const UINT32* pixels, UINT32 nWidth,
+                                               const CLEAR_CELL* cell, wStream* s)
+{
+	UINT32 x, y;
+
+	if (!Stream_EnsureRemainingCapacity(s, cell->width * cell->height * 3))
+		return FALSE;
+
+	for (y = cell->y; y < cell->y + cell->height; y++)
+	{
+		const UINT32* pSrc = &pixels[(y * nWidth) + cell->x];
+
+		for (x = 0; x < cell->width; x++)
+			clear_write_color(s, pSrc[x]);
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_cells(CLEAR_CONTEXT* clear, UINT32 nWidth, UINT32 nHeight,
+                               UINT32* pNumCells)
+{
+	UINT32 x, y;
+	UINT32 numCells = 0;
+	const UINT32* pixels = clear->SrcPixels;
+	const UINT32 maxCells = ((nWidth + CLEARCODEC_CELL_WIDTH - 1) / CLEARCODEC_CELL_WIDTH) *
+	                        ((nHeight + CLEARCODEC_BAND_MAX_HEIGHT - 1) / CLEARCODEC_BAND_MAX_HEIGHT);
+
+	if (maxCells > clear->CellsSize)
+	{
+		CLEAR_CELL* tmp = (CLEAR_CELL*)realloc(clear->Cells, maxCells * sizeof(CLEAR_CELL));
+
+		if (!tmp)
+		{
+			WLog_ERR(TAG, "clear->Cells realloc failed for %" PRIu32 " cells", maxCells);
+			return FALSE;
+		}
+
+		clear->Cells = tmp;
+		clear->CellsSize = maxCells;
+	}
+
+	for (y = 0; y < nHeight; y += CLEARCODEC_BAND_MAX_HEIGHT)
+	{
+		for (x = 0; x < nWidth; x += CLEARCODEC_CELL_WIDTH)
+		{
+			int rlex;
+			UINT32 cost;
+			UINT32 bandsCost;
+			CLEAR_CELL* cell = &(clear->Cells[numCells++]);
+			cell->x = x;
+			cell->y = y;
+			cell->width = MIN(CLEARCODEC_CELL_WIDTH, nWidth - x);
+			cell->height = MIN(CLEARCODEC_BAND_MAX_HEIGHT, nHeight - y);
+			cell->colorBkg = clear_encode_cell_background(pixels, nWidth, cell);
+			/* subcodecs carry a 13 byte header */
+			cell->mode = CLEAR_CELL_UNCOMPRESSED;
+			cost = 13 + (cell->width * cell->height * 3);
+			rlex = clear_encode_subcodec_rlex(pixels, nWidth, cell, NULL);
+
+			if ((rlex >= 0) && (13 + (UINT32)rlex < cost))
+			{
+				cell->mode = CLEAR_CELL_RLEX;
+				cost = 13 + (UINT32)rlex;
+			}
+
+			bandsCost = clear_encode_bands_cost(clear, pixels, nWidth, cell);
+
+			if (bandsCost < cost)
+			{
+				cell->mode = CLEAR_CELL_BANDS;
+				cost = bandsCost;
+			}
+
+			if (clear_encode_residual_cost(pixels, nWidth, cell) <= cost)
+				cell->mode = CLEAR_CELL_RESIDUAL;
+		}
+	}
+
+	*pNumCells = numCells;
+	return TRUE;
+}
+
+static BOOL clear_encode_residual_data(CLEAR_CONTEXT* clear, wStream* s, UINT32 nWidth,
+                                       UINT32 numCells)
+{
+	UINT32 i, x, y;
+	UINT32 color = 0;
+	UINT32 runLengthFactor = 0;
+	BOOL runHasColor = FALSE;
+	const UINT32* pixels = clear->SrcPixels;
+
+	/* pixels of other cells are overwritten later, they extend the current run */
+	for (i = 0; i < numCells;)
+	{
+		UINT32 first = i;
+		const UINT32 top = clear->Cells[i].y;
+
+		while ((i < numCells) && (clear->Cells[i].y == top))
+			i++;
+
+		for (y = top; y < top + clear->Cells[first].height; y++)
+		{
+			UINT32 index;
+
+			for (index = first; index < i; index++)
+			{
+				const CLEAR_CELL* cell = &(clear->Cells[index]);
+				const UINT32* pSrc = &pixels[(y * nWidth) + cell->x];
+
+				if (cell->mode != CLEAR_CELL_RESIDUAL)
+				{
+					runLengthFactor += cell->width;
+					continue;
+				}
+
+				for (x = 0; x < cell->width; x++)
+				{
+					if (!runHasColor)
+					{
+						color = pSrc[x];
+						runHasColor = TRUE;
+					}
+					else if (pSrc[x] != color)
+					{
+						if (!Stream_EnsureRemainingCapacity(s, 10))
+							return FALSE;
+
+						clear_write_color(s, color);
+						clear_write_run_length(s, runLengthFactor);
+						color = pSrc[x];
+						runLengthFactor = 0;
+					}
+
+					runLengthFactor++;
+				}
+			}
+		}
+	}
+
+	if (runLengthFactor)
+	{
+		if (!Stream_EnsureRemainingCapacity(s, 10))
+			return FALSE;
+
+		clear_write_color(s, color);
+		clear_write_run_length(s, runLengthFactor);
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_band(CLEAR_CONTEXT* clear, wStream* s, UINT32 nWidth, UINT32 xStart,
+                              UINT32 xEnd, const CLEAR_CELL* cell)
+{
+	UINT32 x;
+	UINT32 yOn, yOff;
+	UINT32 vBar[CLEARCODEC_BAND_MAX_HEIGHT];
+	const UINT32 vBarHeight = cell->height;
+
+	if (!Stream_EnsureRemainingCapacity(s, 11))
+		return FALSE;
+
+	Stream_Write_UINT16(s, (UINT16)xStart);
+	Stream_Write_UINT16(s, (UINT16)xEnd);
+	Stream_Write_UINT16(s, (UINT16)cell->y);
+	Stream_Write_UINT16(s, (UINT16)(cell->y + vBarHeight - 1));
+	clear_write_color(s, cell->colorBkg);
+
+	for (x = xStart; x <= xEnd; x++)
+	{
+		UINT32 index;
+		UINT32 count;
+		UINT32 vBarHash;
+		UINT32 shortHash;
+		clear_encode_get_vbar(clear->SrcPixels, nWidth, x, cell->y, vBarHeight, cell->colorBkg,
+		                      vBar, &yOn, &yOff);
+		vBarHash = clear_hash_pixels(vBar, vBarHeight);
+		index = clear_encode_vbar_lookup(clear->VBarStorage, clear->VBarHashTable,
+		                                 CLEARCODEC_VBAR_SIZE, vBar, vBarHeight, vBarHash);
+
+		if (!Stream_EnsureRemainingCapacity(s, 2 + (CLEARCODEC_BAND_MAX_HEIGHT * 3)))
+			return FALSE;
+
+		if (index)
+		{
+			Stream_Write_UINT16(s, 0x8000 | (index - 1)); /* VBAR_CACHE_HIT */
+			continue;
+		}
+
+		count = yOff - yOn;
+		shortHash = clear_hash_pixels(&vBar[yOn], count);
+		index = count ? clear_encode_vbar_lookup(clear->ShortVBarStorage, clear->ShortVBarHashTable,
+		                                         CLEARCODEC_VBAR_SHORT_SIZE, &vBar[yOn], count,
+		                                         shortHash)
+		              : 0;
+
+		if (index)
+		{
+			Stream_Write_UINT16(s, 0x4000 | (index - 1)); /* SHORT_VBAR_CACHE_HIT */
+			Stream_Write_UINT8(s, (BYTE)yOn);
+		}
+		else
+		{
+			UINT32 y;
+			Stream_Write_UINT16(s, (UINT16)(yOn | (yOff << 8))); /* SHORT_VBAR_CACHE_MISS */
+
+			for (y = yOn; y < yOff; y++)
+				clear_write_color(s, vBar[y]);
+
+			if (!clear_encode_vbar_insert(clear, clear->ShortVBarStorage, clear->ShortVBarHashTable,
+			                              CLEARCODEC_VBAR_SHORT_SIZE, clear->ShortVBarStorageCursor,
+			                              &vBar[yOn], count, shortHash))
+				return FALSE;
+
+			clear->ShortVBarStorageCursor =
+			    (clear->ShortVBarStorageCursor + 1) % CLEARCODEC_VBAR_SHORT_SIZE;
+		}
+
+		/* both short vBar variants store the reconstructed vBar on the decoder */
+		if (!clear_encode_vbar_insert(clear, clear->VBarStorage, clear->VBarHashTable,
+		                              CLEARCODEC_VBAR_SIZE, clear->VBarStorageCursor, vBar,
+		                              vBarHeight, vBarHash))
+			return FALSE;
+
+		clear->VBarStorageCursor = (clear->VBarStorageCursor + 1) % CLEARCODEC_VBAR_SIZE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_bands_data(CLEAR_CONTEXT* clear, wStream* s, UINT32 nWidth,
+                                    UINT32 numCells)
+{
+	UINT32 i = 0;
+
+	while (i < numCells)
+	{
+		const CLEAR_CELL* cell = &(clear->Cells[i]);
+		const CLEAR_CELL* last = cell;
+
+		if (cell->mode != CLEAR_CELL_BANDS)
+		{
+			i++;
+			continue;
+		}
+
+		/* neighbouring band cells with the same background share one band */
+		for (i++; i < numCells; i++)
+		{
+			const CLEAR_CELL* next = &(clear->Cells[i]);
+
+			if ((next->mode != CLEAR_CELL_BANDS) || (next->y != cell->y) ||
+			    (next->colorBkg != cell->colorBkg))
+				break;
+
+			last = next;
+		}
+
+		if (!clear_encode_band(clear, s, nWidth, cell->x, last->x + last->width - 1, cell))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_subcodecs_data(CLEAR_CONTEXT* clear, wStream* s, UINT32 nWidth,
+                                        UINT32 numCells)
+{
+	UINT32 i;
+
+	for (i = 0; i < numCells; i++)
+	{
+		size_t start;
+		size_t end;
+		BYTE subcodecId;
+		const CLEAR_CELL* cell = &(clear->Cells[i]);
+
+		if (cell->mode == CLEAR_CELL_RLEX)
+			subcodecId = 2; /* CLEARCODEC_SUBCODEC_RLEX */
+		else if (cell->mode == CLEAR_CELL_UNCOMPRESSED)
+			subcodecId = 0; /* Uncompressed */
+		else
+			continue;
+
+		if (!Stream_EnsureRemainingCapacity(s, 13))
+			return FALSE;
+
+		start = Stream_GetPosition(s);
+		Stream_Seek(s, 13);
+
+		if (subcodecId == 2)
+		{
+			if (clear_encode_subcodec_rlex(clear->SrcPixels, nWidth, cell, s) < 0)
+				return FALSE;
+		}
+		else if (!clear_encode_subcodec_uncompressed(clear->SrcPixels, nWidth, cell, s))
+			return FALSE;
+
+		end = Stream_GetPosition(s);
+		Stream_SetPosition(s, start);
+		Stream_Write_UINT16(s, (UINT16)cell->x);              /* xStart (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)cell->y);              /* yStart (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)cell->width);          /* width (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)cell->height);         /* height (2 bytes) */
+		Stream_Write_UINT32(s, (UINT32)(end - start - 13));   /* bitmapDataByteCount (4 bytes) */
+		Stream_Write_UINT8(s, subcodecId);                    /* subcodecId (1 byte) */
+		Stream_SetPosition(s, end);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Bitmaps of up to 1024 pixels go through the glyph cache. Everything else is
+ * split into cells of up to 64x52 pixels, each cell is sent with whichever of
+ * residual, bands or a subcodec (RLEX or uncompressed) is estimated to be the
+ * cheapest. The NSCodec subcodec is lossy and never used by the encoder.
+ * The output buffer belongs to the context and remains valid until the next call.
+ */
+int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, UINT32 SrcFormat,
+                   UINT32 nWidth, UINT32 nHeight, UINT32 nSrcStep, BYTE** ppDstData,
                    UINT32* pDstSize)
 {
-	WLog_ERR(TAG, "TODO: %s not implemented!", __FUNCTION__);
+	UINT32 i;
+	UINT32 numCells = 0;
+	UINT32 glyphHash = 0;
+	UINT16 glyphIndex = 0;
+	BYTE glyphFlags = 0;
+	BOOL glyphInsert = FALSE;
+	size_t headerPos;
+	size_t residualPos;
+	size_t bandsPos;
+	size_t subcodecPos;
+	size_t end;
+	wStream* s;
+
+	if (!clear || !clear->Compressor || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	s = clear->buffer;
+
+	if (!s || (nWidth == 0) || (nHeight == 0) || (nWidth > 0xFFFF) || (nHeight > 0xFFFF))
+		return -1;
+
+	if ((nSrcStep < nWidth * GetBytesPerPixel(SrcFormat)) || (SrcSize < nSrcStep * nHeight))
+		return -1;
+
+	/* cache entries are stored as UINT32 pixels */
+	if (!updateContextFormat(clear, PIXEL_FORMAT_BGRX32))
+		return -1;
+
+	if (!clear_encode_load_source(clear, pSrcData, SrcFormat, nSrcStep, nWidth, nHeight))
+		return -1;
+
+	*ppDstData = NULL;
+	*pDstSize = 0;
+	Stream_SetPosition(s, 0);
+
+	if (!Stream_EnsureRemainingCapacity(s, 16))
+		return -1;
+
+	if (clear->CacheReset)
+	{
+		glyphFlags |= CLEARCODEC_FLAG_CACHE_RESET;
+		clear->VBarStorageCursor = 0;
+		clear->ShortVBarStorageCursor = 0;
+		clear->CacheReset = FALSE;
+	}
+
+	if ((nWidth * nHeight) <= CLEARCODEC_GLYPH_MAX_PIXELS)
+	{
+		glyphHash = clear_hash_pixels(clear->SrcPixels, nWidth * nHeight) ^ (nWidth << 16);
+
+		if (clear_encode_glyph_lookup(clear, nWidth, nHeight, glyphHash, &glyphIndex))
+		{
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX | CLEARCODEC_FLAG_GLYPH_HIT;
+		}
+		else
+		{
+			glyphIndex = (UINT16)clear->GlyphCacheCursor;
+			clear->GlyphCacheCursor = (clear->GlyphCacheCursor + 1) % 4000;
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX;
+			glyphInsert = TRUE;
+		}
+	}
+
+	Stream_Write_UINT8(s, glyphFlags);
+	Stream_Write_UINT8(s, (BYTE)clear->seqNumber);
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_INDEX)
+		Stream_Write_UINT16(s, glyphIndex);
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_HIT)
+		goto finish;
+
+	if (!clear_encode_cells(clear, nWidth, nHeight, &numCells))
+		return -1;
+
+	headerPos = Stream_GetPosition(s);
+	Stream_Seek(s, 12);
+	residualPos = Stream_GetPosition(s);
+
+	for (i = 0; i < numCells; i++)
+	{
+		if (clear->Cells[i].mode == CLEAR_CELL_RESIDUAL)
+		{
+			if (!clear_encode_residual_data(clear, s, nWidth, numCells))
+				return -1;
+
+			break;
+		}
+	}
+
+	bandsPos = Stream_GetPosition(s);
+
+	if (!clear_encode_bands_data(clear, s, nWidth, numCells))
+		return -1;
+
+	subcodecPos = Stream_GetPosition(s);
+
+	if (!clear_encode_subcodecs_data(clear, s, nWidth, numCells))
+		return -1;
+
+	end = Stream_GetPosition(s);
+	Stream_SetPosition(s, headerPos);
+	Stream_Write_UINT32(s, (UINT32)(bandsPos - residualPos));  /* residualByteCount (4 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(subcodecPos - bandsPos));  /* bandsByteCount (4 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(end - subcodecPos));       /* subcodecByteCount (4 bytes) */
+	Stream_SetPosition(s, end);
+
+	if (glyphInsert && !clear_encode_glyph_insert(clear, glyphIndex, nWidth, nHeight, glyphHash))
+		return -1;
+
+finish:
+	clear->seqNumber = (clear->seqNumber + 1) % 256;
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32)Stream_GetPosition(s);
 	return 1;
 }
+
 BOOL clear_context_reset(CLEAR_CONTEXT* clear)
 {
 	if (!clear)
 		return FALSE;
 
 	clear->seqNumber = 0;
+
+	/* a new decoder starts with empty caches, forget everything it might not have */
+	if (clear->Compressor)
+	{
+		UINT32 i;
+
+		for (i = 0; i < 4000; i++)
+			clear->GlyphCache[i].count = 0;
+
+		for (i = 0; i < CLEARCODEC_VBAR_SIZE; i++)
+			clear->VBarStorage[i].count = 0;
+
+		for (i = 0; i < CLEARCODEC_VBAR_SHORT_SIZE; i++)
+			clear->ShortVBarStorage[i].count = 0;
+
+		ZeroMemory(clear->GlyphHashTable, sizeof(clear->GlyphHashTable));
+		ZeroMemory(clear->VBarHashTable, sizeof(clear->VBarHashTable));
+		ZeroMemory(clear->ShortVBarHashTable, sizeof(clear->ShortVBarHashTable));
+		clear->GlyphCacheCursor = 0;
+		clear->VBarStorageCursor = 0;
+		clear->ShortVBarStorageCursor = 0;
+		clear->CacheReset = TRUE;
+	}
+
 	return TRUE;
 }
+
 CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
 {
 	CLEAR_CONTEXT* clear;
@@ -1168,6 +2089,14 @@ CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
 	clear->Compressor = Compressor;
 	clear->nsc = nsc_context_new();
 
+	if (Compressor)
+	{
+		clear->buffer = Stream_New(NULL, 0xFFFF);
+
+		if (!clear->buffer)
+			goto error_nsc;
+	}
+
 	if (!clear->nsc)
 		goto error_nsc;
 
@@ -1197,6 +2126,9 @@ void clear_context_free(CLEAR_CONTEXT* clear)
 
 	nsc_context_free(clear->nsc);
 	free(clear->TempBuffer);
+	Stream_Free(clear->buffer, TRUE);
+	free(clear->SrcPixels);
+	free(clear->Cells);
 
 	for (i = 0; i < 4000; i++)
 		free(clear->GlyphCache[i].pixels);
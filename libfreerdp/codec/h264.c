@@ -500,6 +500,18 @@ static BOOL CALLBACK h264_register_subsystems(PINIT_ONCE once, PVOID param, PVOI
 		i++;
 	}
 #endif
+#ifdef WITH_X264
+	{
+		/*
+		 * x264 is only built when WITH_X264=ON is asked for explicitly, so it goes
+		 * first: behind the other encoders it would never be used. It only encodes,
+		 * decoders fall through to the next subsystem.
+		 */
+		extern H264_CONTEXT_SUBSYSTEM g_Subsystem_x264;
+		subSystems[i] = &g_Subsystem_x264;
+		i++;
+	}
+#endif
 #ifdef WITH_OPENH264
 	{
 		extern H264_CONTEXT_SUBSYSTEM g_Subsystem_OpenH264;
@@ -513,13 +525,6 @@ static BOOL CALLBACK h264_register_subsystems(PINIT_ONCE once, PVOID param, PVOI
 		subSystems[i] = &g_Subsystem_libavcodec;
 		i++;
 	}
-#endif
-#ifdef WITH_X264
-	{
-		extern H264_CONTEXT_SUBSYSTEM g_Subsystem_x264;
-		subSystems[i] = &g_Subsystem_x264;
-		i++;
-	}
 #endif
 	return i > 0;
 }
@@ -157,6 +157,19 @@ static BOOL libavcodec_create_encoder(H264_CONTEXT* h264)
 			sys->codecEncoderContext->bit_rate = h264->BitRate;
 			break;
 
+		case H264_RATECONTROL_CBR:
+			sys->codecEncoderContext->bit_rate = h264->BitRate;
+			sys->codecEncoderContext->rc_min_rate = h264->BitRate;
+			sys->codecEncoderContext->rc_max_rate = h264->BitRate;
+			sys->codecEncoderContext->rc_buffer_size =
+			    (h264->FrameRate >= 1.0f) ? (int)(h264->BitRate / h264->FrameRate)
+			                              : (int)h264->BitRate;
+			break;
+
+		case H264_RATECONTROL_CRF:
+			av_opt_set_int(sys->codecEncoderContext, "crf", h264->QP, AV_OPT_SEARCH_CHILDREN);
+			break;
+
 		case H264_RATECONTROL_CQP:
 			/* TODO: sys->codecEncoderContext-> = h264->QP; */
 			break;
@@ -204,6 +204,7 @@ static int openh264_compress(H264_CONTEXT* h264, const BYTE** pYUVData, const UI
 		switch (h264->RateControlMode)
 		{
 			case H264_RATECONTROL_VBR:
+			case H264_RATECONTROL_CBR:
 				sys->EncParamExt.iRCMode = RC_BITRATE_MODE;
 				sys->EncParamExt.iTargetBitrate = (int)h264->BitRate;
 				sys->EncParamExt.sSpatialLayers[0].iSpatialBitrate =
@@ -211,6 +212,7 @@ static int openh264_compress(H264_CONTEXT* h264, const BYTE** pYUVData, const UI
 				break;
 
 			case H264_RATECONTROL_CQP:
+			case H264_RATECONTROL_CRF:
 				sys->EncParamExt.iRCMode = RC_OFF_MODE;
 				sys->EncParamExt.sSpatialLayers[0].iDLayerQp = (int)h264->QP;
 				break;
@@ -250,6 +252,7 @@ static int openh264_compress(H264_CONTEXT* h264, const BYTE** pYUVData, const UI
 		switch (h264->RateControlMode)
 		{
 			case H264_RATECONTROL_VBR:
+			case H264_RATECONTROL_CBR:
 				if (sys->EncParamExt.iTargetBitrate != (int)h264->BitRate)
 				{
 					sys->EncParamExt.iTargetBitrate = (int)h264->BitRate;
@@ -284,6 +287,7 @@ static int openh264_compress(H264_CONTEXT* h264, const BYTE** pYUVData, const UI
 				break;
 
 			case H264_RATECONTROL_CQP:
+			case H264_RATECONTROL_CRF:
 				if (sys->EncParamExt.sSpatialLayers[0].iDLayerQp != (int)h264->QP)
 				{
 					sys->EncParamExt.sSpatialLayers[0].iDLayerQp = (int)h264->QP;
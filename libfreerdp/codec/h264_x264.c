@@ -35,28 +35,341 @@
 #define NAL_PRIORITY_HIGHEST X264_NAL_PRIORITY_HIGHEST
 
 #include <stdint.h>
+#include <stdarg.h>
 #include <x264.h>
-#include <freerdp/codec/h264.h>
 
-#error "X264 backend not implemented, please review your configuration!"
+#include <winpr/crt.h>
+
+#include <freerdp/codec/h264.h>
 
 struct _H264_CONTEXT_X264
 {
-	void* dummy;
+	x264_t* encoder;
+	x264_param_t param;
+	int64_t pts;
+
+	H264_RATECONTROL_MODE RateControlMode;
+	UINT32 BitRate;
+	FLOAT FrameRate;
+	UINT32 QP;
+
+	/* Previous input frame, used to flag unchanged macroblocks */
+	BYTE* pPrevYUV[3];
+	UINT32 iPrevStride[3];
+	BOOL prevValid;
+	BOOL avc444;
 };
 typedef struct _H264_CONTEXT_X264 H264_CONTEXT_X264;
 
-static int x264_decompress(H264_CONTEXT* h264, BYTE* pSrcData, UINT32 SrcSize)
+static void x264_log_callback(void* context, int level, const char* fmt, va_list args)
+{
+	char buffer[512];
+	H264_CONTEXT* h264 = (H264_CONTEXT*)context;
+	DWORD wlevel;
+
+	switch (level)
+	{
+		case X264_LOG_ERROR:
+			wlevel = WLOG_ERROR;
+			break;
+
+		case X264_LOG_WARNING:
+			wlevel = WLOG_WARN;
+			break;
+
+		case X264_LOG_INFO:
+			wlevel = WLOG_INFO;
+			break;
+
+		default:
+			wlevel = WLOG_DEBUG;
+			break;
+	}
+
+	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	WLog_Print(h264->log, wlevel, "%s", buffer);
+}
+
+static void x264_apply_ratecontrol(H264_CONTEXT* h264, x264_param_t* param)
+{
+	const int bitrate = (int)(h264->BitRate / 1000);
+
+	param->i_fps_num = (uint32_t)(h264->FrameRate * 1000);
+	param->i_fps_den = 1000;
+	param->rc.i_bitrate = 0;
+	param->rc.i_vbv_max_bitrate = 0;
+	param->rc.i_vbv_buffer_size = 0;
+
+	switch (h264->RateControlMode)
+	{
+		case H264_RATECONTROL_VBR:
+			param->rc.i_rc_method = X264_RC_ABR;
+			param->rc.i_bitrate = bitrate;
+			break;
+
+		case H264_RATECONTROL_CBR:
+			/* A single frame VBV buffer keeps every frame close to the target size */
+			param->rc.i_rc_method = X264_RC_ABR;
+			param->rc.i_bitrate = bitrate;
+			param->rc.i_vbv_max_bitrate = bitrate;
+			param->rc.i_vbv_buffer_size = (h264->FrameRate >= 1.0f)
+			                                  ? (int)(bitrate / h264->FrameRate)
+			                                  : bitrate;
+			break;
+
+		case H264_RATECONTROL_CQP:
+			param->rc.i_rc_method = X264_RC_CQP;
+			param->rc.i_qp_constant = (int)h264->QP;
+			break;
+
+		case H264_RATECONTROL_CRF:
+			param->rc.i_rc_method = X264_RC_CRF;
+			param->rc.f_rf_constant = (float)h264->QP;
+			break;
+	}
+}
+
+static void x264_close_encoder(H264_CONTEXT_X264* sys)
+{
+	size_t x;
+
+	if (sys->encoder)
+		x264_encoder_close(sys->encoder);
+
+	sys->encoder = NULL;
+	sys->prevValid = FALSE;
+
+	for (x = 0; x < 3; x++)
+	{
+		_aligned_free(sys->pPrevYUV[x]);
+		sys->pPrevYUV[x] = NULL;
+	}
+}
+
+static BOOL x264_open_encoder(H264_CONTEXT* h264, H264_CONTEXT_X264* sys)
 {
-	// H264_CONTEXT_X264* sys = (H264_CONTEXT_X264*) h264->pSystemData;
+	size_t x;
+	x264_param_t* param = &sys->param;
+	x264_close_encoder(sys);
+
+	if (x264_param_default_preset(param, "veryfast", "zerolatency") < 0)
+		return FALSE;
+
+	param->i_width = (int)h264->width;
+	param->i_height = (int)h264->height;
+	param->i_csp = X264_CSP_I420;
+	param->i_threads = (int)h264->NumberOfThreads;
+	param->b_sliced_threads = 1;
+	param->i_keyint_max = X264_KEYINT_MAX_INFINITE;
+	param->b_repeat_headers = 1;
+	param->b_annexb = 1;
+	param->analyse.b_mb_info = 1;
+	param->pf_log = x264_log_callback;
+	param->p_log_private = h264;
+	param->i_log_level = X264_LOG_WARNING;
+	x264_apply_ratecontrol(h264, param);
+
+	if (x264_param_apply_profile(param, "high") < 0)
+		return FALSE;
+
+	sys->encoder = x264_encoder_open(param);
+
+	if (!sys->encoder)
+	{
+		WLog_Print(h264->log, WLOG_ERROR, "Failed to open x264 encoder");
+		return FALSE;
+	}
+
+	for (x = 0; x < 3; x++)
+	{
+		const UINT32 height = (x == 0) ? h264->height : (h264->height + 1) / 2;
+		sys->iPrevStride[x] = (x == 0) ? h264->width : (h264->width + 1) / 2;
+		sys->pPrevYUV[x] = _aligned_malloc(1ull * sys->iPrevStride[x] * height, 16);
+
+		if (!sys->pPrevYUV[x])
+			return FALSE;
+	}
+
+	sys->RateControlMode = h264->RateControlMode;
+	sys->BitRate = h264->BitRate;
+	sys->FrameRate = h264->FrameRate;
+	sys->QP = h264->QP;
+	return TRUE;
+}
+
+static BOOL x264_update_encoder(H264_CONTEXT* h264, H264_CONTEXT_X264* sys)
+{
+	if (sys->encoder && (sys->param.i_width == (int)h264->width) &&
+	    (sys->param.i_height == (int)h264->height))
+	{
+		if ((sys->RateControlMode == h264->RateControlMode) && (sys->BitRate == h264->BitRate) &&
+		    (sys->FrameRate == h264->FrameRate) && (sys->QP == h264->QP))
+			return TRUE;
+
+		/* Bitrate and rate factor changes apply to the running encoder */
+		if (sys->RateControlMode == h264->RateControlMode)
+		{
+			x264_param_t param = sys->param;
+			x264_apply_ratecontrol(h264, &param);
+
+			if (x264_encoder_reconfig(sys->encoder, &param) == 0)
+			{
+				sys->param = param;
+				sys->BitRate = h264->BitRate;
+				sys->FrameRate = h264->FrameRate;
+				sys->QP = h264->QP;
+				return TRUE;
+			}
+		}
+	}
+
+	return x264_open_encoder(h264, sys);
+}
+
+static BOOL x264_plane_block_equal(const BYTE* pSrc, UINT32 nSrcStep, const BYTE* pPrev,
+                                   UINT32 nPrevStep, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 y;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		if (memcmp(&pSrc[y * nSrcStep], &pPrev[y * nPrevStep], nWidth) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Flags the macroblocks that did not change since the previous input frame as constant,
+ * which lets x264 skip analysis and encode them as skip blocks. Only the changed screen
+ * regions end up costing encoder time and bits.
+ */
+static uint8_t* x264_build_mb_info(H264_CONTEXT* h264, H264_CONTEXT_X264* sys,
+                                   const BYTE** pYUVData, const UINT32* iStride)
+{
+	UINT32 x, y, plane;
+	const UINT32 mbWidth = (h264->width + 15) / 16;
+	const UINT32 mbHeight = (h264->height + 15) / 16;
+	uint8_t* mbInfo = NULL;
+
+	if (sys->prevValid)
+	{
+		mbInfo = calloc(1ull * mbWidth * mbHeight, sizeof(uint8_t));
+
+		/* The reference is not updated, the next frame has to start over */
+		if (!mbInfo)
+		{
+			sys->prevValid = FALSE;
+			return NULL;
+		}
+	}
+
+	for (y = 0; y < mbHeight; y++)
+	{
+		for (x = 0; x < mbWidth; x++)
+		{
+			BOOL equal = TRUE;
+
+			for (plane = 0; plane < 3; plane++)
+			{
+				const UINT32 shift = (plane == 0) ? 4 : 3;
+				const UINT32 planeWidth = (plane == 0) ? h264->width : (h264->width + 1) / 2;
+				const UINT32 planeHeight = (plane == 0) ? h264->height : (h264->height + 1) / 2;
+				const UINT32 left = x << shift;
+				const UINT32 top = y << shift;
+				const UINT32 width = MIN(1u << shift, planeWidth - left);
+				const UINT32 height = MIN(1u << shift, planeHeight - top);
+				const BYTE* pSrc = &pYUVData[plane][top * iStride[plane] + left];
+				BYTE* pPrev = &sys->pPrevYUV[plane][top * sys->iPrevStride[plane] + left];
+
+				if (equal && mbInfo)
+					equal = x264_plane_block_equal(pSrc, iStride[plane], pPrev,
+					                               sys->iPrevStride[plane], width, height);
+
+				if (!equal || !mbInfo)
+				{
+					UINT32 row;
+
+					for (row = 0; row < height; row++)
+						memcpy(&pPrev[row * sys->iPrevStride[plane]],
+						       &pSrc[row * iStride[plane]], width);
+				}
+			}
+
+			if (mbInfo && equal)
+				mbInfo[y * mbWidth + x] = X264_MBINFO_CONSTANT;
+		}
+	}
+
+	sys->prevValid = TRUE;
+	return mbInfo;
+}
+
+static int x264_decompress(H264_CONTEXT* h264, const BYTE* pSrcData, UINT32 SrcSize)
+{
+	WINPR_UNUSED(pSrcData);
+	WINPR_UNUSED(SrcSize);
+	WLog_Print(h264->log, WLOG_ERROR, "x264 does not support decoding");
 	return -1;
 }
 
 static int x264_compress(H264_CONTEXT* h264, const BYTE** ppSrcYuv, const UINT32* pStride,
                          BYTE** ppDstData, UINT32* pDstSize)
 {
-	// H264_CONTEXT_X264* sys = (H264_CONTEXT_X264*) h264->pSystemData;
-	return -1;
+	int status;
+	int i_nals = 0;
+	x264_nal_t* nals = NULL;
+	x264_picture_t pic;
+	x264_picture_t pic_out;
+	H264_CONTEXT_X264* sys = (H264_CONTEXT_X264*)h264->pSystemData;
+
+	if (!sys || !ppSrcYuv || !pStride || !ppDstData || !pDstSize)
+		return -1;
+
+	if (!ppSrcYuv[0] || !ppSrcYuv[1] || !ppSrcYuv[2])
+		return -1;
+
+	if ((h264->width > INT_MAX) || (h264->height > INT_MAX) || (h264->FrameRate <= 0))
+		return -1;
+
+	if (!x264_update_encoder(h264, sys))
+		return -1;
+
+	x264_picture_init(&pic);
+	pic.img.i_csp = X264_CSP_I420;
+	pic.img.i_plane = 3;
+	pic.img.i_stride[0] = (int)pStride[0];
+	pic.img.i_stride[1] = (int)pStride[1];
+	pic.img.i_stride[2] = (int)pStride[2];
+	pic.img.plane[0] = (uint8_t*)ppSrcYuv[0];
+	pic.img.plane[1] = (uint8_t*)ppSrcYuv[1];
+	pic.img.plane[2] = (uint8_t*)ppSrcYuv[2];
+	pic.i_pts = sys->pts++;
+
+	/* AVC444 interleaves the main and the auxiliary view in one encoder, the previous
+	 * frame of the encoder is the other view, so no block can be flagged as constant */
+	if (ppSrcYuv[0] == h264->pYUV444Data[0])
+		sys->avc444 = TRUE;
+
+	if (!sys->avc444)
+	{
+		pic.prop.mb_info = x264_build_mb_info(h264, sys, ppSrcYuv, pStride);
+		pic.prop.mb_info_free = free;
+	}
+
+	status = x264_encoder_encode(sys->encoder, &nals, &i_nals, &pic, &pic_out);
+
+	if (status < 0)
+	{
+		WLog_Print(h264->log, WLOG_ERROR, "Failed to encode frame (status=%d)", status);
+		return -1;
+	}
+
+	/* The payloads of all NAL units returned by one call are contiguous */
+	*ppDstData = (i_nals > 0) ? nals[0].p_payload : NULL;
+	*pDstSize = (UINT32)status;
+	return 1;
 }
 
 static void x264_uninit(H264_CONTEXT* h264)
@@ -65,6 +378,7 @@ static void x264_uninit(H264_CONTEXT* h264)
 
 	if (sys)
 	{
+		x264_close_encoder(sys);
 		free(sys);
 		h264->pSystemData = NULL;
 	}
@@ -73,6 +387,10 @@ static void x264_uninit(H264_CONTEXT* h264)
 static BOOL x264_init(H264_CONTEXT* h264)
 {
 	H264_CONTEXT_X264* sys;
+
+	if (!h264->Compressor)
+		return FALSE;
+
 	h264->numSystemData = 1;
 	sys = (H264_CONTEXT_X264*)calloc(h264->numSystemData, sizeof(H264_CONTEXT_X264));
 
@@ -81,15 +399,8 @@ static BOOL x264_init(H264_CONTEXT* h264)
 		goto EXCEPTION;
 	}
 
+	/* The encoder is opened on the first frame, once the dimensions are known */
 	h264->pSystemData = (void*)sys;
-
-	if (h264->Compressor)
-	{
-	}
-	else
-	{
-	}
-
 	return TRUE;
 EXCEPTION:
 	x264_uninit(h264);
@@ -395,37 +395,871 @@ BOOL interleaved_decompress(BITMAP_INTERLEAVED_CONTEXT* interleaved, const BYTE*
 	                          FREERDP_FLIP_VERTICAL);
 }
 
-BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved, BYTE* pDstData, UINT32* pDstSize,
-                          UINT32 nWidth, UINT32 nHeight, const BYTE* pSrcData, UINT32 SrcFormat,
-                          UINT32 nSrcStep, UINT32 nXSrc, UINT32 nYSrc, const gdiPalette* palette,
-                          UINT32 bpp)
+/*
+   RLE encoder
+
+   The encoder parses the bitmap with dynamic programming over a cost model.
+   For every pixel position it keeps the cheapest known way to reach it, once
+   ending with a closed order and once inside an open color image of each
+   header size, and tries every order that can start there. Orders can span rows, the parse runs on
+   bands of rows to bound the scratch memory and only the foreground color and
+   the background run state are carried from one band to the next.
+*/
+
+#define INTERLEAVED_BAND_ROWS 64
+#define INTERLEAVED_MAX_RUN 0xFFFF
+#define INTERLEAVED_INFINITE_COST 0xFFFFFFFF
+#define INTERLEAVED_MAX_LENGTHS 40
+#define INTERLEAVED_LITERAL_CLASSES 3
+
+typedef struct
 {
-	BOOL status;
-	wStream* s;
-	UINT32 DstFormat = 0;
-	const size_t maxSize = 64 * 64 * 4;
+	UINT32 cost;
+	UINT32 fg;
+	UINT32 from;
+	UINT32 length;
+	BYTE order;
+	BYTE bg;
+	BYTE source; /* 0 for an order, otherwise 1 + the class of the color image it closes */
+} INTERLEAVED_NODE;
+
+struct _BITMAP_INTERLEAVED_CONTEXT_PRIV
+{
+	UINT32 Level;
 
-	if (!interleaved || !pDstData || !pSrcData)
-		return FALSE;
+	size_t BandSize;
+	UINT32* BandPixels;
+	UINT32* BandRuns;
+	INTERLEAVED_NODE* BandNodes;
+	UINT32* BandPath;
+};
+
+typedef struct
+{
+	const UINT32* above;
+	const UINT32* pixels;
+	const UINT32* pSame;
+	const UINT32* pZero;
+	const UINT32* xSame;
+	const UINT32* xZero;
+	const UINT32* alt;
+	UINT32 width;
+	UINT32 start;
+	UINT32 count;
+	UINT32 bpp;
+	UINT32 white;
+	UINT32 level;
+	INTERLEAVED_NODE* nodes;
+	INTERLEAVED_NODE* literals[INTERLEAVED_LITERAL_CLASSES];
+} INTERLEAVED_BAND;
+
+typedef struct
+{
+	UINT32 fg;
+	UINT32 end;
+	BOOL first;
+	BOOL done;
+} INTERLEAVED_EXTENT;
+
+/**
+ * Orders starting on the first line are decoded against black instead of the
+ * previous line, for all of their pixels. Everything else is relative to the
+ * pixel above, a value of 0 is background.
+ */
+static INLINE BOOL interleaved_first_line(const INTERLEAVED_BAND* band, UINT32 t)
+{
+	return (band->start + t) < band->width;
+}
+
+static INLINE UINT32 interleaved_delta(const INTERLEAVED_BAND* band, BOOL first, UINT32 t)
+{
+	if (first)
+		return band->pixels[t];
+
+	return band->pixels[t] ^ band->above[t];
+}
+
+static INLINE UINT32 interleaved_zero_run(const INTERLEAVED_BAND* band, BOOL first, UINT32 t)
+{
+	return first ? band->pZero[t] : band->xZero[t];
+}
+
+static INLINE UINT32 interleaved_same_run(const INTERLEAVED_BAND* band, BOOL first, UINT32 t)
+{
+	return first ? band->pSame[t] : band->xSame[t];
+}
+
+/* Size of the order header, length is the run length field (pairs for dithered runs) */
+static INLINE UINT32 interleaved_header_size(BYTE order, UINT32 length)
+{
+	switch (order)
+	{
+		case REGULAR_FGBG_IMAGE:
+			if (((length % 8) == 0) && (length <= 248))
+				return 1;
+
+			return (length <= 256) ? 2 : 3;
+
+		case LITE_SET_FG_FGBG_IMAGE:
+			if (((length % 8) == 0) && (length <= 120))
+				return 1;
+
+			return (length <= 256) ? 2 : 3;
+
+		case LITE_SET_FG_FG_RUN:
+		case LITE_DITHERED_RUN:
+			if (length <= 15)
+				return 1;
+
+			return (length <= 271) ? 2 : 3;
+
+		case SPECIAL_FGBG_1:
+		case SPECIAL_FGBG_2:
+		case SPECIAL_WHITE:
+		case SPECIAL_BLACK:
+			return 1;
+
+		default:
+			if (length <= 31)
+				return 1;
+
+			return (length <= 287) ? 2 : 3;
+	}
+}
+
+static INLINE UINT32 interleaved_order_size(BYTE order, UINT32 length, UINT32 bpp)
+{
+	const UINT32 header = interleaved_header_size(order, length);
+
+	switch (order)
+	{
+		case LITE_SET_FG_FG_RUN:
+		case REGULAR_COLOR_RUN:
+			return header + bpp;
+
+		case LITE_DITHERED_RUN:
+			return header + 2 * bpp;
+
+		case REGULAR_FGBG_IMAGE:
+			return header + (length + 7) / 8;
+
+		case LITE_SET_FG_FGBG_IMAGE:
+			return header + bpp + (length + 7) / 8;
+
+		case REGULAR_COLOR_IMAGE:
+			return header + length * bpp;
+
+		default:
+			return header;
+	}
+}
+
+/* Run lengths worth trying: the longest run and where the header grows, more on higher levels */
+static UINT32 interleaved_run_lengths(UINT32 level, UINT32 max, BOOL lite, UINT32* lengths)
+{
+	UINT32 x;
+	UINT32 count = 0;
+	const UINT32 small = lite ? 15 : 31;
+	const UINT32 medium = lite ? 271 : 287;
+	lengths[count++] = max;
+
+	if (small < max)
+		lengths[count++] = small;
+
+	if (medium < max)
+		lengths[count++] = medium;
+
+	if ((level >= INTERLEAVED_LEVEL_DEFAULT) && (max > 1))
+		lengths[count++] = max - 1;
+
+	if (level >= INTERLEAVED_LEVEL_BEST)
+	{
+		for (x = 1; (x + 1 < max) && (x <= 16); x++)
+			lengths[count++] = x;
+	}
+
+	return count;
+}
+
+/* Foreground/background image lengths worth trying, the mask costs a byte per 8 pixels */
+static UINT32 interleaved_fgbg_lengths(UINT32 level, UINT32 max, UINT32* lengths)
+{
+	UINT32 x;
+	UINT32 count = 0;
+	lengths[count++] = max;
+
+	if ((max > 8) && (max % 8))
+		lengths[count++] = max & ~7u;
+
+	if (level >= INTERLEAVED_LEVEL_DEFAULT)
+	{
+		if (max > 8)
+			lengths[count++] = 8;
+
+		if (max > 248)
+			lengths[count++] = 248;
+
+		if (max > 256)
+			lengths[count++] = 256;
+	}
+
+	if (level >= INTERLEAVED_LEVEL_BEST)
+	{
+		for (x = 16; (x < max) && (x < 248); x += 8)
+			lengths[count++] = x;
+	}
+
+	return count;
+}
+
+/**
+ * Number of pixels from t that are either background or fg, hopping over whole
+ * runs. The extent found for the previous position is reused while the color
+ * does not change, so that the pixels of an image are only scanned once.
+ */
+static UINT32 interleaved_fgbg_length(const INTERLEAVED_BAND* band, INTERLEAVED_EXTENT* extent,
+                                      BOOL first, UINT32 t, UINT32 fg, UINT32 limit)
+{
+	UINT32 pos = t;
+	const UINT32 end = MIN(band->count, t + limit);
+
+	if ((extent->fg == fg) && (extent->first == first) && (extent->end > t))
+	{
+		if (extent->done)
+			return MIN(extent->end, end) - t;
+
+		pos = extent->end;
+	}
+
+	while (pos < end)
+	{
+		const UINT32 value = interleaved_delta(band, first, pos);
+
+		if (value == 0)
+			pos += interleaved_zero_run(band, first, pos);
+		else if (value == fg)
+			pos += interleaved_same_run(band, first, pos);
+		else
+			break;
+	}
+
+	extent->fg = fg;
+	extent->end = pos;
+	extent->first = first;
+	extent->done = (pos < end) || (pos >= band->count);
+	return MIN(pos, end) - t;
+}
+
+static INLINE BYTE interleaved_fgbg_mask(const INTERLEAVED_BAND* band, BOOL first, UINT32 t,
+                                         UINT32 fg, UINT32 count)
+{
+	UINT32 x;
+	BYTE mask = 0;
+
+	for (x = 0; x < count; x++)
+	{
+		if (interleaved_delta(band, first, t + x) == fg)
+			mask |= (BYTE)(1 << x);
+	}
+
+	return mask;
+}
+
+/**
+ * Open color images are tracked separately for each size of their header, so
+ * that an image that already paid for the longest header is not replaced by a
+ * shorter one that is cheaper now but has yet to grow its header.
+ */
+static INLINE UINT32 interleaved_literal_class(UINT32 length)
+{
+	if (length <= 31)
+		return 0;
+
+	return (length <= 287) ? 1 : 2;
+}
+
+static INLINE void interleaved_relax(INTERLEAVED_BAND* band, const INTERLEAVED_NODE* entry,
+                                     BYTE source, UINT32 t, BYTE order, UINT32 length,
+                                     UINT32 pixels, UINT32 fg, BOOL bg)
+{
+	INTERLEAVED_NODE* node = &band->nodes[t + pixels];
+	const UINT32 cost = entry->cost + interleaved_order_size(order, length, band->bpp);
+
+	/* On a tie prefer the state a following background run can use as is */
+	if ((cost < node->cost) || ((cost == node->cost) && node->bg && !bg))
+	{
+		node->cost = cost;
+		node->fg = fg;
+		node->from = t;
+		node->length = pixels;
+		node->order = order;
+		node->bg = bg ? TRUE : FALSE;
+		node->source = source;
+	}
+}
+
+static void interleaved_relax_runs(INTERLEAVED_BAND* band, const INTERLEAVED_NODE* entry,
+                                   BYTE source, UINT32 t, BYTE order, UINT32 max, UINT32 fg)
+{
+	UINT32 x;
+	UINT32 lengths[INTERLEAVED_MAX_LENGTHS];
+	const BOOL lite = (order == LITE_SET_FG_FG_RUN) || (order == LITE_DITHERED_RUN);
+	const UINT32 count = interleaved_run_lengths(band->level, MIN(max, INTERLEAVED_MAX_RUN),
+	                                             lite, lengths);
+
+	for (x = 0; x < count; x++)
+	{
+		const UINT32 length = lengths[x];
+
+		if (order == LITE_DITHERED_RUN)
+		{
+			if (length >= 2)
+				interleaved_relax(band, entry, source, t, order, length, length * 2, fg, FALSE);
+		}
+		else if (order == REGULAR_BG_RUN)
+		{
+			/* The first line rules end with the first order starting past it */
+			const BOOL crossing = interleaved_first_line(band, t) &&
+			                      !interleaved_first_line(band, t + length);
+			interleaved_relax(band, entry, source, t, order, length, length, fg, !crossing);
+		}
+		else
+			interleaved_relax(band, entry, source, t, order, length, length, fg, FALSE);
+	}
+}
+
+static void interleaved_relax_fgbg(INTERLEAVED_BAND* band, INTERLEAVED_EXTENT* extent,
+                                   const INTERLEAVED_NODE* entry, BYTE source, UINT32 t,
+                                   BYTE order, UINT32 fg)
+{
+	UINT32 x, count, max;
+	UINT32 lengths[INTERLEAVED_MAX_LENGTHS];
+	const BOOL first = interleaved_first_line(band, t);
+	const UINT32 limit = (band->level == INTERLEAVED_LEVEL_FAST)
+	                         ? 64
+	                         : ((band->level == INTERLEAVED_LEVEL_DEFAULT) ? 256 : 1024);
+	max = interleaved_fgbg_length(band, extent, first, t, fg, limit);
+
+	if (max == 0)
+		return;
+
+	if ((order == REGULAR_FGBG_IMAGE) && (max >= 8))
+	{
+		const BYTE mask = interleaved_fgbg_mask(band, first, t, fg, 8);
+
+		if (mask == g_MaskSpecialFgBg1)
+			interleaved_relax(band, entry, source, t, SPECIAL_FGBG_1, 8, 8, fg, FALSE);
+		else if (mask == g_MaskSpecialFgBg2)
+			interleaved_relax(band, entry, source, t, SPECIAL_FGBG_2, 8, 8, fg, FALSE);
+	}
+
+	count = interleaved_fgbg_lengths(band->level, max, lengths);
+
+	for (x = 0; x < count; x++)
+		interleaved_relax(band, entry, source, t, order, lengths[x], lengths[x], fg, FALSE);
+}
+
+static void interleaved_parse_band(INTERLEAVED_BAND* band, UINT32 fg, BOOL bg)
+{
+	UINT32 t, x;
+	INTERLEAVED_EXTENT extents[2] = { 0 };
+	const UINT32 n = band->count;
+
+	for (t = 0; t <= n; t++)
+	{
+		band->nodes[t].cost = INTERLEAVED_INFINITE_COST;
+
+		for (x = 0; x < INTERLEAVED_LITERAL_CLASSES; x++)
+			band->literals[x][t].cost = INTERLEAVED_INFINITE_COST;
+	}
+
+	band->nodes[0].cost = 0;
+	band->nodes[0].fg = fg;
+	band->nodes[0].bg = bg ? TRUE : FALSE;
+
+	for (t = 0; t < n; t++)
+	{
+		UINT32 y;
+		BYTE source = 0;
+		const INTERLEAVED_NODE* entry = &band->nodes[t];
+		INTERLEAVED_NODE* next = &band->literals[0][t + 1];
+		const BOOL first = interleaved_first_line(band, t);
+		const UINT32 pixel = band->pixels[t];
+
+		/* A color image can be closed at no cost, orders start from the cheapest state */
+		for (x = 0; x < INTERLEAVED_LITERAL_CLASSES; x++)
+		{
+			if (band->literals[x][t].cost < entry->cost)
+			{
+				entry = &band->literals[x][t];
+				source = (BYTE)(x + 1);
+			}
+		}
+
+		if (entry->cost == INTERLEAVED_INFINITE_COST)
+			continue;
+
+		/* Open a new color image or extend the current ones */
+		next->cost = entry->cost + 1 + band->bpp;
+		next->fg = entry->fg;
+		next->from = t;
+		next->length = 1;
+		next->order = REGULAR_COLOR_IMAGE;
+		next->bg = FALSE;
+		next->source = source;
+
+		for (x = 0; x < INTERLEAVED_LITERAL_CLASSES; x++)
+		{
+			const INTERLEAVED_NODE* open = &band->literals[x][t];
+
+			if ((open->cost != INTERLEAVED_INFINITE_COST) && (open->length < INTERLEAVED_MAX_RUN))
+			{
+				const UINT32 grown = interleaved_literal_class(open->length + 1);
+				const UINT32 cost = open->cost + band->bpp + ((grown != x) ? 1 : 0);
+
+				next = &band->literals[grown][t + 1];
+
+				if (cost <= next->cost)
+				{
+					next->cost = cost;
+					next->fg = open->fg;
+					next->from = t;
+					next->length = open->length + 1;
+					next->order = REGULAR_COLOR_IMAGE;
+					next->bg = FALSE;
+					next->source = (BYTE)(x + 1);
+				}
+			}
+		}
+
+		y = interleaved_delta(band, first, t);
+
+		/* Background run, following another one it starts with a foreground pixel */
+		if (!entry->bg)
+		{
+			x = interleaved_zero_run(band, first, t);
+
+			if (x > 0)
+				interleaved_relax_runs(band, entry, source, t, REGULAR_BG_RUN, x, entry->fg);
+		}
+		else if (y == entry->fg)
+		{
+			x = 1 + ((t + 1 < n) ? interleaved_zero_run(band, first, t + 1) : 0);
+			interleaved_relax_runs(band, entry, source, t, REGULAR_BG_RUN, x, entry->fg);
+		}
+
+		/* Foreground runs, with the current or a new foreground color */
+		x = interleaved_same_run(band, first, t);
+
+		if (y == entry->fg)
+			interleaved_relax_runs(band, entry, source, t, REGULAR_FG_RUN, x, entry->fg);
+		else if (y != 0)
+			interleaved_relax_runs(band, entry, source, t, LITE_SET_FG_FG_RUN, x, y);
+
+		/* A single pixel color run costs as much as opening a color image */
+		if (band->pSame[t] > 1)
+			interleaved_relax_runs(band, entry, source, t, REGULAR_COLOR_RUN, band->pSame[t],
+			                       entry->fg);
+
+		if ((band->alt[t] >= 2) && (pixel != band->pixels[t + 1]))
+			interleaved_relax_runs(band, entry, source, t, LITE_DITHERED_RUN,
+			                       (band->alt[t] + 2) / 2, entry->fg);
+
+		/* Foreground/background images, with the current or the next foreground color */
+		if (entry->fg != 0)
+			interleaved_relax_fgbg(band, &extents[0], entry, source, t, REGULAR_FGBG_IMAGE,
+			                       entry->fg);
+
+		for (x = t; (x < n) && (x < t + 8); x++)
+		{
+			const UINT32 value = interleaved_delta(band, first, x);
+
+			if (value != 0)
+			{
+				if (value != entry->fg)
+					interleaved_relax_fgbg(band, &extents[1], entry, source, t,
+					                       LITE_SET_FG_FGBG_IMAGE, value);
+
+				break;
+			}
+		}
+
+		if (pixel == band->white)
+			interleaved_relax(band, entry, source, t, SPECIAL_WHITE, 1, 1, entry->fg, FALSE);
+		else if (pixel == 0)
+			interleaved_relax(band, entry, source, t, SPECIAL_BLACK, 1, 1, entry->fg, FALSE);
+	}
+}
 
-	if ((nWidth == 0) || (nHeight == 0))
+static INLINE void interleaved_write_pixel(wStream* s, UINT32 bpp, UINT32 pixel)
+{
+	if (bpp == 3)
+	{
+		Stream_Write_UINT8(s, pixel & 0xFF);
+		Stream_Write_UINT8(s, (pixel >> 8) & 0xFF);
+		Stream_Write_UINT8(s, (pixel >> 16) & 0xFF);
+	}
+	else
+		Stream_Write_UINT16(s, pixel & 0xFFFF);
+}
+
+static void interleaved_write_header(wStream* s, BYTE order, UINT32 length)
+{
+	switch (order)
+	{
+		case REGULAR_FGBG_IMAGE:
+		case LITE_SET_FG_FGBG_IMAGE:
+		{
+			const BOOL lite = (order == LITE_SET_FG_FGBG_IMAGE);
+			const BYTE code = lite ? 0xD0 : 0x40;
+
+			if (interleaved_header_size(order, length) == 1)
+				Stream_Write_UINT8(s, code | (length / 8));
+			else if (length <= 256)
+			{
+				Stream_Write_UINT8(s, code);
+				Stream_Write_UINT8(s, length - 1);
+			}
+			else
+			{
+				Stream_Write_UINT8(s, lite ? MEGA_MEGA_SET_FGBG_IMAGE : MEGA_MEGA_FGBG_IMAGE);
+				Stream_Write_UINT16(s, length);
+			}
+		}
+		break;
+
+		case LITE_SET_FG_FG_RUN:
+		case LITE_DITHERED_RUN:
+		{
+			const BYTE code = (BYTE)(order << 4);
+
+			if (length <= 15)
+				Stream_Write_UINT8(s, code | length);
+			else if (length <= 271)
+			{
+				Stream_Write_UINT8(s, code);
+				Stream_Write_UINT8(s, length - 16);
+			}
+			else
+			{
+				Stream_Write_UINT8(s, (order == LITE_DITHERED_RUN) ? MEGA_MEGA_DITHERED_RUN
+				                                                   : MEGA_MEGA_SET_FG_RUN);
+				Stream_Write_UINT16(s, length);
+			}
+		}
+		break;
+
+		case SPECIAL_FGBG_1:
+		case SPECIAL_FGBG_2:
+		case SPECIAL_WHITE:
+		case SPECIAL_BLACK:
+			Stream_Write_UINT8(s, order);
+			break;
+
+		default:
+		{
+			const BYTE code = (BYTE)(order << 5);
+
+			if (length <= 31)
+				Stream_Write_UINT8(s, code | length);
+			else if (length <= 287)
+			{
+				Stream_Write_UINT8(s, code);
+				Stream_Write_UINT8(s, length - 32);
+			}
+			else
+			{
+				Stream_Write_UINT8(s, 0xF0 | order);
+				Stream_Write_UINT16(s, length);
+			}
+		}
+		break;
+	}
+}
+
+static BOOL interleaved_write_order(const INTERLEAVED_BAND* band, wStream* s,
+                                    const INTERLEAVED_NODE* node)
+{
+	UINT32 x;
+	const UINT32 t = node->from;
+	const BOOL first = interleaved_first_line(band, t);
+	const UINT32 length = (node->order == LITE_DITHERED_RUN) ? node->length / 2 : node->length;
+
+	/* The stream wraps the caller's buffer and cannot grow */
+	if (Stream_GetRemainingCapacity(s) < interleaved_order_size(node->order, length, band->bpp))
 		return FALSE;
 
-	if (nWidth % 4)
+	interleaved_write_header(s, node->order, length);
+
+	switch (node->order)
 	{
-		WLog_ERR(TAG, "interleaved_compress: width is not a multiple of 4");
+		case LITE_SET_FG_FG_RUN:
+			interleaved_write_pixel(s, band->bpp, node->fg);
+			break;
+
+		case REGULAR_COLOR_RUN:
+			interleaved_write_pixel(s, band->bpp, band->pixels[t]);
+			break;
+
+		case LITE_DITHERED_RUN:
+			interleaved_write_pixel(s, band->bpp, band->pixels[t]);
+			interleaved_write_pixel(s, band->bpp, band->pixels[t + 1]);
+			break;
+
+		case LITE_SET_FG_FGBG_IMAGE:
+		case REGULAR_FGBG_IMAGE:
+			if (node->order == LITE_SET_FG_FGBG_IMAGE)
+				interleaved_write_pixel(s, band->bpp, node->fg);
+
+			for (x = 0; x < length; x += 8)
+				Stream_Write_UINT8(
+				    s, interleaved_fgbg_mask(band, first, t + x, node->fg, MIN(8, length - x)));
+
+			break;
+
+		case REGULAR_COLOR_IMAGE:
+			for (x = 0; x < length; x++)
+				interleaved_write_pixel(s, band->bpp, band->pixels[t + x]);
+
+			break;
+
+		default:
+			break;
+	}
+
+	return TRUE;
+}
+
+/* Walks the cheapest parse back from the end of the band and writes it out */
+static BOOL interleaved_write_band(INTERLEAVED_BAND* band, wStream* s, UINT32* path,
+                                   UINT32* pFg, BOOL* pBg)
+{
+	UINT32 x;
+	UINT32 count = 0;
+	UINT32 pos = band->count;
+	BYTE source = 0;
+	const INTERLEAVED_NODE* last = &band->nodes[pos];
+
+	for (x = 0; x < INTERLEAVED_LITERAL_CLASSES; x++)
+	{
+		if (band->literals[x][pos].cost < last->cost)
+		{
+			last = &band->literals[x][pos];
+			source = (BYTE)(x + 1);
+		}
+	}
+
+	*pFg = last->fg;
+	*pBg = last->bg;
+
+	/* Path entries are the end of each order, with the color image class in the top bits */
+	while (pos > 0)
+	{
+		path[count++] = pos | ((UINT32)source << 30);
+
+		if (source > 0)
+		{
+			/* Color images are opened with a single pixel, always in the first class */
+			const UINT32 start = pos - band->literals[source - 1][pos].length;
+			source = band->literals[0][start + 1].source;
+			pos = start;
+		}
+		else
+		{
+			source = band->nodes[pos].source;
+			pos = band->nodes[pos].from;
+		}
+	}
+
+	while (count > 0)
+	{
+		const UINT32 step = path[--count];
+		const UINT32 end = step & 0x3FFFFFFFu;
+		INTERLEAVED_NODE node;
+
+		if (step >> 30)
+		{
+			node = band->literals[(step >> 30) - 1][end];
+			node.from = end - node.length;
+		}
+		else
+			node = band->nodes[end];
+
+		if (!interleaved_write_order(band, s, &node))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL interleaved_ensure_band(BITMAP_INTERLEAVED_CONTEXT_PRIV* priv, size_t size)
+{
+	UINT32* pixels;
+	UINT32* runs;
+	UINT32* path;
+	INTERLEAVED_NODE* nodes;
+
+	if (size <= priv->BandSize)
+		return TRUE;
+
+	/* The pixels hold the row above the band as well, which is never wider than the band */
+	if (!(pixels = (UINT32*)realloc(priv->BandPixels, sizeof(UINT32) * size * 2)))
+		return FALSE;
+
+	priv->BandPixels = pixels;
+
+	if (!(runs = (UINT32*)realloc(priv->BandRuns, sizeof(UINT32) * (size + 1) * 5)))
 		return FALSE;
+
+	priv->BandRuns = runs;
+
+	nodes = (INTERLEAVED_NODE*)realloc(priv->BandNodes, sizeof(*nodes) * (size + 1) *
+	                                                        (1 + INTERLEAVED_LITERAL_CLASSES));
+
+	if (!nodes)
+		return FALSE;
+
+	priv->BandNodes = nodes;
+
+	if (!(path = (UINT32*)realloc(priv->BandPath, sizeof(UINT32) * (size + 1))))
+		return FALSE;
+
+	priv->BandPath = path;
+	priv->BandSize = size;
+	return TRUE;
+}
+
+/**
+ * Loads rows [row, row + rows) of the stream, which starts with the bottom line
+ * of the image, and precomputes the lengths of the runs starting at each pixel.
+ */
+static void interleaved_load_band(BITMAP_INTERLEAVED_CONTEXT_PRIV* priv, INTERLEAVED_BAND* band,
+                                  const BYTE* data, UINT32 step, UINT32 height, UINT32 row,
+                                  UINT32 rows)
+{
+	UINT32 x, y, t;
+	const UINT32 width = band->width;
+	const UINT32 n = width * rows;
+	UINT32* pixels = priv->BandPixels;
+	UINT32* pSame = priv->BandRuns;
+	UINT32* pZero = &pSame[n + 1];
+	UINT32* xSame = &pZero[n + 1];
+	UINT32* xZero = &xSame[n + 1];
+	UINT32* alt = &xZero[n + 1];
+
+	for (y = 0; y <= rows; y++)
+	{
+		const BYTE* src;
+		UINT32* dst = &pixels[y * width];
+
+		/* The first band has nothing above it, its first line is coded against black */
+		if ((y == 0) && (row == 0))
+		{
+			memset(dst, 0, sizeof(UINT32) * width);
+			continue;
+		}
+
+		src = &data[1ull * (height - row - y) * step];
+
+		for (x = 0; x < width; x++)
+		{
+			if (band->bpp == 3)
+				dst[x] = (UINT32)src[4 * x] | ((UINT32)src[4 * x + 1] << 8) |
+				         ((UINT32)src[4 * x + 2] << 16);
+			else
+				dst[x] = (UINT32)src[2 * x] | ((UINT32)src[2 * x + 1] << 8);
+		}
 	}
 
-	if ((nWidth > 64) || (nHeight > 64))
+	band->above = pixels;
+	band->pixels = &pixels[width];
+	band->start = row * width;
+	band->count = n;
+	pSame[n] = pZero[n] = xSame[n] = xZero[n] = alt[n] = 0;
+
+	for (t = n; t-- > 0;)
 	{
-		WLog_ERR(TAG,
-		         "interleaved_compress: width (%" PRIu32 ") or height (%" PRIu32
-		         ") is greater than 64",
-		         nWidth, nHeight);
+		const UINT32 pixel = band->pixels[t];
+		const UINT32 delta = pixel ^ band->above[t];
+		const BOOL more = (t + 1 < n);
+		pSame[t] = (more && (band->pixels[t + 1] == pixel)) ? pSame[t + 1] + 1 : 1;
+		pZero[t] = (pixel == 0) ? pZero[t + 1] + 1 : 0;
+		xSame[t] = (more && ((band->pixels[t + 1] ^ band->above[t + 1]) == delta))
+		               ? xSame[t + 1] + 1
+		               : 1;
+		xZero[t] = (delta == 0) ? xZero[t + 1] + 1 : 0;
+		alt[t] = ((t + 2 < n) && (band->pixels[t + 2] == pixel)) ? alt[t + 1] + 1 : 0;
+		pSame[t] = MIN(pSame[t], INTERLEAVED_MAX_RUN);
+		pZero[t] = MIN(pZero[t], INTERLEAVED_MAX_RUN);
+		xSame[t] = MIN(xSame[t], INTERLEAVED_MAX_RUN);
+		xZero[t] = MIN(xZero[t], INTERLEAVED_MAX_RUN);
+		alt[t] = MIN(alt[t], INTERLEAVED_MAX_RUN);
+	}
+
+	band->pSame = pSame;
+	band->pZero = pZero;
+	band->xSame = xSame;
+	band->xZero = xZero;
+	band->alt = alt;
+}
+
+static BOOL interleaved_encode(BITMAP_INTERLEAVED_CONTEXT* interleaved, wStream* s,
+                               const BYTE* data, UINT32 step, UINT32 width, UINT32 height,
+                               UINT32 bpp)
+{
+	UINT32 row, fg, x;
+	BOOL bg = FALSE;
+	INTERLEAVED_BAND band = { 0 };
+	BITMAP_INTERLEAVED_CONTEXT_PRIV* priv = interleaved->priv;
+	const UINT32 bandRows = MIN(height, INTERLEAVED_BAND_ROWS);
+
+	if (!interleaved_ensure_band(priv, 1ull * width * bandRows))
 		return FALSE;
+
+	band.width = width;
+	band.bpp = (bpp == 24) ? 3 : 2;
+	band.white = (bpp == 24) ? 0xFFFFFF : 0xFFFF;
+	band.level = priv->Level;
+	band.nodes = priv->BandNodes;
+
+	for (x = 0; x < INTERLEAVED_LITERAL_CLASSES; x++)
+		band.literals[x] = &priv->BandNodes[(x + 1) * (priv->BandSize + 1)];
+	fg = band.white;
+
+	for (row = 0; row < height; row += bandRows)
+	{
+		const UINT32 rows = MIN(bandRows, height - row);
+		interleaved_load_band(priv, &band, data, step, height, row, rows);
+		interleaved_parse_band(&band, fg, bg);
+
+		if (!interleaved_write_band(&band, s, priv->BandPath, &fg, &bg))
+			return FALSE;
 	}
 
+	return TRUE;
+}
+
+BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved, BYTE* pDstData, UINT32* pDstSize,
+                          UINT32 nWidth, UINT32 nHeight, const BYTE* pSrcData, UINT32 SrcFormat,
+                          UINT32 nSrcStep, UINT32 nXSrc, UINT32 nYSrc, const gdiPalette* palette,
+                          UINT32 bpp)
+{
+	BOOL status;
+	wStream* s;
+	UINT32 y, x;
+	UINT32 step;
+	size_t BufferSize;
+	UINT32 DstFormat = 0;
+	UINT32 bytesPerPixel;
+	/* Bitmap scan lines are padded to a multiple of 4 pixels */
+	const UINT32 width = (nWidth + 3) & ~3u;
+
+	if (!interleaved || !pDstData || !pSrcData || !pDstSize)
+		return FALSE;
+
+	if ((nWidth == 0) || (nHeight == 0) || (width > UINT16_MAX) || (nHeight > UINT16_MAX))
+		return FALSE;
+
 	switch (bpp)
 	{
 		case 24:
@@ -444,23 +1278,41 @@ BOOL interleaved_compress(BITMAP_INTERLEAVED_CONTEXT* interleaved, BYTE* pDstDat
 			return FALSE;
 	}
 
-	if (!freerdp_image_copy(interleaved->TempBuffer, DstFormat, 0, 0, 0, nWidth, nHeight, pSrcData,
-	                        SrcFormat, nSrcStep, nXSrc, nYSrc, palette, FREERDP_FLIP_NONE))
+	bytesPerPixel = GetBytesPerPixel(DstFormat);
+	step = width * bytesPerPixel;
+	BufferSize = 1ull * step * nHeight;
+
+	if (BufferSize > interleaved->TempSize)
+	{
+		BYTE* buffer = _aligned_realloc(interleaved->TempBuffer, BufferSize, 16);
+
+		if (!buffer)
+			return FALSE;
+
+		interleaved->TempBuffer = buffer;
+		interleaved->TempSize = (UINT32)BufferSize;
+	}
+
+	if (!freerdp_image_copy(interleaved->TempBuffer, DstFormat, step, 0, 0, nWidth, nHeight,
+	                        pSrcData, SrcFormat, nSrcStep, nXSrc, nYSrc, palette,
+	                        FREERDP_FLIP_NONE))
 		return FALSE;
 
+	for (y = 0; y < nHeight; y++)
+	{
+		BYTE* line = &interleaved->TempBuffer[1ull * y * step];
+
+		for (x = nWidth; x < width; x++)
+			memcpy(&line[x * bytesPerPixel], &line[(nWidth - 1) * bytesPerPixel], bytesPerPixel);
+	}
+
 	s = Stream_New(pDstData, *pDstSize);
 
 	if (!s)
 		return FALSE;
 
-	Stream_SetPosition(interleaved->bts, 0);
-
-	if (freerdp_bitmap_compress(interleaved->TempBuffer, nWidth, nHeight, s, bpp, maxSize,
-	                            nHeight - 1, interleaved->bts, 0) < 0)
-		status = FALSE;
-	else
-		status = TRUE;
-
+	status = interleaved_encode(interleaved, s, interleaved->TempBuffer, step, width, nHeight,
+	                            bpp);
 	Stream_SealLength(s);
 	*pDstSize = (UINT32)Stream_Length(s);
 	Stream_Free(s, FALSE);
@@ -475,6 +1327,15 @@ BOOL bitmap_interleaved_context_reset(BITMAP_INTERLEAVED_CONTEXT* interleaved)
 	return TRUE;
 }
 
+BOOL bitmap_interleaved_context_set_level(BITMAP_INTERLEAVED_CONTEXT* interleaved, UINT32 level)
+{
+	if (!interleaved || !interleaved->priv || (level > INTERLEAVED_LEVEL_BEST))
+		return FALSE;
+
+	interleaved->priv->Level = level;
+	return TRUE;
+}
+
 BITMAP_INTERLEAVED_CONTEXT* bitmap_interleaved_context_new(BOOL Compressor)
 {
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
@@ -482,6 +1343,7 @@ BITMAP_INTERLEAVED_CONTEXT* bitmap_interleaved_context_new(BOOL Compressor)
 
 	if (interleaved)
 	{
+		interleaved->Compressor = Compressor;
 		interleaved->TempSize = 64 * 64 * 4;
 		interleaved->TempBuffer = _aligned_malloc(interleaved->TempSize, 16);
 
@@ -501,6 +1363,18 @@ BITMAP_INTERLEAVED_CONTEXT* bitmap_interleaved_context_new(BOOL Compressor)
 			WLog_ERR(TAG, "Stream_New failed!");
 			return NULL;
 		}
+
+		interleaved->priv =
+		    (BITMAP_INTERLEAVED_CONTEXT_PRIV*)calloc(1, sizeof(BITMAP_INTERLEAVED_CONTEXT_PRIV));
+
+		if (!interleaved->priv)
+		{
+			bitmap_interleaved_context_free(interleaved);
+			WLog_ERR(TAG, "calloc failed!");
+			return NULL;
+		}
+
+		interleaved->priv->Level = INTERLEAVED_LEVEL_DEFAULT;
 	}
 
 	return interleaved;
@@ -511,6 +1385,15 @@ void bitmap_interleaved_context_free(BITMAP_INTERLEAVED_CONTEXT* interleaved)
 	if (!interleaved)
 		return;
 
+	if (interleaved->priv)
+	{
+		free(interleaved->priv->BandPixels);
+		free(interleaved->priv->BandRuns);
+		free(interleaved->priv->BandNodes);
+		free(interleaved->priv->BandPath);
+		free(interleaved->priv);
+	}
+
 	_aligned_free(interleaved->TempBuffer);
 	Stream_Free(interleaved->bts, TRUE);
 	free(interleaved);
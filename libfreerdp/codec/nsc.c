@@ -35,8 +35,10 @@
 
 #include "nsc_types.h"
 #include "nsc_encode.h"
+#include "nsc_decode.h"
 
 #include "nsc_sse2.h"
+#include "nsc_neon.h"
 
 #ifndef NSC_INIT_SIMD
 #define NSC_INIT_SIMD(_nsc_context) \
@@ -45,132 +47,58 @@
 	} while (0)
 #endif
 
-static BOOL nsc_decode(NSC_CONTEXT* context)
+BOOL nsc_decode(NSC_CONTEXT* context)
 {
-	UINT16 x;
-	UINT16 y;
-	UINT16 rw;
+	UINT32 x;
+	UINT32 y;
 	BYTE shift;
 	BYTE* bmpdata;
-	size_t pos = 0;
 
 	if (!context)
 		return FALSE;
 
-	rw = ROUND_UP_TO(context->width, 8);
 	shift = context->ColorLossLevel - 1; /* colorloss recovery + YCoCg shift */
 	bmpdata = context->BitmapData;
 
 	if (!bmpdata)
 		return FALSE;
 
+	if (4ULL * context->width * context->height > context->BitmapDataLength)
+		return FALSE;
+
 	for (y = 0; y < context->height; y++)
 	{
 		const BYTE* yplane;
 		const BYTE* coplane;
 		const BYTE* cgplane;
-		const BYTE* aplane = context->priv->PlaneBuffers[3] + y * context->width; /* A */
-
-		if (context->ChromaSubsamplingLevel)
-		{
-			yplane = context->priv->PlaneBuffers[0] + y * rw;                /* Y */
-			coplane = context->priv->PlaneBuffers[1] + (y >> 1) * (rw >> 1); /* Co, supersampled */
-			cgplane = context->priv->PlaneBuffers[2] + (y >> 1) * (rw >> 1); /* Cg, supersampled */
-		}
-		else
-		{
-			yplane = context->priv->PlaneBuffers[0] + y * context->width;  /* Y */
-			coplane = context->priv->PlaneBuffers[1] + y * context->width; /* Co */
-			cgplane = context->priv->PlaneBuffers[2] + y * context->width; /* Cg */
-		}
+		const BYTE* aplane;
+		nsc_decode_rows(context, y, &yplane, &coplane, &cgplane, &aplane);
 
 		for (x = 0; x < context->width; x++)
 		{
-			INT16 y_val = (INT16)*yplane;
-			INT16 co_val = (INT16)(INT8)(*coplane << shift);
-			INT16 cg_val = (INT16)(INT8)(*cgplane << shift);
-			INT16 r_val = y_val + co_val - cg_val;
-			INT16 g_val = y_val + cg_val;
-			INT16 b_val = y_val - co_val - cg_val;
-
-			if (pos + 4 > context->BitmapDataLength)
-				return FALSE;
-
-			pos += 4;
-			*bmpdata++ = MINMAX(b_val, 0, 0xFF);
-			*bmpdata++ = MINMAX(g_val, 0, 0xFF);
-			*bmpdata++ = MINMAX(r_val, 0, 0xFF);
-			*bmpdata++ = *aplane;
-			yplane++;
-			coplane += (context->ChromaSubsamplingLevel ? x % 2 : 1);
-			cgplane += (context->ChromaSubsamplingLevel ? x % 2 : 1);
-			aplane++;
+			/* Co and Cg are supersampled horizontally when subsampling is used */
+			const UINT32 c = context->ChromaSubsamplingLevel ? x >> 1 : x;
+			nsc_decode_pixel(bmpdata, yplane[x], coplane[c], cgplane[c], aplane[x], shift);
+			bmpdata += 4;
 		}
 	}
 
 	return TRUE;
 }
 
-static BOOL nsc_rle_decode(BYTE* in, BYTE* out, UINT32 outSize, UINT32 originalSize)
+BOOL nsc_rle_decode(const BYTE* in, UINT32 inSize, BYTE* out, UINT32 outSize,
+                    UINT32 originalSize)
 {
-	UINT32 len;
-	UINT32 left;
-	BYTE value;
-	left = originalSize;
+	const BYTE* end = in + inSize;
+	UINT32 left = originalSize;
 
 	while (left > 4)
 	{
-		value = *in++;
-
-		if (left == 5)
-		{
-			if (outSize < 1)
-				return FALSE;
-
-			outSize--;
-			*out++ = value;
-			left--;
-		}
-		else if (value == *in)
-		{
-			in++;
-
-			if (*in < 0xFF)
-			{
-				len = (UINT32)*in++;
-				len += 2;
-			}
-			else
-			{
-				in++;
-				len = *((UINT32*)in);
-				in += 4;
-			}
-
-			if (outSize < len)
-				return FALSE;
-
-			outSize -= len;
-			FillMemory(out, len, value);
-			out += len;
-			left -= len;
-		}
-		else
-		{
-			if (outSize < 1)
-				return FALSE;
-
-			outSize--;
-			*out++ = value;
-			left--;
-		}
+		if (!nsc_rle_decode_step(&in, end, &out, &outSize, &left))
+			return FALSE;
 	}
 
-	if ((outSize < 4) || (left < 4))
-		return FALSE;
-
-	memcpy(out, in, 4);
-	return TRUE;
+	return nsc_rle_decode_end(in, end, out, outSize, left);
 }
 
 static BOOL nsc_rle_decompress_data(NSC_CONTEXT* context)
@@ -199,8 +127,8 @@ static BOOL nsc_rle_decompress_data(NSC_CONTEXT* context)
 		}
 		else if (planeSize < originalSize)
 		{
-			if (!nsc_rle_decode(rle, context->priv->PlaneBuffers[i],
-			                    context->priv->PlaneBuffersLength, originalSize))
+			if (!context->rle_decode(rle, planeSize, context->priv->PlaneBuffers[i],
+			                         context->priv->PlaneBuffersLength, originalSize))
 				return FALSE;
 		}
 		else
@@ -220,16 +148,28 @@ static BOOL nsc_rle_decompress_data(NSC_CONTEXT* context)
 static BOOL nsc_stream_initialize(NSC_CONTEXT* context, wStream* s)
 {
 	int i;
+	UINT64 total = 0;
 
 	if (Stream_GetRemainingLength(s) < 20)
 		return FALSE;
 
 	for (i = 0; i < 4; i++)
+	{
 		Stream_Read_UINT32(s, context->PlaneByteCount[i]);
+		total += context->PlaneByteCount[i];
+	}
 
 	Stream_Read_UINT8(s, context->ColorLossLevel);         /* ColorLossLevel (1 byte) */
 	Stream_Read_UINT8(s, context->ChromaSubsamplingLevel); /* ChromaSubsamplingLevel (1 byte) */
 	Stream_Seek(s, 2);                                     /* Reserved (2 bytes) */
+
+	/* [MS-RDPNSC] 2.2.1: ColorLossLevel MUST be in the range 1 to 7 */
+	if ((context->ColorLossLevel < 1) || (context->ColorLossLevel > 7))
+		return FALSE;
+
+	if (Stream_GetRemainingLength(s) < total)
+		return FALSE;
+
 	context->Planes = Stream_Pointer(s);
 	return TRUE;
 }
@@ -338,6 +278,7 @@ NSC_CONTEXT* nsc_context_new(void)
 	WLog_OpenAppender(context->priv->log);
 	context->BitmapData = NULL;
 	context->decode = nsc_decode;
+	context->rle_decode = nsc_rle_decode;
 	context->encode = nsc_encode;
 
 	PROFILER_CREATE(context->priv->prof_nsc_rle_decompress_data, "nsc_rle_decompress_data")
@@ -0,0 +1,177 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * NSCodec Library - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <immintrin.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "nsc_types.h"
+#include "nsc_decode.h"
+#include "nsc_avx2.h"
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+/* See nsc_decode_8_sse2, the unpacked pixels are reordered across the 128 bit lanes */
+static INLINE void nsc_decode_16_avx2(BYTE* dst, __m256i y_val, __m256i co_val, __m256i cg_val,
+                                      __m256i a_val, __m128i count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_set1_epi16(0xFF);
+	__m256i r_val;
+	__m256i g_val;
+	__m256i b_val;
+	__m256i bg;
+	__m256i ra;
+	__m256i lo;
+	__m256i hi;
+	co_val = _mm256_srai_epi16(_mm256_sll_epi16(co_val, count), 8);
+	cg_val = _mm256_srai_epi16(_mm256_sll_epi16(cg_val, count), 8);
+	r_val = _mm256_sub_epi16(_mm256_add_epi16(y_val, co_val), cg_val);
+	g_val = _mm256_add_epi16(y_val, cg_val);
+	b_val = _mm256_sub_epi16(_mm256_sub_epi16(y_val, co_val), cg_val);
+	r_val = _mm256_min_epi16(_mm256_max_epi16(r_val, zero), max);
+	g_val = _mm256_min_epi16(_mm256_max_epi16(g_val, zero), max);
+	b_val = _mm256_min_epi16(_mm256_max_epi16(b_val, zero), max);
+	bg = _mm256_or_si256(b_val, _mm256_slli_epi16(g_val, 8));
+	ra = _mm256_or_si256(r_val, _mm256_slli_epi16(a_val, 8));
+	lo = _mm256_unpacklo_epi16(bg, ra); /* pixels 0-3 and 8-11 */
+	hi = _mm256_unpackhi_epi16(bg, ra); /* pixels 4-7 and 12-15 */
+	_mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+static BOOL nsc_decode_avx2(NSC_CONTEXT* context)
+{
+	UINT32 x;
+	UINT32 y;
+	BYTE shift;
+	BYTE* bmpdata;
+	__m128i count;
+
+	if (!context || !context->BitmapData)
+		return FALSE;
+
+	if (4ULL * context->width * context->height > context->BitmapDataLength)
+		return FALSE;
+
+	shift = context->ColorLossLevel - 1; /* colorloss recovery + YCoCg shift */
+	count = _mm_cvtsi32_si128(8 + shift);
+	bmpdata = context->BitmapData;
+
+	for (y = 0; y < context->height; y++)
+	{
+		const BYTE* yplane;
+		const BYTE* coplane;
+		const BYTE* cgplane;
+		const BYTE* aplane;
+		nsc_decode_rows(context, y, &yplane, &coplane, &cgplane, &aplane);
+
+		for (x = 0; x + 32 <= context->width; x += 32)
+		{
+			const __m128i* py = (const __m128i*)&yplane[x];
+			const __m128i* pa = (const __m128i*)&aplane[x];
+			__m128i co_val[2];
+			__m128i cg_val[2];
+			size_t i;
+
+			if (context->ChromaSubsamplingLevel)
+			{
+				/* supersample: duplicate each of the 16 chroma values */
+				const __m128i co = _mm_loadu_si128((const __m128i*)&coplane[x >> 1]);
+				const __m128i cg = _mm_loadu_si128((const __m128i*)&cgplane[x >> 1]);
+				co_val[0] = _mm_unpacklo_epi8(co, co);
+				co_val[1] = _mm_unpackhi_epi8(co, co);
+				cg_val[0] = _mm_unpacklo_epi8(cg, cg);
+				cg_val[1] = _mm_unpackhi_epi8(cg, cg);
+			}
+			else
+			{
+				co_val[0] = _mm_loadu_si128((const __m128i*)&coplane[x]);
+				co_val[1] = _mm_loadu_si128((const __m128i*)&coplane[x + 16]);
+				cg_val[0] = _mm_loadu_si128((const __m128i*)&cgplane[x]);
+				cg_val[1] = _mm_loadu_si128((const __m128i*)&cgplane[x + 16]);
+			}
+
+			for (i = 0; i < 2; i++)
+			{
+				nsc_decode_16_avx2(bmpdata, _mm256_cvtepu8_epi16(_mm_loadu_si128(&py[i])),
+				                   _mm256_cvtepu8_epi16(co_val[i]),
+				                   _mm256_cvtepu8_epi16(cg_val[i]),
+				                   _mm256_cvtepu8_epi16(_mm_loadu_si128(&pa[i])), count);
+				bmpdata += 64;
+			}
+		}
+
+		for (; x < context->width; x++)
+		{
+			const UINT32 c = context->ChromaSubsamplingLevel ? x >> 1 : x;
+			nsc_decode_pixel(bmpdata, yplane[x], coplane[c], cgplane[c], aplane[x], shift);
+			bmpdata += 4;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL nsc_rle_decode_avx2(const BYTE* in, UINT32 inSize, BYTE* out, UINT32 outSize,
+                                UINT32 originalSize)
+{
+	const BYTE* end = in + inSize;
+	UINT32 left = originalSize;
+
+	while (left > 4)
+	{
+		/* Copy literals 32 at a time, up to the first pair of equal bytes starting a run */
+		if ((left > 36) && (end - in > 32) && (outSize >= 32))
+		{
+			const __m256i cur = _mm256_loadu_si256((const __m256i*)in);
+			const __m256i next = _mm256_loadu_si256((const __m256i*)(in + 1));
+			const UINT32 mask = (UINT32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(cur, next));
+			const UINT32 len = mask ? nsc_ctz64(mask) : 32;
+			_mm256_storeu_si256((__m256i*)out, cur);
+			in += len;
+			out += len;
+			outSize -= len;
+			left -= len;
+
+			if (!mask)
+				continue;
+		}
+
+		if (!nsc_rle_decode_step(&in, end, &out, &outSize, &left))
+			return FALSE;
+	}
+
+	return nsc_rle_decode_end(in, end, out, outSize, left);
+}
+
+void nsc_init_avx2(NSC_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return;
+
+	PROFILER_RENAME(context->priv->prof_nsc_decode, "nsc_decode_avx2");
+	context->decode = nsc_decode_avx2;
+	context->rle_decode = nsc_rle_decode_avx2;
+}
@@ -0,0 +1,168 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * NSCodec Decoder
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_NSC_DECODE_H
+#define FREERDP_LIB_CODEC_NSC_DECODE_H
+
+#include <winpr/endian.h>
+
+#include <freerdp/api.h>
+
+#include "nsc_types.h"
+
+/* Generic implementations, used as fallback by the SIMD variants */
+FREERDP_LOCAL BOOL nsc_decode(NSC_CONTEXT* context);
+FREERDP_LOCAL BOOL nsc_rle_decode(const BYTE* in, UINT32 inSize, BYTE* out, UINT32 outSize,
+                                  UINT32 originalSize);
+
+/**
+ * Colorloss recovery and AYCoCg to BGRA conversion of a single pixel.
+ * shift is ColorLossLevel - 1, the chroma values are sign extended after shifting.
+ */
+static INLINE void nsc_decode_pixel(BYTE* dst, BYTE y, BYTE co, BYTE cg, BYTE a, BYTE shift)
+{
+	const INT16 y_val = (INT16)y;
+	const INT16 co_val = (INT16)(INT8)(co << shift);
+	const INT16 cg_val = (INT16)(INT8)(cg << shift);
+	const INT16 r_val = y_val + co_val - cg_val;
+	const INT16 g_val = y_val + cg_val;
+	const INT16 b_val = y_val - co_val - cg_val;
+	dst[0] = MINMAX(b_val, 0, 0xFF);
+	dst[1] = MINMAX(g_val, 0, 0xFF);
+	dst[2] = MINMAX(r_val, 0, 0xFF);
+	dst[3] = a;
+}
+
+/**
+ * Returns the plane rows used to decode image row y.
+ * With chroma subsampling the Y plane is padded to a multiple of 8 pixels and
+ * Co/Cg hold one sample per 2x2 block.
+ */
+static INLINE void nsc_decode_rows(const NSC_CONTEXT* context, UINT32 y, const BYTE** yplane,
+                                   const BYTE** coplane, const BYTE** cgplane,
+                                   const BYTE** aplane)
+{
+	BYTE* const* planes = context->priv->PlaneBuffers;
+	*aplane = planes[3] + y * context->width;
+
+	if (context->ChromaSubsamplingLevel)
+	{
+		const UINT32 rw = ROUND_UP_TO(context->width, 8);
+		*yplane = planes[0] + y * rw;
+		*coplane = planes[1] + (y >> 1) * (rw >> 1);
+		*cgplane = planes[2] + (y >> 1) * (rw >> 1);
+	}
+	else
+	{
+		*yplane = planes[0] + y * context->width;
+		*coplane = planes[1] + y * context->width;
+		*cgplane = planes[2] + y * context->width;
+	}
+}
+
+/**
+ * Decodes one RLE element: a literal byte or a run of at least two equal bytes.
+ * The caller guarantees left > 4, the final 4 bytes of a plane are stored raw.
+ */
+static INLINE BOOL nsc_rle_decode_step(const BYTE** pin, const BYTE* end, BYTE** pout,
+                                       UINT32* outSize, UINT32* left)
+{
+	UINT32 len;
+	BYTE value;
+	const BYTE* in = *pin;
+
+	/* every step reads at least two bytes, the last 4 raw bytes follow anyway */
+	if (end - in < 2)
+		return FALSE;
+
+	value = *in++;
+
+	if ((*left == 5) || (value != *in))
+	{
+		if (*outSize < 1)
+			return FALSE;
+
+		(*outSize)--;
+		*(*pout)++ = value;
+		(*left)--;
+		*pin = in;
+		return TRUE;
+	}
+
+	/* a run has a value, a repeat and a length byte */
+	if (end - *pin < 3)
+		return FALSE;
+
+	in++;
+
+	if (*in < 0xFF)
+	{
+		len = (UINT32)*in++;
+		len += 2;
+	}
+	else
+	{
+		in++;
+
+		if (end - in < 4)
+			return FALSE;
+
+		Data_Read_UINT32(in, len);
+		in += 4;
+	}
+
+	if (*outSize < len)
+		return FALSE;
+
+	*outSize -= len;
+	FillMemory(*pout, len, value);
+	*pout += len;
+	*left -= len;
+	*pin = in;
+	return TRUE;
+}
+
+/* Copies the 4 raw bytes terminating a RLE encoded plane */
+static INLINE BOOL nsc_rle_decode_end(const BYTE* in, const BYTE* end, BYTE* out,
+                                      UINT32 outSize, UINT32 left)
+{
+	if ((outSize < 4) || (left < 4) || (end - in < 4))
+		return FALSE;
+
+	memcpy(out, in, 4);
+	return TRUE;
+}
+
+/* Number of trailing zero bits, mask must not be 0 */
+static INLINE UINT32 nsc_ctz64(UINT64 mask)
+{
+#if defined(__GNUC__)
+	return (UINT32)__builtin_ctzll(mask);
+#else
+	UINT32 n = 0;
+
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		n++;
+	}
+
+	return n;
+#endif
+}
+
+#endif /* FREERDP_LIB_CODEC_NSC_DECODE_H */
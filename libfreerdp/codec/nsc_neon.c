@@ -0,0 +1,167 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * NSCodec Library - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "nsc_types.h"
+#include "nsc_decode.h"
+#include "nsc_neon.h"
+
+/* (INT8)(c << shift), count holds 8 + shift */
+static INLINE int16x8_t nsc_decode_chroma_neon(uint8x8_t c, int16x8_t count)
+{
+	return vshrq_n_s16(vshlq_s16(vreinterpretq_s16_u16(vmovl_u8(c)), count), 8);
+}
+
+/* Colorloss recovery and AYCoCg to BGRA conversion of 8 pixels */
+static INLINE void nsc_decode_8_neon(BYTE* dst, uint8x8_t y, uint8x8_t co, uint8x8_t cg,
+                                     uint8x8_t a, int16x8_t count)
+{
+	uint8x8x4_t bgra;
+	const int16x8_t y_val = vreinterpretq_s16_u16(vmovl_u8(y));
+	const int16x8_t co_val = nsc_decode_chroma_neon(co, count);
+	const int16x8_t cg_val = nsc_decode_chroma_neon(cg, count);
+	bgra.val[0] = vqmovun_s16(vsubq_s16(vsubq_s16(y_val, co_val), cg_val));
+	bgra.val[1] = vqmovun_s16(vaddq_s16(y_val, cg_val));
+	bgra.val[2] = vqmovun_s16(vsubq_s16(vaddq_s16(y_val, co_val), cg_val));
+	bgra.val[3] = a;
+	vst4_u8(dst, bgra);
+}
+
+static BOOL nsc_decode_neon(NSC_CONTEXT* context)
+{
+	UINT32 x;
+	UINT32 y;
+	BYTE shift;
+	BYTE* bmpdata;
+	int16x8_t count;
+
+	if (!context || !context->BitmapData)
+		return FALSE;
+
+	if (4ULL * context->width * context->height > context->BitmapDataLength)
+		return FALSE;
+
+	shift = context->ColorLossLevel - 1; /* colorloss recovery + YCoCg shift */
+	count = vdupq_n_s16(8 + shift);
+	bmpdata = context->BitmapData;
+
+	for (y = 0; y < context->height; y++)
+	{
+		const BYTE* yplane;
+		const BYTE* coplane;
+		const BYTE* cgplane;
+		const BYTE* aplane;
+		nsc_decode_rows(context, y, &yplane, &coplane, &cgplane, &aplane);
+
+		for (x = 0; x + 16 <= context->width; x += 16)
+		{
+			const uint8x16_t y_val = vld1q_u8(&yplane[x]);
+			const uint8x16_t a_val = vld1q_u8(&aplane[x]);
+			uint8x8x2_t co_val;
+			uint8x8x2_t cg_val;
+
+			if (context->ChromaSubsamplingLevel)
+			{
+				/* supersample: duplicate each of the 8 chroma values */
+				const uint8x8_t co = vld1_u8(&coplane[x >> 1]);
+				const uint8x8_t cg = vld1_u8(&cgplane[x >> 1]);
+				co_val = vzip_u8(co, co);
+				cg_val = vzip_u8(cg, cg);
+			}
+			else
+			{
+				const uint8x16_t co = vld1q_u8(&coplane[x]);
+				const uint8x16_t cg = vld1q_u8(&cgplane[x]);
+				co_val.val[0] = vget_low_u8(co);
+				co_val.val[1] = vget_high_u8(co);
+				cg_val.val[0] = vget_low_u8(cg);
+				cg_val.val[1] = vget_high_u8(cg);
+			}
+
+			nsc_decode_8_neon(bmpdata, vget_low_u8(y_val), co_val.val[0], cg_val.val[0],
+			                  vget_low_u8(a_val), count);
+			nsc_decode_8_neon(bmpdata + 32, vget_high_u8(y_val), co_val.val[1], cg_val.val[1],
+			                  vget_high_u8(a_val), count);
+			bmpdata += 64;
+		}
+
+		for (; x < context->width; x++)
+		{
+			const UINT32 c = context->ChromaSubsamplingLevel ? x >> 1 : x;
+			nsc_decode_pixel(bmpdata, yplane[x], coplane[c], cgplane[c], aplane[x], shift);
+			bmpdata += 4;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL nsc_rle_decode_neon(const BYTE* in, UINT32 inSize, BYTE* out, UINT32 outSize,
+                                UINT32 originalSize)
+{
+	const BYTE* end = in + inSize;
+	UINT32 left = originalSize;
+
+	while (left > 4)
+	{
+		/* Copy literals 16 at a time, up to the first pair of equal bytes starting a run */
+		if ((left > 20) && (end - in > 16) && (outSize >= 16))
+		{
+			const uint8x16_t cur = vld1q_u8(in);
+			const uint8x16_t eq = vceqq_u8(cur, vld1q_u8(in + 1));
+			/* narrow to 4 bits per byte to get a scalar mask */
+			const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+			const UINT64 mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+			const UINT32 len = mask ? nsc_ctz64(mask) >> 2 : 16;
+			vst1q_u8(out, cur);
+			in += len;
+			out += len;
+			outSize -= len;
+			left -= len;
+
+			if (!mask)
+				continue;
+		}
+
+		if (!nsc_rle_decode_step(&in, end, &out, &outSize, &left))
+			return FALSE;
+	}
+
+	return nsc_rle_decode_end(in, end, out, outSize, left);
+}
+
+void nsc_init_neon(NSC_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	PROFILER_RENAME(context->priv->prof_nsc_decode, "nsc_decode_neon");
+	context->decode = nsc_decode_neon;
+	context->rle_decode = nsc_rle_decode_neon;
+}
+
+#endif /* __ARM_NEON__ */
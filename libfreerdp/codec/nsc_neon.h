@@ -0,0 +1,32 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * NSCodec Library - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_NSC_NEON_H
+#define FREERDP_LIB_CODEC_NSC_NEON_H
+
+#include <freerdp/codec/nsc.h>
+#include <freerdp/api.h>
+
+FREERDP_LOCAL void nsc_init_neon(NSC_CONTEXT* context);
+
+#ifndef NSC_INIT_SIMD
+#if defined(WITH_NEON)
+#define NSC_INIT_SIMD(_nsc_context) nsc_init_neon(_nsc_context)
+#endif
+#endif
+
+#endif /* FREERDP_LIB_CODEC_NSC_NEON_H */
@@ -33,7 +33,9 @@
 #include <winpr/sysinfo.h>
 
 #include "nsc_types.h"
+#include "nsc_decode.h"
 #include "nsc_sse2.h"
+#include "nsc_avx2.h"
 
 static BOOL nsc_encode_argb_to_aycocg_sse2(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline)
 {
@@ -380,11 +382,146 @@ static BOOL nsc_encode_sse2(NSC_CONTEXT* context, const BYTE* data, UINT32 scanl
 	return TRUE;
 }
 
+/**
+ * Colorloss recovery and AYCoCg to BGRA conversion of 8 pixels held as 16 bit lanes.
+ * count holds 8 + shift: shifting the chroma byte into the high half and back
+ * arithmetically yields (INT8)(c << shift).
+ */
+static INLINE void nsc_decode_8_sse2(BYTE* dst, __m128i y_val, __m128i co_val, __m128i cg_val,
+                                     __m128i a_val, __m128i count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i max = _mm_set1_epi16(0xFF);
+	__m128i r_val;
+	__m128i g_val;
+	__m128i b_val;
+	__m128i bg;
+	__m128i ra;
+	co_val = _mm_srai_epi16(_mm_sll_epi16(co_val, count), 8);
+	cg_val = _mm_srai_epi16(_mm_sll_epi16(cg_val, count), 8);
+	r_val = _mm_sub_epi16(_mm_add_epi16(y_val, co_val), cg_val);
+	g_val = _mm_add_epi16(y_val, cg_val);
+	b_val = _mm_sub_epi16(_mm_sub_epi16(y_val, co_val), cg_val);
+	r_val = _mm_min_epi16(_mm_max_epi16(r_val, zero), max);
+	g_val = _mm_min_epi16(_mm_max_epi16(g_val, zero), max);
+	b_val = _mm_min_epi16(_mm_max_epi16(b_val, zero), max);
+	bg = _mm_or_si128(b_val, _mm_slli_epi16(g_val, 8));
+	ra = _mm_or_si128(r_val, _mm_slli_epi16(a_val, 8));
+	_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+static BOOL nsc_decode_sse2(NSC_CONTEXT* context)
+{
+	UINT32 x;
+	UINT32 y;
+	BYTE shift;
+	BYTE* bmpdata;
+	__m128i count;
+	const __m128i zero = _mm_setzero_si128();
+
+	if (!context || !context->BitmapData)
+		return FALSE;
+
+	if (4ULL * context->width * context->height > context->BitmapDataLength)
+		return FALSE;
+
+	shift = context->ColorLossLevel - 1; /* colorloss recovery + YCoCg shift */
+	count = _mm_cvtsi32_si128(8 + shift);
+	bmpdata = context->BitmapData;
+
+	for (y = 0; y < context->height; y++)
+	{
+		const BYTE* yplane;
+		const BYTE* coplane;
+		const BYTE* cgplane;
+		const BYTE* aplane;
+		nsc_decode_rows(context, y, &yplane, &coplane, &cgplane, &aplane);
+
+		for (x = 0; x + 16 <= context->width; x += 16)
+		{
+			const __m128i y_val = _mm_loadu_si128((const __m128i*)&yplane[x]);
+			const __m128i a_val = _mm_loadu_si128((const __m128i*)&aplane[x]);
+			__m128i co_val;
+			__m128i cg_val;
+
+			if (context->ChromaSubsamplingLevel)
+			{
+				/* supersample: duplicate each of the 8 chroma values */
+				co_val = _mm_loadl_epi64((const __m128i*)&coplane[x >> 1]);
+				cg_val = _mm_loadl_epi64((const __m128i*)&cgplane[x >> 1]);
+				co_val = _mm_unpacklo_epi8(co_val, co_val);
+				cg_val = _mm_unpacklo_epi8(cg_val, cg_val);
+			}
+			else
+			{
+				co_val = _mm_loadu_si128((const __m128i*)&coplane[x]);
+				cg_val = _mm_loadu_si128((const __m128i*)&cgplane[x]);
+			}
+
+			nsc_decode_8_sse2(bmpdata, _mm_unpacklo_epi8(y_val, zero),
+			                  _mm_unpacklo_epi8(co_val, zero), _mm_unpacklo_epi8(cg_val, zero),
+			                  _mm_unpacklo_epi8(a_val, zero), count);
+			nsc_decode_8_sse2(bmpdata + 32, _mm_unpackhi_epi8(y_val, zero),
+			                  _mm_unpackhi_epi8(co_val, zero), _mm_unpackhi_epi8(cg_val, zero),
+			                  _mm_unpackhi_epi8(a_val, zero), count);
+			bmpdata += 64;
+		}
+
+		for (; x < context->width; x++)
+		{
+			const UINT32 c = context->ChromaSubsamplingLevel ? x >> 1 : x;
+			nsc_decode_pixel(bmpdata, yplane[x], coplane[c], cgplane[c], aplane[x], shift);
+			bmpdata += 4;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL nsc_rle_decode_sse2(const BYTE* in, UINT32 inSize, BYTE* out, UINT32 outSize,
+                                UINT32 originalSize)
+{
+	const BYTE* end = in + inSize;
+	UINT32 left = originalSize;
+
+	while (left > 4)
+	{
+		/* Copy literals 16 at a time, up to the first pair of equal bytes starting a run */
+		if ((left > 20) && (end - in > 16) && (outSize >= 16))
+		{
+			const __m128i cur = _mm_loadu_si128((const __m128i*)in);
+			const __m128i next = _mm_loadu_si128((const __m128i*)(in + 1));
+			const UINT32 mask = (UINT32)_mm_movemask_epi8(_mm_cmpeq_epi8(cur, next));
+			const UINT32 len = mask ? nsc_ctz64(mask) : 16;
+			_mm_storeu_si128((__m128i*)out, cur);
+			in += len;
+			out += len;
+			outSize -= len;
+			left -= len;
+
+			if (!mask)
+				continue;
+		}
+
+		if (!nsc_rle_decode_step(&in, end, &out, &outSize, &left))
+			return FALSE;
+	}
+
+	return nsc_rle_decode_end(in, end, out, outSize, left);
+}
+
 void nsc_init_sse2(NSC_CONTEXT* context)
 {
 	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
 		return;
 
 	PROFILER_RENAME(context->priv->prof_nsc_encode, "nsc_encode_sse2");
+	PROFILER_RENAME(context->priv->prof_nsc_decode, "nsc_decode_sse2");
 	context->encode = nsc_encode_sse2;
+	context->decode = nsc_decode_sse2;
+	context->rle_decode = nsc_rle_decode_sse2;
+#if defined(WITH_AVX2)
+	nsc_init_avx2(context);
+#endif
 }
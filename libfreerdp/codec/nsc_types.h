@@ -70,6 +70,8 @@ struct _NSC_CONTEXT
 	const BYTE* palette;
 
 	BOOL (*decode)(NSC_CONTEXT* context);
+	BOOL (*rle_decode)(const BYTE* in, UINT32 inSize, BYTE* out, UINT32 outSize,
+	                   UINT32 originalSize);
 	BOOL (*encode)(NSC_CONTEXT* context, const BYTE* BitmapData, UINT32 rowstride);
 
 	NSC_CONTEXT_PRIV* priv;
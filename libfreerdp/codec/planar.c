@@ -25,19 +25,26 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/primitives.h>
 #include <freerdp/log.h>
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/codec/planar.h>
 
+#include "planar.h"
+#include "planar_sse2.h"
+#include "planar_neon.h"
+
+#ifndef PLANAR_INIT_SIMD
+#define PLANAR_INIT_SIMD(_planar_context) \
+	do                                    \
+	{                                     \
+	} while (0)
+#endif
+
 #define TAG FREERDP_TAG("codec")
 
-static INLINE BOOL freerdp_bitmap_planar_compress_plane_rle(const BYTE* plane, UINT32 width,
-                                                            UINT32 height, BYTE* outPlane,
-                                                            UINT32* dstSize);
-static INLINE BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane, UINT32 width,
-                                                             UINT32 height, BYTE* outPlane);
 
 static INLINE INT32 planar_skip_plane_rle(const BYTE* pSrcData, UINT32 SrcSize, UINT32 nWidth,
                                           UINT32 nHeight)
@@ -669,32 +676,48 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar, const BYTE* pSrcData, UINT
 	return (SrcSize == (srcp - pSrcData)) ? TRUE : FALSE;
 }
 
-static INLINE BOOL freerdp_split_color_planes(const BYTE* data, UINT32 format, UINT32 width,
-                                              UINT32 height, UINT32 scanline, BYTE* planes[4])
+void planar_split_color_row(const BYTE* pSrc, UINT32 format, UINT32 width, BYTE* planes[4])
 {
-	INT32 i, j, k;
-	if ((width > INT32_MAX) || (height > INT32_MAX) || (scanline > INT32_MAX))
-		return FALSE;
+	UINT32 x;
+	const UINT32 bpp = GetBytesPerPixel(format);
 
-	k = 0;
+	for (x = 0; x < width; x++)
+	{
+		const UINT32 color = ReadColor(pSrc, format);
+		pSrc += bpp;
+		SplitColor(color, format, &planes[1][x], &planes[2][x], &planes[3][x], &planes[0][x],
+		           NULL);
+	}
+}
 
-	if (scanline == 0)
-		scanline = width * GetBytesPerPixel(format);
+/* Splits plane rows [y, y + rows), the planes store the bitmap bottom up */
+static INLINE void freerdp_split_color_rows(BITMAP_PLANAR_CONTEXT* context, const BYTE* data,
+                                            UINT32 format, UINT32 width, UINT32 height,
+                                            UINT32 scanline, UINT32 y, UINT32 rows,
+                                            BYTE* planes[4])
+{
+	UINT32 i;
 
-	for (i = (INT32)height - 1; i >= 0; i--)
+	for (i = y; i < y + rows; i++)
 	{
-		const BYTE* pixel = &data[(INT32)scanline * i];
-
-		for (j = 0; j < (INT32)width; j++)
-		{
-			const UINT32 color = ReadColor(pixel, format);
-			pixel += GetBytesPerPixel(format);
-			SplitColor(color, format, &planes[1][k], &planes[2][k], &planes[3][k], &planes[0][k],
-			           NULL);
-			k++;
-		}
+		BYTE* row[4];
+		const size_t offset = 1ull * i * width;
+		row[0] = &planes[0][offset];
+		row[1] = &planes[1][offset];
+		row[2] = &planes[2][offset];
+		row[3] = &planes[3][offset];
+		context->split_color_row(&data[1ull * scanline * (height - 1 - i)], format, width, row);
 	}
+}
 
+static INLINE BOOL freerdp_split_color_planes(BITMAP_PLANAR_CONTEXT* context, const BYTE* data,
+                                              UINT32 format, UINT32 width, UINT32 height,
+                                              UINT32 scanline, BYTE* planes[4])
+{
+	if ((width > INT32_MAX) || (height > INT32_MAX) || (scanline > INT32_MAX))
+		return FALSE;
+
+	freerdp_split_color_rows(context, data, format, width, height, scanline, 0, height, planes);
 	return TRUE;
 }
 
@@ -812,10 +835,26 @@ static INLINE UINT32 freerdp_bitmap_planar_write_rle_bytes(const BYTE* pInBuffer
 	return (pOutput - pOutBuffer);
 }
 
-static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffer,
+UINT32 planar_rle_scan_bytes(const BYTE* pInput, UINT32 size, BOOL match)
+{
+	UINT32 n = 0;
+	match = match ? TRUE : FALSE;
+
+	while ((n < size) && ((pInput[0] == pInput[-1]) == match))
+	{
+		pInput++;
+		n++;
+	}
+
+	return n;
+}
+
+static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(BITMAP_PLANAR_CONTEXT* context,
+                                                            const BYTE* pInBuffer,
                                                             UINT32 inBufferSize, BYTE* pOutBuffer,
                                                             UINT32 outBufferSize)
 {
+	UINT32 nSkip;
 	BYTE symbol;
 	const BYTE* pInput;
 	BYTE* pOutput;
@@ -871,6 +910,18 @@ static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffe
 
 		nRunLength += bSymbolMatch;
 		cRawBytes += (!bSymbolMatch) ? TRUE : FALSE;
+
+		/* Skip the bytes that continue the current run or raw stretch in one go */
+		nSkip = context->rle_scan_bytes(pInput, inBufferSize, nRunLength ? TRUE : FALSE);
+
+		if (nRunLength)
+			nRunLength += nSkip;
+		else
+			cRawBytes += nSkip;
+
+		pInput += nSkip;
+		inBufferSize -= nSkip;
+		symbol = pInput[-1];
 	} while (outBufferSize);
 
 	if (cRawBytes || nRunLength)
@@ -891,8 +942,10 @@ static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffe
 	return nTotalBytesWritten;
 }
 
-BOOL freerdp_bitmap_planar_compress_plane_rle(const BYTE* inPlane, UINT32 width, UINT32 height,
-                                              BYTE* outPlane, UINT32* dstSize)
+static BOOL freerdp_bitmap_planar_compress_plane_rle(BITMAP_PLANAR_CONTEXT* context,
+                                                     const BYTE* inPlane, UINT32 width,
+                                                     UINT32 height, BYTE* outPlane,
+                                                     UINT32* dstSize)
 {
 	UINT32 index;
 	const BYTE* pInput;
@@ -912,8 +965,8 @@ BOOL freerdp_bitmap_planar_compress_plane_rle(const BYTE* inPlane, UINT32 width,
 
 	while (outBufferSize)
 	{
-		nBytesWritten =
-		    freerdp_bitmap_planar_encode_rle_bytes(pInput, width, pOutput, outBufferSize);
+		nBytesWritten = freerdp_bitmap_planar_encode_rle_bytes(context, pInput, width, pOutput,
+		                                                       outBufferSize);
 
 		if ((!nBytesWritten) || (nBytesWritten > outBufferSize))
 			return FALSE;
@@ -932,7 +985,8 @@ BOOL freerdp_bitmap_planar_compress_plane_rle(const BYTE* inPlane, UINT32 width,
 	return TRUE;
 }
 
-static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BYTE* inPlanes[4], UINT32 width,
+static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BITMAP_PLANAR_CONTEXT* context,
+                                                             BYTE* inPlanes[4], UINT32 width,
                                                              UINT32 height, BYTE* outPlanes,
                                                              UINT32* dstSizes, BOOL skipAlpha)
 {
@@ -947,8 +1001,8 @@ static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BYTE* inPlanes[4],
 	{
 		dstSizes[0] = outPlanesSize;
 
-		if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[0], width, height, outPlanes,
-		                                              &dstSizes[0]))
+		if (!freerdp_bitmap_planar_compress_plane_rle(context, inPlanes[0], width, height,
+		                                              outPlanes, &dstSizes[0]))
 			return FALSE;
 
 		outPlanes += dstSizes[0];
@@ -958,8 +1012,8 @@ static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BYTE* inPlanes[4],
 	/* LumaOrRedPlane */
 	dstSizes[1] = outPlanesSize;
 
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[1], width, height, outPlanes,
-	                                              &dstSizes[1]))
+	if (!freerdp_bitmap_planar_compress_plane_rle(context, inPlanes[1], width, height,
+	                                              outPlanes, &dstSizes[1]))
 		return FALSE;
 
 	outPlanes += dstSizes[1];
@@ -967,8 +1021,8 @@ static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BYTE* inPlanes[4],
 	/* OrangeChromaOrGreenPlane */
 	dstSizes[2] = outPlanesSize;
 
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[2], width, height, outPlanes,
-	                                              &dstSizes[2]))
+	if (!freerdp_bitmap_planar_compress_plane_rle(context, inPlanes[2], width, height,
+	                                              outPlanes, &dstSizes[2]))
 		return FALSE;
 
 	outPlanes += dstSizes[2];
@@ -976,22 +1030,50 @@ static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BYTE* inPlanes[4],
 	/* GreenChromeOrBluePlane */
 	dstSizes[3] = outPlanesSize;
 
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[3], width, height, outPlanes,
-	                                              &dstSizes[3]))
+	if (!freerdp_bitmap_planar_compress_plane_rle(context, inPlanes[3], width, height,
+	                                              outPlanes, &dstSizes[3]))
 		return FALSE;
 
 	return TRUE;
 }
 
-BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane, UINT32 width, UINT32 height,
-                                               BYTE* outPlane)
+void planar_delta_encode_row(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst, UINT32 width)
+{
+	UINT32 x;
+
+	for (x = 0; x < width; x++)
+	{
+		/* two's complement difference to sign-magnitude, sign in the least significant bit */
+		const INT8 delta = (INT8)(pSrc[x] - pPrev[x]);
+		pDst[x] = (delta >= 0) ? (BYTE)(delta << 1) : (BYTE)(((-delta) << 1) - 1);
+	}
+}
+
+/* Delta encodes rows of a plane, pPrev is the row preceding inPlane or NULL for the first row */
+static INLINE void freerdp_bitmap_planar_delta_encode_rows(BITMAP_PLANAR_CONTEXT* context,
+                                                           const BYTE* pPrev, const BYTE* inPlane,
+                                                           UINT32 width, UINT32 rows,
+                                                           BYTE* outPlane)
 {
-	char s2c;
-	INT32 delta;
-	UINT32 y, x;
-	BYTE* outPtr;
-	const BYTE *srcPtr, *prevLinePtr;
+	UINT32 y;
 
+	for (y = 0; y < rows; y++)
+	{
+		if (pPrev)
+			context->delta_encode_row(inPlane, pPrev, outPlane, width);
+		else
+			CopyMemory(outPlane, inPlane, width); /* first line is copied as is */
+
+		pPrev = inPlane;
+		inPlane += width;
+		outPlane += width;
+	}
+}
+
+static BYTE* freerdp_bitmap_planar_delta_encode_plane(BITMAP_PLANAR_CONTEXT* context,
+                                                      const BYTE* inPlane, UINT32 width,
+                                                      UINT32 height, BYTE* outPlane)
+{
 	if (!outPlane)
 	{
 		if (width * height == 0)
@@ -1001,38 +1083,215 @@ BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane, UINT32 width
 			return NULL;
 	}
 
-	// first line is copied as is
-	CopyMemory(outPlane, inPlane, width);
-	outPtr = outPlane + width;
-	srcPtr = inPlane + width;
-	prevLinePtr = inPlane;
+	freerdp_bitmap_planar_delta_encode_rows(context, NULL, inPlane, width, height, outPlane);
+	return outPlane;
+}
 
-	for (y = 1; y < height; y++)
+static INLINE BOOL freerdp_bitmap_planar_delta_encode_planes(BITMAP_PLANAR_CONTEXT* context,
+                                                             BYTE* inPlanes[4], UINT32 width,
+                                                             UINT32 height, BYTE* outPlanes[4])
+{
+	UINT32 i;
+
+	for (i = 0; i < 4; i++)
 	{
-		for (x = 0; x < width; x++, outPtr++, srcPtr++, prevLinePtr++)
-		{
-			delta = *srcPtr - *prevLinePtr;
-			s2c = (delta >= 0) ? (char)delta : (char)(~((BYTE)(-delta)) + 1);
-			s2c = (s2c >= 0) ? (s2c << 1) : (char)(((~((BYTE)s2c) + 1) << 1) - 1);
-			*outPtr = (BYTE)s2c;
-		}
+		outPlanes[i] = freerdp_bitmap_planar_delta_encode_plane(context, inPlanes[i], width,
+		                                                        height, outPlanes[i]);
+
+		if (!outPlanes[i])
+			return FALSE;
 	}
 
-	return outPlane;
+	return TRUE;
 }
 
-static INLINE BOOL freerdp_bitmap_planar_delta_encode_planes(BYTE* inPlanes[4], UINT32 width,
-                                                             UINT32 height, BYTE* outPlanes[4])
+/* Worst case size of a RLE encoded row, including all control bytes */
+static INLINE size_t planar_rle_row_bound(UINT32 width)
+{
+	return 2ull * width + 16;
+}
+
+static BOOL planar_encode_band(PLANAR_BAND_PARAM* param)
 {
 	UINT32 i;
+	BITMAP_PLANAR_CONTEXT* context = param->context;
+	const size_t offset = 1ull * param->y * param->width;
+	BYTE* prev[4] = { NULL, NULL, NULL, NULL };
+
+	freerdp_split_color_rows(context, param->data, param->format, param->width, param->height,
+	                         param->scanline, param->y, param->rows, context->planes);
+
+	if (!context->AllowRunLengthEncoding)
+		return TRUE;
+
+	/* The delta of the first row needs the last row of the previous band, split it again */
+	if (param->y > 0)
+	{
+		BYTE* row[4];
+
+		for (i = 0; i < 4; i++)
+			row[i] = prev[i] = param->previous[i];
+
+		context->split_color_row(&param->data[1ull * param->scanline * (param->height - param->y)],
+		                         param->format, param->width, row);
+	}
 
 	for (i = 0; i < 4; i++)
 	{
-		outPlanes[i] =
-		    freerdp_bitmap_planar_delta_encode_plane(inPlanes[i], width, height, outPlanes[i]);
+		UINT32 size = (UINT32)(planar_rle_row_bound(param->width) * param->rows);
 
-		if (!outPlanes[i])
+		if ((i == 0) && context->AllowSkipAlpha)
+			continue;
+
+		freerdp_bitmap_planar_delta_encode_rows(context, prev[i], &context->planes[i][offset],
+		                                        param->width, param->rows,
+		                                        &context->deltaPlanes[i][offset]);
+
+		if (!freerdp_bitmap_planar_compress_plane_rle(context, &context->deltaPlanes[i][offset],
+		                                              param->width, param->rows, param->rle[i],
+		                                              &size))
+			return FALSE;
+
+		param->rleSizes[i] = size;
+	}
+
+	return TRUE;
+}
+
+static void CALLBACK planar_encode_band_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                                      PTP_WORK work)
+{
+	PLANAR_BAND_PARAM* param = (PLANAR_BAND_PARAM*)context;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	param->success = planar_encode_band(param);
+}
+
+static BOOL planar_prepare_bands(BITMAP_PLANAR_CONTEXT* context, UINT32 width, UINT32 count)
+{
+	UINT32 i;
+	BITMAP_PLANAR_CONTEXT_PRIV* priv = context->priv;
+	/* per band: one row of each plane for the delta of the first row, then the RLE output */
+	const size_t rleSize = planar_rle_row_bound(width) * PLANAR_BAND_HEIGHT;
+	const size_t bandSize = 4ull * (width + rleSize);
+
+	if (count > priv->BandCount)
+	{
+		PTP_WORK* work;
+		PLANAR_BAND_PARAM* params;
+
+		if (!(work = (PTP_WORK*)realloc(priv->BandWork, sizeof(PTP_WORK) * count)))
+			return FALSE;
+
+		priv->BandWork = work;
+
+		if (!(params = (PLANAR_BAND_PARAM*)realloc(priv->BandParams, sizeof(*params) * count)))
+			return FALSE;
+
+		priv->BandParams = params;
+		priv->BandCount = count;
+	}
+
+	if (bandSize * count > priv->BandBufferSize)
+	{
+		BYTE* buffer = realloc(priv->BandBuffer, bandSize * count);
+
+		if (!buffer)
 			return FALSE;
+
+		priv->BandBuffer = buffer;
+		priv->BandBufferSize = bandSize * count;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		UINT32 j;
+		BYTE* band = &priv->BandBuffer[bandSize * i];
+
+		for (j = 0; j < 4; j++)
+		{
+			priv->BandParams[i].previous[j] = &band[1ull * width * j];
+			priv->BandParams[i].rle[j] = &band[4ull * width + rleSize * j];
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Splits, delta encodes and RLE compresses bands of rows on the thread pool.
+ * Every row is a separate RLE segment, so the plane is the concatenation of the bands.
+ */
+static BOOL freerdp_bitmap_planar_encode_threaded(BITMAP_PLANAR_CONTEXT* context,
+                                                  const BYTE* data, UINT32 format, UINT32 width,
+                                                  UINT32 height, UINT32 scanline,
+                                                  UINT32* dstSizes)
+{
+	UINT32 i;
+	UINT32 p;
+	UINT32 submitted = 0;
+	BOOL rc = TRUE;
+	size_t offset = 0;
+	const size_t limit = 4ull * width * height;
+	BITMAP_PLANAR_CONTEXT_PRIV* priv = context->priv;
+	const UINT32 count = (height + PLANAR_BAND_HEIGHT - 1) / PLANAR_BAND_HEIGHT;
+
+	if (!planar_prepare_bands(context, width, count))
+		return FALSE;
+
+	for (i = 0; i < count; i++)
+	{
+		PLANAR_BAND_PARAM* param = &priv->BandParams[i];
+		param->context = context;
+		param->data = data;
+		param->format = format;
+		param->width = width;
+		param->height = height;
+		param->scanline = scanline;
+		param->y = i * PLANAR_BAND_HEIGHT;
+		param->rows = MIN(PLANAR_BAND_HEIGHT, height - param->y);
+		param->success = FALSE;
+		ZeroMemory(param->rleSizes, sizeof(param->rleSizes));
+		priv->BandWork[i] =
+		    CreateThreadpoolWork(planar_encode_band_work_callback, param, &priv->ThreadPoolEnv);
+
+		if (!priv->BandWork[i])
+		{
+			WLog_ERR(TAG, "CreateThreadpoolWork failed.");
+			rc = FALSE;
+			break;
+		}
+
+		SubmitThreadpoolWork(priv->BandWork[i]);
+		submitted++;
+	}
+
+	for (i = 0; i < submitted; i++)
+	{
+		WaitForThreadpoolWorkCallbacks(priv->BandWork[i], FALSE);
+		CloseThreadpoolWork(priv->BandWork[i]);
+		rc &= priv->BandParams[i].success;
+	}
+
+	if (!rc || !context->AllowRunLengthEncoding)
+		return rc;
+
+	for (p = 0; p < 4; p++)
+	{
+		dstSizes[p] = 0;
+
+		for (i = 0; i < count; i++)
+		{
+			const PLANAR_BAND_PARAM* param = &priv->BandParams[i];
+
+			/* the single threaded encoder fails when the planes do not fit in limit */
+			if (param->rleSizes[p] > limit - offset)
+				return FALSE;
+
+			CopyMemory(&context->rlePlanesBuffer[offset], param->rle[p], param->rleSizes[p]);
+			offset += param->rleSizes[p];
+			dstSizes[p] += param->rleSizes[p];
+		}
 	}
 
 	return TRUE;
@@ -1056,20 +1315,39 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 
 	planeSize = width * height;
 
-	if (!freerdp_split_color_planes(data, format, width, height, scanline, context->planes))
-		return NULL;
+	if (scanline == 0)
+		scanline = width * GetBytesPerPixel(format);
 
-	if (context->AllowRunLengthEncoding)
+	if (context->priv && (height >= 2 * PLANAR_BAND_HEIGHT))
 	{
-		if (!freerdp_bitmap_planar_delta_encode_planes(context->planes, width, height,
-		                                               context->deltaPlanes))
+		if ((width > INT32_MAX) || (height > INT32_MAX) || (scanline > INT32_MAX))
 			return NULL;
 
-		if (!freerdp_bitmap_planar_compress_planes_rle(context->deltaPlanes, width, height,
-		                                               context->rlePlanesBuffer, dstSizes,
-		                                               context->AllowSkipAlpha))
+		if (!freerdp_bitmap_planar_encode_threaded(context, data, format, width, height, scanline,
+		                                           dstSizes))
 			return NULL;
+	}
+	else
+	{
+		if (!freerdp_split_color_planes(context, data, format, width, height, scanline,
+		                                context->planes))
+			return NULL;
+
+		if (context->AllowRunLengthEncoding)
+		{
+			if (!freerdp_bitmap_planar_delta_encode_planes(context, context->planes, width,
+			                                               height, context->deltaPlanes))
+				return NULL;
+
+			if (!freerdp_bitmap_planar_compress_planes_rle(
+			        context, context->deltaPlanes, width, height, context->rlePlanesBuffer,
+			        dstSizes, context->AllowSkipAlpha))
+				return NULL;
+		}
+	}
 
+	if (context->AllowRunLengthEncoding)
+	{
 		{
 			int offset = 0;
 			FormatHeader |= PLANAR_FORMAT_HEADER_RLE;
@@ -1262,6 +1540,11 @@ BITMAP_PLANAR_CONTEXT* freerdp_bitmap_planar_context_new(DWORD flags, UINT32 max
 	if (context->ColorLossLevel)
 		context->AllowDynamicColorFidelity = TRUE;
 
+	context->split_color_row = planar_split_color_row;
+	context->delta_encode_row = planar_delta_encode_row;
+	context->rle_scan_bytes = planar_rle_scan_bytes;
+	PLANAR_INIT_SIMD(context);
+
 	if (!freerdp_bitmap_planar_context_reset(context, maxWidth, maxHeight))
 	{
 		freerdp_bitmap_planar_context_free(context);
@@ -1276,9 +1559,67 @@ void freerdp_bitmap_planar_context_free(BITMAP_PLANAR_CONTEXT* context)
 	if (!context)
 		return;
 
+	freerdp_bitmap_planar_context_set_threading(context, FALSE);
 	free(context->pTempData);
 	free(context->planesBuffer);
 	free(context->deltaPlanesBuffer);
 	free(context->rlePlanesBuffer);
 	free(context);
 }
+
+BOOL freerdp_bitmap_planar_context_set_threading(BITMAP_PLANAR_CONTEXT* context, BOOL enable)
+{
+	SYSTEM_INFO sysinfo;
+	BITMAP_PLANAR_CONTEXT_PRIV* priv;
+
+	if (!context)
+		return FALSE;
+
+	priv = context->priv;
+
+	if (!enable)
+	{
+		if (priv)
+		{
+			CloseThreadpool(priv->ThreadPool);
+			DestroyThreadpoolEnvironment(&priv->ThreadPoolEnv);
+			free(priv->BandWork);
+			free(priv->BandParams);
+			free(priv->BandBuffer);
+			free(priv);
+			context->priv = NULL;
+		}
+
+		return TRUE;
+	}
+
+	if (priv)
+		return TRUE;
+
+	priv = (BITMAP_PLANAR_CONTEXT_PRIV*)calloc(1, sizeof(BITMAP_PLANAR_CONTEXT_PRIV));
+
+	if (!priv)
+		return FALSE;
+
+	priv->ThreadPool = CreateThreadpool(NULL);
+
+	if (!priv->ThreadPool)
+		goto fail;
+
+	InitializeThreadpoolEnvironment(&priv->ThreadPoolEnv);
+	SetThreadpoolCallbackPool(&priv->ThreadPoolEnv, priv->ThreadPool);
+	GetNativeSystemInfo(&sysinfo);
+
+	if (!SetThreadpoolThreadMinimum(priv->ThreadPool, sysinfo.dwNumberOfProcessors))
+	{
+		CloseThreadpool(priv->ThreadPool);
+		DestroyThreadpoolEnvironment(&priv->ThreadPoolEnv);
+		goto fail;
+	}
+
+	context->priv = priv;
+	return TRUE;
+fail:
+	free(priv);
+	return FALSE;
+}
@@ -0,0 +1,139 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_PLANAR_H
+#define FREERDP_LIB_CODEC_PLANAR_H
+
+#include <winpr/pool.h>
+
+#include <freerdp/api.h>
+#include <freerdp/codec/planar.h>
+
+/* Rows encoded by a single work item in multithreaded mode */
+#define PLANAR_BAND_HEIGHT 64
+
+typedef struct
+{
+	BITMAP_PLANAR_CONTEXT* context;
+	const BYTE* data;
+	UINT32 format;
+	UINT32 width;
+	UINT32 height;
+	UINT32 scanline;
+	UINT32 y;
+	UINT32 rows;
+	BYTE* previous[4];
+	BYTE* rle[4];
+	UINT32 rleSizes[4];
+	BOOL success;
+} PLANAR_BAND_PARAM;
+
+struct _BITMAP_PLANAR_CONTEXT_PRIV
+{
+	PTP_POOL ThreadPool;
+	TP_CALLBACK_ENVIRON ThreadPoolEnv;
+
+	UINT32 BandCount;
+	PTP_WORK* BandWork;
+	PLANAR_BAND_PARAM* BandParams;
+	BYTE* BandBuffer;
+	size_t BandBufferSize;
+};
+
+/**
+ * Generic encoder routines, the optimized variants fall back to them.
+ *
+ * planar_split_color_row writes one row of pixels to the A, R, G, B planes.
+ * planar_delta_encode_row stores the sign-magnitude difference to the previous row.
+ * planar_rle_scan_bytes counts the leading bytes of pInput that equal their
+ * predecessor (match) or differ from it (!match), pInput[-1] must be readable.
+ */
+FREERDP_LOCAL void planar_split_color_row(const BYTE* pSrc, UINT32 format, UINT32 width,
+                                          BYTE* planes[4]);
+FREERDP_LOCAL void planar_delta_encode_row(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst,
+                                           UINT32 width);
+FREERDP_LOCAL UINT32 planar_rle_scan_bytes(const BYTE* pInput, UINT32 size, BOOL match);
+
+/**
+ * Byte offsets of the A, R, G and B components of a 32bpp format in memory.
+ * The alpha offset is -1 for formats without alpha, which split to 0xFF.
+ */
+static INLINE BOOL planar_format_offsets(UINT32 format, INT32 offsets[4])
+{
+	switch (format)
+	{
+		case PIXEL_FORMAT_ARGB32:
+		case PIXEL_FORMAT_XRGB32:
+			offsets[0] = 0;
+			offsets[1] = 1;
+			offsets[2] = 2;
+			offsets[3] = 3;
+			break;
+
+		case PIXEL_FORMAT_ABGR32:
+		case PIXEL_FORMAT_XBGR32:
+			offsets[0] = 0;
+			offsets[1] = 3;
+			offsets[2] = 2;
+			offsets[3] = 1;
+			break;
+
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			offsets[0] = 3;
+			offsets[1] = 0;
+			offsets[2] = 1;
+			offsets[3] = 2;
+			break;
+
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+			offsets[0] = 3;
+			offsets[1] = 2;
+			offsets[2] = 1;
+			offsets[3] = 0;
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	if (!ColorHasAlpha(format))
+		offsets[0] = -1;
+
+	return TRUE;
+}
+
+/* Number of trailing zero bits, mask must not be 0 */
+static INLINE UINT32 planar_ctz32(UINT32 mask)
+{
+#if defined(__GNUC__)
+	return (UINT32)__builtin_ctz(mask);
+#else
+	UINT32 n = 0;
+
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		n++;
+	}
+
+	return n;
+#endif
+}
+
+#endif /* FREERDP_LIB_CODEC_PLANAR_H */
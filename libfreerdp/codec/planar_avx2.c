@@ -0,0 +1,136 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <immintrin.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "planar.h"
+#include "planar_avx2.h"
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+static void planar_split_color_row_avx2(const BYTE* pSrc, UINT32 format, UINT32 width,
+                                        BYTE* planes[4])
+{
+	UINT32 i;
+	UINT32 x = 0;
+	INT32 offsets[4];
+	__m128i counts[4];
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	/* packing works within 128 bit lanes, this restores the pixel order */
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	if (!planar_format_offsets(format, offsets))
+	{
+		planar_split_color_row(pSrc, format, width, planes);
+		return;
+	}
+
+	for (i = 0; i < 4; i++)
+		counts[i] = _mm_cvtsi32_si128(8 * MAX(offsets[i], 0));
+
+	for (; x + 32 <= width; x += 32)
+	{
+		const __m256i* src = (const __m256i*)&pSrc[4ull * x];
+		const __m256i v0 = _mm256_loadu_si256(&src[0]);
+		const __m256i v1 = _mm256_loadu_si256(&src[1]);
+		const __m256i v2 = _mm256_loadu_si256(&src[2]);
+		const __m256i v3 = _mm256_loadu_si256(&src[3]);
+
+		for (i = 0; i < 4; i++)
+		{
+			__m256i lo;
+			__m256i hi;
+
+			if (offsets[i] < 0)
+			{
+				_mm256_storeu_si256((__m256i*)&planes[i][x], _mm256_set1_epi8((char)0xFF));
+				continue;
+			}
+
+			lo = _mm256_packus_epi32(_mm256_and_si256(_mm256_srl_epi32(v0, counts[i]), mask),
+			                         _mm256_and_si256(_mm256_srl_epi32(v1, counts[i]), mask));
+			hi = _mm256_packus_epi32(_mm256_and_si256(_mm256_srl_epi32(v2, counts[i]), mask),
+			                         _mm256_and_si256(_mm256_srl_epi32(v3, counts[i]), mask));
+			_mm256_storeu_si256(
+			    (__m256i*)&planes[i][x],
+			    _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order));
+		}
+	}
+
+	if (x < width)
+	{
+		BYTE* rest[4] = { &planes[0][x], &planes[1][x], &planes[2][x], &planes[3][x] };
+		planar_split_color_row(&pSrc[4ull * x], format, width - x, rest);
+	}
+}
+
+static void planar_delta_encode_row_avx2(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst,
+                                         UINT32 width)
+{
+	UINT32 x = 0;
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (; x + 32 <= width; x += 32)
+	{
+		const __m256i cur = _mm256_loadu_si256((const __m256i*)&pSrc[x]);
+		const __m256i prev = _mm256_loadu_si256((const __m256i*)&pPrev[x]);
+		const __m256i delta = _mm256_sub_epi8(cur, prev);
+		const __m256i sign = _mm256_cmpgt_epi8(zero, delta);
+		const __m256i magnitude = _mm256_sub_epi8(_mm256_xor_si256(delta, sign), sign);
+		_mm256_storeu_si256((__m256i*)&pDst[x],
+		                    _mm256_add_epi8(_mm256_add_epi8(magnitude, magnitude), sign));
+	}
+
+	planar_delta_encode_row(&pSrc[x], &pPrev[x], &pDst[x], width - x);
+}
+
+static UINT32 planar_rle_scan_bytes_avx2(const BYTE* pInput, UINT32 size, BOOL match)
+{
+	UINT32 n = 0;
+	const UINT32 invert = match ? 0xFFFFFFFF : 0;
+
+	for (; n + 32 <= size; n += 32)
+	{
+		const __m256i cur = _mm256_loadu_si256((const __m256i*)&pInput[n]);
+		const __m256i prev = _mm256_loadu_si256((const __m256i*)(&pInput[n] - 1));
+		const UINT32 mask = (UINT32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(cur, prev)) ^ invert;
+
+		if (mask)
+			return n + planar_ctz32(mask);
+	}
+
+	return n + planar_rle_scan_bytes(&pInput[n], size - n, match);
+}
+
+void planar_init_avx2(BITMAP_PLANAR_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return;
+
+	context->split_color_row = planar_split_color_row_avx2;
+	context->delta_encode_row = planar_delta_encode_row_avx2;
+	context->rle_scan_bytes = planar_rle_scan_bytes_avx2;
+}
@@ -0,0 +1,27 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_PLANAR_AVX2_H
+#define FREERDP_LIB_CODEC_PLANAR_AVX2_H
+
+#include <freerdp/codec/planar.h>
+#include <freerdp/api.h>
+
+/* Installs the AVX2 encoder routines if the CPU supports them, called by planar_init_sse2 */
+FREERDP_LOCAL void planar_init_avx2(BITMAP_PLANAR_CONTEXT* context);
+
+#endif /* FREERDP_LIB_CODEC_PLANAR_AVX2_H */
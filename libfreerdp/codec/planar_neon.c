@@ -0,0 +1,111 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "planar.h"
+#include "planar_neon.h"
+
+static void planar_split_color_row_neon(const BYTE* pSrc, UINT32 format, UINT32 width,
+                                        BYTE* planes[4])
+{
+	UINT32 i;
+	UINT32 x = 0;
+	INT32 offsets[4];
+
+	if (!planar_format_offsets(format, offsets))
+	{
+		planar_split_color_row(pSrc, format, width, planes);
+		return;
+	}
+
+	for (; x + 16 <= width; x += 16)
+	{
+		/* vld4 deinterleaves the bytes of 16 pixels by their position */
+		const uint8x16x4_t v = vld4q_u8(&pSrc[4ull * x]);
+
+		for (i = 0; i < 4; i++)
+			vst1q_u8(&planes[i][x], (offsets[i] < 0) ? vdupq_n_u8(0xFF) : v.val[offsets[i]]);
+	}
+
+	if (x < width)
+	{
+		BYTE* rest[4] = { &planes[0][x], &planes[1][x], &planes[2][x], &planes[3][x] };
+		planar_split_color_row(&pSrc[4ull * x], format, width - x, rest);
+	}
+}
+
+static void planar_delta_encode_row_neon(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst,
+                                         UINT32 width)
+{
+	UINT32 x = 0;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const uint8x16_t diff = vsubq_u8(vld1q_u8(&pSrc[x]), vld1q_u8(&pPrev[x]));
+		const int8x16_t delta = vreinterpretq_s8_u8(diff);
+		/* sign-magnitude: 2 * |delta| - 1 for negative, 2 * delta otherwise */
+		const uint8x16_t sign = vcltq_s8(delta, vdupq_n_s8(0));
+		const uint8x16_t magnitude = vreinterpretq_u8_s8(vabsq_s8(delta));
+		vst1q_u8(&pDst[x], vaddq_u8(vshlq_n_u8(magnitude, 1), sign));
+	}
+
+	planar_delta_encode_row(&pSrc[x], &pPrev[x], &pDst[x], width - x);
+}
+
+static UINT32 planar_rle_scan_bytes_neon(const BYTE* pInput, UINT32 size, BOOL match)
+{
+	UINT32 n = 0;
+	const UINT64 invert = match ? ~0ULL : 0;
+
+	for (; n + 16 <= size; n += 16)
+	{
+		const uint8x16_t eq = vceqq_u8(vld1q_u8(&pInput[n]), vld1q_u8(&pInput[n] - 1));
+		/* narrow to 4 bits per byte, set for the bytes ending the stretch */
+		const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+		const UINT64 mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) ^ invert;
+
+		if (mask)
+		{
+			const UINT32 lo = (UINT32)mask;
+			return n + ((lo ? planar_ctz32(lo) : 32 + planar_ctz32((UINT32)(mask >> 32))) >> 2);
+		}
+	}
+
+	return n + planar_rle_scan_bytes(&pInput[n], size - n, match);
+}
+
+void planar_init_neon(BITMAP_PLANAR_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	context->split_color_row = planar_split_color_row_neon;
+	context->delta_encode_row = planar_delta_encode_row_neon;
+	context->rle_scan_bytes = planar_rle_scan_bytes_neon;
+}
+
+#endif /* __ARM_NEON__ */
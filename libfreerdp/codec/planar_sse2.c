@@ -0,0 +1,135 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <emmintrin.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "planar.h"
+#include "planar_sse2.h"
+#include "planar_avx2.h"
+
+static void planar_split_color_row_sse2(const BYTE* pSrc, UINT32 format, UINT32 width,
+                                        BYTE* planes[4])
+{
+	UINT32 i;
+	UINT32 x = 0;
+	INT32 offsets[4];
+	__m128i counts[4];
+	const __m128i mask = _mm_set1_epi32(0xFF);
+
+	if (!planar_format_offsets(format, offsets))
+	{
+		planar_split_color_row(pSrc, format, width, planes);
+		return;
+	}
+
+	for (i = 0; i < 4; i++)
+		counts[i] = _mm_cvtsi32_si128(8 * MAX(offsets[i], 0));
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const __m128i* src = (const __m128i*)&pSrc[4ull * x];
+		const __m128i v0 = _mm_loadu_si128(&src[0]);
+		const __m128i v1 = _mm_loadu_si128(&src[1]);
+		const __m128i v2 = _mm_loadu_si128(&src[2]);
+		const __m128i v3 = _mm_loadu_si128(&src[3]);
+
+		for (i = 0; i < 4; i++)
+		{
+			__m128i lo;
+			__m128i hi;
+
+			if (offsets[i] < 0)
+			{
+				_mm_storeu_si128((__m128i*)&planes[i][x], _mm_set1_epi8((char)0xFF));
+				continue;
+			}
+
+			/* move the component to the low byte of each pixel, then narrow */
+			lo = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(v0, counts[i]), mask),
+			                     _mm_and_si128(_mm_srl_epi32(v1, counts[i]), mask));
+			hi = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(v2, counts[i]), mask),
+			                     _mm_and_si128(_mm_srl_epi32(v3, counts[i]), mask));
+			_mm_storeu_si128((__m128i*)&planes[i][x], _mm_packus_epi16(lo, hi));
+		}
+	}
+
+	if (x < width)
+	{
+		BYTE* rest[4] = { &planes[0][x], &planes[1][x], &planes[2][x], &planes[3][x] };
+		planar_split_color_row(&pSrc[4ull * x], format, width - x, rest);
+	}
+}
+
+static void planar_delta_encode_row_sse2(const BYTE* pSrc, const BYTE* pPrev, BYTE* pDst,
+                                         UINT32 width)
+{
+	UINT32 x = 0;
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; x + 16 <= width; x += 16)
+	{
+		const __m128i cur = _mm_loadu_si128((const __m128i*)&pSrc[x]);
+		const __m128i prev = _mm_loadu_si128((const __m128i*)&pPrev[x]);
+		const __m128i delta = _mm_sub_epi8(cur, prev);
+		/* sign-magnitude: 2 * |delta| - 1 for negative, 2 * delta otherwise */
+		const __m128i sign = _mm_cmplt_epi8(delta, zero);
+		const __m128i magnitude = _mm_sub_epi8(_mm_xor_si128(delta, sign), sign);
+		_mm_storeu_si128((__m128i*)&pDst[x],
+		                 _mm_add_epi8(_mm_add_epi8(magnitude, magnitude), sign));
+	}
+
+	planar_delta_encode_row(&pSrc[x], &pPrev[x], &pDst[x], width - x);
+}
+
+static UINT32 planar_rle_scan_bytes_sse2(const BYTE* pInput, UINT32 size, BOOL match)
+{
+	UINT32 n = 0;
+	const UINT32 invert = match ? 0xFFFF : 0;
+
+	for (; n + 16 <= size; n += 16)
+	{
+		const __m128i cur = _mm_loadu_si128((const __m128i*)&pInput[n]);
+		const __m128i prev = _mm_loadu_si128((const __m128i*)(&pInput[n] - 1));
+		/* bits are set for the bytes ending the stretch */
+		const UINT32 mask = (UINT32)_mm_movemask_epi8(_mm_cmpeq_epi8(cur, prev)) ^ invert;
+
+		if (mask)
+			return n + planar_ctz32(mask);
+	}
+
+	return n + planar_rle_scan_bytes(&pInput[n], size - n, match);
+}
+
+void planar_init_sse2(BITMAP_PLANAR_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		return;
+
+	context->split_color_row = planar_split_color_row_sse2;
+	context->delta_encode_row = planar_delta_encode_row_sse2;
+	context->rle_scan_bytes = planar_rle_scan_bytes_sse2;
+#if defined(WITH_AVX2)
+	planar_init_avx2(context);
+#endif
+}
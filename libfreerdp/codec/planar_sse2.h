@@ -0,0 +1,32 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_PLANAR_SSE2_H
+#define FREERDP_LIB_CODEC_PLANAR_SSE2_H
+
+#include <freerdp/codec/planar.h>
+#include <freerdp/api.h>
+
+FREERDP_LOCAL void planar_init_sse2(BITMAP_PLANAR_CONTEXT* context);
+
+#ifdef WITH_SSE2
+#ifndef PLANAR_INIT_SIMD
+#define PLANAR_INIT_SIMD(_planar_context) planar_init_sse2(_planar_context)
+#endif
+#endif
+
+#endif /* FREERDP_LIB_CODEC_PLANAR_SSE2_H */
@@ -32,6 +32,7 @@
 #include <freerdp/log.h>
 
 #include "rfx_differential.h"
+#include "rfx_encode.h"
 #include "rfx_quantization.h"
 #include "rfx_rlgr.h"
 #include "progressive.h"
@@ -102,6 +103,16 @@ static INLINE void progressive_component_codec_quant_read(const BYTE* block,
 	quantVal->HH1 = block[4] >> 4;
 }
 
+static INLINE void progressive_component_codec_quant_write(BYTE* block,
+                                                           const RFX_COMPONENT_CODEC_QUANT* quantVal)
+{
+	block[0] = (quantVal->LL3 & 0x0F) | (quantVal->HL3 << 4);
+	block[1] = (quantVal->LH3 & 0x0F) | (quantVal->HH3 << 4);
+	block[2] = (quantVal->HL2 & 0x0F) | (quantVal->LH2 << 4);
+	block[3] = (quantVal->HH2 & 0x0F) | (quantVal->HL1 << 4);
+	block[4] = (quantVal->LH1 & 0x0F) | (quantVal->HH1 << 4);
+}
+
 static INLINE void progressive_rfx_quant_ladd(RFX_COMPONENT_CODEC_QUANT* q, int val)
 {
 	q->HL1 += val; /* HL1 */
@@ -116,8 +127,8 @@ static INLINE void progressive_rfx_quant_ladd(RFX_COMPONENT_CODEC_QUANT* q, int
 	q->LL3 += val; /* LL3 */
 }
 
-static INLINE void progressive_rfx_quant_add(RFX_COMPONENT_CODEC_QUANT* q1,
-                                             RFX_COMPONENT_CODEC_QUANT* q2,
+static INLINE void progressive_rfx_quant_add(const RFX_COMPONENT_CODEC_QUANT* q1,
+                                             const RFX_COMPONENT_CODEC_QUANT* q2,
                                              RFX_COMPONENT_CODEC_QUANT* dst)
 {
 	dst->HL1 = q1->HL1 + q2->HL1; /* HL1 */
@@ -146,8 +157,8 @@ static INLINE void progressive_rfx_quant_lsub(RFX_COMPONENT_CODEC_QUANT* q, int
 	q->LL3 -= val; /* LL3 */
 }
 
-static INLINE void progressive_rfx_quant_sub(RFX_COMPONENT_CODEC_QUANT* q1,
-                                             RFX_COMPONENT_CODEC_QUANT* q2,
+static INLINE void progressive_rfx_quant_sub(const RFX_COMPONENT_CODEC_QUANT* q1,
+                                             const RFX_COMPONENT_CODEC_QUANT* q2,
                                              RFX_COMPONENT_CODEC_QUANT* dst)
 {
 	dst->HL1 = q1->HL1 - q2->HL1; /* HL1 */
@@ -1968,9 +1979,877 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcD
 	return rc;
 }
 
+/**
+ * Encoder quantization: every tile uses the same base quantization values, the
+ * first pass is sent at the coarsest progressive quantization level and each
+ * upgrade pass moves one level closer to full quality.
+ */
+
+static const RFX_COMPONENT_CODEC_QUANT progressive_quant_default = { 6, 6, 6, 6, 7,
+	                                                                 7, 8, 8, 8, 9 };
+
+static const RFX_PROGRESSIVE_CODEC_QUANT progressive_quant_prog_default[] = {
+	{ 25,
+	  { 1, 2, 2, 2, 3, 3, 3, 4, 4, 4 },
+	  { 1, 2, 2, 2, 3, 3, 3, 4, 4, 4 },
+	  { 1, 2, 2, 2, 3, 3, 3, 4, 4, 4 } },
+	{ 50,
+	  { 0, 1, 1, 1, 2, 2, 2, 3, 3, 3 },
+	  { 0, 1, 1, 1, 2, 2, 2, 3, 3, 3 },
+	  { 0, 1, 1, 1, 2, 2, 2, 3, 3, 3 } },
+	{ 75,
+	  { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1 },
+	  { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1 },
+	  { 0, 0, 0, 0, 1, 1, 1, 1, 1, 1 } },
+};
+
+#define PROGRESSIVE_ENCODER_NUM_PROG_QUANT ARRAYSIZE(progressive_quant_prog_default)
+#define PROGRESSIVE_ENCODER_COMPONENT_SIZE 8192
+
+static INLINE void progressive_rfx_dwt(const INT16* pSrc, int nSrcStep, INT16* pLow, int nLowStep,
+                                       INT16* pHigh, int nHighStep, int nCount)
+{
+	int n;
+	INT32 X0, X1, X2;
+	const int nHighCount = (nCount - 1) / 2;
+	const int nLowCount = nCount - nHighCount;
+
+	for (n = 0; n < nHighCount; n++)
+	{
+		X0 = pSrc[(2 * n) * nSrcStep];
+		X1 = pSrc[(2 * n + 1) * nSrcStep];
+		X2 = pSrc[(2 * n + 2) * nSrcStep];
+		pHigh[n * nHighStep] = (INT16)((X1 - ((X0 + X2) / 2)) / 2);
+	}
+
+	pLow[0] = pSrc[0] + pHigh[0];
+
+	for (n = 1; n < nHighCount; n++)
+	{
+		X0 = pSrc[(2 * n) * nSrcStep];
+		pLow[n * nLowStep] =
+		    (INT16)(X0 + ((pHigh[(n - 1) * nHighStep] + pHigh[n * nHighStep]) / 2));
+	}
+
+	X0 = pSrc[(2 * nHighCount) * nSrcStep];
+
+	if (nLowCount <= (nHighCount + 1))
+	{
+		pLow[nHighCount * nLowStep] = (INT16)(X0 + pHigh[(nHighCount - 1) * nHighStep]);
+	}
+	else
+	{
+		/* even sample count, mirrors the extrapolated tail of the inverse transform */
+		X1 = pSrc[(nCount - 1) * nSrcStep];
+		pLow[nHighCount * nLowStep] = (INT16)(X0 + (pHigh[(nHighCount - 1) * nHighStep] / 2));
+		pLow[(nHighCount + 1) * nLowStep] = (INT16)((2 * X1) - X0);
+	}
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode_block(INT16* buffer, INT16* temp, int level)
+{
+	int i;
+	int offset;
+	int nBandL;
+	int nBandH;
+	int nCount;
+	INT16 *HL, *LH;
+	INT16 *HH, *LL;
+	INT16 *L, *H;
+	nBandL = progressive_rfx_get_band_l_count(level);
+	nBandH = progressive_rfx_get_band_h_count(level);
+	nCount = nBandL + nBandH;
+	offset = 0;
+	HL = &buffer[offset];
+	offset += (nBandH * nBandL);
+	LH = &buffer[offset];
+	offset += (nBandL * nBandH);
+	HH = &buffer[offset];
+	offset += (nBandH * nBandH);
+	LL = &buffer[offset];
+	offset = 0;
+	L = &temp[offset];
+	offset += (nBandL * nCount);
+	H = &temp[offset];
+
+	/* vertical (X -> L + H) */
+	for (i = 0; i < nCount; i++)
+		progressive_rfx_dwt(&buffer[i], nCount, &L[i], nCount, &H[i], nCount, nCount);
+
+	/* horizontal (L -> LL + HL) */
+	for (i = 0; i < nBandL; i++)
+		progressive_rfx_dwt(&L[i * nCount], 1, &LL[i * nBandL], 1, &HL[i * nBandH], 1, nCount);
+
+	/* horizontal (H -> LH + HH) */
+	for (i = 0; i < nBandH; i++)
+		progressive_rfx_dwt(&H[i * nCount], 1, &LH[i * nBandL], 1, &HH[i * nBandH], 1, nCount);
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode(INT16* buffer, INT16* temp)
+{
+	progressive_rfx_dwt_2d_encode_block(&buffer[0], temp, 1);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3007], temp, 2);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3807], temp, 3);
+}
+
+static INLINE void progressive_rfx_quantize_block(const INT16* coefficients, INT16* buffer,
+                                                  UINT32 length, UINT32 shift, BOOL nonLL)
+{
+	UINT32 index;
+
+	if (!nonLL)
+	{
+		/* LL3 upgrades are unsigned, round towards negative infinity */
+		for (index = 0; index < length; index++)
+			buffer[index] = coefficients[index] >> shift;
+
+		return;
+	}
+
+	for (index = 0; index < length; index++)
+	{
+		if (coefficients[index] < 0)
+			buffer[index] = -((-coefficients[index]) >> shift);
+		else
+			buffer[index] = coefficients[index] >> shift;
+	}
+}
+
+static INLINE int progressive_rfx_encode_component(PROGRESSIVE_CONTEXT* progressive,
+                                                   const RFX_COMPONENT_CODEC_QUANT* shift,
+                                                   const INT16* coefficients, BYTE* pDstData,
+                                                   UINT32 DstSize)
+{
+	int status;
+	INT16* buffer;
+	buffer = (INT16*)BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!buffer)
+		return -1;
+
+	progressive_rfx_quantize_block(&coefficients[0], &buffer[0], 1023, shift->HL1, TRUE); /* HL1 */
+	progressive_rfx_quantize_block(&coefficients[1023], &buffer[1023], 1023, shift->LH1,
+	                               TRUE); /* LH1 */
+	progressive_rfx_quantize_block(&coefficients[2046], &buffer[2046], 961, shift->HH1,
+	                               TRUE); /* HH1 */
+	progressive_rfx_quantize_block(&coefficients[3007], &buffer[3007], 272, shift->HL2,
+	                               TRUE); /* HL2 */
+	progressive_rfx_quantize_block(&coefficients[3279], &buffer[3279], 272, shift->LH2,
+	                               TRUE); /* LH2 */
+	progressive_rfx_quantize_block(&coefficients[3551], &buffer[3551], 256, shift->HH2,
+	                               TRUE); /* HH2 */
+	progressive_rfx_quantize_block(&coefficients[3807], &buffer[3807], 72, shift->HL3,
+	                               TRUE); /* HL3 */
+	progressive_rfx_quantize_block(&coefficients[3879], &buffer[3879], 72, shift->LH3,
+	                               TRUE); /* LH3 */
+	progressive_rfx_quantize_block(&coefficients[3951], &buffer[3951], 64, shift->HH3,
+	                               TRUE); /* HH3 */
+	progressive_rfx_quantize_block(&coefficients[4015], &buffer[4015], 81, shift->LL3,
+	                               FALSE); /* LL3 */
+	rfx_differential_encode(&buffer[4015], 81);
+	/* the RLGR encoder expects the output buffer to be initialized to zero */
+	ZeroMemory(pDstData, DstSize);
+	status = rfx_rlgr_encode(RLGR1, buffer, 4096, pDstData, DstSize);
+	BufferPool_Return(progressive->bufferPool, buffer);
+
+	if ((status < 0) || ((UINT32)status >= DstSize))
+		return -1;
+
+	return status;
+}
+
+static INLINE void progressive_rfx_srl_write(RFX_PROGRESSIVE_UPGRADE_STATE* state, INT16 value,
+                                             UINT32 numBits)
+{
+	int k;
+	UINT32 mag;
+	UINT32 max;
+	UINT32 count;
+	wBitStream* bs = state->srl;
+	k = state->kp / 8;
+
+	if (!value)
+	{
+		state->nz++;
+
+		if (state->nz >= (1 << k))
+		{
+			/* '0' bit, run of (1 << k) zeros */
+			BitStream_Write_Bits(bs, 0, 1);
+			state->nz = 0;
+			state->kp += 4;
+
+			if (state->kp > 80)
+				state->kp = 80;
+		}
+
+		return;
+	}
+
+	/* '1' bit, followed by the remaining run length in k bits */
+	BitStream_Write_Bits(bs, 1, 1);
+
+	if (k)
+		BitStream_Write_Bits(bs, (UINT32)state->nz, k);
+
+	state->nz = 0;
+	/* sign bit */
+	BitStream_Write_Bits(bs, (value < 0) ? 1 : 0, 1);
+	state->kp -= 6;
+
+	if (state->kp < 0)
+		state->kp = 0;
+
+	if (numBits == 1)
+		return;
+
+	/* unary encoded magnitude, the terminating bit is implicit at the maximum */
+	mag = (value < 0) ? -value : value;
+	max = (1 << numBits) - 1;
+	count = mag - 1;
+
+	while (count > 0)
+	{
+		const UINT32 nbits = (count > 16) ? 16 : count;
+		BitStream_Write_Bits(bs, 0, nbits);
+		count -= nbits;
+	}
+
+	if (mag < max)
+		BitStream_Write_Bits(bs, 1, 1);
+}
+
+static INLINE void progressive_rfx_encode_upgrade_block(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+                                                        const INT16* coefficients, UINT32 length,
+                                                        UINT32 shift, UINT32 numBits)
+{
+	UINT32 index;
+	UINT32 mag;
+	INT16 value;
+	const UINT32 mask = (1 << numBits) - 1;
+	wBitStream* raw;
+
+	if (!numBits)
+		return;
+
+	raw = state->raw;
+
+	if (!state->nonLL)
+	{
+		for (index = 0; index < length; index++)
+			BitStream_Write_Bits(raw, (UINT32)(coefficients[index] >> shift) & mask, numBits);
+
+		return;
+	}
+
+	for (index = 0; index < length; index++)
+	{
+		mag = (coefficients[index] < 0) ? -coefficients[index] : coefficients[index];
+
+		if (mag >> (shift + numBits))
+		{
+			/* already significant, refine magnitude through raw */
+			BitStream_Write_Bits(raw, (mag >> shift) & mask, numBits);
+		}
+		else
+		{
+			/* not yet significant, encode through srl */
+			value = (INT16)(mag >> shift);
+			progressive_rfx_srl_write(state, (coefficients[index] < 0) ? -value : value, numBits);
+		}
+	}
+}
+
+static INLINE int progressive_rfx_encode_upgrade_component(
+    const RFX_COMPONENT_CODEC_QUANT* shift, const RFX_COMPONENT_CODEC_QUANT* numBits,
+    const INT16* coefficients, BYTE* srlData, UINT32* srlLen, BYTE* rawData, UINT32* rawLen,
+    UINT32 capacity)
+{
+	wBitStream s_srl;
+	wBitStream s_raw;
+	RFX_PROGRESSIVE_UPGRADE_STATE state;
+
+	ZeroMemory(&s_srl, sizeof(wBitStream));
+	ZeroMemory(&s_raw, sizeof(wBitStream));
+	ZeroMemory(&state, sizeof(RFX_PROGRESSIVE_UPGRADE_STATE));
+	state.kp = 8;
+	state.mode = 0;
+	state.srl = &s_srl;
+	state.raw = &s_raw;
+	BitStream_Attach(state.srl, srlData, capacity);
+	BitStream_Attach(state.raw, rawData, capacity);
+
+	state.nonLL = TRUE;
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[0], 1023, shift->HL1,
+	                                     numBits->HL1); /* HL1 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[1023], 1023, shift->LH1,
+	                                     numBits->LH1); /* LH1 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[2046], 961, shift->HH1,
+	                                     numBits->HH1); /* HH1 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[3007], 272, shift->HL2,
+	                                     numBits->HL2); /* HL2 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[3279], 272, shift->LH2,
+	                                     numBits->LH2); /* LH2 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[3551], 256, shift->HH2,
+	                                     numBits->HH2); /* HH2 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[3807], 72, shift->HL3,
+	                                     numBits->HL3); /* HL3 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[3879], 72, shift->LH3,
+	                                     numBits->LH3); /* LH3 */
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[3951], 64, shift->HH3,
+	                                     numBits->HH3); /* HH3 */
+
+	/* a pending run of zeros is closed with a '0' bit, covering the remaining coefficients */
+	if (state.nz)
+		BitStream_Write_Bits(state.srl, 0, 1);
+
+	state.nonLL = FALSE;
+	progressive_rfx_encode_upgrade_block(&state, &coefficients[4015], 81, shift->LL3,
+	                                     numBits->LL3); /* LL3 */
+	BitStream_Flush(state.srl);
+	BitStream_Flush(state.raw);
+
+	if ((state.srl->position > (capacity * 8)) || (state.raw->position > (capacity * 8)))
+		return -1;
+
+	*srlLen = (state.srl->position + 7) / 8;
+	*rawLen = (state.raw->position + 7) / 8;
+	return 1;
+}
+
+static INLINE void progressive_tile_get_planes(RFX_PROGRESSIVE_TILE* tile, INT16* pCurrent[3])
+{
+	BYTE* pBuffer = tile->current;
+	pCurrent[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pCurrent[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pCurrent[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+}
+
+static INLINE const RFX_PROGRESSIVE_CODEC_QUANT*
+progressive_encoder_quant_prog(PROGRESSIVE_CONTEXT* progressive, BYTE quality)
+{
+	if (quality == 0xFF)
+		return &(progressive->quantProgValFull);
+
+	return &progressive_quant_prog_default[quality];
+}
+
+/* The progressive quantization and bit positions of a tile sent up to quality */
+static INLINE void progressive_tile_set_quality(PROGRESSIVE_CONTEXT* progressive,
+                                                RFX_PROGRESSIVE_TILE* tile, BYTE quality)
+{
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal =
+	    progressive_encoder_quant_prog(progressive, quality);
+	tile->quality = quality;
+	CopyMemory(&(tile->yProgQuant), &(quantProgVal->yQuantValues),
+	           sizeof(RFX_COMPONENT_CODEC_QUANT));
+	CopyMemory(&(tile->cbProgQuant), &(quantProgVal->cbQuantValues),
+	           sizeof(RFX_COMPONENT_CODEC_QUANT));
+	CopyMemory(&(tile->crProgQuant), &(quantProgVal->crQuantValues),
+	           sizeof(RFX_COMPONENT_CODEC_QUANT));
+	progressive_rfx_quant_add(&(tile->yQuant), &(tile->yProgQuant), &(tile->yBitPos));
+	progressive_rfx_quant_add(&(tile->cbQuant), &(tile->cbProgQuant), &(tile->cbBitPos));
+	progressive_rfx_quant_add(&(tile->crQuant), &(tile->crProgQuant), &(tile->crBitPos));
+}
+
+static INLINE int progressive_compress_tile_first(PROGRESSIVE_CONTEXT* progressive,
+                                                  RFX_PROGRESSIVE_TILE* tile,
+                                                  const BYTE* pSrcData, UINT32 SrcFormat,
+                                                  UINT32 nSrcStep, wStream* s)
+{
+	int status;
+	UINT32 index;
+	size_t start;
+	size_t end;
+	UINT16 len[3];
+	INT16* temp;
+	INT16* pCurrent[3];
+	RFX_COMPONENT_CODEC_QUANT shift[3];
+	static const prim_size_t roi_64x64 = { 64, 64 };
+	const primitives_t* prims = primitives_get();
+
+	if (!tile->current)
+	{
+		tile->current = (BYTE*)_aligned_malloc((8192 + 32) * 3, 16);
+
+		if (!tile->current)
+			return -1;
+	}
+
+	/**
+	 * The DWT coefficients are kept at full precision in the tile,
+	 * upgrade passes are derived from them rather than from the source.
+	 */
+	progressive_tile_get_planes(tile, pCurrent);
+	rfx_encode_format_rgb(pSrcData, tile->width, tile->height, nSrcStep, SrcFormat, NULL,
+	                      pCurrent[0], pCurrent[1], pCurrent[2]);
+	prims->RGBToYCbCr_16s16s_P3P3((const INT16**)pCurrent, 64 * sizeof(INT16), pCurrent,
+	                              64 * sizeof(INT16), &roi_64x64);
+	temp = (INT16*)BufferPool_Take(progressive->bufferPool, -1); /* DWT buffer */
+
+	if (!temp)
+		return -1;
+
+	for (index = 0; index < 3; index++)
+		progressive_rfx_dwt_2d_encode(pCurrent[index], temp);
+
+	BufferPool_Return(progressive->bufferPool, temp);
+	CopyMemory(&(tile->yQuant), &progressive_quant_default, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	CopyMemory(&(tile->cbQuant), &progressive_quant_default, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	CopyMemory(&(tile->crQuant), &progressive_quant_default, sizeof(RFX_COMPONENT_CODEC_QUANT));
+	progressive_tile_set_quality(progressive, tile, 0);
+	CopyMemory(&shift[0], &(tile->yBitPos), sizeof(RFX_COMPONENT_CODEC_QUANT));
+	progressive_rfx_quant_lsub(&shift[0], 1); /* -6 + 5 = -1 */
+	CopyMemory(&shift[1], &(tile->cbBitPos), sizeof(RFX_COMPONENT_CODEC_QUANT));
+	progressive_rfx_quant_lsub(&shift[1], 1); /* -6 + 5 = -1 */
+	CopyMemory(&shift[2], &(tile->crBitPos), sizeof(RFX_COMPONENT_CODEC_QUANT));
+	progressive_rfx_quant_lsub(&shift[2], 1); /* -6 + 5 = -1 */
+
+	if (!Stream_EnsureRemainingCapacity(s, 23 + (3 * PROGRESSIVE_ENCODER_COMPONENT_SIZE)))
+		return -1;
+
+	start = Stream_GetPosition(s);
+	Stream_Seek(s, 23);
+
+	for (index = 0; index < 3; index++)
+	{
+		status = progressive_rfx_encode_component(progressive, &shift[index], pCurrent[index],
+		                                          Stream_Pointer(s),
+		                                          PROGRESSIVE_ENCODER_COMPONENT_SIZE);
+
+		if (status < 0)
+			return -1;
+
+		len[index] = (UINT16)status;
+		Stream_Seek(s, len[index]);
+	}
+
+	end = Stream_GetPosition(s);
+	Stream_SetPosition(s, start);
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_FIRST); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(end - start));      /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx);                 /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx);                 /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* flags (1 byte) */
+	Stream_Write_UINT8(s, tile->quality);               /* quality (1 byte) */
+	Stream_Write_UINT16(s, len[0]);                     /* yLen (2 bytes) */
+	Stream_Write_UINT16(s, len[1]);                     /* cbLen (2 bytes) */
+	Stream_Write_UINT16(s, len[2]);                     /* crLen (2 bytes) */
+	Stream_Write_UINT16(s, 0);                          /* tailLen (2 bytes) */
+	Stream_SetPosition(s, end);
+	tile->pass = 1;
+	return 1;
+}
+
+static INLINE int progressive_compress_tile_upgrade(PROGRESSIVE_CONTEXT* progressive,
+                                                    RFX_PROGRESSIVE_TILE* tile, wStream* s)
+{
+	int status;
+	UINT32 index;
+	BYTE* pBuffer;
+	BYTE* srlData;
+	BYTE* rawData;
+	UINT32 srlLen[3];
+	UINT32 rawLen[3];
+	size_t start;
+	INT16* pCurrent[3];
+	BYTE quality;
+	RFX_COMPONENT_CODEC_QUANT* bitPos[3];
+	RFX_COMPONENT_CODEC_QUANT newBitPos[3];
+	RFX_COMPONENT_CODEC_QUANT numBits[3];
+	RFX_COMPONENT_CODEC_QUANT shift[3];
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal;
+	const UINT32 capacity = ((8192 + 32) * 3) / 2;
+
+	if ((tile->quality + 1) < PROGRESSIVE_ENCODER_NUM_PROG_QUANT)
+		quality = tile->quality + 1;
+	else
+		quality = 0xFF;
+
+	quantProgVal = progressive_encoder_quant_prog(progressive, quality);
+	bitPos[0] = &(tile->yBitPos);
+	bitPos[1] = &(tile->cbBitPos);
+	bitPos[2] = &(tile->crBitPos);
+	progressive_rfx_quant_add(&(tile->yQuant), &(quantProgVal->yQuantValues), &newBitPos[0]);
+	progressive_rfx_quant_add(&(tile->cbQuant), &(quantProgVal->cbQuantValues), &newBitPos[1]);
+	progressive_rfx_quant_add(&(tile->crQuant), &(quantProgVal->crQuantValues), &newBitPos[2]);
+
+	for (index = 0; index < 3; index++)
+	{
+		progressive_rfx_quant_sub(bitPos[index], &newBitPos[index], &numBits[index]);
+		CopyMemory(&shift[index], &newBitPos[index], sizeof(RFX_COMPONENT_CODEC_QUANT));
+		progressive_rfx_quant_lsub(&shift[index], 1); /* -6 + 5 = -1 */
+	}
+
+	progressive_tile_get_planes(tile, pCurrent);
+	pBuffer = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!pBuffer)
+		return -1;
+
+	srlData = pBuffer;
+	rawData = &pBuffer[capacity];
+	start = Stream_GetPosition(s);
+
+	if (!Stream_EnsureRemainingCapacity(s, 26))
+		goto fail;
+
+	Stream_Seek(s, 26);
+
+	for (index = 0; index < 3; index++)
+	{
+		status = progressive_rfx_encode_upgrade_component(&shift[index], &numBits[index],
+		                                                  pCurrent[index], srlData,
+		                                                  &srlLen[index], rawData,
+		                                                  &rawLen[index], capacity);
+
+		if (status < 0)
+			goto fail;
+
+		if ((srlLen[index] > UINT16_MAX) || (rawLen[index] > UINT16_MAX))
+			goto fail;
+
+		if (!Stream_EnsureRemainingCapacity(s, srlLen[index] + rawLen[index]))
+			goto fail;
+
+		Stream_Write(s, srlData, srlLen[index]);
+		Stream_Write(s, rawData, rawLen[index]);
+	}
+
+	BufferPool_Return(progressive->bufferPool, pBuffer);
+	progressive_tile_set_quality(progressive, tile, quality);
+
+	{
+		const size_t end = Stream_GetPosition(s);
+		Stream_SetPosition(s, start);
+		Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_UPGRADE); /* blockType (2 bytes) */
+		Stream_Write_UINT32(s, (UINT32)(end - start));        /* blockLen (4 bytes) */
+		Stream_Write_UINT8(s, 0);                             /* quantIdxY (1 byte) */
+		Stream_Write_UINT8(s, 0);                             /* quantIdxCb (1 byte) */
+		Stream_Write_UINT8(s, 0);                             /* quantIdxCr (1 byte) */
+		Stream_Write_UINT16(s, tile->xIdx);                   /* xIdx (2 bytes) */
+		Stream_Write_UINT16(s, tile->yIdx);                   /* yIdx (2 bytes) */
+		Stream_Write_UINT8(s, tile->quality);                 /* quality (1 byte) */
+		Stream_Write_UINT16(s, (UINT16)srlLen[0]);            /* ySrlLen (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)rawLen[0]);            /* yRawLen (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)srlLen[1]);            /* cbSrlLen (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)rawLen[1]);            /* cbRawLen (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)srlLen[2]);            /* crSrlLen (2 bytes) */
+		Stream_Write_UINT16(s, (UINT16)rawLen[2]);            /* crRawLen (2 bytes) */
+		Stream_SetPosition(s, end);
+	}
+
+	tile->pass++;
+	return 1;
+fail:
+	BufferPool_Return(progressive->bufferPool, pBuffer);
+	return -1;
+}
+
+static INLINE BOOL progressive_write_region_header(PROGRESSIVE_CONTEXT* progressive,
+                                                   RFX_PROGRESSIVE_TILE** tiles, UINT16 numTiles,
+                                                   UINT32 width, UINT32 height, wStream* s)
+{
+	UINT32 index;
+	BYTE quant[5];
+	const size_t blockLen = 18 + (numTiles * 8) + 5 + (PROGRESSIVE_ENCODER_NUM_PROG_QUANT * 16);
+
+	if (!Stream_EnsureRemainingCapacity(s, blockLen))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_REGION);             /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 0);                                  /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 64);                                  /* tileSize (1 byte) */
+	Stream_Write_UINT16(s, numTiles);                           /* numRects (2 bytes) */
+	Stream_Write_UINT8(s, 1);                                   /* numQuant (1 byte) */
+	Stream_Write_UINT8(s, PROGRESSIVE_ENCODER_NUM_PROG_QUANT);  /* numProgQuant (1 byte) */
+	Stream_Write_UINT8(s, RFX_DWT_REDUCE_EXTRAPOLATE);          /* flags (1 byte) */
+	Stream_Write_UINT16(s, numTiles);                           /* numTiles (2 bytes) */
+	Stream_Write_UINT32(s, 0);                                  /* tileDataSize (4 bytes) */
+
+	for (index = 0; index < numTiles; index++)
+	{
+		const RFX_PROGRESSIVE_TILE* tile = tiles[index];
+		Stream_Write_UINT16(s, tile->x);                             /* x (2 bytes) */
+		Stream_Write_UINT16(s, tile->y);                             /* y (2 bytes) */
+		Stream_Write_UINT16(s, MIN(64, width - tile->x));  /* width (2 bytes) */
+		Stream_Write_UINT16(s, MIN(64, height - tile->y)); /* height (2 bytes) */
+	}
+
+	progressive_component_codec_quant_write(quant, &progressive_quant_default);
+	Stream_Write(s, quant, 5);
+
+	for (index = 0; index < PROGRESSIVE_ENCODER_NUM_PROG_QUANT; index++)
+	{
+		const RFX_PROGRESSIVE_CODEC_QUANT* quantProgVal = &progressive_quant_prog_default[index];
+		Stream_Write_UINT8(s, quantProgVal->quality); /* quality (1 byte) */
+		progressive_component_codec_quant_write(quant, &(quantProgVal->yQuantValues));
+		Stream_Write(s, quant, 5);
+		progressive_component_codec_quant_write(quant, &(quantProgVal->cbQuantValues));
+		Stream_Write(s, quant, 5);
+		progressive_component_codec_quant_write(quant, &(quantProgVal->crQuantValues));
+		Stream_Write(s, quant, 5);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Undoes the tile state changes of a frame that is not sent. Upgraded tiles go
+ * back to their previous quality. The coefficients of a first pass are already
+ * replaced, so those tiles get a first pass from the source of the next call.
+ */
+static void progressive_compress_rollback(PROGRESSIVE_CONTEXT* progressive,
+                                          RFX_PROGRESSIVE_TILE** tiles, UINT32 numTiles,
+                                          UINT32 numEncoded)
+{
+	UINT32 index;
+
+	for (index = 0; index < numTiles; index++)
+	{
+		RFX_PROGRESSIVE_TILE* tile = tiles[index];
+
+		if (tile->blockType == PROGRESSIVE_WBT_TILE_FIRST)
+		{
+			tile->pass = 0;
+			tile->dirty = TRUE;
+		}
+		else if (index < numEncoded)
+		{
+			BYTE quality = tile->quality - 1;
+
+			if (tile->quality == 0xFF)
+				quality = PROGRESSIVE_ENCODER_NUM_PROG_QUANT - 1;
+
+			progressive_tile_set_quality(progressive, tile, quality);
+			tile->pass--;
+		}
+	}
+}
+
+/**
+ * Tiles intersecting invalidRegion (the whole surface if NULL) are sent as a
+ * first pass at coarse quality, tiles sent earlier are upgraded by one quality
+ * level per call until they reach full quality. Returns 1 if a message was
+ * produced, 0 if there is nothing left to send and a negative value on error.
+ * The tile state only advances with a produced message, the tiles of a failed
+ * call are sent again by the next one.
+ * The output buffer belongs to the context and remains valid until the next call.
+ */
 int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData, UINT32 SrcSize,
-                         BYTE** ppDstData, UINT32* pDstSize)
+                         UINT32 SrcFormat, UINT32 Width, UINT32 Height, UINT32 ScanLine,
+                         const REGION16* invalidRegion, UINT16 surfaceId, BYTE** ppDstData,
+                         UINT32* pDstSize)
 {
+	int status;
+	UINT32 index;
+	UINT32 numRects;
+	UINT32 numTiles = 0;
+	UINT32 numEncoded = 0;
+	UINT32 xIdx, yIdx;
+	size_t regionStart;
+	size_t tilesStart;
+	size_t end;
+	wStream* s;
+	RECTANGLE_16 fullRect;
+	const RECTANGLE_16* rects;
+	RFX_PROGRESSIVE_TILE* tile;
+	PROGRESSIVE_SURFACE_CONTEXT* surface;
+	const UINT32 bpp = GetBytesPerPixel(SrcFormat);
+
+	if (!progressive || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	s = progressive->buffer;
+
+	if (!s || (bpp == 0) || (Width == 0) || (Height == 0))
+		return -1;
+
+	if ((ScanLine < (Width * bpp)) || (SrcSize < (ScanLine * Height)))
+		return -1;
+
+	surface = (PROGRESSIVE_SURFACE_CONTEXT*)progressive_get_surface_data(progressive, surfaceId);
+
+	if (!surface)
+	{
+		if (progressive_create_surface_context(progressive, surfaceId, Width, Height) < 0)
+			return -1;
+
+		surface =
+		    (PROGRESSIVE_SURFACE_CONTEXT*)progressive_get_surface_data(progressive, surfaceId);
+	}
+
+	if (!surface || (Width > surface->width) || (Height > surface->height))
+		return -1;
+
+	if (progressive->cTiles < surface->gridSize)
+	{
+		RFX_PROGRESSIVE_TILE** tmpBuf = (RFX_PROGRESSIVE_TILE**)realloc(
+		    progressive->tiles, surface->gridSize * sizeof(RFX_PROGRESSIVE_TILE*));
+
+		if (!tmpBuf)
+			return -1;
+
+		progressive->tiles = tmpBuf;
+		progressive->cTiles = surface->gridSize;
+	}
+
+	/* tiles which still have upgrade passes pending */
+	for (index = 0; index < surface->gridSize; index++)
+	{
+		tile = &(surface->tiles[index]);
+		tile->blockType = 0;
+
+		/* tiles outside of the encoded area are left for a larger frame */
+		if (((tile->xIdx * 64U) >= Width) || ((tile->yIdx * 64U) >= Height))
+			continue;
+
+		if (tile->dirty)
+			tile->blockType = PROGRESSIVE_WBT_TILE_FIRST;
+		else if (tile->pass && (tile->quality != 0xFF))
+			tile->blockType = PROGRESSIVE_WBT_TILE_UPGRADE;
+	}
+
+	/* tiles which have to be sent again from scratch */
+	if (invalidRegion)
+	{
+		rects = region16_rects(invalidRegion, &numRects);
+	}
+	else
+	{
+		fullRect.left = fullRect.top = 0;
+		fullRect.right = (UINT16)Width;
+		fullRect.bottom = (UINT16)Height;
+		rects = &fullRect;
+		numRects = 1;
+	}
+
+	for (index = 0; index < numRects; index++)
+	{
+		const UINT32 right = MIN(rects[index].right, Width);
+		const UINT32 bottom = MIN(rects[index].bottom, Height);
+
+		if ((rects[index].left >= right) || (rects[index].top >= bottom))
+			continue;
+
+		for (yIdx = rects[index].top / 64; yIdx <= (bottom - 1) / 64; yIdx++)
+		{
+			for (xIdx = rects[index].left / 64; xIdx <= (right - 1) / 64; xIdx++)
+			{
+				tile = &(surface->tiles[(yIdx * surface->gridWidth) + xIdx]);
+				tile->blockType = PROGRESSIVE_WBT_TILE_FIRST;
+				tile->xIdx = (UINT16)xIdx;
+				tile->yIdx = (UINT16)yIdx;
+			}
+		}
+	}
+
+	for (index = 0; index < surface->gridSize; index++)
+	{
+		tile = &(surface->tiles[index]);
+
+		if (tile->blockType)
+			progressive->tiles[numTiles++] = tile;
+	}
+
+	*ppDstData = NULL;
+	*pDstSize = 0;
+
+	if (numTiles == 0)
+		return 0;
+
+	if (numTiles > UINT16_MAX)
+		goto fail;
+
+	Stream_SetPosition(s, 0);
+
+	if (!Stream_EnsureRemainingCapacity(s, 36))
+		goto fail;
+
+	if (surface->frameIndex == 0)
+	{
+		Stream_Write_UINT16(s, PROGRESSIVE_WBT_SYNC); /* blockType (2 bytes) */
+		Stream_Write_UINT32(s, 12);                   /* blockLen (4 bytes) */
+		Stream_Write_UINT32(s, 0xCACCACCA);           /* magic (4 bytes) */
+		Stream_Write_UINT16(s, 0x0100);               /* version (2 bytes) */
+		Stream_Write_UINT16(s, PROGRESSIVE_WBT_CONTEXT); /* blockType (2 bytes) */
+		Stream_Write_UINT32(s, 10);                      /* blockLen (4 bytes) */
+		Stream_Write_UINT8(s, 0);                        /* ctxId (1 byte) */
+		Stream_Write_UINT16(s, 64);                      /* tileSize (2 bytes) */
+		Stream_Write_UINT8(s, RFX_SUBBAND_DIFFING);      /* flags (1 byte) */
+	}
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_BEGIN); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 12);                          /* blockLen (4 bytes) */
+	Stream_Write_UINT32(s, surface->frameIndex);         /* frameIndex (4 bytes) */
+	Stream_Write_UINT16(s, 1);                           /* regionCount (2 bytes) */
+	regionStart = Stream_GetPosition(s);
+
+	for (index = 0; index < numTiles; index++)
+	{
+		tile = progressive->tiles[index];
+		tile->x = tile->xIdx * 64;
+		tile->y = tile->yIdx * 64;
+		tile->width = MIN(64, Width - tile->x);
+		tile->height = MIN(64, Height - tile->y);
+	}
+
+	if (!progressive_write_region_header(progressive, progressive->tiles, (UINT16)numTiles, Width,
+	                                     Height, s))
+		goto fail;
+
+	tilesStart = Stream_GetPosition(s);
+
+	for (index = 0; index < numTiles; index++)
+	{
+		tile = progressive->tiles[index];
+
+		if (tile->blockType == PROGRESSIVE_WBT_TILE_FIRST)
+		{
+			const BYTE* pSrcTile = &pSrcData[(tile->y * ScanLine) + (tile->x * bpp)];
+			status = progressive_compress_tile_first(progressive, tile, pSrcTile, SrcFormat,
+			                                         ScanLine, s);
+		}
+		else
+		{
+			status = progressive_compress_tile_upgrade(progressive, tile, s);
+		}
+
+		if (status < 0)
+		{
+			WLog_Print(progressive->log, WLOG_ERROR, "failed to encode tile %" PRIu16 "x%" PRIu16,
+			           tile->xIdx, tile->yIdx);
+			goto fail;
+		}
+
+		numEncoded++;
+	}
+
+	end = Stream_GetPosition(s);
+	Stream_SetPosition(s, regionStart + 2);
+	Stream_Write_UINT32(s, (UINT32)(end - regionStart)); /* blockLen (4 bytes) */
+	Stream_SetPosition(s, regionStart + 14);
+	Stream_Write_UINT32(s, (UINT32)(end - tilesStart)); /* tileDataSize (4 bytes) */
+	Stream_SetPosition(s, end);
+
+	if (!Stream_EnsureRemainingCapacity(s, 6))
+		goto fail;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_END); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 6);                         /* blockLen (4 bytes) */
+
+	for (index = 0; index < numTiles; index++)
+		progressive->tiles[index]->dirty = FALSE;
+
+	surface->frameIndex++;
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32)Stream_GetPosition(s);
+	return 1;
+fail:
+	progressive_compress_rollback(progressive, progressive->tiles, numTiles, numEncoded);
 	return -1;
 }
 
@@ -1991,6 +2870,15 @@ PROGRESSIVE_CONTEXT* progressive_context_new(BOOL Compressor)
 	{
 		progressive->Compressor = Compressor;
 		progressive->bufferPool = BufferPool_New(TRUE, (8192 + 32) * 3, 16);
+
+		if (Compressor)
+		{
+			progressive->buffer = Stream_New(NULL, 0xFFFF);
+
+			if (!progressive->buffer)
+				goto cleanup;
+		}
+
 		progressive->cRects = 64;
 		progressive->rects = (RFX_RECT*)calloc(progressive->cRects, sizeof(RFX_RECT));
 
@@ -2041,6 +2929,7 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 	if (!progressive)
 		return;
 
+	Stream_Free(progressive->buffer, TRUE);
 	BufferPool_Free(progressive->bufferPool);
 	free(progressive->rects);
 	free(progressive->tiles);
@@ -23,6 +23,7 @@
 
 #include <winpr/wlog.h>
 #include <winpr/collections.h>
+#include <winpr/stream.h>
 
 #include <freerdp/codec/rfx.h>
 
@@ -140,6 +141,7 @@ struct _RFX_PROGRESSIVE_TILE
 	BYTE* current;
 
 	UINT16 pass;
+	BOOL dirty;
 	BYTE* sign;
 	RFX_COMPONENT_CODEC_QUANT yBitPos;
 	RFX_COMPONENT_CODEC_QUANT cbBitPos;
@@ -199,6 +201,8 @@ struct _PROGRESSIVE_SURFACE_CONTEXT
 	UINT32 gridHeight;
 	UINT32 gridSize;
 	RFX_PROGRESSIVE_TILE* tiles;
+
+	UINT32 frameIndex;
 };
 typedef struct _PROGRESSIVE_SURFACE_CONTEXT PROGRESSIVE_SURFACE_CONTEXT;
 
@@ -227,6 +231,8 @@ struct _PROGRESSIVE_CONTEXT
 
 	wHashTable* SurfaceContexts;
 	wLog* log;
+
+	wStream* buffer;
 };
 
 #endif /* INTERNAL_CODEC_PROGRESSIVE_H */
@@ -95,6 +95,7 @@ static void rfx_profiler_create(RFX_CONTEXT* context)
 	PROFILER_CREATE(context->priv->prof_rfx_dwt_2d_encode, "rfx_dwt_2d_encode")
 	PROFILER_CREATE(context->priv->prof_rfx_rgb_to_ycbcr, "prims->RGBToYCbCr")
 	PROFILER_CREATE(context->priv->prof_rfx_encode_format_rgb, "rfx_encode_format_rgb")
+	PROFILER_CREATE(context->priv->prof_rfx_tile_hash, "rfx_tile_hash")
 }
 
 static void rfx_profiler_free(RFX_CONTEXT* context)
@@ -114,6 +115,7 @@ static void rfx_profiler_free(RFX_CONTEXT* context)
 	PROFILER_FREE(context->priv->prof_rfx_dwt_2d_encode)
 	PROFILER_FREE(context->priv->prof_rfx_rgb_to_ycbcr)
 	PROFILER_FREE(context->priv->prof_rfx_encode_format_rgb)
+	PROFILER_FREE(context->priv->prof_rfx_tile_hash)
 }
 
 static void rfx_profiler_print(RFX_CONTEXT* context)
@@ -134,7 +136,14 @@ static void rfx_profiler_print(RFX_CONTEXT* context)
 	PROFILER_PRINT(context->priv->prof_rfx_dwt_2d_encode)
 	PROFILER_PRINT(context->priv->prof_rfx_rgb_to_ycbcr)
 	PROFILER_PRINT(context->priv->prof_rfx_encode_format_rgb)
+	PROFILER_PRINT(context->priv->prof_rfx_tile_hash)
 	PROFILER_PRINT_FOOTER
+#ifdef WITH_PROFILER
+	if (context->priv->TilesHashed)
+		WLog_INFO(TAG, "rfx_tile_hash: skipped %" PRIu64 " of %" PRIu64 " tiles (%.1f%%)",
+		          context->priv->TilesSkipped, context->priv->TilesHashed,
+		          100.0 * context->priv->TilesSkipped / context->priv->TilesHashed);
+#endif
 }
 
 static void rfx_tile_init(void* obj)
@@ -379,6 +388,7 @@ void rfx_context_free(RFX_CONTEXT* context)
 	}
 
 	BufferPool_Free(context->priv->BufferPool);
+	free(context->priv->TileHashes);
 	free(context->priv);
 	free(context);
 }
@@ -409,6 +419,28 @@ BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height)
 	context->state = RFX_STATE_SEND_HEADERS;
 	context->expectedDataBlockType = WBT_FRAME_BEGIN;
 	context->frameIdx = 0;
+
+	/* the client starts over with a new surface */
+	if (context->priv->TileHashes)
+		ZeroMemory(context->priv->TileHashes,
+		           sizeof(UINT64) * context->priv->TileHashesX * context->priv->TileHashesY);
+
+	return TRUE;
+}
+
+BOOL rfx_context_set_tile_hashing(RFX_CONTEXT* context, BOOL enable)
+{
+	RFX_CONTEXT_PRIV* priv;
+
+	if (!context || !context->encoder)
+		return FALSE;
+
+	priv = context->priv;
+	priv->TileHashing = enable;
+	free(priv->TileHashes);
+	priv->TileHashes = NULL;
+	priv->TileHashesX = 0;
+	priv->TileHashesY = 0;
 	return TRUE;
 }
 
@@ -1412,6 +1444,199 @@ static BOOL setupWorkers(RFX_CONTEXT* context, int nbTiles)
 	return TRUE;
 }
 
+#define RFX_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define RFX_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+
+static INLINE UINT64 rfx_hash_rotl(UINT64 v, UINT32 n)
+{
+	return (v << n) | (v >> (64 - n));
+}
+
+static INLINE UINT64 rfx_hash_round(UINT64 acc, UINT64 value)
+{
+	return rfx_hash_rotl(acc + value * RFX_HASH_PRIME2, 31) * RFX_HASH_PRIME1;
+}
+
+static INLINE UINT64 rfx_hash_load(const BYTE* p)
+{
+	UINT64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* 64 bit content hash of a tile with four independent lanes per row, never returns 0 */
+static UINT64 rfx_tile_hash(const BYTE* data, UINT32 scanline, UINT32 rowBytes, UINT32 height,
+                            UINT64 seed)
+{
+	UINT32 x, y;
+	UINT64 h;
+	UINT64 lane0 = seed + RFX_HASH_PRIME1 + RFX_HASH_PRIME2;
+	UINT64 lane1 = seed + RFX_HASH_PRIME2;
+	UINT64 lane2 = seed;
+	UINT64 lane3 = seed - RFX_HASH_PRIME1;
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* row = &data[y * scanline];
+
+		for (x = 0; x + 32 <= rowBytes; x += 32)
+		{
+			lane0 = rfx_hash_round(lane0, rfx_hash_load(&row[x]));
+			lane1 = rfx_hash_round(lane1, rfx_hash_load(&row[x + 8]));
+			lane2 = rfx_hash_round(lane2, rfx_hash_load(&row[x + 16]));
+			lane3 = rfx_hash_round(lane3, rfx_hash_load(&row[x + 24]));
+		}
+
+		for (; x + 8 <= rowBytes; x += 8)
+			lane0 = rfx_hash_round(lane0, rfx_hash_load(&row[x]));
+
+		if (x < rowBytes)
+		{
+			UINT64 v = 0;
+			memcpy(&v, &row[x], rowBytes - x);
+			lane1 = rfx_hash_round(lane1, v);
+		}
+	}
+
+	h = rfx_hash_rotl(lane0, 1) + rfx_hash_rotl(lane1, 7) + rfx_hash_rotl(lane2, 12) +
+	    rfx_hash_rotl(lane3, 18);
+	h ^= h >> 33;
+	h *= RFX_HASH_PRIME2;
+	h ^= h >> 29;
+	h *= RFX_HASH_PRIME1;
+	h ^= h >> 32;
+	return h ? h : 1;
+}
+
+/* Covers everything besides the pixels that changes the decoded tile */
+static UINT64 rfx_tile_hash_seed(const RFX_CONTEXT* context)
+{
+	UINT32 i;
+	UINT64 seed = rfx_hash_round(context->pixel_format, ((UINT64)context->quantIdxY << 16) |
+	                                                        ((UINT64)context->quantIdxCb << 8) |
+	                                                        context->quantIdxCr);
+
+	for (i = 0; i < context->numQuant * 10; i++)
+		seed = rfx_hash_round(seed, context->quants[i]);
+
+	return seed;
+}
+
+static void rfx_tile_hashes_invalidate(RFX_CONTEXT_PRIV* priv)
+{
+	if (priv->TileHashes)
+		ZeroMemory(priv->TileHashes, sizeof(UINT64) * priv->TileHashesX * priv->TileHashesY);
+}
+
+static BOOL rfx_tile_hashes_prepare(RFX_CONTEXT_PRIV* priv, UINT32 width, UINT32 height)
+{
+	const UINT32 tilesX = (width + 63) / 64;
+	const UINT32 tilesY = (height + 63) / 64;
+
+	if (priv->TileHashes && (priv->TileHashesX == tilesX) && (priv->TileHashesY == tilesY))
+		return TRUE;
+
+	free(priv->TileHashes);
+	priv->TileHashesX = tilesX;
+	priv->TileHashesY = tilesY;
+
+	if (!(priv->TileHashes = (UINT64*)calloc(tilesX * tilesY, sizeof(UINT64))))
+	{
+		priv->TileHashesX = priv->TileHashesY = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Returns TRUE if the tile content matches the last encoded one, otherwise remembers it */
+static BOOL rfx_tile_unchanged(RFX_CONTEXT* context, const BYTE* data, UINT32 scanline,
+                               UINT32 xIdx, UINT32 yIdx, UINT32 width, UINT32 height, UINT64 seed)
+{
+	UINT64 hash;
+	RFX_CONTEXT_PRIV* priv = context->priv;
+	UINT64* last = &priv->TileHashes[yIdx * priv->TileHashesX + xIdx];
+	const UINT32 bytesPerPixel = (context->bits_per_pixel / 8);
+	PROFILER_ENTER(priv->prof_rfx_tile_hash)
+	hash = rfx_tile_hash(&data[(yIdx * 64 * scanline) + (xIdx * 64 * bytesPerPixel)], scanline,
+	                     width * bytesPerPixel, height,
+	                     rfx_hash_round(seed, ((UINT64)width << 32) | height));
+	PROFILER_EXIT(priv->prof_rfx_tile_hash)
+	priv->TilesHashed++;
+
+	if (*last == hash)
+	{
+		priv->TilesSkipped++;
+		return TRUE;
+	}
+
+	*last = hash;
+	return FALSE;
+}
+
+static BOOL rfx_encode_message_tile(RFX_CONTEXT* context, RFX_MESSAGE* message, BYTE* data,
+                                    UINT32 scanline, UINT32 xIdx, UINT32 yIdx, UINT32 width,
+                                    UINT32 height)
+{
+	RFX_TILE* tile;
+	const UINT32 index = message->numTiles;
+	const UINT32 bytesPerPixel = (context->bits_per_pixel / 8);
+
+	if (!(tile = (RFX_TILE*)ObjectPool_Take(context->priv->TilePool)))
+		return FALSE;
+
+	tile->xIdx = xIdx;
+	tile->yIdx = yIdx;
+	tile->x = xIdx * 64;
+	tile->y = yIdx * 64;
+	tile->scanline = scanline;
+	tile->width = width;
+	tile->height = height;
+
+	if (tile->data && tile->allocated)
+	{
+		free(tile->data);
+		tile->allocated = FALSE;
+	}
+
+	tile->data = &data[(tile->y * scanline) + (tile->x * bytesPerPixel)];
+	tile->quantIdxY = context->quantIdxY;
+	tile->quantIdxCb = context->quantIdxCb;
+	tile->quantIdxCr = context->quantIdxCr;
+	tile->YLen = tile->CbLen = tile->CrLen = 0;
+
+	if (!(tile->YCbCrData = (BYTE*)BufferPool_Take(context->priv->BufferPool, -1)))
+		return FALSE;
+
+	tile->YData = (BYTE*)&(tile->YCbCrData[((8192 + 32) * 0) + 16]);
+	tile->CbData = (BYTE*)&(tile->YCbCrData[((8192 + 32) * 1) + 16]);
+	tile->CrData = (BYTE*)&(tile->YCbCrData[((8192 + 32) * 2) + 16]);
+	message->tiles[message->numTiles] = tile;
+	message->numTiles++;
+
+	if (context->priv->UseThreads)
+	{
+		PTP_WORK* workObject = &context->priv->workObjects[index];
+		RFX_TILE_COMPOSE_WORK_PARAM* workParam = &context->priv->tileWorkParams[index];
+		workParam->context = context;
+		workParam->tile = tile;
+
+		if (!(*workObject = CreateThreadpoolWork(rfx_compose_message_tile_work_callback,
+		                                         (void*)workParam, &context->priv->ThreadPoolEnv)))
+		{
+			return FALSE;
+		}
+
+		SubmitThreadpoolWork(*workObject);
+	}
+	else
+	{
+		rfx_encode_rgb(context, tile);
+	}
+
+	return TRUE;
+}
+
 RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int numRects,
                                 BYTE* data, int w, int h, int s)
 {
@@ -1420,12 +1645,14 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int
 	const UINT32 scanline = (UINT32)s;
 	UINT32 i, maxNbTiles, maxTilesX, maxTilesY;
 	UINT32 xIdx, yIdx, regionNbRects;
-	UINT32 gridRelX, gridRelY, ax, ay, bytesPerPixel;
+	UINT32 gridRelX, gridRelY;
+	UINT64 hashSeed = 0;
+	BOOL skippedTile = FALSE;
+	UINT32 skippedX = 0, skippedY = 0, skippedWidth = 0, skippedHeight = 0;
 	RFX_TILE* tile;
 	RFX_RECT* rfxRect;
 	RFX_MESSAGE* message = NULL;
 	PTP_WORK* workObject = NULL;
-	RFX_TILE_COMPOSE_WORK_PARAM* workParam = NULL;
 	BOOL success = FALSE;
 	REGION16 rectsRegion, tilesRegion;
 	RECTANGLE_16 currentTileRect;
@@ -1464,7 +1691,14 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int
 
 	message->numQuant = context->numQuant;
 	message->quantVals = context->quants;
-	bytesPerPixel = (context->bits_per_pixel / 8);
+
+	if (context->priv->TileHashing)
+	{
+		if (!rfx_tile_hashes_prepare(context->priv, width, height))
+			goto skip_encoding_loop;
+
+		hashSeed = rfx_tile_hash_seed(context);
+	}
 
 	if (!computeRegion(rects, numRects, &rectsRegion, width, height))
 		goto skip_encoding_loop;
@@ -1482,12 +1716,6 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int
 	if (!setupWorkers(context, maxNbTiles))
 		goto skip_encoding_loop;
 
-	if (context->priv->UseThreads)
-	{
-		workObject = context->priv->workObjects;
-		workParam = context->priv->tileWorkParams;
-	}
-
 	regionRect = region16_rects(&rectsRegion, &regionNbRects);
 
 	if (!(message->rects = calloc(regionNbRects, sizeof(RFX_RECT))))
@@ -1520,7 +1748,7 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int
 			for (xIdx = startTileX, gridRelX = startTileX * 64; xIdx <= endTileX;
 			     xIdx++, gridRelX += 64)
 			{
-				int tileWidth = 64;
+				UINT32 tileWidth = 64;
 
 				if ((xIdx == endTileX) && (gridRelX + 64 > width))
 					tileWidth = width - gridRelX;
@@ -1532,67 +1760,42 @@ RFX_MESSAGE* rfx_encode_message(RFX_CONTEXT* context, const RFX_RECT* rects, int
 				if (region16_intersects_rect(&tilesRegion, &currentTileRect))
 					continue;
 
-				if (!(tile = (RFX_TILE*)ObjectPool_Take(context->priv->TilePool)))
-					goto skip_encoding_loop;
-
-				tile->xIdx = xIdx;
-				tile->yIdx = yIdx;
-				tile->x = gridRelX;
-				tile->y = gridRelY;
-				tile->scanline = scanline;
-				tile->width = tileWidth;
-				tile->height = tileHeight;
-				ax = gridRelX;
-				ay = gridRelY;
-
-				if (tile->data && tile->allocated)
-				{
-					free(tile->data);
-					tile->allocated = FALSE;
-				}
-
-				tile->data = &data[(ay * scanline) + (ax * bytesPerPixel)];
-				tile->quantIdxY = context->quantIdxY;
-				tile->quantIdxCb = context->quantIdxCb;
-				tile->quantIdxCr = context->quantIdxCr;
-				tile->YLen = tile->CbLen = tile->CrLen = 0;
-
-				if (!(tile->YCbCrData = (BYTE*)BufferPool_Take(context->priv->BufferPool, -1)))
+				if (!region16_union_rect(&tilesRegion, &tilesRegion, &currentTileRect))
 					goto skip_encoding_loop;
 
-				tile->YData = (BYTE*)&(tile->YCbCrData[((8192 + 32) * 0) + 16]);
-				tile->CbData = (BYTE*)&(tile->YCbCrData[((8192 + 32) * 1) + 16]);
-				tile->CrData = (BYTE*)&(tile->YCbCrData[((8192 + 32) * 2) + 16]);
-				message->tiles[message->numTiles] = tile;
-				message->numTiles++;
-
-				if (context->priv->UseThreads)
+				if (context->priv->TileHashing &&
+				    rfx_tile_unchanged(context, data, scanline, xIdx, yIdx, tileWidth, tileHeight,
+				                       hashSeed))
 				{
-					workParam->context = context;
-					workParam->tile = tile;
-
-					if (!(*workObject = CreateThreadpoolWork(rfx_compose_message_tile_work_callback,
-					                                         (void*)workParam,
-					                                         &context->priv->ThreadPoolEnv)))
+					if (!skippedTile)
 					{
-						goto skip_encoding_loop;
+						skippedTile = TRUE;
+						skippedX = xIdx;
+						skippedY = yIdx;
+						skippedWidth = tileWidth;
+						skippedHeight = tileHeight;
 					}
 
-					SubmitThreadpoolWork(*workObject);
-					workObject++;
-					workParam++;
-				}
-				else
-				{
-					rfx_encode_rgb(context, tile);
+					continue;
 				}
 
-				if (!region16_union_rect(&tilesRegion, &tilesRegion, &currentTileRect))
+				if (!rfx_encode_message_tile(context, message, data, scanline, xIdx, yIdx,
+				                             tileWidth, tileHeight))
 					goto skip_encoding_loop;
 			} /* xIdx */
 		}     /* yIdx */
 	}         /* rects */
 
+	/* a tileset needs at least one tile, send an unchanged one if nothing else changed */
+	if ((message->numTiles == 0) && skippedTile)
+	{
+		context->priv->TilesSkipped--;
+
+		if (!rfx_encode_message_tile(context, message, data, scanline, skippedX, skippedY,
+		                             skippedWidth, skippedHeight))
+			goto skip_encoding_loop;
+	}
+
 	success = TRUE;
 skip_encoding_loop:
 
@@ -1642,6 +1845,8 @@ skip_encoding_loop:
 	}
 
 	WLog_ERR(TAG, "%s: failed", __FUNCTION__);
+	/* the client will not see this message, forget what it would have updated */
+	rfx_tile_hashes_invalidate(context->priv);
 	message->freeRects = TRUE;
 	rfx_message_free(context, message);
 	return NULL;
@@ -33,13 +33,16 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/sysinfo.h>
-#include <winpr/bitstream.h>
 #include <winpr/intrin.h>
 
-#include "rfx_bitstream.h"
-
 #include "rfx_rlgr.h"
 
+#if defined(WITH_SSE2) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#include <emmintrin.h>
+#define RFX_RLGR_SSE2
+#endif
+
 /* Constants used in RLGR1/RLGR3 algorithm */
 #define KPMAX (80) /* max value for kp or krp */
 #define LSGR (3)   /* shift count to convert kp to k */
@@ -74,12 +77,50 @@
 		_k = (_param >> LSGR);           \
 	}
 
+/* Reads the bitstream most significant bit first through a 64 bit buffer */
+typedef struct
+{
+	const BYTE* src;
+	const BYTE* end;
+	UINT64 bits;  /* msb aligned, bits past the end of the stream are zero */
+	UINT32 avail; /* number of valid bits in the buffer */
+} RFX_RLGR_READER;
+
+/* Writes the bitstream most significant bit first through a 64 bit buffer */
+typedef struct
+{
+	BYTE* buffer;
+	size_t capacity;
+	size_t position; /* may run past capacity, the excess bytes are dropped */
+	UINT64 bits;     /* lsb aligned, only the lowest count bits are pending */
+	UINT32 count;    /* always less than 32 between calls */
+} RFX_RLGR_WRITER;
+
 static BOOL g_LZCNT = FALSE;
 
+/* number of leading zero bits of a byte, used for prefix counts without LZCNT */
+static BYTE g_LeadingZeros[256];
+
 static INIT_ONCE rfx_rlgr_init_once = INIT_ONCE_STATIC_INIT;
 
 static BOOL CALLBACK rfx_rlgr_init(PINIT_ONCE once, PVOID param, PVOID* context)
 {
+	size_t i;
+
+	for (i = 0; i < ARRAYSIZE(g_LeadingZeros); i++)
+	{
+		BYTE n = 8;
+		size_t v = i;
+
+		while (v)
+		{
+			v >>= 1;
+			n--;
+		}
+
+		g_LeadingZeros[i] = n;
+	}
+
 	g_LZCNT = IsProcessorFeaturePresentEx(PF_EX_LZCNT);
 	return TRUE;
 }
@@ -91,50 +132,135 @@ static INLINE UINT32 lzcnt_s(UINT32 x)
 
 	if (!g_LZCNT)
 	{
-		UINT32 y;
-		int n = 32;
-		y = x >> 16;
-		if (y != 0)
-		{
-			n = n - 16;
-			x = y;
-		}
-		y = x >> 8;
-		if (y != 0)
-		{
-			n = n - 8;
-			x = y;
-		}
-		y = x >> 4;
-		if (y != 0)
-		{
-			n = n - 4;
-			x = y;
-		}
-		y = x >> 2;
-		if (y != 0)
+		if (x >> 16)
 		{
-			n = n - 2;
-			x = y;
+			if (x >> 24)
+				return g_LeadingZeros[x >> 24];
+
+			return 8 + g_LeadingZeros[x >> 16];
 		}
-		y = x >> 1;
-		if (y != 0)
-			return n - 2;
-		return n - x;
+
+		if (x >> 8)
+			return 16 + g_LeadingZeros[x >> 8];
+
+		return 24 + g_LeadingZeros[x];
 	}
 
 	return __lzcnt(x);
 }
 
+static INLINE UINT32 lzcnt64_s(UINT64 x)
+{
+	const UINT32 hi = (UINT32)(x >> 32);
+
+	if (hi)
+		return lzcnt_s(hi);
+
+	return 32 + lzcnt_s((UINT32)x);
+}
+
+static INLINE void rfx_rlgr_reader_init(RFX_RLGR_READER* r, const BYTE* src, size_t size)
+{
+	r->src = src;
+	r->end = src + size;
+	r->bits = 0;
+	r->avail = 0;
+}
+
+/* Tops the buffer up to at least 56 valid bits unless the stream ends first */
+static INLINE void rfx_rlgr_reader_refill(RFX_RLGR_READER* r)
+{
+	if (r->end - r->src >= 8)
+	{
+		const BYTE* s = r->src;
+		const UINT64 v = ((UINT64)s[0] << 56) | ((UINT64)s[1] << 48) | ((UINT64)s[2] << 40) |
+		                 ((UINT64)s[3] << 32) | ((UINT64)s[4] << 24) | ((UINT64)s[5] << 16) |
+		                 ((UINT64)s[6] << 8) | (UINT64)s[7];
+		/* bits beyond avail are either zero or already the same stream bits */
+		r->bits |= v >> r->avail;
+		r->src += (63 - r->avail) >> 3;
+		r->avail |= 56;
+		return;
+	}
+
+	while ((r->avail < 56) && (r->src < r->end))
+	{
+		r->bits |= ((UINT64)*r->src++) << (56 - r->avail);
+		r->avail += 8;
+	}
+}
+
+static INLINE size_t rfx_rlgr_reader_remaining(const RFX_RLGR_READER* r)
+{
+	return r->avail + 8 * (size_t)(r->end - r->src);
+}
+
+/* Consumes n bits, n must not exceed the number of remaining bits */
+static INLINE void rfx_rlgr_reader_skip(RFX_RLGR_READER* r, UINT32 n)
+{
+	if (n > r->avail)
+		rfx_rlgr_reader_refill(r);
+
+	r->bits <<= n;
+	r->avail -= n;
+}
+
+/* Reads n <= 32 bits, n must not exceed the number of remaining bits */
+static INLINE UINT32 rfx_rlgr_reader_read(RFX_RLGR_READER* r, UINT32 n)
+{
+	UINT32 v;
+
+	if (!n)
+		return 0;
+
+	if (n > r->avail)
+		rfx_rlgr_reader_refill(r);
+
+	v = (UINT32)(r->bits >> (64 - n));
+	r->bits <<= n;
+	r->avail -= n;
+	return v;
+}
+
+/*
+ * Consumes a run of equal leading bits (zeros if ones is FALSE) and returns its length.
+ * The run ends at the first differing bit, which is not consumed, or at the end of the stream.
+ */
+static INLINE UINT32 rfx_rlgr_reader_run(RFX_RLGR_READER* r, BOOL ones)
+{
+	UINT32 count = 0;
+
+	for (;;)
+	{
+		UINT32 n;
+
+		if (r->avail < 32)
+			rfx_rlgr_reader_refill(r);
+
+		n = lzcnt64_s(ones ? ~r->bits : r->bits);
+
+		if (n < r->avail)
+		{
+			r->bits <<= n;
+			r->avail -= n;
+			return count + n;
+		}
+
+		count += r->avail;
+		r->bits = 0;
+		r->avail = 0;
+
+		if (r->src >= r->end)
+			return count;
+	}
+}
+
 int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16* pDstData,
                     UINT32 DstSize)
 {
-	int vk;
-	int run;
-	int cnt;
-	int size;
-	int nbits;
-	size_t offset;
+	UINT32 vk;
+	size_t run;
+	size_t size;
 	INT16 mag;
 	UINT32 k;
 	INT32 kp;
@@ -146,8 +272,9 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 	UINT32 val1;
 	UINT32 val2;
 	INT16* pOutput;
-	wBitStream* bs;
-	wBitStream s_bs;
+	INT16* pEnd;
+	RFX_RLGR_READER* r;
+	RFX_RLGR_READER s_r;
 
 	InitOnceExecuteOnce(&rfx_rlgr_init_once, rfx_rlgr_init, NULL, NULL);
 
@@ -167,13 +294,12 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 		return -1;
 
 	pOutput = pDstData;
+	pEnd = &pDstData[DstSize];
 
-	bs = &s_bs;
-
-	BitStream_Attach(bs, pSrcData, SrcSize);
-	BitStream_Fetch(bs);
+	r = &s_r;
+	rfx_rlgr_reader_init(r, pSrcData, SrcSize);
 
-	while ((BitStream_GetRemainingLength(bs) > 0) && ((pOutput - pDstData) < DstSize))
+	while ((rfx_rlgr_reader_remaining(r) > 0) && (pOutput < pEnd))
 	{
 		if (k)
 		{
@@ -183,35 +309,12 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 			/* count number of leading 0s */
 
-			cnt = lzcnt_s(bs->accumulator);
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(bs->accumulator);
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
+			vk = rfx_rlgr_reader_run(r, FALSE);
 
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (rfx_rlgr_reader_remaining(r) < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			rfx_rlgr_reader_skip(r, 1);
 
 			while (vk--)
 			{
@@ -221,105 +324,65 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 				kp += UP_GR;
 
-				if (kp > KPMAX)
+				if (kp >= KPMAX)
+				{
 					kp = KPMAX;
+					k = kp >> LSGR;
+					run += (size_t)vk << k; /* k no longer changes */
+					break;
+				}
 
 				k = kp >> LSGR;
 			}
 
 			/* next k bits contain run length remainder */
 
-			if (BitStream_GetRemainingLength(bs) < k)
+			if (rfx_rlgr_reader_remaining(r) < k)
 				break;
 
-			bs->mask = ((1 << k) - 1);
-			run += ((bs->accumulator >> (32 - k)) & bs->mask);
-			BitStream_Shift(bs, k);
+			run += rfx_rlgr_reader_read(r, k);
 
 			/* read sign bit */
 
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (rfx_rlgr_reader_remaining(r) < 1)
 				break;
 
-			sign = (bs->accumulator & 0x80000000) ? 1 : 0;
-			BitStream_Shift(bs, 1);
+			sign = rfx_rlgr_reader_read(r, 1);
 
 			/* count number of leading 1s */
 
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
-
-				nbits = BitStream_GetRemainingLength(bs);
+			vk = rfx_rlgr_reader_run(r, TRUE);
 
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (rfx_rlgr_reader_remaining(r) < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			rfx_rlgr_reader_skip(r, 1);
 
 			/* next kr bits contain code remainder */
 
-			if (BitStream_GetRemainingLength(bs) < kr)
+			if (rfx_rlgr_reader_remaining(r) < kr)
 				break;
 
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16)((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
+			code = (UINT16)rfx_rlgr_reader_read(r, kr);
 
 			/* add (vk << kr) to code */
 
 			code |= (vk << kr);
 
+			/* update kr, krp params */
+
 			if (!vk)
 			{
-				/* update kr, krp params */
-
-				krp -= 2;
-
-				if (krp < 0)
-					krp = 0;
-
-				kr = krp >> LSGR;
+				UpdateParam(krp, -2, kr);
 			}
 			else if (vk != 1)
 			{
-				/* update kr, krp params */
-
-				krp += vk;
-
-				if (krp > KPMAX)
-					krp = KPMAX;
-
-				kr = krp >> LSGR;
+				UpdateParam(krp, (INT32)vk, kr);
 			}
 
 			/* update k, kp params */
 
-			kp -= DN_GR;
-
-			if (kp < 0)
-				kp = 0;
-
-			k = kp >> LSGR;
+			UpdateParam(kp, -DN_GR, k);
 
 			/* compute magnitude from code */
 
@@ -330,11 +393,10 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 			/* write to output stream */
 
-			offset = (pOutput - pDstData);
 			size = run;
 
-			if ((offset + size) > DstSize)
-				size = DstSize - offset;
+			if (size > (size_t)(pEnd - pOutput))
+				size = (size_t)(pEnd - pOutput);
 
 			if (size)
 			{
@@ -342,11 +404,8 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				pOutput += size;
 			}
 
-			if ((pOutput - pDstData) < DstSize)
-			{
-				*pOutput = mag;
-				pOutput++;
-			}
+			if (pOutput < pEnd)
+				*pOutput++ = mag;
 		}
 		else
 		{
@@ -354,97 +413,45 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 			/* count number of leading 1s */
 
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
+			vk = rfx_rlgr_reader_run(r, TRUE);
 
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (rfx_rlgr_reader_remaining(r) < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			rfx_rlgr_reader_skip(r, 1);
 
 			/* next kr bits contain code remainder */
 
-			if (BitStream_GetRemainingLength(bs) < kr)
+			if (rfx_rlgr_reader_remaining(r) < kr)
 				break;
 
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16)((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
+			code = (UINT16)rfx_rlgr_reader_read(r, kr);
 
 			/* add (vk << kr) to code */
 
 			code |= (vk << kr);
 
+			/* update kr, krp params */
+
 			if (!vk)
 			{
-				/* update kr, krp params */
-
-				krp -= 2;
-
-				if (krp < 0)
-					krp = 0;
-
-				kr = krp >> LSGR;
+				UpdateParam(krp, -2, kr);
 			}
 			else if (vk != 1)
 			{
-				/* update kr, krp params */
-
-				krp += vk;
-
-				if (krp > KPMAX)
-					krp = KPMAX;
-
-				kr = krp >> LSGR;
+				UpdateParam(krp, (INT32)vk, kr);
 			}
 
 			if (mode == RLGR1) /* RLGR1 */
 			{
 				if (!code)
 				{
-					/* update k, kp params */
-
-					kp += UQ_GR;
-
-					if (kp > KPMAX)
-						kp = KPMAX;
-
-					k = kp >> LSGR;
-
+					UpdateParam(kp, UQ_GR, k);
 					mag = 0;
 				}
 				else
 				{
-					/* update k, kp params */
-
-					kp -= DQ_GR;
-
-					if (kp < 0)
-						kp = 0;
-
-					k = kp >> LSGR;
+					UpdateParam(kp, -DQ_GR, k);
 
 					/*
 					 * code = 2 * mag - sign
@@ -457,52 +464,29 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 						mag = (INT16)(code >> 1);
 				}
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				if (pOutput < pEnd)
+					*pOutput++ = mag;
 			}
 			else if (mode == RLGR3) /* RLGR3 */
 			{
 				nIdx = 0;
 
 				if (code)
-				{
-					mag = (UINT32)code;
-					nIdx = 32 - lzcnt_s(mag);
-				}
+					nIdx = 32 - lzcnt_s(code);
 
-				if (BitStream_GetRemainingLength(bs) < nIdx)
+				if (rfx_rlgr_reader_remaining(r) < nIdx)
 					break;
 
-				bs->mask = ((1 << nIdx) - 1);
-				val1 = ((bs->accumulator >> (32 - nIdx)) & bs->mask);
-				BitStream_Shift(bs, nIdx);
-
+				val1 = rfx_rlgr_reader_read(r, nIdx);
 				val2 = code - val1;
 
 				if (val1 && val2)
 				{
-					/* update k, kp params */
-
-					kp -= (2 * DQ_GR);
-
-					if (kp < 0)
-						kp = 0;
-
-					k = kp >> LSGR;
+					UpdateParam(kp, -2 * DQ_GR, k);
 				}
 				else if (!val1 && !val2)
 				{
-					/* update k, kp params */
-
-					kp += (2 * UQ_GR);
-
-					if (kp > KPMAX)
-						kp = KPMAX;
-
-					k = kp >> LSGR;
+					UpdateParam(kp, 2 * UQ_GR, k);
 				}
 
 				if (val1 & 1)
@@ -510,90 +494,164 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				else
 					mag = (INT16)(val1 >> 1);
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				if (pOutput < pEnd)
+					*pOutput++ = mag;
 
 				if (val2 & 1)
 					mag = ((INT16)((val2 + 1) >> 1)) * -1;
 				else
 					mag = (INT16)(val2 >> 1);
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				if (pOutput < pEnd)
+					*pOutput++ = mag;
 			}
 		}
 	}
 
-	offset = (pOutput - pDstData);
+	if (pOutput < pEnd)
+	{
+		size = (size_t)(pEnd - pOutput);
+		ZeroMemory(pOutput, size * sizeof(INT16));
+	}
+
+	return 1;
+}
+
+static INLINE void rfx_rlgr_writer_init(RFX_RLGR_WRITER* w, BYTE* buffer, size_t capacity)
+{
+	w->buffer = buffer;
+	w->capacity = buffer ? capacity : 0;
+	w->position = 0;
+	w->bits = 0;
+	w->count = 0;
+}
+
+static INLINE void rfx_rlgr_writer_emit_byte(RFX_RLGR_WRITER* w, BYTE b)
+{
+	if (w->position < w->capacity)
+		w->buffer[w->position] = b;
+
+	w->position++;
+}
+
+static INLINE void rfx_rlgr_writer_emit32(RFX_RLGR_WRITER* w, UINT32 v)
+{
+	if (w->position + 4 <= w->capacity)
+	{
+		BYTE* d = &w->buffer[w->position];
+		d[0] = (BYTE)(v >> 24);
+		d[1] = (BYTE)(v >> 16);
+		d[2] = (BYTE)(v >> 8);
+		d[3] = (BYTE)v;
+		w->position += 4;
+		return;
+	}
+
+	rfx_rlgr_writer_emit_byte(w, (BYTE)(v >> 24));
+	rfx_rlgr_writer_emit_byte(w, (BYTE)(v >> 16));
+	rfx_rlgr_writer_emit_byte(w, (BYTE)(v >> 8));
+	rfx_rlgr_writer_emit_byte(w, (BYTE)v);
+}
 
-	if (offset < DstSize)
+/* Appends the nbits <= 32 low bits of value, which must not have any higher bit set */
+static INLINE void rfx_rlgr_writer_put(RFX_RLGR_WRITER* w, UINT32 value, UINT32 nbits)
+{
+	w->bits = (w->bits << nbits) | value;
+	w->count += nbits;
+
+	if (w->count >= 32)
 	{
-		size = DstSize - offset;
-		ZeroMemory(pOutput, size * 2);
-		pOutput += size;
+		w->count -= 32;
+		rfx_rlgr_writer_emit32(w, (UINT32)(w->bits >> w->count));
 	}
+}
 
-	offset = (pOutput - pDstData);
+/* Appends count bits all set to bit */
+static INLINE void rfx_rlgr_writer_fill(RFX_RLGR_WRITER* w, UINT32 count, BOOL bit)
+{
+	for (; count > 32; count -= 32)
+		rfx_rlgr_writer_put(w, bit ? 0xFFFFFFFF : 0, 32);
 
-	if (offset != DstSize)
-		return -1;
+	if (count)
+		rfx_rlgr_writer_put(w, bit ? (UINT32)((1ULL << count) - 1) : 0, count);
+}
 
-	return 1;
+/*
+ * Pads the pending bits with zeros and returns the number of bytes written.
+ * The padding repeats the length of the partial last byte before rounding up to a byte
+ * boundary, which may append a zero byte. Decoders ignore it, it is kept so the encoded
+ * size stays the same as with the original bitstream flush.
+ */
+static INLINE size_t rfx_rlgr_writer_flush(RFX_RLGR_WRITER* w)
+{
+	const UINT32 partial = w->count & 7;
+	const UINT32 pad = partial + ((8 - ((w->count + partial) & 7)) & 7);
+	const UINT64 v = w->bits << pad;
+	UINT32 n = (w->count + pad) / 8;
+
+	while (n--)
+		rfx_rlgr_writer_emit_byte(w, (BYTE)(v >> (8 * n)));
+
+	w->bits = 0;
+	w->count = 0;
+	return (w->position < w->capacity) ? w->position : w->capacity;
 }
 
-/* Returns the next coefficient (a signed int) to encode, from the input stream */
-#define GetNextInput(_n)   \
-	{                      \
-		if (data_size > 0) \
-		{                  \
-			_n = *data++;  \
-			data_size--;   \
-		}                  \
-		else               \
-		{                  \
-			_n = 0;        \
-		}                  \
+/* Returns the number of zero coefficients at the start of data */
+static INLINE UINT32 rfx_rlgr_zero_run(const INT16* data, UINT32 size)
+{
+	UINT32 n = 0;
+#if defined(RFX_RLGR_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; n + 8 <= size; n += 8)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*)&data[n]);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) != 0xFFFF)
+			break;
 	}
+#else
 
-/* Emit bitPattern to the output bitstream */
-#define OutputBits(numBits, bitPattern) rfx_bitstream_put_bits(bs, bitPattern, numBits)
+	for (; n + 4 <= size; n += 4)
+	{
+		UINT64 v;
+		memcpy(&v, &data[n], sizeof(v));
 
-/* Emit a bit (0 or 1), count number of times, to the output bitstream */
-#define OutputBit(count, bit)                                    \
-	{                                                            \
-		UINT16 _b = (bit ? 0xFFFF : 0);                          \
-		int _c = (count);                                        \
-		for (; _c > 0; _c -= 16)                                 \
-			rfx_bitstream_put_bits(bs, _b, (_c > 16 ? 16 : _c)); \
+		if (v)
+			break;
 	}
+#endif
+
+	while ((n < size) && (data[n] == 0))
+		n++;
+
+	return n;
+}
 
 /* Converts the input value to (2 * abs(input) - sign(input)), where sign(input) = (input < 0 ? 1 :
  * 0) and returns it */
 #define Get2MagSign(input) ((input) >= 0 ? 2 * (input) : -2 * (input)-1)
 
 /* Outputs the Golomb/Rice encoding of a non-negative integer */
-#define CodeGR(krp, val) rfx_rlgr_code_gr(bs, krp, val)
-
-static void rfx_rlgr_code_gr(RFX_BITSTREAM* bs, int* krp, UINT32 val)
+static INLINE void rfx_rlgr_code_gr(RFX_RLGR_WRITER* w, int* krp, UINT32 val)
 {
 	int kr = *krp >> LSGR;
 
-	/* unary part of GR code */
+	/* unary part of GR code, vk ones terminated by a zero */
+	UINT32 vk = val >> kr;
+	const UINT32 remainder = val & ((1 << kr) - 1);
 
-	UINT32 vk = (val) >> kr;
-	OutputBit(vk, 1);
-	OutputBit(1, 0);
-
-	/* remainder part of GR code, if needed */
-	if (kr)
+	/* kr never exceeds KPMAX >> LSGR so short codes are emitted at once with the remainder */
+	if (vk + 1 + kr <= 32)
+	{
+		const UINT64 prefix = ((1ULL << vk) - 1) << 1;
+		rfx_rlgr_writer_put(w, (UINT32)((prefix << kr) | remainder), vk + 1 + kr);
+	}
+	else
 	{
-		OutputBits(kr, val & ((1 << kr) - 1));
+		rfx_rlgr_writer_fill(w, vk, TRUE);
+		rfx_rlgr_writer_put(w, remainder, 1 + kr);
 	}
 
 	/* update krp, only if it is not equal to 1 */
@@ -613,13 +671,11 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 	int k;
 	int kp;
 	int krp;
-	RFX_BITSTREAM* bs;
-	int processed_size;
+	RFX_RLGR_WRITER* w;
+	RFX_RLGR_WRITER s_w;
 
-	if (!(bs = (RFX_BITSTREAM*)calloc(1, sizeof(RFX_BITSTREAM))))
-		return 0;
-
-	rfx_bitstream_attach(bs, buffer, buffer_size);
+	w = &s_w;
+	rfx_rlgr_writer_init(w, buffer, buffer_size);
 
 	/* initialize the parameters */
 	k = 1;
@@ -633,37 +689,44 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 
 		if (k)
 		{
-			int numZeros;
-			int runmax;
+			UINT32 numZeros;
+			UINT32 zeroBits;
+			UINT32 runmax;
 			int mag;
 			int sign;
 
 			/* RUN-LENGTH MODE */
 
 			/* collect the run of zeros in the input stream */
-			numZeros = 0;
-			GetNextInput(input);
-			while (input == 0 && data_size > 0)
+			numZeros = rfx_rlgr_zero_run(data, data_size);
+			data += numZeros;
+			data_size -= numZeros;
+
+			/* a trailing zero belongs to the run, the value coded after it is discarded */
+			input = 0;
+
+			if (data_size > 0)
 			{
-				numZeros++;
-				GetNextInput(input);
+				input = *data++;
+				data_size--;
 			}
 
-			// emit output zeros
+			/* emit a zero bit for each full run */
+			zeroBits = 0;
 			runmax = 1 << k;
+
 			while (numZeros >= runmax)
 			{
-				OutputBit(1, 0); /* output a zero bit */
+				zeroBits++;
 				numZeros -= runmax;
 				UpdateParam(kp, UP_GR, k); /* update kp, k */
 				runmax = 1 << k;
 			}
 
-			/* output a 1 to terminate runs */
-			OutputBit(1, 1);
+			rfx_rlgr_writer_fill(w, zeroBits, FALSE);
 
-			/* output the remaining run length using k bits */
-			OutputBits(k, numZeros);
+			/* output a 1 to terminate runs and the remaining run length using k bits */
+			rfx_rlgr_writer_put(w, runmax | numZeros, k + 1);
 
 			/* note: when we reach here and the last byte being encoded is 0, we still
 			   need to output the last two bits, otherwise mstsc will crash */
@@ -672,8 +735,8 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 			mag = (input < 0 ? -input : input); /* absolute value of input coefficient */
 			sign = (input < 0 ? 1 : 0);         /* sign of input coefficient */
 
-			OutputBit(1, sign);              /* output the sign bit */
-			CodeGR(&krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
+			rfx_rlgr_writer_put(w, sign, 1);                /* output the sign bit */
+			rfx_rlgr_code_gr(w, &krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
 
 			UpdateParam(kp, -DN_GR, k);
 		}
@@ -688,9 +751,10 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 				/* RLGR1 variant */
 
 				/* convert input to (2*magnitude - sign), encode using GR code */
-				GetNextInput(input);
+				input = *data++;
+				data_size--;
 				twoMs = Get2MagSign(input);
-				CodeGR(&krp, twoMs);
+				rfx_rlgr_code_gr(w, &krp, twoMs);
 
 				/* update k, kp */
 				/* NOTE: as of Aug 2011, the algorithm is still wrongly documented
@@ -707,26 +771,33 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 			else /* mode == RLGR3 */
 			{
 				UINT32 twoMs1;
-				UINT32 twoMs2;
+				UINT32 twoMs2 = 0;
 				UINT32 sum2Ms;
 				UINT32 nIdx;
 
 				/* RLGR3 variant */
 
 				/* convert the next two input values to (2*magnitude - sign) and */
-				/* encode their sum using GR code */
+				/* encode their sum using GR code, a missing second value is zero */
 
-				GetNextInput(input);
+				input = *data++;
+				data_size--;
 				twoMs1 = Get2MagSign(input);
-				GetNextInput(input);
-				twoMs2 = Get2MagSign(input);
+
+				if (data_size > 0)
+				{
+					input = *data++;
+					data_size--;
+					twoMs2 = Get2MagSign(input);
+				}
+
 				sum2Ms = twoMs1 + twoMs2;
 
-				CodeGR(&krp, sum2Ms);
+				rfx_rlgr_code_gr(w, &krp, sum2Ms);
 
 				/* encode binary representation of the first input (twoMs1). */
 				GetMinBits(sum2Ms, nIdx);
-				OutputBits(nIdx, twoMs1);
+				rfx_rlgr_writer_put(w, twoMs1 & 0xFFFF, nIdx);
 
 				/* update k,kp for the two input values */
 
@@ -742,9 +813,5 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 		}
 	}
 
-	rfx_bitstream_flush(bs);
-	processed_size = rfx_bitstream_get_processed_bytes(bs);
-	free(bs);
-
-	return processed_size;
+	return (int)rfx_rlgr_writer_flush(w);
 }
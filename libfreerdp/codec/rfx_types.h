@@ -61,6 +61,14 @@ struct _RFX_CONTEXT_PRIV
 
 	wBufferPool* BufferPool;
 
+	/* content hashes of the last encoded tiles, 0 if unknown */
+	BOOL TileHashing;
+	UINT64* TileHashes;
+	UINT32 TileHashesX;
+	UINT32 TileHashesY;
+	UINT64 TilesHashed;
+	UINT64 TilesSkipped;
+
 	/* profilers */
 	PROFILER_DEFINE(prof_rfx_decode_rgb)
 	PROFILER_DEFINE(prof_rfx_decode_component)
@@ -78,6 +86,7 @@ struct _RFX_CONTEXT_PRIV
 	PROFILER_DEFINE(prof_rfx_dwt_2d_encode)
 	PROFILER_DEFINE(prof_rfx_rgb_to_ycbcr)
 	PROFILER_DEFINE(prof_rfx_encode_format_rgb)
+	PROFILER_DEFINE(prof_rfx_tile_hash)
 };
 
 #endif /* FREERDP_LIB_CODEC_RFX_TYPES_H */
@@ -1,5 +1,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/codec/clear.h>
 
@@ -67,6 +68,228 @@ fail:
 	return rc;
 }
 
+static UINT32 test_rand(UINT32* state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 16;
+}
+
+/* Office like desktop: flat background, a window with a gradient title bar,
+ * lines of glyph like text and a noisy picture. */
+static void test_fill_desktop(BYTE* pData, UINT32 nStep, UINT32 nWidth, UINT32 nHeight,
+                              UINT32 scroll, UINT32* state)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		BYTE* pDst = &pData[y * nStep];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			BYTE r = 0x3A, g = 0x6E, b = 0xA5;
+
+			if ((x >= 32) && (x < nWidth - 32) && (y >= 24) && (y < nHeight - 24))
+			{
+				const UINT32 ty = y + scroll;
+				r = g = b = 0xFF;
+
+				if (y < 48)
+				{
+					r = (BYTE)(x * 255 / nWidth);
+					g = 0x40;
+					b = 0xC0;
+				}
+				else if ((x > nWidth / 2 + 64) && (y > nHeight / 2))
+				{
+					r = (BYTE)test_rand(state);
+					g = (BYTE)(x + y);
+					b = (BYTE)(r ^ g);
+				}
+				else if (((ty % 20) >= 4) && ((ty % 20) < 16))
+				{
+					/* 8 pixel wide glyphs chosen by column and line, anti aliased edges */
+					const UINT32 glyph = ((x / 8) * 7 + (ty / 20) * 3) % 23;
+					const UINT32 bit = ((glyph * 0x9E3779B1UL) >> ((x % 8) + (ty % 20))) & 1;
+
+					if (bit && (glyph % 5))
+						r = g = b = ((x % 8) == 0) ? 0x80 : 0x00;
+				}
+			}
+
+			pDst[x * 4 + 0] = b;
+			pDst[x * 4 + 1] = g;
+			pDst[x * 4 + 2] = r;
+			pDst[x * 4 + 3] = 0xFF;
+		}
+	}
+}
+
+static BOOL test_ClearCompare(const BYTE* pSrc, const BYTE* pDst, UINT32 nStep, UINT32 nWidth,
+                              UINT32 nHeight)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		for (x = 0; x < nWidth; x++)
+		{
+			const BYTE* a = &pSrc[y * nStep + x * 4];
+			const BYTE* b = &pDst[y * nStep + x * 4];
+
+			if ((a[0] != b[0]) || (a[1] != b[1]) || (a[2] != b[2]))
+			{
+				printf("clear mismatch at %" PRIu32 "x%" PRIu32 "\n", x, y);
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_ClearRoundTrip(CLEAR_CONTEXT* encoder, CLEAR_CONTEXT* decoder,
+                                const BYTE* pSrcData, BYTE* pDstData, UINT32 nStep,
+                                UINT32 nWidth, UINT32 nHeight, UINT32* pDstSize,
+                                UINT64* pCompressTime, UINT64* pDecompressTime)
+{
+	int status;
+	UINT64 start;
+	BYTE* pData = NULL;
+	start = GetTickCount64();
+	status = clear_compress(encoder, pSrcData, nStep * nHeight, PIXEL_FORMAT_BGRX32, nWidth,
+	                        nHeight, nStep, &pData, pDstSize);
+	*pCompressTime += GetTickCount64() - start;
+
+	if (status < 0)
+	{
+		printf("clear_compress failure: %d\n", status);
+		return FALSE;
+	}
+
+	memset(pDstData, 0, nStep * nHeight);
+	start = GetTickCount64();
+	status = clear_decompress(decoder, pData, *pDstSize, nWidth, nHeight, pDstData,
+	                          PIXEL_FORMAT_BGRX32, nStep, 0, 0, nWidth, nHeight, NULL);
+	*pDecompressTime += GetTickCount64() - start;
+
+	if (status < 0)
+	{
+		printf("clear_decompress failure: %d\n", status);
+		return FALSE;
+	}
+
+	return test_ClearCompare(pSrcData, pDstData, nStep, nWidth, nHeight);
+}
+
+static BOOL test_ClearCompressGlyph(void)
+{
+	BOOL rc = FALSE;
+	UINT32 x, y;
+	UINT32 DstSize = 0;
+	UINT64 compressTime = 0;
+	UINT64 decompressTime = 0;
+	const UINT32 nWidth = 9;
+	const UINT32 nHeight = 15;
+	const UINT32 nStep = nWidth * 4;
+	BYTE pSrcData[9 * 15 * 4];
+	BYTE pDstData[9 * 15 * 4];
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!encoder || !decoder)
+		goto fail;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		for (x = 0; x < nWidth; x++)
+		{
+			const BYTE v = (((x + y) % 4) == 0) ? 0x00 : 0xFF;
+			pSrcData[y * nStep + x * 4 + 0] = v;
+			pSrcData[y * nStep + x * 4 + 1] = v;
+			pSrcData[y * nStep + x * 4 + 2] = (BYTE)(v ^ (x * 16));
+			pSrcData[y * nStep + x * 4 + 3] = 0xFF;
+		}
+	}
+
+	if (!test_ClearRoundTrip(encoder, decoder, pSrcData, pDstData, nStep, nWidth, nHeight,
+	                         &DstSize, &compressTime, &decompressTime))
+		goto fail;
+
+	/* the same glyph again is a glyph cache hit */
+	if (!test_ClearRoundTrip(encoder, decoder, pSrcData, pDstData, nStep, nWidth, nHeight,
+	                         &DstSize, &compressTime, &decompressTime))
+		goto fail;
+
+	if (DstSize != 4)
+	{
+		printf("clear glyph cache hit size %" PRIu32 " [4 expected]\n", DstSize);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	return rc;
+}
+
+static BOOL test_ClearCompressDesktop(UINT32 nWidth, UINT32 nHeight)
+{
+	BOOL rc = FALSE;
+	UINT32 frame;
+	UINT32 state = 0x5EED;
+	UINT64 totalIn = 0;
+	UINT64 totalOut = 0;
+	UINT64 compressTime = 0;
+	UINT64 decompressTime = 0;
+	const UINT32 nStep = nWidth * 4;
+	const UINT32 frames = 8;
+	BYTE* pSrcData = (BYTE*)malloc(nStep * nHeight);
+	BYTE* pDstData = (BYTE*)malloc(nStep * nHeight);
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!pSrcData || !pDstData || !encoder || !decoder)
+		goto fail;
+
+	/* scrolling text reuses the vBar caches of the previous frames */
+	for (frame = 0; frame < frames; frame++)
+	{
+		UINT32 DstSize = 0;
+		test_fill_desktop(pSrcData, nStep, nWidth, nHeight, frame * 20, &state);
+
+		if (!test_ClearRoundTrip(encoder, decoder, pSrcData, pDstData, nStep, nWidth, nHeight,
+		                         &DstSize, &compressTime, &decompressTime))
+		{
+			printf("clear desktop %" PRIu32 "x%" PRIu32 " frame %" PRIu32 " failed\n", nWidth,
+			       nHeight, frame);
+			goto fail;
+		}
+
+		if (frame == 0)
+			printf("clear desktop %" PRIu32 "x%" PRIu32 " first frame: %" PRIu32
+			       " -> %" PRIu32 " bytes\n",
+			       nWidth, nHeight, nWidth * nHeight * 3, DstSize);
+
+		totalIn += nWidth * nHeight * 3;
+		totalOut += DstSize;
+	}
+
+	printf("clear desktop %" PRIu32 "x%" PRIu32 ": %" PRIu64 " -> %" PRIu64
+	       " bytes, ratio %.2f%%, compress %.1f MPixel/s, decompress %.1f MPixel/s\n",
+	       nWidth, nHeight, totalIn, totalOut, 100.0 * totalOut / totalIn,
+	       frames * nWidth * nHeight / 1000000.0 / (MAX(compressTime, 1) / 1000.0),
+	       frames * nWidth * nHeight / 1000000.0 / (MAX(decompressTime, 1) / 1000.0));
+	rc = TRUE;
+fail:
+	free(pSrcData);
+	free(pDstData);
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	return rc;
+}
+
 int TestFreeRDPCodecClear(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -86,5 +309,14 @@ int TestFreeRDPCodecClear(int argc, char* argv[])
 	if (!test_ClearDecompressExample(4, 7, 15, TEST_CLEAR_EXAMPLE_4, sizeof(TEST_CLEAR_EXAMPLE_4)))
 		return -1;
 
+	if (!test_ClearCompressGlyph())
+		return -1;
+
+	if (!test_ClearCompressDesktop(77, 53))
+		return -1;
+
+	if (!test_ClearCompressDesktop(1024, 768))
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,164 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/h264.h>
+
+#define TEST_WIDTH 64
+#define TEST_HEIGHT 64
+#define TEST_STEP (TEST_WIDTH * 4)
+#define TEST_QP 10
+
+/* Smooth content, chroma subsampling and a low quantizer keep the error small */
+static void test_h264_fill(BYTE* data, BYTE shift)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < TEST_HEIGHT; y++)
+	{
+		for (x = 0; x < TEST_WIDTH; x++)
+		{
+			BYTE* pixel = &data[y * TEST_STEP + x * 4];
+			WriteColor(pixel, PIXEL_FORMAT_BGRX32,
+			           FreeRDPGetColor(PIXEL_FORMAT_BGRX32, (BYTE)(x * 3 + shift), (BYTE)(y * 3),
+			                           0x80, 0xFF));
+		}
+	}
+}
+
+/* A single macroblock changes, everything else is flagged constant by the encoder */
+static void test_h264_change_block(BYTE* data)
+{
+	UINT32 x, y;
+
+	for (y = 16; y < 32; y++)
+	{
+		for (x = 32; x < 48; x++)
+			WriteColor(&data[y * TEST_STEP + x * 4], PIXEL_FORMAT_BGRX32,
+			           FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0x20, 0xE0, 0x20, 0xFF));
+	}
+}
+
+static BOOL test_h264_compare(const BYTE* expected, const BYTE* actual, const char* what)
+{
+	size_t x;
+	UINT64 error = 0;
+
+	for (x = 0; x < TEST_STEP * TEST_HEIGHT; x++)
+	{
+		if ((x % 4) == 3)
+			continue;
+
+		error += (UINT64)abs((int)expected[x] - (int)actual[x]);
+	}
+
+	/* average error per color channel */
+	if (error > 3ull * TEST_WIDTH * TEST_HEIGHT * 3)
+	{
+		fprintf(stderr, "%s: decoded frame differs, total error %" PRIu64 "\n", what, error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_h264_frame(H264_CONTEXT* encoder, H264_CONTEXT* decoder, const BYTE* src,
+                            BYTE* dst, UINT32* size, const char* what)
+{
+	BYTE* data = NULL;
+	RECTANGLE_16 rect = { 0, 0, TEST_WIDTH, TEST_HEIGHT };
+
+	if (avc420_compress(encoder, src, PIXEL_FORMAT_BGRX32, TEST_STEP, TEST_WIDTH, TEST_HEIGHT,
+	                    &data, size) < 0)
+	{
+		fprintf(stderr, "%s: encoding failed\n", what);
+		return FALSE;
+	}
+
+	if (avc420_decompress(decoder, data, *size, dst, PIXEL_FORMAT_BGRX32, TEST_STEP, TEST_WIDTH,
+	                      TEST_HEIGHT, &rect, 1) < 0)
+	{
+		fprintf(stderr, "%s: decoding failed\n", what);
+		return FALSE;
+	}
+
+	return test_h264_compare(src, dst, what);
+}
+
+static BOOL test_h264_roundtrip(void)
+{
+	BOOL rc = FALSE;
+	UINT32 keySize = 0;
+	UINT32 changedSize = 0;
+	UINT32 staticSize = 0;
+	BYTE* src = calloc(TEST_STEP, TEST_HEIGHT);
+	BYTE* dst = calloc(TEST_STEP, TEST_HEIGHT);
+	H264_CONTEXT* encoder = h264_context_new(TRUE);
+	H264_CONTEXT* decoder = h264_context_new(FALSE);
+
+	if (!src || !dst || !encoder || !decoder)
+		goto fail;
+
+	if (strcmp(encoder->subsystem->name, "x264") != 0)
+	{
+		fprintf(stderr, "encoder uses %s instead of x264\n", encoder->subsystem->name);
+		goto fail;
+	}
+
+	encoder->RateControlMode = H264_RATECONTROL_CQP;
+	encoder->QP = TEST_QP;
+
+	if (!h264_context_reset(encoder, TEST_WIDTH, TEST_HEIGHT) ||
+	    !h264_context_reset(decoder, TEST_WIDTH, TEST_HEIGHT))
+		goto fail;
+
+	/* The first frame has no reference, it is encoded without macroblock info */
+	test_h264_fill(src, 0);
+
+	if (!test_h264_frame(encoder, decoder, src, dst, &keySize, "key frame"))
+		goto fail;
+
+	/* The unchanged macroblocks of the following frames are passed as constant */
+	test_h264_change_block(src);
+
+	if (!test_h264_frame(encoder, decoder, src, dst, &changedSize, "changed block"))
+		goto fail;
+
+	if (!test_h264_frame(encoder, decoder, src, dst, &staticSize, "static frame"))
+		goto fail;
+
+	if (staticSize >= keySize)
+	{
+		fprintf(stderr, "static frame %" PRIu32 " bytes, key frame %" PRIu32 " bytes\n",
+		        staticSize, keySize);
+		goto fail;
+	}
+
+	/* A full frame change after constant frames must not leave stale blocks behind */
+	test_h264_fill(src, 0x40);
+
+	if (!test_h264_frame(encoder, decoder, src, dst, &changedSize, "full change"))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	h264_context_free(encoder);
+	h264_context_free(decoder);
+	free(src);
+	free(dst);
+	return rc;
+}
+
+int TestFreeRDPCodecH264(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_h264_roundtrip())
+		return -1;
+
+	return 0;
+}
@@ -183,6 +183,265 @@ static BOOL TestColorConversion(void)
 	return TRUE;
 }
 
+/* Synthetic content: desktop like, noise, gradient and sparse noise on a solid background */
+static void fill_test_image(BYTE* data, UINT32 width, UINT32 height, UINT32 step, UINT32 kind)
+{
+	UINT32 x, y;
+	winpr_RAND(data, 1ull * step * height);
+
+	for (y = 0; y < height; y++)
+	{
+		BYTE* line = &data[1ull * y * step];
+
+		for (x = 0; x < width; x++)
+		{
+			UINT32 color;
+			const UINT32 noise = ReadColor(&line[x * 4], PIXEL_FORMAT_BGRX32);
+
+			switch (kind)
+			{
+				case 0:
+					if ((y % 24) < 4)
+						color = 0xFF2060A0; /* title bars */
+					else if (((x / 3) + (y / 5)) % 7 == 0)
+						color = 0xFF000000; /* text strokes */
+					else if ((x > width / 2) && (y > height / 2))
+						color = ((x + y) & 1) ? 0xFFC0C0C0 : 0xFF808080; /* dithered area */
+					else
+						color = 0xFFFFFFFF;
+					break;
+
+				case 1:
+					color = noise;
+					break;
+
+				case 2:
+					color = 0xFF000000 | ((x * 255 / width) << 16) | ((y * 255 / height) << 8);
+					break;
+
+				default:
+					color = ((noise & 0x3F) == 0) ? noise : 0xFF3A6EA5;
+					break;
+			}
+
+			WriteColor(&line[x * 4], PIXEL_FORMAT_BGRX32, color | 0xFF000000);
+		}
+	}
+}
+
+static BOOL compare_colors(const BYTE* src, const BYTE* dst, UINT32 width, UINT32 height,
+                           UINT32 srcStep, UINT32 dstStep, UINT32 bpp)
+{
+	UINT32 x, y;
+	const float maxDiff = 4.0f * ((bpp < 24) ? 2.0f : 1.0f);
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE r, g, b, dr, dg, db;
+			const UINT32 srcColor = ReadColor(&src[y * srcStep + x * 4], PIXEL_FORMAT_BGRX32);
+			const UINT32 dstColor = ReadColor(&dst[y * dstStep + x * 4], PIXEL_FORMAT_BGRX32);
+			SplitColor(srcColor, PIXEL_FORMAT_BGRX32, &r, &g, &b, NULL, NULL);
+			SplitColor(dstColor, PIXEL_FORMAT_BGRX32, &dr, &dg, &db, NULL, NULL);
+
+			if ((fabsf((float)r - dr) > maxDiff) || (fabsf((float)g - dg) > maxDiff) ||
+			    (fabsf((float)b - db) > maxDiff))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Any size must round trip, the stream covers the width padded to a multiple of 4 */
+static BOOL TestInterleavedSizes(BITMAP_INTERLEAVED_CONTEXT* encoder,
+                                 BITMAP_INTERLEAVED_CONTEXT* decoder)
+{
+	const UINT32 sizes[][2] = { { 1, 1 },   { 3, 5 },    { 4, 1 },   { 17, 3 },
+		                        { 64, 64 }, { 61, 17 },  { 100, 70 }, { 257, 130 } };
+	const UINT32 depths[] = { 24, 16, 15 };
+	UINT32 i, j, kind, level;
+	BOOL rc = FALSE;
+	const UINT32 srcStep = 260 * 4;
+	const UINT32 dstSize = 260 * 4 * 130 * 2;
+	BYTE* src = malloc(1ull * srcStep * 130);
+	BYTE* dst = malloc(1ull * srcStep * 130);
+	BYTE* tmp = malloc(dstSize);
+
+	if (!src || !dst || !tmp)
+		goto fail;
+
+	for (kind = 0; kind < 4; kind++)
+	{
+		fill_test_image(src, 260, 130, srcStep, kind);
+
+		for (level = INTERLEAVED_LEVEL_FAST; level <= INTERLEAVED_LEVEL_BEST; level++)
+		{
+			if (!bitmap_interleaved_context_set_level(encoder, level))
+				goto fail;
+
+			for (i = 0; i < ARRAYSIZE(sizes); i++)
+			{
+				for (j = 0; j < ARRAYSIZE(depths); j++)
+				{
+					const UINT32 w = sizes[i][0];
+					const UINT32 h = sizes[i][1];
+					const UINT32 padded = (w + 3) & ~3u;
+					UINT32 size = dstSize;
+
+					if (!interleaved_compress(encoder, tmp, &size, w, h, src, PIXEL_FORMAT_BGRX32,
+					                          srcStep, 0, 0, NULL, depths[j]) ||
+					    !interleaved_decompress(decoder, tmp, size, padded, h, depths[j], dst,
+					                            PIXEL_FORMAT_BGRX32, srcStep, 0, 0, padded, h,
+					                            NULL) ||
+					    !compare_colors(src, dst, w, h, srcStep, srcStep, depths[j]))
+					{
+						printf("%s: %" PRIu32 "x%" PRIu32 " %" PRIu32 "bpp content %" PRIu32
+						       " level %" PRIu32 " failed\n",
+						       __FUNCTION__, w, h, depths[j], kind, level);
+						goto fail;
+					}
+				}
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	bitmap_interleaved_context_set_level(encoder, INTERLEAVED_LEVEL_DEFAULT);
+	free(src);
+	free(dst);
+	free(tmp);
+	return rc;
+}
+
+/* Size of the image in 64x64 tiles with the RLE encoder of freerdp_bitmap_compress */
+static SSIZE_T compressed_size_bitmap(const BYTE* src, UINT32 width, UINT32 height, UINT32 step,
+                                      UINT32 bpp)
+{
+	UINT32 x, y;
+	SSIZE_T total = 0;
+	const UINT32 format = (bpp == 24) ? PIXEL_FORMAT_BGRX32 : PIXEL_FORMAT_RGB16;
+	BYTE* tile = malloc(64 * 64 * 4);
+	wStream* s = Stream_New(NULL, 64 * 64 * 8);
+	wStream* ts = Stream_New(NULL, 64 * 64 * 4);
+
+	if (!tile || !s || !ts)
+		total = -1;
+
+	for (y = 0; (total >= 0) && (y < height); y += 64)
+	{
+		for (x = 0; (total >= 0) && (x < width); x += 64)
+		{
+			Stream_SetPosition(s, 0);
+
+			if (!freerdp_image_copy(tile, format, 0, 0, 0, 64, 64, src, PIXEL_FORMAT_BGRX32, step,
+			                        x, y, NULL, FREERDP_FLIP_NONE) ||
+			    (freerdp_bitmap_compress(tile, 64, 64, s, bpp, 64 * 64 * 4, 63, ts, 0) < 0))
+				total = -1;
+			else
+				total += (SSIZE_T)Stream_GetPosition(s);
+		}
+	}
+
+	free(tile);
+	Stream_Free(s, TRUE);
+	Stream_Free(ts, TRUE);
+	return total;
+}
+
+static SSIZE_T compressed_size_interleaved(BITMAP_INTERLEAVED_CONTEXT* encoder, const BYTE* src,
+                                           UINT32 width, UINT32 height, UINT32 step, UINT32 bpp)
+{
+	UINT32 x, y;
+	SSIZE_T total = 0;
+	BYTE* tile = malloc(64 * 64 * 8);
+
+	if (!tile)
+		return -1;
+
+	for (y = 0; (total >= 0) && (y < height); y += 64)
+	{
+		for (x = 0; (total >= 0) && (x < width); x += 64)
+		{
+			UINT32 size = 64 * 64 * 8;
+
+			if (!interleaved_compress(encoder, tile, &size, 64, 64, src, PIXEL_FORMAT_BGRX32, step,
+			                          x, y, NULL, bpp))
+				total = -1;
+			else
+				total += size;
+		}
+	}
+
+	free(tile);
+	return total;
+}
+
+/**
+ * Compares the output size against the previous RLE encoder, which is still
+ * available as freerdp_bitmap_compress. The cost model search must never lose
+ * and has to win clearly on desktop like content.
+ */
+static BOOL TestInterleavedRatio(BITMAP_INTERLEAVED_CONTEXT* encoder)
+{
+	const char* names[] = { "desktop", "noise", "gradient", "sparse" };
+	const UINT32 depths[] = { 24, 16 };
+	const UINT32 width = 256;
+	const UINT32 height = 256;
+	const UINT32 step = width * 4;
+	UINT32 j, kind, level;
+	BOOL rc = FALSE;
+	BYTE* src = malloc(1ull * step * height);
+
+	if (!src)
+		return FALSE;
+
+	for (kind = 0; kind < ARRAYSIZE(names); kind++)
+	{
+		fill_test_image(src, width, height, step, kind);
+
+		for (j = 0; j < ARRAYSIZE(depths); j++)
+		{
+			SSIZE_T sizes[3];
+			const SSIZE_T raw = 1ll * width * height * ((depths[j] + 7) / 8);
+			const SSIZE_T old = compressed_size_bitmap(src, width, height, step, depths[j]);
+
+			for (level = INTERLEAVED_LEVEL_FAST; level <= INTERLEAVED_LEVEL_BEST; level++)
+			{
+				if (!bitmap_interleaved_context_set_level(encoder, level))
+					goto fail;
+
+				sizes[level] =
+				    compressed_size_interleaved(encoder, src, width, height, step, depths[j]);
+
+				if (sizes[level] <= 0)
+					goto fail;
+			}
+
+			printf("%-8s %2" PRIu32 "bpp: ratio previous %6.2f fast %6.2f default %6.2f best "
+			       "%6.2f\n",
+			       names[kind], depths[j], (double)raw / (double)old,
+			       (double)raw / (double)sizes[0], (double)raw / (double)sizes[1],
+			       (double)raw / (double)sizes[2]);
+
+			if ((old <= 0) || (sizes[INTERLEAVED_LEVEL_DEFAULT] > old) ||
+			    (sizes[INTERLEAVED_LEVEL_BEST] > sizes[INTERLEAVED_LEVEL_DEFAULT]))
+				goto fail;
+
+			if ((kind == 0) && (sizes[INTERLEAVED_LEVEL_DEFAULT] * 4 > old * 3))
+				goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	bitmap_interleaved_context_set_level(encoder, INTERLEAVED_LEVEL_DEFAULT);
+	free(src);
+	return rc;
+}
+
 int TestFreeRDPCodecInterleaved(int argc, char* argv[])
 {
 	BITMAP_INTERLEAVED_CONTEXT *encoder, *decoder;
@@ -207,6 +466,12 @@ int TestFreeRDPCodecInterleaved(int argc, char* argv[])
 	if (!TestColorConversion())
 		goto fail;
 
+	if (!TestInterleavedSizes(encoder, decoder))
+		goto fail;
+
+	if (!TestInterleavedRatio(encoder))
+		goto fail;
+
 	rc = 0;
 fail:
 	bitmap_interleaved_context_free(encoder);
@@ -0,0 +1,296 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/crypto.h>
+#include <winpr/stream.h>
+
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/nsc.h>
+
+#include "../nsc_types.h"
+#include "../nsc_decode.h"
+
+/* Writes a NSC bitmap stream with uncompressed planes of random content */
+static wStream* test_nsc_random_stream(UINT32 width, UINT32 height, BYTE colorLoss,
+                                       BYTE subsampling)
+{
+	size_t i;
+	UINT32 sizes[4];
+	wStream* s;
+	const UINT32 tempWidth = ROUND_UP_TO(width, 8);
+	const UINT32 tempHeight = ROUND_UP_TO(height, 2);
+
+	for (i = 0; i < 4; i++)
+		sizes[i] = width * height;
+
+	if (subsampling)
+	{
+		sizes[0] = tempWidth * height;
+		sizes[1] = (tempWidth >> 1) * (tempHeight >> 1);
+		sizes[2] = sizes[1];
+	}
+
+	s = Stream_New(NULL, 20 + sizes[0] + sizes[1] + sizes[2] + sizes[3]);
+
+	if (!s)
+		return NULL;
+
+	for (i = 0; i < 4; i++)
+		Stream_Write_UINT32(s, sizes[i]);
+
+	Stream_Write_UINT8(s, colorLoss);
+	Stream_Write_UINT8(s, subsampling);
+	Stream_Write_UINT16(s, 0);
+
+	for (i = 0; i < 4; i++)
+	{
+		winpr_RAND(Stream_Pointer(s), sizes[i]);
+		Stream_Seek(s, sizes[i]);
+	}
+
+	Stream_SealLength(s);
+	return s;
+}
+
+/* Decodes with the installed (optimized) decoder and compares against nsc_decode */
+static BOOL test_nsc_decode_compare(NSC_CONTEXT* context, UINT32 width, UINT32 height,
+                                    BYTE colorLoss, BYTE subsampling)
+{
+	BOOL rc = FALSE;
+	const UINT32 size = width * height * 4;
+	BYTE* dst = malloc(size);
+	BYTE* optimized = malloc(size);
+	wStream* s = test_nsc_random_stream(width, height, colorLoss, subsampling);
+
+	if (!dst || !optimized || !s)
+		goto fail;
+
+	if (!nsc_process_message(context, 32, width, height, Stream_Buffer(s), Stream_Length(s), dst,
+	                         PIXEL_FORMAT_BGRA32, 0, 0, 0, width, height, FREERDP_FLIP_NONE))
+		goto fail;
+
+	memcpy(optimized, context->BitmapData, size);
+
+	if (!nsc_decode(context))
+		goto fail;
+
+	if (memcmp(optimized, context->BitmapData, size) != 0)
+	{
+		fprintf(stderr, "NSC decode mismatch %" PRIu32 "x%" PRIu32 " colorloss %" PRIu8
+		                " subsampling %" PRIu8 "\n",
+		        width, height, colorLoss, subsampling);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	Stream_Free(s, TRUE);
+	free(dst);
+	free(optimized);
+	return rc;
+}
+
+static BOOL test_nsc_decode(void)
+{
+	size_t i;
+	size_t j;
+	BOOL rc = FALSE;
+	BYTE colorLoss;
+	BYTE subsampling;
+	const UINT32 widths[] = { 1, 2, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 100, 129 };
+	const UINT32 heights[] = { 1, 2, 3, 17 };
+	NSC_CONTEXT* context = nsc_context_new();
+
+	if (!context)
+		return FALSE;
+
+	printf("NSC decoder %s, RLE decoder %s\n",
+	       (context->decode == nsc_decode) ? "generic" : "optimized",
+	       (context->rle_decode == nsc_rle_decode) ? "generic" : "optimized");
+
+	for (subsampling = 0; subsampling < 2; subsampling++)
+	{
+		for (colorLoss = 1; colorLoss <= 7; colorLoss++)
+		{
+			for (i = 0; i < ARRAYSIZE(widths); i++)
+			{
+				for (j = 0; j < ARRAYSIZE(heights); j++)
+				{
+					if (!test_nsc_decode_compare(context, widths[i], heights[j], colorLoss,
+					                             subsampling))
+						goto fail;
+				}
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	nsc_context_free(context);
+	return rc;
+}
+
+/* Reference RLE encoder following [MS-RDPNSC] 2.2.2.1, the last 4 bytes are stored raw */
+static UINT32 test_nsc_rle_encode(const BYTE* in, UINT32 size, BYTE* out)
+{
+	UINT32 i = 0;
+	BYTE* start = out;
+
+	while (size - i > 4)
+	{
+		UINT32 len = 1;
+
+		if (size - i > 5)
+		{
+			while ((i + len < size - 4) && (in[i + len] == in[i]))
+				len++;
+		}
+
+		*out++ = in[i];
+
+		if (len > 1)
+		{
+			*out++ = in[i];
+
+			if (len - 2 < 0xFF)
+				*out++ = (BYTE)(len - 2);
+			else
+			{
+				*out++ = 0xFF;
+				Data_Write_UINT32(out, len);
+				out += 4;
+			}
+		}
+
+		i += len;
+	}
+
+	memcpy(out, &in[i], 4);
+	return (UINT32)(out - start) + 4;
+}
+
+/* Random plane data with a mix of literal stretches and short, long and huge runs */
+static void test_nsc_rle_fill(BYTE* data, UINT32 size)
+{
+	UINT32 i = 0;
+	winpr_RAND(data, size);
+
+	while (i < size)
+	{
+		UINT32 r;
+		UINT32 len;
+		winpr_RAND((BYTE*)&r, sizeof(r));
+		len = (r >> 8) % ((r & 0x10) ? 600 : 40);
+
+		if (len > size - i)
+			len = size - i;
+
+		if (r & 1)
+			memset(&data[i], data[i], len);
+
+		i += len;
+	}
+}
+
+static BOOL test_nsc_rle_decode(void)
+{
+	size_t i;
+	BOOL rc = FALSE;
+	const UINT32 sizes[] = { 4, 5, 6, 7, 16, 21, 22, 37, 64, 1000, 4096, 65536 };
+	const UINT32 maxSize = 65536;
+	BYTE* plane = malloc(maxSize);
+	BYTE* encoded = malloc(maxSize * 2);
+	BYTE* generic = NULL;
+	BYTE* optimized = NULL;
+	NSC_CONTEXT* context = nsc_context_new();
+
+	if (!plane || !encoded || !context)
+		goto fail;
+
+	for (i = 0; i < ARRAYSIZE(sizes) * 8; i++)
+	{
+		const UINT32 size = sizes[i / 8];
+		UINT32 encodedSize;
+
+		/* exactly sized, so overruns are caught by memory checkers */
+		free(generic);
+		free(optimized);
+		generic = malloc(size);
+		optimized = malloc(size);
+
+		if (!generic || !optimized)
+			goto fail;
+
+		if (i % 8 == 0)
+			winpr_RAND(plane, size);
+		else if (i % 8 == 1)
+			memset(plane, 0x42, size);
+		else
+			test_nsc_rle_fill(plane, size);
+
+		encodedSize = test_nsc_rle_encode(plane, size, encoded);
+
+		if (!nsc_rle_decode(encoded, encodedSize, generic, size, size) ||
+		    !context->rle_decode(encoded, encodedSize, optimized, size, size))
+		{
+			fprintf(stderr, "NSC RLE decode of %" PRIu32 " bytes failed\n", size);
+			goto fail;
+		}
+
+		if ((memcmp(plane, generic, size) != 0) || (memcmp(plane, optimized, size) != 0))
+		{
+			fprintf(stderr, "NSC RLE decode mismatch for %" PRIu32 " bytes\n", size);
+			goto fail;
+		}
+
+		/* Truncated input must be rejected, not read past its end */
+		if (nsc_rle_decode(encoded, encodedSize - 1, generic, size, size) ||
+		    context->rle_decode(encoded, encodedSize - 1, optimized, size, size))
+		{
+			fprintf(stderr, "NSC RLE decode accepted truncated input\n");
+			goto fail;
+		}
+	}
+
+	/* A run cut off after the value and repeat bytes, the length byte is missing */
+	free(encoded);
+
+	if (!(encoded = malloc(2)))
+		goto fail;
+
+	encoded[0] = 0x42;
+	encoded[1] = 0x42;
+
+	if (nsc_rle_decode(encoded, 2, generic, 16, 16) ||
+	    context->rle_decode(encoded, 2, optimized, 16, 16))
+	{
+		fprintf(stderr, "NSC RLE decode accepted a run without length\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	nsc_context_free(context);
+	free(plane);
+	free(encoded);
+	free(generic);
+	free(optimized);
+	return rc;
+}
+
+int TestFreeRDPCodecNsc(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_nsc_rle_decode())
+		return -1;
+
+	if (!test_nsc_decode())
+		return -1;
+
+	return 0;
+}
@@ -3,12 +3,15 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/crypto.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/codec/planar.h>
 
+#include "../planar.h"
+
 /**
  * Experimental Case 01: 64x64 (32bpp)
  */
@@ -5650,9 +5653,191 @@ fail:
 	return rc;
 }
 
+/* Fills a BGRX32 image with noise interrupted by solid runs, exercising both RLE branches */
+static void FillPlanarTestImage(BYTE* data, UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+	winpr_RAND(data, width * height * 4);
+
+	for (y = 0; y < height; y++)
+	{
+		UINT32* line = (UINT32*)&data[y * width * 4];
+
+		for (x = 0; x < width; x++)
+		{
+			if (((x / 37) + (y / 11)) % 3 == 0)
+				line[x] = 0xFF336699;
+			else if ((y % 7) == 0)
+				line[x] = line[0];
+		}
+	}
+}
+
+/* Compares the optimized encoder routines installed in the context with the generic ones */
+static BOOL TestPlanarKernels(void)
+{
+	UINT32 f, width, match;
+	BOOL rc = FALSE;
+	const UINT32 maxWidth = 259;
+	BITMAP_PLANAR_CONTEXT* planar = freerdp_bitmap_planar_context_new(0, 64, 64);
+	BYTE* src = (BYTE*)malloc(maxWidth * 4);
+	BYTE* prev = (BYTE*)malloc(maxWidth);
+	BYTE* planes = (BYTE*)malloc(maxWidth * 8);
+	BYTE* deltas = (BYTE*)malloc(maxWidth * 2);
+
+	printf("%s: ", __FUNCTION__);
+
+	if (!planar || !src || !prev || !planes || !deltas)
+		goto fail;
+
+	for (width = 1; width <= maxWidth; width++)
+	{
+		for (f = 0; f < colorFormatCount; f++)
+		{
+			UINT32 i;
+			BYTE* a[4];
+			BYTE* b[4];
+			const UINT32 format = colorFormatList[f];
+
+			if (GetBytesPerPixel(format) != 4)
+				continue;
+
+			for (i = 0; i < 4; i++)
+			{
+				a[i] = &planes[i * maxWidth];
+				b[i] = &planes[(4 + i) * maxWidth];
+			}
+
+			winpr_RAND(src, width * 4);
+			planar->split_color_row(src, format, width, a);
+			planar_split_color_row(src, format, width, b);
+
+			for (i = 0; i < 4; i++)
+			{
+				if (memcmp(a[i], b[i], width) != 0)
+				{
+					printf("split_color_row [%s] width %" PRIu32 " plane %" PRIu32 " mismatch",
+					       FreeRDPGetColorFormatName(format), width, i);
+					goto fail;
+				}
+			}
+		}
+
+		winpr_RAND(prev, width);
+		planar->delta_encode_row(src, prev, deltas, width);
+		planar_delta_encode_row(src, prev, &deltas[maxWidth], width);
+
+		if (memcmp(deltas, &deltas[maxWidth], width) != 0)
+		{
+			printf("delta_encode_row width %" PRIu32 " mismatch", width);
+			goto fail;
+		}
+
+		/* Long runs with a few breaks, the first byte is the previous symbol */
+		memset(src, 0x42, width + 1);
+		src[1 + (width * 3) / 4] = 0x17;
+
+		for (match = 0; match < 2; match++)
+		{
+			const UINT32 offset = match ? 1 : (width * 3) / 4;
+			const UINT32 size = width - offset + 1;
+			const UINT32 expected = planar_rle_scan_bytes(&src[offset], size, match);
+
+			if (planar->rle_scan_bytes(&src[offset], size, match) != expected)
+			{
+				printf("rle_scan_bytes width %" PRIu32 " match %" PRIu32 " mismatch", width,
+				       match);
+				goto fail;
+			}
+		}
+
+		winpr_RAND(src, width + 1);
+
+		for (match = 0; match < 2; match++)
+		{
+			if (planar->rle_scan_bytes(&src[1], width, match) !=
+			    planar_rle_scan_bytes(&src[1], width, match))
+			{
+				printf("rle_scan_bytes random width %" PRIu32 " mismatch", width);
+				goto fail;
+			}
+		}
+	}
+
+	printf("SUCCESS");
+	rc = TRUE;
+fail:
+	printf("\n");
+	free(src);
+	free(prev);
+	free(planes);
+	free(deltas);
+	freerdp_bitmap_planar_context_free(planar);
+	return rc;
+}
+
+/* The banded multithreaded encoder must produce the same stream as the serial one */
+static BOOL TestPlanarThreaded(DWORD flags, UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	UINT32 serialSize = 0;
+	UINT32 threadedSize = 0;
+	BYTE* serialData = NULL;
+	BYTE* threadedData = NULL;
+	BITMAP_PLANAR_CONTEXT* serial = freerdp_bitmap_planar_context_new(flags, width, height);
+	BITMAP_PLANAR_CONTEXT* threaded = freerdp_bitmap_planar_context_new(flags, width, height);
+	BYTE* image = (BYTE*)malloc(width * height * 4);
+	BYTE* decoded = (BYTE*)malloc(width * height * 4);
+
+	printf("%s: flags 0x%08" PRIx32 " %" PRIu32 "x%" PRIu32 ": ", __FUNCTION__, flags, width,
+	       height);
+
+	if (!serial || !threaded || !image || !decoded)
+		goto fail;
+
+	if (!freerdp_bitmap_planar_context_set_threading(threaded, TRUE))
+		goto fail;
+
+	FillPlanarTestImage(image, width, height);
+	serialData = freerdp_bitmap_compress_planar(serial, image, PIXEL_FORMAT_BGRX32, width, height,
+	                                            0, NULL, &serialSize);
+	threadedData = freerdp_bitmap_compress_planar(threaded, image, PIXEL_FORMAT_BGRX32, width,
+	                                              height, 0, NULL, &threadedSize);
+
+	if (!serialData || !threadedData)
+		goto fail;
+
+	if ((serialSize != threadedSize) || (memcmp(serialData, threadedData, serialSize) != 0))
+	{
+		printf("output mismatch (%" PRIu32 " vs %" PRIu32 " bytes)", serialSize, threadedSize);
+		goto fail;
+	}
+
+	/* The encoder stores the planes bottom up */
+	if (!planar_decompress(threaded, threadedData, threadedSize, width, height, decoded,
+	                       PIXEL_FORMAT_BGRX32, 0, 0, 0, width, height, TRUE))
+		goto fail;
+
+	if (!CompareBitmap(decoded, PIXEL_FORMAT_BGRX32, image, PIXEL_FORMAT_BGRX32, width, height))
+		goto fail;
+
+	printf("SUCCESS");
+	rc = TRUE;
+fail:
+	printf("\n");
+	free(serialData);
+	free(threadedData);
+	free(image);
+	free(decoded);
+	freerdp_bitmap_planar_context_free(serial);
+	freerdp_bitmap_planar_context_free(threaded);
+	return rc;
+}
+
 int TestFreeRDPCodecPlanar(int argc, char* argv[])
 {
 	UINT32 x;
+	const DWORD rle = PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE;
 	WINPR_UNUSED(argc);
 	WINPR_UNUSED(argv);
 
@@ -5662,5 +5847,20 @@ int TestFreeRDPCodecPlanar(int argc, char* argv[])
 			return -1;
 	}
 
+	if (!TestPlanarKernels())
+		return -1;
+
+	if (!TestPlanarThreaded(rle, 1024, 768))
+		return -1;
+
+	if (!TestPlanarThreaded(rle, 333, 517))
+		return -1;
+
+	if (!TestPlanarThreaded(PLANAR_FORMAT_HEADER_NA, 640, 480))
+		return -1;
+
+	if (!TestPlanarThreaded(0, 257, 129))
+		return -1;
+
 	return 0;
 }
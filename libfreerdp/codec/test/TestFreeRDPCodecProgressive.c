@@ -1017,6 +1017,307 @@ static int test_progressive_ms_sample(char* ms_sample_path)
 	return 0;
 }
 
+static UINT32 test_rand(UINT32* seed)
+{
+	*seed = (*seed * 1103515245) + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+static void test_progressive_fill_image(BYTE* pData, UINT32 nStep, UINT32 nWidth, UINT32 nHeight,
+                                        UINT32 seed)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		BYTE* pDst = &pData[y * nStep];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			BYTE r = (BYTE)((x * 255) / nWidth);
+			BYTE g = (BYTE)((y * 255) / nHeight);
+			BYTE b = (BYTE)(((x + y) * 2) & 0xFF);
+
+			/* text-like strokes on a flat window background */
+			if ((y % 96) > 48)
+			{
+				r = g = b = 0xF0;
+
+				if (((x / 3) % 7 == 1) && ((y % 16) < 11))
+					r = g = b = 0x20;
+			}
+			else
+			{
+				/* low level noise on the gradient */
+				r = (BYTE)(r ^ (test_rand(&seed) & 0x07));
+			}
+
+			pDst[(x * 4) + 0] = b;
+			pDst[(x * 4) + 1] = g;
+			pDst[(x * 4) + 2] = r;
+			pDst[(x * 4) + 3] = 0xFF;
+		}
+	}
+}
+
+static double test_progressive_mse(const BYTE* pSrc, const BYTE* pDst, UINT32 nStep,
+                                    UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 x, y, c;
+	double sum = 0.0;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		for (x = 0; x < nWidth; x++)
+		{
+			for (c = 0; c < 3; c++)
+			{
+				const double diff =
+				    (double)pSrc[(y * nStep) + (x * 4) + c] - (double)pDst[(y * nStep) + (x * 4) + c];
+				sum += diff * diff;
+			}
+		}
+	}
+
+	return sum / (nWidth * nHeight * 3.0);
+}
+
+static int test_progressive_encode_pass(PROGRESSIVE_CONTEXT* encoder, PROGRESSIVE_CONTEXT* decoder,
+                                        const BYTE* pSrcData, BYTE* pDstData, UINT32 nStep,
+                                        UINT32 nWidth, UINT32 nHeight,
+                                        const REGION16* invalidRegion, UINT32* pDstSize)
+{
+	int status;
+	BYTE* pData = NULL;
+	UINT32 size = 0;
+	status = progressive_compress(encoder, pSrcData, nStep * nHeight, PIXEL_FORMAT_BGRX32, nWidth,
+	                              nHeight, nStep, invalidRegion, 0, &pData, &size);
+	*pDstSize = size;
+
+	if (status <= 0)
+		return status;
+
+	if (progressive_decompress(decoder, pData, size, pDstData, PIXEL_FORMAT_BGRX32, nStep, 0, 0,
+	                           NULL, 0) < 0)
+	{
+		printf("progressive_decompress failure\n");
+		return -1;
+	}
+
+	return status;
+}
+
+static int test_progressive_encode(UINT32 nWidth, UINT32 nHeight)
+{
+	int rc = -1;
+	int status;
+	UINT32 pass = 0;
+	UINT32 size = 0;
+	UINT32 total = 0;
+	double mse = 0.0;
+	double last = 65025.0;
+	BYTE* pSrcData = NULL;
+	BYTE* pDstData = NULL;
+	REGION16 region;
+	RECTANGLE_16 rect;
+	const UINT32 nStep = nWidth * 4;
+	PROGRESSIVE_CONTEXT* encoder = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* decoder = progressive_context_new(FALSE);
+	region16_init(&region);
+
+	if (!encoder || !decoder)
+		goto fail;
+
+	pSrcData = calloc(nHeight, nStep);
+	pDstData = calloc(nHeight, nStep);
+
+	if (!pSrcData || !pDstData)
+		goto fail;
+
+	if (progressive_create_surface_context(decoder, 0, nWidth, nHeight) < 0)
+		goto fail;
+
+	test_progressive_fill_image(pSrcData, nStep, nWidth, nHeight, 0x1234);
+
+	/* first pass followed by upgrade passes until the encoder has nothing left to send */
+	do
+	{
+		status = test_progressive_encode_pass(encoder, decoder, pSrcData, pDstData, nStep, nWidth,
+		                                      nHeight, pass ? &region : NULL, &size);
+
+		if (status < 0)
+			goto fail;
+
+		if (status == 0)
+			break;
+
+		total += size;
+		mse = test_progressive_mse(pSrcData, pDstData, nStep, nWidth, nHeight);
+		printf("pass %" PRIu32 ": %" PRIu32 " bytes MSE %.2f\n", pass + 1, size, mse);
+
+		if (mse > last)
+		{
+			printf("quality decreased after upgrade pass\n");
+			goto fail;
+		}
+
+		last = mse;
+		pass++;
+	} while (pass < 16);
+
+	if ((pass != 4) || (mse > 20.0))
+	{
+		printf("unexpected progression: %" PRIu32 " passes, MSE %.2f\n", pass, mse);
+		goto fail;
+	}
+
+	printf("%" PRIu32 "x%" PRIu32 ": %" PRIu32 " -> %" PRIu32 " bytes (%.2f%%)\n", nWidth, nHeight,
+	       nStep * nHeight, total, (100.0 * total) / (nStep * nHeight));
+
+	/* only tiles touched by the invalid region are sent again */
+	test_progressive_fill_image(pSrcData, nStep, 100, 20, 0x4321);
+	rect.left = 10;
+	rect.top = 10;
+	rect.right = 100;
+	rect.bottom = 20;
+	region16_union_rect(&region, &region, &rect);
+
+	do
+	{
+		status = test_progressive_encode_pass(encoder, decoder, pSrcData, pDstData, nStep, nWidth,
+		                                      nHeight, &region, &size);
+
+		if (status < 0)
+			goto fail;
+
+		region16_clear(&region);
+	} while (status > 0);
+
+	mse = test_progressive_mse(pSrcData, pDstData, nStep, nWidth, nHeight);
+
+	if (mse > 20.0)
+	{
+		printf("update MSE %.2f too high\n", mse);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	region16_uninit(&region);
+	progressive_context_free(encoder);
+	progressive_context_free(decoder);
+	free(pSrcData);
+	free(pDstData);
+	return rc;
+}
+
+static int test_progressive_encode_shrink(void)
+{
+	int rc = -1;
+	int status;
+	UINT32 size = 0;
+	BYTE* pSrcData = NULL;
+	BYTE* pDstData = NULL;
+	REGION16 region;
+	const UINT32 nWidth = 250;
+	const UINT32 nHeight = 190;
+	const UINT32 nStep = nWidth * 4;
+	PROGRESSIVE_CONTEXT* encoder = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* decoder = progressive_context_new(FALSE);
+	region16_init(&region);
+
+	if (!encoder || !decoder)
+		goto fail;
+
+	pSrcData = calloc(nHeight, nStep);
+	pDstData = calloc(nHeight, nStep);
+
+	if (!pSrcData || !pDstData)
+		goto fail;
+
+	if (progressive_create_surface_context(decoder, 0, nWidth, nHeight) < 0)
+		goto fail;
+
+	test_progressive_fill_image(pSrcData, nStep, nWidth, nHeight, 0x2468);
+
+	/* every tile has upgrade passes pending after the first pass */
+	if (test_progressive_encode_pass(encoder, decoder, pSrcData, pDstData, nStep, nWidth, nHeight,
+	                                 NULL, &size) <= 0)
+		goto fail;
+
+	/* the tiles outside of a smaller frame must not be sent */
+	do
+	{
+		status = test_progressive_encode_pass(encoder, decoder, pSrcData, pDstData, nStep, 100, 60,
+		                                      &region, &size);
+
+		if (status < 0)
+		{
+			printf("smaller frame failed\n");
+			goto fail;
+		}
+	} while (status > 0);
+
+	/* and are upgraded once the frame covers them again */
+	status = test_progressive_encode_pass(encoder, decoder, pSrcData, pDstData, nStep, nWidth,
+	                                      nHeight, &region, &size);
+
+	if (status <= 0)
+	{
+		printf("pending upgrade passes were lost\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	region16_uninit(&region);
+	progressive_context_free(encoder);
+	progressive_context_free(decoder);
+	free(pSrcData);
+	free(pDstData);
+	return rc;
+}
+
+static int test_progressive_encode_speed(void)
+{
+	int rc = -1;
+	UINT32 index;
+	UINT32 size = 0;
+	UINT64 start, end;
+	BYTE* pData = NULL;
+	BYTE* pSrcData = NULL;
+	const UINT32 nWidth = 1920;
+	const UINT32 nHeight = 1080;
+	const UINT32 nStep = nWidth * 4;
+	const UINT32 count = 10;
+	PROGRESSIVE_CONTEXT* encoder = progressive_context_new(TRUE);
+	pSrcData = calloc(nHeight, nStep);
+
+	if (!encoder || !pSrcData)
+		goto fail;
+
+	test_progressive_fill_image(pSrcData, nStep, nWidth, nHeight, 0x5678);
+	start = GetTickCount64();
+
+	for (index = 0; index < count; index++)
+	{
+		/* every frame invalidates the whole surface, the first pass is sent each time */
+		if (progressive_compress(encoder, pSrcData, nStep * nHeight, PIXEL_FORMAT_BGRX32, nWidth,
+		                         nHeight, nStep, NULL, 0, &pData, &size) <= 0)
+			goto fail;
+	}
+
+	end = GetTickCount64();
+	printf("progressive_compress: %" PRIu32 " frames in %" PRIu64 " ms, first pass %" PRIu32
+	       " bytes\n",
+	       count, end - start, size);
+	rc = 0;
+fail:
+	progressive_context_free(encoder);
+	free(pSrcData);
+	return rc;
+}
+
 int TestFreeRDPCodecProgressive(int argc, char* argv[])
 {
 	char* ms_sample_path;
@@ -1024,6 +1325,19 @@ int TestFreeRDPCodecProgressive(int argc, char* argv[])
 	SYSTEMTIME systemTime;
 	WINPR_UNUSED(argc);
 	WINPR_UNUSED(argv);
+
+	if (test_progressive_encode(64, 64) < 0)
+		return -1;
+
+	if (test_progressive_encode(250, 190) < 0)
+		return -1;
+
+	if (test_progressive_encode_shrink() < 0)
+		return -1;
+
+	if (test_progressive_encode_speed() < 0)
+		return -1;
+
 	GetSystemTime(&systemTime);
 	sprintf_s(name, sizeof(name),
 	          "EGFX_PROGRESSIVE_MS_SAMPLE-%04" PRIu16 "%02" PRIu16 "%02" PRIu16 "%02" PRIu16
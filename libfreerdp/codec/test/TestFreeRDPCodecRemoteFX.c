@@ -1,9 +1,13 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 
+#include <winpr/sysinfo.h>
+
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/rfx.h>
 
+#include "../rfx_rlgr.h"
+
 static BYTE encodeHeaderSample[] = {
 	/* as in 4.2.2 */
 	0xc0, 0xcc, 0x0c, 0x00, 0x00, 0x00, 0xca, 0xac, 0xcc, 0xca, 0x00, 0x01, 0xc3, 0xcc, 0x0d, 0x00,
@@ -843,6 +847,262 @@ static BOOL fuzzyCompareImage(const UINT32* refImage, const BYTE* img, size_t np
 	return TRUE;
 }
 
+/* Coefficients covering zero runs, sign changes, long GR prefixes and a trailing zero */
+static const INT16 rlgrSample[] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, -1, 0, 0,
+	1, 0, 0, 0, 0, 0, 0, 0, 0, 0, -7, 12, -30, 5, 1, -1,
+	2, -2, 300, -512, 4, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 9, -3, 27,
+	0, -64, 1, 0, 0, 2, 0
+};
+
+static const BYTE rlgr1Sample[] = {
+	0x08, 0x49, 0x10, 0x17, 0xFA, 0x3E, 0xDF, 0xFF, 0xD9, 0x10, 0xA3, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFC, 0x3F, 0xF0, 0x20, 0x00, 0x00, 0x80,
+	0x00, 0x00, 0x00, 0x3C, 0x08, 0x90, 0x14, 0x1A, 0x00, 0xA7, 0xE0, 0x40,
+	0x00, 0x04, 0x00, 0x00
+};
+
+static const BYTE rlgr3Sample[] = {
+	0x08, 0x49, 0x10, 0x17, 0xFA, 0x3E, 0xDF, 0xFF, 0xDA, 0x52, 0x9F, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE, 0x60, 0x1C, 0x03, 0xBF,
+	0xF0, 0x04, 0x00, 0x00, 0x00, 0x40, 0x08, 0x90, 0x0A, 0x03, 0x5C, 0x7E,
+	0x02, 0x80, 0x80, 0x00, 0x00
+};
+
+static UINT32 test_rlgr_rand(UINT32* state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7FFF;
+}
+
+/* Fills a tile like a quantized DWT, mostly zero with small values and a denser LL3 band */
+static void test_rlgr_fill_tile(INT16* tile, UINT32 density, UINT32* state)
+{
+	UINT32 i;
+
+	for (i = 0; i < 4096; i++)
+	{
+		const UINT32 bound = (i >= 4015) ? 256 : 16;
+
+		if ((i >= 4015) || ((test_rlgr_rand(state) % 100) < density))
+			tile[i] = (INT16)(test_rlgr_rand(state) % (2 * bound + 1)) - (INT16)bound;
+		else
+			tile[i] = 0;
+	}
+}
+
+static BOOL test_rlgr_sample(RLGR_MODE mode, const BYTE* expected, size_t expectedSize)
+{
+	int status;
+	BYTE buffer[256] = { 0 };
+	INT16 decoded[ARRAYSIZE(rlgrSample)];
+
+	status = rfx_rlgr_encode(mode, rlgrSample, ARRAYSIZE(rlgrSample), buffer, sizeof(buffer));
+
+	if ((status != (int)expectedSize) || (memcmp(buffer, expected, expectedSize) != 0))
+	{
+		printf("rfx_rlgr_encode: RLGR%d output differs from the reference\n",
+		       (mode == RLGR1) ? 1 : 3);
+		return FALSE;
+	}
+
+	status = rfx_rlgr_decode(mode, expected, (UINT32)expectedSize, decoded, ARRAYSIZE(decoded));
+
+	if ((status < 0) || (memcmp(decoded, rlgrSample, sizeof(rlgrSample)) != 0))
+	{
+		printf("rfx_rlgr_decode: RLGR%d output differs from the reference\n",
+		       (mode == RLGR1) ? 1 : 3);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_rlgr_round_trip(RLGR_MODE mode)
+{
+	UINT32 i;
+	UINT32 state = 0x1234;
+	INT16 tile[4096];
+	INT16 decoded[4096];
+	BYTE buffer[16384];
+
+	for (i = 0; i < 64; i++)
+	{
+		int status;
+		const UINT32 size = (i % 4 == 3) ? 1 + test_rlgr_rand(&state) % 4096 : 4096;
+
+		test_rlgr_fill_tile(tile, i * 100 / 64, &state);
+		ZeroMemory(buffer, sizeof(buffer));
+		status = rfx_rlgr_encode(mode, tile, size, buffer, sizeof(buffer));
+
+		if (status <= 0)
+			return FALSE;
+
+		status = rfx_rlgr_decode(mode, buffer, (UINT32)status, decoded, size);
+
+		if ((status < 0) || (memcmp(decoded, tile, size * sizeof(INT16)) != 0))
+		{
+			printf("RLGR%d round trip mismatch for tile %" PRIu32 "\n", (mode == RLGR1) ? 1 : 3,
+			       i);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_rlgr_speed(RLGR_MODE mode)
+{
+	UINT32 i;
+	UINT32 state = 0x5678;
+	int size = 0;
+	UINT64 start;
+	UINT64 encodeTime;
+	UINT64 decodeTime;
+	const UINT32 count = 2000;
+	INT16 tile[4096];
+	INT16 decoded[4096];
+	BYTE buffer[16384];
+
+	test_rlgr_fill_tile(tile, 30, &state);
+	start = GetTickCount64();
+
+	for (i = 0; i < count; i++)
+	{
+		/* the encoder expects a zeroed buffer like in rfx_encode_component */
+		ZeroMemory(buffer, (size_t)size + 8);
+		size = rfx_rlgr_encode(mode, tile, 4096, buffer, sizeof(buffer));
+
+		if (size <= 0)
+			return FALSE;
+	}
+
+	encodeTime = GetTickCount64() - start;
+	start = GetTickCount64();
+
+	for (i = 0; i < count; i++)
+	{
+		if (rfx_rlgr_decode(mode, buffer, (UINT32)size, decoded, 4096) < 0)
+			return FALSE;
+	}
+
+	decodeTime = GetTickCount64() - start;
+	printf("RLGR%d: %" PRIu32 " tiles of %d bytes, encode %" PRIu64 " ms (%" PRIu64
+	       " tiles/s), decode %" PRIu64 " ms (%" PRIu64 " tiles/s)\n",
+	       (mode == RLGR1) ? 1 : 3, count, size, encodeTime,
+	       count * 1000ULL / (encodeTime ? encodeTime : 1), decodeTime,
+	       count * 1000ULL / (decodeTime ? decodeTime : 1));
+	return TRUE;
+}
+
+/* Encodes a message with encoder and decodes it into dst, returns the number of tiles sent */
+static int test_tile_hashing_frame(RFX_CONTEXT* encoder, RFX_CONTEXT* decoder, BYTE* src,
+                                   BYTE* dst, UINT32 width, UINT32 height)
+{
+	int numTiles = -1;
+	REGION16 region;
+	wStream* s = NULL;
+	RFX_MESSAGE* message;
+	const RFX_RECT rect = { 0, 0, (UINT16)width, (UINT16)height };
+
+	region16_init(&region);
+
+	if (!(message = rfx_encode_message(encoder, &rect, 1, src, (int)width, (int)height,
+	                                   (int)width * 4)))
+		goto fail;
+
+	if (!(s = Stream_New(NULL, 1024)) || !rfx_write_message(encoder, s, message))
+		goto fail;
+
+	if (!rfx_process_message(decoder, Stream_Buffer(s), (UINT32)Stream_GetPosition(s), 0, 0, dst,
+	                         PIXEL_FORMAT_BGRX32, width * 4, height, &region))
+		goto fail;
+
+	numTiles = rfx_message_get_tile_count(message);
+fail:
+	rfx_message_free(encoder, message);
+	Stream_Free(s, TRUE);
+	region16_uninit(&region);
+	return numTiles;
+}
+
+static BOOL test_tile_hashing(void)
+{
+	BOOL rc = FALSE;
+	UINT32 x, y;
+	const UINT32 width = 256;
+	const UINT32 height = 100;
+	BYTE* src = calloc(width * height, 4);
+	BYTE* dst = calloc(width * height, 4);
+	BYTE* ref = calloc(width * height, 4);
+	RFX_CONTEXT* encoder = rfx_context_new(TRUE);
+	RFX_CONTEXT* decoder = rfx_context_new(FALSE);
+	RFX_CONTEXT* refEncoder = rfx_context_new(TRUE);
+	RFX_CONTEXT* refDecoder = rfx_context_new(FALSE);
+
+	if (!src || !dst || !ref || !encoder || !decoder || !refEncoder || !refDecoder)
+		goto fail;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width * 4; x++)
+			src[y * width * 4 + x] = (BYTE)((x * 7) ^ (y * 13));
+	}
+
+	rfx_context_reset(encoder, width, height);
+	rfx_context_reset(refEncoder, width, height);
+
+	if (!rfx_context_set_tile_hashing(encoder, TRUE))
+		goto fail;
+
+	/* 4x2 tiles, the first frame sends all, an unchanged frame keeps a single tile */
+	if ((test_tile_hashing_frame(encoder, decoder, src, dst, width, height) != 8) ||
+	    (test_tile_hashing_frame(encoder, decoder, src, dst, width, height) != 1))
+	{
+		printf("%s: unchanged tiles were not skipped\n", __FUNCTION__);
+		goto fail;
+	}
+
+	/* touch the partial tile at the bottom right and one full tile */
+	src[(80 * width + 200) * 4] ^= 0xFF;
+	src[(10 * width + 70) * 4 + 1] ^= 0xFF;
+
+	if (test_tile_hashing_frame(encoder, decoder, src, dst, width, height) != 2)
+	{
+		printf("%s: changed tiles were not detected\n", __FUNCTION__);
+		goto fail;
+	}
+
+	/* the client image must match a full update of the same content */
+	if (test_tile_hashing_frame(refEncoder, refDecoder, src, ref, width, height) != 8)
+		goto fail;
+
+	if (memcmp(dst, ref, width * height * 4) != 0)
+	{
+		printf("%s: skipped tiles changed the decoded image\n", __FUNCTION__);
+		goto fail;
+	}
+
+	/* a reset forgets the client content */
+	rfx_context_reset(encoder, width, height);
+
+	if (test_tile_hashing_frame(encoder, decoder, src, dst, width, height) != 8)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	rfx_context_free(encoder);
+	rfx_context_free(decoder);
+	rfx_context_free(refEncoder);
+	rfx_context_free(refDecoder);
+	free(src);
+	free(dst);
+	free(ref);
+	return rc;
+}
+
 int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 {
 	int rc = -1;
@@ -851,6 +1111,19 @@ int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 	BYTE* dest = NULL;
 	size_t stride = FORMAT_SIZE * IMG_WIDTH;
 
+	if (!test_rlgr_sample(RLGR1, rlgr1Sample, sizeof(rlgr1Sample)) ||
+	    !test_rlgr_sample(RLGR3, rlgr3Sample, sizeof(rlgr3Sample)))
+		return -1;
+
+	if (!test_rlgr_round_trip(RLGR1) || !test_rlgr_round_trip(RLGR3))
+		return -1;
+
+	if (!test_rlgr_speed(RLGR1) || !test_rlgr_speed(RLGR3))
+		return -1;
+
+	if (!test_tile_hashing())
+		return -1;
+
 	context = rfx_context_new(FALSE);
 	if (!context)
 		goto fail;
@@ -1,6 +1,7 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/bitstream.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/zgfx.h>
@@ -252,6 +253,155 @@ fail:
 	return rc;
 }
 
+static UINT32 test_rand(UINT32* state)
+{
+	*state = *state * 1103515245 + 12345;
+	return *state >> 16;
+}
+
+/* Synthetic EGFX like payload: surface rows with solid runs, repeated
+ * glyph like patterns and some noise. */
+static void test_fill_payload(BYTE* data, UINT32 size, UINT32* state)
+{
+	UINT32 i = 0;
+
+	while (i < size)
+	{
+		const UINT32 kind = test_rand(state) % 4;
+		UINT32 len = 16 + test_rand(state) % 512;
+
+		if (len > size - i)
+			len = size - i;
+
+		switch (kind)
+		{
+			case 0:
+				memset(&data[i], (BYTE)test_rand(state), len);
+				break;
+
+			case 1:
+				if (i > 4096)
+				{
+					const UINT32 back = 1 + test_rand(state) % 4096;
+					UINT32 j;
+
+					for (j = 0; j < len; j++)
+						data[i + j] = data[i + j - back];
+
+					break;
+				}
+				/* fallthrough */
+
+			case 2:
+			{
+				UINT32 j;
+
+				for (j = 0; j < len; j++)
+					data[i + j] = (BYTE)((j & 3) == 3 ? 0xFF : (j * 7));
+
+				break;
+			}
+
+			default:
+			{
+				UINT32 j;
+
+				for (j = 0; j < len; j++)
+					data[i + j] = (BYTE)test_rand(state);
+
+				break;
+			}
+		}
+
+		i += len;
+	}
+}
+
+static int test_ZGfxCompressRoundTrip(DWORD level)
+{
+	int rc = -1;
+	UINT32 i;
+	UINT32 state = 0x1234;
+	const UINT32 count = 192;
+	const UINT32 maxSize = 131072;
+	UINT64 totalIn = 0;
+	UINT64 totalOut = 0;
+	UINT64 compressTime = 0;
+	UINT64 decompressTime = 0;
+	BYTE* pSrcData = NULL;
+	ZGFX_CONTEXT* encoder = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decoder = zgfx_context_new(FALSE);
+
+	if (!encoder || !decoder)
+		goto fail;
+
+	zgfx_set_compression_level(encoder, level);
+	pSrcData = (BYTE*)malloc(maxSize);
+
+	if (!pSrcData)
+		goto fail;
+
+	/* Sizes add up beyond the history size so that the window slides */
+	for (i = 0; i < count; i++)
+	{
+		int status;
+		UINT32 Flags = 0;
+		UINT32 DstSize = 0;
+		UINT32 DstSize2 = 0;
+		BYTE* pDstData = NULL;
+		BYTE* pDstData2 = NULL;
+		UINT64 start;
+		const UINT32 SrcSize = (i % 8 == 0) ? maxSize : 1 + test_rand(&state) % maxSize;
+
+		/* Every other packet partly repeats the previous one, like redrawn surfaces */
+		if (i % 2)
+			test_fill_payload(pSrcData, SrcSize / 2, &state);
+		else
+			test_fill_payload(pSrcData, SrcSize, &state);
+
+		start = GetTickCount64();
+		status = zgfx_compress(encoder, pSrcData, SrcSize, &pDstData2, &DstSize2, &Flags);
+		compressTime += GetTickCount64() - start;
+
+		if (status < 0)
+		{
+			free(pDstData2);
+			goto fail;
+		}
+
+		start = GetTickCount64();
+		status = zgfx_decompress(decoder, pDstData2, DstSize2, &pDstData, &DstSize, Flags);
+		decompressTime += GetTickCount64() - start;
+
+		if ((status < 0) || (DstSize != SrcSize) || (memcmp(pDstData, pSrcData, SrcSize) != 0))
+		{
+			printf("test_ZGfxCompressRoundTrip: level %" PRIu32 " packet %" PRIu32
+			       " mismatch (size %" PRIu32 " -> %" PRIu32 ")\n",
+			       level, i, SrcSize, DstSize);
+			free(pDstData);
+			free(pDstData2);
+			goto fail;
+		}
+
+		totalIn += SrcSize;
+		totalOut += DstSize2;
+		free(pDstData);
+		free(pDstData2);
+	}
+
+	printf("zgfx level %" PRIu32 ": %" PRIu64 " -> %" PRIu64 " bytes, ratio %.2f%%, "
+	       "compress %.1f MB/s, decompress %.1f MB/s\n",
+	       level, totalIn, totalOut, 100.0 * totalOut / totalIn,
+	       totalIn / 1048576.0 / (MAX(compressTime, 1) / 1000.0),
+	       totalIn / 1048576.0 / (MAX(decompressTime, 1) / 1000.0));
+	rc = 0;
+fail:
+	free(pSrcData);
+	zgfx_context_free(encoder);
+	zgfx_context_free(decoder);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -269,5 +419,17 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	if (test_ZGfxCompressRoundTrip(ZGFX_COMPRESSION_LEVEL_NONE) < 0)
+		return -1;
+
+	if (test_ZGfxCompressRoundTrip(ZGFX_COMPRESSION_LEVEL_FAST) < 0)
+		return -1;
+
+	if (test_ZGfxCompressRoundTrip(ZGFX_COMPRESSION_LEVEL_DEFAULT) < 0)
+		return -1;
+
+	if (test_ZGfxCompressRoundTrip(ZGFX_COMPRESSION_LEVEL_MAX) < 0)
+		return -1;
+
 	return 0;
 }
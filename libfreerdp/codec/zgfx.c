@@ -42,6 +42,50 @@
  * Minimum match length: 3 bytes
  */
 
+#define ZGFX_HISTORY_SIZE 2500000
+#define ZGFX_MAX_MATCH_DISTANCE (ZGFX_HISTORY_SIZE - 1)
+#define ZGFX_MIN_MATCH_LENGTH 3
+
+/**
+ * Compressor match finder:
+ *
+ * The compressor keeps the data it has sent in a linear window of twice the
+ * history size, which is slid back whenever it fills up. Matches are found
+ * with hash chains over 3 byte prefixes. Positions are absolute stream
+ * offsets, the chain table is indexed modulo its size, which bounds how far
+ * back a chain can reach (the hash heads may still point up to the full
+ * history size back).
+ */
+
+#define ZGFX_WINDOW_SIZE (2 * ZGFX_HISTORY_SIZE)
+#define ZGFX_HASH_BITS 16
+#define ZGFX_HASH_SIZE (1 << ZGFX_HASH_BITS)
+#define ZGFX_CHAIN_BITS 21
+#define ZGFX_CHAIN_SIZE (1 << ZGFX_CHAIN_BITS)
+#define ZGFX_CHAIN_MASK (ZGFX_CHAIN_SIZE - 1)
+
+struct _ZGFX_LEVEL
+{
+	UINT32 maxChain;
+	UINT32 niceLength;
+	BOOL lazy;
+};
+typedef struct _ZGFX_LEVEL ZGFX_LEVEL;
+
+static const ZGFX_LEVEL ZGFX_LEVEL_TABLE[] = {
+	// chain  nice   lazy
+	{ 0, 0, FALSE },          // 0: no compression
+	{ 4, 16, FALSE },         // 1: fastest
+	{ 8, 32, FALSE },         // 2
+	{ 16, 64, FALSE },        // 3
+	{ 16, 64, TRUE },         // 4: default
+	{ 32, 128, TRUE },        // 5
+	{ 64, 258, TRUE },        // 6
+	{ 128, 1024, TRUE },      // 7
+	{ 512, 4096, TRUE },      // 8
+	{ 4096, 65535, TRUE }     // 9: best
+};
+
 struct _ZGFX_TOKEN
 {
 	UINT32 prefixLength;
@@ -67,9 +111,27 @@ struct _ZGFX_CONTEXT
 	BYTE OutputBuffer[65536];
 	UINT32 OutputCount;
 
-	BYTE HistoryBuffer[2500000];
+	BYTE HistoryBuffer[ZGFX_HISTORY_SIZE];
 	UINT32 HistoryIndex;
 	UINT32 HistoryBufferSize;
+
+	UINT32 CompressionLevel;
+	BYTE* Window;
+	UINT32 WindowLength;
+	UINT32 WindowBase;
+	UINT32 HashPosition;
+	UINT32* HashHead;
+	UINT32* HashChain;
+
+	UINT16 LiteralCode[256];
+	BYTE LiteralBits[256];
+
+	UINT64 CompressBits;
+	UINT32 cCompressBits;
+	BOOL CompressOverflow;
+	BYTE CompressBuffer[65536];
+	UINT32 CompressCount;
+	UINT32 CompressLimit;
 };
 
 static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] = {
@@ -452,18 +514,307 @@ fail:
 	return status;
 }
 
+static INLINE void zgfx_put_bits(ZGFX_CONTEXT* zgfx, UINT32 value, UINT32 nbits)
+{
+	zgfx->CompressBits = (zgfx->CompressBits << nbits) | value;
+	zgfx->cCompressBits += nbits;
+
+	while (zgfx->cCompressBits >= 8)
+	{
+		zgfx->cCompressBits -= 8;
+
+		if (zgfx->CompressCount >= zgfx->CompressLimit)
+		{
+			zgfx->CompressOverflow = TRUE;
+			continue;
+		}
+
+		zgfx->CompressBuffer[zgfx->CompressCount++] =
+		    (BYTE)(zgfx->CompressBits >> zgfx->cCompressBits);
+	}
+}
+
+/* Indices of the match tokens in ZGFX_TOKEN_TABLE, ordered by valueBase */
+static const BYTE ZGFX_MATCH_TOKENS[] = { 1, 2, 3, 4, 5, 8, 9, 13, 14, 31, 32, 37, 38, 39 };
+
+static INLINE const ZGFX_TOKEN* zgfx_distance_token(UINT32 distance)
+{
+	size_t index = ARRAYSIZE(ZGFX_MATCH_TOKENS) - 1;
+
+	while ((index > 0) && (ZGFX_TOKEN_TABLE[ZGFX_MATCH_TOKENS[index]].valueBase > distance))
+		index--;
+
+	return &ZGFX_TOKEN_TABLE[ZGFX_MATCH_TOKENS[index]];
+}
+
+static INLINE UINT32 zgfx_length_exponent(UINT32 count)
+{
+	UINT32 k = 2;
+
+	while ((count >> (k + 1)) != 0)
+		k++;
+
+	return k;
+}
+
+static INLINE UINT32 zgfx_match_bits(UINT32 distance, UINT32 count)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+	const UINT32 lengthBits = (count == 3) ? 1 : 2 * zgfx_length_exponent(count);
+	return token->prefixLength + token->valueBits + lengthBits;
+}
+
+static INLINE void zgfx_put_literal(ZGFX_CONTEXT* zgfx, BYTE c)
+{
+	zgfx_put_bits(zgfx, zgfx->LiteralCode[c], zgfx->LiteralBits[c]);
+}
+
+static INLINE void zgfx_put_match(ZGFX_CONTEXT* zgfx, UINT32 distance, UINT32 count)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+	zgfx_put_bits(zgfx, token->prefixCode, token->prefixLength);
+	zgfx_put_bits(zgfx, distance - token->valueBase, token->valueBits);
+
+	if (count == 3)
+	{
+		zgfx_put_bits(zgfx, 0, 1);
+	}
+	else
+	{
+		/* 1, (k - 2) times 1, 0, then k bits of count - 2^k */
+		const UINT32 k = zgfx_length_exponent(count);
+		zgfx_put_bits(zgfx, ((1 << (k - 1)) - 1) << 1, k);
+		zgfx_put_bits(zgfx, count - (1 << k), k);
+	}
+}
+
+static INLINE UINT32 zgfx_hash(const BYTE* p)
+{
+	const UINT32 v = ((UINT32)p[0] << 16) | ((UINT32)p[1] << 8) | p[2];
+	return (v * 2654435761U) >> (32 - ZGFX_HASH_BITS);
+}
+
+/* Insert all window positions below end into the hash chains. */
+static INLINE void zgfx_hash_insert(ZGFX_CONTEXT* zgfx, UINT32 end)
+{
+	const UINT32 limit = zgfx->WindowLength - (ZGFX_MIN_MATCH_LENGTH - 1);
+
+	if (end > limit)
+		end = limit;
+
+	while (zgfx->HashPosition < end)
+	{
+		const UINT32 index = zgfx->HashPosition++;
+		const UINT32 h = zgfx_hash(&zgfx->Window[index]);
+		const UINT32 position = zgfx->WindowBase + index;
+		zgfx->HashChain[position & ZGFX_CHAIN_MASK] = zgfx->HashHead[h];
+		zgfx->HashHead[h] = position;
+	}
+}
+
+static UINT32 zgfx_find_match(ZGFX_CONTEXT* zgfx, UINT32 index, UINT32 end, UINT32* pDistance)
+{
+	const ZGFX_LEVEL* level = &ZGFX_LEVEL_TABLE[zgfx->CompressionLevel];
+	const BYTE* cur = &zgfx->Window[index];
+	const UINT32 position = zgfx->WindowBase + index;
+	const UINT32 maxDistance = MIN(index, ZGFX_MAX_MATCH_DISTANCE);
+	const UINT32 maxLength = end - index;
+	UINT32 chain = level->maxChain;
+	UINT32 bestLength = 0;
+	UINT32 bestDistance = 0;
+	UINT32 lastDistance = 0;
+	UINT32 candidate;
+
+	zgfx_hash_insert(zgfx, index);
+	candidate = zgfx->HashHead[zgfx_hash(cur)];
+
+	while (chain-- > 0)
+	{
+		const UINT32 distance = position - candidate;
+		const BYTE* ref;
+		UINT32 length;
+
+		if (distance == 0)
+		{
+			candidate = zgfx->HashChain[candidate & ZGFX_CHAIN_MASK];
+			continue;
+		}
+
+		if ((distance <= lastDistance) || (distance > maxDistance))
+			break;
+
+		lastDistance = distance;
+		ref = cur - distance;
+
+		if ((ref[bestLength] == cur[bestLength]) && (ref[0] == cur[0]) && (ref[1] == cur[1]) &&
+		    (ref[2] == cur[2]))
+		{
+			length = 3;
+
+			while ((length < maxLength) && (ref[length] == cur[length]))
+				length++;
+
+			if (length > bestLength)
+			{
+				bestLength = length;
+				bestDistance = distance;
+
+				if ((length >= level->niceLength) || (length == maxLength))
+					break;
+			}
+		}
+
+		candidate = zgfx->HashChain[candidate & ZGFX_CHAIN_MASK];
+	}
+
+	zgfx_hash_insert(zgfx, index + 1);
+
+	if (bestLength < ZGFX_MIN_MATCH_LENGTH)
+		return 0;
+
+	/* Short matches far back can cost more than the literals they replace */
+	if (bestLength < 8)
+	{
+		UINT32 i;
+		UINT32 literalBits = 0;
+
+		for (i = 0; i < bestLength; i++)
+			literalBits += zgfx->LiteralBits[cur[i]];
+
+		if (zgfx_match_bits(bestDistance, bestLength) >= literalBits)
+			return 0;
+	}
+
+	*pDistance = bestDistance;
+	return bestLength;
+}
+
+/* Append data to the compressor window, returns the window index it was placed at. */
+static UINT32 zgfx_window_append(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize)
+{
+	UINT32 index;
+
+	if (zgfx->WindowLength + SrcSize > ZGFX_WINDOW_SIZE)
+	{
+		const UINT32 shift = zgfx->WindowLength - ZGFX_HISTORY_SIZE;
+		MoveMemory(zgfx->Window, &zgfx->Window[shift], ZGFX_HISTORY_SIZE);
+		zgfx->WindowBase += shift;
+		zgfx->WindowLength -= shift;
+		zgfx->HashPosition = (zgfx->HashPosition > shift) ? zgfx->HashPosition - shift : 0;
+	}
+
+	index = zgfx->WindowLength;
+	CopyMemory(&zgfx->Window[index], pSrcData, SrcSize);
+	zgfx->WindowLength += SrcSize;
+	return index;
+}
+
+static BOOL zgfx_compress_bits(ZGFX_CONTEXT* zgfx, UINT32 start, UINT32 end)
+{
+	const ZGFX_LEVEL* level = &ZGFX_LEVEL_TABLE[zgfx->CompressionLevel];
+	const BYTE* window = zgfx->Window;
+	UINT32 index = start;
+	UINT32 padding;
+
+	zgfx->CompressBits = 0;
+	zgfx->cCompressBits = 0;
+	zgfx->CompressCount = 0;
+	zgfx->CompressOverflow = FALSE;
+	/* Give up as soon as the result (plus the padding byte) is not smaller than the input */
+	zgfx->CompressLimit = MIN(end - start, sizeof(zgfx->CompressBuffer)) - 1;
+
+	while ((index < end) && !zgfx->CompressOverflow)
+	{
+		UINT32 distance = 0;
+		UINT32 length = 0;
+
+		if (end - index >= ZGFX_MIN_MATCH_LENGTH)
+			length = zgfx_find_match(zgfx, index, end, &distance);
+
+		/* Lazy evaluation: prefer a longer match starting at the next byte */
+		while (level->lazy && (length > 0) && (length < level->niceLength) &&
+		       (end - index > length))
+		{
+			UINT32 nextDistance = 0;
+			const UINT32 nextLength = zgfx_find_match(zgfx, index + 1, end, &nextDistance);
+
+			if (nextLength <= length)
+				break;
+
+			zgfx_put_literal(zgfx, window[index++]);
+			length = nextLength;
+			distance = nextDistance;
+		}
+
+		if (length == 0)
+		{
+			zgfx_put_literal(zgfx, window[index++]);
+			continue;
+		}
+
+		zgfx_put_match(zgfx, distance, length);
+		index += length;
+
+		if (level->maxChain > 8 || length <= level->niceLength)
+			zgfx_hash_insert(zgfx, index);
+		else
+			zgfx->HashPosition = index;
+	}
+
+	if (zgfx->CompressOverflow)
+		return FALSE;
+
+	/* Pad to a full byte, the trailing byte holds the number of padding bits */
+	padding = (8 - zgfx->cCompressBits) & 7;
+	zgfx_put_bits(zgfx, 0, padding);
+
+	if (zgfx->CompressOverflow || (zgfx->CompressCount >= zgfx->CompressLimit))
+		return FALSE;
+
+	zgfx->CompressBuffer[zgfx->CompressCount++] = (BYTE)padding;
+	return TRUE;
+}
+
 static BOOL zgfx_compress_segment(ZGFX_CONTEXT* zgfx, wStream* s, const BYTE* pSrcData,
                                   UINT32 SrcSize, UINT32* pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
+	BYTE header;
+	BOOL compressed = FALSE;
+
+	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
+	header = (BYTE)((*pFlags) & ~PACKET_COMPRESSED);
+
+	/* The window must mirror the decoder history, so it is fed even when not compressing */
+	if (zgfx->Window && (SrcSize > 0))
+	{
+		const UINT32 start = zgfx_window_append(zgfx, pSrcData, SrcSize);
+
+		if (zgfx->CompressionLevel > 0)
+			compressed = zgfx_compress_bits(zgfx, start, start + SrcSize);
+	}
+
+	if (compressed)
+	{
+		if (!Stream_EnsureRemainingCapacity(s, zgfx->CompressCount + 1))
+		{
+			WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
+			return FALSE;
+		}
+
+		(*pFlags) |= PACKET_COMPRESSED;
+		Stream_Write_UINT8(s, header | PACKET_COMPRESSED); /* header (1 byte) */
+		Stream_Write(s, zgfx->CompressBuffer, zgfx->CompressCount);
+		return TRUE;
+	}
+
+	/* The decoder adds uncompressed segments to its history as well */
 	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return FALSE;
 	}
 
-	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags));         /* header (1 byte) */
+	Stream_Write_UINT8(s, header); /* header (1 byte) */
 	Stream_Write(s, pSrcData, SrcSize);
 	return TRUE;
 }
@@ -562,9 +913,50 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 	return status;
 }
 
+void zgfx_set_compression_level(ZGFX_CONTEXT* zgfx, DWORD CompressionLevel)
+{
+	const DWORD maxLevel = ARRAYSIZE(ZGFX_LEVEL_TABLE) - 1;
+
+	if (!zgfx)
+		return;
+
+	zgfx->CompressionLevel = (CompressionLevel > maxLevel) ? maxLevel : CompressionLevel;
+}
+
 void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush)
 {
 	zgfx->HistoryIndex = 0;
+
+	if (zgfx->Compressor)
+	{
+		zgfx->WindowLength = 0;
+		zgfx->HashPosition = 0;
+		ZeroMemory(zgfx->HashHead, ZGFX_HASH_SIZE * sizeof(UINT32));
+	}
+}
+
+static void zgfx_init_literal_table(ZGFX_CONTEXT* zgfx)
+{
+	int opIndex;
+	UINT32 c;
+
+	/* Default literal: prefix 0 followed by the 8 bit value */
+	for (c = 0; c < 256; c++)
+	{
+		zgfx->LiteralCode[c] = (UINT16)c;
+		zgfx->LiteralBits[c] = 9;
+	}
+
+	for (opIndex = 0; ZGFX_TOKEN_TABLE[opIndex].prefixLength != 0; opIndex++)
+	{
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[opIndex];
+
+		if ((token->tokenType == 0) && (token->valueBits == 0))
+		{
+			zgfx->LiteralCode[token->valueBase] = (UINT16)token->prefixCode;
+			zgfx->LiteralBits[token->valueBase] = (BYTE)token->prefixLength;
+		}
+	}
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
@@ -576,6 +968,23 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 	{
 		zgfx->Compressor = Compressor;
 		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
+
+		if (Compressor)
+		{
+			zgfx->CompressionLevel = ZGFX_COMPRESSION_LEVEL_DEFAULT;
+			zgfx->Window = (BYTE*)malloc(ZGFX_WINDOW_SIZE);
+			zgfx->HashHead = (UINT32*)calloc(ZGFX_HASH_SIZE, sizeof(UINT32));
+			zgfx->HashChain = (UINT32*)calloc(ZGFX_CHAIN_SIZE, sizeof(UINT32));
+
+			if (!zgfx->Window || !zgfx->HashHead || !zgfx->HashChain)
+			{
+				zgfx_context_free(zgfx);
+				return NULL;
+			}
+
+			zgfx_init_literal_table(zgfx);
+		}
+
 		zgfx_context_reset(zgfx, FALSE);
 	}
 
@@ -584,5 +993,11 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 
 void zgfx_context_free(ZGFX_CONTEXT* zgfx)
 {
+	if (!zgfx)
+		return;
+
+	free(zgfx->Window);
+	free(zgfx->HashHead);
+	free(zgfx->HashChain);
 	free(zgfx);
 }
@@ -195,6 +195,9 @@ BOOL freerdp_settings_get_bool(const rdpSettings* settings, size_t id)
 		case FreeRDP_FIPSMode:
 			return settings->FIPSMode;
 
+		case FreeRDP_TlsKernelOffload:
+			return settings->TlsKernelOffload;
+
 		case FreeRDP_MstscCookieMode:
 			return settings->MstscCookieMode;
 
@@ -755,6 +758,10 @@ BOOL freerdp_settings_set_bool(rdpSettings* settings, size_t id, BOOL val)
 			settings->FIPSMode = val;
 			break;
 
+		case FreeRDP_TlsKernelOffload:
+			settings->TlsKernelOffload = val;
+			break;
+
 		case FreeRDP_MstscCookieMode:
 			settings->MstscCookieMode = val;
 			break;
@@ -1532,6 +1539,9 @@ UINT32 freerdp_settings_get_uint32(const rdpSettings* settings, size_t id)
 		case FreeRDP_GfxCapsFilter:
 			return settings->GfxCapsFilter;
 
+		case FreeRDP_GfxDecodeThreads:
+			return settings->GfxDecodeThreads;
+
 		case FreeRDP_BitmapCacheV3CodecId:
 			return settings->BitmapCacheV3CodecId;
 
@@ -1972,6 +1982,10 @@ BOOL freerdp_settings_set_uint32(rdpSettings* settings, size_t id, UINT32 val)
 			settings->GfxCapsFilter = val;
 			break;
 
+		case FreeRDP_GfxDecodeThreads:
+			settings->GfxDecodeThreads = val;
+			break;
+
 		case FreeRDP_BitmapCacheV3CodecId:
 			settings->BitmapCacheV3CodecId = val;
 			break;
@@ -2326,6 +2340,9 @@ const char* freerdp_settings_get_string(const rdpSettings* settings, size_t id)
 		case FreeRDP_RemoteApplicationWorkingDir:
 			return settings->RemoteApplicationWorkingDir;
 
+		case FreeRDP_BitmapCachePersistFile:
+			return settings->BitmapCachePersistFile;
+
 		case FreeRDP_ImeFileName:
 			return settings->ImeFileName;
 
@@ -2658,6 +2675,11 @@ BOOL freerdp_settings_set_string(rdpSettings* settings, size_t id, const char* v
 			settings->RemoteApplicationWorkingDir = (val ? _strdup(val) : NULL);
 			return (!val || settings->RemoteApplicationWorkingDir != NULL);
 
+		case FreeRDP_BitmapCachePersistFile:
+			free(settings->BitmapCachePersistFile);
+			settings->BitmapCachePersistFile = (val ? _strdup(val) : NULL);
+			return (!val || settings->BitmapCachePersistFile != NULL);
+
 		case FreeRDP_ImeFileName:
 			free(settings->ImeFileName);
 			settings->ImeFileName = (val ? _strdup(val) : NULL);
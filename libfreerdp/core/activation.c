@@ -21,9 +21,20 @@
 #include "config.h"
 #endif
 
+#include <freerdp/log.h>
+#include <freerdp/cache/cache.h>
+
 #include "activation.h"
 #include "display.h"
 
+#include "../cache/bitmap.h"
+
+#define TAG FREERDP_TAG("core.activation")
+
+/* [MS-RDPBCGR] 2.2.1.17.1 */
+#define PERSIST_LIST_NUM_CELLS 5
+#define PERSIST_LIST_MAX_ENTRIES 169
+
 /*
 static const char* const CTRLACTION_STRINGS[] =
 {
@@ -163,30 +174,116 @@ static void rdp_write_persistent_list_entry(wStream* s, UINT32 key1, UINT32 key2
 	Stream_Write_UINT32(s, key2); /* key2 (4 bytes) */
 }
 
-static void rdp_write_client_persistent_key_list_pdu(wStream* s, rdpSettings* settings)
+static BOOL rdp_write_client_persistent_key_list_pdu(wStream* s, const UINT16* numEntries,
+                                                    const UINT16* totalEntries, BYTE bitMask,
+                                                    const UINT64** keys, const UINT16* first)
 {
-	Stream_Write_UINT16(s, 0);                                   /* numEntriesCache0 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* numEntriesCache1 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* numEntriesCache2 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* numEntriesCache3 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* numEntriesCache4 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* totalEntriesCache0 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* totalEntriesCache1 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* totalEntriesCache2 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* totalEntriesCache3 (2 bytes) */
-	Stream_Write_UINT16(s, 0);                                   /* totalEntriesCache4 (2 bytes) */
-	Stream_Write_UINT8(s, PERSIST_FIRST_PDU | PERSIST_LAST_PDU); /* bBitMask (1 byte) */
-	Stream_Write_UINT8(s, 0);                                    /* pad1 (1 byte) */
-	Stream_Write_UINT16(s, 0);                                   /* pad3 (2 bytes) */
-	                                                             /* entries */
+	UINT32 index, x;
+
+	if (!Stream_EnsureRemainingCapacity(s, 24 + PERSIST_LIST_MAX_ENTRIES * 8))
+		return FALSE;
+
+	for (index = 0; index < PERSIST_LIST_NUM_CELLS; index++)
+		Stream_Write_UINT16(s, numEntries[index]); /* numEntriesCacheX (2 bytes) */
+
+	for (index = 0; index < PERSIST_LIST_NUM_CELLS; index++)
+		Stream_Write_UINT16(s, totalEntries[index]); /* totalEntriesCacheX (2 bytes) */
+
+	Stream_Write_UINT8(s, bitMask); /* bBitMask (1 byte) */
+	Stream_Write_UINT8(s, 0);       /* pad1 (1 byte) */
+	Stream_Write_UINT16(s, 0);      /* pad3 (2 bytes) */
+
+	/* entries, grouped by cell in ascending order */
+	for (index = 0; index < PERSIST_LIST_NUM_CELLS; index++)
+	{
+		for (x = 0; x < numEntries[index]; x++)
+		{
+			const UINT64 key = keys[index][first[index] + x];
+			rdp_write_persistent_list_entry(s, (UINT32)(key & 0xFFFFFFFF), (UINT32)(key >> 32));
+		}
+	}
+
+	return TRUE;
 }
 
+/**
+ * Send the keys of the bitmaps in the persistent bitmap cache.\n
+ * The server assigns the cache indices of a cell in the order the keys are listed, the bitmap
+ * cache fixes that list for the connection and resolves the indices with it.
+ * @msdn{cc240494}
+ */
+
 BOOL rdp_send_client_persistent_key_list_pdu(rdpRdp* rdp)
 {
-	wStream* s;
-	s = rdp_data_pdu_init(rdp);
-	rdp_write_client_persistent_key_list_pdu(s, rdp->settings);
-	return rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_BITMAP_CACHE_PERSISTENT_LIST, rdp->mcs->userId);
+	UINT32 index;
+	UINT32 sent = 0;
+	UINT32 total = 0;
+	UINT16 totalEntries[PERSIST_LIST_NUM_CELLS] = { 0 };
+	UINT16 first[PERSIST_LIST_NUM_CELLS] = { 0 };
+	const UINT64* keys[PERSIST_LIST_NUM_CELLS] = { 0 };
+	rdpBitmapCache* bitmapCache = NULL;
+
+	/* Without a bitmap cache, e.g. no gdi, nothing can be loaded and the list stays empty */
+	if (rdp->context && rdp->context->cache)
+		bitmapCache = rdp->context->cache->bitmap;
+
+	if (!bitmap_cache_announce_persistent_keys(bitmapCache))
+		return FALSE;
+
+	for (index = 0; index < PERSIST_LIST_NUM_CELLS; index++)
+	{
+		UINT32 count;
+		keys[index] = bitmap_cache_get_persistent_keys(bitmapCache, index, &count);
+		totalEntries[index] = (UINT16)count;
+		total += totalEntries[index];
+	}
+
+	do
+	{
+		wStream* s;
+		BYTE bitMask = 0;
+		UINT32 count = 0;
+		UINT16 numEntries[PERSIST_LIST_NUM_CELLS] = { 0 };
+
+		for (index = 0; index < PERSIST_LIST_NUM_CELLS; index++)
+		{
+			numEntries[index] =
+			    (UINT16)MIN(totalEntries[index] - first[index], PERSIST_LIST_MAX_ENTRIES - count);
+			count += numEntries[index];
+		}
+
+		if (sent == 0)
+			bitMask |= PERSIST_FIRST_PDU;
+
+		if (sent + count == total)
+			bitMask |= PERSIST_LAST_PDU;
+
+		s = rdp_data_pdu_init(rdp);
+
+		if (!s)
+			return FALSE;
+
+		if (!rdp_write_client_persistent_key_list_pdu(s, numEntries, totalEntries, bitMask, keys,
+		                                              first))
+		{
+			Stream_Release(s);
+			return FALSE;
+		}
+
+		if (!rdp_send_data_pdu(rdp, s, DATA_PDU_TYPE_BITMAP_CACHE_PERSISTENT_LIST,
+		                       rdp->mcs->userId))
+			return FALSE;
+
+		for (index = 0; index < PERSIST_LIST_NUM_CELLS; index++)
+			first[index] += numEntries[index];
+
+		sent += count;
+	} while (sent < total);
+
+	if (total > 0)
+		WLog_DBG(TAG, "sent %" PRIu32 " persistent bitmap cache keys", total);
+
+	return TRUE;
 }
 
 BOOL rdp_recv_client_font_list_pdu(wStream* s)
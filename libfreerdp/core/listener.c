@@ -42,12 +42,33 @@
 #include <net/if.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define WITH_EVENT_LOOP_EPOLL
+#endif
+
 #include <winpr/handle.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/winsock.h>
+#include <winpr/collections.h>
+
+#include <freerdp/channels/wtsvc.h>
 
 #include "listener.h"
+#include "peer.h"
 
 #define TAG FREERDP_TAG("core.listener")
 
+#define EVENT_LOOP_MAX_THREADS 64
+#define EVENT_LOOP_MAX_EVENTS 64
+#define EVENT_LOOP_DRAIN_TIMEOUT 10
+#define EVENT_LOOP_HANDSHAKE_TIMEOUT 30000
+#define EVENT_LOOP_WATCHDOG_INTERVAL 100
+
+/* wakeup and stop event */
+#define EVENT_LOOP_RESERVED_HANDLES 2
+
 static BOOL freerdp_listener_open(freerdp_listener* instance, const char* bind_address, UINT16 port)
 {
 	int ai_flags = 0;
@@ -415,3 +436,1117 @@ void freerdp_listener_free(freerdp_listener* instance)
 		free(instance);
 	}
 }
+
+typedef struct rdp_event_loop_worker rdpEventLoopWorker;
+typedef struct rdp_event_loop_peer rdpEventLoopPeer;
+
+typedef struct
+{
+	HANDLE handle;
+	int fd;
+	psEventLoopHandleCallback callback;
+	void* arg;
+	rdpEventLoopPeer* peer;
+} rdpEventLoopSource;
+
+/* A peer or a listener served by one worker, guarded by the worker lock */
+struct rdp_event_loop_peer
+{
+	freerdp_peer* client;
+	freerdp_listener* listener;
+	rdpEventLoopWorker* worker;
+	psEventLoopPeerRemoved PeerRemoved;
+	void* arg;
+	HANDLE hServer;
+	BOOL closing;
+	BOOL writeBlocked;
+	rdpEventLoopSource* socket;
+	DWORD count;
+	rdpEventLoopSource sources[MAX_EVENT_LOOP_HANDLES];
+};
+
+/* A peer in the security handshake, served by a thread of its own until it is done */
+typedef struct
+{
+	freerdp_event_loop* loop;
+	freerdp_peer* client;
+	psEventLoopPeerRemoved PeerRemoved;
+	void* arg;
+	HANDLE thread;
+	UINT64 started;
+	BOOL aborted;
+	BOOL done;
+} rdpEventLoopHandshake;
+
+struct rdp_event_loop_worker
+{
+	freerdp_event_loop* loop;
+	HANDLE thread;
+	HANDLE wakeup;
+	CRITICAL_SECTION lock;
+	wArrayList* peers;
+	BOOL closing;
+	DWORD blocked;
+	DWORD count;
+#ifdef WITH_EVENT_LOOP_EPOLL
+	int epfd;
+#else
+	BOOL dirty;
+	DWORD nCount;
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	rdpEventLoopSource* sources[MAXIMUM_WAIT_OBJECTS];
+#endif
+};
+
+struct rdp_freerdp_event_loop
+{
+	CRITICAL_SECTION lock;
+	wHashTable* peers;
+	HANDLE stopEvent;
+	DWORD count;
+	rdpEventLoopWorker* workers;
+	wArrayList* handshakes;
+	HANDLE watchdog;
+	DWORD handshakeTimeout;
+};
+
+static BOOL event_loop_watch(rdpEventLoopWorker* worker, rdpEventLoopSource* source, BOOL add)
+{
+#ifdef WITH_EVENT_LOOP_EPOLL
+	struct epoll_event event = { 0 };
+	const rdpEventLoopPeer* peer = source->peer;
+	event.events = EPOLLIN;
+	event.data.ptr = source;
+
+	if ((peer->socket == source) && peer->writeBlocked)
+		event.events |= EPOLLOUT;
+
+	if (epoll_ctl(worker->epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, source->fd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl failed for fd %d: %s", source->fd, strerror(errno));
+		return FALSE;
+	}
+#else
+	if (add && (worker->count >= MAXIMUM_WAIT_OBJECTS - EVENT_LOOP_RESERVED_HANDLES))
+	{
+		WLog_ERR(TAG, "too many handles for an event loop thread");
+		return FALSE;
+	}
+
+	worker->dirty = TRUE;
+#endif
+
+	if (add)
+		worker->count++;
+
+	return TRUE;
+}
+
+static void event_loop_unwatch(rdpEventLoopWorker* worker, rdpEventLoopSource* source)
+{
+#ifdef WITH_EVENT_LOOP_EPOLL
+	struct epoll_event event = { 0 };
+
+	if (epoll_ctl(worker->epfd, EPOLL_CTL_DEL, source->fd, &event) < 0)
+		WLog_WARN(TAG, "epoll_ctl failed to remove fd %d: %s", source->fd, strerror(errno));
+#else
+	worker->dirty = TRUE;
+#endif
+	worker->count--;
+}
+
+/* Called with the worker lock held */
+static BOOL event_loop_peer_add_source(rdpEventLoopPeer* peer, HANDLE handle,
+                                       psEventLoopHandleCallback callback, void* arg)
+{
+	DWORD index;
+	rdpEventLoopSource* source = NULL;
+
+	for (index = 0; index < MAX_EVENT_LOOP_HANDLES; index++)
+	{
+		if (peer->sources[index].handle == handle)
+		{
+			WLog_ERR(TAG, "handle %p is already part of the event loop", handle);
+			return FALSE;
+		}
+
+		if (!source && !peer->sources[index].handle)
+			source = &peer->sources[index];
+	}
+
+	if (!source)
+	{
+		WLog_ERR(TAG, "too many handles for a peer, maximum is %d", MAX_EVENT_LOOP_HANDLES);
+		return FALSE;
+	}
+
+	source->fd = GetEventFileDescriptor(handle);
+#ifdef WITH_EVENT_LOOP_EPOLL
+
+	if (source->fd < 0)
+	{
+		WLog_ERR(TAG, "handle %p has no file descriptor", handle);
+		return FALSE;
+	}
+
+#endif
+	source->handle = handle;
+	source->callback = callback;
+	source->arg = arg;
+	source->peer = peer;
+
+	if (peer->client && (source->fd == peer->client->sockfd))
+		peer->socket = source;
+
+	if (!event_loop_watch(peer->worker, source, TRUE))
+	{
+		if (peer->socket == source)
+			peer->socket = NULL;
+
+		ZeroMemory(source, sizeof(rdpEventLoopSource));
+		return FALSE;
+	}
+
+	peer->count++;
+	return TRUE;
+}
+
+/* Called with the worker lock held */
+static void event_loop_peer_remove_source(rdpEventLoopPeer* peer, rdpEventLoopSource* source)
+{
+	event_loop_unwatch(peer->worker, source);
+
+	if (peer->socket == source)
+		peer->socket = NULL;
+
+	/* The slot stays valid for events already returned by the current wait */
+	source->handle = NULL;
+	source->callback = NULL;
+	source->arg = NULL;
+	peer->count--;
+}
+
+static void event_loop_peer_close(rdpEventLoopPeer* peer)
+{
+	rdpEventLoopWorker* worker = peer->worker;
+
+	if (!peer->closing)
+	{
+		peer->closing = TRUE;
+		worker->closing = TRUE;
+	}
+}
+
+/* The write interest of the socket follows the blocked state of the peer */
+static void event_loop_peer_update(rdpEventLoopPeer* peer)
+{
+	BOOL blocked;
+	freerdp_peer* client = peer->client;
+	rdpEventLoopWorker* worker = peer->worker;
+
+	if (!client || peer->closing)
+		return;
+
+	blocked = client->IsWriteBlocked(client);
+
+	if (blocked == peer->writeBlocked)
+		return;
+
+	EnterCriticalSection(&worker->lock);
+	peer->writeBlocked = blocked;
+
+	if (blocked)
+		worker->blocked++;
+	else
+		worker->blocked--;
+
+	if (peer->socket && !event_loop_watch(worker, peer->socket, FALSE))
+		event_loop_peer_close(peer);
+
+	LeaveCriticalSection(&worker->lock);
+}
+
+static void event_loop_peer_drain(rdpEventLoopPeer* peer)
+{
+	freerdp_peer* client = peer->client;
+
+	if (!client || peer->closing || !peer->writeBlocked)
+		return;
+
+	if (client->DrainOutputBuffer(client) < 0)
+	{
+		WLog_DBG(TAG, "failed to drain the output buffer of %s", client->hostname);
+		EnterCriticalSection(&peer->worker->lock);
+		event_loop_peer_close(peer);
+		LeaveCriticalSection(&peer->worker->lock);
+		return;
+	}
+
+	event_loop_peer_update(peer);
+}
+
+static void event_loop_dispatch(rdpEventLoopSource* source, BOOL readable, BOOL writable)
+{
+	void* arg;
+	HANDLE handle;
+	psEventLoopHandleCallback callback;
+	rdpEventLoopPeer* peer = source->peer;
+	rdpEventLoopWorker* worker = peer->worker;
+
+	if (writable)
+		event_loop_peer_drain(peer);
+
+	if (!readable)
+		return;
+
+	EnterCriticalSection(&worker->lock);
+	callback = peer->closing ? NULL : source->callback;
+	handle = source->handle;
+	arg = source->arg;
+	LeaveCriticalSection(&worker->lock);
+
+	if (!callback)
+		return;
+
+	if (!callback(peer->client, handle, arg))
+	{
+		EnterCriticalSection(&worker->lock);
+		event_loop_peer_close(peer);
+		LeaveCriticalSection(&worker->lock);
+		return;
+	}
+
+	event_loop_peer_update(peer);
+}
+
+static BOOL event_loop_check_peer(freerdp_peer* client, HANDLE handle, void* arg)
+{
+	rdpEventLoopPeer* peer = (rdpEventLoopPeer*)arg;
+	WINPR_UNUSED(handle);
+
+	if (!client->CheckFileDescriptor(client))
+	{
+		WLog_DBG(TAG, "failed to check the file descriptors of %s", client->hostname);
+		return FALSE;
+	}
+
+	if (peer->hServer && !WTSVirtualChannelManagerCheckFileDescriptor(peer->hServer))
+	{
+		WLog_DBG(TAG, "failed to check the channel manager of %s", client->hostname);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL event_loop_check_listener(freerdp_peer* client, HANDLE handle, void* arg)
+{
+	freerdp_listener* instance = (freerdp_listener*)arg;
+	WINPR_UNUSED(client);
+	WINPR_UNUSED(handle);
+
+	if (!instance->CheckFileDescriptor(instance))
+	{
+		WLog_ERR(TAG, "failed to check the listener file descriptors");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void event_loop_peer_detach(rdpEventLoopPeer* peer)
+{
+	DWORD index;
+	rdpEventLoopWorker* worker = peer->worker;
+
+	for (index = 0; index < MAX_EVENT_LOOP_HANDLES; index++)
+	{
+		if (peer->sources[index].handle)
+			event_loop_peer_remove_source(peer, &peer->sources[index]);
+	}
+
+	if (peer->writeBlocked)
+		worker->blocked--;
+
+	ArrayList_Remove(worker->peers, peer);
+}
+
+/* Takes closed peers off the worker, the callbacks are called without any lock held */
+static void event_loop_worker_close_peers(rdpEventLoopWorker* worker, BOOL all)
+{
+	int index;
+	wArrayList* closed;
+	freerdp_event_loop* loop = worker->loop;
+
+	if (!all && !worker->closing)
+		return;
+
+	/* Retried on the next wakeup */
+	if (!(closed = ArrayList_New(FALSE)))
+		return;
+
+	EnterCriticalSection(&loop->lock);
+	EnterCriticalSection(&worker->lock);
+	worker->closing = FALSE;
+
+	for (index = ArrayList_Count(worker->peers) - 1; index >= 0; index--)
+	{
+		rdpEventLoopPeer* peer = ArrayList_GetItem(worker->peers, index);
+
+		if (!all && !peer->closing)
+			continue;
+
+		if (ArrayList_Add(closed, peer) < 0)
+		{
+			worker->closing = TRUE;
+			break;
+		}
+
+		if (peer->client)
+			HashTable_Remove(loop->peers, peer->client);
+
+		event_loop_peer_detach(peer);
+	}
+
+	LeaveCriticalSection(&worker->lock);
+	LeaveCriticalSection(&loop->lock);
+
+	for (index = 0; index < ArrayList_Count(closed); index++)
+	{
+		rdpEventLoopPeer* peer = ArrayList_GetItem(closed, index);
+
+		if (peer->client)
+			IFCALL(peer->PeerRemoved, peer->client, peer->arg);
+
+		free(peer);
+	}
+
+	ArrayList_Free(closed);
+}
+
+#ifdef WITH_EVENT_LOOP_EPOLL
+
+static DWORD WINAPI event_loop_worker_thread(LPVOID arg)
+{
+	int index;
+	int status;
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	rdpEventLoopWorker* worker = (rdpEventLoopWorker*)arg;
+
+	while (WaitForSingleObject(worker->loop->stopEvent, 0) != WAIT_OBJECT_0)
+	{
+		status = epoll_wait(worker->epfd, events, ARRAYSIZE(events), -1);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_ERR(TAG, "epoll_wait failed: %s", strerror(errno));
+			break;
+		}
+
+		for (index = 0; index < status; index++)
+		{
+			const uint32_t revents = events[index].events;
+			rdpEventLoopSource* source = (rdpEventLoopSource*)events[index].data.ptr;
+
+			/* wakeup and stop event */
+			if (!source)
+			{
+				ResetEvent(worker->wakeup);
+				continue;
+			}
+
+			event_loop_dispatch(source, (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+			                    (revents & EPOLLOUT) != 0);
+		}
+
+		event_loop_worker_close_peers(worker, FALSE);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+#else
+
+/* Rebuilds the handle array after the set of handles changed */
+static void event_loop_worker_prepare(rdpEventLoopWorker* worker)
+{
+	int index;
+	DWORD x;
+
+	EnterCriticalSection(&worker->lock);
+
+	if (worker->dirty)
+	{
+		worker->dirty = FALSE;
+		worker->nCount = 0;
+		worker->handles[worker->nCount++] = worker->wakeup;
+		worker->handles[worker->nCount++] = worker->loop->stopEvent;
+
+		for (index = 0; index < ArrayList_Count(worker->peers); index++)
+		{
+			rdpEventLoopPeer* peer = ArrayList_GetItem(worker->peers, index);
+
+			for (x = 0; x < MAX_EVENT_LOOP_HANDLES; x++)
+			{
+				if (!peer->sources[x].handle)
+					continue;
+
+				worker->sources[worker->nCount] = &peer->sources[x];
+				worker->handles[worker->nCount++] = peer->sources[x].handle;
+			}
+		}
+	}
+
+	LeaveCriticalSection(&worker->lock);
+}
+
+/* Without write readiness blocked peers are drained on a short timeout */
+static void event_loop_worker_drain(rdpEventLoopWorker* worker)
+{
+	int index;
+	int count;
+
+	EnterCriticalSection(&worker->lock);
+	count = worker->blocked ? ArrayList_Count(worker->peers) : 0;
+	LeaveCriticalSection(&worker->lock);
+
+	/* Other threads only append, peers are removed by this thread */
+	for (index = 0; index < count; index++)
+	{
+		rdpEventLoopPeer* peer;
+		EnterCriticalSection(&worker->lock);
+		peer = ArrayList_GetItem(worker->peers, index);
+		LeaveCriticalSection(&worker->lock);
+		event_loop_peer_drain(peer);
+	}
+}
+
+static DWORD WINAPI event_loop_worker_thread(LPVOID arg)
+{
+	DWORD status;
+	rdpEventLoopWorker* worker = (rdpEventLoopWorker*)arg;
+
+	while (WaitForSingleObject(worker->loop->stopEvent, 0) != WAIT_OBJECT_0)
+	{
+		event_loop_worker_prepare(worker);
+		status = WaitForMultipleObjects(worker->nCount, worker->handles, FALSE,
+		                                worker->blocked ? EVENT_LOOP_DRAIN_TIMEOUT : INFINITE);
+
+		if (status == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitForMultipleObjects failed");
+			break;
+		}
+
+		if (status == WAIT_OBJECT_0)
+			ResetEvent(worker->wakeup);
+		else if ((status >= WAIT_OBJECT_0 + EVENT_LOOP_RESERVED_HANDLES) &&
+		         (status < WAIT_OBJECT_0 + worker->nCount))
+			event_loop_dispatch(worker->sources[status - WAIT_OBJECT_0], TRUE, FALSE);
+
+		event_loop_worker_drain(worker);
+		event_loop_worker_close_peers(worker, FALSE);
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+#endif
+
+static BOOL event_loop_worker_init(freerdp_event_loop* loop, rdpEventLoopWorker* worker)
+{
+#ifdef WITH_EVENT_LOOP_EPOLL
+	worker->epfd = -1;
+#endif
+
+	if (!InitializeCriticalSectionAndSpinCount(&worker->lock, 4000))
+		return FALSE;
+
+	worker->loop = loop;
+
+	if (!(worker->peers = ArrayList_New(FALSE)))
+		return FALSE;
+
+	if (!(worker->wakeup = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+#ifdef WITH_EVENT_LOOP_EPOLL
+	{
+		struct epoll_event event = { 0 };
+		event.events = EPOLLIN;
+		event.data.ptr = NULL;
+
+		if ((worker->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		{
+			WLog_ERR(TAG, "epoll_create1 failed: %s", strerror(errno));
+			return FALSE;
+		}
+
+		if ((epoll_ctl(worker->epfd, EPOLL_CTL_ADD, GetEventFileDescriptor(worker->wakeup),
+		               &event) < 0) ||
+		    (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, GetEventFileDescriptor(loop->stopEvent),
+		               &event) < 0))
+		{
+			WLog_ERR(TAG, "epoll_ctl failed: %s", strerror(errno));
+			return FALSE;
+		}
+	}
+#else
+	worker->dirty = TRUE;
+#endif
+
+	if (!(worker->thread = CreateThread(NULL, 0, event_loop_worker_thread, worker, 0, NULL)))
+		return FALSE;
+
+	return TRUE;
+}
+
+static void event_loop_worker_uninit(rdpEventLoopWorker* worker)
+{
+	if (worker->thread)
+		CloseHandle(worker->thread);
+
+	if (worker->peers)
+	{
+		event_loop_worker_close_peers(worker, TRUE);
+		ArrayList_Free(worker->peers);
+	}
+
+#ifdef WITH_EVENT_LOOP_EPOLL
+
+	if (worker->epfd >= 0)
+		close(worker->epfd);
+
+#endif
+
+	if (worker->wakeup)
+		CloseHandle(worker->wakeup);
+
+	if (worker->loop)
+		DeleteCriticalSection(&worker->lock);
+}
+
+/* Blocking TLS and NLA reads of the handshake fail once the socket is shut down */
+static void event_loop_handshake_abort(rdpEventLoopHandshake* handshake)
+{
+	if (handshake->done || handshake->aborted)
+		return;
+
+	handshake->aborted = TRUE;
+	shutdown(handshake->client->sockfd, SD_BOTH);
+}
+
+/* Aborts overdue handshakes and reaps the finished threads, called without the loop lock */
+static void event_loop_check_handshakes(freerdp_event_loop* loop, BOOL all)
+{
+	int index;
+	const UINT64 now = GetTickCount64();
+	EnterCriticalSection(&loop->lock);
+
+	for (index = ArrayList_Count(loop->handshakes) - 1; index >= 0; index--)
+	{
+		rdpEventLoopHandshake* handshake = ArrayList_GetItem(loop->handshakes, index);
+
+		if (all || (now - handshake->started >= loop->handshakeTimeout))
+			event_loop_handshake_abort(handshake);
+
+		if (WaitForSingleObject(handshake->thread, 0) == WAIT_OBJECT_0)
+		{
+			ArrayList_RemoveAt(loop->handshakes, index);
+			CloseHandle(handshake->thread);
+			free(handshake);
+		}
+	}
+
+	LeaveCriticalSection(&loop->lock);
+}
+
+static DWORD WINAPI event_loop_watchdog_thread(LPVOID arg)
+{
+	freerdp_event_loop* loop = (freerdp_event_loop*)arg;
+
+	while (WaitForSingleObject(loop->stopEvent, EVENT_LOOP_WATCHDOG_INTERVAL) == WAIT_TIMEOUT)
+		event_loop_check_handshakes(loop, FALSE);
+
+	ExitThread(0);
+	return 0;
+}
+
+static BOOL event_loop_add_client(freerdp_event_loop* loop, freerdp_peer* client,
+                                  psEventLoopPeerRemoved PeerRemoved, void* arg);
+
+/* TLS and NLA accept block, they run here and the peer joins a worker once they are done */
+static DWORD WINAPI event_loop_handshake_thread(LPVOID arg)
+{
+	DWORD count;
+	DWORD status;
+	BOOL rc = FALSE;
+	HANDLE handles[MAX_EVENT_LOOP_HANDLES + 1];
+	rdpEventLoopHandshake* handshake = (rdpEventLoopHandshake*)arg;
+	freerdp_event_loop* loop = handshake->loop;
+	freerdp_peer* client = handshake->client;
+
+	while (!freerdp_peer_is_handshake_done(client))
+	{
+		count = client->GetEventHandles(client, handles, MAX_EVENT_LOOP_HANDLES);
+
+		if (count == 0)
+			break;
+
+		handles[count++] = loop->stopEvent;
+		status = WaitForMultipleObjects(count, handles, FALSE, INFINITE);
+
+		if ((status == WAIT_FAILED) || (status == WAIT_OBJECT_0 + count - 1))
+			break;
+
+		if (!client->CheckFileDescriptor(client))
+		{
+			WLog_DBG(TAG, "security handshake with %s failed", client->hostname);
+			break;
+		}
+	}
+
+	EnterCriticalSection(&loop->lock);
+
+	if (freerdp_peer_is_handshake_done(client) && !handshake->aborted)
+		rc = event_loop_add_client(loop, client, handshake->PeerRemoved, handshake->arg);
+
+	handshake->done = TRUE;
+	LeaveCriticalSection(&loop->lock);
+
+	if (!rc)
+		IFCALL(handshake->PeerRemoved, client, handshake->arg);
+
+	ExitThread(0);
+	return 0;
+}
+
+/* Called with the loop lock held */
+static rdpEventLoopHandshake* event_loop_find_handshake(freerdp_event_loop* loop,
+                                                        freerdp_peer* client)
+{
+	int index;
+
+	for (index = 0; index < ArrayList_Count(loop->handshakes); index++)
+	{
+		rdpEventLoopHandshake* handshake = ArrayList_GetItem(loop->handshakes, index);
+
+		if ((handshake->client == client) && !handshake->done)
+			return handshake;
+	}
+
+	return NULL;
+}
+
+static BOOL event_loop_add_handshake(freerdp_event_loop* loop, freerdp_peer* client,
+                                     psEventLoopPeerRemoved PeerRemoved, void* arg)
+{
+	rdpEventLoopHandshake* handshake =
+	    (rdpEventLoopHandshake*)calloc(1, sizeof(rdpEventLoopHandshake));
+
+	if (!handshake)
+		return FALSE;
+
+	handshake->loop = loop;
+	handshake->client = client;
+	handshake->PeerRemoved = PeerRemoved;
+	handshake->arg = arg;
+	handshake->started = GetTickCount64();
+	EnterCriticalSection(&loop->lock);
+
+	if (HashTable_Contains(loop->peers, client) || event_loop_find_handshake(loop, client))
+	{
+		WLog_ERR(TAG, "peer %s is already part of the event loop", client->hostname);
+		goto fail;
+	}
+
+	if (ArrayList_Add(loop->handshakes, handshake) < 0)
+		goto fail;
+
+	/* The thread takes the loop lock before it touches the handshake */
+	if (!(handshake->thread =
+	          CreateThread(NULL, 0, event_loop_handshake_thread, handshake, 0, NULL)))
+	{
+		ArrayList_Remove(loop->handshakes, handshake);
+		goto fail;
+	}
+
+	LeaveCriticalSection(&loop->lock);
+	return TRUE;
+fail:
+	LeaveCriticalSection(&loop->lock);
+	free(handshake);
+	return FALSE;
+}
+
+freerdp_event_loop* freerdp_event_loop_new(DWORD threads)
+{
+	DWORD index;
+	freerdp_event_loop* loop;
+
+	if ((threads < 1) || (threads > EVENT_LOOP_MAX_THREADS))
+	{
+		WLog_ERR(TAG, "invalid number of event loop threads %" PRIu32, threads);
+		return NULL;
+	}
+
+	loop = (freerdp_event_loop*)calloc(1, sizeof(freerdp_event_loop));
+
+	if (!loop)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&loop->lock, 4000))
+	{
+		free(loop);
+		return NULL;
+	}
+
+	loop->workers = (rdpEventLoopWorker*)calloc(threads, sizeof(rdpEventLoopWorker));
+	loop->peers = HashTable_New(FALSE);
+	loop->handshakes = ArrayList_New(FALSE);
+	loop->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	loop->handshakeTimeout = EVENT_LOOP_HANDSHAKE_TIMEOUT;
+
+	if (!loop->workers || !loop->peers || !loop->handshakes || !loop->stopEvent)
+		goto fail;
+
+	if (!(loop->watchdog = CreateThread(NULL, 0, event_loop_watchdog_thread, loop, 0, NULL)))
+		goto fail;
+
+	for (index = 0; index < threads; index++)
+	{
+		loop->count++;
+
+		if (!event_loop_worker_init(loop, &loop->workers[index]))
+			goto fail;
+	}
+
+	return loop;
+fail:
+	WLog_ERR(TAG, "failed to create the event loop");
+	freerdp_event_loop_free(loop);
+	return NULL;
+}
+
+void freerdp_event_loop_free(freerdp_event_loop* loop)
+{
+	DWORD index;
+
+	if (!loop)
+		return;
+
+	if (loop->stopEvent)
+		SetEvent(loop->stopEvent);
+
+	for (index = 0; index < loop->count; index++)
+	{
+		if (loop->workers[index].thread)
+			WaitForSingleObject(loop->workers[index].thread, INFINITE);
+	}
+
+	if (loop->watchdog)
+	{
+		WaitForSingleObject(loop->watchdog, INFINITE);
+		CloseHandle(loop->watchdog);
+	}
+
+	/* Handshakes still running are aborted, done ones have joined a worker by now */
+	if (loop->handshakes)
+	{
+		event_loop_check_handshakes(loop, TRUE);
+
+		while (ArrayList_Count(loop->handshakes) > 0)
+		{
+			rdpEventLoopHandshake* handshake = ArrayList_GetItem(loop->handshakes, 0);
+			WaitForSingleObject(handshake->thread, INFINITE);
+			event_loop_check_handshakes(loop, TRUE);
+		}
+	}
+
+	/* Peers still on the loop are removed on this thread once all workers stopped */
+	for (index = 0; index < loop->count; index++)
+		event_loop_worker_uninit(&loop->workers[index]);
+
+	if (loop->stopEvent)
+		CloseHandle(loop->stopEvent);
+
+	HashTable_Free(loop->peers);
+	ArrayList_Free(loop->handshakes);
+	free(loop->workers);
+	DeleteCriticalSection(&loop->lock);
+	free(loop);
+}
+
+/* The worker serving the fewest handles, called with the loop lock held */
+static rdpEventLoopWorker* event_loop_next_worker(freerdp_event_loop* loop)
+{
+	DWORD index;
+	rdpEventLoopWorker* worker = &loop->workers[0];
+
+	for (index = 1; index < loop->count; index++)
+	{
+		if (loop->workers[index].count < worker->count)
+			worker = &loop->workers[index];
+	}
+
+	return worker;
+}
+
+static rdpEventLoopPeer* event_loop_add(freerdp_event_loop* loop, freerdp_peer* client,
+                                        freerdp_listener* instance, HANDLE* handles,
+                                        DWORD count, psEventLoopHandleCallback callback,
+                                        void* arg)
+{
+	DWORD index;
+	rdpEventLoopWorker* worker;
+	rdpEventLoopPeer* peer = (rdpEventLoopPeer*)calloc(1, sizeof(rdpEventLoopPeer));
+
+	if (!peer)
+		return NULL;
+
+	peer->client = client;
+	peer->listener = instance;
+	EnterCriticalSection(&loop->lock);
+
+	if (client && HashTable_Contains(loop->peers, client))
+	{
+		WLog_ERR(TAG, "peer %s is already part of the event loop", client->hostname);
+		goto fail;
+	}
+
+	worker = event_loop_next_worker(loop);
+	peer->worker = worker;
+	EnterCriticalSection(&worker->lock);
+
+	if (ArrayList_Add(worker->peers, peer) < 0)
+	{
+		LeaveCriticalSection(&worker->lock);
+		goto fail;
+	}
+
+	for (index = 0; index < count; index++)
+	{
+		if (!event_loop_peer_add_source(peer, handles[index], callback, arg ? arg : peer))
+		{
+			event_loop_peer_detach(peer);
+			LeaveCriticalSection(&worker->lock);
+			goto fail;
+		}
+	}
+
+	LeaveCriticalSection(&worker->lock);
+
+	if (client && (HashTable_Add(loop->peers, client, peer) < 0))
+	{
+		EnterCriticalSection(&worker->lock);
+		event_loop_peer_detach(peer);
+		LeaveCriticalSection(&worker->lock);
+		goto fail;
+	}
+
+	LeaveCriticalSection(&loop->lock);
+	SetEvent(worker->wakeup);
+	return peer;
+fail:
+	LeaveCriticalSection(&loop->lock);
+	free(peer);
+	return NULL;
+}
+
+BOOL freerdp_event_loop_add_listener(freerdp_event_loop* loop, freerdp_listener* instance)
+{
+	DWORD count;
+	HANDLE handles[MAX_LISTENER_HANDLES];
+
+	if (!loop || !instance)
+		return FALSE;
+
+	count = instance->GetEventHandles(instance, handles, ARRAYSIZE(handles));
+
+	if (count == 0)
+	{
+		WLog_ERR(TAG, "the listener has no event handles");
+		return FALSE;
+	}
+
+	return event_loop_add(loop, NULL, instance, handles, count, event_loop_check_listener,
+	                      instance) != NULL;
+}
+
+static BOOL event_loop_add_client(freerdp_event_loop* loop, freerdp_peer* client,
+                                  psEventLoopPeerRemoved PeerRemoved, void* arg)
+{
+	DWORD count;
+	rdpEventLoopPeer* peer;
+	HANDLE handles[MAX_EVENT_LOOP_HANDLES];
+
+	count = client->GetEventHandles(client, handles, ARRAYSIZE(handles));
+
+	if (count == 0)
+	{
+		WLog_ERR(TAG, "failed to get the event handles of %s", client->hostname);
+		return FALSE;
+	}
+
+	/* The callbacks are set before the first event can be dispatched */
+	EnterCriticalSection(&loop->lock);
+	peer = event_loop_add(loop, client, NULL, handles, count, event_loop_check_peer, NULL);
+
+	if (peer)
+	{
+		peer->PeerRemoved = PeerRemoved;
+		peer->arg = arg;
+	}
+
+	LeaveCriticalSection(&loop->lock);
+	return peer != NULL;
+}
+
+BOOL freerdp_event_loop_add_peer(freerdp_event_loop* loop, freerdp_peer* client,
+                                 psEventLoopPeerRemoved PeerRemoved, void* arg)
+{
+	if (!loop || !client || !client->context)
+		return FALSE;
+
+	if (!freerdp_peer_is_handshake_done(client))
+		return event_loop_add_handshake(loop, client, PeerRemoved, arg);
+
+	return event_loop_add_client(loop, client, PeerRemoved, arg);
+}
+
+BOOL freerdp_event_loop_set_handshake_timeout(freerdp_event_loop* loop, DWORD timeout)
+{
+	if (!loop || (timeout == 0))
+		return FALSE;
+
+	EnterCriticalSection(&loop->lock);
+	loop->handshakeTimeout = timeout;
+	LeaveCriticalSection(&loop->lock);
+	return TRUE;
+}
+
+/* Looks up a peer and locks its worker, called with the loop lock held */
+static rdpEventLoopPeer* event_loop_find(freerdp_event_loop* loop, freerdp_peer* client)
+{
+	rdpEventLoopPeer* peer = (rdpEventLoopPeer*)HashTable_GetItemValue(loop->peers, client);
+
+	if (!peer)
+		return NULL;
+
+	EnterCriticalSection(&peer->worker->lock);
+	return peer;
+}
+
+BOOL freerdp_event_loop_add_channel_manager(freerdp_event_loop* loop, freerdp_peer* client,
+                                            HANDLE hServer)
+{
+	BOOL rc = FALSE;
+	HANDLE handle;
+	rdpEventLoopPeer* peer;
+
+	if (!loop || !client || !hServer)
+		return FALSE;
+
+	if (!(handle = WTSVirtualChannelManagerGetEventHandle(hServer)))
+		return FALSE;
+
+	EnterCriticalSection(&loop->lock);
+
+	if ((peer = event_loop_find(loop, client)))
+	{
+		if (peer->hServer)
+			WLog_ERR(TAG, "peer %s already has a channel manager", client->hostname);
+		else if ((rc = event_loop_peer_add_source(peer, handle, event_loop_check_peer, peer)))
+			peer->hServer = hServer;
+
+		LeaveCriticalSection(&peer->worker->lock);
+	}
+
+	LeaveCriticalSection(&loop->lock);
+	return rc;
+}
+
+BOOL freerdp_event_loop_add_handle(freerdp_event_loop* loop, freerdp_peer* client, HANDLE handle,
+                                   psEventLoopHandleCallback callback, void* arg)
+{
+	BOOL rc = FALSE;
+	rdpEventLoopPeer* peer;
+
+	if (!loop || !client || !handle || !callback)
+		return FALSE;
+
+	EnterCriticalSection(&loop->lock);
+
+	if ((peer = event_loop_find(loop, client)))
+	{
+		rc = event_loop_peer_add_source(peer, handle, callback, arg);
+		LeaveCriticalSection(&peer->worker->lock);
+	}
+
+	LeaveCriticalSection(&loop->lock);
+	return rc;
+}
+
+BOOL freerdp_event_loop_remove_handle(freerdp_event_loop* loop, freerdp_peer* client,
+                                      HANDLE handle)
+{
+	DWORD index;
+	BOOL rc = FALSE;
+	rdpEventLoopPeer* peer;
+
+	if (!loop || !client || !handle)
+		return FALSE;
+
+	EnterCriticalSection(&loop->lock);
+
+	if ((peer = event_loop_find(loop, client)))
+	{
+		for (index = 0; index < MAX_EVENT_LOOP_HANDLES; index++)
+		{
+			if (peer->sources[index].handle == handle)
+			{
+				event_loop_peer_remove_source(peer, &peer->sources[index]);
+				rc = TRUE;
+				break;
+			}
+		}
+
+		LeaveCriticalSection(&peer->worker->lock);
+	}
+
+	LeaveCriticalSection(&loop->lock);
+	return rc;
+}
+
+BOOL freerdp_event_loop_remove_peer(freerdp_event_loop* loop, freerdp_peer* client)
+{
+	BOOL rc = FALSE;
+	rdpEventLoopPeer* peer;
+	rdpEventLoopHandshake* handshake;
+
+	if (!loop || !client)
+		return FALSE;
+
+	EnterCriticalSection(&loop->lock);
+
+	if ((peer = event_loop_find(loop, client)))
+	{
+		event_loop_peer_close(peer);
+		LeaveCriticalSection(&peer->worker->lock);
+		SetEvent(peer->worker->wakeup);
+		rc = TRUE;
+	}
+	else if ((handshake = event_loop_find_handshake(loop, client)))
+	{
+		event_loop_handshake_abort(handshake);
+		rc = TRUE;
+	}
+
+	LeaveCriticalSection(&loop->lock);
+	return rc;
+}
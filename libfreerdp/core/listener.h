@@ -30,6 +30,7 @@ typedef struct rdp_listener rdpListener;
 #include <freerdp/listener.h>
 
 #define MAX_LISTENER_HANDLES 5
+#define MAX_EVENT_LOOP_HANDLES 16
 
 struct rdp_listener
 {
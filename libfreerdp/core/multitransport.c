@@ -21,6 +21,8 @@
 #include "config.h"
 #endif
 
+#include <winpr/error.h>
+
 #include "multitransport.h"
 
 int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s)
@@ -29,6 +31,10 @@ int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s)
 	UINT16 requestedProtocol;
 	UINT16 reserved;
 	BYTE securityCookie[16];
+	rdpMultitransport* multitransport;
+
+	if (!rdp || !rdp->multitransport)
+		return -1;
 
 	if (Stream_GetRemainingLength(s) < 24)
 		return -1;
@@ -37,10 +43,42 @@ int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s)
 	Stream_Read_UINT16(s, requestedProtocol); /* requestedProtocol (2 bytes) */
 	Stream_Read_UINT16(s, reserved);          /* reserved (2 bytes) */
 	Stream_Read(s, securityCookie, 16);       /* securityCookie (16 bytes) */
+	multitransport = rdp->multitransport;
+	multitransport->requestId = requestId;
+	multitransport->requestedProtocol = requestedProtocol;
+	CopyMemory(multitransport->securityCookie, securityCookie, 16);
+	WLog_DBG(MULTITRANSPORT_TAG,
+	         "Initiate Multitransport Request: id %" PRIu32 " protocol 0x%04" PRIX16, requestId,
+	         requestedProtocol);
+
+	/**
+	 * The sideband channel needs a TLS (reliable) or DTLS (lossy) secured tunnel over RDP-UDP,
+	 * which is not implemented. Decline so the server keeps all traffic on the main connection
+	 * instead of waiting for the tunnel to come up.
+	 */
+	if (!rdp_send_multitransport_response(rdp, requestId, E_ABORT))
+		return -1;
 
 	return 0;
 }
 
+BOOL rdp_send_multitransport_response(rdpRdp* rdp, UINT32 requestId, HRESULT hrResponse)
+{
+	wStream* s;
+
+	if (!rdp)
+		return FALSE;
+
+	s = rdp_message_channel_pdu_init(rdp);
+
+	if (!s)
+		return FALSE;
+
+	Stream_Write_UINT32(s, requestId);          /* requestId (4 bytes) */
+	Stream_Write_UINT32(s, (UINT32)hrResponse); /* hrResponse (4 bytes) */
+	return rdp_send_message_channel_pdu(rdp, s, SEC_TRANSPORT_RSP);
+}
+
 rdpMultitransport* multitransport_new(void)
 {
 	return (rdpMultitransport*)calloc(1, sizeof(rdpMultitransport));
@@ -25,18 +25,25 @@ typedef struct rdp_multitransport rdpMultitransport;
 #include "rdp.h"
 
 #include <freerdp/freerdp.h>
+#include <freerdp/log.h>
 #include <freerdp/api.h>
 
 #include <winpr/stream.h>
 
 struct rdp_multitransport
 {
-	UINT32 placeholder;
+	UINT32 requestId;
+	UINT16 requestedProtocol;
+	BYTE securityCookie[16];
 };
 
 FREERDP_LOCAL int rdp_recv_multitransport_packet(rdpRdp* rdp, wStream* s);
+FREERDP_LOCAL BOOL rdp_send_multitransport_response(rdpRdp* rdp, UINT32 requestId,
+                                                    HRESULT hrResponse);
 
 FREERDP_LOCAL rdpMultitransport* multitransport_new(void);
 FREERDP_LOCAL void multitransport_free(rdpMultitransport* multitransport);
 
+#define MULTITRANSPORT_TAG FREERDP_TAG("core.multitransport")
+
 #endif /* FREERDP_LIB_CORE_MULTITRANSPORT_H */
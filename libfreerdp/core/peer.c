@@ -746,6 +746,12 @@ static BOOL freerdp_peer_has_more_to_read(freerdp_peer* peer)
 	return peer->context->rdp->transport->haveMoreBytesToRead;
 }
 
+BOOL freerdp_peer_is_handshake_done(freerdp_peer* client)
+{
+	const rdpRdp* rdp = client->context->rdp;
+	return rdp->state > CONNECTION_STATE_INITIAL;
+}
+
 static LicenseCallbackResult freerdp_peer_nolicense(freerdp_peer* peer, wStream* s)
 {
 	rdpRdp* rdp = peer->context->rdp;
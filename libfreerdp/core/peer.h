@@ -26,4 +26,7 @@
 
 #include <freerdp/peer.h>
 
+/* The security protocol was negotiated, TLS and NLA completed if selected */
+FREERDP_LOCAL BOOL freerdp_peer_is_handshake_done(freerdp_peer* client);
+
 #endif /* FREERDP_LIB_CORE_PEER_H */
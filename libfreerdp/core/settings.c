@@ -521,6 +521,7 @@ rdpSettings* freerdp_settings_new(DWORD flags)
 	settings->GfxH264 = FALSE;
 	settings->GfxAVC444 = FALSE;
 	settings->GfxSendQoeAck = FALSE;
+	settings->GfxDecodeThreads = 0;
 	settings->ClientAutoReconnectCookie =
 	    (ARC_CS_PRIVATE_PACKET*)calloc(1, sizeof(ARC_CS_PRIVATE_PACKET));
 
@@ -613,6 +614,7 @@ rdpSettings* freerdp_settings_new(DWORD flags)
 	settings->ActionScript = _strdup("~/.config/freerdp/action.sh");
 	settings->SmartcardLogon = FALSE;
 	settings->TlsSecLevel = 1;
+	settings->TlsKernelOffload = FALSE;
 	settings->OrderSupport = calloc(1, 32);
 
 	if (!settings->OrderSupport)
@@ -725,6 +727,7 @@ static void freerdp_settings_free_internal(rdpSettings* settings)
 	free(settings->RemoteApplicationGuid);
 	free(settings->RemoteApplicationCmdLine);
 	free(settings->ImeFileName);
+	free(settings->BitmapCachePersistFile);
 	free(settings->DrivesToRedirect);
 	free(settings->WindowTitle);
 	free(settings->WmClass);
@@ -816,6 +819,7 @@ BOOL freerdp_settings_copy(rdpSettings* _settings, const rdpSettings* settings)
 	CHECKED_STRDUP(RemoteApplicationFile);        /* 2116 */
 	CHECKED_STRDUP(RemoteApplicationGuid);        /* 2117 */
 	CHECKED_STRDUP(RemoteApplicationCmdLine);     /* 2118 */
+	CHECKED_STRDUP(BitmapCachePersistFile);       /* 2503 */
 	CHECKED_STRDUP(ImeFileName);                  /* 2628 */
 	CHECKED_STRDUP(DrivesToRedirect);             /* 4290 */
 	CHECKED_STRDUP(ActionScript);
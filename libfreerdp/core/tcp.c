@@ -40,6 +40,7 @@
 #include <netinet/tcp.h>
 #include <net/if.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
 #ifdef HAVE_POLL_H
@@ -136,6 +137,60 @@ static int transport_bio_simple_write(BIO* bio, const char* buf, int size)
 	return status;
 }
 
+static int transport_bio_simple_writev(BIO* bio, const DataChunk* chunks, int count)
+{
+	int i;
+	int error;
+	int status;
+	WINPR_BIO_SIMPLE_SOCKET* ptr = (WINPR_BIO_SIMPLE_SOCKET*)BIO_get_data(bio);
+#ifdef _WIN32
+	DWORD sent = 0;
+	WSABUF buffers[BIO_WRITEV_MAX_CHUNKS];
+#else
+	struct iovec buffers[BIO_WRITEV_MAX_CHUNKS];
+#endif
+
+	if (!chunks || (count < 1) || (count > BIO_WRITEV_MAX_CHUNKS))
+		return -1;
+
+	BIO_clear_flags(bio, BIO_FLAGS_WRITE);
+
+	for (i = 0; i < count; i++)
+	{
+#ifdef _WIN32
+		buffers[i].buf = (CHAR*)chunks[i].data;
+		buffers[i].len = (ULONG)chunks[i].size;
+#else
+		buffers[i].iov_base = (void*)chunks[i].data;
+		buffers[i].iov_len = chunks[i].size;
+#endif
+	}
+
+#ifdef _WIN32
+	status = (WSASend(ptr->socket, buffers, (DWORD)count, &sent, 0, NULL, NULL) == 0) ? (int)sent
+	                                                                                  : -1;
+#else
+	status = (int)writev(ptr->socket, buffers, count);
+#endif
+
+	if (status <= 0)
+	{
+		error = WSAGetLastError();
+
+		if ((error == WSAEWOULDBLOCK) || (error == WSAEINTR) || (error == WSAEINPROGRESS) ||
+		    (error == WSAEALREADY))
+		{
+			BIO_set_flags(bio, (BIO_FLAGS_WRITE | BIO_FLAGS_SHOULD_RETRY));
+		}
+		else
+		{
+			BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+		}
+	}
+
+	return status;
+}
+
 static int transport_bio_simple_read(BIO* bio, char* buf, int size)
 {
 	int error;
@@ -312,6 +367,10 @@ static long transport_bio_simple_ctrl(BIO* bio, int cmd, long arg1, void* arg2)
 
 			break;
 
+		case BIO_C_WRITEV:
+			status = transport_bio_simple_writev(bio, (const DataChunk*)arg2, (int)arg1);
+			break;
+
 		case BIO_C_GET_FD:
 			if (BIO_get_init(bio))
 			{
@@ -465,63 +524,93 @@ static long transport_bio_buffered_callback(BIO* bio, int mode, const char* argp
 	return 1;
 }
 
+/* Sends as much of the chunks as the next BIO takes with a single call */
+static int transport_bio_buffered_send(BIO* next_bio, const DataChunk* chunks, int count)
+{
+	if ((count > 1) && (BIO_method_type(next_bio) == BIO_TYPE_SIMPLE))
+		return BIO_writev(next_bio, chunks, count);
+
+	return BIO_write(next_bio, chunks[0].data, chunks[0].size);
+}
+
 static int transport_bio_buffered_write(BIO* bio, const char* buf, int num)
 {
-	int i, ret;
+	int i;
+	int ret;
 	int status;
 	int nchunks;
-	int committedBytes;
-	DataChunk chunks[2];
+	size_t pending;
+	size_t committedBytes;
+	DataChunk chunks[BIO_WRITEV_MAX_CHUNKS];
 	WINPR_BIO_BUFFERED_SOCKET* ptr = (WINPR_BIO_BUFFERED_SOCKET*)BIO_get_data(bio);
 	BIO* next_bio = NULL;
 	ret = num;
 	ptr->writeBlocked = FALSE;
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE);
 
-	/* we directly append extra bytes in the xmit buffer, this could be prevented
-	 * but for now it makes the code more simple.
+	/* The queued bytes and the new data are sent with one gather write, the new
+	 * data is only copied to the xmit buffer if the socket does not take it all.
 	 */
-	if (buf && num && !ringbuffer_write(&ptr->xmitBuffer, (const BYTE*)buf, num))
+	pending = ringbuffer_used(&ptr->xmitBuffer);
+	nchunks = ringbuffer_peek(&ptr->xmitBuffer, chunks, pending);
+
+	if (buf && (num > 0))
 	{
-		WLog_ERR(TAG, "an error occurred when writing (num: %d)", num);
-		return -1;
+		chunks[nchunks].data = (const BYTE*)buf;
+		chunks[nchunks].size = (size_t)num;
+		nchunks++;
 	}
 
 	committedBytes = 0;
-	nchunks = ringbuffer_peek(&ptr->xmitBuffer, chunks, ringbuffer_used(&ptr->xmitBuffer));
 	next_bio = BIO_next(bio);
+	i = 0;
 
-	for (i = 0; i < nchunks; i++)
+	while (i < nchunks)
 	{
-		while (chunks[i].size)
-		{
-			status = BIO_write(next_bio, chunks[i].data, chunks[i].size);
+		status = transport_bio_buffered_send(next_bio, &chunks[i], nchunks - i);
 
-			if (status <= 0)
+		if (status <= 0)
+		{
+			if (!BIO_should_retry(next_bio))
 			{
-				if (!BIO_should_retry(next_bio))
-				{
-					BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
-					ret = -1; /* fatal error */
-					goto out;
-				}
-
-				if (BIO_should_write(next_bio))
-				{
-					BIO_set_flags(bio, BIO_FLAGS_WRITE);
-					ptr->writeBlocked = TRUE;
-					goto out; /* EWOULDBLOCK */
-				}
+				BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+				ret = -1; /* fatal error */
+				goto out;
 			}
 
-			committedBytes += status;
-			chunks[i].size -= status;
-			chunks[i].data += status;
+			BIO_set_flags(bio, BIO_FLAGS_WRITE);
+			ptr->writeBlocked = TRUE;
+			goto out; /* EWOULDBLOCK */
+		}
+
+		committedBytes += (size_t)status;
+
+		while ((status > 0) && (i < nchunks))
+		{
+			const size_t size = MIN((size_t)status, chunks[i].size);
+			chunks[i].data += size;
+			chunks[i].size -= size;
+			status -= (int)size;
+
+			if (chunks[i].size == 0)
+				i++;
 		}
 	}
 
 out:
-	ringbuffer_commit_read_bytes(&ptr->xmitBuffer, committedBytes);
+	ringbuffer_commit_read_bytes(&ptr->xmitBuffer, MIN(committedBytes, pending));
+
+	if ((ret > 0) && buf && (committedBytes < pending + (size_t)num))
+	{
+		const size_t sent = (committedBytes > pending) ? committedBytes - pending : 0;
+
+		if (!ringbuffer_write(&ptr->xmitBuffer, (const BYTE*)&buf[sent], (size_t)num - sent))
+		{
+			WLog_ERR(TAG, "an error occurred when writing (num: %d)", num);
+			return -1;
+		}
+	}
+
 	return ret;
 }
 
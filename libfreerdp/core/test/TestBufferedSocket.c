@@ -0,0 +1,133 @@
+#include <winpr/crt.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../tcp.h"
+
+#define TEST_TOTAL (4 * 1024 * 1024)
+#define TEST_SIZES 5
+
+static BYTE test_byte(size_t offset)
+{
+	return (BYTE)((offset * 2654435761u) >> 13);
+}
+
+static BIO* test_buffered_bio(int fd)
+{
+	BIO* socketBio = BIO_new(BIO_s_simple_socket());
+	BIO* bufferedBio = BIO_new(BIO_s_buffered_socket());
+
+	if (!socketBio || !bufferedBio)
+	{
+		BIO_free(socketBio);
+		BIO_free(bufferedBio);
+		return NULL;
+	}
+
+	BIO_set_fd(socketBio, fd, BIO_CLOSE);
+	bufferedBio = BIO_push(bufferedBio, socketBio);
+	BIO_set_nonblock(bufferedBio, TRUE);
+	return bufferedBio;
+}
+
+/* Reads what is available and checks it continues the written sequence */
+static BOOL test_receive(int fd, size_t* received)
+{
+	ssize_t x;
+	BYTE buffer[65536];
+	const ssize_t status = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+	if (status < 0)
+		return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+
+	for (x = 0; x < status; x++)
+	{
+		if (buffer[x] != test_byte(*received + x))
+		{
+			printf("mismatch at offset %" PRIuz "\n", *received + x);
+			return FALSE;
+		}
+	}
+
+	*received += status;
+	return TRUE;
+}
+
+int TestBufferedSocket(int argc, char* argv[])
+{
+	int fds[2];
+	int rc = -1;
+	size_t x;
+	size_t written = 0;
+	size_t received = 0;
+	size_t rounds = 0;
+	BOOL blocked = FALSE;
+	BYTE* data = NULL;
+	BIO* bio = NULL;
+	/* small PDUs and writes larger than the socket buffer */
+	const size_t sizes[TEST_SIZES] = { 13, 1000, 16413, 70000, 3 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		return -1;
+
+	if (!(data = malloc(TEST_TOTAL)) || !(bio = test_buffered_bio(fds[0])))
+		goto out;
+
+	for (x = 0; x < TEST_TOTAL; x++)
+		data[x] = test_byte(x);
+
+	/* Nobody reads, the socket fills up and the rest is queued in order */
+	for (x = 0; written < TEST_TOTAL / 2; x++)
+	{
+		const size_t size = MIN(sizes[x % TEST_SIZES], TEST_TOTAL / 2 - written);
+
+		if (BIO_write(bio, &data[written], (int)size) != (int)size)
+			goto out;
+
+		written += size;
+		blocked |= BIO_write_blocked(bio);
+	}
+
+	if (!blocked || (BIO_wpending(bio) <= 0))
+	{
+		printf("expected queued data, blocked=%d pending=%d\n", blocked, BIO_wpending(bio));
+		goto out;
+	}
+
+	/* New writes go out behind the queued data while the peer drains the socket */
+	for (x = 0; received < TEST_TOTAL; x++)
+	{
+		if (written < TEST_TOTAL)
+		{
+			const size_t size = MIN(sizes[x % TEST_SIZES], TEST_TOTAL - written);
+
+			if (BIO_write(bio, &data[written], (int)size) != (int)size)
+				goto out;
+
+			written += size;
+		}
+		else if (BIO_flush(bio) < 1)
+			goto out;
+
+		if (!test_receive(fds[1], &received) || (++rounds > 10 * TEST_TOTAL))
+			goto out;
+	}
+
+	if ((BIO_wpending(bio) != 0) || BIO_write_blocked(bio))
+		goto out;
+
+	rc = 0;
+out:
+	if (rc != 0)
+		printf("written %" PRIuz " received %" PRIuz "\n", written, received);
+
+	BIO_free_all(bio);
+	close(fds[1]);
+	free(data);
+	return rc;
+}
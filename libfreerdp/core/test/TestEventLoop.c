@@ -0,0 +1,366 @@
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/winsock.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <freerdp/peer.h>
+#include <freerdp/listener.h>
+
+#include "../listener.h"
+
+#define TEST_PEERS 200
+#define TEST_THREADS 2
+#define TEST_TIMEOUT 20000
+
+typedef struct
+{
+	freerdp_event_loop* loop;
+	CRITICAL_SECTION lock;
+	DWORD threads[TEST_THREADS];
+	size_t nthreads;
+	LONG accepted;
+	LONG removed;
+	BOOL checkThreads;
+	BOOL failed;
+} TEST_EVENT_LOOP;
+
+/* X.224 Connection Request asking for standard RDP security */
+static const BYTE test_connection_request[] = { 0x03, 0x00, 0x00, 0x13, 0x0e, 0xe0, 0x00,
+	                                            0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x08,
+	                                            0x00, 0x00, 0x00, 0x00, 0x00 };
+
+/* The same asking for TLS, the server then waits for the TLS Client Hello */
+static const BYTE test_tls_request[] = { 0x03, 0x00, 0x00, 0x13, 0x0e, 0xe0, 0x00,
+	                                     0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x08,
+	                                     0x00, 0x01, 0x00, 0x00, 0x00 };
+
+/* Remembers which threads called back, there must not be more than the loop has */
+static void test_thread_seen(TEST_EVENT_LOOP* state)
+{
+	size_t x;
+	const DWORD id = GetCurrentThreadId();
+
+	EnterCriticalSection(&state->lock);
+
+	for (x = 0; x < state->nthreads; x++)
+	{
+		if (state->threads[x] == id)
+			break;
+	}
+
+	if (x == state->nthreads)
+	{
+		if (state->nthreads < TEST_THREADS)
+			state->threads[state->nthreads++] = id;
+		else
+		{
+			printf("callback on more than %d threads\n", TEST_THREADS);
+			state->failed = TRUE;
+		}
+	}
+
+	LeaveCriticalSection(&state->lock);
+}
+
+static void test_peer_removed(freerdp_peer* client, void* arg)
+{
+	TEST_EVENT_LOOP* state = (TEST_EVENT_LOOP*)arg;
+
+	if (state->checkThreads)
+		test_thread_seen(state);
+
+	client->Disconnect(client);
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+	InterlockedIncrement(&state->removed);
+}
+
+static BOOL test_peer_accepted(freerdp_listener* instance, freerdp_peer* client)
+{
+	TEST_EVENT_LOOP* state = (TEST_EVENT_LOOP*)instance->info;
+
+	test_thread_seen(state);
+
+	if (!freerdp_peer_context_new(client))
+		return FALSE;
+
+	if (!freerdp_settings_set_string(client->settings, FreeRDP_RdpKeyFile,
+	                                 TESTING_SRC_DIRECTORY "/server/Sample/server.key") ||
+	    !freerdp_settings_set_string(client->settings, FreeRDP_PrivateKeyFile,
+	                                 TESTING_SRC_DIRECTORY "/server/Sample/server.key") ||
+	    !freerdp_settings_set_string(client->settings, FreeRDP_CertificateFile,
+	                                 TESTING_SRC_DIRECTORY "/server/Sample/server.crt") ||
+	    !client->Initialize(client) ||
+	    !freerdp_event_loop_add_peer(state->loop, client, test_peer_removed, state))
+	{
+		freerdp_peer_context_free(client);
+		return FALSE;
+	}
+
+	InterlockedIncrement(&state->accepted);
+	return TRUE;
+}
+
+static BOOL test_wait_for(volatile LONG* value, LONG expected)
+{
+	DWORD waited;
+
+	for (waited = 0; waited < TEST_TIMEOUT; waited += 10)
+	{
+		if (*value == expected)
+			return TRUE;
+
+		Sleep(10);
+	}
+
+	printf("timed out with %" PRId32 " of %" PRId32 "\n", *value, expected);
+	return FALSE;
+}
+
+static int test_connect(UINT16 port)
+{
+	struct sockaddr_in addr = { 0 };
+	struct timeval timeout = { TEST_TIMEOUT / 1000, 0 };
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Every peer answers the connection request with an X.224 Connection Confirm */
+static BOOL test_negotiate_request(int fd, const BYTE* request, size_t length)
+{
+	BYTE response[19];
+	size_t received = 0;
+
+	if (send(fd, request, length, 0) != (ssize_t)length)
+		return FALSE;
+
+	while (received < sizeof(response))
+	{
+		const ssize_t status = recv(fd, &response[received], sizeof(response) - received, 0);
+
+		if (status <= 0)
+		{
+			printf("recv failed: %s\n", (status < 0) ? strerror(errno) : "closed");
+			return FALSE;
+		}
+
+		received += (size_t)status;
+	}
+
+	return (response[0] == 0x03) && ((response[5] & 0xF0) == 0xD0);
+}
+
+static BOOL test_negotiate(int fd)
+{
+	return test_negotiate_request(fd, test_connection_request, sizeof(test_connection_request));
+}
+
+static BOOL test_listen(TEST_EVENT_LOOP* state, freerdp_listener** pInstance, UINT16* port)
+{
+	struct sockaddr_in addr = { 0 };
+	socklen_t length = sizeof(addr);
+	rdpListener* listener;
+	freerdp_listener* instance = freerdp_listener_new();
+
+	if (!(*pInstance = instance))
+		return FALSE;
+
+	instance->info = state;
+	instance->PeerAccepted = test_peer_accepted;
+	listener = (rdpListener*)instance->listener;
+
+	if (!instance->Open(instance, "127.0.0.1", 0) ||
+	    (getsockname(listener->sockfds[0], (struct sockaddr*)&addr, &length) != 0))
+		return FALSE;
+
+	*port = ntohs(addr.sin_port);
+	return freerdp_event_loop_add_listener(state->loop, instance);
+}
+
+static void test_unlisten(freerdp_listener* instance)
+{
+	if (instance)
+		instance->Close(instance);
+
+	freerdp_listener_free(instance);
+}
+
+static int test_event_loop_peers(void)
+{
+	size_t x;
+	int rc = -1;
+	int fds[TEST_PEERS];
+	UINT16 port;
+	TEST_EVENT_LOOP state = { 0 };
+	freerdp_listener* instance = NULL;
+
+	for (x = 0; x < TEST_PEERS; x++)
+		fds[x] = -1;
+
+	InitializeCriticalSection(&state.lock);
+	state.checkThreads = TRUE;
+
+	if (!(state.loop = freerdp_event_loop_new(TEST_THREADS)) ||
+	    !test_listen(&state, &instance, &port))
+		goto out;
+
+	/* All connections stay open at the same time */
+	for (x = 0; x < TEST_PEERS; x++)
+	{
+		if ((fds[x] = test_connect(port)) < 0)
+		{
+			printf("connect %" PRIuz " failed: %s\n", x, strerror(errno));
+			goto out;
+		}
+	}
+
+	if (!test_wait_for(&state.accepted, TEST_PEERS))
+		goto out;
+
+	for (x = 0; x < TEST_PEERS; x++)
+	{
+		if (!test_negotiate(fds[x]))
+		{
+			printf("negotiation with peer %" PRIuz " failed\n", x);
+			goto out;
+		}
+	}
+
+	if (state.removed != 0)
+		goto out;
+
+	/* Closed connections take the peers off the loop */
+	for (x = 0; x < TEST_PEERS / 2; x++)
+	{
+		close(fds[x]);
+		fds[x] = -1;
+	}
+
+	if (!test_wait_for(&state.removed, TEST_PEERS / 2))
+		goto out;
+
+	rc = state.failed ? -1 : 0;
+out:
+	/* Peers still connected are removed when the loop is freed */
+	state.checkThreads = FALSE;
+	freerdp_event_loop_free(state.loop);
+
+	if ((rc == 0) && (state.removed != TEST_PEERS))
+	{
+		printf("%" PRId32 " of %d peers removed\n", state.removed, TEST_PEERS);
+		rc = -1;
+	}
+
+	test_unlisten(instance);
+
+	for (x = 0; x < TEST_PEERS; x++)
+	{
+		if (fds[x] >= 0)
+			close(fds[x]);
+	}
+
+	DeleteCriticalSection(&state.lock);
+	return rc;
+}
+
+/* A client stalling in the TLS handshake must not hold up a second one on the same thread */
+static int test_event_loop_handshake(void)
+{
+	int rc = -1;
+	int stalled = -1;
+	int live = -1;
+	UINT16 port;
+	TEST_EVENT_LOOP state = { 0 };
+	freerdp_listener* instance = NULL;
+
+	InitializeCriticalSection(&state.lock);
+
+	if (!(state.loop = freerdp_event_loop_new(1)) ||
+	    !freerdp_event_loop_set_handshake_timeout(state.loop, 1000) ||
+	    !test_listen(&state, &instance, &port))
+		goto out;
+
+	if (((stalled = test_connect(port)) < 0) ||
+	    !test_negotiate_request(stalled, test_tls_request, sizeof(test_tls_request)))
+	{
+		printf("TLS negotiation failed\n");
+		goto out;
+	}
+
+	if (((live = test_connect(port)) < 0) || !test_negotiate(live) || (state.removed != 0))
+	{
+		printf("negotiation blocked by a stalled handshake\n");
+		goto out;
+	}
+
+	/* The stalled handshake is aborted, the negotiated peer stays */
+	if (!test_wait_for(&state.removed, 1))
+		goto out;
+
+	Sleep(200);
+
+	if ((state.accepted != 2) || (state.removed != 1))
+	{
+		printf("%" PRId32 " peers accepted, %" PRId32 " removed\n", state.accepted,
+		       state.removed);
+		goto out;
+	}
+
+	rc = 0;
+out:
+	freerdp_event_loop_free(state.loop);
+
+	if ((rc == 0) && (state.removed != 2))
+		rc = -1;
+
+	test_unlisten(instance);
+
+	if (stalled >= 0)
+		close(stalled);
+
+	if (live >= 0)
+		close(live);
+
+	DeleteCriticalSection(&state.lock);
+	return rc;
+}
+
+int TestEventLoop(int argc, char* argv[])
+{
+	int rc = -1;
+	WSADATA wsaData;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return -1;
+
+	if ((test_event_loop_peers() == 0) && (test_event_loop_handshake() == 0))
+		rc = 0;
+
+	WSACleanup();
+	return rc;
+}
@@ -64,6 +64,7 @@ static const size_t bool_list_indices[] = {
 	FreeRDP_DisableCredentialsDelegation,
 	FreeRDP_VmConnectMode,
 	FreeRDP_FIPSMode,
+	FreeRDP_TlsKernelOffload,
 	FreeRDP_MstscCookieMode,
 	FreeRDP_SendPreconnectionPdu,
 	FreeRDP_SmartcardLogon,
@@ -272,6 +273,7 @@ static const size_t uint32_list_indices[] = {
 	FreeRDP_JpegCodecId,
 	FreeRDP_JpegQuality,
 	FreeRDP_GfxCapsFilter,
+	FreeRDP_GfxDecodeThreads,
 	FreeRDP_BitmapCacheV3CodecId,
 	FreeRDP_DrawNineGridCacheSize,
 	FreeRDP_DrawNineGridCacheEntries,
@@ -362,6 +364,7 @@ static const size_t string_list_indices[] = {
 	FreeRDP_RemoteApplicationGuid,
 	FreeRDP_RemoteApplicationCmdLine,
 	FreeRDP_RemoteApplicationWorkingDir,
+	FreeRDP_BitmapCachePersistFile,
 	FreeRDP_ImeFileName,
 	FreeRDP_DrivesToRedirect,
 	FreeRDP_RDP2TCPArgs,
@@ -791,39 +791,14 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 	return Stream_Length(s);
 }
 
-int transport_write(rdpTransport* transport, wStream* s)
+/* Writes data to the front BIO, the caller holds the write lock */
+static int transport_write_bytes(rdpTransport* transport, const BYTE* data, size_t length)
 {
-	size_t length;
 	int status = -1;
-	int writtenlength = 0;
-	rdpRdp* rdp = transport->context->rdp;
-
-	if (!s)
-		return -1;
-
-	if (!transport)
-		goto fail;
-
-	if (!transport->frontBio)
-	{
-		transport->layer = TRANSPORT_LAYER_CLOSED;
-		goto fail;
-	}
-
-	EnterCriticalSection(&(transport->WriteLock));
-	length = Stream_GetPosition(s);
-	writtenlength = length;
-	Stream_SetPosition(s, 0);
-
-	if (length > 0)
-	{
-		rdp->outBytes += length;
-		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length, WLOG_PACKET_OUTBOUND);
-	}
 
 	while (length > 0)
 	{
-		status = BIO_write(transport->frontBio, Stream_Pointer(s), length);
+		status = BIO_write(transport->frontBio, data, length);
 
 		if (status <= 0)
 		{
@@ -834,21 +809,20 @@ int transport_write(rdpTransport* transport, wStream* s)
 			if (!BIO_should_retry(transport->frontBio))
 			{
 				WLog_ERR_BIO(transport, "BIO_should_retry", transport->frontBio);
-				goto out_cleanup;
+				return -1;
 			}
 
 			/* non-blocking can live with blocked IOs */
 			if (!transport->blocking)
 			{
 				WLog_ERR_BIO(transport, "BIO_write", transport->frontBio);
-				goto out_cleanup;
+				return -1;
 			}
 
 			if (BIO_wait_write(transport->frontBio, 100) < 0)
 			{
 				WLog_ERR_BIO(transport, "BIO_wait_write", transport->frontBio);
-				status = -1;
-				goto out_cleanup;
+				return -1;
 			}
 
 			continue;
@@ -861,27 +835,120 @@ int transport_write(rdpTransport* transport, wStream* s)
 				if (BIO_wait_write(transport->frontBio, 100) < 0)
 				{
 					WLog_Print(transport->log, WLOG_ERROR, "error when selecting for write");
-					status = -1;
-					goto out_cleanup;
+					return -1;
 				}
 
 				if (BIO_flush(transport->frontBio) < 1)
 				{
 					WLog_Print(transport->log, WLOG_ERROR, "error when flushing outputBuffer");
-					status = -1;
-					goto out_cleanup;
+					return -1;
 				}
 			}
 		}
 
 		length -= status;
-		Stream_Seek(s, status);
+		data += status;
 	}
 
-	transport->written += writtenlength;
-out_cleanup:
+	return status;
+}
+
+/* Sends the coalesced PDUs, the caller holds the write lock */
+static int transport_flush_batch(rdpTransport* transport)
+{
+	int status;
+	const size_t length = Stream_GetPosition(transport->batch);
+
+	if (length == 0)
+		return 1;
+
+	Stream_SetPosition(transport->batch, 0);
+
+	if (!transport->frontBio)
+		return -1;
+
+	status = transport_write_bytes(transport, Stream_Buffer(transport->batch), length);
 
 	if (status < 0)
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+
+	return status;
+}
+
+/**
+ * Appends a PDU to the batch buffer. The buffer is sent whenever it holds a full
+ * TLS record worth of data, larger PDUs skip the copy once the buffer is empty.
+ */
+static int transport_write_batched(rdpTransport* transport, const BYTE* data, size_t length)
+{
+	int status = 1;
+
+	while (length > 0)
+	{
+		size_t size;
+
+		if ((Stream_GetPosition(transport->batch) == 0) && (length >= TRANSPORT_BATCH_SIZE))
+			return transport_write_bytes(transport, data, length);
+
+		size = Stream_GetRemainingCapacity(transport->batch);
+
+		if (size > length)
+			size = length;
+
+		Stream_Write(transport->batch, data, size);
+		data += size;
+		length -= size;
+
+		if (Stream_GetRemainingCapacity(transport->batch) == 0)
+		{
+			status = transport_flush_batch(transport);
+
+			if (status < 0)
+				return status;
+		}
+	}
+
+	return status;
+}
+
+int transport_write(rdpTransport* transport, wStream* s)
+{
+	size_t length;
+	int status = -1;
+	int writtenlength = 0;
+	rdpRdp* rdp = transport->context->rdp;
+
+	if (!s)
+		return -1;
+
+	if (!transport)
+		goto fail;
+
+	if (!transport->frontBio)
+	{
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+		goto fail;
+	}
+
+	EnterCriticalSection(&(transport->WriteLock));
+	length = Stream_GetPosition(s);
+	writtenlength = length;
+	Stream_SetPosition(s, 0);
+
+	if (length > 0)
+	{
+		rdp->outBytes += length;
+		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length, WLOG_PACKET_OUTBOUND);
+	}
+
+	if (transport->batching)
+		status = transport_write_batched(transport, Stream_Buffer(s), length);
+	else
+		status = transport_write_bytes(transport, Stream_Buffer(s), length);
+
+	if (status >= 0)
+		transport->written += writtenlength;
+	else
 	{
 		/* A write error indicates that the peer has dropped the connection */
 		transport->layer = TRANSPORT_LAYER_CLOSED;
@@ -893,6 +960,48 @@ fail:
 	return status;
 }
 
+BOOL transport_begin_batch(rdpTransport* transport)
+{
+	int status = 1;
+
+	if (!transport)
+		return FALSE;
+
+	EnterCriticalSection(&(transport->WriteLock));
+
+	/* A frame that was never ended is sent before the next one starts */
+	if (transport->batching)
+		status = transport_flush_batch(transport);
+
+	transport->batching = TRUE;
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status >= 0;
+}
+
+/* Sends what the batch holds without ending it */
+static BOOL transport_send_batch(rdpTransport* transport)
+{
+	int status;
+	EnterCriticalSection(&(transport->WriteLock));
+	status = transport_flush_batch(transport);
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status >= 0;
+}
+
+BOOL transport_end_batch(rdpTransport* transport)
+{
+	int status;
+
+	if (!transport)
+		return FALSE;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	transport->batching = FALSE;
+	status = transport_flush_batch(transport);
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status >= 0;
+}
+
 DWORD transport_get_event_handles(rdpTransport* transport, HANDLE* events, DWORD count)
 {
 	DWORD nCount = 1; /* always the reread Event */
@@ -983,6 +1092,9 @@ int transport_drain_output_buffer(rdpTransport* transport)
 {
 	BOOL status = FALSE;
 
+	if (!transport_send_batch(transport))
+		return -1;
+
 	if (BIO_write_blocked(transport->frontBio))
 	{
 		if (BIO_flush(transport->frontBio) < 1)
@@ -1007,6 +1119,10 @@ int transport_check_fds(rdpTransport* transport)
 
 	dueDate = now + transport->settings->MaxTimeInCheckLoop;
 
+	/* Do not hold back output while the peer waits for it */
+	if (transport->batching && !transport_send_batch(transport))
+		return -1;
+
 	if (transport->haveMoreBytesToRead)
 	{
 		transport->haveMoreBytesToRead = FALSE;
@@ -1168,13 +1284,18 @@ rdpTransport* transport_new(rdpContext* context)
 	if (!transport->rereadEvent || transport->rereadEvent == INVALID_HANDLE_VALUE)
 		goto out_free_connectedEvent;
 
+	transport->batch = Stream_New(NULL, TRANSPORT_BATCH_SIZE);
+
+	if (!transport->batch)
+		goto out_free_rereadEvent;
+
 	transport->haveMoreBytesToRead = FALSE;
 	transport->blocking = TRUE;
 	transport->GatewayEnabled = FALSE;
 	transport->layer = TRANSPORT_LAYER_TCP;
 
 	if (!InitializeCriticalSectionAndSpinCount(&(transport->ReadLock), 4000))
-		goto out_free_rereadEvent;
+		goto out_free_batch;
 
 	if (!InitializeCriticalSectionAndSpinCount(&(transport->WriteLock), 4000))
 		goto out_free_readlock;
@@ -1182,6 +1303,8 @@ rdpTransport* transport_new(rdpContext* context)
 	return transport;
 out_free_readlock:
 	DeleteCriticalSection(&(transport->ReadLock));
+out_free_batch:
+	Stream_Free(transport->batch, TRUE);
 out_free_rereadEvent:
 	CloseHandle(transport->rereadEvent);
 out_free_connectedEvent:
@@ -1206,6 +1329,7 @@ void transport_free(rdpTransport* transport)
 		Stream_Release(transport->ReceiveBuffer);
 
 	StreamPool_Free(transport->ReceivePool);
+	Stream_Free(transport->batch, TRUE);
 	CloseHandle(transport->connectedEvent);
 	CloseHandle(transport->rereadEvent);
 	DeleteCriticalSection(&(transport->ReadLock));
@@ -53,6 +53,9 @@ typedef struct rdp_transport rdpTransport;
 
 typedef int (*TransportRecv)(rdpTransport* transport, wStream* stream, void* extra);
 
+/* Maximum plaintext of a TLS record, PDUs of a frame are coalesced up to this size */
+#define TRANSPORT_BATCH_SIZE 16384
+
 struct rdp_transport
 {
 	TRANSPORT_LAYER layer;
@@ -77,6 +80,8 @@ struct rdp_transport
 	HANDLE rereadEvent;
 	BOOL haveMoreBytesToRead;
 	wLog* log;
+	BOOL batching;
+	wStream* batch;
 };
 
 FREERDP_LOCAL wStream* transport_send_stream_init(rdpTransport* transport, int size);
@@ -94,6 +99,15 @@ FREERDP_LOCAL BOOL transport_accept_nla(rdpTransport* transport);
 FREERDP_LOCAL int transport_read_pdu(rdpTransport* transport, wStream* s);
 FREERDP_LOCAL int transport_write(rdpTransport* transport, wStream* s);
 
+/**
+ * Between transport_begin_batch and transport_end_batch written PDUs are coalesced
+ * into full TLS records and sent when the batch is ended, typically at the end
+ * of a frame. transport_check_fds and transport_drain_output_buffer send what
+ * an open batch holds so far.
+ */
+FREERDP_LOCAL BOOL transport_begin_batch(rdpTransport* transport);
+FREERDP_LOCAL BOOL transport_end_batch(rdpTransport* transport);
+
 FREERDP_LOCAL void transport_get_fds(rdpTransport* transport, void** rfds, int* rcount);
 FREERDP_LOCAL int transport_check_fds(rdpTransport* transport);
 
@@ -1087,6 +1087,12 @@ static BOOL update_send_surface_frame_marker(rdpContext* context,
 	rdpRdp* rdp = context->rdp;
 	BOOL ret = FALSE;
 	update_force_flush(context);
+
+	/* The PDUs of a frame are coalesced and sent with the end marker */
+	if ((surfaceFrameMarker->frameAction == SURFACECMD_FRAMEACTION_BEGIN) &&
+	    !transport_begin_batch(rdp->transport))
+		return FALSE;
+
 	s = fastpath_update_pdu_init(rdp->fastpath);
 
 	if (!s)
@@ -1098,6 +1104,11 @@ static BOOL update_send_surface_frame_marker(rdpContext* context,
 		goto out_fail;
 
 	update_force_flush(context);
+
+	if ((surfaceFrameMarker->frameAction == SURFACECMD_FRAMEACTION_END) &&
+	    !transport_end_batch(rdp->transport))
+		goto out_fail;
+
 	ret = TRUE;
 out_fail:
 	Stream_Release(s);
@@ -1111,6 +1122,10 @@ static BOOL update_send_surface_frame_bits(rdpContext* context, const SURFACE_BI
 	rdpRdp* rdp = context->rdp;
 	BOOL ret = FALSE;
 	update_force_flush(context);
+
+	if (first && !transport_begin_batch(rdp->transport))
+		return FALSE;
+
 	s = fastpath_update_pdu_init(rdp->fastpath);
 
 	if (!s)
@@ -1134,6 +1149,10 @@ static BOOL update_send_surface_frame_bits(rdpContext* context, const SURFACE_BI
 	ret = fastpath_send_update_pdu(rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, s,
 	                               cmd->skipCompression);
 	update_force_flush(context);
+
+	if (last && !transport_end_batch(rdp->transport))
+		ret = FALSE;
+
 out_fail:
 	Stream_Release(s);
 	return ret;
@@ -0,0 +1,283 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/winsock.h>
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <freerdp/settings.h>
+#include <freerdp/crypto/tls.h>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#ifdef HAVE_LINUX_TLS_H
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
+/* Full sized records followed by a partial one */
+#define TEST_PDU 16384
+#define TEST_BYTES (4 * TEST_PDU + 1000)
+
+static char test_hostname[] = "localhost";
+
+typedef struct
+{
+	rdpTls* client;
+	SOCKET socket;
+	BYTE* received;
+	size_t length;
+} TEST_TLS_CLIENT;
+
+static char* test_tls_pem(BIO* bio)
+{
+	char* pem;
+	char* data = NULL;
+	const long length = BIO_get_mem_data(bio, &data);
+
+	if (length <= 0)
+		return NULL;
+
+	pem = (char*)calloc((size_t)length + 1, sizeof(char));
+
+	if (pem)
+		CopyMemory(pem, data, (size_t)length);
+
+	return pem;
+}
+
+static BOOL test_tls_credentials(rdpSettings* settings)
+{
+	BOOL rc = FALSE;
+	EVP_PKEY* pkey = NULL;
+	X509_NAME* name;
+	X509* x509 = X509_new();
+	BIO* keyBio = BIO_new(BIO_s_mem());
+	BIO* certBio = BIO_new(BIO_s_mem());
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+
+	if (!x509 || !keyBio || !certBio || !ctx)
+		goto out;
+
+	if ((EVP_PKEY_keygen_init(ctx) <= 0) || (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) <= 0) ||
+	    (EVP_PKEY_keygen(ctx, &pkey) <= 0))
+		goto out;
+
+	name = X509_get_subject_name(x509);
+
+	if (!X509_set_version(x509, 2) || !ASN1_INTEGER_set(X509_get_serialNumber(x509), 1) ||
+	    !X509_gmtime_adj(X509_get_notBefore(x509), 0) ||
+	    !X509_gmtime_adj(X509_get_notAfter(x509), 3600) || !X509_set_pubkey(x509, pkey) ||
+	    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const BYTE*)"localhost", -1, -1,
+	                                0) ||
+	    !X509_set_issuer_name(x509, name) || !X509_sign(x509, pkey, EVP_sha256()))
+		goto out;
+
+	if (!PEM_write_bio_PrivateKey(keyBio, pkey, NULL, NULL, 0, NULL, NULL) ||
+	    !PEM_write_bio_X509(certBio, x509))
+		goto out;
+
+	settings->PrivateKeyContent = test_tls_pem(keyBio);
+	settings->CertificateContent = test_tls_pem(certBio);
+	rc = settings->PrivateKeyContent && settings->CertificateContent;
+out:
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(pkey);
+	X509_free(x509);
+	BIO_free(keyBio);
+	BIO_free(certBio);
+	return rc;
+}
+
+static BOOL test_tls_socketpair(SOCKET* pServer, SOCKET* pClient)
+{
+	struct sockaddr_in addr = { 0 };
+	socklen_t length = sizeof(addr);
+	SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	*pServer = INVALID_SOCKET;
+	*pClient = INVALID_SOCKET;
+
+	if (listener == INVALID_SOCKET)
+		return FALSE;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+	    (listen(listener, 1) != 0) ||
+	    (getsockname(listener, (struct sockaddr*)&addr, &length) != 0))
+		goto out;
+
+	*pClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if ((*pClient == INVALID_SOCKET) ||
+	    (connect(*pClient, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+		goto out;
+
+	*pServer = accept(listener, NULL, NULL);
+out:
+	closesocket(listener);
+	return (*pServer != INVALID_SOCKET) && (*pClient != INVALID_SOCKET);
+}
+
+static BOOL test_tls_offloaded(SOCKET s)
+{
+#ifdef HAVE_LINUX_TLS_H
+	struct tls12_crypto_info_aes_gcm_256 info;
+	socklen_t length = sizeof(info);
+	const BOOL rc = getsockopt(s, SOL_TLS, TLS_TX, &info, &length) == 0;
+	SecureZeroMemory(&info, sizeof(info));
+	return rc;
+#else
+	WINPR_UNUSED(s);
+	return FALSE;
+#endif
+}
+
+/* The client decrypts with OpenSSL what the kernel encrypted */
+static DWORD WINAPI test_tls_client_thread(LPVOID arg)
+{
+	int status;
+	TEST_TLS_CLIENT* client = (TEST_TLS_CLIENT*)arg;
+	BIO* bio = BIO_new_socket((int)client->socket, BIO_NOCLOSE);
+
+	if (!bio)
+		return 1;
+
+	if (tls_connect(client->client, bio) < 1)
+	{
+		shutdown(client->socket, SD_BOTH);
+		return 1;
+	}
+
+	while (client->length < TEST_BYTES)
+	{
+		status = BIO_read(client->client->bio, &client->received[client->length],
+		                  (int)(TEST_BYTES - client->length));
+
+		if (status > 0)
+			client->length += (size_t)status;
+		else if (!BIO_should_retry(client->client->bio))
+			break;
+	}
+
+	return 0;
+}
+
+static int test_tls_kernel_offload(void)
+{
+	int rc = -1;
+	size_t i;
+	BIO* bio;
+	SOCKET server = INVALID_SOCKET;
+	HANDLE thread = NULL;
+	rdpTls* tls = NULL;
+	TEST_TLS_CLIENT client = { 0 };
+	BYTE* data = (BYTE*)malloc(TEST_BYTES);
+	rdpSettings* serverSettings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
+	rdpSettings* clientSettings = freerdp_settings_new(0);
+	client.socket = INVALID_SOCKET;
+	client.received = (BYTE*)calloc(TEST_BYTES, sizeof(BYTE));
+
+	if (!data || !client.received || !serverSettings || !clientSettings)
+		goto out;
+
+	for (i = 0; i < TEST_BYTES; i++)
+		data[i] = (BYTE)((i * 2654435761u) >> 24);
+
+	serverSettings->TlsKernelOffload = TRUE;
+	clientSettings->IgnoreCertificate = TRUE;
+
+	if (!test_tls_credentials(serverSettings) || !test_tls_socketpair(&server, &client.socket))
+		goto out;
+
+	tls = tls_new(serverSettings);
+	client.client = tls_new(clientSettings);
+
+	if (!tls || !client.client)
+		goto out;
+
+	client.client->hostname = test_hostname;
+	client.client->port = 3389;
+	thread = CreateThread(NULL, 0, test_tls_client_thread, &client, 0, NULL);
+	bio = BIO_new_socket((int)server, BIO_NOCLOSE);
+
+	if (!thread || !bio || !tls_accept(tls, bio, serverSettings))
+		goto out;
+
+	if (!test_tls_offloaded(server))
+	{
+		printf("kernel TLS offload not available, skipping\n");
+		rc = 0;
+		goto out;
+	}
+
+	if ((tls_write_all(tls, data, TEST_PDU) != TEST_PDU) ||
+	    (tls_write_all(tls, &data[TEST_PDU], TEST_BYTES - TEST_PDU) != TEST_BYTES - TEST_PDU))
+		goto out;
+
+	WaitForSingleObject(thread, INFINITE);
+
+	if ((client.length != TEST_BYTES) || (memcmp(client.received, data, TEST_BYTES) != 0))
+	{
+		fprintf(stderr, "client received %" PRIuz " of %d bytes, content %s\n", client.length,
+		        TEST_BYTES,
+		        memcmp(client.received, data, client.length) == 0 ? "matches" : "differs");
+		goto out;
+	}
+
+	rc = 0;
+out:
+	if (server != INVALID_SOCKET)
+		shutdown(server, SD_BOTH);
+
+	if (thread)
+	{
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+
+	tls_free(client.client);
+	tls_free(tls);
+
+	if (server != INVALID_SOCKET)
+		closesocket(server);
+
+	if (client.socket != INVALID_SOCKET)
+		closesocket(client.socket);
+
+	freerdp_settings_free(clientSettings);
+	freerdp_settings_free(serverSettings);
+	free(client.received);
+	free(data);
+	return rc;
+}
+
+int TestTlsKernelOffload(int argc, char* argv[])
+{
+	int rc;
+	WSADATA wsaData;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return -1;
+
+	rc = test_tls_kernel_offload();
+	WSACleanup();
+	return rc;
+}
@@ -46,6 +46,24 @@
 #include <valgrind/memcheck.h>
 #endif
 
+#if defined(HAVE_LINUX_TLS_H) && (OPENSSL_VERSION_NUMBER >= 0x10101000L) && \
+    !defined(LIBRESSL_VERSION_NUMBER)
+#define WITH_TLS_KERNEL_OFFLOAD
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <openssl/kdf.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
 #define TAG FREERDP_TAG("crypto")
 
 /**
@@ -74,6 +92,7 @@ struct _BIO_RDP_TLS
 {
 	SSL* ssl;
 	CRITICAL_SECTION lock;
+	BOOL kernelOffload;
 };
 typedef struct _BIO_RDP_TLS BIO_RDP_TLS;
 
@@ -84,6 +103,25 @@ static void tls_print_certificate_name_mismatch_error(const char* hostname, UINT
 static void tls_print_certificate_error(const char* hostname, UINT16 port, const char* fingerprint,
                                         const char* hosts_file);
 
+/**
+ * With kernel TLS offload the socket encrypts the records itself, the plaintext
+ * goes to the socket BIO below the SSL object so that its buffering still applies.
+ * That is the read BIO of the SSL object, its write BIO discards what OpenSSL sends.
+ */
+static int bio_rdp_tls_write_offloaded(BIO* bio, BIO_RDP_TLS* tls, const char* buf, int size)
+{
+	int status;
+	BIO_clear_retry_flags(bio);
+	EnterCriticalSection(&tls->lock);
+	status = BIO_write(SSL_get_rbio(tls->ssl), buf, size);
+	LeaveCriticalSection(&tls->lock);
+
+	if (status <= 0)
+		BIO_copy_next_retry(bio);
+
+	return status;
+}
+
 static int bio_rdp_tls_write(BIO* bio, const char* buf, int size)
 {
 	int error;
@@ -93,6 +131,9 @@ static int bio_rdp_tls_write(BIO* bio, const char* buf, int size)
 	if (!buf || !tls)
 		return 0;
 
+	if (tls->kernelOffload)
+		return bio_rdp_tls_write_offloaded(bio, tls, buf, size);
+
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE | BIO_FLAGS_READ | BIO_FLAGS_IO_SPECIAL);
 	EnterCriticalSection(&tls->lock);
 	status = SSL_write(tls->ssl, buf, size);
@@ -245,6 +286,10 @@ static long bio_rdp_tls_ctrl(BIO* bio, int cmd, long num, void* ptr)
 	ssl_rbio = tls->ssl ? SSL_get_rbio(tls->ssl) : NULL;
 	ssl_wbio = tls->ssl ? SSL_get_wbio(tls->ssl) : NULL;
 
+	/* The write BIO of an offloaded connection is a sink, the socket is the read BIO */
+	if (tls->kernelOffload)
+		ssl_wbio = ssl_rbio;
+
 	switch (cmd)
 	{
 		case BIO_CTRL_RESET:
@@ -637,6 +682,27 @@ out_free:
 	return NULL;
 }
 
+/**
+ * Whether kernel TLS offload will be tried for a connection on top of underlying, only
+ * those get their protocol version capped at TLS 1.2.
+ */
+static BOOL tls_kernel_offload_possible(rdpSettings* settings, BIO* underlying)
+{
+#if defined(WITH_TLS_KERNEL_OFFLOAD)
+	int type;
+
+	if (!settings->TlsKernelOffload || !underlying)
+		return FALSE;
+
+	type = BIO_method_type(underlying);
+	return (type == BIO_TYPE_BUFFERED) || (type == BIO_TYPE_SIMPLE) || (type == BIO_TYPE_SOCKET);
+#else
+	WINPR_UNUSED(settings);
+	WINPR_UNUSED(underlying);
+	return FALSE;
+#endif
+}
+
 #if OPENSSL_VERSION_NUMBER >= 0x010000000L
 static BOOL tls_prepare(rdpTls* tls, BIO* underlying, const SSL_METHOD* method, int options,
                         BOOL clientMode)
@@ -659,7 +725,12 @@ static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method, int op
 	SSL_CTX_set_read_ahead(tls->ctx, 1);
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	SSL_CTX_set_min_proto_version(tls->ctx, TLS1_VERSION); /* min version */
-	SSL_CTX_set_max_proto_version(tls->ctx, 0); /* highest supported version by library */
+
+	/* kernel TLS offload only takes over TLS 1.2 sessions */
+	if (tls_kernel_offload_possible(settings, underlying))
+		SSL_CTX_set_max_proto_version(tls->ctx, TLS1_2_VERSION);
+	else
+		SSL_CTX_set_max_proto_version(tls->ctx, 0); /* highest supported version by library */
 #endif
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER)
 	SSL_CTX_set_security_level(tls->ctx, settings->TlsSecLevel);
@@ -817,8 +888,196 @@ out:
 	return verify_status;
 }
 
+#if defined(WITH_TLS_KERNEL_OFFLOAD)
+/**
+ * Computes the TLS 1.2 key block (RFC 5246 section 6.3):
+ * PRF(master_secret, "key expansion", server_random + client_random)
+ */
+static BOOL tls_get_key_block(SSL* ssl, BYTE* keyBlock, size_t length)
+{
+	BOOL rc = FALSE;
+	size_t outLength = length;
+	size_t masterLength;
+	BYTE master[SSL_MAX_MASTER_KEY_LENGTH];
+	BYTE seed[2 * SSL3_RANDOM_SIZE];
+	const char label[] = "key expansion";
+	const EVP_MD* md = SSL_CIPHER_get_handshake_digest(SSL_get_current_cipher(ssl));
+	EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, NULL);
+	masterLength = SSL_SESSION_get_master_key(SSL_get_session(ssl), master, sizeof(master));
+
+	if (!md || !pctx || (masterLength == 0))
+		goto out;
+
+	if ((SSL_get_server_random(ssl, seed, SSL3_RANDOM_SIZE) != SSL3_RANDOM_SIZE) ||
+	    (SSL_get_client_random(ssl, &seed[SSL3_RANDOM_SIZE], SSL3_RANDOM_SIZE) !=
+	     SSL3_RANDOM_SIZE))
+		goto out;
+
+	if ((EVP_PKEY_derive_init(pctx) <= 0) || (EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) <= 0) ||
+	    (EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master, (int)masterLength) <= 0) ||
+	    (EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, label, (int)strlen(label)) <= 0) ||
+	    (EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, seed, sizeof(seed)) <= 0) ||
+	    (EVP_PKEY_derive(pctx, keyBlock, &outLength) <= 0) || (outLength != length))
+		goto out;
+
+	rc = TRUE;
+out:
+	OPENSSL_cleanse(master, sizeof(master));
+	EVP_PKEY_CTX_free(pctx);
+	return rc;
+}
+
+static BOOL tls_set_kernel_tx_key(int fd, int nid, const BYTE* key, const BYTE* salt)
+{
+	/* The Finished message was record 0 of the new keys, the kernel continues with 1 */
+	const BYTE sequence[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+	BOOL rc;
+	union
+	{
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+	} info;
+
+	ZeroMemory(&info, sizeof(info));
+
+	if (nid == NID_aes_128_gcm)
+	{
+		info.aes128.info.version = TLS_1_2_VERSION;
+		info.aes128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+		CopyMemory(info.aes128.key, key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+		CopyMemory(info.aes128.salt, salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+		CopyMemory(info.aes128.iv, sequence, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+		CopyMemory(info.aes128.rec_seq, sequence, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+		rc = setsockopt(fd, SOL_TLS, TLS_TX, &info.aes128, sizeof(info.aes128)) == 0;
+	}
+	else
+	{
+		info.aes256.info.version = TLS_1_2_VERSION;
+		info.aes256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+		CopyMemory(info.aes256.key, key, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+		CopyMemory(info.aes256.salt, salt, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+		CopyMemory(info.aes256.iv, sequence, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+		CopyMemory(info.aes256.rec_seq, sequence, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+		rc = setsockopt(fd, SOL_TLS, TLS_TX, &info.aes256, sizeof(info.aes256)) == 0;
+	}
+
+	OPENSSL_cleanse(&info, sizeof(info));
+	return rc;
+}
+#endif
+
+/**
+ * Hands the write direction of an established connection to the Linux kernel TLS
+ * layer, OpenSSL keeps decrypting what we receive. Only TLS 1.2 with AES-GCM on a
+ * TCP socket directly below the TLS layer is supported, anything else stays on
+ * the user space path. OpenSSL must not write on the connection afterwards: its
+ * records would be encrypted a second time by the kernel. Renegotiation is refused,
+ * the close notify alert is skipped on shutdown and the write BIO of the SSL object
+ * is replaced with a sink, so that alerts sent while reading never reach the socket.
+ */
+static BOOL tls_enable_kernel_offload(rdpTls* tls)
+{
+#if defined(WITH_TLS_KERNEL_OFFLOAD)
+	BOOL rc = FALSE;
+	int fd;
+	int nid;
+	size_t keyLength;
+	size_t saltLength = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+	BYTE keyBlock[2 * TLS_CIPHER_AES_GCM_256_KEY_SIZE + 2 * TLS_CIPHER_AES_GCM_256_SALT_SIZE];
+	BIO* sink = NULL;
+	BIO_RDP_TLS* bioTls = (BIO_RDP_TLS*)BIO_get_data(tls->bio);
+	const BOOL server = SSL_is_server(tls->ssl);
+
+	if (!tls_kernel_offload_possible(tls->settings, tls->underlying))
+	{
+		WLog_DBG(TAG, "kernel TLS offload needs a socket below the TLS layer");
+		return FALSE;
+	}
+
+	if (SSL_version(tls->ssl) != TLS1_2_VERSION)
+	{
+		WLog_WARN(TAG, "kernel TLS offload is not supported for %s", SSL_get_version(tls->ssl));
+		return FALSE;
+	}
+
+	nid = SSL_CIPHER_get_cipher_nid(SSL_get_current_cipher(tls->ssl));
+
+	if (nid == NID_aes_128_gcm)
+		keyLength = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+	else if (nid == NID_aes_256_gcm)
+		keyLength = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+	else
+	{
+		WLog_WARN(TAG, "kernel TLS offload is not supported for cipher %s",
+		          SSL_get_cipher_name(tls->ssl));
+		return FALSE;
+	}
+
+	fd = BIO_get_fd(tls->underlying, NULL);
+
+	if (fd < 0)
+		return FALSE;
+
+	if ((SSL_get_rbio(tls->ssl) != SSL_get_wbio(tls->ssl)) || !(sink = BIO_new(BIO_s_null())))
+		return FALSE;
+
+	/* client_write_key, server_write_key, client_write_IV, server_write_IV */
+	if (!tls_get_key_block(tls->ssl, keyBlock, 2 * keyLength + 2 * saltLength))
+	{
+		WLog_ERR(TAG, "failed to derive the TLS key block");
+		goto out;
+	}
+
+	/* Records still queued in the socket BIO are already encrypted */
+	while (BIO_wpending(tls->underlying) > 0)
+	{
+		if (BIO_flush(tls->underlying) < 1)
+			goto out;
+
+		if ((BIO_wpending(tls->underlying) > 0) && (BIO_wait_write(tls->underlying, 100) < 0))
+			goto out;
+	}
+
+	if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0)
+	{
+		WLog_WARN(TAG, "kernel TLS is not available: %s", strerror(errno));
+		goto out;
+	}
+
+	if (!tls_set_kernel_tx_key(fd, nid, &keyBlock[server ? keyLength : 0],
+	                           &keyBlock[2 * keyLength + (server ? saltLength : 0)]))
+	{
+		WLog_WARN(TAG, "kernel TLS rejected the %s key: %s", SSL_get_cipher_name(tls->ssl),
+		          strerror(errno));
+		goto out;
+	}
+
+	SSL_set_quiet_shutdown(tls->ssl, 1);
+#ifdef SSL_OP_NO_RENEGOTIATION
+	SSL_set_options(tls->ssl, SSL_OP_NO_RENEGOTIATION);
+#endif
+	EnterCriticalSection(&bioTls->lock);
+	/* Drops the reference of the write BIO only, the socket stays the read BIO */
+	SSL_set0_wbio(tls->ssl, sink);
+	sink = NULL;
+	bioTls->kernelOffload = TRUE;
+	LeaveCriticalSection(&bioTls->lock);
+	WLog_INFO(TAG, "kernel TLS offload enabled for %s", SSL_get_cipher_name(tls->ssl));
+	rc = TRUE;
+out:
+	BIO_free(sink);
+	OPENSSL_cleanse(keyBlock, sizeof(keyBlock));
+	return rc;
+#else
+	WINPR_UNUSED(tls);
+	WLog_WARN(TAG, "kernel TLS offload is not supported on this platform");
+	return FALSE;
+#endif
+}
+
 int tls_connect(rdpTls* tls, BIO* underlying)
 {
+	int status;
 	int options = 0;
 	/**
 	 * SSL_OP_NO_COMPRESSION:
@@ -862,7 +1121,12 @@ int tls_connect(rdpTls* tls, BIO* underlying)
 #if !defined(OPENSSL_NO_TLSEXT) && !defined(LIBRESSL_VERSION_NUMBER)
 	SSL_set_tlsext_host_name(tls->ssl, tls->hostname);
 #endif
-	return tls_do_handshake(tls, TRUE);
+	status = tls_do_handshake(tls, TRUE);
+
+	if ((status > 0) && tls->settings->TlsKernelOffload)
+		tls_enable_kernel_offload(tls);
+
+	return status;
 }
 
 #if defined(MICROSOFT_IOS_SNI_BUG) && !defined(OPENSSL_NO_TLSEXT) && \
@@ -1009,7 +1273,13 @@ BOOL tls_accept(rdpTls* tls, BIO* underlying, rdpSettings* settings)
     !defined(LIBRESSL_VERSION_NUMBER)
 	SSL_set_tlsext_debug_callback(tls->ssl, tls_openssl_tlsext_debug_callback);
 #endif
-	return tls_do_handshake(tls, FALSE) > 0;
+	if (tls_do_handshake(tls, FALSE) <= 0)
+		return FALSE;
+
+	if (settings->TlsKernelOffload)
+		tls_enable_kernel_offload(tls);
+
+	return TRUE;
 }
 
 BOOL tls_send_alert(rdpTls* tls)
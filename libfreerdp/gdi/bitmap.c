@@ -27,6 +27,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <winpr/synch.h>
+
 #include <freerdp/api.h>
 #include <freerdp/freerdp.h>
 #include <freerdp/gdi/gdi.h>
@@ -40,9 +42,19 @@
 #include "brush.h"
 #include "clipping.h"
 #include "../gdi/gdi.h"
+#include "rop.h"
+#include "bitmap_sse2.h"
+#include "bitmap_neon.h"
 
 #define TAG FREERDP_TAG("gdi.bitmap")
 
+#ifndef GDI_ROP_INIT_SIMD
+#define GDI_ROP_INIT_SIMD(_kernels) \
+	do                              \
+	{                               \
+	} while (0)
+#endif
+
 /**
  * Get pixel at the given coordinates.\n
  * @msdn{dd144909}
@@ -160,179 +172,211 @@ HGDI_BITMAP gdi_CreateCompatibleBitmap(HGDI_DC hdc, UINT32 nWidth, UINT32 nHeigh
 	return hBitmap;
 }
 
-static BOOL op_not(UINT32* stack, UINT32* stackp)
+static void gdi_rop_Dn(BYTE* pDst, size_t len)
 {
-	if (!stack || !stackp)
-		return FALSE;
+	size_t x;
 
-	if (*stackp < 1)
-		return FALSE;
+	for (x = 0; x < len; x++)
+		pDst[x] = ~pDst[x];
+}
 
-	stack[(*stackp) - 1] = ~stack[(*stackp) - 1];
-	return TRUE;
+static void gdi_rop_Sn(BYTE* pDst, const BYTE* pSrc, size_t len)
+{
+	size_t x;
+
+	for (x = 0; x < len; x++)
+		pDst[x] = ~pSrc[x];
 }
 
-static BOOL op_and(UINT32* stack, UINT32* stackp)
+static void gdi_rop_DSa(BYTE* pDst, const BYTE* pSrc, size_t len)
 {
-	if (!stack || !stackp)
-		return FALSE;
+	size_t x;
 
-	if (*stackp < 2)
-		return FALSE;
+	for (x = 0; x < len; x++)
+		pDst[x] &= pSrc[x];
+}
 
-	(*stackp)--;
-	stack[(*stackp) - 1] &= stack[(*stackp)];
-	return TRUE;
+static void gdi_rop_DSo(BYTE* pDst, const BYTE* pSrc, size_t len)
+{
+	size_t x;
+
+	for (x = 0; x < len; x++)
+		pDst[x] |= pSrc[x];
 }
 
-static BOOL op_or(UINT32* stack, UINT32* stackp)
+static void gdi_rop_DSx(BYTE* pDst, const BYTE* pSrc, size_t len)
 {
-	if (!stack || !stackp)
-		return FALSE;
+	size_t x;
 
-	if (*stackp < 2)
-		return FALSE;
+	for (x = 0; x < len; x++)
+		pDst[x] ^= pSrc[x];
+}
 
-	(*stackp)--;
-	stack[(*stackp) - 1] |= stack[(*stackp)];
-	return TRUE;
+static void gdi_rop_PSa(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, size_t len)
+{
+	size_t x;
+
+	for (x = 0; x < len; x++)
+		pDst[x] = pPat[x] & pSrc[x];
 }
 
-static BOOL op_xor(UINT32* stack, UINT32* stackp)
+static void gdi_rop_SPaDSnao(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, size_t len)
 {
-	if (!stack || !stackp)
-		return FALSE;
+	size_t x;
 
-	if (*stackp < 2)
-		return FALSE;
+	for (x = 0; x < len; x++)
+		pDst[x] = (pSrc[x] & pPat[x]) | (pDst[x] & ~pSrc[x]);
+}
+
+static GDI_ROP_KERNELS gdi_rop_kernels = { gdi_rop_Dn,  gdi_rop_Sn,  gdi_rop_DSa,     gdi_rop_DSo,
+	                                       gdi_rop_DSx, gdi_rop_PSa, gdi_rop_SPaDSnao };
 
-	(*stackp)--;
-	stack[(*stackp) - 1] ^= stack[(*stackp)];
+static INIT_ONCE gdi_rop_kernels_InitOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK gdi_rop_kernels_init_cb(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+	GDI_ROP_INIT_SIMD(&gdi_rop_kernels);
 	return TRUE;
 }
 
-static UINT32 process_rop(UINT32 src, UINT32 dst, UINT32 pat, const char* rop, UINT32 format)
+#define GDI_ROP_STACK_SIZE 10
+
+/**
+ * Generic row-wise evaluation of a reverse polish ROP string.
+ * Each stack slot holds a full row of len bytes, slot 0 is the result.
+ */
+static void gdi_rop_generic(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, const BYTE* pBlack,
+                            const BYTE* pWhite, BYTE* pStack, const char* rop, size_t len)
 {
-	DWORD stack[10] = { 0 };
-	DWORD stackp = 0;
+	size_t x;
+	size_t stackp = 0;
+	memset(pStack, 0, len);
 
 	while (*rop != '\0')
 	{
-		char op = *rop++;
+		const BYTE* push = NULL;
+		const char op = *rop++;
 
 		switch (op)
 		{
 			case '0':
-				stack[stackp++] = FreeRDPGetColor(format, 0, 0, 0, 0xFF);
+				push = pBlack;
 				break;
 
 			case '1':
-				stack[stackp++] = FreeRDPGetColor(format, 0xFF, 0xFF, 0xFF, 0xFF);
+				push = pWhite;
 				break;
 
 			case 'D':
-				stack[stackp++] = dst;
+				push = pDst;
 				break;
 
 			case 'S':
-				stack[stackp++] = src;
+				push = pSrc;
 				break;
 
 			case 'P':
-				stack[stackp++] = pat;
+				push = pPat;
 				break;
 
 			case 'x':
-				op_xor(stack, &stackp);
-				break;
-
 			case 'a':
-				op_and(stack, &stackp);
-				break;
-
 			case 'o':
-				op_or(stack, &stackp);
+				if (stackp >= 2)
+				{
+					const BYTE* b = &pStack[(stackp - 1) * len];
+					BYTE* a = &pStack[(stackp - 2) * len];
+
+					if (op == 'x')
+					{
+						for (x = 0; x < len; x++)
+							a[x] ^= b[x];
+					}
+					else if (op == 'a')
+					{
+						for (x = 0; x < len; x++)
+							a[x] &= b[x];
+					}
+					else
+					{
+						for (x = 0; x < len; x++)
+							a[x] |= b[x];
+					}
+
+					stackp--;
+				}
+
 				break;
 
 			case 'n':
-				op_not(stack, &stackp);
+				if (stackp >= 1)
+				{
+					BYTE* a = &pStack[(stackp - 1) * len];
+
+					for (x = 0; x < len; x++)
+						a[x] = ~a[x];
+				}
+
 				break;
 
 			default:
 				break;
 		}
+
+		if (push && (stackp < GDI_ROP_STACK_SIZE))
+			memcpy(&pStack[(stackp++) * len], push, len);
 	}
 
-	return stack[0];
+	memcpy(pDst, pStack, len);
 }
 
-static INLINE BOOL BitBlt_write(HGDI_DC hdcDest, HGDI_DC hdcSrc, INT32 nXDest, INT32 nYDest,
-                                INT32 nXSrc, INT32 nYSrc, INT32 x, INT32 y, BOOL useSrc,
-                                BOOL usePat, UINT32 style, const char* rop,
-                                const gdiPalette* palette)
+/* Replicate the first period bytes of a row over the whole row of len bytes. */
+static void gdi_replicate_row(BYTE* pRow, size_t period, size_t len)
 {
-	UINT32 dstColor;
-	UINT32 colorA;
-	UINT32 colorB = 0;
-	UINT32 colorC = 0;
-	const INT32 dstX = nXDest + x;
-	const INT32 dstY = nYDest + y;
-	BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, dstX, dstY);
-
-	if (!dstp)
+	size_t filled = period;
+
+	while (filled < len)
 	{
-		WLog_ERR(TAG, "dstp=%p", (void*)dstp);
-		return FALSE;
+		const size_t count = MIN(filled, len - filled);
+		memcpy(&pRow[filled], pRow, count);
+		filled += count;
 	}
+}
 
-	colorA = ReadColor(dstp, hdcDest->format);
+static void gdi_fill_color_row(BYTE* pRow, UINT32 format, UINT32 color, UINT32 nWidth)
+{
+	const UINT32 bpp = GetBytesPerPixel(format);
+	WriteColor(pRow, format, color);
+	gdi_replicate_row(pRow, bpp, 1ull * nWidth * bpp);
+}
 
-	if (useSrc)
+static BOOL gdi_fill_pattern_row(HGDI_DC hdcDest, BYTE* pRow, INT32 nXDest, INT32 nYDest,
+                                 UINT32 nWidth)
+{
+	UINT32 x;
+	const UINT32 bpp = GetBytesPerPixel(hdcDest->format);
+	const UINT32 period = MIN(hdcDest->brush->pattern->width, nWidth);
+
+	/* The brush repeats every pattern->width pixels, so only the first period is looked up. */
+	for (x = 0; x < period; x++)
 	{
-		const BYTE* srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc + x, nYSrc + y);
+		const BYTE* patp = gdi_get_brush_pointer(hdcDest, nXDest + x, nYDest);
 
-		if (!srcp)
+		if (!patp)
 		{
-			WLog_ERR(TAG, "srcp=%p", (void*)srcp);
+			WLog_ERR(TAG, "patp=%p", (void*)patp);
 			return FALSE;
 		}
 
-		colorC = ReadColor(srcp, hdcSrc->format);
-		colorC = FreeRDPConvertColor(colorC, hdcSrc->format, hdcDest->format, palette);
+		memcpy(&pRow[x * bpp], patp, bpp);
 	}
 
-	if (usePat)
-	{
-		switch (style)
-		{
-			case GDI_BS_SOLID:
-				colorB = hdcDest->brush->color;
-				break;
-
-			case GDI_BS_HATCHED:
-			case GDI_BS_PATTERN:
-			{
-				const BYTE* patp = gdi_get_brush_pointer(hdcDest, nXDest + x, nYDest + y);
-
-				if (!patp)
-				{
-					WLog_ERR(TAG, "patp=%p", (void*)patp);
-					return FALSE;
-				}
-
-				colorB = ReadColor(patp, hdcDest->format);
-			}
-			break;
-
-			default:
-				break;
-		}
-	}
-
-	dstColor = process_rop(colorC, colorA, colorB, rop, hdcDest->format);
-	return WriteColor(dstp, hdcDest->format, dstColor);
+	gdi_replicate_row(pRow, 1ull * period * bpp, 1ull * nWidth * bpp);
+	return TRUE;
 }
-
 static BOOL adjust_src_coordinates(HGDI_DC hdcSrc, INT32 nWidth, INT32 nHeight, INT32* px,
                                    INT32* py)
 {
@@ -439,14 +483,31 @@ static BOOL adjust_src_dst_coordinates(HGDI_DC hdcDest, INT32* pnXSrc, INT32* pn
 }
 
 static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest, INT32 nWidth, INT32 nHeight,
-                           HGDI_DC hdcSrc, INT32 nXSrc, INT32 nYSrc, const char* rop,
+                           HGDI_DC hdcSrc, INT32 nXSrc, INT32 nYSrc, DWORD rop,
                            const gdiPalette* palette)
 {
-	INT32 x, y;
+	INT32 y;
 	UINT32 style = 0;
 	BOOL useSrc = FALSE;
 	BOOL usePat = FALSE;
-	const char* iter = rop;
+	BOOL srcCopy = FALSE;
+	BOOL srcInPlace = FALSE;
+	BOOL rc = FALSE;
+	UINT32 srcMask = 0;
+	UINT32 srcBpp = 0;
+	size_t rowSize, scratchSize;
+	BYTE* scratch = NULL;
+	BYTE* pSrcRow = NULL;
+	BYTE* pPatRow = NULL;
+	BYTE* pBlackRow = NULL;
+	BYTE* pWhiteRow = NULL;
+	BYTE* pStack = NULL;
+	BYTE alphaMask[4] = { 0 };
+	UINT32 dstBits, dstBpp;
+	HGDI_BITMAP hSrcBmp = NULL;
+	HGDI_BITMAP hDstBmp;
+	const char* str = gdi_rop_to_string(rop);
+	const char* iter = str;
 
 	while (*iter != '\0')
 	{
@@ -497,58 +558,241 @@ static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest, INT32 nW
 		}
 	}
 
-	if ((nXDest > nXSrc) && (nYDest > nYSrc))
+	if ((nWidth == 0) || (nHeight == 0))
+		return TRUE;
+
+	dstBits = GetBitsPerPixel(hdcDest->format);
+
+	switch (dstBits)
 	{
-		for (y = nHeight - 1; y >= 0; y--)
-		{
-			for (x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
-		}
+		case 32:
+		case 24:
+		case 16:
+		case 15:
+		case 8:
+			break;
+
+		default:
+			WLog_ERR(TAG, "Unsupported format %s", FreeRDPGetColorFormatName(hdcDest->format));
+			return FALSE;
 	}
-	else if (nXDest > nXSrc)
+
+	hDstBmp = (HGDI_BITMAP)hdcDest->selectedObject;
+	dstBpp = GetBytesPerPixel(hdcDest->format);
+	rowSize = 1ull * nWidth * dstBpp;
+
+	if (useSrc)
 	{
-		for (y = 0; y < nHeight; y++)
+		hSrcBmp = (HGDI_BITMAP)hdcSrc->selectedObject;
+		srcBpp = GetBytesPerPixel(hdcSrc->format);
+
+		/* Identical formats only need a byte copy, but X formats read back with
+		 * the unused channel forced on, which is ORed in after the copy.
+		 * 16bpp does not round trip through FreeRDPConvertColor (green channel)
+		 * and 8bpp goes through the palette, both are converted per pixel. */
+		if ((hdcSrc->format == hdcDest->format) &&
+		    ((dstBits == 32) || (dstBits == 24) || (dstBits == 15)))
 		{
-			for (x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+			srcCopy = TRUE;
+			srcMask = FreeRDPConvertColor(0, hdcSrc->format, hdcDest->format, palette);
+			WriteColor(alphaMask, hdcDest->format, srcMask);
+			srcInPlace = (srcMask == 0) && (hSrcBmp->data != hDstBmp->data);
 		}
 	}
-	else if (nYDest > nYSrc)
+
+	scratchSize = 0;
+
+	if (useSrc && !srcInPlace)
+		scratchSize += rowSize;
+
+	if (usePat)
+		scratchSize += rowSize;
+
+	switch (rop)
+	{
+		case GDI_PATCOPY:
+		case GDI_SRCINVERT:
+		case GDI_SRCAND:
+		case GDI_SRCPAINT:
+		case GDI_DSTINVERT:
+		case GDI_NOTSRCCOPY:
+		case GDI_MERGECOPY:
+		case GDI_PATINVERT:
+		case GDI_GLYPH_ORDER:
+			break;
+
+		default:
+			scratchSize += (2 + GDI_ROP_STACK_SIZE) * rowSize;
+			break;
+	}
+
+	if (scratchSize > 0)
 	{
-		for (y = nHeight - 1; y >= 0; y--)
+		BYTE* ptr;
+		scratch = _aligned_malloc(scratchSize, 16);
+
+		if (!scratch)
+			return FALSE;
+
+		ptr = scratch;
+
+		if (useSrc && !srcInPlace)
 		{
-			for (x = 0; x < nWidth; x++)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+			pSrcRow = ptr;
+			ptr += rowSize;
+		}
+
+		if (usePat)
+		{
+			pPatRow = ptr;
+			ptr += rowSize;
+		}
+
+		if (ptr < scratch + scratchSize)
+		{
+			pBlackRow = ptr;
+			pWhiteRow = pBlackRow + rowSize;
+			pStack = pWhiteRow + rowSize;
+			gdi_fill_color_row(pBlackRow, hdcDest->format,
+			                   FreeRDPGetColor(hdcDest->format, 0, 0, 0, 0xFF), nWidth);
+			gdi_fill_color_row(pWhiteRow, hdcDest->format,
+			                   FreeRDPGetColor(hdcDest->format, 0xFF, 0xFF, 0xFF, 0xFF), nWidth);
 		}
 	}
-	else
+
+	if (usePat && (style == GDI_BS_SOLID))
+		gdi_fill_color_row(pPatRow, hdcDest->format, hdcDest->brush->color, nWidth);
+
+	if (!InitOnceExecuteOnce(&gdi_rop_kernels_InitOnce, gdi_rop_kernels_init_cb, NULL, NULL))
+		goto fail;
+
+	for (y = 0; y < nHeight; y++)
 	{
-		for (y = 0; y < nHeight; y++)
+		/* Source and destination may be the same bitmap, walk rows in the
+		 * direction that reads every source row before it is overwritten.
+		 * Within a row the source is gathered first, which handles
+		 * horizontal overlap. */
+		const INT32 row = (nYDest > nYSrc) ? nHeight - 1 - y : y;
+		BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + row);
+		const BYTE* srcRow = NULL;
+
+		if (!dstp)
+		{
+			WLog_ERR(TAG, "dstp=%p", (void*)dstp);
+			goto fail;
+		}
+
+		if (useSrc)
 		{
-			for (x = 0; x < nWidth; x++)
+			const BYTE* srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc + row);
+
+			if (!srcp)
+			{
+				WLog_ERR(TAG, "srcp=%p", (void*)srcp);
+				goto fail;
+			}
+
+			if (srcInPlace)
+				srcRow = srcp;
+			else if (srcCopy)
+			{
+				memmove(pSrcRow, srcp, rowSize);
+
+				if (srcMask != 0)
+				{
+					size_t x;
+
+					for (x = 0; x < rowSize; x += dstBpp)
+					{
+						UINT32 c;
+
+						for (c = 0; c < dstBpp; c++)
+							pSrcRow[x + c] |= alphaMask[c];
+					}
+				}
+
+				srcRow = pSrcRow;
+			}
+			else
 			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest, nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
+				INT32 x;
+
+				for (x = 0; x < nWidth; x++)
+				{
+					UINT32 color = ReadColor(&srcp[x * srcBpp], hdcSrc->format);
+					color = FreeRDPConvertColor(color, hdcSrc->format, hdcDest->format, palette);
+					WriteColor(&pSrcRow[x * dstBpp], hdcDest->format, color);
+				}
+
+				srcRow = pSrcRow;
 			}
 		}
+
+		if (usePat && (style != GDI_BS_SOLID))
+		{
+			if (!gdi_fill_pattern_row(hdcDest, pPatRow, nXDest, nYDest + row, nWidth))
+				goto fail;
+		}
+
+		switch (rop)
+		{
+			case GDI_PATCOPY:
+				memcpy(dstp, pPatRow, rowSize);
+				break;
+
+			case GDI_SRCINVERT:
+				gdi_rop_kernels.DSx(dstp, srcRow, rowSize);
+				break;
+
+			case GDI_SRCAND:
+				gdi_rop_kernels.DSa(dstp, srcRow, rowSize);
+				break;
+
+			case GDI_SRCPAINT:
+				gdi_rop_kernels.DSo(dstp, srcRow, rowSize);
+				break;
+
+			case GDI_DSTINVERT:
+				gdi_rop_kernels.Dn(dstp, rowSize);
+				break;
+
+			case GDI_NOTSRCCOPY:
+				gdi_rop_kernels.Sn(dstp, srcRow, rowSize);
+				break;
+
+			case GDI_MERGECOPY:
+				gdi_rop_kernels.PSa(dstp, srcRow, pPatRow, rowSize);
+				break;
+
+			case GDI_PATINVERT:
+				gdi_rop_kernels.DSx(dstp, pPatRow, rowSize);
+				break;
+
+			case GDI_GLYPH_ORDER:
+				gdi_rop_kernels.SPaDSnao(dstp, srcRow, pPatRow, rowSize);
+				break;
+
+			default:
+				gdi_rop_generic(dstp, srcRow, pPatRow, pBlackRow, pWhiteRow, pStack, str,
+				                rowSize);
+				break;
+		}
+
+		/* The top bit of 15bpp formats without alpha is always written as 0 */
+		if ((dstBits == 15) && !ColorHasAlpha(hdcDest->format))
+		{
+			size_t x;
+
+			for (x = 1; x < rowSize; x += 2)
+				dstp[x] &= 0x7F;
+		}
 	}
 
-	return TRUE;
+	rc = TRUE;
+fail:
+	_aligned_free(scratch);
+	return rc;
 }
-
 /**
  * Perform a bit blit operation on the given pixel buffers.\n
  * @msdn{dd183370}
@@ -628,8 +872,8 @@ BOOL gdi_BitBlt(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest, INT32 nWidth, INT32
 			break;
 
 		default:
-			if (!BitBlt_process(hdcDest, nXDest, nYDest, nWidth, nHeight, hdcSrc, nXSrc, nYSrc,
-			                    gdi_rop_to_string(rop), palette))
+			if (!BitBlt_process(hdcDest, nXDest, nYDest, nWidth, nHeight, hdcSrc, nXSrc, nYSrc, rop,
+			                    palette))
 				return FALSE;
 
 			break;
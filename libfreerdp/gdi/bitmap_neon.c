@@ -0,0 +1,110 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * GDI Raster Operation Row Kernels - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+#include <winpr/sysinfo.h>
+
+#include "bitmap_neon.h"
+
+static void gdi_rop_Dn_neon(BYTE* pDst, size_t len)
+{
+	size_t x = 0;
+
+	for (; x + 16 <= len; x += 16)
+		vst1q_u8(&pDst[x], vmvnq_u8(vld1q_u8(&pDst[x])));
+
+	for (; x < len; x++)
+		pDst[x] = ~pDst[x];
+}
+
+static void gdi_rop_Sn_neon(BYTE* pDst, const BYTE* pSrc, size_t len)
+{
+	size_t x = 0;
+
+	for (; x + 16 <= len; x += 16)
+		vst1q_u8(&pDst[x], vmvnq_u8(vld1q_u8(&pSrc[x])));
+
+	for (; x < len; x++)
+		pDst[x] = ~pSrc[x];
+}
+
+#define GDI_ROP_DS_NEON(_name, _op, _scalar)                                    \
+	static void _name(BYTE* pDst, const BYTE* pSrc, size_t len)                 \
+	{                                                                           \
+		size_t x = 0;                                                           \
+                                                                                \
+		for (; x + 16 <= len; x += 16)                                          \
+			vst1q_u8(&pDst[x], _op(vld1q_u8(&pDst[x]), vld1q_u8(&pSrc[x])));    \
+                                                                                \
+		for (; x < len; x++)                                                    \
+			pDst[x] = _scalar;                                                  \
+	}
+
+GDI_ROP_DS_NEON(gdi_rop_DSa_neon, vandq_u8, pDst[x] & pSrc[x])
+GDI_ROP_DS_NEON(gdi_rop_DSo_neon, vorrq_u8, pDst[x] | pSrc[x])
+GDI_ROP_DS_NEON(gdi_rop_DSx_neon, veorq_u8, pDst[x] ^ pSrc[x])
+
+static void gdi_rop_PSa_neon(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, size_t len)
+{
+	size_t x = 0;
+
+	for (; x + 16 <= len; x += 16)
+		vst1q_u8(&pDst[x], vandq_u8(vld1q_u8(&pPat[x]), vld1q_u8(&pSrc[x])));
+
+	for (; x < len; x++)
+		pDst[x] = pPat[x] & pSrc[x];
+}
+
+static void gdi_rop_SPaDSnao_neon(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, size_t len)
+{
+	size_t x = 0;
+
+	for (; x + 16 <= len; x += 16)
+	{
+		/* vbslq_u8(s, p, d) selects p where s is set and d elsewhere */
+		uint8x16_t s = vld1q_u8(&pSrc[x]);
+		vst1q_u8(&pDst[x], vbslq_u8(s, vld1q_u8(&pPat[x]), vld1q_u8(&pDst[x])));
+	}
+
+	for (; x < len; x++)
+		pDst[x] = (pSrc[x] & pPat[x]) | (pDst[x] & ~pSrc[x]);
+}
+
+void gdi_rop_init_neon(GDI_ROP_KERNELS* kernels)
+{
+	if (!kernels)
+		return;
+
+	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+	{
+		kernels->Dn = gdi_rop_Dn_neon;
+		kernels->Sn = gdi_rop_Sn_neon;
+		kernels->DSa = gdi_rop_DSa_neon;
+		kernels->DSo = gdi_rop_DSo_neon;
+		kernels->DSx = gdi_rop_DSx_neon;
+		kernels->PSa = gdi_rop_PSa_neon;
+		kernels->SPaDSnao = gdi_rop_SPaDSnao_neon;
+	}
+}
+
+#endif /* __ARM_NEON__ */
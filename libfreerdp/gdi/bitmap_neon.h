@@ -0,0 +1,33 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * GDI Raster Operation Row Kernels - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_GDI_BITMAP_NEON_H
+#define FREERDP_LIB_GDI_BITMAP_NEON_H
+
+#include <freerdp/api.h>
+
+#include "rop.h"
+
+FREERDP_LOCAL void gdi_rop_init_neon(GDI_ROP_KERNELS* kernels);
+
+#ifndef GDI_ROP_INIT_SIMD
+#if defined(WITH_NEON)
+#define GDI_ROP_INIT_SIMD(_kernels) gdi_rop_init_neon(_kernels)
+#endif
+#endif
+
+#endif /* FREERDP_LIB_GDI_BITMAP_NEON_H */
@@ -0,0 +1,126 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * GDI Raster Operation Row Kernels - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+
+#include <emmintrin.h>
+
+#include "bitmap_sse2.h"
+
+static void gdi_rop_Dn_sse2(BYTE* pDst, size_t len)
+{
+	size_t x = 0;
+	const __m128i ones = _mm_set1_epi32(-1);
+
+	for (; x + 16 <= len; x += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)&pDst[x]);
+		_mm_storeu_si128((__m128i*)&pDst[x], _mm_xor_si128(d, ones));
+	}
+
+	for (; x < len; x++)
+		pDst[x] = ~pDst[x];
+}
+
+static void gdi_rop_Sn_sse2(BYTE* pDst, const BYTE* pSrc, size_t len)
+{
+	size_t x = 0;
+	const __m128i ones = _mm_set1_epi32(-1);
+
+	for (; x + 16 <= len; x += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)&pSrc[x]);
+		_mm_storeu_si128((__m128i*)&pDst[x], _mm_xor_si128(s, ones));
+	}
+
+	for (; x < len; x++)
+		pDst[x] = ~pSrc[x];
+}
+
+#define GDI_ROP_DS_SSE2(_name, _op, _scalar)                               \
+	static void _name(BYTE* pDst, const BYTE* pSrc, size_t len)            \
+	{                                                                      \
+		size_t x = 0;                                                      \
+                                                                           \
+		for (; x + 16 <= len; x += 16)                                     \
+		{                                                                  \
+			__m128i d = _mm_loadu_si128((const __m128i*)&pDst[x]);         \
+			__m128i s = _mm_loadu_si128((const __m128i*)&pSrc[x]);         \
+			_mm_storeu_si128((__m128i*)&pDst[x], _op(d, s));               \
+		}                                                                  \
+                                                                           \
+		for (; x < len; x++)                                               \
+			pDst[x] = _scalar;                                             \
+	}
+
+GDI_ROP_DS_SSE2(gdi_rop_DSa_sse2, _mm_and_si128, pDst[x] & pSrc[x])
+GDI_ROP_DS_SSE2(gdi_rop_DSo_sse2, _mm_or_si128, pDst[x] | pSrc[x])
+GDI_ROP_DS_SSE2(gdi_rop_DSx_sse2, _mm_xor_si128, pDst[x] ^ pSrc[x])
+
+static void gdi_rop_PSa_sse2(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, size_t len)
+{
+	size_t x = 0;
+
+	for (; x + 16 <= len; x += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)&pSrc[x]);
+		__m128i p = _mm_loadu_si128((const __m128i*)&pPat[x]);
+		_mm_storeu_si128((__m128i*)&pDst[x], _mm_and_si128(p, s));
+	}
+
+	for (; x < len; x++)
+		pDst[x] = pPat[x] & pSrc[x];
+}
+
+static void gdi_rop_SPaDSnao_sse2(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, size_t len)
+{
+	size_t x = 0;
+
+	for (; x + 16 <= len; x += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i*)&pDst[x]);
+		__m128i s = _mm_loadu_si128((const __m128i*)&pSrc[x]);
+		__m128i p = _mm_loadu_si128((const __m128i*)&pPat[x]);
+		/* _mm_andnot_si128(a, b) computes ~a & b */
+		__m128i r = _mm_or_si128(_mm_and_si128(s, p), _mm_andnot_si128(s, d));
+		_mm_storeu_si128((__m128i*)&pDst[x], r);
+	}
+
+	for (; x < len; x++)
+		pDst[x] = (pSrc[x] & pPat[x]) | (pDst[x] & ~pSrc[x]);
+}
+
+void gdi_rop_init_sse2(GDI_ROP_KERNELS* kernels)
+{
+	if (!kernels)
+		return;
+
+	if (IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE))
+	{
+		kernels->Dn = gdi_rop_Dn_sse2;
+		kernels->Sn = gdi_rop_Sn_sse2;
+		kernels->DSa = gdi_rop_DSa_sse2;
+		kernels->DSo = gdi_rop_DSo_sse2;
+		kernels->DSx = gdi_rop_DSx_sse2;
+		kernels->PSa = gdi_rop_PSa_sse2;
+		kernels->SPaDSnao = gdi_rop_SPaDSnao_sse2;
+	}
+}
@@ -23,14 +23,25 @@
 #include "config.h"
 #endif
 
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+#include <winpr/collections.h>
+
 #include "../core/update.h"
+#include "../cache/persistent.h"
+#include "../cache/persistent_gfx.h"
 
 #include <freerdp/log.h>
 #include <freerdp/gdi/gfx.h>
 #include <freerdp/gdi/region.h>
+#include <freerdp/primitives.h>
 
 #define TAG FREERDP_TAG("gdi")
 
+/* [MS-RDPEGFX] 3.3.1.4 bitmap cache size */
+#define GDI_GFX_CACHE_SIZE (100ull * 1024ull * 1024ull)
+#define GDI_GFX_SMALL_CACHE_SIZE (16ull * 1024ull * 1024ull)
+
 static DWORD gfx_align_scanline(DWORD widthInBytes, DWORD alignment)
 {
 	const UINT32 align = alignment;
@@ -43,6 +54,443 @@ static DWORD gfx_align_scanline(DWORD widthInBytes, DWORD alignment)
 	return scanline;
 }
 
+/**
+ * Surface commands of codecs without connection wide state are decoded on a private thread
+ * pool. Every surface has its own queue, so the commands of one surface are decoded in the
+ * order they were received while different surfaces decode concurrently. The channel thread
+ * commits the decoded areas in the order of the commands when the frame ends, or earlier when
+ * a PDU depends on the surface contents.
+ */
+typedef struct
+{
+	gdiGfxSurface* surface;
+	RDPGFX_SURFACE_COMMAND cmd;
+	RDPGFX_AVC444_BITMAP_STREAM avc;
+	REGION16 invalidRegion;
+	UINT status;
+} gdiGfxDecodeJob;
+
+struct gdi_gfx_surface_queue
+{
+	rdpGdi* gdi;
+	CRITICAL_SECTION lock;
+	wQueue* jobs;
+	BOOL running;
+	HANDLE idle;
+	PTP_WORK work;
+	rdpCodecs* codecs;
+};
+typedef struct gdi_gfx_surface_queue gdiGfxSurfaceQueue;
+
+struct gdi_gfx_decoder
+{
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+	wArrayList* jobs; /* decoded or pending commands in the order they were received */
+};
+typedef struct gdi_gfx_decoder gdiGfxDecoder;
+
+static UINT gdi_SurfaceCommand_Decode(rdpGdi* gdi, gdiGfxSurface* surface,
+                                      const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion);
+
+static rdpCodecs* gdi_gfx_surface_codecs(gdiGfxSurface* surface, UINT32 flags)
+{
+	gdiGfxSurfaceQueue* queue = surface->queue;
+
+	if (!queue)
+		return surface->codecs;
+
+	/* The codec contexts of a queue are only used by its decoder thread */
+	if (((flags & FREERDP_CODEC_PLANAR) && !queue->codecs->planar) ||
+	    ((flags & FREERDP_CODEC_PROGRESSIVE) && !queue->codecs->progressive))
+	{
+		if (!freerdp_client_codecs_prepare(queue->codecs, flags, surface->width, surface->height))
+			return NULL;
+	}
+
+	return queue->codecs;
+}
+
+static BOOL gdi_gfx_decode_job_copy_bitstream(gdiGfxDecodeJob* job,
+                                              RDPGFX_AVC420_BITMAP_STREAM* dst,
+                                              const RDPGFX_AVC420_BITMAP_STREAM* src,
+                                              const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	const RDPGFX_H264_METABLOCK* meta = &src->meta;
+	dst->length = src->length;
+	dst->meta.numRegionRects = meta->numRegionRects;
+
+	/* The bitstreams point into the PDU, which is released when the callback returns */
+	if (src->length > 0)
+	{
+		if (!src->data || (src->data < cmd->data) ||
+		    (src->data + src->length > cmd->data + cmd->length))
+			return FALSE;
+
+		dst->data = &job->cmd.data[src->data - cmd->data];
+	}
+
+	if (meta->numRegionRects > 0)
+	{
+		dst->meta.regionRects = (RECTANGLE_16*)calloc(meta->numRegionRects, sizeof(RECTANGLE_16));
+		dst->meta.quantQualityVals = (RDPGFX_H264_QUANT_QUALITY*)calloc(
+		    meta->numRegionRects, sizeof(RDPGFX_H264_QUANT_QUALITY));
+
+		if (!dst->meta.regionRects || !dst->meta.quantQualityVals)
+			return FALSE;
+
+		CopyMemory(dst->meta.regionRects, meta->regionRects,
+		           meta->numRegionRects * sizeof(RECTANGLE_16));
+
+		if (meta->quantQualityVals)
+			CopyMemory(dst->meta.quantQualityVals, meta->quantQualityVals,
+			           meta->numRegionRects * sizeof(RDPGFX_H264_QUANT_QUALITY));
+	}
+
+	return TRUE;
+}
+
+static void gdi_gfx_decode_job_free(gdiGfxDecodeJob* job)
+{
+	UINT32 x;
+
+	if (!job)
+		return;
+
+	for (x = 0; x < ARRAYSIZE(job->avc.bitstream); x++)
+	{
+		free(job->avc.bitstream[x].meta.regionRects);
+		free(job->avc.bitstream[x].meta.quantQualityVals);
+	}
+
+	region16_uninit(&job->invalidRegion);
+	free(job->cmd.data);
+	free(job);
+}
+
+static gdiGfxDecodeJob* gdi_gfx_decode_job_new(gdiGfxSurface* surface,
+                                               const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	gdiGfxDecodeJob* job = (gdiGfxDecodeJob*)calloc(1, sizeof(gdiGfxDecodeJob));
+
+	if (!job)
+		return NULL;
+
+	job->surface = surface;
+	job->cmd = *cmd;
+	job->cmd.data = NULL;
+	job->cmd.extra = NULL;
+	region16_init(&job->invalidRegion);
+
+	if (cmd->length > 0)
+	{
+		job->cmd.data = (BYTE*)malloc(cmd->length);
+
+		if (!job->cmd.data)
+			goto fail;
+
+		CopyMemory(job->cmd.data, cmd->data, cmd->length);
+	}
+
+	if (cmd->extra)
+	{
+		switch (cmd->codecId)
+		{
+			case RDPGFX_CODECID_AVC420:
+				if (!gdi_gfx_decode_job_copy_bitstream(
+				        job, &job->avc.bitstream[0],
+				        (const RDPGFX_AVC420_BITMAP_STREAM*)cmd->extra, cmd))
+					goto fail;
+
+				job->cmd.extra = &job->avc.bitstream[0];
+				break;
+
+			case RDPGFX_CODECID_AVC444v2:
+			case RDPGFX_CODECID_AVC444:
+			{
+				UINT32 x;
+				const RDPGFX_AVC444_BITMAP_STREAM* bs =
+				    (const RDPGFX_AVC444_BITMAP_STREAM*)cmd->extra;
+				job->avc.cbAvc420EncodedBitstream1 = bs->cbAvc420EncodedBitstream1;
+				job->avc.LC = bs->LC;
+
+				for (x = 0; x < ARRAYSIZE(bs->bitstream); x++)
+				{
+					if (!gdi_gfx_decode_job_copy_bitstream(job, &job->avc.bitstream[x],
+					                                       &bs->bitstream[x], cmd))
+						goto fail;
+				}
+
+				job->cmd.extra = &job->avc;
+			}
+			break;
+
+			default:
+				break;
+		}
+	}
+
+	return job;
+fail:
+	gdi_gfx_decode_job_free(job);
+	return NULL;
+}
+
+static void CALLBACK gdi_gfx_surface_queue_work_callback(PTP_CALLBACK_INSTANCE instance,
+                                                         void* context, PTP_WORK work)
+{
+	gdiGfxSurface* surface = (gdiGfxSurface*)context;
+	gdiGfxSurfaceQueue* queue = surface->queue;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	for (;;)
+	{
+		gdiGfxDecodeJob* job;
+		EnterCriticalSection(&queue->lock);
+		job = (gdiGfxDecodeJob*)Queue_Dequeue(queue->jobs);
+
+		if (!job)
+		{
+			queue->running = FALSE;
+			SetEvent(queue->idle);
+			LeaveCriticalSection(&queue->lock);
+			break;
+		}
+
+		LeaveCriticalSection(&queue->lock);
+		job->status = gdi_SurfaceCommand_Decode(queue->gdi, surface, &job->cmd, &job->invalidRegion);
+	}
+}
+
+static void gdi_gfx_surface_queue_wait(gdiGfxSurfaceQueue* queue)
+{
+	WaitForSingleObject(queue->idle, INFINITE);
+	/* Acquire what the decoder thread wrote before it released the lock as idle */
+	EnterCriticalSection(&queue->lock);
+	LeaveCriticalSection(&queue->lock);
+}
+
+static void gdi_gfx_surface_queue_free(gdiGfxSurfaceQueue* queue)
+{
+	if (!queue)
+		return;
+
+	if (queue->work)
+	{
+		gdi_gfx_surface_queue_wait(queue);
+		WaitForThreadpoolWorkCallbacks(queue->work, FALSE);
+		CloseThreadpoolWork(queue->work);
+	}
+
+	Queue_Free(queue->jobs);
+	codecs_free(queue->codecs);
+
+	if (queue->idle)
+		CloseHandle(queue->idle);
+
+	DeleteCriticalSection(&queue->lock);
+	free(queue);
+}
+
+static gdiGfxSurfaceQueue* gdi_gfx_surface_queue_new(rdpGdi* gdi, gdiGfxSurface* surface)
+{
+	gdiGfxSurfaceQueue* queue = (gdiGfxSurfaceQueue*)calloc(1, sizeof(gdiGfxSurfaceQueue));
+
+	if (!queue)
+		return NULL;
+
+	queue->gdi = gdi;
+	InitializeCriticalSection(&queue->lock);
+
+	if (!(queue->idle = CreateEvent(NULL, TRUE, TRUE, NULL)))
+		goto fail;
+
+	if (!(queue->jobs = Queue_New(FALSE, -1, -1)))
+		goto fail;
+
+	if (!(queue->codecs = codecs_new(gdi->context)))
+		goto fail;
+
+	if (!(queue->work = CreateThreadpoolWork(gdi_gfx_surface_queue_work_callback, (void*)surface,
+	                                         &gdi->gfxDecoder->environment)))
+		goto fail;
+
+	return queue;
+fail:
+	gdi_gfx_surface_queue_free(queue);
+	return NULL;
+}
+
+static UINT gdi_gfx_surface_queue_submit(rdpGdi* gdi, gdiGfxSurface* surface,
+                                         const RDPGFX_SURFACE_COMMAND* cmd)
+{
+	gdiGfxSurfaceQueue* queue = surface->queue;
+	gdiGfxDecodeJob* job = gdi_gfx_decode_job_new(surface, cmd);
+
+	if (!job)
+		return CHANNEL_RC_NO_MEMORY;
+
+	if (ArrayList_Add(gdi->gfxDecoder->jobs, job) < 0)
+	{
+		gdi_gfx_decode_job_free(job);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	EnterCriticalSection(&queue->lock);
+
+	if (!Queue_Enqueue(queue->jobs, job))
+	{
+		LeaveCriticalSection(&queue->lock);
+		ArrayList_Remove(gdi->gfxDecoder->jobs, job);
+		gdi_gfx_decode_job_free(job);
+		return CHANNEL_RC_NO_MEMORY;
+	}
+
+	if (!queue->running)
+	{
+		queue->running = TRUE;
+		ResetEvent(queue->idle);
+		SubmitThreadpoolWork(queue->work);
+	}
+
+	LeaveCriticalSection(&queue->lock);
+	return CHANNEL_RC_OK;
+}
+
+static UINT gdi_SurfaceCommand_Commit(RdpgfxClientContext* context, gdiGfxSurface* surface,
+                                      const REGION16* invalidRegion)
+{
+	UINT status;
+	UINT32 x, nrRects;
+	const RECTANGLE_16* rects = region16_rects(invalidRegion, &nrRects);
+	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
+	                      nrRects, rects);
+
+	if (status != CHANNEL_RC_OK)
+		return status;
+
+	for (x = 0; x < nrRects; x++)
+		region16_union_rect(&surface->invalidRegion, &surface->invalidRegion, &rects[x]);
+
+	return CHANNEL_RC_OK;
+}
+
+/**
+ * Wait for the queued surface commands of a surface, or of all surfaces when surface is NULL,
+ * and commit their updates in the order the commands were received.
+ *
+ * @return 0 on success, otherwise the first error of the committed commands
+ */
+static UINT gdi_gfx_decoder_flush(rdpGdi* gdi, RdpgfxClientContext* context,
+                                  gdiGfxSurface* surface)
+{
+	int index = 0;
+	UINT status = CHANNEL_RC_OK;
+	wArrayList* jobs;
+
+	if (!gdi->gfxDecoder)
+		return CHANNEL_RC_OK;
+
+	jobs = gdi->gfxDecoder->jobs;
+
+	if (surface && surface->queue)
+		gdi_gfx_surface_queue_wait(surface->queue);
+
+	while (index < ArrayList_Count(jobs))
+	{
+		UINT rc;
+		gdiGfxDecodeJob* job = (gdiGfxDecodeJob*)ArrayList_GetItem(jobs, index);
+
+		if (surface && (job->surface != surface))
+		{
+			index++;
+			continue;
+		}
+
+		gdi_gfx_surface_queue_wait(job->surface->queue);
+		rc = job->status;
+
+		if (rc == CHANNEL_RC_OK)
+			rc = gdi_SurfaceCommand_Commit(context, job->surface, &job->invalidRegion);
+
+		if (status == CHANNEL_RC_OK)
+			status = rc;
+
+		ArrayList_RemoveAt(jobs, index);
+		gdi_gfx_decode_job_free(job);
+	}
+
+	return status;
+}
+
+static void gdi_gfx_decoder_free(gdiGfxDecoder* decoder)
+{
+	if (!decoder)
+		return;
+
+	if (decoder->jobs)
+	{
+		int index;
+
+		for (index = 0; index < ArrayList_Count(decoder->jobs); index++)
+			gdi_gfx_decode_job_free((gdiGfxDecodeJob*)ArrayList_GetItem(decoder->jobs, index));
+
+		ArrayList_Free(decoder->jobs);
+	}
+
+	if (decoder->pool)
+	{
+		CloseThreadpool(decoder->pool);
+		DestroyThreadpoolEnvironment(&decoder->environment);
+	}
+
+	free(decoder);
+}
+
+static gdiGfxDecoder* gdi_gfx_decoder_new(const rdpSettings* settings)
+{
+	DWORD threads = settings->GfxDecodeThreads;
+	gdiGfxDecoder* decoder;
+
+	if (threads == 0)
+	{
+		SYSTEM_INFO sysinfo;
+		GetNativeSystemInfo(&sysinfo);
+		threads = sysinfo.dwNumberOfProcessors;
+	}
+
+	/* With a single thread the channel thread decodes the commands itself */
+	if (threads <= 1)
+		return NULL;
+
+	decoder = (gdiGfxDecoder*)calloc(1, sizeof(gdiGfxDecoder));
+
+	if (!decoder)
+		return NULL;
+
+	/* Initialize the primitives before any decoder thread uses them */
+	primitives_get();
+
+	if (!(decoder->jobs = ArrayList_New(FALSE)))
+		goto fail;
+
+	if (!(decoder->pool = CreateThreadpool(NULL)))
+		goto fail;
+
+	InitializeThreadpoolEnvironment(&decoder->environment);
+	SetThreadpoolCallbackPool(&decoder->environment, decoder->pool);
+	SetThreadpoolThreadMaximum(decoder->pool, threads);
+
+	if (!SetThreadpoolThreadMinimum(decoder->pool, threads))
+		goto fail;
+
+	return decoder;
+fail:
+	gdi_gfx_decoder_free(decoder);
+	return NULL;
+}
+
 /**
  * Function description
  *
@@ -62,6 +510,12 @@ static UINT gdi_ResetGraphics(RdpgfxClientContext* context,
 	rdpUpdate* update = gdi->context->update;
 	rdpSettings* settings = gdi->context->settings;
 	EnterCriticalSection(&context->mux);
+	rc = gdi_gfx_decoder_flush(gdi, context, NULL);
+
+	if (rc != CHANNEL_RC_OK)
+		goto fail;
+
+	rc = ERROR_INTERNAL_ERROR;
 	DesktopWidth = resetGraphics->width;
 	DesktopHeight = resetGraphics->height;
 
@@ -80,7 +534,15 @@ static UINT gdi_ResetGraphics(RdpgfxClientContext* context,
 	{
 		surface = (gdiGfxSurface*)context->GetSurfaceData(context, pSurfaceIds[index]);
 
-		if (!surface || !surface->outputMapped)
+		if (!surface)
+			continue;
+
+		if (surface->queue &&
+		    !freerdp_client_codecs_reset(surface->queue->codecs, FREERDP_CODEC_ALL, surface->width,
+		                                 surface->height))
+			goto fail;
+
+		if (!surface->outputMapped)
 			continue;
 
 		region16_clear(&surface->invalidRegion);
@@ -171,8 +633,12 @@ static UINT gdi_UpdateSurfaces(RdpgfxClientContext* context)
 		return CHANNEL_RC_OK;
 
 	EnterCriticalSection(&context->mux);
+	status = gdi_gfx_decoder_flush(gdi, context, NULL);
+
+	if (status != CHANNEL_RC_OK)
+		goto fail;
+
 	context->GetSurfaceIds(context, &pSurfaceIds, &count);
-	status = CHANNEL_RC_OK;
 
 	for (index = 0; index < count; index++)
 	{
@@ -198,6 +664,7 @@ static UINT gdi_UpdateSurfaces(RdpgfxClientContext* context)
 	}
 
 	free(pSurfaceIds);
+fail:
 	LeaveCriticalSection(&context->mux);
 	return status;
 }
@@ -221,9 +688,19 @@ static UINT gdi_StartFrame(RdpgfxClientContext* context, const RDPGFX_START_FRAM
  */
 static UINT gdi_EndFrame(RdpgfxClientContext* context, const RDPGFX_END_FRAME_PDU* endFrame)
 {
-	UINT status = CHANNEL_RC_NOT_INITIALIZED;
+	UINT status;
 	rdpGdi* gdi = (rdpGdi*)context->custom;
-	IFCALLRET(context->UpdateSurfaces, status, context);
+	/* Commit the decoded frame before it is acknowledged */
+	EnterCriticalSection(&context->mux);
+	status = gdi_gfx_decoder_flush(gdi, context, NULL);
+	LeaveCriticalSection(&context->mux);
+
+	if (status == CHANNEL_RC_OK)
+	{
+		status = CHANNEL_RC_NOT_INITIALIZED;
+		IFCALLRET(context->UpdateSurfaces, status, context);
+	}
+
 	gdi->inGfxFrame = FALSE;
 	return status;
 }
@@ -233,20 +710,11 @@ static UINT gdi_EndFrame(RdpgfxClientContext* context, const RDPGFX_END_FRAME_PD
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_Uncompressed(rdpGdi* gdi, RdpgfxClientContext* context,
-                                            const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_Uncompressed(rdpGdi* gdi, gdiGfxSurface* surface,
+                                            const RDPGFX_SURFACE_COMMAND* cmd,
+                                            REGION16* invalidRegion)
 {
-	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface;
 	RECTANGLE_16 invalidRect;
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
 
 	if (!freerdp_image_copy(surface->data, surface->format, surface->scanline, cmd->left, cmd->top,
 	                        cmd->width, cmd->height, cmd->data, cmd->format, 0, 0, 0, NULL,
@@ -257,21 +725,8 @@ static UINT gdi_SurfaceCommand_Uncompressed(rdpGdi* gdi, RdpgfxClientContext* co
 	invalidRect.top = cmd->top;
 	invalidRect.right = cmd->right;
 	invalidRect.bottom = cmd->bottom;
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	if (!gdi->inGfxFrame)
-	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
-	}
-
-fail:
-	return status;
+	region16_union_rect(invalidRegion, invalidRegion, &invalidRect);
+	return CHANNEL_RC_OK;
 }
 
 /**
@@ -279,53 +734,20 @@ fail:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_RemoteFX(rdpGdi* gdi, RdpgfxClientContext* context,
-                                        const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_RemoteFX(rdpGdi* gdi, gdiGfxSurface* surface,
+                                        const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
 {
-	UINT status = ERROR_INTERNAL_ERROR;
-	gdiGfxSurface* surface;
-	REGION16 invalidRegion;
-	const RECTANGLE_16* rects;
-	UINT32 nrRects, x;
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
 	rfx_context_set_pixel_format(surface->codecs->rfx, cmd->format);
-	region16_init(&invalidRegion);
 
 	if (!rfx_process_message(surface->codecs->rfx, cmd->data, cmd->length, cmd->left, cmd->top,
 	                         surface->data, surface->format, surface->scanline, surface->height,
-	                         &invalidRegion))
+	                         invalidRegion))
 	{
 		WLog_ERR(TAG, "Failed to process RemoteFX message");
-		goto fail;
-	}
-
-	rects = region16_rects(&invalidRegion, &nrRects);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      nrRects, rects);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	for (x = 0; x < nrRects; x++)
-		region16_union_rect(&surface->invalidRegion, &surface->invalidRegion, &rects[x]);
-
-	if (!gdi->inGfxFrame)
-	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
+		return ERROR_INTERNAL_ERROR;
 	}
 
-fail:
-	region16_uninit(&invalidRegion);
-	return status;
+	return CHANNEL_RC_OK;
 }
 
 /**
@@ -333,22 +755,12 @@ fail:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_ClearCodec(rdpGdi* gdi, RdpgfxClientContext* context,
-                                          const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_ClearCodec(rdpGdi* gdi, gdiGfxSurface* surface,
+                                          const RDPGFX_SURFACE_COMMAND* cmd,
+                                          REGION16* invalidRegion)
 {
 	INT32 rc;
-	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface;
 	RECTANGLE_16 invalidRect;
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
 	rc = clear_decompress(surface->codecs->clear, cmd->data, cmd->length, cmd->width, cmd->height,
 	                      surface->data, surface->format, surface->scanline, cmd->left, cmd->top,
 	                      surface->width, surface->height, &gdi->palette);
@@ -363,21 +775,8 @@ static UINT gdi_SurfaceCommand_ClearCodec(rdpGdi* gdi, RdpgfxClientContext* cont
 	invalidRect.top = cmd->top;
 	invalidRect.right = cmd->right;
 	invalidRect.bottom = cmd->bottom;
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	if (!gdi->inGfxFrame)
-	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
-	}
-
-fail:
-	return status;
+	region16_union_rect(invalidRegion, invalidRegion, &invalidRect);
+	return CHANNEL_RC_OK;
 }
 
 /**
@@ -385,26 +784,17 @@ fail:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_Planar(rdpGdi* gdi, RdpgfxClientContext* context,
-                                      const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_Planar(rdpGdi* gdi, gdiGfxSurface* surface,
+                                      const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
 {
-	UINT status = CHANNEL_RC_OK;
-	BYTE* DstData = NULL;
-	gdiGfxSurface* surface;
 	RECTANGLE_16 invalidRect;
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
+	rdpCodecs* codecs = gdi_gfx_surface_codecs(surface, FREERDP_CODEC_PLANAR);
 
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
-	DstData = surface->data;
+	if (!codecs)
+		return ERROR_INTERNAL_ERROR;
 
-	if (!planar_decompress(surface->codecs->planar, cmd->data, cmd->length, cmd->width, cmd->height,
-	                       DstData, surface->format, surface->scanline, cmd->left, cmd->top,
+	if (!planar_decompress(codecs->planar, cmd->data, cmd->length, cmd->width, cmd->height,
+	                       surface->data, surface->format, surface->scanline, cmd->left, cmd->top,
 	                       cmd->width, cmd->height, FALSE))
 		return ERROR_INTERNAL_ERROR;
 
@@ -412,64 +802,49 @@ static UINT gdi_SurfaceCommand_Planar(rdpGdi* gdi, RdpgfxClientContext* context,
 	invalidRect.top = cmd->top;
 	invalidRect.right = cmd->right;
 	invalidRect.bottom = cmd->bottom;
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
+	region16_union_rect(invalidRegion, invalidRegion, &invalidRect);
+	return CHANNEL_RC_OK;
+}
 
-	if (!gdi->inGfxFrame)
+#ifdef WITH_GFX_H264
+static UINT gdi_SurfaceCommand_PrepareH264(gdiGfxSurface* surface)
+{
+	if (!surface->h264)
 	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
+		surface->h264 = h264_context_new(FALSE);
+
+		if (!surface->h264)
+		{
+			WLog_ERR(TAG, "%s: unable to create h264 context", __FUNCTION__);
+			return ERROR_NOT_ENOUGH_MEMORY;
+		}
+
+		if (!h264_context_reset(surface->h264, surface->width, surface->height))
+			return ERROR_INTERNAL_ERROR;
 	}
 
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 }
+#endif
 
 /**
  * Function description
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_AVC420(rdpGdi* gdi, RdpgfxClientContext* context,
-                                      const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_AVC420(rdpGdi* gdi, gdiGfxSurface* surface,
+                                      const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
 {
 #ifdef WITH_GFX_H264
 	INT32 rc;
-	UINT status = CHANNEL_RC_OK;
 	UINT32 i;
-	gdiGfxSurface* surface;
+	UINT status;
 	RDPGFX_H264_METABLOCK* meta;
 	RDPGFX_AVC420_BITMAP_STREAM* bs;
+	status = gdi_SurfaceCommand_PrepareH264(surface);
 
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
-	if (!surface->h264)
-	{
-		surface->h264 = h264_context_new(FALSE);
-
-		if (!surface->h264)
-		{
-			WLog_ERR(TAG, "%s: unable to create h264 context", __FUNCTION__);
-			return ERROR_NOT_ENOUGH_MEMORY;
-		}
-
-		if (!h264_context_reset(surface->h264, surface->width, surface->height))
-			return ERROR_INTERNAL_ERROR;
-	}
-
-	if (!surface->h264)
-		return ERROR_NOT_SUPPORTED;
+	if (status != CHANNEL_RC_OK)
+		return status;
 
 	bs = (RDPGFX_AVC420_BITMAP_STREAM*)cmd->extra;
 
@@ -488,25 +863,9 @@ static UINT gdi_SurfaceCommand_AVC420(rdpGdi* gdi, RdpgfxClientContext* context,
 	}
 
 	for (i = 0; i < meta->numRegionRects; i++)
-	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    (RECTANGLE_16*)&(meta->regionRects[i]));
-	}
-
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      meta->numRegionRects, meta->regionRects);
+		region16_union_rect(invalidRegion, invalidRegion, &(meta->regionRects[i]));
 
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	if (!gdi->inGfxFrame)
-	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
-	}
-
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 #else
 	return ERROR_NOT_SUPPORTED;
 #endif
@@ -517,44 +876,22 @@ fail:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_AVC444(rdpGdi* gdi, RdpgfxClientContext* context,
-                                      const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_AVC444(rdpGdi* gdi, gdiGfxSurface* surface,
+                                      const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
 {
 #ifdef WITH_GFX_H264
 	INT32 rc;
-	UINT status = CHANNEL_RC_OK;
 	UINT32 i;
-	gdiGfxSurface* surface;
+	UINT status;
 	RDPGFX_AVC444_BITMAP_STREAM* bs;
 	RDPGFX_AVC420_BITMAP_STREAM* avc1;
 	RDPGFX_H264_METABLOCK* meta1;
 	RDPGFX_AVC420_BITMAP_STREAM* avc2;
 	RDPGFX_H264_METABLOCK* meta2;
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
+	status = gdi_SurfaceCommand_PrepareH264(surface);
 
-	if (!surface->h264)
-	{
-		surface->h264 = h264_context_new(FALSE);
-
-		if (!surface->h264)
-		{
-			WLog_ERR(TAG, "%s: unable to create h264 context", __FUNCTION__);
-			return ERROR_NOT_ENOUGH_MEMORY;
-		}
-
-		if (!h264_context_reset(surface->h264, surface->width, surface->height))
-			return ERROR_INTERNAL_ERROR;
-	}
-
-	if (!surface->h264)
-		return ERROR_NOT_SUPPORTED;
+	if (status != CHANNEL_RC_OK)
+		return status;
 
 	bs = (RDPGFX_AVC444_BITMAP_STREAM*)cmd->extra;
 
@@ -572,42 +909,17 @@ static UINT gdi_SurfaceCommand_AVC444(rdpGdi* gdi, RdpgfxClientContext* context,
 
 	if (rc < 0)
 	{
-		WLog_WARN(TAG, "avc444_decompress failure: %" PRIu32 ", ignoring update.", status);
+		WLog_WARN(TAG, "avc444_decompress failure: %" PRId32 ", ignoring update.", rc);
 		return CHANNEL_RC_OK;
 	}
 
 	for (i = 0; i < meta1->numRegionRects; i++)
-	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    &(meta1->regionRects[i]));
-	}
-
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      meta1->numRegionRects, meta1->regionRects);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
+		region16_union_rect(invalidRegion, invalidRegion, &(meta1->regionRects[i]));
 
 	for (i = 0; i < meta2->numRegionRects; i++)
-	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    &(meta2->regionRects[i]));
-	}
-
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      meta2->numRegionRects, meta2->regionRects);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	if (!gdi->inGfxFrame)
-	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
-	}
+		region16_union_rect(invalidRegion, invalidRegion, &(meta2->regionRects[i]));
 
-fail:
-	return status;
+	return CHANNEL_RC_OK;
 #else
 	return ERROR_NOT_SUPPORTED;
 #endif
@@ -653,12 +965,10 @@ static BOOL gdi_apply_alpha(BYTE* data, UINT32 format, UINT32 stride, RECTANGLE_
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_Alpha(rdpGdi* gdi, RdpgfxClientContext* context,
-                                     const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_Alpha(rdpGdi* gdi, gdiGfxSurface* surface,
+                                     const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
 {
-	UINT status = CHANNEL_RC_OK;
 	UINT16 alphaSig, compressed;
-	gdiGfxSurface* surface;
 	RECTANGLE_16 invalidRect;
 	wStream s;
 	Stream_StaticInit(&s, cmd->data, cmd->length);
@@ -666,15 +976,6 @@ static UINT gdi_SurfaceCommand_Alpha(rdpGdi* gdi, RdpgfxClientContext* context,
 	if (Stream_GetRemainingLength(&s) < 4)
 		return ERROR_INVALID_DATA;
 
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
-
 	Stream_Read_UINT16(&s, alphaSig);
 	Stream_Read_UINT16(&s, compressed);
 
@@ -759,21 +1060,8 @@ static UINT gdi_SurfaceCommand_Alpha(rdpGdi* gdi, RdpgfxClientContext* context,
 	invalidRect.top = cmd->top;
 	invalidRect.right = cmd->right;
 	invalidRect.bottom = cmd->bottom;
-	region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId, 1,
-	                      &invalidRect);
-
-	if (status != CHANNEL_RC_OK)
-		goto fail;
-
-	if (!gdi->inGfxFrame)
-	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
-	}
-
-fail:
-	return status;
+	region16_union_rect(invalidRegion, invalidRegion, &invalidRect);
+	return CHANNEL_RC_OK;
 }
 
 /**
@@ -781,31 +1069,23 @@ fail:
  *
  * @return 0 on success, otherwise a Win32 error code
  */
-static UINT gdi_SurfaceCommand_Progressive(rdpGdi* gdi, RdpgfxClientContext* context,
-                                           const RDPGFX_SURFACE_COMMAND* cmd)
+static UINT gdi_SurfaceCommand_Progressive(rdpGdi* gdi, gdiGfxSurface* surface,
+                                           const RDPGFX_SURFACE_COMMAND* cmd,
+                                           REGION16* invalidRegion)
 {
 	INT32 rc;
-	UINT status = CHANNEL_RC_OK;
-	gdiGfxSurface* surface;
-	REGION16 invalidRegion;
-	const RECTANGLE_16* rects;
-	UINT32 nrRects, x;
+	rdpCodecs* codecs = gdi_gfx_surface_codecs(surface, FREERDP_CODEC_PROGRESSIVE);
+
 	/**
 	 * Note: Since this comes via a Wire-To-Surface-2 PDU the
 	 * cmd's top/left/right/bottom/width/height members are always zero!
 	 * The update region is determined during decompression.
 	 */
-	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
-
-	if (!surface)
-	{
-		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
-		         cmd->surfaceId);
-		return ERROR_NOT_FOUND;
-	}
+	if (!codecs)
+		return ERROR_INTERNAL_ERROR;
 
-	rc = progressive_create_surface_context(surface->codecs->progressive, cmd->surfaceId,
-	                                        surface->width, surface->height);
+	rc = progressive_create_surface_context(codecs->progressive, cmd->surfaceId, surface->width,
+	                                        surface->height);
 
 	if (rc < 0)
 	{
@@ -813,40 +1093,100 @@ static UINT gdi_SurfaceCommand_Progressive(rdpGdi* gdi, RdpgfxClientContext* con
 		return ERROR_INTERNAL_ERROR;
 	}
 
-	region16_init(&invalidRegion);
-	rc = progressive_decompress(surface->codecs->progressive, cmd->data, cmd->length, surface->data,
+	rc = progressive_decompress(codecs->progressive, cmd->data, cmd->length, surface->data,
 	                            surface->format, surface->scanline, cmd->left, cmd->top,
-	                            &invalidRegion, cmd->surfaceId);
+	                            invalidRegion, cmd->surfaceId);
 
 	if (rc < 0)
 	{
 		WLog_ERR(TAG, "progressive_decompress failure: %" PRId32 "", rc);
-		region16_uninit(&invalidRegion);
 		return ERROR_INTERNAL_ERROR;
 	}
 
-	rects = region16_rects(&invalidRegion, &nrRects);
-	status = IFCALLRESULT(CHANNEL_RC_OK, context->UpdateSurfaceArea, context, surface->surfaceId,
-	                      nrRects, rects);
+	return CHANNEL_RC_OK;
+}
 
-	if (status != CHANNEL_RC_OK)
-		goto fail;
+/**
+ * Decode a surface command into the surface data and collect the updated area in
+ * invalidRegion. Called on a decoder thread for the codecs gdi_SurfaceCommand_Threaded
+ * accepts, on the channel thread otherwise.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_SurfaceCommand_Decode(rdpGdi* gdi, gdiGfxSurface* surface,
+                                      const RDPGFX_SURFACE_COMMAND* cmd, REGION16* invalidRegion)
+{
+	UINT status = CHANNEL_RC_OK;
+
+	switch (cmd->codecId)
+	{
+		case RDPGFX_CODECID_UNCOMPRESSED:
+			status = gdi_SurfaceCommand_Uncompressed(gdi, surface, cmd, invalidRegion);
+			break;
+
+		case RDPGFX_CODECID_CAVIDEO:
+			status = gdi_SurfaceCommand_RemoteFX(gdi, surface, cmd, invalidRegion);
+			break;
+
+		case RDPGFX_CODECID_CLEARCODEC:
+			status = gdi_SurfaceCommand_ClearCodec(gdi, surface, cmd, invalidRegion);
+			break;
+
+		case RDPGFX_CODECID_PLANAR:
+			status = gdi_SurfaceCommand_Planar(gdi, surface, cmd, invalidRegion);
+			break;
+
+		case RDPGFX_CODECID_AVC420:
+			status = gdi_SurfaceCommand_AVC420(gdi, surface, cmd, invalidRegion);
+			break;
+
+		case RDPGFX_CODECID_AVC444v2:
+		case RDPGFX_CODECID_AVC444:
+			status = gdi_SurfaceCommand_AVC444(gdi, surface, cmd, invalidRegion);
+			break;
 
-	for (x = 0; x < nrRects; x++)
-		region16_union_rect(&surface->invalidRegion, &surface->invalidRegion, &rects[x]);
+		case RDPGFX_CODECID_ALPHA:
+			status = gdi_SurfaceCommand_Alpha(gdi, surface, cmd, invalidRegion);
+			break;
 
-	region16_uninit(&invalidRegion);
+		case RDPGFX_CODECID_CAPROGRESSIVE:
+			status = gdi_SurfaceCommand_Progressive(gdi, surface, cmd, invalidRegion);
+			break;
 
-	if (!gdi->inGfxFrame)
-	{
-		status = CHANNEL_RC_NOT_INITIALIZED;
-		IFCALLRET(context->UpdateSurfaces, status, context);
+		case RDPGFX_CODECID_CAPROGRESSIVE_V2:
+			WLog_WARN(TAG, "SurfaceCommand 0x%08" PRIX32 " not implemented", cmd->codecId);
+			break;
+
+		default:
+			WLog_WARN(TAG, "Invalid SurfaceCommand 0x%08" PRIX32 "", cmd->codecId);
+			break;
 	}
 
-fail:
 	return status;
 }
 
+/**
+ * ClearCodec keeps its glyph and band caches for the whole connection and RemoteFX decodes
+ * tiles on its own thread pool, both stay on the channel thread.
+ */
+static BOOL gdi_SurfaceCommand_Threaded(UINT32 codecId)
+{
+	switch (codecId)
+	{
+		case RDPGFX_CODECID_UNCOMPRESSED:
+		case RDPGFX_CODECID_PLANAR:
+		case RDPGFX_CODECID_AVC420:
+		case RDPGFX_CODECID_AVC444v2:
+		case RDPGFX_CODECID_AVC444:
+		case RDPGFX_CODECID_ALPHA:
+		case RDPGFX_CODECID_CAPROGRESSIVE:
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
+}
+
 /**
  * Function description
  *
@@ -856,6 +1196,8 @@ static UINT gdi_SurfaceCommand(RdpgfxClientContext* context, const RDPGFX_SURFAC
 {
 	UINT status = CHANNEL_RC_OK;
 	rdpGdi* gdi;
+	gdiGfxSurface* surface;
+	REGION16 invalidRegion;
 
 	if (!context || !cmd)
 		return ERROR_INVALID_PARAMETER;
@@ -871,51 +1213,50 @@ static UINT gdi_SurfaceCommand(RdpgfxClientContext* context, const RDPGFX_SURFAC
 	           cmd->surfaceId, cmd->codecId, cmd->contextId, FreeRDPGetColorFormatName(cmd->format),
 	           cmd->left, cmd->top, cmd->right, cmd->bottom, cmd->width, cmd->height, cmd->length,
 	           (void*)cmd->data, (void*)cmd->extra);
+	surface = (gdiGfxSurface*)context->GetSurfaceData(context, cmd->surfaceId);
 
-	switch (cmd->codecId)
+	if (!surface)
 	{
-		case RDPGFX_CODECID_UNCOMPRESSED:
-			status = gdi_SurfaceCommand_Uncompressed(gdi, context, cmd);
-			break;
-
-		case RDPGFX_CODECID_CAVIDEO:
-			status = gdi_SurfaceCommand_RemoteFX(gdi, context, cmd);
-			break;
+		WLog_ERR(TAG, "%s: unable to retrieve surfaceData for surfaceId=%" PRIu32 "", __FUNCTION__,
+		         cmd->surfaceId);
+		status = ERROR_NOT_FOUND;
+		goto fail;
+	}
 
-		case RDPGFX_CODECID_CLEARCODEC:
-			status = gdi_SurfaceCommand_ClearCodec(gdi, context, cmd);
-			break;
+	if (surface->queue && gdi_SurfaceCommand_Threaded(cmd->codecId))
+	{
+		status = gdi_gfx_surface_queue_submit(gdi, surface, cmd);
 
-		case RDPGFX_CODECID_PLANAR:
-			status = gdi_SurfaceCommand_Planar(gdi, context, cmd);
-			break;
+		/* Outside of a frame the update is shown right away */
+		if ((status == CHANNEL_RC_OK) && !gdi->inGfxFrame)
+			status = gdi_gfx_decoder_flush(gdi, context, surface);
+	}
+	else
+	{
+		status = gdi_gfx_decoder_flush(gdi, context, surface);
 
-		case RDPGFX_CODECID_AVC420:
-			status = gdi_SurfaceCommand_AVC420(gdi, context, cmd);
-			break;
+		if (status != CHANNEL_RC_OK)
+			goto fail;
 
-		case RDPGFX_CODECID_AVC444v2:
-		case RDPGFX_CODECID_AVC444:
-			status = gdi_SurfaceCommand_AVC444(gdi, context, cmd);
-			break;
+		region16_init(&invalidRegion);
+		status = gdi_SurfaceCommand_Decode(gdi, surface, cmd, &invalidRegion);
 
-		case RDPGFX_CODECID_ALPHA:
-			status = gdi_SurfaceCommand_Alpha(gdi, context, cmd);
-			break;
+		if (status == CHANNEL_RC_OK)
+			status = gdi_SurfaceCommand_Commit(context, surface, &invalidRegion);
 
-		case RDPGFX_CODECID_CAPROGRESSIVE:
-			status = gdi_SurfaceCommand_Progressive(gdi, context, cmd);
-			break;
+		region16_uninit(&invalidRegion);
+	}
 
-		case RDPGFX_CODECID_CAPROGRESSIVE_V2:
-			WLog_WARN(TAG, "SurfaceCommand 0x%08" PRIX32 " not implemented", cmd->codecId);
-			break;
+	if (status != CHANNEL_RC_OK)
+		goto fail;
 
-		default:
-			WLog_WARN(TAG, "Invalid SurfaceCommand 0x%08" PRIX32 "", cmd->codecId);
-			break;
+	if (!gdi->inGfxFrame)
+	{
+		status = CHANNEL_RC_NOT_INITIALIZED;
+		IFCALLRET(context->UpdateSurfaces, status, context);
 	}
 
+fail:
 	LeaveCriticalSection(&context->mux);
 	return status;
 }
@@ -989,6 +1330,18 @@ static UINT gdi_CreateSurface(RdpgfxClientContext* context,
 		goto fail;
 	}
 
+	if (gdi->gfxDecoder)
+	{
+		surface->queue = gdi_gfx_surface_queue_new(gdi, surface);
+
+		if (!surface->queue)
+		{
+			_aligned_free(surface->data);
+			free(surface);
+			goto fail;
+		}
+	}
+
 	surface->outputMapped = FALSE;
 	region16_init(&surface->invalidRegion);
 	rc = context->SetSurfaceData(context, surface->surfaceId, (void*)surface);
@@ -1008,11 +1361,15 @@ static UINT gdi_DeleteSurface(RdpgfxClientContext* context,
 	UINT rc = ERROR_INTERNAL_ERROR;
 	rdpCodecs* codecs = NULL;
 	gdiGfxSurface* surface = NULL;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
 	EnterCriticalSection(&context->mux);
 	surface = (gdiGfxSurface*)context->GetSurfaceData(context, deleteSurface->surfaceId);
 
 	if (surface)
 	{
+		gdi_gfx_decoder_flush(gdi, context, surface);
+		gdi_gfx_surface_queue_free(surface->queue);
+
 		if (surface->windowId != 0)
 			rc = IFCALLRESULT(CHANNEL_RC_OK, context->UnmapWindowForSurface, context,
 			                  surface->windowId);
@@ -1057,6 +1414,13 @@ static UINT gdi_SolidFill(RdpgfxClientContext* context, const RDPGFX_SOLID_FILL_
 	if (!surface)
 		goto fail;
 
+	status = gdi_gfx_decoder_flush(gdi, context, surface);
+
+	if (status != CHANNEL_RC_OK)
+		goto fail;
+
+	status = ERROR_INTERNAL_ERROR;
+
 	b = solidFill->fillPixel.B;
 	g = solidFill->fillPixel.G;
 	r = solidFill->fillPixel.R;
@@ -1135,6 +1499,10 @@ static UINT gdi_SurfaceToSurface(RdpgfxClientContext* context,
 	if (!surfaceSrc || !surfaceDst)
 		goto fail;
 
+	if ((gdi_gfx_decoder_flush(gdi, context, surfaceSrc) != CHANNEL_RC_OK) ||
+	    (!sameSurface && (gdi_gfx_decoder_flush(gdi, context, surfaceDst) != CHANNEL_RC_OK)))
+		goto fail;
+
 	nWidth = rectSrc->right - rectSrc->left;
 	nHeight = rectSrc->bottom - rectSrc->top;
 
@@ -1174,6 +1542,37 @@ fail:
 	return status;
 }
 
+static gdiGfxCacheEntry* gdi_gfx_cache_entry_new(UINT32 width, UINT32 height, UINT32 format)
+{
+	gdiGfxCacheEntry* cacheEntry = (gdiGfxCacheEntry*)calloc(1, sizeof(gdiGfxCacheEntry));
+
+	if (!cacheEntry)
+		return NULL;
+
+	cacheEntry->width = width;
+	cacheEntry->height = height;
+	cacheEntry->format = format;
+	cacheEntry->scanline = gfx_align_scanline(cacheEntry->width * 4, 16);
+	cacheEntry->data = (BYTE*)calloc(cacheEntry->height, cacheEntry->scanline);
+
+	if (!cacheEntry->data)
+	{
+		free(cacheEntry);
+		return NULL;
+	}
+
+	return cacheEntry;
+}
+
+static void gdi_gfx_cache_entry_free(gdiGfxCacheEntry* cacheEntry)
+{
+	if (!cacheEntry)
+		return;
+
+	free(cacheEntry->data);
+	free(cacheEntry);
+}
+
 /**
  * Function description
  *
@@ -1186,6 +1585,7 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 	gdiGfxSurface* surface;
 	gdiGfxCacheEntry* cacheEntry;
 	UINT rc = ERROR_INTERNAL_ERROR;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
 	EnterCriticalSection(&context->mux);
 	rect = &(surfaceToCache->rectSrc);
 	surface = (gdiGfxSurface*)context->GetSurfaceData(context, surfaceToCache->surfaceId);
@@ -1193,28 +1593,26 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 	if (!surface)
 		goto fail;
 
-	cacheEntry = (gdiGfxCacheEntry*)calloc(1, sizeof(gdiGfxCacheEntry));
+	rc = gdi_gfx_decoder_flush(gdi, context, surface);
 
-	if (!cacheEntry)
+	if (rc != CHANNEL_RC_OK)
 		goto fail;
 
-	cacheEntry->width = (UINT32)(rect->right - rect->left);
-	cacheEntry->height = (UINT32)(rect->bottom - rect->top);
-	cacheEntry->format = surface->format;
-	cacheEntry->scanline = gfx_align_scanline(cacheEntry->width * 4, 16);
-	cacheEntry->data = (BYTE*)calloc(cacheEntry->height, cacheEntry->scanline);
+	rc = ERROR_INTERNAL_ERROR;
 
-	if (!cacheEntry->data)
-	{
-		free(cacheEntry);
+	cacheEntry = gdi_gfx_cache_entry_new((UINT32)(rect->right - rect->left),
+	                                     (UINT32)(rect->bottom - rect->top), surface->format);
+
+	if (!cacheEntry)
 		goto fail;
-	}
+
+	cacheEntry->cacheKey = surfaceToCache->cacheKey;
 
 	if (!freerdp_image_copy(cacheEntry->data, cacheEntry->format, cacheEntry->scanline, 0, 0,
 	                        cacheEntry->width, cacheEntry->height, surface->data, surface->format,
 	                        surface->scanline, rect->left, rect->top, NULL, FREERDP_FLIP_NONE))
 	{
-		free(cacheEntry);
+		gdi_gfx_cache_entry_free(cacheEntry);
 		goto fail;
 	}
 
@@ -1246,6 +1644,13 @@ static UINT gdi_CacheToSurface(RdpgfxClientContext* context,
 	if (!surface || !cacheEntry)
 		goto fail;
 
+	status = gdi_gfx_decoder_flush(gdi, context, surface);
+
+	if (status != CHANNEL_RC_OK)
+		goto fail;
+
+	status = ERROR_INTERNAL_ERROR;
+
 	for (index = 0; index < cacheToSurface->destPtsCount; index++)
 	{
 		destPt = &cacheToSurface->destPts[index];
@@ -1292,7 +1697,56 @@ fail:
 static UINT gdi_CacheImportReply(RdpgfxClientContext* context,
                                  const RDPGFX_CACHE_IMPORT_REPLY_PDU* cacheImportReply)
 {
-	return CHANNEL_RC_OK;
+	UINT16 index;
+	UINT rc = CHANNEL_RC_OK;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
+	EnterCriticalSection(&context->mux);
+
+	/* The reply lists the assigned cache slot for each offered entry in offer order */
+	for (index = 0; gdi->gfxCache && (index < cacheImportReply->importedEntriesCount); index++)
+	{
+		PERSISTENT_GFX_CACHE_ENTRY info;
+		gdiGfxCacheEntry* cacheEntry;
+		const UINT16 cacheSlot = cacheImportReply->cacheSlots[index];
+
+		if (!persistent_gfx_cache_get_info(gdi->gfxCache, index, &info))
+		{
+			WLog_WARN(TAG, "cache import reply for entry %" PRIu16 " that was not offered", index);
+			break;
+		}
+
+		cacheEntry = gdi_gfx_cache_entry_new(info.width, info.height, info.format);
+
+		if (!cacheEntry)
+		{
+			rc = CHANNEL_RC_NO_MEMORY;
+			break;
+		}
+
+		cacheEntry->cacheKey = info.cacheKey;
+
+		if (!persistent_gfx_cache_read(gdi->gfxCache, index, cacheEntry->data,
+		                               cacheEntry->scanline))
+		{
+			WLog_WARN(TAG, "failed to load cache entry 0x%016" PRIX64 "", info.cacheKey);
+			gdi_gfx_cache_entry_free(cacheEntry);
+			continue;
+		}
+
+		gdi_gfx_cache_entry_free((gdiGfxCacheEntry*)context->GetCacheSlotData(context, cacheSlot));
+		rc = context->SetCacheSlotData(context, cacheSlot, (void*)cacheEntry);
+
+		if (rc != CHANNEL_RC_OK)
+		{
+			gdi_gfx_cache_entry_free(cacheEntry);
+			break;
+		}
+	}
+
+	persistent_gfx_cache_free(gdi->gfxCache);
+	gdi->gfxCache = NULL;
+	LeaveCriticalSection(&context->mux);
+	return rc;
 }
 
 /**
@@ -1307,18 +1761,132 @@ static UINT gdi_EvictCacheEntry(RdpgfxClientContext* context,
 	UINT rc = ERROR_INTERNAL_ERROR;
 	EnterCriticalSection(&context->mux);
 	cacheEntry = (gdiGfxCacheEntry*)context->GetCacheSlotData(context, evictCacheEntry->cacheSlot);
+	gdi_gfx_cache_entry_free(cacheEntry);
+	rc = context->SetCacheSlotData(context, evictCacheEntry->cacheSlot, NULL);
+	LeaveCriticalSection(&context->mux);
+	return rc;
+}
+
+/**
+ * Offer the cache entries saved by the last session, the server answers with a cache import
+ * reply listing the cache slots of the entries it kept.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_CapsConfirm(RdpgfxClientContext* context,
+                            const RDPGFX_CAPS_CONFIRM_PDU* capsConfirm)
+{
+	char* filename;
+	UINT16 maxEntries;
+	UINT64 maxSize;
+	UINT rc = CHANNEL_RC_OK;
+	RDPGFX_CACHE_IMPORT_OFFER_PDU offer = { 0 };
+	rdpGdi* gdi = (rdpGdi*)context->custom;
+	rdpSettings* settings = gdi->context->settings;
+
+	if (!persistent_cache_enabled(settings) || !capsConfirm || !capsConfirm->capsSet)
+		return CHANNEL_RC_OK;
+
+	offer.cacheEntries = (RDPGFX_CACHE_ENTRY_METADATA*)calloc(
+	    RDPGFX_CACHE_ENTRY_MAX_COUNT, sizeof(RDPGFX_CACHE_ENTRY_METADATA));
 
-	if (cacheEntry)
+	if (!offer.cacheEntries)
+		return CHANNEL_RC_NO_MEMORY;
+
+	maxEntries = MIN(context->MaxCacheSlots, RDPGFX_CACHE_ENTRY_MAX_COUNT);
+	/* The limit the server confirmed, not the one the client asked for */
+	if (capsConfirm->capsSet->flags & RDPGFX_CAPS_FLAG_SMALL_CACHE)
+		maxSize = GDI_GFX_SMALL_CACHE_SIZE;
+	else
+		maxSize = GDI_GFX_CACHE_SIZE;
+	EnterCriticalSection(&context->mux);
+	persistent_gfx_cache_free(gdi->gfxCache);
+	filename = persistent_gfx_cache_get_filename(settings);
+	gdi->gfxCache = persistent_gfx_cache_open(filename);
+	free(filename);
+	offer.cacheEntriesCount =
+	    persistent_gfx_cache_get_offer(gdi->gfxCache, offer.cacheEntries, maxEntries, maxSize);
+
+	if (offer.cacheEntriesCount == 0)
 	{
-		free(cacheEntry->data);
-		free(cacheEntry);
+		persistent_gfx_cache_free(gdi->gfxCache);
+		gdi->gfxCache = NULL;
 	}
 
-	rc = context->SetCacheSlotData(context, evictCacheEntry->cacheSlot, NULL);
 	LeaveCriticalSection(&context->mux);
+
+	if (offer.cacheEntriesCount > 0)
+	{
+		WLog_DBG(TAG, "offering %" PRIu16 " cache entries", offer.cacheEntriesCount);
+		rc = IFCALLRESULT(CHANNEL_RC_OK, context->CacheImportOffer, context, &offer);
+	}
+
+	free(offer.cacheEntries);
 	return rc;
 }
 
+/**
+ * Save the cache slots before the channel evicts them, the next session offers them to the
+ * server again.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_OnClose(RdpgfxClientContext* context)
+{
+	UINT16 index;
+	UINT32 count = 0;
+	char* filename;
+	PERSISTENT_GFX_CACHE_ENTRY* entries;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
+	rdpSettings* settings = gdi->context->settings;
+	EnterCriticalSection(&context->mux);
+	persistent_gfx_cache_free(gdi->gfxCache);
+	gdi->gfxCache = NULL;
+
+	if (!persistent_cache_enabled(settings))
+		goto out;
+
+	entries = (PERSISTENT_GFX_CACHE_ENTRY*)calloc(RDPGFX_CACHE_ENTRY_MAX_COUNT,
+	                                              sizeof(PERSISTENT_GFX_CACHE_ENTRY));
+
+	if (!entries)
+		goto out;
+
+	for (index = 0; (index < context->MaxCacheSlots) && (count < RDPGFX_CACHE_ENTRY_MAX_COUNT);
+	     index++)
+	{
+		const gdiGfxCacheEntry* cacheEntry =
+		    (const gdiGfxCacheEntry*)context->GetCacheSlotData(context, index);
+
+		if (!cacheEntry || !cacheEntry->cacheKey)
+			continue;
+
+		entries[count].cacheKey = cacheEntry->cacheKey;
+		entries[count].width = cacheEntry->width;
+		entries[count].height = cacheEntry->height;
+		entries[count].format = cacheEntry->format;
+		entries[count].scanline = cacheEntry->scanline;
+		entries[count].data = cacheEntry->data;
+		count++;
+	}
+
+	/* Keep the previous cache when the server never filled this one */
+	if (count > 0)
+	{
+		filename = persistent_gfx_cache_get_filename(settings);
+
+		if (!persistent_gfx_cache_save(filename, entries, count))
+			WLog_WARN(TAG, "failed to save %" PRIu32 " cache entries", count);
+
+		free(filename);
+	}
+
+	free(entries);
+out:
+	LeaveCriticalSection(&context->mux);
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  *
@@ -1329,12 +1897,21 @@ static UINT gdi_MapSurfaceToOutput(RdpgfxClientContext* context,
 {
 	UINT rc = ERROR_INTERNAL_ERROR;
 	gdiGfxSurface* surface;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
 	EnterCriticalSection(&context->mux);
 	surface = (gdiGfxSurface*)context->GetSurfaceData(context, surfaceToOutput->surfaceId);
 
 	if (!surface)
 		goto fail;
 
+	/* Updates decoded before the mapping changes belong to the previous mapping */
+	rc = gdi_gfx_decoder_flush(gdi, context, surface);
+
+	if (rc != CHANNEL_RC_OK)
+		goto fail;
+
+	rc = ERROR_INTERNAL_ERROR;
+
 	surface->outputMapped = TRUE;
 	surface->outputOriginX = surfaceToOutput->outputOriginX;
 	surface->outputOriginY = surfaceToOutput->outputOriginY;
@@ -1353,12 +1930,21 @@ gdi_MapSurfaceToScaledOutput(RdpgfxClientContext* context,
 {
 	UINT rc = ERROR_INTERNAL_ERROR;
 	gdiGfxSurface* surface;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
 	EnterCriticalSection(&context->mux);
 	surface = (gdiGfxSurface*)context->GetSurfaceData(context, surfaceToOutput->surfaceId);
 
 	if (!surface)
 		goto fail;
 
+	/* Updates decoded before the mapping changes belong to the previous mapping */
+	rc = gdi_gfx_decoder_flush(gdi, context, surface);
+
+	if (rc != CHANNEL_RC_OK)
+		goto fail;
+
+	rc = ERROR_INTERNAL_ERROR;
+
 	surface->outputMapped = TRUE;
 	surface->outputOriginX = surfaceToOutput->outputOriginX;
 	surface->outputOriginY = surfaceToOutput->outputOriginY;
@@ -1381,12 +1967,21 @@ static UINT gdi_MapSurfaceToWindow(RdpgfxClientContext* context,
 {
 	UINT rc = ERROR_INTERNAL_ERROR;
 	gdiGfxSurface* surface;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
 	EnterCriticalSection(&context->mux);
 	surface = (gdiGfxSurface*)context->GetSurfaceData(context, surfaceToWindow->surfaceId);
 
 	if (!surface)
 		goto fail;
 
+	/* Updates decoded before the mapping changes belong to the previous mapping */
+	rc = gdi_gfx_decoder_flush(gdi, context, surface);
+
+	if (rc != CHANNEL_RC_OK)
+		goto fail;
+
+	rc = ERROR_INTERNAL_ERROR;
+
 	if (surface->windowId != 0)
 	{
 		if (surface->windowId != surfaceToWindow->windowId)
@@ -1411,12 +2006,21 @@ gdi_MapSurfaceToScaledWindow(RdpgfxClientContext* context,
 {
 	UINT rc = ERROR_INTERNAL_ERROR;
 	gdiGfxSurface* surface;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
 	EnterCriticalSection(&context->mux);
 	surface = (gdiGfxSurface*)context->GetSurfaceData(context, surfaceToWindow->surfaceId);
 
 	if (!surface)
 		goto fail;
 
+	/* Updates decoded before the mapping changes belong to the previous mapping */
+	rc = gdi_gfx_decoder_flush(gdi, context, surface);
+
+	if (rc != CHANNEL_RC_OK)
+		goto fail;
+
+	rc = ERROR_INTERNAL_ERROR;
+
 	if (surface->windowId != 0)
 	{
 		if (surface->windowId != surfaceToWindow->windowId)
@@ -1463,6 +2067,8 @@ BOOL gdi_graphics_pipeline_init_ex(rdpGdi* gdi, RdpgfxClientContext* gfx,
 	gfx->CacheToSurface = gdi_CacheToSurface;
 	gfx->CacheImportReply = gdi_CacheImportReply;
 	gfx->EvictCacheEntry = gdi_EvictCacheEntry;
+	gfx->CapsConfirm = gdi_CapsConfirm;
+	gfx->OnClose = gdi_OnClose;
 	gfx->MapSurfaceToOutput = gdi_MapSurfaceToOutput;
 	gfx->MapSurfaceToWindow = gdi_MapSurfaceToWindow;
 	gfx->MapSurfaceToScaledOutput = gdi_MapSurfaceToScaledOutput;
@@ -1472,14 +2078,51 @@ BOOL gdi_graphics_pipeline_init_ex(rdpGdi* gdi, RdpgfxClientContext* gfx,
 	gfx->UnmapWindowForSurface = unmap;
 	gfx->UpdateSurfaceArea = update;
 	InitializeCriticalSection(&gfx->mux);
+
+	if (!gdi->gfxDecoder)
+		gdi->gfxDecoder = gdi_gfx_decoder_new(gdi->context->settings);
+
 	PROFILER_CREATE(gfx->SurfaceProfiler, "GFX-PROFILER");
 	return TRUE;
 }
 
+static void gdi_graphics_pipeline_release_queues(RdpgfxClientContext* gfx)
+{
+	UINT16 index;
+	UINT16 count = 0;
+	UINT16* pSurfaceIds = NULL;
+	EnterCriticalSection(&gfx->mux);
+	gfx->GetSurfaceIds(gfx, &pSurfaceIds, &count);
+
+	for (index = 0; index < count; index++)
+	{
+		gdiGfxSurface* surface = (gdiGfxSurface*)gfx->GetSurfaceData(gfx, pSurfaceIds[index]);
+
+		if (!surface)
+			continue;
+
+		gdi_gfx_surface_queue_free(surface->queue);
+		surface->queue = NULL;
+	}
+
+	free(pSurfaceIds);
+	LeaveCriticalSection(&gfx->mux);
+}
+
 void gdi_graphics_pipeline_uninit(rdpGdi* gdi, RdpgfxClientContext* gfx)
 {
 	if (gdi)
+	{
+		/* Surfaces that outlive the pipeline are decoded on the channel thread */
+		if (gfx && gdi->gfxDecoder)
+			gdi_graphics_pipeline_release_queues(gfx);
+
+		gdi_gfx_decoder_free(gdi->gfxDecoder);
+		gdi->gfxDecoder = NULL;
+		persistent_gfx_cache_free(gdi->gfxCache);
+		gdi->gfxCache = NULL;
 		gdi->gfx = NULL;
+	}
 
 	if (!gfx)
 		return;
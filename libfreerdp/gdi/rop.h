@@ -0,0 +1,48 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * GDI Raster Operation Row Kernels
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_GDI_ROP_H
+#define FREERDP_LIB_GDI_ROP_H
+
+#include <winpr/wtypes.h>
+
+#include <freerdp/api.h>
+
+/**
+ * Row kernels for the most frequently used ROP3 codes.
+ *
+ * All raster operations are bitwise and the pixel read/write helpers only
+ * reorder bytes, so the kernels work on the raw bytes of a destination row
+ * and are independent of the destination color format.
+ * len is the row length in bytes.
+ */
+typedef void (*gdi_rop_D_fn)(BYTE* pDst, size_t len);
+typedef void (*gdi_rop_DS_fn)(BYTE* pDst, const BYTE* pSrc, size_t len);
+typedef void (*gdi_rop_DSP_fn)(BYTE* pDst, const BYTE* pSrc, const BYTE* pPat, size_t len);
+
+typedef struct
+{
+	gdi_rop_D_fn Dn;             /* D = ~D */
+	gdi_rop_DS_fn Sn;            /* D = ~S */
+	gdi_rop_DS_fn DSa;           /* D = D & S */
+	gdi_rop_DS_fn DSo;           /* D = D | S */
+	gdi_rop_DS_fn DSx;           /* D = D ^ S */
+	gdi_rop_DSP_fn PSa;          /* D = P & S */
+	gdi_rop_DSP_fn SPaDSnao;     /* D = (S & P) | (D & ~S) */
+} GDI_ROP_KERNELS;
+
+#endif /* FREERDP_LIB_GDI_ROP_H */
@@ -0,0 +1,390 @@
+
+#include <freerdp/gdi/gdi.h>
+
+#include <freerdp/gdi/dc.h>
+#include <freerdp/gdi/bitmap.h>
+
+#include <winpr/crt.h>
+#include <winpr/crypto.h>
+#include <winpr/sysinfo.h>
+
+#include "brush.h"
+
+/* Compares gdi_BitBlt against a per pixel reference implementation of the
+ * ROP3 string interpreter and prints the time both paths take. */
+
+#define TEST_WIDTH 256
+#define TEST_HEIGHT 128
+#define TEST_ITERATIONS 8
+
+typedef struct
+{
+	DWORD rop;
+	const char* str;
+} test_rop_t;
+
+static const test_rop_t rops[] = { { GDI_PATCOPY, "P" },
+	                               { GDI_SRCINVERT, "DSx" },
+	                               { GDI_SRCAND, "DSa" },
+	                               { GDI_SRCPAINT, "DSo" },
+	                               { GDI_DSTINVERT, "Dn" },
+	                               { GDI_NOTSRCCOPY, "Sn" },
+	                               { GDI_MERGECOPY, "PSa" },
+	                               { GDI_PATINVERT, "DPx" },
+	                               { GDI_GLYPH_ORDER, "SPaDSnao" },
+	                               { GDI_BLACKNESS, "0" },
+	                               { GDI_WHITENESS, "1" },
+	                               { GDI_PSDPxax, "PSDPxax" },
+	                               { GDI_DSPDxax, "DSPDxax" },
+	                               { GDI_PDSxnan, "PDSxnan" } };
+
+static UINT32 ref_process_rop(UINT32 src, UINT32 dst, UINT32 pat, const char* rop, UINT32 format)
+{
+	UINT32 stack[10] = { 0 };
+	UINT32 stackp = 0;
+
+	while (*rop != '\0')
+	{
+		switch (*rop++)
+		{
+			case '0':
+				stack[stackp++] = FreeRDPGetColor(format, 0, 0, 0, 0xFF);
+				break;
+
+			case '1':
+				stack[stackp++] = FreeRDPGetColor(format, 0xFF, 0xFF, 0xFF, 0xFF);
+				break;
+
+			case 'D':
+				stack[stackp++] = dst;
+				break;
+
+			case 'S':
+				stack[stackp++] = src;
+				break;
+
+			case 'P':
+				stack[stackp++] = pat;
+				break;
+
+			case 'x':
+				stackp--;
+				stack[stackp - 1] ^= stack[stackp];
+				break;
+
+			case 'a':
+				stackp--;
+				stack[stackp - 1] &= stack[stackp];
+				break;
+
+			case 'o':
+				stackp--;
+				stack[stackp - 1] |= stack[stackp];
+				break;
+
+			case 'n':
+				stack[stackp - 1] = ~stack[stackp - 1];
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return stack[0];
+}
+
+static void ref_write(HGDI_DC hdcDst, HGDI_DC hdcSrc, INT32 nXDst, INT32 nYDst, INT32 nXSrc,
+                      INT32 nYSrc, INT32 x, INT32 y, const char* rop, const gdiPalette* palette)
+{
+	HGDI_BITMAP hDst = (HGDI_BITMAP)hdcDst->selectedObject;
+	HGDI_BITMAP hSrc = (HGDI_BITMAP)hdcSrc->selectedObject;
+	HGDI_BRUSH brush = hdcDst->brush;
+	const UINT32 dstBpp = GetBytesPerPixel(hdcDst->format);
+	const UINT32 srcBpp = GetBytesPerPixel(hdcSrc->format);
+	BYTE* dstp = &hDst->data[(nYDst + y) * hDst->scanline + (nXDst + x) * dstBpp];
+	const BYTE* srcp = &hSrc->data[(nYSrc + y) * hSrc->scanline + (nXSrc + x) * srcBpp];
+	UINT32 src, dst, pat;
+	dst = ReadColor(dstp, hdcDst->format);
+	src = ReadColor(srcp, hdcSrc->format);
+	src = FreeRDPConvertColor(src, hdcSrc->format, hdcDst->format, palette);
+
+	if (!brush)
+		pat = 0;
+	else if (brush->style == GDI_BS_SOLID)
+		pat = brush->color;
+	else
+	{
+		HGDI_BITMAP hPat = brush->pattern;
+		const UINT32 px = (nXDst + x) % hPat->width;
+		const UINT32 py = (nYDst + y) % hPat->height;
+		pat = ReadColor(&hPat->data[py * hPat->scanline + px * dstBpp], hdcDst->format);
+	}
+
+	WriteColor(dstp, hdcDst->format, ref_process_rop(src, dst, pat, rop, hdcDst->format));
+}
+
+static void ref_BitBlt(HGDI_DC hdcDst, INT32 nXDst, INT32 nYDst, INT32 nWidth, INT32 nHeight,
+                       HGDI_DC hdcSrc, INT32 nXSrc, INT32 nYSrc, const char* rop,
+                       const gdiPalette* palette)
+{
+	INT32 x, y;
+
+	if ((nXDst > nXSrc) && (nYDst > nYSrc))
+	{
+		for (y = nHeight - 1; y >= 0; y--)
+			for (x = nWidth - 1; x >= 0; x--)
+				ref_write(hdcDst, hdcSrc, nXDst, nYDst, nXSrc, nYSrc, x, y, rop, palette);
+	}
+	else if (nXDst > nXSrc)
+	{
+		for (y = 0; y < nHeight; y++)
+			for (x = nWidth - 1; x >= 0; x--)
+				ref_write(hdcDst, hdcSrc, nXDst, nYDst, nXSrc, nYSrc, x, y, rop, palette);
+	}
+	else if (nYDst > nYSrc)
+	{
+		for (y = nHeight - 1; y >= 0; y--)
+			for (x = 0; x < nWidth; x++)
+				ref_write(hdcDst, hdcSrc, nXDst, nYDst, nXSrc, nYSrc, x, y, rop, palette);
+	}
+	else
+	{
+		for (y = 0; y < nHeight; y++)
+			for (x = 0; x < nWidth; x++)
+				ref_write(hdcDst, hdcSrc, nXDst, nYDst, nXSrc, nYSrc, x, y, rop, palette);
+	}
+}
+
+static HGDI_BITMAP create_random_bitmap(UINT32 format, UINT32 width, UINT32 height)
+{
+	const size_t size = 1ull * width * height * GetBytesPerPixel(format);
+	BYTE* data = _aligned_malloc(size, 16);
+	HGDI_BITMAP bmp;
+
+	if (!data)
+		return NULL;
+
+	winpr_RAND(data, size);
+	bmp = gdi_CreateBitmap(width, height, format, data);
+
+	if (!bmp)
+		_aligned_free(data);
+
+	return bmp;
+}
+
+static HGDI_BITMAP clone_bitmap(HGDI_BITMAP bmp)
+{
+	const size_t size = 1ull * bmp->scanline * bmp->height;
+	BYTE* data = _aligned_malloc(size, 16);
+	HGDI_BITMAP clone;
+
+	if (!data)
+		return NULL;
+
+	memcpy(data, bmp->data, size);
+	clone = gdi_CreateBitmapEx(bmp->width, bmp->height, bmp->format, bmp->scanline, data,
+	                           _aligned_free);
+
+	if (!clone)
+		_aligned_free(data);
+
+	return clone;
+}
+
+static BOOL test_rop(UINT32 SrcFormat, UINT32 DstFormat, const test_rop_t* rop, BOOL pattern,
+                     const gdiPalette* palette, UINT64* refTime, UINT64* optTime)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	UINT64 start;
+	HGDI_DC hdcSrc = NULL;
+	HGDI_DC hdcDst = NULL;
+	HGDI_DC hdcRef = NULL;
+	HGDI_BITMAP hBmpSrc = NULL;
+	HGDI_BITMAP hBmpDst = NULL;
+	HGDI_BITMAP hBmpRef = NULL;
+	HGDI_BITMAP hBmpPat = NULL;
+	HGDI_BRUSH brush = NULL;
+	HGDI_BRUSH refBrush = NULL;
+
+	if (!(hdcSrc = gdi_GetDC()) || !(hdcDst = gdi_GetDC()) || !(hdcRef = gdi_GetDC()))
+		goto fail;
+
+	hdcSrc->format = SrcFormat;
+	hdcDst->format = DstFormat;
+	hdcRef->format = DstFormat;
+	hBmpSrc = create_random_bitmap(SrcFormat, TEST_WIDTH, TEST_HEIGHT);
+	hBmpDst = create_random_bitmap(DstFormat, TEST_WIDTH, TEST_HEIGHT);
+
+	if (!hBmpSrc || !hBmpDst)
+		goto fail;
+
+	hBmpRef = clone_bitmap(hBmpDst);
+
+	if (!hBmpRef)
+		goto fail;
+
+	gdi_SelectObject(hdcSrc, (HGDIOBJECT)hBmpSrc);
+	gdi_SelectObject(hdcDst, (HGDIOBJECT)hBmpDst);
+	gdi_SelectObject(hdcRef, (HGDIOBJECT)hBmpRef);
+
+	if (pattern)
+	{
+		hBmpPat = create_random_bitmap(DstFormat, 8, 8);
+
+		if (!hBmpPat)
+			goto fail;
+
+		brush = gdi_CreatePatternBrush(hBmpPat);
+		refBrush = gdi_CreatePatternBrush(hBmpPat);
+	}
+	else
+	{
+		brush = gdi_CreateSolidBrush(FreeRDPGetColor(DstFormat, 0x12, 0x34, 0x56, 0xFF));
+		refBrush = gdi_CreateSolidBrush(FreeRDPGetColor(DstFormat, 0x12, 0x34, 0x56, 0xFF));
+	}
+
+	if (!brush || !refBrush)
+		goto fail;
+
+	hdcDst->brush = brush;
+	hdcRef->brush = refBrush;
+	start = GetTickCount64();
+
+	for (i = 0; i < TEST_ITERATIONS; i++)
+		ref_BitBlt(hdcRef, 3, 1, TEST_WIDTH - 5, TEST_HEIGHT - 2, hdcSrc, 1, 0, rop->str,
+		           palette);
+
+	*refTime += GetTickCount64() - start;
+	start = GetTickCount64();
+
+	for (i = 0; i < TEST_ITERATIONS; i++)
+	{
+		if (!gdi_BitBlt(hdcDst, 3, 1, TEST_WIDTH - 5, TEST_HEIGHT - 2, hdcSrc, 1, 0, rop->rop,
+		                palette))
+			goto fail;
+	}
+
+	*optTime += GetTickCount64() - start;
+
+	if (memcmp(hBmpDst->data, hBmpRef->data, 1ull * hBmpDst->scanline * hBmpDst->height) != 0)
+	{
+		fprintf(stderr, "%s [%s] %s -> %s mismatch\n", rop->str, pattern ? "pattern" : "solid",
+		        FreeRDPGetColorFormatName(SrcFormat), FreeRDPGetColorFormatName(DstFormat));
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	hdcDst->brush = NULL;
+	hdcRef->brush = NULL;
+	gdi_DeleteObject((HGDIOBJECT)brush);
+	gdi_DeleteObject((HGDIOBJECT)refBrush);
+	gdi_DeleteObject((HGDIOBJECT)hBmpPat);
+	gdi_DeleteObject((HGDIOBJECT)hBmpSrc);
+	gdi_DeleteObject((HGDIOBJECT)hBmpDst);
+	gdi_DeleteObject((HGDIOBJECT)hBmpRef);
+	gdi_DeleteDC(hdcSrc);
+	gdi_DeleteDC(hdcDst);
+	gdi_DeleteDC(hdcRef);
+	return rc;
+}
+
+/* Scroll a bitmap onto itself, the result must match the reference which
+ * walks pixels in the overlap safe direction. */
+static BOOL test_overlap(UINT32 format, INT32 dx, INT32 dy)
+{
+	BOOL rc = FALSE;
+	HGDI_DC hdc = NULL;
+	HGDI_DC hdcRef = NULL;
+	HGDI_BITMAP hBmp = NULL;
+	HGDI_BITMAP hBmpRef = NULL;
+	const INT32 nXSrc = 8;
+	const INT32 nYSrc = 8;
+
+	if (!(hdc = gdi_GetDC()) || !(hdcRef = gdi_GetDC()))
+		goto fail;
+
+	hdc->format = format;
+	hdcRef->format = format;
+	hBmp = create_random_bitmap(format, 64, 64);
+
+	if (!hBmp)
+		goto fail;
+
+	hBmpRef = clone_bitmap(hBmp);
+
+	if (!hBmpRef)
+		goto fail;
+
+	gdi_SelectObject(hdc, (HGDIOBJECT)hBmp);
+	gdi_SelectObject(hdcRef, (HGDIOBJECT)hBmpRef);
+	ref_BitBlt(hdcRef, nXSrc + dx, nYSrc + dy, 40, 40, hdcRef, nXSrc, nYSrc, "DSx", NULL);
+
+	if (!gdi_BitBlt(hdc, nXSrc + dx, nYSrc + dy, 40, 40, hdc, nXSrc, nYSrc, GDI_SRCINVERT, NULL))
+		goto fail;
+
+	if (memcmp(hBmp->data, hBmpRef->data, 1ull * hBmp->scanline * hBmp->height) != 0)
+	{
+		fprintf(stderr, "overlapping DSx %s (%" PRId32 ",%" PRId32 ") mismatch\n",
+		        FreeRDPGetColorFormatName(format), dx, dy);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	gdi_DeleteObject((HGDIOBJECT)hBmp);
+	gdi_DeleteObject((HGDIOBJECT)hBmpRef);
+	gdi_DeleteDC(hdc);
+	gdi_DeleteDC(hdcRef);
+	return rc;
+}
+
+int TestGdiBitBltRop(int argc, char* argv[])
+{
+	int rc = 0;
+	UINT32 x, y, r;
+	const UINT32 formatList[] = { PIXEL_FORMAT_RGB15,  PIXEL_FORMAT_ARGB15, PIXEL_FORMAT_RGB16,
+		                          PIXEL_FORMAT_RGB24,  PIXEL_FORMAT_BGRA32, PIXEL_FORMAT_BGRX32,
+		                          PIXEL_FORMAT_RGBX32, PIXEL_FORMAT_ABGR32 };
+	const UINT32 listSize = sizeof(formatList) / sizeof(formatList[0]);
+	const INT32 offsets[][2] = { { 3, 2 }, { -3, 2 }, { 3, -2 }, { -3, -2 }, { 5, 0 }, { -5, 0 } };
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	for (r = 0; r < sizeof(rops) / sizeof(rops[0]); r++)
+	{
+		UINT64 refTime = 0;
+		UINT64 optTime = 0;
+
+		for (x = 0; x < listSize; x++)
+		{
+			const UINT32 DstFormat = formatList[x];
+			const UINT32 srcFormats[] = { DstFormat, PIXEL_FORMAT_BGRA32 };
+
+			for (y = 0; y < 2; y++)
+			{
+				if (!test_rop(srcFormats[y], DstFormat, &rops[r], FALSE, NULL, &refTime,
+				              &optTime) ||
+				    !test_rop(srcFormats[y], DstFormat, &rops[r], TRUE, NULL, &refTime, &optTime))
+					rc = -1;
+			}
+		}
+
+		printf("%-8s per pixel %5" PRIu64 "ms, row kernels %5" PRIu64 "ms\n", rops[r].str,
+		       refTime, optTime);
+	}
+
+	for (x = 0; x < listSize; x++)
+	{
+		for (y = 0; y < sizeof(offsets) / sizeof(offsets[0]); y++)
+		{
+			if (!test_overlap(formatList[x], offsets[y][0], offsets[y][1]))
+				rc = -1;
+		}
+	}
+
+	return rc;
+}
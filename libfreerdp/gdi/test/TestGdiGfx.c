@@ -0,0 +1,313 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/log.h>
+#include <freerdp/gdi/gfx.h>
+#include <freerdp/codec/color.h>
+
+#define TAG FREERDP_TAG("test.gdi.gfx")
+
+#define TEST_SURFACES 2
+#define TEST_SIZE 256
+#define TEST_TILE 32
+#define TEST_COMMANDS 96
+
+typedef struct
+{
+	RdpgfxClientContext gfx;
+	void* surfaces[TEST_SURFACES];
+	UINT32 updates[TEST_SURFACES];
+} TEST_GFX_CONTEXT;
+
+static UINT test_get_surface_ids(RdpgfxClientContext* context, UINT16** ppSurfaceIds,
+                                 UINT16* count_out)
+{
+	UINT16 index;
+	UINT16 count = 0;
+	TEST_GFX_CONTEXT* test = (TEST_GFX_CONTEXT*)context;
+	UINT16* pSurfaceIds = (UINT16*)calloc(TEST_SURFACES, sizeof(UINT16));
+
+	if (!pSurfaceIds)
+		return CHANNEL_RC_NO_MEMORY;
+
+	for (index = 0; index < TEST_SURFACES; index++)
+	{
+		if (test->surfaces[index])
+			pSurfaceIds[count++] = index;
+	}
+
+	*ppSurfaceIds = pSurfaceIds;
+	*count_out = count;
+	return CHANNEL_RC_OK;
+}
+
+static UINT test_set_surface_data(RdpgfxClientContext* context, UINT16 surfaceId, void* pData)
+{
+	TEST_GFX_CONTEXT* test = (TEST_GFX_CONTEXT*)context;
+
+	if (surfaceId >= TEST_SURFACES)
+		return ERROR_INVALID_PARAMETER;
+
+	test->surfaces[surfaceId] = pData;
+	return CHANNEL_RC_OK;
+}
+
+static void* test_get_surface_data(RdpgfxClientContext* context, UINT16 surfaceId)
+{
+	TEST_GFX_CONTEXT* test = (TEST_GFX_CONTEXT*)context;
+
+	if (surfaceId >= TEST_SURFACES)
+		return NULL;
+
+	return test->surfaces[surfaceId];
+}
+
+static UINT test_update_surface_area(RdpgfxClientContext* context, UINT16 surfaceId,
+                                     UINT32 nrRects, const RECTANGLE_16* rects)
+{
+	TEST_GFX_CONTEXT* test = (TEST_GFX_CONTEXT*)context;
+	WINPR_UNUSED(rects);
+
+	if ((surfaceId >= TEST_SURFACES) || (nrRects == 0))
+		return ERROR_INVALID_DATA;
+
+	test->updates[surfaceId]++;
+	return CHANNEL_RC_OK;
+}
+
+static BYTE* test_uncompressed_data(UINT32 index)
+{
+	UINT32 x;
+	BYTE* data = (BYTE*)malloc(TEST_TILE * TEST_TILE * 4);
+
+	if (!data)
+		return NULL;
+
+	for (x = 0; x < TEST_TILE * TEST_TILE * 4; x++)
+		data[x] = (BYTE)(index * 13 + x);
+
+	return data;
+}
+
+static UINT test_command(RdpgfxClientContext* gfx, UINT32 index)
+{
+	UINT rc;
+	BYTE* data;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	cmd.surfaceId = index % TEST_SURFACES;
+	cmd.left = (index * 17) % (TEST_SIZE - TEST_TILE);
+	cmd.top = (index * 29) % (TEST_SIZE - TEST_TILE);
+	cmd.width = TEST_TILE;
+	cmd.height = TEST_TILE;
+	cmd.right = cmd.left + cmd.width;
+	cmd.bottom = cmd.top + cmd.height;
+
+	/* Alpha updates the pixels in place and depends on the previous commands */
+	if (index % 5 == 4)
+	{
+		wStream* s = Stream_New(NULL, 4 + TEST_TILE * TEST_TILE);
+
+		if (!s)
+			return ERROR_OUTOFMEMORY;
+
+		Stream_Write_UINT16(s, 0x414C); /* alphaSig */
+		Stream_Write_UINT16(s, 0);      /* compressed */
+
+		while (Stream_GetRemainingCapacity(s) > 0)
+			Stream_Write_UINT8(s, (BYTE)(index + Stream_GetPosition(s)));
+
+		cmd.codecId = RDPGFX_CODECID_ALPHA;
+		cmd.format = PIXEL_FORMAT_BGRA32;
+		cmd.length = (UINT32)Stream_GetPosition(s);
+		cmd.data = Stream_Buffer(s);
+		rc = gfx->SurfaceCommand(gfx, &cmd);
+		Stream_Free(s, TRUE);
+		return rc;
+	}
+
+	data = test_uncompressed_data(index);
+
+	if (!data)
+		return ERROR_OUTOFMEMORY;
+
+	cmd.codecId = RDPGFX_CODECID_UNCOMPRESSED;
+	cmd.format = PIXEL_FORMAT_BGRA32;
+	cmd.length = TEST_TILE * TEST_TILE * 4;
+	cmd.data = data;
+	rc = gfx->SurfaceCommand(gfx, &cmd);
+	/* The decoder must not reference the PDU after the callback returned */
+	memset(data, 0xCC, cmd.length);
+	free(data);
+	return rc;
+}
+
+static UINT test_solid_fill(RdpgfxClientContext* gfx, UINT16 surfaceId, UINT16 left, UINT16 top,
+                            UINT16 right, UINT16 bottom)
+{
+	RECTANGLE_16 rect;
+	RDPGFX_SOLID_FILL_PDU solidFill = { 0 };
+	rect.left = left;
+	rect.top = top;
+	rect.right = right;
+	rect.bottom = bottom;
+	solidFill.surfaceId = surfaceId;
+	solidFill.fillPixel.R = 0x11;
+	solidFill.fillPixel.G = 0x22;
+	solidFill.fillPixel.B = 0x33;
+	solidFill.fillRectCount = 1;
+	solidFill.fillRects = &rect;
+	return gfx->SolidFill(gfx, &solidFill);
+}
+
+static BOOL test_run(UINT32 threads, BYTE* result[TEST_SURFACES], UINT32 updates[TEST_SURFACES])
+{
+	UINT16 id;
+	UINT32 index;
+	BOOL rc = FALSE;
+	rdpContext context = { 0 };
+	rdpGdi gdi = { 0 };
+	TEST_GFX_CONTEXT test = { 0 };
+	RdpgfxClientContext* gfx = &test.gfx;
+	RDPGFX_START_FRAME_PDU startFrame = { 0 };
+	RDPGFX_END_FRAME_PDU endFrame = { 0 };
+	context.settings = freerdp_settings_new(0);
+	context.codecs = codecs_new(&context);
+
+	if (!context.settings || !context.codecs)
+		goto fail;
+
+	context.settings->GfxDecodeThreads = threads;
+	gdi.context = &context;
+	gdi.log = WLog_Get(TAG);
+	gfx->GetSurfaceIds = test_get_surface_ids;
+	gfx->SetSurfaceData = test_set_surface_data;
+	gfx->GetSurfaceData = test_get_surface_data;
+
+	if (!gdi_graphics_pipeline_init_ex(&gdi, gfx, NULL, NULL, test_update_surface_area))
+		goto fail;
+
+	if ((threads > 1) != (gdi.gfxDecoder != NULL))
+		goto out;
+
+	for (id = 0; id < TEST_SURFACES; id++)
+	{
+		RDPGFX_CREATE_SURFACE_PDU createSurface = { 0 };
+		createSurface.surfaceId = id;
+		createSurface.width = TEST_SIZE;
+		createSurface.height = TEST_SIZE;
+		createSurface.pixelFormat = GFX_PIXEL_FORMAT_ARGB_8888;
+
+		if (gfx->CreateSurface(gfx, &createSurface) != CHANNEL_RC_OK)
+			goto out;
+
+		if (test_solid_fill(gfx, id, 0, 0, TEST_SIZE, TEST_SIZE) != CHANNEL_RC_OK)
+			goto out;
+	}
+
+	if (gfx->StartFrame(gfx, &startFrame) != CHANNEL_RC_OK)
+		goto out;
+
+	for (index = 0; index < TEST_COMMANDS; index++)
+	{
+		if (test_command(gfx, index) != CHANNEL_RC_OK)
+			goto out;
+
+		/* Synchronous PDUs in the middle of the frame see the queued commands applied */
+		if ((index == TEST_COMMANDS / 2) &&
+		    (test_solid_fill(gfx, 0, 8, 8, 120, 64) != CHANNEL_RC_OK))
+			goto out;
+	}
+
+	if (gfx->EndFrame(gfx, &endFrame) != CHANNEL_RC_OK)
+		goto out;
+
+	/* Commands outside of a frame are committed before the callback returns */
+	if (test_command(gfx, TEST_COMMANDS) != CHANNEL_RC_OK)
+		goto out;
+
+	for (id = 0; id < TEST_SURFACES; id++)
+	{
+		const gdiGfxSurface* surface = (const gdiGfxSurface*)test.surfaces[id];
+		result[id] = (BYTE*)malloc(surface->scanline * surface->height);
+
+		if (!result[id])
+			goto out;
+
+		memcpy(result[id], surface->data, surface->scanline * surface->height);
+		updates[id] = test.updates[id];
+	}
+
+	rc = TRUE;
+out:
+
+	for (id = 0; id < TEST_SURFACES; id++)
+	{
+		RDPGFX_DELETE_SURFACE_PDU deleteSurface = { 0 };
+		deleteSurface.surfaceId = id;
+
+		if (test.surfaces[id])
+			gfx->DeleteSurface(gfx, &deleteSurface);
+	}
+
+	gdi_graphics_pipeline_uninit(&gdi, gfx);
+fail:
+	codecs_free(context.codecs);
+	freerdp_settings_free(context.settings);
+	return rc;
+}
+
+int TestGdiGfx(int argc, char* argv[])
+{
+	UINT32 id;
+	int rc = -1;
+	BYTE* expected[TEST_SURFACES] = { 0 };
+	BYTE* actual[TEST_SURFACES] = { 0 };
+	UINT32 expectedUpdates[TEST_SURFACES] = { 0 };
+	UINT32 actualUpdates[TEST_SURFACES] = { 0 };
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_run(1, expected, expectedUpdates))
+	{
+		printf("decoding on the channel thread failed\n");
+		goto fail;
+	}
+
+	if (!test_run(4, actual, actualUpdates))
+	{
+		printf("decoding on decoder threads failed\n");
+		goto fail;
+	}
+
+	for (id = 0; id < TEST_SURFACES; id++)
+	{
+		const size_t scanline = TEST_SIZE * 4;
+
+		if (memcmp(expected[id], actual[id], scanline * TEST_SIZE) != 0)
+		{
+			printf("surface %" PRIu32 " differs\n", id);
+			goto fail;
+		}
+
+		if (expectedUpdates[id] != actualUpdates[id])
+		{
+			printf("surface %" PRIu32 " got %" PRIu32 " updates, expected %" PRIu32 "\n", id,
+			       actualUpdates[id], expectedUpdates[id]);
+			goto fail;
+		}
+	}
+
+	rc = 0;
+fail:
+
+	for (id = 0; id < TEST_SURFACES; id++)
+	{
+		free(expected[id]);
+		free(actual[id]);
+	}
+
+	return rc;
+}
@@ -0,0 +1,459 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * AVX2 YUV/RGB conversion operations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * The routines compute exactly the same results as the SSSE3 versions in
+ * prim_YUV_ssse3.c, they only process twice the number of pixels per step
+ * and do not require aligned buffers.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+static primitives_t fallback = { 0 };
+
+/****************************************************************************/
+/* AVX2 YUV420 -> RGB conversion                                            */
+/****************************************************************************/
+
+/* Converts 8 pixels, the Y, U and V values are expanded to 32 bit */
+static INLINE __m256i avx2_YUV444Pixel(__m256i Y, __m256i U, __m256i V)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_set1_epi32(255);
+	const __m256i c128 = _mm256_set1_epi32(128);
+	const __m256i C = _mm256_slli_epi32(Y, 8);
+	const __m256i D = _mm256_sub_epi32(U, c128);
+	const __m256i E = _mm256_sub_epi32(V, c128);
+	__m256i R, G, B;
+	/* R = (256 * Y + 403 * (V - 128)) >> 8 */
+	R = _mm256_add_epi32(C, _mm256_mullo_epi32(E, _mm256_set1_epi32(403)));
+	R = _mm256_srai_epi32(R, 8);
+	R = _mm256_min_epi32(max, _mm256_max_epi32(R, zero));
+	/* G = (256 * Y - 48 * (U - 128) - 120 * (V - 128)) >> 8 */
+	G = _mm256_add_epi32(_mm256_mullo_epi32(D, _mm256_set1_epi32(48)),
+	                     _mm256_mullo_epi32(E, _mm256_set1_epi32(120)));
+	G = _mm256_srai_epi32(_mm256_sub_epi32(C, G), 8);
+	G = _mm256_min_epi32(max, _mm256_max_epi32(G, zero));
+	/* B = (256 * Y + 475 * (U - 128)) >> 8 */
+	B = _mm256_add_epi32(C, _mm256_mullo_epi32(D, _mm256_set1_epi32(475)));
+	B = _mm256_srai_epi32(B, 8);
+	B = _mm256_min_epi32(max, _mm256_max_epi32(B, zero));
+	/* BGRX */
+	return _mm256_or_si256(_mm256_or_si256(B, _mm256_slli_epi32(G, 8)),
+	                       _mm256_or_si256(_mm256_slli_epi32(R, 16),
+	                                       _mm256_set1_epi32((INT32)0xFF000000)));
+}
+
+static pstatus_t avx2_YUV420ToRGB_BGRX(const BYTE* const* pSrc, const UINT32* srcStep, BYTE* pDst,
+                                       UINT32 dstStep, const prim_size_t* roi)
+{
+	const UINT32 nWidth = roi->width;
+	const UINT32 nHeight = roi->height;
+	const UINT32 pad = roi->width % 16;
+	const __m128i duplicate = _mm_set_epi8(7, 7, 6, 6, 5, 5, 4, 4, 3, 3, 2, 2, 1, 1, 0, 0);
+	UINT32 y;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		UINT32 x;
+		BYTE* dst = pDst + dstStep * y;
+		const BYTE* YData = pSrc[0] + y * srcStep[0];
+		const BYTE* UData = pSrc[1] + (y / 2) * srcStep[1];
+		const BYTE* VData = pSrc[2] + (y / 2) * srcStep[2];
+
+		for (x = 0; x < nWidth - pad; x += 16)
+		{
+			const __m128i Y = _mm_loadu_si128((const __m128i*)YData);
+			const __m128i U = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)UData), duplicate);
+			const __m128i V = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)VData), duplicate);
+			const __m256i lo = avx2_YUV444Pixel(_mm256_cvtepu8_epi32(Y), _mm256_cvtepu8_epi32(U),
+			                                    _mm256_cvtepu8_epi32(V));
+			const __m256i hi = avx2_YUV444Pixel(_mm256_cvtepu8_epi32(_mm_srli_si128(Y, 8)),
+			                                    _mm256_cvtepu8_epi32(_mm_srli_si128(U, 8)),
+			                                    _mm256_cvtepu8_epi32(_mm_srli_si128(V, 8)));
+			_mm256_storeu_si256((__m256i*)dst, lo);
+			_mm256_storeu_si256((__m256i*)&dst[32], hi);
+			YData += 16;
+			UData += 8;
+			VData += 8;
+			dst += 64;
+		}
+
+		for (x = 0; x < pad; x++)
+		{
+			const BYTE Y = *YData++;
+			const BYTE U = *UData;
+			const BYTE V = *VData;
+			const BYTE r = YUV2R(Y, U, V);
+			const BYTE g = YUV2G(Y, U, V);
+			const BYTE b = YUV2B(Y, U, V);
+			dst = writePixelBGRX(dst, 4, PIXEL_FORMAT_BGRX32, r, g, b, 0xFF);
+
+			if (x % 2)
+			{
+				UData++;
+				VData++;
+			}
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_YUV420ToRGB(const BYTE* const* pSrc, const UINT32* srcStep, BYTE* pDst,
+                                  UINT32 dstStep, UINT32 DstFormat, const prim_size_t* roi)
+{
+	switch (DstFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			return avx2_YUV420ToRGB_BGRX(pSrc, srcStep, pDst, dstStep, roi);
+
+		default:
+			return fallback.YUV420ToRGB_8u_P3AC4R(pSrc, srcStep, pDst, dstStep, DstFormat, roi);
+	}
+}
+
+/****************************************************************************/
+/* AVX2 RGB -> YUV420 conversion                                            */
+/****************************************************************************/
+
+/* See the comment in prim_YUV_ssse3.c for the factors */
+#define BGRX_Y_FACTORS \
+	_mm256_broadcastsi128_si256(   \
+	    _mm_set_epi8(0, 27, 92, 9, 0, 27, 92, 9, 0, 27, 92, 9, 0, 27, 92, 9))
+#define BGRX_U_FACTORS           \
+	_mm256_broadcastsi128_si256( \
+	    _mm_set_epi8(0, -29, -99, 127, 0, -29, -99, 127, 0, -29, -99, 127, 0, -29, -99, 127))
+#define BGRX_V_FACTORS           \
+	_mm256_broadcastsi128_si256( \
+	    _mm_set_epi8(0, 127, -116, -12, 0, 127, -116, -12, 0, 127, -116, -12, 0, 127, -116, -12))
+#define CONST128_FACTORS _mm256_set1_epi8(-128)
+
+#define Y_SHIFT 7
+#define U_SHIFT 8
+#define V_SHIFT 8
+
+/* The horizontal sums and packs work per 128 bit lane, this restores the pixel order */
+#define LANE_ORDER _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)
+
+/* Computes the luma of 32 pixels */
+static INLINE __m256i avx2_RGBToY(__m256i x0, __m256i x1, __m256i x2, __m256i x3)
+{
+	const __m256i y_factors = BGRX_Y_FACTORS;
+	const __m256i y0 = _mm256_srli_epi16(
+	    _mm256_hadd_epi16(_mm256_maddubs_epi16(x0, y_factors), _mm256_maddubs_epi16(x1, y_factors)),
+	    Y_SHIFT);
+	const __m256i y1 = _mm256_srli_epi16(
+	    _mm256_hadd_epi16(_mm256_maddubs_epi16(x2, y_factors), _mm256_maddubs_epi16(x3, y_factors)),
+	    Y_SHIFT);
+	return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(y0, y1), LANE_ORDER);
+}
+
+/* Computes one chroma component of 32 pixels */
+static INLINE __m256i avx2_RGBToUV(__m256i x0, __m256i x1, __m256i x2, __m256i x3,
+                                   __m256i factors)
+{
+	const __m256i c0 = _mm256_srai_epi16(
+	    _mm256_hadd_epi16(_mm256_maddubs_epi16(x0, factors), _mm256_maddubs_epi16(x1, factors)),
+	    U_SHIFT);
+	const __m256i c1 = _mm256_srai_epi16(
+	    _mm256_hadd_epi16(_mm256_maddubs_epi16(x2, factors), _mm256_maddubs_epi16(x3, factors)),
+	    U_SHIFT);
+	const __m256i c = _mm256_sub_epi8(_mm256_packs_epi16(c0, c1), CONST128_FACTORS);
+	return _mm256_permutevar8x32_epi32(c, LANE_ORDER);
+}
+
+/* compute the luma (Y) component from a single rgb source line */
+static INLINE void avx2_RGBToYUV420_BGRX_Y(const BYTE* src, BYTE* dst, UINT32 width)
+{
+	UINT32 x;
+	const __m256i* argb = (const __m256i*)src;
+
+	for (x = 0; x < width; x += 32)
+	{
+		const __m256i x0 = _mm256_loadu_si256(argb++);
+		const __m256i x1 = _mm256_loadu_si256(argb++);
+		const __m256i x2 = _mm256_loadu_si256(argb++);
+		const __m256i x3 = _mm256_loadu_si256(argb++);
+		_mm256_storeu_si256((__m256i*)&dst[x], avx2_RGBToY(x0, x1, x2, x3));
+	}
+}
+
+/* Averages two neighbouring pixels of 16 pixels, the result is in pixel order */
+static INLINE __m256i avx2_subsample(__m256i x0, __m256i x1)
+{
+	/**
+	 * shuffle controls
+	 * c = a[0],a[2],b[0],b[2] == 10 00 10 00 = 0x88
+	 * c = a[1],a[3],b[1],b[3] == 11 01 11 01 = 0xdd
+	 */
+	const __m256i even =
+	    _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(x0), _mm256_castsi256_ps(x1), 0x88));
+	const __m256i odd =
+	    _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(x0), _mm256_castsi256_ps(x1), 0xdd));
+	return _mm256_permutevar8x32_epi32(_mm256_avg_epu8(odd, even),
+	                                   _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7));
+}
+
+/* compute the chrominance (UV) components from two rgb source lines */
+static INLINE void avx2_RGBToYUV420_BGRX_UV(const BYTE* src1, const BYTE* src2, BYTE* dst1,
+                                            BYTE* dst2, UINT32 width)
+{
+	UINT32 x;
+	const __m256i u_factors = BGRX_U_FACTORS;
+	const __m256i v_factors = BGRX_V_FACTORS;
+	const __m256i* rgb1 = (const __m256i*)src1;
+	const __m256i* rgb2 = (const __m256i*)src2;
+
+	for (x = 0; x < width; x += 32)
+	{
+		/* subsample 32x2 pixels into 32x1 pixels */
+		const __m256i x0 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		const __m256i x1 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		const __m256i x2 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		const __m256i x3 = _mm256_avg_epu8(_mm256_loadu_si256(rgb1++), _mm256_loadu_si256(rgb2++));
+		/* subsample these 32x1 pixels into 16x1 pixels */
+		const __m256i a = avx2_subsample(x0, x1);
+		const __m256i b = avx2_subsample(x2, x3);
+		/* multiplications, the total sums and the shift */
+		const __m256i u = _mm256_srai_epi16(
+		    _mm256_hadd_epi16(_mm256_maddubs_epi16(a, u_factors), _mm256_maddubs_epi16(b, u_factors)),
+		    U_SHIFT);
+		const __m256i v = _mm256_srai_epi16(
+		    _mm256_hadd_epi16(_mm256_maddubs_epi16(a, v_factors), _mm256_maddubs_epi16(b, v_factors)),
+		    V_SHIFT);
+		/* pack the 32 words into bytes, add 128 and restore the order */
+		const __m256i uv = _mm256_permutevar8x32_epi32(
+		    _mm256_sub_epi8(_mm256_packs_epi16(u, v), CONST128_FACTORS), LANE_ORDER);
+		/* the lower 16 bytes go to the u plane, the upper 16 bytes to the v plane */
+		_mm_storeu_si128((__m128i*)&dst1[x / 2], _mm256_castsi256_si128(uv));
+		_mm_storeu_si128((__m128i*)&dst2[x / 2], _mm256_extracti128_si256(uv, 1));
+	}
+}
+
+static pstatus_t avx2_RGBToYUV420_BGRX(const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+                                       BYTE* pDst[3], UINT32 dstStep[3], const prim_size_t* roi)
+{
+	UINT32 y;
+	const BYTE* argb = pSrc;
+	BYTE* ydst = pDst[0];
+	BYTE* udst = pDst[1];
+	BYTE* vdst = pDst[2];
+
+	if (roi->height < 1 || roi->width < 1)
+		return !PRIMITIVES_SUCCESS;
+
+	if (roi->width % 32)
+		return fallback.RGBToYUV420_8u_P3AC4R(pSrc, srcFormat, srcStep, pDst, dstStep, roi);
+
+	for (y = 0; y < roi->height - 1; y += 2)
+	{
+		const BYTE* line1 = argb;
+		const BYTE* line2 = argb + srcStep;
+		avx2_RGBToYUV420_BGRX_UV(line1, line2, udst, vdst, roi->width);
+		avx2_RGBToYUV420_BGRX_Y(line1, ydst, roi->width);
+		avx2_RGBToYUV420_BGRX_Y(line2, ydst + dstStep[0], roi->width);
+		argb += 2 * srcStep;
+		ydst += 2 * dstStep[0];
+		udst += 1 * dstStep[1];
+		vdst += 1 * dstStep[2];
+	}
+
+	if (roi->height & 1)
+	{
+		/* pass the same last line of an odd height twice for UV */
+		avx2_RGBToYUV420_BGRX_UV(argb, argb, udst, vdst, roi->width);
+		avx2_RGBToYUV420_BGRX_Y(argb, ydst, roi->width);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_RGBToYUV420(const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+                                  BYTE* pDst[3], UINT32 dstStep[3], const prim_size_t* roi)
+{
+	switch (srcFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			return avx2_RGBToYUV420_BGRX(pSrc, srcFormat, srcStep, pDst, dstStep, roi);
+
+		default:
+			return fallback.RGBToYUV420_8u_P3AC4R(pSrc, srcFormat, srcStep, pDst, dstStep, roi);
+	}
+}
+
+/****************************************************************************/
+/* AVX2 RGB -> AVC444-YUV conversion                                       **/
+/****************************************************************************/
+
+/* Splits the 32 chroma values of an even and an odd row according to
+ * 3.3.8.3.2 YUV420p Stream Combination for YUV444 mode:
+ * 2x   2y    -> main (average of the 2x2 block if there is an odd row)
+ * x    2y+1  -> odd
+ * 2x+1 2y    -> aux */
+static INLINE void avx2_RGBToAVC444YUV_split(__m256i ce, __m256i co, BOOL haveOdd, BYTE* main,
+                                             BYTE* odd, BYTE* aux)
+{
+	const __m256i evenMask = _mm256_broadcastsi128_si256(_mm_set_epi8(
+	    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 14, 12, 10, 8, 6, 4, 2, 0));
+	const __m256i oddMask = _mm256_broadcastsi128_si256(_mm_set_epi8(
+	    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 15, 13, 11, 9, 7, 5, 3, 1));
+
+	if (haveOdd)
+	{
+		const __m256i ones = _mm256_set1_epi8(1);
+		const __m256i added =
+		    _mm256_add_epi16(_mm256_maddubs_epi16(ce, ones), _mm256_maddubs_epi16(co, ones));
+		const __m256i avg16 = _mm256_srai_epi16(added, 2);
+		const __m256i avg = _mm256_permute4x64_epi64(_mm256_packus_epi16(avg16, avg16), 0xD8);
+		_mm_storeu_si128((__m128i*)main, _mm256_castsi256_si128(avg));
+		_mm256_storeu_si256((__m256i*)odd, co);
+	}
+	else
+	{
+		const __m256i cd = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(ce, evenMask), 0xD8);
+		_mm_storeu_si128((__m128i*)main, _mm256_castsi256_si128(cd));
+	}
+
+	{
+		const __m256i cde = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(ce, oddMask), 0xD8);
+		_mm_storeu_si128((__m128i*)aux, _mm256_castsi256_si128(cde));
+	}
+}
+
+static INLINE void avx2_RGBToAVC444YUV_BGRX_DOUBLE_ROW(const BYTE* srcEven, const BYTE* srcOdd,
+                                                       BYTE* b1Even, BYTE* b1Odd, BYTE* b2,
+                                                       BYTE* b3, BYTE* b4, BYTE* b5, BYTE* b6,
+                                                       BYTE* b7, UINT32 width)
+{
+	UINT32 x;
+	const __m256i* argbEven = (const __m256i*)srcEven;
+	const __m256i* argbOdd = (const __m256i*)srcOdd;
+	const __m256i u_factors = BGRX_U_FACTORS;
+	const __m256i v_factors = BGRX_V_FACTORS;
+
+	for (x = 0; x < width; x += 32)
+	{
+		/* store 32 rgba pixels in 4 256 bit registers */
+		const __m256i xe1 = _mm256_loadu_si256(argbEven++);
+		const __m256i xe2 = _mm256_loadu_si256(argbEven++);
+		const __m256i xe3 = _mm256_loadu_si256(argbEven++);
+		const __m256i xe4 = _mm256_loadu_si256(argbEven++);
+		const __m256i xo1 = _mm256_loadu_si256(argbOdd++);
+		const __m256i xo2 = _mm256_loadu_si256(argbOdd++);
+		const __m256i xo3 = _mm256_loadu_si256(argbOdd++);
+		const __m256i xo4 = _mm256_loadu_si256(argbOdd++);
+		__m256i uo = _mm256_setzero_si256();
+		__m256i vo = _mm256_setzero_si256();
+		/* store y [b1] */
+		_mm256_storeu_si256((__m256i*)b1Even, avx2_RGBToY(xe1, xe2, xe3, xe4));
+		b1Even += 32;
+
+		if (b1Odd)
+		{
+			_mm256_storeu_si256((__m256i*)b1Odd, avx2_RGBToY(xo1, xo2, xo3, xo4));
+			b1Odd += 32;
+			uo = avx2_RGBToUV(xo1, xo2, xo3, xo4, u_factors);
+			vo = avx2_RGBToUV(xo1, xo2, xo3, xo4, v_factors);
+		}
+
+		avx2_RGBToAVC444YUV_split(avx2_RGBToUV(xe1, xe2, xe3, xe4, u_factors), uo, b1Odd != NULL,
+		                          b2, b4, b6);
+		avx2_RGBToAVC444YUV_split(avx2_RGBToUV(xe1, xe2, xe3, xe4, v_factors), vo, b1Odd != NULL,
+		                          b3, b5, b7);
+		b2 += 16;
+		b3 += 16;
+		b4 += 32;
+		b5 += 32;
+		b6 += 16;
+		b7 += 16;
+	}
+}
+
+static pstatus_t avx2_RGBToAVC444YUV_BGRX(const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+                                          BYTE* pDst1[3], const UINT32 dst1Step[3], BYTE* pDst2[3],
+                                          const UINT32 dst2Step[3], const prim_size_t* roi)
+{
+	UINT32 y;
+	const BYTE* pMaxSrc = pSrc + (roi->height - 1) * srcStep;
+
+	if (roi->height < 1 || roi->width < 1)
+		return !PRIMITIVES_SUCCESS;
+
+	if (roi->width % 32)
+		return fallback.RGBToAVC444YUV(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2, dst2Step,
+		                               roi);
+
+	for (y = 0; y < roi->height; y += 2)
+	{
+		const BOOL last = (y >= (roi->height - 1));
+		const BYTE* srcEven = y < roi->height ? pSrc + y * srcStep : pMaxSrc;
+		const BYTE* srcOdd = !last ? pSrc + (y + 1) * srcStep : pMaxSrc;
+		const UINT32 i = y >> 1;
+		const UINT32 n = (i & ~7) + i;
+		BYTE* b1Even = pDst1[0] + y * dst1Step[0];
+		BYTE* b1Odd = !last ? (b1Even + dst1Step[0]) : NULL;
+		BYTE* b2 = pDst1[1] + (y / 2) * dst1Step[1];
+		BYTE* b3 = pDst1[2] + (y / 2) * dst1Step[2];
+		BYTE* b4 = pDst2[0] + dst2Step[0] * n;
+		BYTE* b5 = b4 + 8 * dst2Step[0];
+		BYTE* b6 = pDst2[1] + (y / 2) * dst2Step[1];
+		BYTE* b7 = pDst2[2] + (y / 2) * dst2Step[2];
+		avx2_RGBToAVC444YUV_BGRX_DOUBLE_ROW(srcEven, srcOdd, b1Even, b1Odd, b2, b3, b4, b5, b6, b7,
+		                                    roi->width);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_RGBToAVC444YUV(const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+                                     BYTE* pDst1[3], const UINT32 dst1Step[3], BYTE* pDst2[3],
+                                     const UINT32 dst2Step[3], const prim_size_t* roi)
+{
+	switch (srcFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			return avx2_RGBToAVC444YUV_BGRX(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2,
+			                                dst2Step, roi);
+
+		default:
+			return fallback.RGBToAVC444YUV(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2,
+			                               dst2Step, roi);
+	}
+}
+
+void primitives_init_YUV_avx2(primitives_t* prims)
+{
+	fallback = *prims;
+	prims->RGBToYUV420_8u_P3AC4R = avx2_RGBToYUV420;
+	prims->RGBToAVC444YUV = avx2_RGBToAVC444YUV;
+	prims->YUV420ToRGB_8u_P3AC4R = avx2_YUV420ToRGB;
+}
@@ -0,0 +1,106 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * AVX2 alpha blending routines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Uses the same arithmetic as the SSE2 version (see prim_alphaComp_opt.c),
+ * eight pixels at a time and without alignment requirements.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+static primitives_t fallback = { 0 };
+
+/* Blends the pixels of one 128 bit lane pair, widened to 16 bit per channel */
+static INLINE __m256i avx2_alphaComp_half(__m256i s1, __m256i s2)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	/* subtract */
+	const __m256i diff = _mm256_subs_epi16(s1, s2);
+	/* 00Ab00Ab00Ab00Ab00Aa00Aa00Aa00Aa (per lane) */
+	__m256i alpha = _mm256_shufflelo_epi16(s1, 0xff);
+	alpha = _mm256_shufflehi_epi16(alpha, 0xff);
+	/* Add one to alphas */
+	alpha = _mm256_adds_epi16(alpha, one);
+	/* Multiply, take low word and shift 8 right */
+	alpha = _mm256_srai_epi16(_mm256_mullo_epi16(alpha, diff), 8);
+	/* Add the second source and mask off remainders or pack gets confused */
+	return _mm256_and_si256(_mm256_adds_epi16(alpha, s2), _mm256_set1_epi16(0x00ff));
+}
+
+static pstatus_t avx2_alphaComp_argb(const BYTE* pSrc1, UINT32 src1Step, const BYTE* pSrc2,
+                                     UINT32 src2Step, BYTE* pDst, UINT32 dstStep, UINT32 width,
+                                     UINT32 height)
+{
+	UINT32 y;
+	const __m256i zero = _mm256_setzero_si256();
+
+	if (width < 8) /* pointless if too small */
+		return fallback.alphaComp_argb(pSrc1, src1Step, pSrc2, src2Step, pDst, dstStep, width,
+		                               height);
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* sptr1 = &pSrc1[y * src1Step];
+		const BYTE* sptr2 = &pSrc2[y * src2Step];
+		BYTE* dptr = &pDst[y * dstStep];
+		UINT32 x;
+
+		for (x = 0; x + 8 <= width; x += 8)
+		{
+			const __m256i a = _mm256_loadu_si256((const __m256i*)sptr1);
+			const __m256i b = _mm256_loadu_si256((const __m256i*)sptr2);
+			const __m256i hi =
+			    avx2_alphaComp_half(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+			const __m256i lo =
+			    avx2_alphaComp_half(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+			/* The unpack and pack both work per lane, the pixel order is preserved */
+			_mm256_storeu_si256((__m256i*)dptr, _mm256_packus_epi16(lo, hi));
+			sptr1 += 32;
+			sptr2 += 32;
+			dptr += 32;
+		}
+
+		/* Finish off the remainder. */
+		if (x < width)
+		{
+			const pstatus_t status = fallback.alphaComp_argb(sptr1, src1Step, sptr2, src2Step,
+			                                                 dptr, dstStep, width - x, 1);
+
+			if (status != PRIMITIVES_SUCCESS)
+				return status;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+void primitives_init_alphaComp_avx2(primitives_t* prims)
+{
+	fallback = *prims;
+	prims->alphaComp_argb = avx2_alphaComp_argb;
+}
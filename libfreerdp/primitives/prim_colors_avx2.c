@@ -0,0 +1,158 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * AVX2 color conversion routines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+static primitives_t fallback = { 0 };
+
+/**
+ * Converts 16 pixels with the fixed point arithmetic of the SSE2 version (see the comment
+ * in sse2_yCbCrToRGB_16s8u_P3AC4R_BGRX), the results are identical.
+ * The channels are combined as 16 bit words (first, second) and (third, 0xFF) which are
+ * interleaved per lane and put back in pixel order with a lane permutation.
+ */
+static INLINE void avx2_yCbCrToRGB_16s8u_16px(const INT16* y_buf, const INT16* cb_buf,
+                                              const INT16* cr_buf, BYTE* d_buf, BOOL rgbx)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_set1_epi16(255);
+	const __m256i r_cr = _mm256_set1_epi16(22986);  /*  1.403 << 14 */
+	const __m256i g_cb = _mm256_set1_epi16(-5636);  /* -0.344 << 14 */
+	const __m256i g_cr = _mm256_set1_epi16(-11698); /* -0.714 << 14 */
+	const __m256i b_cb = _mm256_set1_epi16(28999);  /*  1.770 << 14 */
+	const __m256i c4096 = _mm256_set1_epi16(4096);
+	const __m256i alpha = _mm256_set1_epi16((INT16)0xFF00);
+	__m256i y, cb, cr, r, g, b, first, second, lo, hi;
+	/* y = (y_r_buf[i] + 4096) >> 2 */
+	y = _mm256_loadu_si256((const __m256i*)y_buf);
+	y = _mm256_srai_epi16(_mm256_add_epi16(y, c4096), 2);
+	cb = _mm256_loadu_si256((const __m256i*)cb_buf);
+	cr = _mm256_loadu_si256((const __m256i*)cr_buf);
+	/* (y + HIWORD(cr*22986)) >> 3 */
+	r = _mm256_srai_epi16(_mm256_add_epi16(y, _mm256_mulhi_epi16(cr, r_cr)), 3);
+	r = _mm256_min_epi16(max, _mm256_max_epi16(r, zero));
+	/* (y + HIWORD(cb*-5636) + HIWORD(cr*-11698)) >> 3 */
+	g = _mm256_add_epi16(y, _mm256_mulhi_epi16(cb, g_cb));
+	g = _mm256_srai_epi16(_mm256_add_epi16(g, _mm256_mulhi_epi16(cr, g_cr)), 3);
+	g = _mm256_min_epi16(max, _mm256_max_epi16(g, zero));
+	/* (y + HIWORD(cb*28999)) >> 3 */
+	b = _mm256_srai_epi16(_mm256_add_epi16(y, _mm256_mulhi_epi16(cb, b_cb)), 3);
+	b = _mm256_min_epi16(max, _mm256_max_epi16(b, zero));
+
+	if (rgbx)
+	{
+		first = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+		second = _mm256_or_si256(b, alpha);
+	}
+	else
+	{
+		first = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+		second = _mm256_or_si256(r, alpha);
+	}
+
+	/* lo = pixels 0-3 | 8-11, hi = pixels 4-7 | 12-15 */
+	lo = _mm256_unpacklo_epi16(first, second);
+	hi = _mm256_unpackhi_epi16(first, second);
+	_mm256_storeu_si256((__m256i*)d_buf, _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i*)&d_buf[32], _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+static INLINE pstatus_t avx2_yCbCrToRGB_16s8u_P3AC4R_X(const INT16* const pSrc[3], UINT32 srcStep,
+                                                       BYTE* pDst, UINT32 dstStep,
+                                                       const prim_size_t* roi, BOOL rgbx)
+{
+	UINT32 yp;
+	const UINT32 pad = roi->width % 16;
+
+	for (yp = 0; yp < roi->height; yp++)
+	{
+		UINT32 i;
+		const INT16* y_buf = (const INT16*)((const BYTE*)pSrc[0] + yp * srcStep);
+		const INT16* cb_buf = (const INT16*)((const BYTE*)pSrc[1] + yp * srcStep);
+		const INT16* cr_buf = (const INT16*)((const BYTE*)pSrc[2] + yp * srcStep);
+		BYTE* d_buf = &pDst[yp * dstStep];
+
+		for (i = 0; i < roi->width - pad; i += 16)
+		{
+			avx2_yCbCrToRGB_16s8u_16px(y_buf, cb_buf, cr_buf, d_buf, rgbx);
+			y_buf += 16;
+			cb_buf += 16;
+			cr_buf += 16;
+			d_buf += 64;
+		}
+
+		for (i = 0; i < pad; i++)
+		{
+			const INT32 divisor = 16;
+			const INT32 Y = ((*y_buf++) + 4096) << divisor;
+			const INT32 Cb = (*cb_buf++);
+			const INT32 Cr = (*cr_buf++);
+			const INT32 CrR = Cr * (INT32)(1.402525f * (1 << divisor));
+			const INT32 CrG = Cr * (INT32)(0.714401f * (1 << divisor));
+			const INT32 CbG = Cb * (INT32)(0.343730f * (1 << divisor));
+			const INT32 CbB = Cb * (INT32)(1.769905f * (1 << divisor));
+			const INT16 R = ((INT16)((CrR + Y) >> divisor) >> 5);
+			const INT16 G = ((INT16)((Y - CbG - CrG) >> divisor) >> 5);
+			const INT16 B = ((INT16)((CbB + Y) >> divisor) >> 5);
+			*d_buf++ = rgbx ? CLIP(R) : CLIP(B);
+			*d_buf++ = CLIP(G);
+			*d_buf++ = rgbx ? CLIP(B) : CLIP(R);
+			*d_buf++ = 0xFF;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_yCbCrToRGB_16s8u_P3AC4R(const INT16* const pSrc[3], UINT32 srcStep,
+                                              BYTE* pDst, UINT32 dstStep, UINT32 DstFormat,
+                                              const prim_size_t* roi) /* region of interest */
+{
+	switch (DstFormat)
+	{
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+			return avx2_yCbCrToRGB_16s8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, roi, FALSE);
+
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			return avx2_yCbCrToRGB_16s8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, roi, TRUE);
+
+		default:
+			return fallback.yCbCrToRGB_16s8u_P3AC4R(pSrc, srcStep, pDst, dstStep, DstFormat,
+			                                        roi);
+	}
+}
+
+void primitives_init_colors_avx2(primitives_t* prims)
+{
+	fallback = *prims;
+	prims->yCbCrToRGB_16s8u_P3AC4R = avx2_yCbCrToRGB_16s8u_P3AC4R;
+}
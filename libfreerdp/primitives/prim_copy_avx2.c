@@ -0,0 +1,104 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * AVX2 copy operations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_AVX2)
+#error "This file needs WITH_AVX2 enabled!"
+#endif
+
+static primitives_t fallback = { 0 };
+
+static BOOL avx2_regions_overlap(const BYTE* pSrc, INT32 srcStep, const BYTE* pDst, INT32 dstStep,
+                                 INT32 rowbytes, INT32 height)
+{
+	const ULONG_PTR src = (ULONG_PTR)pSrc;
+	const ULONG_PTR dst = (ULONG_PTR)pDst;
+	const ULONG_PTR srcEnd = src + (height - 1) * srcStep + rowbytes;
+	const ULONG_PTR dstEnd = dst + (height - 1) * dstStep + rowbytes;
+	return (src < dstEnd) && (dst < srcEnd);
+}
+
+/* Rows of a tile are short, an inline loop beats a memcpy call per row. The last vector of a
+ * row overlaps the previous one instead of falling back to a byte loop. */
+static INLINE void avx2_copy_row(const BYTE* src, BYTE* dst, INT32 rowbytes)
+{
+	INT32 x;
+
+	for (x = 0; x + 64 <= rowbytes; x += 64)
+	{
+		const __m256i a = _mm256_loadu_si256((const __m256i*)&src[x]);
+		const __m256i b = _mm256_loadu_si256((const __m256i*)&src[x + 32]);
+		_mm256_storeu_si256((__m256i*)&dst[x], a);
+		_mm256_storeu_si256((__m256i*)&dst[x + 32], b);
+	}
+
+	if (x + 32 <= rowbytes)
+	{
+		_mm256_storeu_si256((__m256i*)&dst[x], _mm256_loadu_si256((const __m256i*)&src[x]));
+		x += 32;
+	}
+
+	if (x < rowbytes)
+	{
+		const INT32 last = rowbytes - 32;
+		_mm256_storeu_si256((__m256i*)&dst[last], _mm256_loadu_si256((const __m256i*)&src[last]));
+	}
+}
+
+static pstatus_t avx2_copy_8u_AC4r(const BYTE* pSrc, INT32 srcStep, BYTE* pDst, INT32 dstStep,
+                                   INT32 width, INT32 height)
+{
+	INT32 y;
+	const INT32 rowbytes = width * 4;
+
+	if ((width <= 0) || (height <= 0))
+		return PRIMITIVES_SUCCESS;
+
+	if ((rowbytes < 32) || (srcStep < rowbytes) || (dstStep < rowbytes) ||
+	    avx2_regions_overlap(pSrc, srcStep, pDst, dstStep, rowbytes, height))
+		return fallback.copy_8u_AC4r(pSrc, srcStep, pDst, dstStep, width, height);
+
+	/* Whole surfaces are a single block */
+	if ((srcStep == rowbytes) && (dstStep == rowbytes))
+	{
+		memcpy(pDst, pSrc, (size_t)rowbytes * height);
+		return PRIMITIVES_SUCCESS;
+	}
+
+	for (y = 0; y < height; y++)
+		avx2_copy_row(&pSrc[y * srcStep], &pDst[y * dstStep], rowbytes);
+
+	return PRIMITIVES_SUCCESS;
+}
+
+void primitives_init_copy_avx2(primitives_t* prims)
+{
+	fallback = *prims;
+	prims->copy_8u_AC4r = avx2_copy_8u_AC4r;
+}
@@ -207,10 +207,32 @@ FREERDP_LOCAL void primitives_init_YCoCg_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YUV_opt(primitives_t* prims);
 #endif
 
+#if defined(WITH_AVX2)
+FREERDP_LOCAL void primitives_init_copy_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_alphaComp_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_colors_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_YUV_avx2(primitives_t* prims);
+#endif
+
+#if defined(WITH_AVX512)
+FREERDP_LOCAL void primitives_init_colors_avx512(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_YUV_avx512(primitives_t* prims);
+#endif
+
 #if defined(WITH_OPENCL)
 FREERDP_LOCAL BOOL primitives_init_opencl(primitives_t* prims);
 #endif
 
+/* Instruction set tiers of the CPU primitives, each one builds on the previous one */
+typedef enum
+{
+	PRIMITIVES_CPU_SIMD,  /** SSE2/SSSE3 or NEON */
+	PRIMITIVES_CPU_AVX2,  /** AVX2 if supported by the CPU */
+	PRIMITIVES_CPU_AVX512 /** AVX-512F/BW if supported by the CPU */
+} primitives_cpu_tier;
+
+FREERDP_LOCAL BOOL primitives_init_cpu(primitives_t* prims, primitives_cpu_tier tier);
+
 FREERDP_LOCAL primitives_t* primitives_get_by_type(DWORD type);
 
 #endif /* FREERDP_LIB_PRIM_INTERNAL_H */
@@ -34,7 +34,6 @@
 
 /* hints to know which kind of primitives to use */
 static primitive_hints primitivesHints = PRIMITIVES_AUTODETECT;
-static BOOL primitives_init_optimized(primitives_t* prims);
 
 void primitives_set_hints(primitive_hints hints)
 {
@@ -90,7 +89,7 @@ static BOOL CALLBACK primitives_init_generic_cb(PINIT_ONCE once, PVOID param, PV
 	return primitives_init_generic(&pPrimitivesGeneric);
 }
 
-static BOOL primitives_init_optimized(primitives_t* prims)
+BOOL primitives_init_cpu(primitives_t* prims, primitives_cpu_tier tier)
 {
 	primitives_init_generic(prims);
 
@@ -107,6 +106,31 @@ static BOOL primitives_init_optimized(primitives_t* prims)
 	primitives_init_YUV_opt(prims);
 	prims->flags |= PRIM_FLAGS_HAVE_EXTCPU;
 #endif
+#if defined(WITH_AVX2)
+
+	/* The wider tiers only replace the routines they are faster at */
+	if ((tier >= PRIMITIVES_CPU_AVX2) && IsProcessorFeaturePresentEx(PF_EX_AVX2))
+	{
+#if !defined(WITH_IPP)
+		primitives_init_copy_avx2(prims);
+		primitives_init_alphaComp_avx2(prims);
+#endif
+		primitives_init_colors_avx2(prims);
+		primitives_init_YUV_avx2(prims);
+	}
+
+#endif
+#if defined(WITH_AVX512)
+
+	if ((tier >= PRIMITIVES_CPU_AVX512) && IsProcessorFeaturePresentEx(PF_EX_AVX2) &&
+	    IsProcessorFeaturePresentEx(PF_EX_AVX512BW))
+	{
+		primitives_init_colors_avx512(prims);
+		primitives_init_YUV_avx512(prims);
+	}
+
+#endif
+	WINPR_UNUSED(tier);
 	return TRUE;
 }
 
@@ -288,7 +312,7 @@ static BOOL CALLBACK primitives_init_cpu_cb(PINIT_ONCE once, PVOID param, PVOID*
 	WINPR_UNUSED(param);
 	WINPR_UNUSED(context);
 
-	if (!primitives_init_optimized(&pPrimitivesCpu))
+	if (!primitives_init_cpu(&pPrimitivesCpu, PRIMITIVES_CPU_AVX512))
 		return FALSE;
 
 	return TRUE;
@@ -160,6 +160,48 @@ static BOOL test_alphaComp_func(void)
 	return TRUE;
 }
 
+/* Wide enough for the vectorized loops and their remainders */
+#define TIER_WIDTH 37
+#define TIER_HEIGHT 6
+
+static BOOL test_alphaComp_tiers(void)
+{
+	UINT32 tier, i;
+	BYTE ALIGN(src1[(TIER_WIDTH + 1) * TIER_HEIGHT * 4]);
+	BYTE ALIGN(src2[(TIER_WIDTH + 3) * TIER_HEIGHT * 4]);
+	BYTE ALIGN(dst1[(TIER_WIDTH + 2) * TIER_HEIGHT * 4]);
+	UINT32* ptr = (UINT32*)src2;
+	winpr_RAND(src1, sizeof(src1));
+	winpr_RAND(src2, sizeof(src2));
+
+	for (i = 0; i < sizeof(src2) / 4; ++i)
+		*ptr++ |= 0xFF000000U;
+
+	for (tier = 0; tier < PRIM_TEST_TIERS; tier++)
+	{
+		const primitives_t* prims = prim_test_get_tier(tier);
+
+		if (!prims)
+			return FALSE;
+
+		memset(dst1, 0, sizeof(dst1));
+
+		if (prims->alphaComp_argb(src1, 4 * (TIER_WIDTH + 1), src2, 4 * (TIER_WIDTH + 3), dst1,
+		                          4 * (TIER_WIDTH + 2), TIER_WIDTH,
+		                          TIER_HEIGHT) != PRIMITIVES_SUCCESS)
+			return FALSE;
+
+		if (!check(src1, 4 * (TIER_WIDTH + 1), src2, 4 * (TIER_WIDTH + 3), dst1,
+		           4 * (TIER_WIDTH + 2), TIER_WIDTH, TIER_HEIGHT))
+		{
+			printf("alphaComp %s failed\n", prim_test_tier_name(tier));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 static int test_alphaComp_speed(void)
 {
 	BYTE ALIGN(src1[SRC1_WIDTH * SRC1_HEIGHT]);
@@ -197,6 +239,9 @@ int TestPrimitivesAlphaComp(int argc, char* argv[])
 	if (!test_alphaComp_func())
 		return -1;
 
+	if (!test_alphaComp_tiers())
+		return -1;
+
 	if (g_TestPrimitivesPerformance)
 	{
 		if (!test_alphaComp_speed())
@@ -62,6 +62,66 @@ static BOOL test_copy8u_func(void)
 	return TRUE;
 }
 
+/* ------------------------------------------------------------------------- */
+static BOOL test_copy8u_AC4r_tiers(void)
+{
+	const INT32 widths[] = { 1, 7, 8, 9, 16, 17, 31, 64, 65, 100 };
+	const INT32 height = 5;
+	const INT32 stride = 4 * 100 + 12;
+	const size_t size = (size_t)stride * height;
+	BYTE* src = malloc(size);
+	BYTE* expected = malloc(size);
+	BYTE* actual = malloc(size);
+	BOOL rc = FALSE;
+	UINT32 tier, x;
+
+	if (!src || !expected || !actual)
+		goto fail;
+
+	winpr_RAND(src, size);
+
+	for (tier = 0; tier < PRIM_TEST_TIERS; tier++)
+	{
+		const primitives_t* prims = prim_test_get_tier(tier);
+
+		if (!prims)
+			goto fail;
+
+		for (x = 0; x < sizeof(widths) / sizeof(widths[0]); x++)
+		{
+			const INT32 width = widths[x];
+			/* Packed rows and rows with gaps */
+			const INT32 srcStep = (x % 2) ? stride : width * 4;
+			const INT32 dstStep = (x % 3) ? stride : width * 4;
+			memset(expected, 0xA5, size);
+			memset(actual, 0xA5, size);
+
+			if (generic->copy_8u_AC4r(src + 4, srcStep, expected + 8, dstStep, width, height) !=
+			    PRIMITIVES_SUCCESS)
+				goto fail;
+
+			if (prims->copy_8u_AC4r(src + 4, srcStep, actual + 8, dstStep, width, height) !=
+			    PRIMITIVES_SUCCESS)
+				goto fail;
+
+			if (memcmp(expected, actual, size) != 0)
+			{
+				printf("COPY8U_AC4R FAIL: %s width=%" PRId32 " srcStep=%" PRId32
+				       " dstStep=%" PRId32 "\n",
+				       prim_test_tier_name(tier), width, srcStep, dstStep);
+				goto fail;
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	free(expected);
+	free(actual);
+	return rc;
+}
+
 /* ------------------------------------------------------------------------- */
 static BOOL test_copy8u_speed(void)
 {
@@ -88,6 +148,9 @@ int TestPrimitivesCopy(int argc, char* argv[])
 	if (!test_copy8u_func())
 		return 1;
 
+	if (!test_copy8u_AC4r_tiers())
+		return 1;
+
 	if (g_TestPrimitivesPerformance)
 	{
 		if (!test_copy8u_speed())
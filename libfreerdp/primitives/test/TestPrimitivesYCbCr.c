@@ -1711,6 +1711,81 @@ fail:
 	return status;
 }
 
+/* The instruction set tiers must produce exactly the same output */
+static BOOL test_PrimitivesYCbCr_tiers(prim_size_t roi)
+{
+	const UINT32 formats[] = { PIXEL_FORMAT_RGBA32, PIXEL_FORMAT_RGBX32, PIXEL_FORMAT_BGRA32,
+		                       PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_XRGB32 };
+	const UINT32 srcStride = roi.width * 2;
+	const UINT32 dstStride = roi.width * 4;
+	const UINT32 srcSize = srcStride * roi.height;
+	const UINT32 dstSize = dstStride * roi.height;
+	INT16* pYCbCr[3] = { NULL, NULL, NULL };
+	BYTE* expected = _aligned_malloc(dstSize, 16);
+	BYTE* actual = _aligned_malloc(dstSize, 16);
+	BOOL rc = FALSE;
+	UINT32 x, i, tier;
+
+	if (!expected || !actual)
+		goto fail;
+
+	for (i = 0; i < 3; i++)
+	{
+		UINT32 j;
+
+		if (!(pYCbCr[i] = _aligned_malloc(srcSize, 16)))
+			goto fail;
+
+		for (j = 0; j < srcSize / 2; j++)
+			pYCbCr[i][j] = (INT16)((rand() % 8192) - 4096);
+	}
+
+	for (x = 0; x < sizeof(formats) / sizeof(formats[0]); x++)
+	{
+		const primitives_t* base = prim_test_get_tier(0);
+
+		if (!base)
+			goto fail;
+
+		memset(expected, 0, dstSize);
+
+		if (base->yCbCrToRGB_16s8u_P3AC4R((const INT16**)pYCbCr, srcStride, expected, dstStride,
+		                                  formats[x], &roi) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		for (tier = 1; tier < PRIM_TEST_TIERS; tier++)
+		{
+			const primitives_t* prims = prim_test_get_tier(tier);
+
+			if (!prims)
+				goto fail;
+
+			memset(actual, 0, dstSize);
+
+			if (prims->yCbCrToRGB_16s8u_P3AC4R((const INT16**)pYCbCr, srcStride, actual,
+			                                   dstStride, formats[x], &roi) != PRIMITIVES_SUCCESS)
+				goto fail;
+
+			if (memcmp(expected, actual, dstSize) != 0)
+			{
+				printf("yCbCrToRGB_16s8u_P3AC4R %s [%" PRIu32 "x%" PRIu32 "] %s differs\n",
+				       prim_test_tier_name(tier), roi.width, roi.height,
+				       FreeRDPGetColorFormatName(formats[x]));
+				goto fail;
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	_aligned_free(pYCbCr[0]);
+	_aligned_free(pYCbCr[1]);
+	_aligned_free(pYCbCr[2]);
+	_aligned_free(expected);
+	_aligned_free(actual);
+	return rc;
+}
+
 int TestPrimitivesYCbCr(int argc, char* argv[])
 {
 	const UINT32 formats[] = { PIXEL_FORMAT_XRGB32, PIXEL_FORMAT_XBGR32, PIXEL_FORMAT_ARGB32,
@@ -1722,6 +1797,16 @@ int TestPrimitivesYCbCr(int argc, char* argv[])
 
 	if (argc < 2)
 	{
+		{
+			/* Compare the instruction set tiers, with and without a pixel remainder */
+			const prim_size_t sizes[] = { { 64, 64 }, { 72, 8 }, { 88, 3 }, { 1928, 4 } };
+
+			for (x = 0; x < sizeof(sizes) / sizeof(sizes[0]); x++)
+			{
+				if (!test_PrimitivesYCbCr_tiers(sizes[x]))
+					return -1;
+			}
+		}
 		{
 			/* Do content comparison. */
 			for (x = 0; x < sizeof(formats) / sizeof(formats[0]); x++)
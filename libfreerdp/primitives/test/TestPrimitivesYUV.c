@@ -847,14 +847,167 @@ fail:
 	return rc;
 }
 
+static BOOL compare_tier(const char* name, UINT32 tier, const BYTE* expected, const BYTE* actual,
+                         size_t size, prim_size_t roi)
+{
+	if (memcmp(expected, actual, size) == 0)
+		return TRUE;
+
+	printf("%s %s [%" PRIu32 "x%" PRIu32 "] differs\n", name, prim_test_tier_name(tier),
+	       roi.width, roi.height);
+	return FALSE;
+}
+
+/* The instruction set tiers must produce exactly the same output */
+static BOOL TestPrimitiveYUVTiers(prim_size_t roi)
+{
+	BOOL rc = FALSE;
+	UINT32 i, tier;
+	const UINT32 rgbStride = roi.width * 4;
+	const size_t rgbSize = (size_t)rgbStride * roi.height;
+	const size_t planeSize = (size_t)roi.width * roi.height;
+	/* The AVC444 auxiliary frame needs heights padded to 16 lines */
+	const BOOL avc444 = (roi.height % 16) == 0;
+	UINT32 yuvStep[3];
+	BYTE* rgb = _aligned_malloc(rgbSize, 16);
+	BYTE* rgbExpected = _aligned_malloc(rgbSize, 16);
+	BYTE* rgbActual = _aligned_malloc(rgbSize, 16);
+	BYTE* yuv[3] = { 0 };
+	BYTE* expected[9] = { 0 }; /* YUV420 planes followed by the AVC444 planes */
+	BYTE* actual[6] = { 0 };
+	yuvStep[0] = roi.width;
+	yuvStep[1] = (roi.width + 1) / 2;
+	yuvStep[2] = (roi.width + 1) / 2;
+
+	if (!rgb || !rgbExpected || !rgbActual)
+		goto fail;
+
+	for (i = 0; i < 9; i++)
+	{
+		if (i < 3)
+		{
+			if (!(yuv[i] = _aligned_malloc(planeSize, 16)))
+				goto fail;
+
+			winpr_RAND(yuv[i], planeSize);
+		}
+
+		if (i < 6)
+		{
+			if (!(actual[i] = _aligned_malloc(planeSize, 16)))
+				goto fail;
+		}
+
+		if (!(expected[i] = _aligned_malloc(planeSize, 16)))
+			goto fail;
+
+		memset(expected[i], 0, planeSize);
+	}
+
+	winpr_RAND(rgb, rgbSize);
+
+	{
+		const primitives_t* base = prim_test_get_tier(0);
+
+		if (!base)
+			goto fail;
+
+		if (base->YUV420ToRGB_8u_P3AC4R((const BYTE**)yuv, yuvStep, rgbExpected, rgbStride,
+		                                PIXEL_FORMAT_BGRX32, &roi) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		if (base->RGBToYUV420_8u_P3AC4R(rgb, PIXEL_FORMAT_BGRX32, rgbStride, expected, yuvStep,
+		                                &roi) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		if (avc444 && (base->RGBToAVC444YUV(rgb, PIXEL_FORMAT_BGRX32, rgbStride, &expected[3],
+		                                    yuvStep, &expected[6], yuvStep,
+		                                    &roi) != PRIMITIVES_SUCCESS))
+			goto fail;
+	}
+
+	for (tier = 1; tier < PRIM_TEST_TIERS; tier++)
+	{
+		const primitives_t* prims = prim_test_get_tier(tier);
+
+		if (!prims)
+			goto fail;
+
+		memset(rgbActual, 0, rgbSize);
+
+		if (prims->YUV420ToRGB_8u_P3AC4R((const BYTE**)yuv, yuvStep, rgbActual, rgbStride,
+		                                 PIXEL_FORMAT_BGRX32, &roi) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		if (!compare_tier("YUV420ToRGB", tier, rgbExpected, rgbActual, rgbSize, roi))
+			goto fail;
+
+		for (i = 0; i < 6; i++)
+			memset(actual[i], 0, planeSize);
+
+		if (prims->RGBToYUV420_8u_P3AC4R(rgb, PIXEL_FORMAT_BGRX32, rgbStride, actual, yuvStep,
+		                                 &roi) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		for (i = 0; i < 3; i++)
+		{
+			if (!compare_tier("RGBToYUV420", tier, expected[i], actual[i], planeSize, roi))
+				goto fail;
+		}
+
+		if (!avc444)
+			continue;
+
+		for (i = 0; i < 6; i++)
+			memset(actual[i], 0, planeSize);
+
+		if (prims->RGBToAVC444YUV(rgb, PIXEL_FORMAT_BGRX32, rgbStride, actual, yuvStep,
+		                          &actual[3], yuvStep, &roi) != PRIMITIVES_SUCCESS)
+			goto fail;
+
+		for (i = 0; i < 6; i++)
+		{
+			if (!compare_tier("RGBToAVC444YUV", tier, expected[i + 3], actual[i], planeSize,
+			                  roi))
+				goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+
+	for (i = 0; i < 9; i++)
+	{
+		if (i < 3)
+			_aligned_free(yuv[i]);
+
+		if (i < 6)
+			_aligned_free(actual[i]);
+
+		_aligned_free(expected[i]);
+	}
+
+	_aligned_free(rgb);
+	_aligned_free(rgbExpected);
+	_aligned_free(rgbActual);
+	return rc;
+}
+
 int TestPrimitivesYUV(int argc, char* argv[])
 {
 	BOOL large = (argc > 1);
 	UINT32 x;
 	int rc = -1;
+	const prim_size_t tierSizes[] = { { 64, 16 }, { 96, 33 }, { 1928, 16 }, { 1920, 32 } };
 	prim_test_setup(FALSE);
 	primitives_t* prims = primitives_get();
 
+	for (x = 0; x < sizeof(tierSizes) / sizeof(tierSizes[0]); x++)
+	{
+		if (!TestPrimitiveYUVTiers(tierSizes[x]))
+			goto end;
+	}
+
 	for (x = 0; x < 10; x++)
 	{
 		prim_size_t roi;
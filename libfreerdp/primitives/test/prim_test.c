@@ -17,6 +17,7 @@
 #endif
 
 #include "prim_test.h"
+#include "../prim_internal.h"
 
 #ifndef _WIN32
 #include <fcntl.h>
@@ -100,6 +101,43 @@ void prim_test_setup(BOOL performance)
 	g_TestPrimitivesPerformance = performance;
 }
 
+primitives_t* prim_test_get_tier(UINT32 tier)
+{
+	static primitives_t tiers[PRIM_TEST_TIERS] = { 0 };
+	static BOOL initialized[PRIM_TEST_TIERS] = { 0 };
+
+	if (tier >= PRIM_TEST_TIERS)
+		return NULL;
+
+	if (!initialized[tier])
+	{
+		if (!primitives_init_cpu(&tiers[tier], (primitives_cpu_tier)tier))
+			return NULL;
+
+		initialized[tier] = TRUE;
+	}
+
+	return &tiers[tier];
+}
+
+const char* prim_test_tier_name(UINT32 tier)
+{
+	switch (tier)
+	{
+		case PRIMITIVES_CPU_SIMD:
+			return "SIMD";
+
+		case PRIMITIVES_CPU_AVX2:
+			return "AVX2";
+
+		case PRIMITIVES_CPU_AVX512:
+			return "AVX512";
+
+		default:
+			return "unknown";
+	}
+}
+
 BOOL speed_test(const char* name, const char* dsc, UINT32 iterations, pstatus_t (*generic)(),
                 pstatus_t (*optimised)(), ...)
 {
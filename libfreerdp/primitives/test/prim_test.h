@@ -51,6 +51,12 @@ extern primitives_t* optimized;
 
 void prim_test_setup(BOOL performance);
 
+/* The CPU primitives restricted to one instruction set tier, tiers the CPU
+ * does not support are identical to the previous one. */
+#define PRIM_TEST_TIERS 3
+primitives_t* prim_test_get_tier(UINT32 tier);
+const char* prim_test_tier_name(UINT32 tier);
+
 typedef pstatus_t (*speed_test_fkt)();
 
 BOOL speed_test(const char* name, const char* dsc, UINT32 iterations, speed_test_fkt generic,
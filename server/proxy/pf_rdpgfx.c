@@ -448,7 +448,7 @@ static UINT pf_rdpgfx_cache_import_offer(RdpgfxServerContext* context,
 
 	if (pdata->config->SessionCapture)
 	{
-		/* do not proxy CacheImportOffer, as is it currently not supported by FREERDP. */
+		/* do not proxy CacheImportOffer, the capture decoder cannot import the offered entries */
 		return CHANNEL_RC_OK;
 	}
 
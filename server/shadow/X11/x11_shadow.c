@@ -759,14 +759,14 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 {
 	int count;
 	int status;
-	int x, y;
-	int width, height;
+	UINT32 index;
+	UINT32 numRects;
 	XImage* image;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
+	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
+	const RECTANGLE_16* rects;
 	server = subsystem->common.server;
 	surface = server->surface;
 	count = ArrayList_Count(server->clients);
@@ -778,6 +778,7 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	surfaceRect.top = 0;
 	surfaceRect.right = surface->width;
 	surfaceRect.bottom = surface->height;
+	region16_init(&invalidRegion);
 	XLockDisplay(subsystem->display);
 	/*
 	 * Ignore BadMatch error during image capture. The screen size may be
@@ -790,9 +791,10 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 		image = subsystem->fb_image;
 		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
 		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
-		status = shadow_capture_compare(surface->data, surface->scanline, surface->width,
-		                                surface->height, (BYTE*)&(image->data[surface->width * 4]),
-		                                image->bytes_per_line, &invalidRect);
+		status = shadow_capture_compare_region(surface->data, surface->scanline, surface->width,
+		                                       surface->height,
+		                                       (BYTE*)&(image->data[surface->width * 4]),
+		                                       image->bytes_per_line, &invalidRegion);
 	}
 	else
 	{
@@ -808,9 +810,9 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 			goto fail_capture;
 		}
 
-		status = shadow_capture_compare(surface->data, surface->scanline, surface->width,
-		                                surface->height, (BYTE*)image->data, image->bytes_per_line,
-		                                &invalidRect);
+		status = shadow_capture_compare_region(surface->data, surface->scanline, surface->width,
+		                                       surface->height, (BYTE*)image->data,
+		                                       image->bytes_per_line, &invalidRegion);
 	}
 
 	/* Restore the default error handler */
@@ -818,23 +820,36 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
 
-	if (status)
+	if (status > 0)
 	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
+		EnterCriticalSection(&(surface->lock));
+		rects = region16_rects(&invalidRegion, &numRects);
+
+		for (index = 0; index < numRects; index++)
+			region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+			                    &rects[index]);
+
 		region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion), &surfaceRect);
 
 		if (!region16_is_empty(&(surface->invalidRegion)))
 		{
-			extents = region16_extents(&(surface->invalidRegion));
-			x = extents->left;
-			y = extents->top;
-			width = extents->right - extents->left;
-			height = extents->bottom - extents->top;
+			/* Only the dirty tiles are copied, not their bounding box */
+			rects = region16_rects(&(surface->invalidRegion), &numRects);
 
-			if (!freerdp_image_copy(surface->data, surface->format, surface->scanline, x, y, width,
-			                        height, (BYTE*)image->data, PIXEL_FORMAT_BGRX32,
-			                        image->bytes_per_line, x, y, NULL, FREERDP_FLIP_NONE))
-				goto fail_capture;
+			for (index = 0; index < numRects; index++)
+			{
+				const RECTANGLE_16* rect = &rects[index];
+
+				if (!freerdp_image_copy(surface->data, surface->format, surface->scanline,
+				                        rect->left, rect->top, rect->right - rect->left,
+				                        rect->bottom - rect->top, (BYTE*)image->data,
+				                        PIXEL_FORMAT_BGRX32, image->bytes_per_line, rect->left,
+				                        rect->top, NULL, FREERDP_FLIP_NONE))
+				{
+					LeaveCriticalSection(&(surface->lock));
+					goto fail_capture;
+				}
+			}
 
 			// x11_shadow_blend_cursor(subsystem);
 			count = ArrayList_Count(server->clients);
@@ -852,13 +867,17 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 
 			region16_clear(&(surface->invalidRegion));
 		}
+
+		LeaveCriticalSection(&(surface->lock));
 	}
 
 	if (!subsystem->use_xshm)
 		XDestroyImage(image);
 
+	region16_uninit(&invalidRegion);
 	return 1;
 fail_capture:
+	region16_uninit(&invalidRegion);
 
 	if (!subsystem->use_xshm && image)
 		XDestroyImage(image);
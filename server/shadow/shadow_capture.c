@@ -21,16 +21,28 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
 #include <winpr/print.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
 
 #include "shadow_surface.h"
 
 #include "shadow_capture.h"
+#include "shadow_capture_sse2.h"
+#include "shadow_capture_neon.h"
 
 #define TAG SERVER_TAG("shadow")
 
+#ifndef SHADOW_CAPTURE_INIT_SIMD
+#define SHADOW_CAPTURE_INIT_SIMD(_tileEqual) \
+	do                                       \
+	{                                        \
+	} while (0)
+#endif
+
 int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 {
 	int dx, dy;
@@ -79,143 +91,333 @@ int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 	return 1;
 }
 
-int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
-                           UINT32 nStep2, RECTANGLE_16* rect)
+static BOOL shadow_capture_tile_equal(const BYTE* pData1, UINT32 nStep1, const BYTE* pData2,
+                                      UINT32 nStep2, UINT32 nWidth, UINT32 nHeight)
 {
-	BOOL equal;
-	BOOL allEqual;
-	UINT32 tw, th;
-	UINT32 tx, ty, k;
-	UINT32 nrow, ncol;
-	UINT32 l, t, r, b;
-	BYTE *p1, *p2;
-	BOOL rows[1024];
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	BOOL cols[1024];
-#endif
-	allEqual = TRUE;
-	ZeroMemory(rect, sizeof(RECTANGLE_16));
-	FillMemory(rows, sizeof(rows), 0xFF);
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	FillMemory(cols, sizeof(cols), 0xFF);
-#endif
-	nrow = (nHeight + 15) / 16;
-	ncol = (nWidth + 15) / 16;
-	l = ncol + 1;
-	r = 0;
-	t = nrow + 1;
-	b = 0;
+	UINT32 y;
 
-	for (ty = 0; ty < nrow; ty++)
+	for (y = 0; y < nHeight; y++)
 	{
-		th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
+		if (memcmp(pData1, pData2, nWidth * 4) != 0)
+			return FALSE;
 
-		if (!th)
-			th = 16;
+		pData1 += nStep1;
+		pData2 += nStep2;
+	}
 
-		for (tx = 0; tx < ncol; tx++)
-		{
-			equal = TRUE;
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
+	return TRUE;
+}
+
+static pfnShadowCaptureTileEqual shadow_capture_tile_equal_fn = shadow_capture_tile_equal;
+
+static INIT_ONCE shadow_capture_InitOnce = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK shadow_capture_init_cb(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+	SHADOW_CAPTURE_INIT_SIMD(&shadow_capture_tile_equal_fn);
+	return TRUE;
+}
 
-			if (!tw)
-				tw = 16;
+/* Tile rows compared by one thread pool work item at least */
+#define SHADOW_CAPTURE_BAND_ROWS 16
 
-			p1 = &pData1[(ty * 16 * nStep1) + (tx * 16 * 4)];
-			p2 = &pData2[(ty * 16 * nStep2) + (tx * 16 * 4)];
+typedef struct
+{
+	const BYTE* pData1;
+	UINT32 nStep1;
+	const BYTE* pData2;
+	UINT32 nStep2;
+	UINT32 nWidth;
+	UINT32 nHeight;
+	UINT32 ncol;
+	UINT32 firstRow;
+	UINT32 lastRow;
+	BYTE* dirty;
+	BOOL changed;
+} SHADOW_CAPTURE_BAND;
+
+static void shadow_capture_compare_band(SHADOW_CAPTURE_BAND* band)
+{
+	UINT32 tx, ty;
+	UINT32 tw, th;
+	const pfnShadowCaptureTileEqual tileEqual = shadow_capture_tile_equal_fn;
+
+	for (ty = band->firstRow; ty < band->lastRow; ty++)
+	{
+		th = MIN(16, band->nHeight - (ty * 16));
+
+		for (tx = 0; tx < band->ncol; tx++)
+		{
+			const BYTE* p1 = &band->pData1[(ty * 16ULL * band->nStep1) + (tx * 16ULL * 4)];
+			const BYTE* p2 = &band->pData2[(ty * 16ULL * band->nStep2) + (tx * 16ULL * 4)];
+			tw = MIN(16, band->nWidth - (tx * 16));
 
-			for (k = 0; k < th; k++)
+			if (!tileEqual(p1, band->nStep1, p2, band->nStep2, tw, th))
 			{
-				if (memcmp(p1, p2, tw * 4) != 0)
-				{
-					equal = FALSE;
-					break;
-				}
-
-				p1 += nStep1;
-				p2 += nStep2;
+				band->dirty[(ty * band->ncol) + tx] = 1;
+				band->changed = TRUE;
 			}
+		}
+	}
+}
+
+static void CALLBACK shadow_capture_compare_work_callback(PTP_CALLBACK_INSTANCE instance,
+                                                          void* context, PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	shadow_capture_compare_band((SHADOW_CAPTURE_BAND*)context);
+}
+
+static UINT32 shadow_capture_band_count(UINT32 nrow)
+{
+	SYSTEM_INFO sysinfo;
+	UINT32 count = nrow / SHADOW_CAPTURE_BAND_ROWS;
+	GetNativeSystemInfo(&sysinfo);
+
+	if (count > sysinfo.dwNumberOfProcessors)
+		count = sysinfo.dwNumberOfProcessors;
+
+	return (count > 0) ? count : 1;
+}
+
+static BOOL shadow_capture_close_rect(REGION16* region, const RECTANGLE_16* rect, UINT32 nWidth,
+                                      UINT32 nHeight)
+{
+	RECTANGLE_16 clipped = *rect;
+
+	if (clipped.right > nWidth)
+		clipped.right = nWidth;
+
+	if (clipped.bottom > nHeight)
+		clipped.bottom = nHeight;
 
-			if (!equal)
+	return region16_union_rect(region, region, &clipped);
+}
+
+/**
+ * Collects runs of dirty tiles into rectangles. Runs spanning the same
+ * columns on consecutive tile rows are merged so the region stays small.
+ */
+static BOOL shadow_capture_build_region(REGION16* region, const BYTE* dirty, UINT32 ncol,
+                                        UINT32 nrow, UINT32 nWidth, UINT32 nHeight)
+{
+	BOOL rc = FALSE;
+	UINT32 tx, ty;
+	UINT32 index;
+	UINT32 nopen = 0;
+	UINT32 nnext;
+	RECTANGLE_16* open = (RECTANGLE_16*)calloc(ncol, sizeof(RECTANGLE_16));
+	RECTANGLE_16* next = (RECTANGLE_16*)calloc(ncol, sizeof(RECTANGLE_16));
+
+	if (!open || !next)
+		goto fail;
+
+	for (ty = 0; ty < nrow; ty++)
+	{
+		const BYTE* row = &dirty[ty * ncol];
+		index = 0;
+		nnext = 0;
+
+		for (tx = 0; tx < ncol;)
+		{
+			RECTANGLE_16 run;
+
+			if (!row[tx])
 			{
-				rows[ty] = FALSE;
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-				cols[tx] = FALSE;
-#endif
+				tx++;
+				continue;
+			}
+
+			run.left = tx * 16;
+			run.top = ty * 16;
+
+			while ((tx < ncol) && row[tx])
+				tx++;
+
+			run.right = tx * 16;
+			run.bottom = (ty + 1) * 16;
 
-				if (l > tx)
-					l = tx;
+			/* Open rectangles are sorted by column like the runs */
+			while ((index < nopen) && (open[index].left < run.left))
+			{
+				if (!shadow_capture_close_rect(region, &open[index++], nWidth, nHeight))
+					goto fail;
+			}
 
-				if (r < tx)
-					r = tx;
+			if ((index < nopen) && (open[index].left == run.left) &&
+			    (open[index].right == run.right))
+			{
+				run.top = open[index++].top;
 			}
+
+			next[nnext++] = run;
 		}
 
-		if (!rows[ty])
+		while (index < nopen)
 		{
-			allEqual = FALSE;
-
-			if (t > ty)
-				t = ty;
+			if (!shadow_capture_close_rect(region, &open[index++], nWidth, nHeight))
+				goto fail;
+		}
 
-			if (b < ty)
-				b = ty;
+		{
+			RECTANGLE_16* tmp = open;
+			open = next;
+			next = tmp;
+			nopen = nnext;
 		}
 	}
 
-	if (allEqual)
-		return 0;
+	for (index = 0; index < nopen; index++)
+	{
+		if (!shadow_capture_close_rect(region, &open[index], nWidth, nHeight))
+			goto fail;
+	}
 
-	rect->left = l * 16;
-	rect->top = t * 16;
-	rect->right = (r + 1) * 16;
-	rect->bottom = (b + 1) * 16;
+	rc = TRUE;
+fail:
+	free(open);
+	free(next);
+	return rc;
+}
 
-	if (rect->right > nWidth)
-		rect->right = nWidth;
+/**
+ * Compares two 32bpp frames in 16x16 tiles and stores the changed tiles in
+ * region, clipped to nWidth x nHeight. Large frames are split in bands of
+ * tile rows compared on the default thread pool.
+ *
+ * @return 1 if the frames differ, 0 if they are equal, -1 on failure
+ */
+int shadow_capture_compare_region(const BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
+                                  const BYTE* pData2, UINT32 nStep2, REGION16* region)
+{
+	int status = -1;
+	UINT32 index;
+	UINT32 nrow, ncol;
+	UINT32 count;
+	BOOL changed = FALSE;
+	BYTE* dirty = NULL;
+	PTP_WORK* work = NULL;
+	SHADOW_CAPTURE_BAND* bands = NULL;
 
-	if (rect->bottom > nHeight)
-		rect->bottom = nHeight;
+	if (!pData1 || !pData2 || !region)
+		return -1;
 
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	size_t size = ncol + 1;
-	char* col_str = calloc(size, sizeof(char));
+	region16_clear(region);
+	InitOnceExecuteOnce(&shadow_capture_InitOnce, shadow_capture_init_cb, NULL, NULL);
+	nrow = (nHeight + 15) / 16;
+	ncol = (nWidth + 15) / 16;
+
+	if ((nrow == 0) || (ncol == 0))
+		return 0;
+
+	count = shadow_capture_band_count(nrow);
+	dirty = (BYTE*)calloc(nrow, ncol);
+	bands = (SHADOW_CAPTURE_BAND*)calloc(count, sizeof(SHADOW_CAPTURE_BAND));
+	work = (PTP_WORK*)calloc(count, sizeof(PTP_WORK));
 
-	if (!col_str)
+	if (!dirty || !bands || !work)
+		goto fail;
+
+	for (index = 0; index < count; index++)
 	{
-		WLog_ERR(TAG, "calloc failed!");
-		return 1;
+		SHADOW_CAPTURE_BAND* band = &bands[index];
+		band->pData1 = pData1;
+		band->nStep1 = nStep1;
+		band->pData2 = pData2;
+		band->nStep2 = nStep2;
+		band->nWidth = nWidth;
+		band->nHeight = nHeight;
+		band->ncol = ncol;
+		band->firstRow = (nrow * index) / count;
+		band->lastRow = (nrow * (index + 1)) / count;
+		band->dirty = dirty;
 	}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	/* The first band runs on the calling thread */
+	for (index = 1; index < count; index++)
+	{
+		if (!(work[index] = CreateThreadpoolWork(shadow_capture_compare_work_callback,
+		                                         (void*)&bands[index], NULL)))
+		{
+			WLog_ERR(TAG, "CreateThreadpoolWork failed.");
+			shadow_capture_compare_band(&bands[index]);
+			continue;
+		}
 
-	WLog_INFO(TAG, "%s", col_str);
+		SubmitThreadpoolWork(work[index]);
+	}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+	shadow_capture_compare_band(&bands[0]);
 
-	WLog_INFO(TAG, "%s", col_str);
+	for (index = 0; index < count; index++)
+	{
+		if (work[index])
+		{
+			WaitForThreadpoolWorkCallbacks(work[index], FALSE);
+			CloseThreadpoolWork(work[index]);
+		}
+
+		changed |= bands[index].changed;
+	}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	if (!changed)
+	{
+		status = 0;
+		goto fail;
+	}
 
-	WLog_INFO(TAG, "%s", col_str);
+	if (!shadow_capture_build_region(region, dirty, ncol, nrow, nWidth, nHeight))
+		goto fail;
 
-	for (ty = 0; ty < nrow; ty++)
+#ifdef WITH_DEBUG_SHADOW_CAPTURE
 	{
-		for (tx = 0; tx < ncol; tx++)
-			sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+		UINT32 tx, ty;
+		char* row_str = calloc(ncol + 1, sizeof(char));
 
-		WLog_INFO(TAG, "%s", col_str);
-		WLog_INFO(TAG, "|%s|", rows[ty] ? "O" : "X");
-	}
+		if (row_str)
+		{
+			for (ty = 0; ty < nrow; ty++)
+			{
+				for (tx = 0; tx < ncol; tx++)
+					row_str[tx] = dirty[(ty * ncol) + tx] ? 'X' : 'O';
 
-	WLog_INFO(TAG, "left: %d top: %d right: %d bottom: %d ncol: %d nrow: %d", l, t, r, b, ncol,
-	          nrow);
-	free(col_str);
+				WLog_INFO(TAG, "|%s|", row_str);
+			}
+
+			free(row_str);
+		}
+
+		WLog_INFO(TAG, "%d rects ncol: %" PRIu32 " nrow: %" PRIu32 "",
+		          region16_n_rects(region), ncol, nrow);
+	}
 #endif
-	return 1;
+	status = 1;
+fail:
+	free(work);
+	free(bands);
+	free(dirty);
+	return status;
+}
+
+int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
+                           UINT32 nStep2, RECTANGLE_16* rect)
+{
+	int status;
+	REGION16 region;
+	ZeroMemory(rect, sizeof(RECTANGLE_16));
+	region16_init(&region);
+	status = shadow_capture_compare_region(pData1, nStep1, nWidth, nHeight, pData2, nStep2,
+	                                       &region);
+
+	if (status > 0)
+		*rect = *region16_extents(&region);
+
+	region16_uninit(&region);
+	return (status > 0) ? 1 : 0;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
@@ -24,6 +24,9 @@
 #include <winpr/crt.h>
 #include <winpr/synch.h>
 
+typedef BOOL (*pfnShadowCaptureTileEqual)(const BYTE* pData1, UINT32 nStep1, const BYTE* pData2,
+                                          UINT32 nStep2, UINT32 nWidth, UINT32 nHeight);
+
 struct rdp_shadow_capture
 {
 	rdpShadowServer* server;
@@ -0,0 +1,80 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server Tile Comparison - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "shadow_capture_neon.h"
+
+static BOOL shadow_capture_tile_equal_neon(const BYTE* pData1, UINT32 nStep1, const BYTE* pData2,
+                                           UINT32 nStep2, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 y;
+	const size_t length = nWidth * 4ULL;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		size_t x = 0;
+		uint64x1_t any;
+		uint8x16_t diff = vdupq_n_u8(0);
+
+		for (; x + 64 <= length; x += 64)
+		{
+			const uint8x16_t d0 = veorq_u8(vld1q_u8(&pData1[x]), vld1q_u8(&pData2[x]));
+			const uint8x16_t d1 = veorq_u8(vld1q_u8(&pData1[x + 16]), vld1q_u8(&pData2[x + 16]));
+			const uint8x16_t d2 = veorq_u8(vld1q_u8(&pData1[x + 32]), vld1q_u8(&pData2[x + 32]));
+			const uint8x16_t d3 = veorq_u8(vld1q_u8(&pData1[x + 48]), vld1q_u8(&pData2[x + 48]));
+			diff = vorrq_u8(diff, vorrq_u8(vorrq_u8(d0, d1), vorrq_u8(d2, d3)));
+		}
+
+		for (; x + 16 <= length; x += 16)
+			diff = vorrq_u8(diff, veorq_u8(vld1q_u8(&pData1[x]), vld1q_u8(&pData2[x])));
+
+		if ((x < length) && (memcmp(&pData1[x], &pData2[x], length - x) != 0))
+			return FALSE;
+
+		/* Stop reading a tile as soon as it is known to be dirty */
+		any = vorr_u64(vget_low_u64(vreinterpretq_u64_u8(diff)),
+		               vget_high_u64(vreinterpretq_u64_u8(diff)));
+
+		if (vget_lane_u64(any, 0) != 0)
+			return FALSE;
+
+		pData1 += nStep1;
+		pData2 += nStep2;
+	}
+
+	return TRUE;
+}
+
+void shadow_capture_init_neon(pfnShadowCaptureTileEqual* tileEqual)
+{
+	if (!tileEqual)
+		return;
+
+	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+		*tileEqual = shadow_capture_tile_equal_neon;
+}
+
+#endif /* __ARM_NEON__ */
@@ -0,0 +1,33 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server Tile Comparison - NEON Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_CAPTURE_NEON_H
+#define FREERDP_SERVER_SHADOW_CAPTURE_NEON_H
+
+#include <freerdp/api.h>
+
+#include "shadow_capture.h"
+
+FREERDP_LOCAL void shadow_capture_init_neon(pfnShadowCaptureTileEqual* tileEqual);
+
+#ifdef WITH_NEON
+#ifndef SHADOW_CAPTURE_INIT_SIMD
+#define SHADOW_CAPTURE_INIT_SIMD(_tileEqual) shadow_capture_init_neon(_tileEqual)
+#endif
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_CAPTURE_NEON_H */
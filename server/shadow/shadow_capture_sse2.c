@@ -0,0 +1,82 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Shadow Server Tile Comparison - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include <emmintrin.h>
+
+#include "shadow_capture_sse2.h"
+
+static BOOL shadow_capture_tile_equal_sse2(const BYTE* pData1, UINT32 nStep1, const BYTE* pData2,
+                                           UINT32 nStep2, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 y;
+	const size_t length = nWidth * 4ULL;
+	__m128i diff = _mm_setzero_si128();
+
+	for (y = 0; y < nHeight; y++)
+	{
+		size_t x = 0;
+
+		for (; x + 64 <= length; x += 64)
+		{
+			const __m128i a0 = _mm_loadu_si128((const __m128i*)&pData1[x]);
+			const __m128i a1 = _mm_loadu_si128((const __m128i*)&pData1[x + 16]);
+			const __m128i a2 = _mm_loadu_si128((const __m128i*)&pData1[x + 32]);
+			const __m128i a3 = _mm_loadu_si128((const __m128i*)&pData1[x + 48]);
+			const __m128i b0 = _mm_loadu_si128((const __m128i*)&pData2[x]);
+			const __m128i b1 = _mm_loadu_si128((const __m128i*)&pData2[x + 16]);
+			const __m128i b2 = _mm_loadu_si128((const __m128i*)&pData2[x + 32]);
+			const __m128i b3 = _mm_loadu_si128((const __m128i*)&pData2[x + 48]);
+			diff = _mm_or_si128(diff, _mm_or_si128(_mm_xor_si128(a0, b0), _mm_xor_si128(a1, b1)));
+			diff = _mm_or_si128(diff, _mm_or_si128(_mm_xor_si128(a2, b2), _mm_xor_si128(a3, b3)));
+		}
+
+		for (; x + 16 <= length; x += 16)
+		{
+			const __m128i a = _mm_loadu_si128((const __m128i*)&pData1[x]);
+			const __m128i b = _mm_loadu_si128((const __m128i*)&pData2[x]);
+			diff = _mm_or_si128(diff, _mm_xor_si128(a, b));
+		}
+
+		if ((x < length) && (memcmp(&pData1[x], &pData2[x], length - x) != 0))
+			return FALSE;
+
+		/* Stop reading a tile as soon as it is known to be dirty */
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+			return FALSE;
+
+		pData1 += nStep1;
+		pData2 += nStep2;
+	}
+
+	return TRUE;
+}
+
+void shadow_capture_init_sse2(pfnShadowCaptureTileEqual* tileEqual)
+{
+	if (!tileEqual)
+		return;
+
+	if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		*tileEqual = shadow_capture_tile_equal_sse2;
+}
@@ -40,6 +40,7 @@ struct _SHADOW_GFX_STATUS
 {
 	BOOL gfxOpened;
 	BOOL gfxSurfaceCreated;
+	BOOL gfxRefinePending;
 };
 typedef struct _SHADOW_GFX_STATUS SHADOW_GFX_STATUS;
 
@@ -771,6 +772,8 @@ static UINT shadow_client_rdpgfx_caps_advertise(RdpgfxServerContext* context,
 					flags = pdu.capsSet->flags;
 					settings->GfxThinClient = (flags & RDPGFX_CAPS_FLAG_THINCLIENT);
 					settings->GfxSmallCache = (flags & RDPGFX_CAPS_FLAG_SMALL_CACHE);
+					/* RFX_PROGRESSIVE requires RDPGFX_CAPVERSION_81 or later */
+					settings->GfxProgressive = FALSE;
 				}
 
 				return context->CapsConfirm(context, &pdu);
@@ -928,6 +931,88 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	return TRUE;
 }
 
+/**
+ * Function description
+ * Send the tiles of invalidRegion as a first progressive pass and upgrade
+ * previously sent tiles. A NULL invalidRegion starts a new progressive stream
+ * covering the whole surface, an empty one only refines.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_progressive(rdpShadowClient* client, const BYTE* pSrcData,
+                                                   int nSrcStep, int nWidth, int nHeight,
+                                                   const REGION16* invalidRegion,
+                                                   SHADOW_GFX_STATUS* pStatus)
+{
+	int status;
+	UINT error = CHANNEL_RC_OK;
+	rdpShadowEncoder* encoder;
+	RDPGFX_SURFACE_COMMAND cmd;
+	RDPGFX_START_FRAME_PDU cmdstart;
+	RDPGFX_END_FRAME_PDU cmdend;
+	SYSTEMTIME sTime;
+
+	if (!pSrcData || !pStatus)
+		return FALSE;
+
+	encoder = client->encoder;
+
+	if (!encoder)
+		return FALSE;
+
+	if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
+	{
+		WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PROGRESSIVE");
+		return FALSE;
+	}
+
+	if (!invalidRegion)
+		progressive_delete_surface_context(encoder->progressive, 0);
+
+	ZeroMemory(&cmd, sizeof(cmd));
+	status = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight,
+	                              PIXEL_FORMAT_BGRX32, nWidth, nHeight, nSrcStep, invalidRegion, 0,
+	                              &cmd.data, &cmd.length);
+
+	if (status < 0)
+	{
+		WLog_ERR(TAG, "progressive_compress failed");
+		return FALSE;
+	}
+
+	/* tiles sent at reduced quality are upgraded while the screen is idle */
+	pStatus->gfxRefinePending = (status > 0);
+
+	if (status == 0)
+		return TRUE;
+
+	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+	GetSystemTime(&sTime);
+	cmdstart.timestamp =
+	    sTime.wHour << 22 | sTime.wMinute << 16 | sTime.wSecond << 10 | sTime.wMilliseconds;
+	cmdend.frameId = cmdstart.frameId;
+	cmd.surfaceId = 0;
+	cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
+	cmd.contextId = 0;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = 0;
+	cmd.top = 0;
+	cmd.right = nWidth;
+	cmd.bottom = nHeight;
+	cmd.width = nWidth;
+	cmd.height = nHeight;
+	IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
+	          &cmdend);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * Function description
  *
@@ -967,6 +1052,7 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		RFX_RECT rect;
 		RFX_MESSAGE* messages;
 		RFX_RECT* messageRects = NULL;
+		rdpShadowEncodedUpdate* shared = NULL;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
@@ -980,9 +1066,44 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		rect.width = nWidth;
 		rect.height = nHeight;
 
-		if (!(messages = rfx_encode_messages(
-		          encoder->rfx, &rect, 1, pSrcData, settings->DesktopWidth, settings->DesktopHeight,
-		          nSrcStep, &numMessages, settings->MultifragMaxRequestSize)))
+		if (shadow_encoder_use_cache(encoder))
+		{
+			BOOL created;
+			SHADOW_ENCODE_KEY key = { 0 };
+			key.pSrcData = pSrcData;
+			key.codec = FREERDP_CODEC_REMOTEFX;
+			key.nXSrc = nXSrc;
+			key.nYSrc = nYSrc;
+			key.nWidth = nWidth;
+			key.nHeight = nHeight;
+			key.params[0] = settings->DesktopWidth;
+			key.params[1] = settings->DesktopHeight;
+			key.params[2] = settings->MultifragMaxRequestSize;
+			shared = shadow_encode_cache_acquire(encoder->server->encodeCache, &key, &created);
+
+			if (shared)
+			{
+				if (created)
+					shadow_encode_cache_encode_rfx(shared, &rect, pSrcData, settings->DesktopWidth,
+					                               settings->DesktopHeight, nSrcStep,
+					                               settings->MultifragMaxRequestSize);
+
+				shadow_encode_cache_release(shared);
+
+				if (!shared->encoded)
+					shared = NULL;
+			}
+		}
+
+		if (shared)
+		{
+			messages = shared->messages;
+			numMessages = shared->numMessages;
+		}
+		else if (!(messages = rfx_encode_messages(
+		               encoder->rfx, &rect, 1, pSrcData, settings->DesktopWidth,
+		               settings->DesktopHeight, nSrcStep, &numMessages,
+		               settings->MultifragMaxRequestSize)))
 		{
 			WLog_ERR(TAG, "rfx_encode_messages failed");
 			return FALSE;
@@ -999,16 +1120,26 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		cmd.bmp.height = settings->DesktopHeight;
 		cmd.skipCompression = TRUE;
 
-		if (numMessages > 0)
+		if (!shared && (numMessages > 0))
 			messageRects = messages[0].rects;
 
 		for (i = 0; i < numMessages; i++)
 		{
+			RFX_MESSAGE* message = &messages[i];
+			RFX_MESSAGE sharedMessage;
 			Stream_SetPosition(s, 0);
 
-			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+			if (shared)
 			{
-				while (i < numMessages)
+				/* Shared messages are read only, frame indices are per connection */
+				sharedMessage = messages[i];
+				sharedMessage.frameIdx = encoder->rfx->frameIdx++;
+				message = &sharedMessage;
+			}
+
+			if (!rfx_write_message(encoder->rfx, s, message))
+			{
+				while (!shared && (i < numMessages))
 				{
 					rfx_message_free(encoder->rfx, &messages[i++]);
 				}
@@ -1018,7 +1149,8 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 				break;
 			}
 
-			rfx_message_free(encoder->rfx, &messages[i]);
+			if (!shared)
+				rfx_message_free(encoder->rfx, &messages[i]);
 			cmd.bmp.bitmapDataLength = Stream_GetPosition(s);
 			cmd.bmp.bitmapData = Stream_Buffer(s);
 			first = (i == 0) ? TRUE : FALSE;
@@ -1037,21 +1169,67 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 			}
 		}
 
-		free(messageRects);
-		free(messages);
+		if (!shared)
+		{
+			free(messageRects);
+			free(messages);
+		}
 	}
 	else if (settings->NSCodec)
 	{
+		rdpShadowEncodedUpdate* shared = NULL;
+
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_NSCODEC) < 0)
 		{
 			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_NSCODEC");
 			return FALSE;
 		}
 
-		s = encoder->bs;
-		Stream_SetPosition(s, 0);
-		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
+		if (shadow_encoder_use_cache(encoder))
+		{
+			BOOL created;
+			SHADOW_ENCODE_KEY key = { 0 };
+			key.pSrcData = pSrcData;
+			key.codec = FREERDP_CODEC_NSCODEC;
+			key.nXSrc = nXSrc;
+			key.nYSrc = nYSrc;
+			key.nWidth = nWidth;
+			key.nHeight = nHeight;
+			key.params[0] = settings->NSCodecColorLossLevel;
+			key.params[1] = settings->NSCodecAllowSubsampling;
+			key.params[2] = settings->NSCodecAllowDynamicColorFidelity;
+			shared = shadow_encode_cache_acquire(encoder->server->encodeCache, &key, &created);
+
+			if (shared)
+			{
+				if (created &&
+				    (shared->data = Stream_New(NULL, Stream_Capacity(encoder->bs))))
+				{
+					nsc_compose_message(encoder->nsc, shared->data,
+					                    &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)], nWidth,
+					                    nHeight, nSrcStep);
+					shared->encoded = TRUE;
+				}
+
+				shadow_encode_cache_release(shared);
+
+				if (!shared->encoded)
+					shared = NULL;
+			}
+		}
+
+		if (shared)
+		{
+			s = shared->data;
+		}
+		else
+		{
+			s = encoder->bs;
+			Stream_SetPosition(s, 0);
+			nsc_compose_message(encoder->nsc, s, &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)],
+			                    nWidth, nHeight, nSrcStep);
+		}
+
 		cmd.bmp.bpp = 32;
 		cmd.bmp.codecID = settings->NSCodecId;
 		cmd.destLeft = nXSrc;
@@ -1081,21 +1259,178 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 
 /**
  * Function description
+ * Store a tile uncompressed, bottom-up, with the scan lines padded to a multiple of 4 pixels.
  *
- * @return TRUE on success
+ * @return TRUE on success, FALSE if there is no uncompressed format for bpp
  */
-static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrcData, int nSrcStep,
-                                             int nXSrc, int nYSrc, int nWidth, int nHeight)
+static BOOL shadow_client_encode_bitmap_raw(BITMAP_DATA* bitmap, BYTE* buffer, const BYTE* data,
+                                            UINT32 SrcFormat, int nSrcStep, UINT32 bpp)
+{
+	UINT32 x, y;
+	UINT32 step;
+	UINT32 width;
+	UINT32 bytesPerPixel;
+	UINT32 DstFormat;
+
+	switch (bpp)
+	{
+		case 24:
+			DstFormat = PIXEL_FORMAT_BGR24;
+			break;
+
+		case 16:
+			DstFormat = PIXEL_FORMAT_RGB16;
+			break;
+
+		case 15:
+			DstFormat = PIXEL_FORMAT_RGB15;
+			break;
+
+		default:
+			return FALSE;
+	}
+
+	bytesPerPixel = GetBytesPerPixel(DstFormat);
+	width = (bitmap->width + 3) & ~3u;
+	step = width * bytesPerPixel;
+
+	if (!freerdp_image_copy(buffer, DstFormat, step, 0, 0, bitmap->width, bitmap->height, data,
+	                        SrcFormat, nSrcStep, 0, 0, NULL, FREERDP_FLIP_VERTICAL))
+		return FALSE;
+
+	for (y = 0; y < bitmap->height; y++)
+	{
+		BYTE* line = &buffer[y * step];
+
+		for (x = bitmap->width; x < width; x++)
+			memcpy(&line[x * bytesPerPixel], &line[(bitmap->width - 1) * bytesPerPixel],
+			       bytesPerPixel);
+	}
+
+	bitmap->width = width;
+	bitmap->compressed = FALSE;
+	bitmap->bitmapDataStream = buffer;
+	bitmap->bitmapLength = step * bitmap->height;
+	bitmap->bitsPerPixel = bpp;
+	bitmap->cbScanWidth = step;
+	bitmap->cbUncompressedSize = bitmap->bitmapLength;
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Compress the tiles covering the given rect with the planar or interleaved codec.
+ *
+ * @return TRUE on success, the number of tiles written to bitmapData is returned in pCount
+ */
+static BOOL shadow_client_encode_bitmaps(rdpShadowEncoder* encoder, rdpSettings* settings,
+                                         BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc,
+                                         int nWidth, int nHeight, int rows, int cols,
+                                         BITMAP_DATA* bitmapData, UINT32* pCount)
 {
-	BOOL ret = TRUE;
 	BYTE* data;
 	BYTE* buffer;
-	size_t k;
+	UINT32 k = 0;
 	int yIdx, xIdx;
-	int rows, cols;
 	UINT32 DstSize;
-	UINT32 SrcFormat;
 	BITMAP_DATA* bitmap;
+	const UINT32 SrcFormat = PIXEL_FORMAT_BGRX32;
+
+	for (yIdx = 0; yIdx < rows; yIdx++)
+	{
+		for (xIdx = 0; xIdx < cols; xIdx++)
+		{
+			bitmap = &bitmapData[k];
+			bitmap->width = 64;
+			bitmap->height = 64;
+			bitmap->destLeft = nXSrc + (xIdx * 64);
+			bitmap->destTop = nYSrc + (yIdx * 64);
+
+			if ((INT64)(bitmap->destLeft + bitmap->width) > (nXSrc + nWidth))
+				bitmap->width = (UINT32)(nXSrc + nWidth) - bitmap->destLeft;
+
+			if ((INT64)(bitmap->destTop + bitmap->height) > (nYSrc + nHeight))
+				bitmap->height = (UINT32)(nYSrc + nHeight) - bitmap->destTop;
+
+			bitmap->destRight = bitmap->destLeft + bitmap->width - 1;
+			bitmap->destBottom = bitmap->destTop + bitmap->height - 1;
+			bitmap->compressed = TRUE;
+
+			if ((bitmap->width < 4) || (bitmap->height < 4))
+				continue;
+
+			if (settings->ColorDepth < 32)
+			{
+				int bitsPerPixel = settings->ColorDepth;
+				int bytesPerPixel = (bitsPerPixel + 7) / 8;
+				DstSize = 64 * 64 * 4;
+				buffer = encoder->grid[k];
+
+				if (interleaved_compress(encoder->interleaved, buffer, &DstSize, bitmap->width,
+				                         bitmap->height, pSrcData, SrcFormat, nSrcStep,
+				                         bitmap->destLeft, bitmap->destTop, NULL, bitsPerPixel))
+				{
+					/* The encoded scan lines are padded to a multiple of 4 pixels */
+					bitmap->width = (bitmap->width + 3) & ~3u;
+					bitmap->bitmapDataStream = buffer;
+					bitmap->bitmapLength = DstSize;
+					bitmap->bitsPerPixel = bitsPerPixel;
+					bitmap->cbScanWidth = bitmap->width * bytesPerPixel;
+					bitmap->cbUncompressedSize = bitmap->width * bitmap->height * bytesPerPixel;
+				}
+				else
+				{
+					WLog_WARN(TAG,
+					          "interleaved_compress failed for the tile at %" PRIu32 ",%" PRIu32
+					          ", sending it uncompressed",
+					          bitmap->destLeft, bitmap->destTop);
+					data = &pSrcData[(bitmap->destTop * nSrcStep) + (bitmap->destLeft * 4)];
+
+					if (!shadow_client_encode_bitmap_raw(bitmap, buffer, data, SrcFormat, nSrcStep,
+					                                     bitsPerPixel))
+					{
+						WLog_ERR(TAG, "No uncompressed fallback for %d bpp", bitsPerPixel);
+						return FALSE;
+					}
+				}
+			}
+			else
+			{
+				UINT32 dstSize;
+				buffer = encoder->grid[k];
+				data = &pSrcData[(bitmap->destTop * nSrcStep) + (bitmap->destLeft * 4)];
+				buffer =
+				    freerdp_bitmap_compress_planar(encoder->planar, data, SrcFormat, bitmap->width,
+				                                   bitmap->height, nSrcStep, buffer, &dstSize);
+				bitmap->bitmapDataStream = buffer;
+				bitmap->bitmapLength = dstSize;
+				bitmap->bitsPerPixel = 32;
+				bitmap->cbScanWidth = bitmap->width * 4;
+				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * 4;
+			}
+
+			bitmap->cbCompFirstRowSize = 0;
+			bitmap->cbCompMainBodySize = bitmap->bitmapLength;
+			k++;
+		}
+	}
+
+	*pCount = k;
+	return TRUE;
+}
+
+/**
+ * Function description
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrcData, int nSrcStep,
+                                             int nXSrc, int nYSrc, int nWidth, int nHeight)
+{
+	BOOL ret = TRUE;
+	UINT32 k;
+	UINT32 index;
+	int rows, cols;
 	rdpUpdate* update;
 	rdpContext* context = (rdpContext*)client;
 	rdpSettings* settings;
@@ -1105,6 +1440,8 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 	BITMAP_DATA* bitmapData;
 	BITMAP_UPDATE bitmapUpdate;
 	rdpShadowEncoder* encoder;
+	rdpShadowEncodedUpdate* shared = NULL;
+	BOOL created = FALSE;
 
 	if (!context || !pSrcData)
 		return FALSE;
@@ -1135,8 +1472,6 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 		}
 	}
 
-	SrcFormat = PIXEL_FORMAT_BGRX32;
-
 	if ((nXSrc % 4) != 0)
 	{
 		nWidth += (nXSrc % 4);
@@ -1151,7 +1486,6 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 
 	rows = (nHeight / 64) + ((nHeight % 64) ? 1 : 0);
 	cols = (nWidth / 64) + ((nWidth % 64) ? 1 : 0);
-	k = 0;
 	totalBitmapSize = 0;
 	bitmapUpdate.count = bitmapUpdate.number = rows * cols;
 
@@ -1170,66 +1504,58 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client, BYTE* pSrc
 		nHeight += (4 - (nHeight % 4));
 	}
 
-	for (yIdx = 0; yIdx < rows; yIdx++)
+	if (shadow_encoder_use_cache(encoder))
 	{
-		for (xIdx = 0; xIdx < cols; xIdx++)
-		{
-			bitmap = &bitmapData[k];
-			bitmap->width = 64;
-			bitmap->height = 64;
-			bitmap->destLeft = nXSrc + (xIdx * 64);
-			bitmap->destTop = nYSrc + (yIdx * 64);
+		SHADOW_ENCODE_KEY key = { 0 };
+		key.pSrcData = pSrcData;
+		key.codec =
+		    (settings->ColorDepth < 32) ? FREERDP_CODEC_INTERLEAVED : FREERDP_CODEC_PLANAR;
+		key.nXSrc = nXSrc;
+		key.nYSrc = nYSrc;
+		key.nWidth = nWidth;
+		key.nHeight = nHeight;
+		key.params[0] = settings->ColorDepth;
+		key.params[1] = settings->DrawAllowSkipAlpha;
+		shared = shadow_encode_cache_acquire(encoder->server->encodeCache, &key, &created);
 
-			if ((INT64)(bitmap->destLeft + bitmap->width) > (nXSrc + nWidth))
-				bitmap->width = (UINT32)(nXSrc + nWidth) - bitmap->destLeft;
+		if (shared && !created)
+		{
+			if (shared->encoded)
+				CopyMemory(bitmapData, shared->bitmaps, shared->numBitmaps * sizeof(BITMAP_DATA));
 
-			if ((INT64)(bitmap->destTop + bitmap->height) > (nYSrc + nHeight))
-				bitmap->height = (UINT32)(nYSrc + nHeight) - bitmap->destTop;
+			shadow_encode_cache_release(shared);
 
-			bitmap->destRight = bitmap->destLeft + bitmap->width - 1;
-			bitmap->destBottom = bitmap->destTop + bitmap->height - 1;
-			bitmap->compressed = TRUE;
+			if (!shared->encoded)
+				shared = NULL;
+		}
+	}
 
-			if ((bitmap->width < 4) || (bitmap->height < 4))
-				continue;
+	if (shared && !created)
+	{
+		k = shared->numBitmaps;
+	}
+	else
+	{
+		if (!shadow_client_encode_bitmaps(encoder, settings, pSrcData, nSrcStep, nXSrc, nYSrc,
+		                                  nWidth, nHeight, rows, cols, bitmapData, &k))
+		{
+			if (shared)
+				shadow_encode_cache_release(shared);
 
-			if (settings->ColorDepth < 32)
-			{
-				int bitsPerPixel = settings->ColorDepth;
-				int bytesPerPixel = (bitsPerPixel + 7) / 8;
-				DstSize = 64 * 64 * 4;
-				buffer = encoder->grid[k];
-				interleaved_compress(encoder->interleaved, buffer, &DstSize, bitmap->width,
-				                     bitmap->height, pSrcData, SrcFormat, nSrcStep,
-				                     bitmap->destLeft, bitmap->destTop, NULL, bitsPerPixel);
-				bitmap->bitmapDataStream = buffer;
-				bitmap->bitmapLength = DstSize;
-				bitmap->bitsPerPixel = bitsPerPixel;
-				bitmap->cbScanWidth = bitmap->width * bytesPerPixel;
-				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * bytesPerPixel;
-			}
-			else
-			{
-				UINT32 dstSize;
-				buffer = encoder->grid[k];
-				data = &pSrcData[(bitmap->destTop * nSrcStep) + (bitmap->destLeft * 4)];
-				buffer =
-				    freerdp_bitmap_compress_planar(encoder->planar, data, SrcFormat, bitmap->width,
-				                                   bitmap->height, nSrcStep, buffer, &dstSize);
-				bitmap->bitmapDataStream = buffer;
-				bitmap->bitmapLength = dstSize;
-				bitmap->bitsPerPixel = 32;
-				bitmap->cbScanWidth = bitmap->width * 4;
-				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * 4;
-			}
+			free(bitmapData);
+			return FALSE;
+		}
 
-			bitmap->cbCompFirstRowSize = 0;
-			bitmap->cbCompMainBodySize = bitmap->bitmapLength;
-			totalBitmapSize += bitmap->bitmapLength;
-			k++;
+		if (shared)
+		{
+			shadow_encode_cache_store_bitmaps(shared, bitmapData, k);
+			shadow_encode_cache_release(shared);
 		}
 	}
 
+	for (index = 0; index < k; index++)
+		totalBitmapSize += bitmapData[index].bitmapLength;
+
 	bitmapUpdate.count = bitmapUpdate.number = k;
 	updateSizeEstimate = totalBitmapSize + (k * bitmapUpdate.count) + 16;
 
@@ -1385,8 +1711,10 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	// WLog_INFO(TAG, "shadow_client_send_surface_update: x: %d y: %d width: %d height: %d right: %d
 	// bottom: %d", 	nXSrc, nYSrc, nWidth, nHeight, nXSrc + nWidth, nYSrc + nHeight);
 
-	if (settings->SupportGraphicsPipeline && settings->GfxH264 && pStatus->gfxOpened)
+	if (settings->SupportGraphicsPipeline && (settings->GfxH264 || settings->GfxProgressive) &&
+	    pStatus->gfxOpened)
 	{
+		BOOL surfaceCreated = FALSE;
 		/* GFX/h264 always full screen encoded */
 		nWidth = settings->DesktopWidth;
 		nHeight = settings->DesktopHeight;
@@ -1394,7 +1722,7 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 		/* Create primary surface if have not */
 		if (!pStatus->gfxSurfaceCreated)
 		{
-			/* Only init surface when we have h264 supported */
+			/* Only init surface when we have h264 or progressive supported */
 			if (!(ret = shadow_client_rdpgfx_reset_graphic(client)))
 				goto out;
 
@@ -1402,9 +1730,45 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 				goto out;
 
 			pStatus->gfxSurfaceCreated = TRUE;
+			surfaceCreated = TRUE;
+		}
+
+		if (settings->GfxH264)
+		{
+			ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
+			                                     nHeight);
 		}
+		else if (surfaceCreated)
+		{
+			ret = shadow_client_send_surface_progressive(client, pSrcData, nSrcStep, nWidth,
+			                                             nHeight, NULL, pStatus);
+		}
+		else
+		{
+			/* progressive tiles are addressed relative to the shared rect */
+			REGION16 gfxRegion;
+			region16_init(&gfxRegion);
+			rects = region16_rects(&invalidRegion, &numRects);
 
-		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth, nHeight);
+			for (index = 0; index < numRects; index++)
+			{
+				RECTANGLE_16 rect = rects[index];
+
+				if (server->shareSubRect)
+				{
+					rect.left -= server->subRect.left;
+					rect.top -= server->subRect.top;
+					rect.right -= server->subRect.left;
+					rect.bottom -= server->subRect.top;
+				}
+
+				region16_union_rect(&gfxRegion, &gfxRegion, &rect);
+			}
+
+			ret = shadow_client_send_surface_progressive(client, pSrcData, nSrcStep, nWidth,
+			                                             nHeight, &gfxRegion, pStatus);
+			region16_uninit(&gfxRegion);
+		}
 	}
 	else if (settings->RemoteFxCodec || settings->NSCodec)
 	{
@@ -1422,6 +1786,57 @@ out:
 	return ret;
 }
 
+/**
+ * Function description
+ * Send pending progressive upgrade passes while the screen is idle.
+ *
+ * @return TRUE on success (or nothing need to be refined)
+ */
+static BOOL shadow_client_send_surface_refine(rdpShadowClient* client, SHADOW_GFX_STATUS* pStatus)
+{
+	BOOL ret;
+	REGION16 emptyRegion;
+	rdpContext* context = (rdpContext*)client;
+	rdpSettings* settings;
+	rdpShadowServer* server;
+	rdpShadowSurface* surface;
+
+	if (!context || !pStatus)
+		return FALSE;
+
+	settings = context->settings;
+	server = client->server;
+
+	if (!settings || !server)
+		return FALSE;
+
+	surface = client->inLobby ? server->lobby : server->surface;
+
+	if (!surface || !client->activated || client->suppressOutput ||
+	    !pStatus->gfxSurfaceCreated || settings->GfxH264)
+	{
+		pStatus->gfxRefinePending = FALSE;
+		return TRUE;
+	}
+
+	/*
+	 * Subsystems hold the surface lock while they update the surface and
+	 * publish the frame. If it is taken, the normal frame path sends the
+	 * new content; refine again on the next idle timeout.
+	 */
+	if (!TryEnterCriticalSection(&(surface->lock)))
+		return TRUE;
+
+	/* upgrade passes only use the coefficients kept by the encoder */
+	region16_init(&emptyRegion);
+	ret = shadow_client_send_surface_progressive(client, surface->data, surface->scanline,
+	                                             settings->DesktopWidth, settings->DesktopHeight,
+	                                             &emptyRegion, pStatus);
+	region16_uninit(&emptyRegion);
+	LeaveCriticalSection(&(surface->lock));
+	return ret;
+}
+
 /**
  * Function description
  * Notify client for resize. The new desktop width/height
@@ -1458,6 +1873,7 @@ static BOOL shadow_client_send_resize(rdpShadowClient* client, SHADOW_GFX_STATUS
 			return FALSE;
 
 		pStatus->gfxSurfaceCreated = FALSE;
+		pStatus->gfxRefinePending = FALSE;
 	}
 
 	/* Send Resize */
@@ -1635,6 +2051,7 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 	SHADOW_GFX_STATUS gfxstatus;
 	gfxstatus.gfxOpened = FALSE;
 	gfxstatus.gfxSurfaceCreated = FALSE;
+	gfxstatus.gfxRefinePending = FALSE;
 	server = client->server;
 	subsystem = server->subsystem;
 	context = (rdpContext*)client;
@@ -1679,11 +2096,22 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 		}
 		events[nCount++] = ChannelEvent;
 		events[nCount++] = MessageQueue_Event(MsgQueue);
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		status = WaitForMultipleObjects(nCount, events, FALSE,
+		                                gfxstatus.gfxRefinePending ? 1000 / client->encoder->fps
+		                                                           : INFINITE);
 
 		if (status == WAIT_FAILED)
 			goto fail;
 
+		if (status == WAIT_TIMEOUT)
+		{
+			if (!shadow_client_send_surface_refine(client, &gfxstatus))
+			{
+				WLog_ERR(TAG, "Failed to send surface refinement");
+				break;
+			}
+		}
+
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
 			/* The UpdateEvent means to start sending current frame. It is
@@ -24,6 +24,10 @@
 
 #include "shadow_encoder.h"
 
+#include <freerdp/log.h>
+
+#define TAG SERVER_TAG("shadow")
+
 int shadow_encoder_preferred_fps(rdpShadowEncoder* encoder)
 {
 	/* Return preferred fps calculated according to the last
@@ -250,6 +254,25 @@ fail:
 	return -1;
 }
 
+static int shadow_encoder_init_progressive(rdpShadowEncoder* encoder)
+{
+	if (!encoder->progressive)
+		encoder->progressive = progressive_context_new(TRUE);
+
+	if (!encoder->progressive)
+		goto fail;
+
+	if (!progressive_context_reset(encoder->progressive))
+		goto fail;
+
+	encoder->codecs |= FREERDP_CODEC_PROGRESSIVE;
+	return 1;
+fail:
+	progressive_context_free(encoder->progressive);
+	encoder->progressive = NULL;
+	return -1;
+}
+
 static int shadow_encoder_init(rdpShadowEncoder* encoder)
 {
 	encoder->width = encoder->server->screen->width;
@@ -327,6 +350,18 @@ static int shadow_encoder_uninit_h264(rdpShadowEncoder* encoder)
 	return 1;
 }
 
+static int shadow_encoder_uninit_progressive(rdpShadowEncoder* encoder)
+{
+	if (encoder->progressive)
+	{
+		progressive_context_free(encoder->progressive);
+		encoder->progressive = NULL;
+	}
+
+	encoder->codecs &= ~FREERDP_CODEC_PROGRESSIVE;
+	return 1;
+}
+
 static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 {
 	shadow_encoder_uninit_grid(encoder);
@@ -362,6 +397,11 @@ static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 		shadow_encoder_uninit_h264(encoder);
 	}
 
+	if (encoder->codecs & FREERDP_CODEC_PROGRESSIVE)
+	{
+		shadow_encoder_uninit_progressive(encoder);
+	}
+
 	return 1;
 }
 
@@ -439,6 +479,14 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
+	if ((codecs & FREERDP_CODEC_PROGRESSIVE) && !(encoder->codecs & FREERDP_CODEC_PROGRESSIVE))
+	{
+		status = shadow_encoder_init_progressive(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
 	return 1;
 }
 
@@ -473,3 +521,283 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 	shadow_encoder_uninit(encoder);
 	free(encoder);
 }
+
+BOOL shadow_encoder_use_cache(rdpShadowEncoder* encoder)
+{
+	rdpShadowServer* server = encoder->server;
+
+	/* The lobby is drawn per client and a single viewer has nobody to share with */
+	if (!server->encodeCache || encoder->client->inLobby)
+		return FALSE;
+
+	return ArrayList_Count(server->clients) > 1;
+}
+
+static BOOL shadow_encode_key_equal(const SHADOW_ENCODE_KEY* a, const SHADOW_ENCODE_KEY* b)
+{
+	size_t index;
+
+	if ((a->pSrcData != b->pSrcData) || (a->codec != b->codec) || (a->nXSrc != b->nXSrc) ||
+	    (a->nYSrc != b->nYSrc) || (a->nWidth != b->nWidth) || (a->nHeight != b->nHeight))
+		return FALSE;
+
+	for (index = 0; index < ARRAYSIZE(a->params); index++)
+	{
+		if (a->params[index] != b->params[index])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void shadow_encoded_update_free(void* obj)
+{
+	int i;
+	rdpShadowEncodedUpdate* update = (rdpShadowEncodedUpdate*)obj;
+
+	if (!update)
+		return;
+
+	if (update->messages)
+	{
+		rdpShadowEncodeCache* cache = update->cache;
+		RFX_RECT* messageRects = (update->numMessages > 0) ? update->messages[0].rects : NULL;
+		EnterCriticalSection(&cache->rfxLock);
+
+		for (i = 0; i < update->numMessages; i++)
+			rfx_message_free(cache->rfx, &update->messages[i]);
+
+		LeaveCriticalSection(&cache->rfxLock);
+		free(messageRects);
+		free(update->messages);
+	}
+
+	Stream_Free(update->data, TRUE);
+	free(update->bitmaps);
+	DeleteCriticalSection(&update->lock);
+	free(update);
+}
+
+/**
+ * Drops all updates encoded for the previous surface frame. Must be called
+ * before the subsystem publishes a new frame, when no client is sending.
+ */
+void shadow_encode_cache_next_frame(rdpShadowEncodeCache* cache)
+{
+	if (!cache)
+		return;
+
+	EnterCriticalSection(&cache->lock);
+	WLog_DBG(TAG, "Frame %" PRIu32 ": %d shared updates", cache->frameId,
+	         ArrayList_Count(cache->updates));
+	ArrayList_Clear(cache->updates);
+	cache->frameId++;
+	LeaveCriticalSection(&cache->lock);
+}
+
+/**
+ * Looks up the update matching key in the current frame and returns it
+ * locked. If created is set on return, the caller is the first client
+ * asking for it and must encode the payload (and set encoded) before
+ * releasing it. Otherwise encoded tells whether a payload is available;
+ * if not, the caller encodes on its own.
+ */
+rdpShadowEncodedUpdate* shadow_encode_cache_acquire(rdpShadowEncodeCache* cache,
+                                                    const SHADOW_ENCODE_KEY* key, BOOL* created)
+{
+	int index;
+	int count;
+	rdpShadowEncodedUpdate* update = NULL;
+
+	if (!cache || !key || !created)
+		return NULL;
+
+	*created = FALSE;
+	EnterCriticalSection(&cache->lock);
+	count = ArrayList_Count(cache->updates);
+
+	for (index = 0; index < count; index++)
+	{
+		rdpShadowEncodedUpdate* current =
+		    (rdpShadowEncodedUpdate*)ArrayList_GetItem(cache->updates, index);
+
+		if (shadow_encode_key_equal(&current->key, key))
+		{
+			update = current;
+			break;
+		}
+	}
+
+	if (!update)
+	{
+		update = (rdpShadowEncodedUpdate*)calloc(1, sizeof(rdpShadowEncodedUpdate));
+
+		if (!update)
+			goto out;
+
+		if (!InitializeCriticalSectionAndSpinCount(&update->lock, 4000))
+		{
+			free(update);
+			update = NULL;
+			goto out;
+		}
+
+		update->cache = cache;
+		update->key = *key;
+
+		if (ArrayList_Add(cache->updates, update) < 0)
+		{
+			shadow_encoded_update_free(update);
+			update = NULL;
+			goto out;
+		}
+
+		/* Uncontended, taken before other clients can find it */
+		EnterCriticalSection(&update->lock);
+		*created = TRUE;
+	}
+
+out:
+	LeaveCriticalSection(&cache->lock);
+
+	/* Updates live until the next frame, waiting outside the cache lock is safe */
+	if (update && !*created)
+		EnterCriticalSection(&update->lock);
+
+	return update;
+}
+
+void shadow_encode_cache_release(rdpShadowEncodedUpdate* update)
+{
+	if (update)
+		LeaveCriticalSection(&update->lock);
+}
+
+/**
+ * RemoteFX messages reference tiles owned by the encoding context, so shared
+ * messages are encoded with a context that outlives the clients. Clients
+ * still write them with their own context to keep headers and frame indices
+ * per connection.
+ */
+BOOL shadow_encode_cache_encode_rfx(rdpShadowEncodedUpdate* update, const RFX_RECT* rect,
+                                    BYTE* pSrcData, int width, int height, int scanline,
+                                    int maxDataSize)
+{
+	rdpShadowEncodeCache* cache;
+
+	if (!update || !rect || !pSrcData)
+		return FALSE;
+
+	cache = update->cache;
+	EnterCriticalSection(&cache->rfxLock);
+
+	if (!cache->rfx)
+	{
+		if (!(cache->rfx = rfx_context_new(TRUE)))
+			goto out;
+
+		rfx_context_set_pixel_format(cache->rfx, PIXEL_FORMAT_BGRX32);
+	}
+
+	if ((cache->rfx->width != (UINT16)width) || (cache->rfx->height != (UINT16)height))
+	{
+		if (!rfx_context_reset(cache->rfx, width, height))
+			goto out;
+	}
+
+	cache->rfx->mode = cache->server->rfxMode;
+	update->messages = rfx_encode_messages(cache->rfx, rect, 1, pSrcData, width, height, scanline,
+	                                       &update->numMessages, maxDataSize);
+out:
+	LeaveCriticalSection(&cache->rfxLock);
+
+	if (!update->messages)
+	{
+		WLog_ERR(TAG, "rfx_encode_messages failed");
+		return FALSE;
+	}
+
+	update->encoded = TRUE;
+	return TRUE;
+}
+
+/**
+ * Copies bitmap tiles encoded by a client into the update. The tile data
+ * is owned by the update, the array itself is copied again by every client
+ * since sending patches header fields per connection.
+ */
+BOOL shadow_encode_cache_store_bitmaps(rdpShadowEncodedUpdate* update, const BITMAP_DATA* bitmaps,
+                                       UINT32 count)
+{
+	UINT32 index;
+	size_t length = 0;
+
+	if (!update || (!bitmaps && (count > 0)))
+		return FALSE;
+
+	for (index = 0; index < count; index++)
+		length += bitmaps[index].bitmapLength;
+
+	if (!(update->data = Stream_New(NULL, length + 1)))
+		return FALSE;
+
+	if (count > 0)
+	{
+		if (!(update->bitmaps = (BITMAP_DATA*)calloc(count, sizeof(BITMAP_DATA))))
+			return FALSE;
+	}
+
+	for (index = 0; index < count; index++)
+	{
+		update->bitmaps[index] = bitmaps[index];
+		update->bitmaps[index].bitmapDataStream = Stream_Pointer(update->data);
+		Stream_Write(update->data, bitmaps[index].bitmapDataStream, bitmaps[index].bitmapLength);
+	}
+
+	update->numBitmaps = count;
+	update->encoded = TRUE;
+	return TRUE;
+}
+
+rdpShadowEncodeCache* shadow_encode_cache_new(rdpShadowServer* server)
+{
+	rdpShadowEncodeCache* cache;
+	cache = (rdpShadowEncodeCache*)calloc(1, sizeof(rdpShadowEncodeCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->server = server;
+
+	if (!InitializeCriticalSectionAndSpinCount(&cache->lock, 4000))
+		goto fail_lock;
+
+	if (!InitializeCriticalSectionAndSpinCount(&cache->rfxLock, 4000))
+		goto fail_rfx_lock;
+
+	if (!(cache->updates = ArrayList_New(FALSE)))
+		goto fail_updates;
+
+	ArrayList_Object(cache->updates)->fnObjectFree = shadow_encoded_update_free;
+	return cache;
+fail_updates:
+	DeleteCriticalSection(&cache->rfxLock);
+fail_rfx_lock:
+	DeleteCriticalSection(&cache->lock);
+fail_lock:
+	free(cache);
+	return NULL;
+}
+
+void shadow_encode_cache_free(rdpShadowEncodeCache* cache)
+{
+	if (!cache)
+		return;
+
+	/* Shared messages must go back to the context before it is freed */
+	ArrayList_Free(cache->updates);
+	rfx_context_free(cache->rfx);
+	DeleteCriticalSection(&cache->rfxLock);
+	DeleteCriticalSection(&cache->lock);
+	free(cache);
+}
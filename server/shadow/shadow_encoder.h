@@ -21,6 +21,8 @@
 
 #include <winpr/crt.h>
 #include <winpr/stream.h>
+#include <winpr/synch.h>
+#include <winpr/collections.h>
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codecs.h>
@@ -50,6 +52,7 @@ struct rdp_shadow_encoder
 	BITMAP_PLANAR_CONTEXT* planar;
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
 	H264_CONTEXT* h264;
+	PROGRESSIVE_CONTEXT* progressive;
 
 	int fps;
 	int maxFps;
@@ -59,6 +62,54 @@ struct rdp_shadow_encoder
 	UINT32 queueDepth;
 };
 
+/**
+ * Identifies an encoded update within the current surface frame. Clients
+ * producing an identical key (same codec, source, rectangle and codec
+ * parameters) receive an identical payload and can share it.
+ */
+typedef struct
+{
+	const BYTE* pSrcData;
+	UINT32 codec;
+	int nXSrc;
+	int nYSrc;
+	int nWidth;
+	int nHeight;
+	UINT32 params[4];
+} SHADOW_ENCODE_KEY;
+
+typedef struct rdp_shadow_encoded_update rdpShadowEncodedUpdate;
+
+struct rdp_shadow_encoded_update
+{
+	rdpShadowEncodeCache* cache;
+	SHADOW_ENCODE_KEY key;
+
+	CRITICAL_SECTION lock;
+	BOOL encoded;
+
+	/* FREERDP_CODEC_REMOTEFX, encoded with the cache RemoteFX context */
+	RFX_MESSAGE* messages;
+	int numMessages;
+
+	/* FREERDP_CODEC_NSCODEC, FREERDP_CODEC_PLANAR and FREERDP_CODEC_INTERLEAVED */
+	wStream* data;
+	BITMAP_DATA* bitmaps;
+	UINT32 numBitmaps;
+};
+
+struct rdp_shadow_encode_cache
+{
+	rdpShadowServer* server;
+
+	CRITICAL_SECTION lock;
+	UINT32 frameId;
+	wArrayList* updates;
+
+	CRITICAL_SECTION rfxLock;
+	RFX_CONTEXT* rfx;
+};
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -71,6 +122,22 @@ extern "C"
 	rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client);
 	void shadow_encoder_free(rdpShadowEncoder* encoder);
 
+	BOOL shadow_encoder_use_cache(rdpShadowEncoder* encoder);
+
+	void shadow_encode_cache_next_frame(rdpShadowEncodeCache* cache);
+	rdpShadowEncodedUpdate* shadow_encode_cache_acquire(rdpShadowEncodeCache* cache,
+	                                                    const SHADOW_ENCODE_KEY* key,
+	                                                    BOOL* created);
+	void shadow_encode_cache_release(rdpShadowEncodedUpdate* update);
+	BOOL shadow_encode_cache_encode_rfx(rdpShadowEncodedUpdate* update, const RFX_RECT* rect,
+	                                    BYTE* pSrcData, int width, int height, int scanline,
+	                                    int maxDataSize);
+	BOOL shadow_encode_cache_store_bitmaps(rdpShadowEncodedUpdate* update,
+	                                       const BITMAP_DATA* bitmaps, UINT32 count);
+
+	rdpShadowEncodeCache* shadow_encode_cache_new(rdpShadowServer* server);
+	void shadow_encode_cache_free(rdpShadowEncodeCache* cache);
+
 #ifdef __cplusplus
 }
 #endif
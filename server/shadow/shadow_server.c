@@ -71,6 +71,8 @@ static const COMMAND_LINE_ARGUMENT_A shadow_args[] = {
 	  "nla extended protocol security" },
 	{ "sam-file", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL,
 	  "NTLM SAM file for NLA authentication" },
+	{ "gfx-progressive", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL,
+	  "RemoteFX progressive codec for graphics pipeline clients" },
 	{ "version", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_VERSION, NULL, NULL, NULL, -1, NULL,
 	  "Print version" },
 	{ "buildconfig", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_BUILDCONFIG, NULL, NULL, NULL, -1,
@@ -366,6 +368,10 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		{
 			freerdp_settings_set_string(settings, FreeRDP_NtlmSamFile, arg->Value);
 		}
+		CommandLineSwitchCase(arg, "gfx-progressive")
+		{
+			settings->GfxProgressive = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchDefault(arg)
 		{
 		}
@@ -714,6 +720,9 @@ int shadow_server_init(rdpShadowServer* server)
 	if (!InitializeCriticalSectionAndSpinCount(&(server->lock), 4000))
 		goto fail_server_lock;
 
+	if (!(server->encodeCache = shadow_encode_cache_new(server)))
+		goto fail_encode_cache;
+
 	status = shadow_server_init_config_path(server);
 
 	if (status < 0)
@@ -754,6 +763,9 @@ fail_certificate:
 	free(server->ConfigPath);
 	server->ConfigPath = NULL;
 fail_config_path:
+	shadow_encode_cache_free(server->encodeCache);
+	server->encodeCache = NULL;
+fail_encode_cache:
 	DeleteCriticalSection(&(server->lock));
 fail_server_lock:
 	CloseHandle(server->StopEvent);
@@ -782,6 +794,8 @@ int shadow_server_uninit(rdpShadowServer* server)
 	server->PrivateKeyFile = NULL;
 	free(server->ConfigPath);
 	server->ConfigPath = NULL;
+	shadow_encode_cache_free(server->encodeCache);
+	server->encodeCache = NULL;
 	DeleteCriticalSection(&(server->lock));
 	CloseHandle(server->StopEvent);
 	server->StopEvent = NULL;
@@ -275,5 +275,9 @@ int shadow_subsystem_pointer_convert_alpha_pointer_data(
 
 void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem)
 {
+	/* Clients are idle until the event is published, drop the last frame's payloads */
+	if (subsystem->server)
+		shadow_encode_cache_next_frame(subsystem->server->encodeCache);
+
 	shadow_multiclient_publish_and_wait(subsystem->updateEvent);
 }
@@ -0,0 +1,213 @@
+
+#include <winpr/crt.h>
+#include <winpr/crypto.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/server/shadow.h>
+
+/* Checks the dirty tile region against a per tile memcmp reference and
+ * prints the time a full frame comparison takes at common screen sizes. */
+
+typedef struct
+{
+	const char* name;
+	UINT32 width;
+	UINT32 height;
+} test_size_t;
+
+static const test_size_t sizes[] = { { "1080p", 1920, 1080 },
+	                                 { "4K", 3840, 2160 },
+	                                 { "8K", 7680, 4320 } };
+
+#define TEST_ITERATIONS 16
+
+static BOOL test_tile_dirty(const BYTE* pData1, const BYTE* pData2, UINT32 nStep, UINT32 nWidth,
+                            UINT32 nHeight, UINT32 tx, UINT32 ty)
+{
+	UINT32 y;
+	const UINT32 tw = MIN(16, nWidth - tx * 16);
+	const UINT32 th = MIN(16, nHeight - ty * 16);
+
+	for (y = 0; y < th; y++)
+	{
+		const size_t offset = ((ty * 16ULL + y) * nStep) + (tx * 16ULL * 4);
+
+		if (memcmp(&pData1[offset], &pData2[offset], tw * 4) != 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Every tile must be covered by the region exactly when it differs */
+static BOOL test_region_matches(const BYTE* pData1, const BYTE* pData2, UINT32 nStep,
+                                UINT32 nWidth, UINT32 nHeight, const REGION16* region)
+{
+	UINT32 tx, ty;
+	REGION16 tile;
+	BOOL rc = TRUE;
+	region16_init(&tile);
+
+	for (ty = 0; rc && (ty < (nHeight + 15) / 16); ty++)
+	{
+		for (tx = 0; rc && (tx < (nWidth + 15) / 16); tx++)
+		{
+			RECTANGLE_16 rect;
+			BOOL covered;
+			rect.left = tx * 16;
+			rect.top = ty * 16;
+			rect.right = MIN(nWidth, (tx + 1) * 16);
+			rect.bottom = MIN(nHeight, (ty + 1) * 16);
+			region16_intersect_rect(&tile, region, &rect);
+			covered = !region16_is_empty(&tile);
+
+			if (covered != test_tile_dirty(pData1, pData2, nStep, nWidth, nHeight, tx, ty))
+			{
+				printf("tile %" PRIu32 "x%" PRIu32 " %s\n", tx, ty,
+				       covered ? "equal but in region" : "dirty but not in region");
+				rc = FALSE;
+			}
+		}
+	}
+
+	region16_uninit(&tile);
+	return rc;
+}
+
+static BOOL test_compare(const BYTE* pData1, BYTE* pData2, UINT32 nStep, UINT32 nWidth,
+                         UINT32 nHeight)
+{
+	int status;
+	UINT32 i;
+	BOOL rc = FALSE;
+	REGION16 region;
+	RECTANGLE_16 rect;
+	region16_init(&region);
+
+	/* identical frames */
+	memcpy(pData2, pData1, (size_t)nStep * nHeight);
+	status = shadow_capture_compare_region(pData1, nStep, nWidth, nHeight, pData2, nStep, &region);
+
+	if ((status != 0) || !region16_is_empty(&region))
+	{
+		printf("identical frames reported dirty\n");
+		goto fail;
+	}
+
+	/* two opposite corners must not produce the bounding box of the screen */
+	pData2[0] ^= 0xFF;
+	pData2[((size_t)(nHeight - 1) * nStep) + ((nWidth - 1) * 4ULL)] ^= 0xFF;
+	status = shadow_capture_compare_region(pData1, nStep, nWidth, nHeight, pData2, nStep, &region);
+
+	if ((status != 1) || (region16_n_rects(&region) != 2) ||
+	    !test_region_matches(pData1, pData2, nStep, nWidth, nHeight, &region))
+	{
+		printf("corner changes: status %d, %d rects\n", status, region16_n_rects(&region));
+		goto fail;
+	}
+
+	/* random scattered changes, including partial edge tiles */
+	for (i = 0; i < 64; i++)
+	{
+		UINT32 pos[2];
+		winpr_RAND((BYTE*)pos, sizeof(pos));
+		pData2[((size_t)(pos[1] % nHeight) * nStep) + ((pos[0] % nWidth) * 4ULL) + (i % 4)] ^=
+		    0x5A;
+	}
+
+	status = shadow_capture_compare_region(pData1, nStep, nWidth, nHeight, pData2, nStep, &region);
+
+	if ((status != 1) || !test_region_matches(pData1, pData2, nStep, nWidth, nHeight, &region))
+	{
+		printf("scattered changes: status %d\n", status);
+		goto fail;
+	}
+
+	/* the rectangle variant reports the extents */
+	if ((shadow_capture_compare((BYTE*)pData1, nStep, nWidth, nHeight, pData2, nStep, &rect) !=
+	     1) ||
+	    (memcmp(&rect, region16_extents(&region), sizeof(RECTANGLE_16)) != 0))
+	{
+		printf("shadow_capture_compare extents mismatch\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	region16_uninit(&region);
+	return rc;
+}
+
+static BOOL test_size(const test_size_t* size)
+{
+	UINT32 i;
+	UINT64 start;
+	UINT64 equal, changed;
+	BOOL rc = FALSE;
+	REGION16 region;
+	const UINT32 nStep = size->width * 4;
+	const size_t length = (size_t)nStep * size->height;
+	BYTE* pData1 = malloc(length);
+	BYTE* pData2 = malloc(length);
+	region16_init(&region);
+
+	if (!pData1 || !pData2)
+	{
+		printf("%s: failed to allocate frames, skipping\n", size->name);
+		rc = TRUE;
+		goto fail;
+	}
+
+	winpr_RAND(pData1, MIN(length, 4096));
+
+	for (i = 4096; i < length; i += 4096)
+		memcpy(&pData1[i], pData1, MIN(4096, length - i));
+
+	if (!test_compare(pData1, pData2, nStep, size->width, size->height))
+	{
+		printf("%s: comparison failed\n", size->name);
+		goto fail;
+	}
+
+	memcpy(pData2, pData1, length);
+	start = GetTickCount64();
+
+	for (i = 0; i < TEST_ITERATIONS; i++)
+		shadow_capture_compare_region(pData1, nStep, size->width, size->height, pData2, nStep,
+		                              &region);
+
+	equal = GetTickCount64() - start;
+	pData2[length / 2] ^= 0xFF;
+	start = GetTickCount64();
+
+	for (i = 0; i < TEST_ITERATIONS; i++)
+		shadow_capture_compare_region(pData1, nStep, size->width, size->height, pData2, nStep,
+		                              &region);
+
+	changed = GetTickCount64() - start;
+	printf("%-5s %" PRIu32 "x%" PRIu32 ": %d unchanged frames in %" PRIu64
+	       "ms, %d changed frames in %" PRIu64 "ms\n",
+	       size->name, size->width, size->height, TEST_ITERATIONS, equal, TEST_ITERATIONS,
+	       changed);
+	rc = TRUE;
+fail:
+	region16_uninit(&region);
+	free(pData1);
+	free(pData2);
+	return rc;
+}
+
+int TestShadowCapture(int argc, char* argv[])
+{
+	size_t i;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	for (i = 0; i < ARRAYSIZE(sizes); i++)
+	{
+		if (!test_size(&sizes[i]))
+			return -1;
+	}
+
+	return 0;
+}
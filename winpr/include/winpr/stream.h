@@ -394,15 +394,17 @@ extern "C"
 
 	/* StreamPool */
 
+	typedef struct _wStreamPoolBucket wStreamPoolBucket;
+
 	struct _wStreamPool
 	{
-		int aSize;
-		int aCapacity;
-		wStream** aArray;
+		/* Available streams, bucketed by capacity and lock-free */
+		wStreamPoolBucket* buckets;
 
-		int uSize;
-		int uCapacity;
-		wStream** uArray;
+		/* Every stream owned by the pool, only touched on allocation and by StreamPool_Find */
+		size_t size;
+		size_t capacity;
+		wStream** array;
 
 		CRITICAL_SECTION lock;
 		BOOL synchronized;
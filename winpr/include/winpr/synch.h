@@ -410,6 +410,26 @@ extern "C"
 
 	WINPR_API void* GetEventWaitObject(HANDLE hEvent);
 
+	/**
+	 * A wait set keeps its handles registered between waits, on Linux with
+	 * epoll. WaitForWaitSet stores up to nCount signaled handles in lpHandles
+	 * and returns WAIT_OBJECT_0, WAIT_TIMEOUT or WAIT_FAILED. Signaled handles
+	 * are consumed like WaitForMultipleObjects does, for example a semaphore
+	 * count is taken. If consuming a handle fails after others were consumed
+	 * the handles collected so far are returned. A wait set is not
+	 * synchronized and a handle must be removed before it is closed.
+	 */
+	typedef struct winpr_wait_set WINPR_WAIT_SET;
+
+	WINPR_API WINPR_WAIT_SET* CreateWaitSet(void);
+	WINPR_API void FreeWaitSet(WINPR_WAIT_SET* set);
+
+	WINPR_API BOOL WaitSetAddHandle(WINPR_WAIT_SET* set, HANDLE hHandle);
+	WINPR_API BOOL WaitSetRemoveHandle(WINPR_WAIT_SET* set, HANDLE hHandle);
+
+	WINPR_API DWORD WaitForWaitSet(WINPR_WAIT_SET* set, DWORD dwMilliseconds, HANDLE* lpHandles,
+	                               DWORD nCount, LPDWORD lpReadyCount);
+
 #ifdef __cplusplus
 }
 #endif
@@ -336,6 +336,8 @@ extern "C"
 #define PF_EX_ARM_IDIVA 13
 #define PF_EX_ARM_IDIVT 14
 #define PF_EX_AVX_PCLMULQDQ 15
+#define PF_EX_AVX512F 16
+#define PF_EX_AVX512BW 17
 
 /*
  * some "aliases" for the standard defines
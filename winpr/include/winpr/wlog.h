@@ -96,6 +96,11 @@ extern "C"
 		void* PacketData;
 		int PacketLength;
 		DWORD PacketFlags;
+
+		/* Set when the message is written asynchronously, 0 otherwise */
+
+		UINT64 TimeStamp; /* milliseconds since the epoch the message was logged at */
+		size_t ThreadId;  /* thread that logged the message */
 	};
 	typedef struct _wLogMessage wLogMessage;
 	typedef struct _wLogLayout wLogLayout;
@@ -195,6 +200,16 @@ extern "C"
 	WINPR_API wLogLayout* WLog_GetLogLayout(wLog* log);
 	WINPR_API BOOL WLog_Layout_SetPrefixFormat(wLog* log, wLogLayout* layout, const char* format);
 
+	/**
+	 * Asynchronous output: messages are copied into a ring of the logging thread
+	 * and written by a background thread. Messages that find the ring full are
+	 * dropped and counted. Image messages are always written synchronously.
+	 */
+	WINPR_API BOOL WLog_SetAsync(BOOL enable);
+	WINPR_API BOOL WLog_IsAsync(void);
+	WINPR_API BOOL WLog_Flush(void);
+	WINPR_API UINT32 WLog_GetDroppedMessages(void);
+
 	/** Deprecated */
 	WINPR_API WINPR_DEPRECATED(BOOL WLog_Init(void));
 	/** Deprecated */
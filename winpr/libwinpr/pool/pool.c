@@ -24,6 +24,7 @@
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/library.h>
+#include <winpr/interlocked.h>
 
 #include "pool.h"
 
@@ -53,69 +54,292 @@ static BOOL CALLBACK init_module(PINIT_ONCE once, PVOID param, PVOID* context)
 static TP_POOL DEFAULT_POOL = {
 	0,    /* DWORD Minimum */
 	500,  /* DWORD Maximum */
-	NULL, /* wArrayList* Threads */
-	NULL, /* wQueue* PendingQueue */
+	NULL, /* TP_WORKER** Workers */
+	0,    /* LONG WorkerCount */
+	0,    /* LONG NextWorker */
+	0,    /* LONG IdleWorkers */
+	0,    /* LONG SignaledWorkers */
+	0,    /* LONG Terminate */
+	0,    /* DWORD TlsIndex */
+	NULL, /* HANDLE WorkSemaphore */
 	NULL, /* HANDLE TerminateEvent */
 	NULL, /* wCountdownEvent* WorkComplete */
 };
 
+static BOOL worker_push(TP_WORKER* worker, PTP_WORK work)
+{
+	BOOL rc = TRUE;
+	EnterCriticalSection(&worker->Lock);
+
+	if ((size_t)worker->Count == worker->Capacity)
+	{
+		size_t index;
+		const size_t capacity = worker->Capacity * 2;
+		PTP_WORK* items = (PTP_WORK*)calloc(capacity, sizeof(PTP_WORK));
+
+		if (!items)
+		{
+			rc = FALSE;
+			goto out;
+		}
+
+		for (index = 0; index < worker->Capacity; index++)
+			items[index] = worker->Items[(worker->Head + index) & (worker->Capacity - 1)];
+
+		free(worker->Items);
+		worker->Items = items;
+		worker->Capacity = capacity;
+		worker->Head = 0;
+	}
+
+	worker->Items[(worker->Head + worker->Count) & (worker->Capacity - 1)] = work;
+	worker->Count++;
+out:
+	LeaveCriticalSection(&worker->Lock);
+	return rc;
+}
+
+static PTP_WORK worker_pop(TP_WORKER* worker, BOOL steal)
+{
+	PTP_WORK work = NULL;
+
+	/* Unlocked peek, avoids touching the locks of idle deques */
+	if (worker->Count == 0)
+		return NULL;
+
+	EnterCriticalSection(&worker->Lock);
+
+	if (worker->Count > 0)
+	{
+		worker->Count--;
+
+		if (steal)
+		{
+			work = worker->Items[worker->Head];
+			worker->Head = (worker->Head + 1) & (worker->Capacity - 1);
+		}
+		else
+			work = worker->Items[(worker->Head + worker->Count) & (worker->Capacity - 1)];
+	}
+
+	LeaveCriticalSection(&worker->Lock);
+	return work;
+}
+
+static PTP_WORK thread_pool_next_work(TP_WORKER* worker)
+{
+	LONG index;
+	PTP_POOL pool = worker->Pool;
+	const LONG count = pool->WorkerCount;
+	PTP_WORK work = worker_pop(worker, FALSE);
+
+	for (index = 1; !work && (index < count); index++)
+		work = worker_pop(pool->Workers[(worker->Index + index) % count], TRUE);
+
+	return work;
+}
+
+/**
+ * Wake one sleeping worker unless a wakeup is already in flight.
+ * A woken worker that finds work passes the wakeup on, so bursts fan out
+ * over the idle workers one at a time instead of waking all of them.
+ */
+static void thread_pool_wake_worker(PTP_POOL pool)
+{
+	if (pool->IdleWorkers <= 0)
+		return;
+
+	if (InterlockedCompareExchange(&pool->SignaledWorkers, 1, 0) == 0)
+		ReleaseSemaphore(pool->WorkSemaphore, 1, NULL);
+}
+
 static DWORD WINAPI thread_pool_work_func(LPVOID arg)
 {
 	DWORD status;
 	PTP_POOL pool;
 	PTP_WORK work;
 	HANDLE events[2];
-	PTP_CALLBACK_INSTANCE callbackInstance;
+	TP_WORKER* worker;
+	BOOL woken = FALSE;
+	TP_CALLBACK_INSTANCE callbackInstance;
 
-	pool = (PTP_POOL)arg;
+	worker = (TP_WORKER*)arg;
+	pool = worker->Pool;
 
 	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+	events[1] = pool->WorkSemaphore;
+
+	TlsSetValue(pool->TlsIndex, worker);
 
-	while (1)
+	while (!pool->Terminate)
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		work = thread_pool_next_work(worker);
+
+		if (work && woken)
+		{
+			woken = FALSE;
+			thread_pool_wake_worker(pool);
+		}
 
-		if (status == WAIT_OBJECT_0)
-			break;
+		if (!work)
+		{
+			/* Announce going idle first, then look again so that work submitted
+			 * in between is either found here or wakes us up. */
+			InterlockedIncrement(&pool->IdleWorkers);
+			work = thread_pool_next_work(worker);
 
-		if (status != (WAIT_OBJECT_0 + 1))
-			break;
+			if (!work)
+			{
+				status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+				InterlockedDecrement(&pool->IdleWorkers);
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE)Queue_Dequeue(pool->PendingQueue);
+				if (status != (WAIT_OBJECT_0 + 1))
+					break;
 
-		if (callbackInstance)
-		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+				InterlockedDecrement(&pool->SignaledWorkers);
+				woken = TRUE;
+				continue;
+			}
+
+			InterlockedDecrement(&pool->IdleWorkers);
 		}
+
+		/* The instance is only valid for the duration of the callback */
+		callbackInstance.Work = work;
+		work->WorkCallback(&callbackInstance, work->CallbackParameter, work);
+		CountdownEvent_Signal(pool->WorkComplete, 1);
 	}
 
 	ExitThread(0);
 	return 0;
 }
 
-static void threads_close(void* thread)
+static void thread_pool_free_worker(TP_WORKER* worker)
 {
-	WaitForSingleObject(thread, INFINITE);
-	CloseHandle(thread);
+	if (!worker)
+		return;
+
+	if (worker->Thread)
+	{
+		WaitForSingleObject(worker->Thread, INFINITE);
+		CloseHandle(worker->Thread);
+	}
+
+	DeleteCriticalSection(&worker->Lock);
+	free(worker->Items);
+	free(worker);
+}
+
+static BOOL thread_pool_add_worker(PTP_POOL pool)
+{
+	TP_WORKER* worker;
+	const LONG index = pool->WorkerCount;
+
+	if (index >= TP_POOL_MAX_WORKERS)
+		return FALSE;
+
+	if (!(worker = (TP_WORKER*)calloc(1, sizeof(TP_WORKER))))
+		return FALSE;
+
+	worker->Pool = pool;
+	worker->Index = (DWORD)index;
+	worker->Capacity = 64;
+
+	if (!InitializeCriticalSectionAndSpinCount(&worker->Lock, 4000))
+	{
+		free(worker);
+		return FALSE;
+	}
+
+	if (!(worker->Items = (PTP_WORK*)calloc(worker->Capacity, sizeof(PTP_WORK))))
+		goto fail;
+
+	/* Publish the deque before the worker count so stealing threads never see a hole */
+	pool->Workers[index] = worker;
+
+	if (!(worker->Thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)worker, 0, NULL)))
+	{
+		pool->Workers[index] = NULL;
+		goto fail;
+	}
+
+	InterlockedIncrement(&pool->WorkerCount);
+	return TRUE;
+fail:
+	thread_pool_free_worker(worker);
+	return FALSE;
+}
+
+static void thread_pool_free_workers(PTP_POOL pool)
+{
+	LONG index;
+	InterlockedExchange(&pool->Terminate, 1);
+	SetEvent(pool->TerminateEvent);
+
+	/* With pipe based semaphores several idle workers can see the semaphore
+	 * readable at once, the ones losing the race block in read() and never
+	 * notice the terminate event. Hand every worker a count to get them out. */
+	if (pool->WorkerCount > 0)
+		ReleaseSemaphore(pool->WorkSemaphore, pool->WorkerCount, NULL);
+
+	for (index = 0; index < pool->WorkerCount; index++)
+		thread_pool_free_worker(pool->Workers[index]);
+
+	free(pool->Workers);
+	pool->Workers = NULL;
+	pool->WorkerCount = 0;
+}
+
+BOOL SubmitWorkToThreadpool(PTP_POOL pool, PTP_WORK work)
+{
+	TP_WORKER* worker;
+
+	/* Work submitted from a worker goes to its own deque, everything else is
+	 * spread round robin so submitters do not contend on a single lock. */
+	worker = (TP_WORKER*)TlsGetValue(pool->TlsIndex);
+
+	if (!worker || (worker->Pool != pool))
+	{
+		const LONG count = pool->WorkerCount;
+
+		if (count <= 0)
+			return FALSE;
+
+		worker = pool->Workers[(ULONG)InterlockedIncrement(&pool->NextWorker) % (ULONG)count];
+	}
+
+	CountdownEvent_AddCount(pool->WorkComplete, 1);
+
+	if (!worker_push(worker, work))
+	{
+		CountdownEvent_Signal(pool->WorkComplete, 1);
+		return FALSE;
+	}
+
+	thread_pool_wake_worker(pool);
+	return TRUE;
 }
 
 static BOOL InitializeThreadpool(PTP_POOL pool)
 {
 	int index;
-	HANDLE thread;
 
-	if (pool->Threads)
+	if (pool->Workers)
 		return TRUE;
 
 	pool->Minimum = 0;
 	pool->Maximum = 500;
+	pool->WorkerCount = 0;
+	pool->NextWorker = 0;
+	pool->IdleWorkers = 0;
+	pool->SignaledWorkers = 0;
+	pool->Terminate = 0;
+
+	if ((pool->TlsIndex = TlsAlloc()) == TLS_OUT_OF_INDEXES)
+		goto fail_tls_alloc;
 
-	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
-		goto fail_queue_new;
+	if (!(pool->WorkSemaphore = CreateSemaphore(NULL, 0, MAXLONG, NULL)))
+		goto fail_work_semaphore;
 
 	if (!(pool->WorkComplete = CountdownEvent_New(0)))
 		goto fail_countdown_event;
@@ -123,38 +347,31 @@ static BOOL InitializeThreadpool(PTP_POOL pool)
 	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
 		goto fail_terminate_event;
 
-	if (!(pool->Threads = ArrayList_New(TRUE)))
-		goto fail_thread_array;
-
-	pool->Threads->object.fnObjectFree = threads_close;
+	if (!(pool->Workers = (TP_WORKER**)calloc(TP_POOL_MAX_WORKERS, sizeof(TP_WORKER*))))
+		goto fail_worker_array;
 
 	for (index = 0; index < 4; index++)
 	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)pool, 0, NULL)))
-		{
-			goto fail_create_threads;
-		}
-
-		if (ArrayList_Add(pool->Threads, thread) < 0)
+		if (!thread_pool_add_worker(pool))
 			goto fail_create_threads;
 	}
 
 	return TRUE;
 
 fail_create_threads:
-	SetEvent(pool->TerminateEvent);
-	ArrayList_Free(pool->Threads);
-	pool->Threads = NULL;
-fail_thread_array:
+	thread_pool_free_workers(pool);
+fail_worker_array:
 	CloseHandle(pool->TerminateEvent);
 	pool->TerminateEvent = NULL;
 fail_terminate_event:
 	CountdownEvent_Free(pool->WorkComplete);
 	pool->WorkComplete = NULL;
 fail_countdown_event:
-	Queue_Free(pool->PendingQueue);
-	pool->WorkComplete = NULL;
-fail_queue_new:
+	CloseHandle(pool->WorkSemaphore);
+	pool->WorkSemaphore = NULL;
+fail_work_semaphore:
+	TlsFree(pool->TlsIndex);
+fail_tls_alloc:
 
 	return FALSE;
 }
@@ -201,19 +418,17 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
-
-	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
+	thread_pool_free_workers(ptpp);
 	CountdownEvent_Free(ptpp->WorkComplete);
 	CloseHandle(ptpp->TerminateEvent);
+	CloseHandle(ptpp->WorkSemaphore);
+	TlsFree(ptpp->TlsIndex);
 
 	if (ptpp == &DEFAULT_POOL)
 	{
-		ptpp->Threads = NULL;
-		ptpp->PendingQueue = NULL;
 		ptpp->WorkComplete = NULL;
 		ptpp->TerminateEvent = NULL;
+		ptpp->WorkSemaphore = NULL;
 	}
 	else
 	{
@@ -223,7 +438,6 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 
 BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 {
-	HANDLE thread;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSetThreadpoolThreadMinimum)
@@ -231,14 +445,11 @@ BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 #endif
 	ptpp->Minimum = cthrdMic;
 
-	while (ArrayList_Count(ptpp->Threads) < (INT64)ptpp->Minimum)
+	/* Deques are preallocated, more than TP_POOL_MAX_WORKERS threads are not started */
+	while ((ptpp->WorkerCount < (LONG)ptpp->Minimum) &&
+	       (ptpp->WorkerCount < TP_POOL_MAX_WORKERS))
 	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)ptpp, 0, NULL)))
-		{
-			return FALSE;
-		}
-
-		if (ArrayList_Add(ptpp->Threads, thread) < 0)
+		if (!thread_pool_add_worker(ptpp))
 			return FALSE;
 	}
 
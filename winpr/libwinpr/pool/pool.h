@@ -30,12 +30,36 @@ struct _TP_CALLBACK_INSTANCE
 	PTP_WORK Work;
 };
 
+#define TP_POOL_MAX_WORKERS 256
+
+/**
+ * Each worker owns a deque of pending work. The owner pops from the tail,
+ * idle workers steal from the head of the other deques.
+ */
+typedef struct
+{
+	PTP_POOL Pool;
+	DWORD Index;
+	HANDLE Thread;
+	CRITICAL_SECTION Lock;
+	PTP_WORK* Items;
+	size_t Capacity;
+	size_t Head;
+	volatile LONG Count;
+} TP_WORKER;
+
 struct _TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
+	TP_WORKER** Workers;
+	volatile LONG WorkerCount;
+	volatile LONG NextWorker;
+	volatile LONG IdleWorkers;
+	volatile LONG SignaledWorkers;
+	volatile LONG Terminate;
+	DWORD TlsIndex;
+	HANDLE WorkSemaphore;
 	HANDLE TerminateEvent;
 	wCountdownEvent* WorkComplete;
 };
@@ -73,5 +97,6 @@ struct _TP_CLEANUP_GROUP
 };
 
 PTP_POOL GetDefaultThreadpool(void);
+BOOL SubmitWorkToThreadpool(PTP_POOL pool, PTP_WORK work);
 
 #endif /* WINPR_POOL_PRIVATE_H */
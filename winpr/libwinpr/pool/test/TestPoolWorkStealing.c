@@ -0,0 +1,147 @@
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+
+#define BENCH_ITEMS 200000
+#define NESTED_ITEMS 64
+
+static LONG count = 0;
+static PTP_WORK nestedWork = NULL;
+
+static void CALLBACK test_CountCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                        PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(work);
+	InterlockedIncrement(&count);
+}
+
+/* Submits more work from inside a worker, which lands on the worker's own deque */
+static void CALLBACK test_NestedCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                         PTP_WORK work)
+{
+	int index;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(work);
+	InterlockedIncrement(&count);
+
+	for (index = 0; index < NESTED_ITEMS; index++)
+		SubmitThreadpoolWork(nestedWork);
+}
+
+static BOOL test_pool(DWORD workers)
+{
+	BOOL rc = FALSE;
+	int index;
+	UINT64 start, duration;
+	PTP_POOL pool;
+	PTP_WORK work = NULL;
+	TP_CALLBACK_ENVIRON environment;
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		return FALSE;
+	}
+
+	if (!SetThreadpoolThreadMinimum(pool, workers))
+	{
+		printf("SetThreadpoolThreadMinimum failure\n");
+		goto fail;
+	}
+
+	SetThreadpoolThreadMaximum(pool, workers);
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	if (!(work = CreateThreadpoolWork(test_CountCallback, NULL, &environment)))
+	{
+		printf("CreateThreadpoolWork failure\n");
+		goto fail;
+	}
+
+	count = 0;
+	start = GetTickCount64();
+
+	for (index = 0; index < BENCH_ITEMS; index++)
+		SubmitThreadpoolWork(work);
+
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+	duration = GetTickCount64() - start;
+
+	if (count != BENCH_ITEMS)
+	{
+		printf("%" PRIu32 " workers: executed %" PRId32 " of %d items\n", workers, count,
+		       BENCH_ITEMS);
+		goto fail;
+	}
+
+	printf("%3" PRIu32 " workers: %d items in %" PRIu64 "ms, %" PRIu64 " items/s\n", workers,
+	       BENCH_ITEMS, duration, (duration > 0) ? (1000ull * BENCH_ITEMS / duration) : 0);
+	CloseThreadpoolWork(work);
+
+	if (!(work = CreateThreadpoolWork(test_NestedCallback, NULL, &environment)))
+	{
+		printf("CreateThreadpoolWork failure\n");
+		goto fail;
+	}
+
+	if (!(nestedWork = CreateThreadpoolWork(test_CountCallback, NULL, &environment)))
+	{
+		printf("CreateThreadpoolWork failure\n");
+		goto fail;
+	}
+
+	count = 0;
+
+	for (index = 0; index < NESTED_ITEMS; index++)
+		SubmitThreadpoolWork(work);
+
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+
+	if (count != NESTED_ITEMS * (NESTED_ITEMS + 1))
+	{
+		printf("%" PRIu32 " workers: executed %" PRId32 " of %d nested items\n", workers, count,
+		       NESTED_ITEMS * (NESTED_ITEMS + 1));
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	if (nestedWork)
+		CloseThreadpoolWork(nestedWork);
+
+	nestedWork = NULL;
+
+	if (work)
+		CloseThreadpoolWork(work);
+
+	CloseThreadpool(pool);
+	return rc;
+}
+
+int TestPoolWorkStealing(int argc, char* argv[])
+{
+	DWORD workers;
+	SYSTEM_INFO sysinfo;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+	GetNativeSystemInfo(&sysinfo);
+
+	/* Pools start with 4 workers, scale up to one worker per processor */
+	for (workers = 4; workers <= 64; workers *= 2)
+	{
+		if (!test_pool(workers))
+			return -1;
+
+		if (workers >= sysinfo.dwNumberOfProcessors)
+			break;
+	}
+
+	return 0;
+}
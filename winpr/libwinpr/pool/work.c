@@ -128,7 +128,6 @@ VOID winpr_CloseThreadpoolWork(PTP_WORK pwk)
 VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 {
 	PTP_POOL pool;
-	PTP_CALLBACK_INSTANCE callbackInstance;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 
@@ -140,14 +139,9 @@ VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 
 #endif
 	pool = pwk->CallbackEnvironment->Pool;
-	callbackInstance = (PTP_CALLBACK_INSTANCE)calloc(1, sizeof(TP_CALLBACK_INSTANCE));
 
-	if (callbackInstance)
-	{
-		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		Queue_Enqueue(pool->PendingQueue, callbackInstance);
-	}
+	if (!SubmitWorkToThreadpool(pool, pwk))
+		WLog_ERR(TAG, "failed to submit work");
 }
 
 BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
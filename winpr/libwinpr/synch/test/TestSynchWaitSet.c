@@ -0,0 +1,148 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+
+#define TEST_HANDLES 48
+
+static BOOL test_ready(WINPR_WAIT_SET* set, DWORD dwMilliseconds, const HANDLE* expected,
+                       DWORD count)
+{
+	DWORD x, y;
+	DWORD ready = 0;
+	HANDLE handles[TEST_HANDLES];
+	const DWORD status = WaitForWaitSet(set, dwMilliseconds, handles, ARRAYSIZE(handles), &ready);
+
+	if (status != (count ? WAIT_OBJECT_0 : WAIT_TIMEOUT))
+	{
+		printf("WaitForWaitSet returned 0x%08" PRIX32 ", expected %" PRIu32 " handles\n", status,
+		       count);
+		return FALSE;
+	}
+
+	if (ready != count)
+	{
+		printf("%" PRIu32 " handles ready, expected %" PRIu32 "\n", ready, count);
+		return FALSE;
+	}
+
+	for (x = 0; x < count; x++)
+	{
+		for (y = 0; y < ready; y++)
+		{
+			if (handles[y] == expected[x])
+				break;
+		}
+
+		if (y == ready)
+		{
+			printf("expected handle %" PRIu32 " is not ready\n", x);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static DWORD WINAPI test_signal_thread(LPVOID arg)
+{
+	Sleep(50);
+	SetEvent((HANDLE)arg);
+	return 0;
+}
+
+int TestSynchWaitSet(int argc, char* argv[])
+{
+	DWORD x;
+	int rc = -1;
+	DWORD ready;
+	HANDLE thread;
+	HANDLE handle;
+	HANDLE expected[3];
+	HANDLE events[TEST_HANDLES] = { 0 };
+	WINPR_WAIT_SET* set;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!(set = CreateWaitSet()))
+		return -1;
+
+	for (x = 0; x < TEST_HANDLES; x++)
+	{
+		if (!(events[x] = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+		    !WaitSetAddHandle(set, events[x]))
+			goto out;
+	}
+
+	if (WaitSetAddHandle(set, events[0]))
+	{
+		printf("a handle was added twice\n");
+		goto out;
+	}
+
+	if (!test_ready(set, 0, NULL, 0))
+		goto out;
+
+	SetEvent(events[2]);
+	SetEvent(events[7]);
+	SetEvent(events[TEST_HANDLES - 1]);
+	expected[0] = events[2];
+	expected[1] = events[7];
+	expected[2] = events[TEST_HANDLES - 1];
+
+	/* Signaled handles stay ready until they are reset */
+	if (!test_ready(set, 0, expected, 3) || !test_ready(set, 0, expected, 3))
+		goto out;
+
+	ResetEvent(events[7]);
+	ResetEvent(events[TEST_HANDLES - 1]);
+
+	if (!test_ready(set, 0, expected, 1))
+		goto out;
+
+	/* Not more handles than requested */
+	SetEvent(events[4]);
+
+	if ((WaitForWaitSet(set, 0, &handle, 1, &ready) != WAIT_OBJECT_0) || (ready != 1))
+		goto out;
+
+	/* Removed handles are not reported */
+	if (!WaitSetRemoveHandle(set, events[4]) || WaitSetRemoveHandle(set, events[4]))
+		goto out;
+
+	if (!test_ready(set, 0, expected, 1))
+		goto out;
+
+	ResetEvent(events[2]);
+
+	if (!test_ready(set, 10, NULL, 0))
+		goto out;
+
+	/* A wait with a timeout returns once another thread signals */
+	if (!(thread = CreateThread(NULL, 0, test_signal_thread, events[9], 0, NULL)))
+		goto out;
+
+	expected[0] = events[9];
+
+	if (!test_ready(set, 5000, expected, 1))
+	{
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+		goto out;
+	}
+
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	rc = 0;
+out:
+	FreeWaitSet(set);
+
+	for (x = 0; x < TEST_HANDLES; x++)
+	{
+		if (events[x])
+			CloseHandle(events[x]);
+	}
+
+	return rc;
+}
@@ -320,6 +320,7 @@ static HANDLE_OPS ops = { TimerIsHandled, TimerCloseHandle,
 /**
  * Waitable Timer
  */
+#if defined(WITH_KQUEUE)
 static void* kqueue_monitoring_thread_start(void* arg)
 {
 	WINPR_TIMER *timer = (WINPR_TIMER*)arg;
@@ -338,6 +339,7 @@ static void* kqueue_monitoring_thread_start(void* arg)
     WLog_VRB(TAG, "%s: Handler called for %s", __FUNCTION__, timer->name);
   }
 }
+#endif
 
 HANDLE CreateWaitableTimerA(LPSECURITY_ATTRIBUTES lpTimerAttributes, BOOL bManualReset,
                             LPCSTR lpTimerName)
@@ -0,0 +1,416 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Synchronization Functions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#ifndef _WIN32
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_SYS_EPOLL_H)
+#include <sys/epoll.h>
+#define WITH_WAIT_SET_EPOLL
+#elif defined(HAVE_POLL_H)
+#include <poll.h>
+#define WITH_WAIT_SET_POLL
+#endif
+
+#include "synch.h"
+
+#endif
+
+#include "../log.h"
+#define TAG WINPR_TAG("sync.waitset")
+
+/**
+ * CreateWaitSet
+ * FreeWaitSet
+ * WaitSetAddHandle
+ * WaitSetRemoveHandle
+ * WaitForWaitSet
+ *
+ * Handles are registered once instead of on every wait. With epoll the kernel
+ * keeps the registration and a wait only touches the handles that are ready,
+ * the poll fallback keeps the pollfd array between waits.
+ * Other platforms wait with WaitForMultipleObjects and are limited to
+ * MAXIMUM_WAIT_OBJECTS handles.
+ */
+
+#define WAIT_SET_MAX_EVENTS 64
+
+struct winpr_wait_set
+{
+	DWORD count;
+#if defined(WITH_WAIT_SET_EPOLL)
+	int epfd;
+#else
+	DWORD capacity;
+	HANDLE* handles;
+#if defined(WITH_WAIT_SET_POLL)
+	struct pollfd* pollfds;
+#endif
+#endif
+};
+
+#if defined(WITH_WAIT_SET_EPOLL) || defined(WITH_WAIT_SET_POLL)
+
+static int wait_set_timeout(DWORD dwMilliseconds)
+{
+	if ((dwMilliseconds == INFINITE) || (dwMilliseconds > INT32_MAX))
+		return -1;
+
+	return (int)dwMilliseconds;
+}
+
+static BOOL wait_set_handle_info(HANDLE hHandle, int* pfd, ULONG* pmode)
+{
+	ULONG Type;
+	WINPR_HANDLE* Object;
+
+	if (!winpr_Handle_GetInfo(hHandle, &Type, &Object) ||
+	    ((*pfd = winpr_Handle_getFd(Object)) < 0))
+	{
+		WLog_ERR(TAG, "handle %p has no file descriptor", hHandle);
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	*pmode = Object->Mode;
+	return TRUE;
+}
+
+#endif
+
+WINPR_WAIT_SET* CreateWaitSet(void)
+{
+	WINPR_WAIT_SET* set = (WINPR_WAIT_SET*)calloc(1, sizeof(WINPR_WAIT_SET));
+
+	if (!set)
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return NULL;
+	}
+
+#if defined(WITH_WAIT_SET_EPOLL)
+	set->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (set->epfd < 0)
+	{
+		WLog_ERR(TAG, "epoll_create1 failure [%d] %s", errno, strerror(errno));
+		SetLastError(ERROR_INTERNAL_ERROR);
+		free(set);
+		return NULL;
+	}
+
+#endif
+	return set;
+}
+
+void FreeWaitSet(WINPR_WAIT_SET* set)
+{
+	if (!set)
+		return;
+
+#if defined(WITH_WAIT_SET_EPOLL)
+	close(set->epfd);
+#else
+	free(set->handles);
+#if defined(WITH_WAIT_SET_POLL)
+	free(set->pollfds);
+#endif
+#endif
+	free(set);
+}
+
+BOOL WaitSetAddHandle(WINPR_WAIT_SET* set, HANDLE hHandle)
+{
+#if defined(WITH_WAIT_SET_EPOLL)
+	int fd;
+	ULONG mode;
+	struct epoll_event event = { 0 };
+
+	if (!set || !wait_set_handle_info(hHandle, &fd, &mode))
+		return FALSE;
+
+	if (mode & WINPR_FD_READ)
+		event.events |= EPOLLIN;
+
+	if (mode & WINPR_FD_WRITE)
+		event.events |= EPOLLOUT;
+
+	event.data.ptr = hHandle;
+
+	if (epoll_ctl(set->epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl(%d) failure [%d] %s", fd, errno, strerror(errno));
+		SetLastError((errno == EEXIST) ? ERROR_ALREADY_EXISTS : ERROR_INTERNAL_ERROR);
+		return FALSE;
+	}
+
+#else
+	DWORD index;
+#if defined(WITH_WAIT_SET_POLL)
+	int fd;
+	ULONG mode;
+
+	if (!set || !wait_set_handle_info(hHandle, &fd, &mode))
+		return FALSE;
+#else
+
+	if (!set || !hHandle)
+		return FALSE;
+
+	if (set->count >= MAXIMUM_WAIT_OBJECTS)
+	{
+		WLog_ERR(TAG, "a wait set is limited to %d handles", MAXIMUM_WAIT_OBJECTS);
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+#endif
+
+	for (index = 0; index < set->count; index++)
+	{
+		if (set->handles[index] == hHandle)
+		{
+			SetLastError(ERROR_ALREADY_EXISTS);
+			return FALSE;
+		}
+	}
+
+	if (set->count == set->capacity)
+	{
+		HANDLE* handles;
+		const DWORD capacity = set->capacity ? set->capacity * 2 : 16;
+
+		if (!(handles = (HANDLE*)realloc(set->handles, capacity * sizeof(HANDLE))))
+			goto fail_memory;
+
+		set->handles = handles;
+#if defined(WITH_WAIT_SET_POLL)
+		{
+			struct pollfd* pollfds =
+			    (struct pollfd*)realloc(set->pollfds, capacity * sizeof(struct pollfd));
+
+			if (!pollfds)
+				goto fail_memory;
+
+			set->pollfds = pollfds;
+		}
+#endif
+		set->capacity = capacity;
+	}
+
+	set->handles[set->count] = hHandle;
+#if defined(WITH_WAIT_SET_POLL)
+	set->pollfds[set->count].fd = fd;
+	set->pollfds[set->count].events = 0;
+	set->pollfds[set->count].revents = 0;
+
+	if (mode & WINPR_FD_READ)
+		set->pollfds[set->count].events |= POLLIN;
+
+	if (mode & WINPR_FD_WRITE)
+		set->pollfds[set->count].events |= POLLOUT;
+
+#endif
+#endif
+	set->count++;
+	return TRUE;
+#if !defined(WITH_WAIT_SET_EPOLL)
+fail_memory:
+	SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+	return FALSE;
+#endif
+}
+
+BOOL WaitSetRemoveHandle(WINPR_WAIT_SET* set, HANDLE hHandle)
+{
+#if defined(WITH_WAIT_SET_EPOLL)
+	int fd;
+	ULONG mode;
+	struct epoll_event event = { 0 };
+
+	if (!set || !wait_set_handle_info(hHandle, &fd, &mode))
+		return FALSE;
+
+	if (epoll_ctl(set->epfd, EPOLL_CTL_DEL, fd, &event) < 0)
+	{
+		WLog_ERR(TAG, "epoll_ctl(%d) failure [%d] %s", fd, errno, strerror(errno));
+		SetLastError((errno == ENOENT) ? ERROR_NOT_FOUND : ERROR_INTERNAL_ERROR);
+		return FALSE;
+	}
+
+#else
+	DWORD index;
+
+	if (!set)
+		return FALSE;
+
+	for (index = 0; index < set->count; index++)
+	{
+		if (set->handles[index] == hHandle)
+			break;
+	}
+
+	if (index == set->count)
+	{
+		SetLastError(ERROR_NOT_FOUND);
+		return FALSE;
+	}
+
+	/* The order of the handles does not matter, the last one takes the slot */
+	set->handles[index] = set->handles[set->count - 1];
+#if defined(WITH_WAIT_SET_POLL)
+	set->pollfds[index] = set->pollfds[set->count - 1];
+#endif
+#endif
+	set->count--;
+	return TRUE;
+}
+
+DWORD WaitForWaitSet(WINPR_WAIT_SET* set, DWORD dwMilliseconds, HANDLE* lpHandles, DWORD nCount,
+                     LPDWORD lpReadyCount)
+{
+	DWORD ready = 0;
+#if defined(WITH_WAIT_SET_EPOLL)
+	int index;
+	int status;
+	struct epoll_event events[WAIT_SET_MAX_EVENTS];
+#elif defined(WITH_WAIT_SET_POLL)
+	int status;
+	DWORD index;
+#else
+	DWORD index;
+	DWORD status;
+#endif
+
+	if (!set || !lpHandles || !nCount || !lpReadyCount)
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+	*lpReadyCount = 0;
+
+	if (set->count == 0)
+	{
+		WLog_ERR(TAG, "waiting on an empty wait set");
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+#if defined(WITH_WAIT_SET_EPOLL)
+
+	do
+	{
+		status = epoll_wait(set->epfd, events,
+		                    (nCount < WAIT_SET_MAX_EVENTS) ? (int)nCount : WAIT_SET_MAX_EVENTS,
+		                    wait_set_timeout(dwMilliseconds));
+	} while ((status < 0) && (errno == EINTR));
+
+	if (status < 0)
+	{
+		WLog_ERR(TAG, "epoll_wait() failure [%d] %s", errno, strerror(errno));
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return WAIT_FAILED;
+	}
+
+	for (index = 0; index < status; index++)
+	{
+		HANDLE hHandle = events[index].data.ptr;
+		const DWORD rc = winpr_Handle_cleanup(hHandle);
+
+		/* Do not lose the handles that were already consumed */
+		if (rc != WAIT_OBJECT_0)
+		{
+			if (ready == 0)
+				return rc;
+
+			break;
+		}
+
+		lpHandles[ready++] = hHandle;
+	}
+
+#elif defined(WITH_WAIT_SET_POLL)
+
+	do
+	{
+		status = poll(set->pollfds, set->count, wait_set_timeout(dwMilliseconds));
+	} while ((status < 0) && (errno == EINTR));
+
+	if (status < 0)
+	{
+		WLog_ERR(TAG, "poll() failure [%d] %s", errno, strerror(errno));
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return WAIT_FAILED;
+	}
+
+	for (index = 0; (index < set->count) && (ready < nCount) && (status > 0); index++)
+	{
+		DWORD rc;
+
+		if (!(set->pollfds[index].revents & set->pollfds[index].events))
+			continue;
+
+		status--;
+
+		if ((rc = winpr_Handle_cleanup(set->handles[index])) != WAIT_OBJECT_0)
+		{
+			if (ready == 0)
+				return rc;
+
+			break;
+		}
+
+		lpHandles[ready++] = set->handles[index];
+	}
+
+#else
+	status = WaitForMultipleObjects(set->count, set->handles, FALSE, dwMilliseconds);
+
+	if ((status == WAIT_TIMEOUT) || (status == WAIT_FAILED))
+		return status;
+
+	index = status - WAIT_OBJECT_0;
+
+	if (index >= set->count)
+		return WAIT_FAILED;
+
+	lpHandles[ready++] = set->handles[index];
+
+	/* WaitForMultipleObjects only reports the first signaled handle */
+	for (index++; (index < set->count) && (ready < nCount); index++)
+	{
+		if (WaitForSingleObject(set->handles[index], 0) == WAIT_OBJECT_0)
+			lpHandles[ready++] = set->handles[index];
+	}
+
+#endif
+	*lpReadyCount = ready;
+	return (ready > 0) ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+}
@@ -574,9 +574,18 @@ ULONGLONG winpr_GetTickCount64(void)
 /* If x86 */
 #ifdef _M_IX86_AMD64
 
-#if defined(__GNUC__) && defined(__AVX__)
+#if defined(__GNUC__)
 #define xgetbv(_func_, _lo_, _hi_) \
 	__asm__ __volatile__("xgetbv" : "=a"(_lo_), "=d"(_hi_) : "c"(_func_))
+#elif defined(_MSC_VER) && (_MSC_FULL_VER >= 160040219)
+#include <immintrin.h>
+#define xgetbv(_func_, _lo_, _hi_)                     \
+	do                                                 \
+	{                                                  \
+		const unsigned __int64 _val_ = _xgetbv(_func_); \
+		_lo_ = (unsigned)_val_;                        \
+		_hi_ = (unsigned)(_val_ >> 32);                \
+	} while (0)
 #endif
 
 #define D_BIT_MMX (1 << 23)
@@ -599,6 +608,10 @@ ULONGLONG winpr_GetTickCount64(void)
 #define E_BIT_XMM (1 << 1)
 #define E_BIT_YMM (1 << 2)
 #define E_BITS_AVX (E_BIT_XMM | E_BIT_YMM)
+#define E_BITS_AVX512 (E_BITS_AVX | (1 << 5) | (1 << 6) | (1 << 7)) /* opmask, ZMM state */
+#define B7_BIT_AVX2 (1 << 5)
+#define B7_BIT_AVX512F (1 << 16)
+#define B7_BIT_AVX512BW (1 << 30)
 
 static void cpuid(unsigned info, unsigned* eax, unsigned* ebx, unsigned* ecx, unsigned* edx)
 {
@@ -618,10 +631,10 @@ static void cpuid(unsigned info, unsigned* eax, unsigned* ebx, unsigned* ecx, un
 	    "xchg %%rbx, %%rsi;"
 #endif
 	    : "=a"(*eax), "=S"(*ebx), "=c"(*ecx), "=d"(*edx)
-	    : "0"(info));
+	    : "0"(info), "2"(0));
 #elif defined(_MSC_VER)
 	int a[4];
-	__cpuid(a, info);
+	__cpuidex(a, info, 0);
 	*eax = a[0];
 	*ebx = a[1];
 	*ecx = a[2];
@@ -933,18 +946,22 @@ BOOL IsProcessorFeaturePresentEx(DWORD ProcessorFeature)
 				ret = TRUE;
 
 			break;
-#if defined(__GNUC__) && defined(__AVX__)
+#if defined(xgetbv)
 
 		case PF_EX_AVX:
 		case PF_EX_FMA:
 		case PF_EX_AVX_AES:
 		case PF_EX_AVX_PCLMULQDQ:
+		case PF_EX_AVX2:
+		case PF_EX_AVX512F:
+		case PF_EX_AVX512BW:
 		{
+			unsigned e, f;
+
 			/* Check for general AVX support */
 			if ((c & C_BITS_AVX) != C_BITS_AVX)
 				break;
 
-			int e, f;
 			xgetbv(0, e, f);
 
 			/* XGETBV enabled for applications and XMM/YMM states enabled */
@@ -973,11 +990,30 @@ BOOL IsProcessorFeaturePresentEx(DWORD ProcessorFeature)
 							ret = TRUE;
 
 						break;
+
+					case PF_EX_AVX2:
+					case PF_EX_AVX512F:
+					case PF_EX_AVX512BW:
+					{
+						unsigned a7, b7, c7, d7;
+						cpuid(7, &a7, &b7, &c7, &d7);
+
+						if (ProcessorFeature == PF_EX_AVX2)
+							ret = (b7 & B7_BIT_AVX2) ? TRUE : FALSE;
+						/* The AVX-512 state must be enabled by the OS as well */
+						else if ((e & E_BITS_AVX512) != E_BITS_AVX512)
+							ret = FALSE;
+						else if (ProcessorFeature == PF_EX_AVX512F)
+							ret = (b7 & B7_BIT_AVX512F) ? TRUE : FALSE;
+						else
+							ret = ((b7 & B7_BIT_AVX512F) && (b7 & B7_BIT_AVX512BW)) ? TRUE : FALSE;
+					}
+					break;
 				}
 			}
 		}
 		break;
-#endif //__AVX__
+#endif /* xgetbv */
 
 		default:
 			break;
@@ -26,6 +26,9 @@ int TestCPUFeatures(int argc, char* argv[])
 	TEST_FEATURE_EX(PF_EX_FMA);
 	TEST_FEATURE_EX(PF_EX_AVX_AES);
 	TEST_FEATURE_EX(PF_EX_AVX_PCLMULQDQ);
+	TEST_FEATURE_EX(PF_EX_AVX2);
+	TEST_FEATURE_EX(PF_EX_AVX512F);
+	TEST_FEATURE_EX(PF_EX_AVX512BW);
 #elif defined(_M_ARM)
 	TEST_FEATURE(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE);
 	TEST_FEATURE(PF_ARM_THUMB);
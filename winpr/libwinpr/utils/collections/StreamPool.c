@@ -22,121 +22,216 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
 
 #include <winpr/collections.h>
 
+/**
+ * Available streams are kept in buckets of power of two capacities, a stream
+ * of bucket k holds at least 2^k bytes. Each bucket has a few cache slots
+ * that threads are hashed to, so a slot is in practice private to a thread,
+ * and behind them a bounded lock-free MPMC ring (D. Vyukov's design) which is
+ * free of ABA problems. Streams that find their bucket full are freed.
+ *
+ * The lock only protects the list of all streams owned by the pool, which is
+ * changed when streams are allocated or freed and read by StreamPool_Find.
+ */
+
+#define STREAMPOOL_MIN_SHIFT 8
+#define STREAMPOOL_MAX_SHIFT 24
+#define STREAMPOOL_BUCKETS (STREAMPOOL_MAX_SHIFT - STREAMPOOL_MIN_SHIFT + 1)
+#define STREAMPOOL_CACHE_SLOTS 8
+#define STREAMPOOL_RING_SIZE 64
+#define STREAMPOOL_CACHE_LINE 64
+
+typedef struct
+{
+	volatile LONG sequence;
+	wStream* stream;
+} wStreamPoolCell;
+
+struct _wStreamPoolBucket
+{
+	PVOID volatile cache[STREAMPOOL_CACHE_SLOTS];
+
+	/* keep the producer and consumer positions on different cache lines */
+	volatile LONG head;
+	BYTE headPadding[STREAMPOOL_CACHE_LINE - sizeof(LONG)];
+	volatile LONG tail;
+	BYTE tailPadding[STREAMPOOL_CACHE_LINE - sizeof(LONG)];
+
+	wStreamPoolCell cells[STREAMPOOL_RING_SIZE];
+};
+
 /**
  * Methods
  */
 
-static void StreamPool_ShiftUsed(wStreamPool* pool, int index, int count)
+static INLINE UINT32 StreamPool_CacheSlot(void)
+{
+	/* pthread ids are aligned addresses, mix the bits before picking a slot */
+	const UINT32 id = (UINT32)GetCurrentThreadId();
+	return ((id * 0x9E3779B1) >> 16) % STREAMPOOL_CACHE_SLOTS;
+}
+
+/* Bucket whose streams all hold at least size bytes */
+static INLINE size_t StreamPool_BucketForSize(size_t size)
+{
+	size_t shift = STREAMPOOL_MIN_SHIFT;
+
+	while ((shift < STREAMPOOL_MAX_SHIFT) && ((1ull << shift) < size))
+		shift++;
+
+	return shift - STREAMPOOL_MIN_SHIFT;
+}
+
+/* Bucket a stream of the given capacity belongs to, -1 if it is too small to keep */
+static INLINE int StreamPool_BucketForCapacity(size_t capacity)
+{
+	size_t shift = STREAMPOOL_MIN_SHIFT;
+
+	if (capacity < (1ull << STREAMPOOL_MIN_SHIFT))
+		return -1;
+
+	while ((shift < STREAMPOOL_MAX_SHIFT) && ((1ull << (shift + 1)) <= capacity))
+		shift++;
+
+	return (int)(shift - STREAMPOOL_MIN_SHIFT);
+}
+
+static BOOL StreamPool_Push(wStreamPoolBucket* bucket, wStream* s)
 {
-	if (count > 0)
+	wStreamPoolCell* cell;
+	const UINT32 slot = StreamPool_CacheSlot();
+	LONG pos;
+
+	if (!bucket->cache[slot] && !InterlockedCompareExchangePointer(&bucket->cache[slot], s, NULL))
+		return TRUE;
+
+	pos = bucket->tail;
+
+	while (1)
 	{
-		if (pool->uSize + count > pool->uCapacity)
+		LONG diff;
+		cell = &bucket->cells[(ULONG)pos & (STREAMPOOL_RING_SIZE - 1)];
+		diff = (LONG)((ULONG)cell->sequence - (ULONG)pos);
+
+		if (diff == 0)
 		{
-			int new_cap;
-			wStream** new_arr;
-
-			new_cap = pool->uCapacity * 2;
-			new_arr = (wStream**)realloc(pool->uArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->uCapacity = new_cap;
-			pool->uArray = new_arr;
-		}
+			const LONG next = (LONG)((ULONG)pos + 1);
+			const LONG current = InterlockedCompareExchange(&bucket->tail, next, pos);
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index],
-		           (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += count;
+			if (current == pos)
+				break;
+
+			pos = current;
+		}
+		else if (diff < 0)
+			return FALSE; /* full */
+		else
+			pos = bucket->tail;
 	}
-	else if (count < 0)
+
+	cell->stream = s;
+	InterlockedExchange(&cell->sequence, (LONG)((ULONG)pos + 1));
+	return TRUE;
+}
+
+static wStream* StreamPool_Pop(wStreamPoolBucket* bucket)
+{
+	wStream* s;
+	wStreamPoolCell* cell;
+	const UINT32 slot = StreamPool_CacheSlot();
+	LONG pos;
+
+	if (bucket->cache[slot])
 	{
-		if (pool->uSize - index + count > 0)
-		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index - count],
-			           (pool->uSize - index + count) * sizeof(wStream*));
-		}
+		s = (wStream*)bucket->cache[slot];
 
-		pool->uSize += count;
+		if (s && (InterlockedCompareExchangePointer(&bucket->cache[slot], NULL, s) == s))
+			return s;
 	}
-}
 
-/**
- * Adds a used stream to the pool.
- */
+	pos = bucket->head;
 
-static void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
-{
-	if ((pool->uSize + 1) >= pool->uCapacity)
+	while (1)
 	{
-		int new_cap;
-		wStream** new_arr;
+		LONG diff;
+		cell = &bucket->cells[(ULONG)pos & (STREAMPOOL_RING_SIZE - 1)];
+		diff = (LONG)((ULONG)cell->sequence - ((ULONG)pos + 1));
 
-		new_cap = pool->uCapacity * 2;
-		new_arr = (wStream**)realloc(pool->uArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			return;
-		pool->uCapacity = new_cap;
-		pool->uArray = new_arr;
+		if (diff == 0)
+		{
+			const LONG next = (LONG)((ULONG)pos + 1);
+			const LONG current = InterlockedCompareExchange(&bucket->head, next, pos);
+
+			if (current == pos)
+				break;
+
+			pos = current;
+		}
+		else if (diff < 0)
+			return NULL; /* empty */
+		else
+			pos = bucket->head;
 	}
 
-	pool->uArray[(pool->uSize)++] = s;
+	s = cell->stream;
+	InterlockedExchange(&cell->sequence, (LONG)((ULONG)pos + STREAMPOOL_RING_SIZE));
+	return s;
 }
 
 /**
- * Removes a used stream from the pool.
+ * Adds a stream to the list of streams owned by the pool.
  */
 
-static void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
+static BOOL StreamPool_AddStream(wStreamPool* pool, wStream* s)
 {
-	int index;
-	BOOL found = FALSE;
+	BOOL rc = TRUE;
+	EnterCriticalSection(&pool->lock);
 
-	for (index = 0; index < pool->uSize; index++)
+	if (pool->size == pool->capacity)
 	{
-		if (pool->uArray[index] == s)
+		const size_t new_cap = pool->capacity * 2;
+		wStream** new_arr = (wStream**)realloc(pool->array, sizeof(wStream*) * new_cap);
+
+		if (!new_arr)
 		{
-			found = TRUE;
-			break;
+			rc = FALSE;
+			goto out;
 		}
+
+		pool->capacity = new_cap;
+		pool->array = new_arr;
 	}
 
-	if (found)
-		StreamPool_ShiftUsed(pool, index, -1);
+	pool->array[pool->size++] = s;
+out:
+	LeaveCriticalSection(&pool->lock);
+	return rc;
 }
 
-static void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
+/**
+ * Removes a stream from the list of streams owned by the pool and frees it.
+ */
+
+static void StreamPool_FreeStream(wStreamPool* pool, wStream* s)
 {
-	if (count > 0)
-	{
-		if (pool->aSize + count > pool->aCapacity)
-		{
-			int new_cap;
-			wStream** new_arr;
-
-			new_cap = pool->aCapacity * 2;
-			new_arr = (wStream**)realloc(pool->aArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->aCapacity = new_cap;
-			pool->aArray = new_arr;
-		}
+	size_t index;
+	EnterCriticalSection(&pool->lock);
 
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index],
-		           (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += count;
-	}
-	else if (count < 0)
+	for (index = 0; index < pool->size; index++)
 	{
-		if (pool->aSize - index + count > 0)
+		if (pool->array[index] == s)
 		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index - count],
-			           (pool->aSize - index + count) * sizeof(wStream*));
+			pool->array[index] = pool->array[--pool->size];
+			break;
 		}
-
-		pool->aSize += count;
 	}
+
+	LeaveCriticalSection(&pool->lock);
+	Stream_Free(s, TRUE);
 }
 
 /**
@@ -145,53 +240,47 @@ static void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
 
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
-	int index;
-	int foundIndex;
+	size_t index;
 	wStream* s = NULL;
 
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
-
 	if (size == 0)
 		size = pool->defaultSize;
 
-	foundIndex = -1;
-
-	for (index = 0; index < pool->aSize; index++)
-	{
-		s = pool->aArray[index];
+	index = StreamPool_BucketForSize(size);
 
-		if (Stream_Capacity(s) >= size)
-		{
-			foundIndex = index;
-			break;
-		}
-	}
+	/* Look one bucket up as well before allocating */
+	if (!(s = StreamPool_Pop(&pool->buckets[index])) && (index + 1 < STREAMPOOL_BUCKETS))
+		s = StreamPool_Pop(&pool->buckets[index + 1]);
 
-	if (foundIndex < 0)
+	/* Only the last bucket holds streams that can be smaller than asked for */
+	if (s && (Stream_Capacity(s) < size))
 	{
-		s = Stream_New(NULL, size);
-		if (!s)
-			goto out_fail;
+		StreamPool_Return(pool, s);
+		s = NULL;
 	}
-	else
+
+	if (s)
 	{
 		Stream_SetPosition(s, 0);
 		Stream_SetLength(s, Stream_Capacity(s));
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
 	}
-
-	if (s)
+	else
 	{
-		s->pool = pool;
-		s->count = 1;
-		StreamPool_AddUsed(pool, s);
-	}
+		const size_t shift = index + STREAMPOOL_MIN_SHIFT;
+		const size_t capacity = (size <= (1ull << shift)) ? (1ull << shift) : size;
 
-out_fail:
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
+		if (!(s = Stream_New(NULL, capacity)))
+			return NULL;
+
+		if (!StreamPool_AddStream(pool, s))
+		{
+			Stream_Free(s, TRUE);
+			return NULL;
+		}
+	}
 
+	s->pool = pool;
+	s->count = 1;
 	return s;
 }
 
@@ -201,58 +290,10 @@ out_fail:
 
 void StreamPool_Return(wStreamPool* pool, wStream* s)
 {
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
-
-	if ((pool->aSize + 1) >= pool->aCapacity)
-	{
-		int new_cap;
-		wStream** new_arr;
-
-		new_cap = pool->aCapacity * 2;
-		new_arr = (wStream**)realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
-	else if ((pool->aSize + 1) * 3 < pool->aCapacity)
-	{
-		int new_cap;
-		wStream** new_arr;
-
-		new_cap = pool->aCapacity / 2;
-		new_arr = (wStream**)realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
-
-	pool->aArray[(pool->aSize)++] = s;
-	StreamPool_RemoveUsed(pool, s);
-
-out_fail:
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
-}
-
-/**
- * Lock the stream pool
- */
-
-static void StreamPool_Lock(wStreamPool* pool)
-{
-	EnterCriticalSection(&pool->lock);
-}
-
-/**
- * Unlock the stream pool
- */
+	const int index = StreamPool_BucketForCapacity(Stream_Capacity(s));
 
-static void StreamPool_Unlock(wStreamPool* pool)
-{
-	LeaveCriticalSection(&pool->lock);
+	if ((index < 0) || !StreamPool_Push(&pool->buckets[index], s))
+		StreamPool_FreeStream(pool, s);
 }
 
 /**
@@ -262,11 +303,7 @@ static void StreamPool_Unlock(wStreamPool* pool)
 void Stream_AddRef(wStream* s)
 {
 	if (s->pool)
-	{
-		StreamPool_Lock(s->pool);
-		s->count++;
-		StreamPool_Unlock(s->pool);
-	}
+		InterlockedIncrement((LONG volatile*)&s->count);
 }
 
 /**
@@ -275,15 +312,9 @@ void Stream_AddRef(wStream* s)
 
 void Stream_Release(wStream* s)
 {
-	DWORD count;
-
 	if (s->pool)
 	{
-		StreamPool_Lock(s->pool);
-		count = --(s->count);
-		StreamPool_Unlock(s->pool);
-
-		if (count == 0)
+		if (InterlockedDecrement((LONG volatile*)&s->count) == 0)
 			StreamPool_Return(s->pool, s);
 	}
 }
@@ -294,17 +325,19 @@ void Stream_Release(wStream* s)
 
 wStream* StreamPool_Find(wStreamPool* pool, BYTE* ptr)
 {
-	int index;
+	size_t index;
 	wStream* s = NULL;
 	BOOL found = FALSE;
 
 	EnterCriticalSection(&pool->lock);
 
-	for (index = 0; index < pool->uSize; index++)
+	for (index = 0; index < pool->size; index++)
 	{
-		s = pool->uArray[index];
+		s = pool->array[index];
 
-		if ((ptr >= Stream_Buffer(s)) && (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
+		/* Only streams in use, a stream in a bucket has no references */
+		if ((s->count > 0) && (ptr >= Stream_Buffer(s)) &&
+		    (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
 		{
 			found = TRUE;
 			break;
@@ -350,17 +383,25 @@ void StreamPool_Release(wStreamPool* pool, BYTE* ptr)
 
 void StreamPool_Clear(wStreamPool* pool)
 {
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	size_t index;
 
-	while (pool->aSize > 0)
+	for (index = 0; index < STREAMPOOL_BUCKETS; index++)
 	{
-		(pool->aSize)--;
-		Stream_Free(pool->aArray[pool->aSize], TRUE);
-	}
+		size_t slot;
+		wStream* s;
+		wStreamPoolBucket* bucket = &pool->buckets[index];
+
+		for (slot = 0; slot < STREAMPOOL_CACHE_SLOTS; slot++)
+		{
+			s = (wStream*)bucket->cache[slot];
+
+			if (s && (InterlockedCompareExchangePointer(&bucket->cache[slot], NULL, s) == s))
+				StreamPool_FreeStream(pool, s);
+		}
 
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
+		while ((s = StreamPool_Pop(bucket)))
+			StreamPool_FreeStream(pool, s);
+	}
 }
 
 /**
@@ -369,6 +410,7 @@ void StreamPool_Clear(wStreamPool* pool)
 
 wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 {
+	size_t index, cell;
 	wStreamPool* pool = NULL;
 
 	pool = (wStreamPool*)calloc(1, sizeof(wStreamPool));
@@ -378,23 +420,30 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 		pool->synchronized = synchronized;
 		pool->defaultSize = defaultSize;
 
-		pool->aSize = 0;
-		pool->aCapacity = 32;
-		pool->aArray = (wStream**)calloc(pool->aCapacity, sizeof(wStream*));
+		pool->buckets = (wStreamPoolBucket*)_aligned_malloc(
+		    sizeof(wStreamPoolBucket) * STREAMPOOL_BUCKETS, STREAMPOOL_CACHE_LINE);
 
-		if (!pool->aArray)
+		if (!pool->buckets)
 		{
 			free(pool);
 			return NULL;
 		}
 
-		pool->uSize = 0;
-		pool->uCapacity = 32;
-		pool->uArray = (wStream**)calloc(pool->uCapacity, sizeof(wStream*));
+		ZeroMemory(pool->buckets, sizeof(wStreamPoolBucket) * STREAMPOOL_BUCKETS);
+
+		for (index = 0; index < STREAMPOOL_BUCKETS; index++)
+		{
+			for (cell = 0; cell < STREAMPOOL_RING_SIZE; cell++)
+				pool->buckets[index].cells[cell].sequence = (LONG)cell;
+		}
+
+		pool->size = 0;
+		pool->capacity = 32;
+		pool->array = (wStream**)calloc(pool->capacity, sizeof(wStream*));
 
-		if (!pool->uArray)
+		if (!pool->array)
 		{
-			free(pool->aArray);
+			_aligned_free(pool->buckets);
 			free(pool);
 			return NULL;
 		}
@@ -413,8 +462,8 @@ void StreamPool_Free(wStreamPool* pool)
 
 		DeleteCriticalSection(&pool->lock);
 
-		free(pool->aArray);
-		free(pool->uArray);
+		_aligned_free(pool->buckets);
+		free(pool->array);
 
 		free(pool);
 	}
@@ -1,45 +1,143 @@
 
 #include <winpr/crt.h>
 #include <winpr/stream.h>
+#include <winpr/thread.h>
 #include <winpr/collections.h>
 
 #define BUFFER_SIZE 16384
+#define THREAD_COUNT 8
+#define THREAD_ROUNDS 20000
+
+static BOOL in_use(wStreamPool* pool, wStream* s)
+{
+	return StreamPool_Find(pool, Stream_Buffer(s)) == s;
+}
+
+static DWORD WINAPI stream_pool_thread(LPVOID arg)
+{
+	UINT32 x, y;
+	wStream* held[4] = { 0 };
+	wStreamPool* pool = (wStreamPool*)arg;
+	const UINT32 tag = GetCurrentThreadId();
+	const size_t sizes[] = { 100, 1500, BUFFER_SIZE, 70000 };
+
+	for (x = 0; x < THREAD_ROUNDS; x++)
+	{
+		const UINT32 slot = x % ARRAYSIZE(held);
+		wStream* s = StreamPool_Take(pool, sizes[x % ARRAYSIZE(sizes)]);
+
+		if (!s || (Stream_Capacity(s) < sizes[x % ARRAYSIZE(sizes)]) || (s->count != 1))
+			return 1;
+
+		Stream_Write_UINT32(s, tag);
+		Stream_Write_UINT32(s, x);
+
+		if (held[slot])
+		{
+			/* Nobody else may have been handed the stream while we held it */
+			Stream_SetPosition(held[slot], 0);
+			Stream_Read_UINT32(held[slot], y);
+
+			if (y != tag)
+				return 1;
+
+			Stream_Release(held[slot]);
+		}
+
+		held[slot] = s;
+	}
+
+	for (x = 0; x < ARRAYSIZE(held); x++)
+		Stream_Release(held[x]);
+
+	return 0;
+}
+
+static BOOL test_stream_pool_threads(void)
+{
+	UINT32 x;
+	DWORD code;
+	BOOL rc = TRUE;
+	HANDLE threads[THREAD_COUNT];
+	wStreamPool* pool = StreamPool_New(TRUE, BUFFER_SIZE);
+
+	if (!pool)
+		return FALSE;
+
+	for (x = 0; x < THREAD_COUNT; x++)
+	{
+		if (!(threads[x] = CreateThread(NULL, 0, stream_pool_thread, pool, 0, NULL)))
+		{
+			printf("failed to create thread\n");
+			return FALSE;
+		}
+	}
+
+	for (x = 0; x < THREAD_COUNT; x++)
+	{
+		if ((WaitForSingleObject(threads[x], INFINITE) != WAIT_OBJECT_0) ||
+		    !GetExitCodeThread(threads[x], &code) || (code != 0))
+			rc = FALSE;
+
+		CloseHandle(threads[x]);
+	}
+
+	StreamPool_Free(pool);
+	return rc;
+}
 
 int TestStreamPool(int argc, char* argv[])
 {
 	wStream* s[5];
+	wStream* released[3];
 	wStreamPool* pool;
 
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
 	pool = StreamPool_New(TRUE, BUFFER_SIZE);
 
+	if (!pool)
+		return -1;
+
 	s[0] = StreamPool_Take(pool, 0);
 	s[1] = StreamPool_Take(pool, 0);
 	s[2] = StreamPool_Take(pool, 0);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
+	if (!s[0] || !s[1] || !s[2] || (Stream_Capacity(s[0]) < BUFFER_SIZE) || !in_use(pool, s[1]))
+		return -1;
+
+	released[0] = s[0];
+	released[1] = s[1];
+	released[2] = s[2];
 
 	Stream_Release(s[0]);
 	Stream_Release(s[1]);
 	Stream_Release(s[2]);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
+	if (in_use(pool, released[0]) || in_use(pool, released[1]) || in_use(pool, released[2]))
+		return -1;
 
+	/* Released streams are handed out again */
 	s[3] = StreamPool_Take(pool, 0);
 	s[4] = StreamPool_Take(pool, 0);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
+	if ((s[3] != released[0]) && (s[3] != released[1]) && (s[3] != released[2]))
+		return -1;
+
+	if ((s[4] != released[0]) && (s[4] != released[1]) && (s[4] != released[2]))
+		return -1;
+
+	if ((s[3] == s[4]) || (Stream_GetPosition(s[3]) != 0) || (s[3]->count != 1))
+		return -1;
 
 	Stream_Release(s[3]);
 	Stream_Release(s[4]);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
-
 	s[2] = StreamPool_Take(pool, 0);
 	s[3] = StreamPool_Take(pool, 0);
 	s[4] = StreamPool_Take(pool, 0);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
-
 	Stream_AddRef(s[2]);
 
 	Stream_AddRef(s[3]);
@@ -50,6 +148,11 @@ int TestStreamPool(int argc, char* argv[])
 	Stream_AddRef(s[4]);
 
 	Stream_Release(s[2]);
+
+	/* Only the last release returns a stream */
+	if (!in_use(pool, s[2]))
+		return -1;
+
 	Stream_Release(s[2]);
 
 	Stream_Release(s[3]);
@@ -59,16 +162,19 @@ int TestStreamPool(int argc, char* argv[])
 	Stream_Release(s[4]);
 	Stream_Release(s[4]);
 	Stream_Release(s[4]);
+
+	if (!in_use(pool, s[4]))
+		return -1;
+
 	Stream_Release(s[4]);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
+	if (in_use(pool, s[2]) || in_use(pool, s[3]) || in_use(pool, s[4]))
+		return -1;
 
 	s[2] = StreamPool_Take(pool, 0);
 	s[3] = StreamPool_Take(pool, 0);
 	s[4] = StreamPool_Take(pool, 0);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
-
 	StreamPool_AddRef(pool, s[2]->buffer + 1024);
 
 	StreamPool_AddRef(pool, s[3]->buffer + 1024);
@@ -78,7 +184,8 @@ int TestStreamPool(int argc, char* argv[])
 	StreamPool_AddRef(pool, s[4]->buffer + 1024 * 2);
 	StreamPool_AddRef(pool, s[4]->buffer + 1024 * 3);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
+	if ((s[2]->count != 2) || (s[3]->count != 3) || (s[4]->count != 4))
+		return -1;
 
 	StreamPool_Release(pool, s[2]->buffer + 2048);
 	StreamPool_Release(pool, s[2]->buffer + 2048 * 2);
@@ -92,9 +199,23 @@ int TestStreamPool(int argc, char* argv[])
 	StreamPool_Release(pool, s[4]->buffer + 2048 * 3);
 	StreamPool_Release(pool, s[4]->buffer + 2048 * 4);
 
-	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
+	if (in_use(pool, s[2]) || in_use(pool, s[3]) || in_use(pool, s[4]))
+		return -1;
+
+	/* Sizes outside of the default */
+	s[0] = StreamPool_Take(pool, 10);
+	s[1] = StreamPool_Take(pool, 1024 * 1024 * 40);
+
+	if (!s[0] || !s[1] || (Stream_Capacity(s[1]) < 1024 * 1024 * 40))
+		return -1;
+
+	Stream_Release(s[0]);
+	Stream_Release(s[1]);
 
 	StreamPool_Free(pool);
 
+	if (!test_stream_pool_threads())
+		return -1;
+
 	return 0;
 }
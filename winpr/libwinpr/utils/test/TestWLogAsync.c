@@ -0,0 +1,197 @@
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+#include <winpr/wlog.h>
+
+#define TEST_THREADS 4
+#define TEST_MESSAGES 500
+#define TEST_FLOOD 5000
+
+typedef struct
+{
+	DWORD id;
+	LONG next;
+} test_thread_t;
+
+/* the last one is the main thread */
+static test_thread_t threads[TEST_THREADS + 1];
+static BOOL async = FALSE;
+static LONG delivered = 0;
+static LONG droppedReports = 0;
+static BOOL success = TRUE;
+static HANDLE blocked = NULL;
+static HANDLE release = NULL;
+
+static void fail(const char* what)
+{
+	fprintf(stderr, "%s\n", what);
+	success = FALSE;
+}
+
+/* Messages are "<thread> <sequence>", each thread must arrive in order, with gaps if dropped */
+static BOOL CallbackAppenderMessage(const wLogMessage* msg)
+{
+	unsigned thread;
+	unsigned sequence;
+
+	if (strcmp(msg->TextString, "block") == 0)
+	{
+		SetEvent(blocked);
+		WaitForSingleObject(release, INFINITE);
+		return TRUE;
+	}
+
+	if (strstr(msg->TextString, "log messages dropped"))
+	{
+		droppedReports++;
+		return TRUE;
+	}
+
+	if ((sscanf(msg->TextString, "%u %u", &thread, &sequence) != 2) || (thread > TEST_THREADS))
+	{
+		fail("unexpected message");
+		return TRUE;
+	}
+
+	/* Queued messages are written by the background thread or by WLog_Flush */
+	if (!async)
+	{
+		if ((GetCurrentThreadId() != threads[thread].id) || (msg->TimeStamp != 0))
+			fail("synchronous message not written by the logging thread");
+	}
+	else if ((msg->TimeStamp == 0) || (msg->ThreadId == 0))
+		fail("message without capture information");
+
+	if ((LONG)sequence < threads[thread].next)
+		fail("message out of order");
+
+	threads[thread].next = (LONG)sequence + 1;
+
+	delivered++;
+	return TRUE;
+}
+
+static DWORD WINAPI test_log_thread(LPVOID arg)
+{
+	unsigned x;
+	const unsigned thread = (unsigned)(size_t)arg;
+	wLog* log = WLog_Get("com.test.async");
+	threads[thread].id = GetCurrentThreadId();
+
+	for (x = 0; x < TEST_MESSAGES; x++)
+		WLog_Print(log, WLOG_INFO, "%u %u", thread, x);
+
+	return 0;
+}
+
+static BOOL test_threads(void)
+{
+	size_t x;
+	HANDLE handles[TEST_THREADS];
+
+	for (x = 0; x < TEST_THREADS; x++)
+	{
+		if (!(handles[x] = CreateThread(NULL, 0, test_log_thread, (void*)x, 0, NULL)))
+			return FALSE;
+	}
+
+	WaitForMultipleObjects(TEST_THREADS, handles, TRUE, INFINITE);
+
+	for (x = 0; x < TEST_THREADS; x++)
+		CloseHandle(handles[x]);
+
+	return WLog_Flush();
+}
+
+int TestWLogAsync(int argc, char* argv[])
+{
+	size_t x;
+	UINT32 dropped;
+	wLog* root;
+	wLog* log;
+	wLogAppender* appender;
+	wLogCallbacks callbacks = { 0 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	threads[TEST_THREADS].id = GetCurrentThreadId();
+	root = WLog_GetRoot();
+
+	if (!WLog_SetLogAppenderType(root, WLOG_APPENDER_CALLBACK))
+		return -1;
+
+	appender = WLog_GetLogAppender(root);
+	callbacks.message = CallbackAppenderMessage;
+
+	if (!WLog_ConfigureAppender(appender, "callbacks", (void*)&callbacks))
+		return -1;
+
+	log = WLog_Get("com.test.async");
+	WLog_SetLogLevel(log, WLOG_INFO);
+
+	if (!(blocked = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+	    !(release = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return -1;
+
+	async = TRUE;
+
+	if (!WLog_SetAsync(TRUE) || !WLog_IsAsync())
+		return -1;
+
+	/* Every message of every thread arrives in order once flushed */
+	if (!test_threads())
+		return -1;
+
+	if (delivered != TEST_THREADS * TEST_MESSAGES)
+	{
+		fprintf(stderr, "%" PRId32 " of %d messages delivered\n", delivered,
+		        TEST_THREADS * TEST_MESSAGES);
+		return -1;
+	}
+
+	/* Disabled levels are not captured at all */
+	WLog_Print(log, WLOG_DEBUG, "%u %u", TEST_THREADS, 0);
+	WLog_Flush();
+
+	if ((delivered != TEST_THREADS * TEST_MESSAGES) || (WLog_GetDroppedMessages() != 0))
+		return -1;
+
+	/* A stuck writer makes the ring overflow, the logging thread does not wait */
+	WLog_Print(log, WLOG_INFO, "block");
+
+	if (WaitForSingleObject(blocked, 5000) != WAIT_OBJECT_0)
+		return -1;
+
+	delivered = 0;
+
+	for (x = 0; x < TEST_FLOOD; x++)
+		WLog_Print(log, WLOG_INFO, "%u %" PRIuz, TEST_THREADS, x);
+
+	dropped = WLog_GetDroppedMessages();
+	SetEvent(release);
+	WLog_Flush();
+
+	if ((dropped == 0) || (delivered + dropped != TEST_FLOOD) || (droppedReports != 1))
+	{
+		fprintf(stderr, "%" PRId32 " delivered, %" PRIu32 " dropped, %" PRId32 " reports\n",
+		        delivered, dropped, droppedReports);
+		return -1;
+	}
+
+	/* Back to synchronous output, written on the logging thread */
+	if (!WLog_SetAsync(FALSE) || WLog_IsAsync())
+		return -1;
+
+	async = FALSE;
+	delivered = 0;
+	WLog_Print(log, WLOG_INFO, "%u %u", TEST_THREADS, TEST_FLOOD);
+
+	if (delivered != 1)
+		return -1;
+
+	CloseHandle(blocked);
+	CloseHandle(release);
+	return success ? 0 : -1;
+}
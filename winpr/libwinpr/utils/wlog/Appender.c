@@ -84,12 +84,15 @@ BOOL WLog_CloseAppender(wLog* log)
 	if (!appender->Close)
 		return TRUE;
 
+	WLog_Async_Suspend();
+
 	if (appender->active)
 	{
 		status = appender->Close(log, appender);
 		appender->active = FALSE;
 	}
 
+	WLog_Async_Resume();
 	return status;
 }
 
@@ -156,6 +159,9 @@ BOOL WLog_SetLogAppenderType(wLog* log, DWORD logAppenderType)
 	if (!log)
 		return FALSE;
 
+	/* Queued messages go to the appender that was set when they were logged */
+	WLog_Async_Suspend();
+
 	if (log->Appender)
 	{
 		WLog_Appender_Free(log, log->Appender);
@@ -163,6 +169,7 @@ BOOL WLog_SetLogAppenderType(wLog* log, DWORD logAppenderType)
 	}
 
 	log->Appender = WLog_Appender_New(log, logAppenderType);
+	WLog_Async_Resume();
 	return log->Appender != NULL;
 }
 
@@ -173,7 +180,13 @@ BOOL WLog_ConfigureAppender(wLogAppender* appender, const char* setting, void* v
 		return FALSE;
 
 	if (appender->Set)
-		return appender->Set(appender, setting, value);
+	{
+		BOOL rc;
+		WLog_Async_Suspend();
+		rc = appender->Set(appender, setting, value);
+		WLog_Async_Resume();
+		return rc;
+	}
 	else
 		return FALSE;
 }
@@ -34,11 +34,17 @@
 
 #include "wlog/Layout.h"
 
+#include <time.h>
+
 #if defined __linux__ && !defined ANDROID
 #include <unistd.h>
 #include <sys/syscall.h>
 #endif
 
+#if !defined(_WIN32)
+#include <sys/time.h>
+#endif
+
 extern const char* WLOG_LEVELS[7];
 
 /**
@@ -62,6 +68,68 @@ static void WLog_PrintMessagePrefix(wLog* log, wLogMessage* message, const char*
 	va_end(args);
 }
 
+size_t WLog_Layout_GetThreadId(void)
+{
+#if defined __linux__ && !defined ANDROID
+	/* On Linux we prefer to see the LWP id */
+	return (size_t)syscall(SYS_gettid);
+#else
+	return (size_t)GetCurrentThreadId();
+#endif
+}
+
+UINT64 WLog_Layout_GetTimeStamp(void)
+{
+#if defined(_WIN32)
+	ULARGE_INTEGER time64;
+	FILETIME fileTime;
+	GetSystemTimeAsFileTime(&fileTime);
+	time64.u.LowPart = fileTime.dwLowDateTime;
+	time64.u.HighPart = fileTime.dwHighDateTime;
+	/* tenths of microseconds since January 1, 1601 */
+	return time64.QuadPart / 10000ULL - 11644473600000ULL;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (UINT64)tv.tv_sec * 1000ULL + (UINT64)tv.tv_usec / 1000ULL;
+#endif
+}
+
+/* Local time of a message, messages written asynchronously carry their own */
+static void WLog_Layout_GetMessageTime(const wLogMessage* message, SYSTEMTIME* localTime)
+{
+	struct tm ltm;
+	time_t ct;
+
+	if (!message->TimeStamp)
+	{
+		GetLocalTime(localTime);
+		return;
+	}
+
+	ct = (time_t)(message->TimeStamp / 1000);
+	ZeroMemory(localTime, sizeof(SYSTEMTIME));
+#if defined(_WIN32)
+
+	if (localtime_s(&ltm, &ct) != 0)
+		return;
+
+#else
+
+	if (!localtime_r(&ct, &ltm))
+		return;
+
+#endif
+	localTime->wYear = (WORD)(ltm.tm_year + 1900);
+	localTime->wMonth = (WORD)(ltm.tm_mon + 1);
+	localTime->wDayOfWeek = (WORD)ltm.tm_wday;
+	localTime->wDay = (WORD)ltm.tm_mday;
+	localTime->wHour = (WORD)ltm.tm_hour;
+	localTime->wMinute = (WORD)ltm.tm_min;
+	localTime->wSecond = (WORD)ltm.tm_sec;
+	localTime->wMilliseconds = (WORD)(message->TimeStamp % 1000);
+}
+
 BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* message)
 {
 	char* p;
@@ -70,7 +138,7 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 	void* args[32];
 	char format[256];
 	SYSTEMTIME localTime;
-	GetLocalTime(&localTime);
+	WLog_Layout_GetMessageTime(message, &localTime);
 	index = 0;
 	p = (char*)layout->FormatString;
 
@@ -137,14 +205,13 @@ BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* me
 				}
 				else if ((p[0] == 't') && (p[1] == 'i') && (p[2] == 'd')) /* thread id */
 				{
+					args[argc++] = (void*)(message->ThreadId ? message->ThreadId
+					                                         : WLog_Layout_GetThreadId());
 #if defined __linux__ && !defined ANDROID
-					/* On Linux we prefer to see the LWP id */
-					args[argc++] = (void*)(size_t)syscall(SYS_gettid);
 					format[index++] = '%';
 					format[index++] = 'l';
 					format[index++] = 'd';
 #else
-					args[argc++] = (void*)(size_t)GetCurrentThreadId();
 					format[index++] = '%';
 					format[index++] = '0';
 					format[index++] = '8';
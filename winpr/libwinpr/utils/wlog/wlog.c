@@ -28,8 +28,13 @@
 #include <winpr/print.h>
 #include <winpr/debug.h>
 #include <winpr/environment.h>
+#include <winpr/interlocked.h>
 #include <winpr/wlog.h>
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 #if defined(ANDROID)
 #include <android/log.h>
 #include "../log.h"
@@ -64,6 +69,81 @@ static DWORD g_FilterCount = 0;
 static wLogFilter* g_Filters = NULL;
 static wLog* g_RootLog = NULL;
 
+/**
+ * Asynchronous output
+ *
+ * Every thread that logs gets a single producer, single consumer ring of
+ * variable sized records, the logging thread only copies the message into it.
+ * A background thread drains the rings and passes the messages to the
+ * appenders, so the prefix layout and the output happen off the logging thread.
+ * Messages of one thread keep their order, messages of different threads are
+ * only ordered by their capture time stamp.
+ *
+ * A message that does not fit into the ring is dropped and counted, the
+ * logging thread never waits for the background thread. The background thread
+ * only sleeps when all rings are empty and is woken by the next message.
+ *
+ * The drain lock serializes the consumers, the background thread and
+ * WLog_Flush, rings of exited threads are freed once they are empty.
+ */
+
+#define WLOG_ASYNC_RING_SIZE (128 * 1024)
+#define WLOG_ASYNC_CACHE_LINE 64
+#define WLOG_ASYNC_IDLE_TIMEOUT 100
+#define WLOG_ASYNC_PADDING 0xFFFFFFFF
+#define WLOG_ASYNC_ALIGN(_size) (((_size) + 7) & ~((size_t)7))
+
+typedef struct
+{
+	UINT32 Size; /* of the whole record, a multiple of 8 */
+	DWORD Type;  /* WLOG_MESSAGE_* or WLOG_ASYNC_PADDING */
+	DWORD Level;
+	DWORD LineNumber;
+	LPCSTR FileName;
+	LPCSTR FunctionName;
+	LPCSTR FormatString; /* NULL if the text was not formatted */
+	wLog* Log;
+	UINT64 TimeStamp;
+	UINT32 Length; /* of the data following the record */
+	DWORD PacketFlags;
+} wLogAsyncRecord;
+
+typedef struct _wLogAsyncRing wLogAsyncRing;
+
+struct _wLogAsyncRing
+{
+	wLogAsyncRing* next;
+	size_t ThreadId;
+	volatile LONG closed;
+
+	/* keep the producer and consumer positions on different cache lines */
+	BYTE headPadding[WLOG_ASYNC_CACHE_LINE];
+	volatile LONG head;
+	BYTE tailPadding[WLOG_ASYNC_CACHE_LINE - sizeof(LONG)];
+	volatile LONG tail;
+	BYTE dataPadding[WLOG_ASYNC_CACHE_LINE - sizeof(LONG)];
+
+	UINT64 data[WLOG_ASYNC_RING_SIZE / sizeof(UINT64)];
+};
+
+static volatile LONG g_AsyncEnabled = FALSE;
+static volatile LONG g_AsyncSleeping = FALSE;
+static volatile LONG g_AsyncDropped = 0;
+static LONG g_AsyncReported = 0;
+static BOOL g_AsyncInitialized = FALSE;
+static BOOL g_AsyncStop = FALSE;
+static BOOL g_AsyncDraining = FALSE;
+static HANDLE g_AsyncEvent = NULL;
+static HANDLE g_AsyncThread = NULL;
+static wLogAsyncRing* volatile g_AsyncRings = NULL;
+static CRITICAL_SECTION g_AsyncStateLock;
+static CRITICAL_SECTION g_AsyncDrainLock;
+#if defined(_WIN32)
+static DWORD g_AsyncRingKey = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t g_AsyncRingKey;
+#endif
+
 static wLog* WLog_New(LPCSTR name, wLog* rootLogger);
 static void WLog_Free(wLog* log);
 static LONG WLog_GetFilterLogLevel(wLog* log);
@@ -75,6 +155,9 @@ static BOOL WLog_ParseFilters(void);
 static void WLog_Uninit_(void) __attribute__((destructor));
 #endif
 
+static BOOL WLog_Async_Start(void);
+static void WLog_Async_Uninit(void);
+
 static void WLog_Uninit_(void)
 {
 	DWORD index;
@@ -84,6 +167,8 @@ static void WLog_Uninit_(void)
 	if (!root)
 		return;
 
+	WLog_Async_Uninit();
+
 	for (index = 0; index < root->ChildrenCount; index++)
 	{
 		child = root->Children[index];
@@ -94,6 +179,33 @@ static void WLog_Uninit_(void)
 	g_RootLog = NULL;
 }
 
+static VOID WINAPI WLog_Async_ThreadExit(PVOID arg)
+{
+	wLogAsyncRing* ring = (wLogAsyncRing*)arg;
+
+	if (ring)
+		InterlockedExchange(&ring->closed, TRUE);
+}
+
+static BOOL WLog_Async_Init(void)
+{
+#if defined(_WIN32)
+
+	if ((g_AsyncRingKey = FlsAlloc(WLog_Async_ThreadExit)) == FLS_OUT_OF_INDEXES)
+		return FALSE;
+
+#else
+
+	if (pthread_key_create(&g_AsyncRingKey, WLog_Async_ThreadExit) != 0)
+		return FALSE;
+
+#endif
+	InitializeCriticalSection(&g_AsyncStateLock);
+	InitializeCriticalSectionAndSpinCount(&g_AsyncDrainLock, 4000);
+	g_AsyncInitialized = TRUE;
+	return TRUE;
+}
+
 static BOOL CALLBACK WLog_InitializeRoot(PINIT_ONCE InitOnce, PVOID Parameter, PVOID* Context)
 {
 	char* env;
@@ -101,6 +213,9 @@ static BOOL CALLBACK WLog_InitializeRoot(PINIT_ONCE InitOnce, PVOID Parameter, P
 	DWORD logAppenderType;
 	LPCSTR appender = "WLOG_APPENDER";
 
+	if (!WLog_Async_Init())
+		return FALSE;
+
 	if (!(g_RootLog = WLog_New("", NULL)))
 		return FALSE;
 
@@ -149,6 +264,31 @@ static BOOL CALLBACK WLog_InitializeRoot(PINIT_ONCE InitOnce, PVOID Parameter, P
 	if (!WLog_SetLogAppenderType(g_RootLog, logAppenderType))
 		goto fail;
 
+	nSize = GetEnvironmentVariableA("WLOG_ASYNC", NULL, 0);
+
+	if (nSize)
+	{
+		env = (LPSTR)malloc(nSize);
+
+		if (!env)
+			goto fail;
+
+		if (GetEnvironmentVariableA("WLOG_ASYNC", env, nSize) != nSize - 1)
+		{
+			fprintf(stderr, "%s environment variable modified in my back", "WLOG_ASYNC");
+			free(env);
+			goto fail;
+		}
+
+		if ((_stricmp(env, "1") == 0) || (_stricmp(env, "TRUE") == 0))
+		{
+			if (!WLog_Async_Start())
+				fprintf(stderr, "%s: failed to start the asynchronous logger\n", __FUNCTION__);
+		}
+
+		free(env);
+	}
+
 #if defined(_WIN32)
 	atexit(WLog_Uninit_);
 #endif
@@ -333,6 +473,382 @@ static BOOL WLog_WritePacket(wLog* log, wLogMessage* message)
 	return status;
 }
 
+static INLINE BYTE* WLog_Async_RingData(wLogAsyncRing* ring, ULONG position)
+{
+	return &((BYTE*)ring->data)[position & (WLOG_ASYNC_RING_SIZE - 1)];
+}
+
+static wLogAsyncRing* WLog_Async_GetRing(void)
+{
+	wLogAsyncRing* next;
+#if defined(_WIN32)
+	wLogAsyncRing* ring = (wLogAsyncRing*)FlsGetValue(g_AsyncRingKey);
+#else
+	wLogAsyncRing* ring = (wLogAsyncRing*)pthread_getspecific(g_AsyncRingKey);
+#endif
+
+	if (ring)
+		return ring;
+
+	if (!(ring = (wLogAsyncRing*)calloc(1, sizeof(wLogAsyncRing))))
+		return NULL;
+
+	ring->ThreadId = WLog_Layout_GetThreadId();
+#if defined(_WIN32)
+
+	if (!FlsSetValue(g_AsyncRingKey, ring))
+#else
+
+	if (pthread_setspecific(g_AsyncRingKey, ring) != 0)
+#endif
+	{
+		free(ring);
+		return NULL;
+	}
+
+	/* Only the consumer removes rings and never the first one, a push is enough */
+	do
+	{
+		next = g_AsyncRings;
+		ring->next = next;
+	} while (InterlockedCompareExchangePointer((PVOID volatile*)&g_AsyncRings, ring, next) != next);
+
+	return ring;
+}
+
+/* Copies a message into the ring of the calling thread, FALSE if it was dropped */
+static BOOL WLog_Async_Push(wLog* log, const wLogMessage* message, const void* data,
+                            size_t length)
+{
+	ULONG tail;
+	ULONG head;
+	ULONG offset;
+	ULONG contiguous;
+	size_t needed;
+	wLogAsyncRecord* record;
+	wLogAsyncRing* ring = WLog_Async_GetRing();
+	const size_t size = WLOG_ASYNC_ALIGN(sizeof(wLogAsyncRecord) + length + 1);
+
+	if (!ring || (size > WLOG_ASYNC_RING_SIZE))
+		goto fail;
+
+	tail = (ULONG)ring->tail;
+	/* Acquire, the consumer is done with everything before head */
+	head = (ULONG)InterlockedCompareExchange(&ring->head, 0, 0);
+	offset = tail & (WLOG_ASYNC_RING_SIZE - 1);
+	contiguous = WLOG_ASYNC_RING_SIZE - offset;
+	needed = (size > contiguous) ? size + contiguous : size;
+
+	if (needed > WLOG_ASYNC_RING_SIZE - (tail - head))
+		goto fail;
+
+	/* Records are contiguous, the rest of the ring is skipped if it is too small */
+	if (size > contiguous)
+	{
+		record = (wLogAsyncRecord*)WLog_Async_RingData(ring, tail);
+		record->Size = contiguous;
+		record->Type = WLOG_ASYNC_PADDING;
+		tail += contiguous;
+	}
+
+	record = (wLogAsyncRecord*)WLog_Async_RingData(ring, tail);
+	record->Size = (UINT32)size;
+	record->Type = message->Type;
+	record->Level = message->Level;
+	record->LineNumber = message->LineNumber;
+	record->FileName = message->FileName;
+	record->FunctionName = message->FunctionName;
+	record->FormatString = (message->FormatString != message->TextString) ? message->FormatString
+	                                                                      : NULL;
+	record->Log = log;
+	record->TimeStamp = WLog_Layout_GetTimeStamp();
+	record->Length = (UINT32)length;
+	record->PacketFlags = message->PacketFlags;
+	CopyMemory(&record[1], data, length);
+	((BYTE*)&record[1])[length] = '\0';
+	InterlockedExchange(&ring->tail, (LONG)(tail + size));
+
+	/* The exchange above orders the record before the check */
+	if (g_AsyncSleeping && InterlockedCompareExchange(&g_AsyncSleeping, FALSE, TRUE))
+		SetEvent(g_AsyncEvent);
+
+	return TRUE;
+fail:
+	InterlockedIncrement(&g_AsyncDropped);
+	return FALSE;
+}
+
+static void WLog_Async_Deliver(wLogAsyncRing* ring, const wLogAsyncRecord* record)
+{
+	wLogMessage message = { 0 };
+	BYTE* data = (BYTE*)&record[1];
+	message.Type = record->Type;
+	message.Level = record->Level;
+	message.LineNumber = record->LineNumber;
+	message.FileName = record->FileName;
+	message.FunctionName = record->FunctionName;
+	message.TimeStamp = record->TimeStamp;
+	message.ThreadId = ring->ThreadId;
+
+	switch (record->Type)
+	{
+		case WLOG_MESSAGE_TEXT:
+			message.TextString = (LPSTR)data;
+			message.FormatString = record->FormatString ? record->FormatString : (LPCSTR)data;
+			WLog_Write(record->Log, &message);
+			break;
+
+		case WLOG_MESSAGE_DATA:
+			message.Data = data;
+			message.Length = (int)record->Length;
+			WLog_WriteData(record->Log, &message);
+			break;
+
+		case WLOG_MESSAGE_PACKET:
+			message.PacketData = data;
+			message.PacketLength = (int)record->Length;
+			message.PacketFlags = record->PacketFlags;
+			WLog_WritePacket(record->Log, &message);
+			break;
+
+		default:
+			break;
+	}
+}
+
+static size_t WLog_Async_DrainRing(wLogAsyncRing* ring)
+{
+	size_t count = 0;
+	ULONG head = (ULONG)ring->head;
+	/* Acquire, the records before tail must be visible before they are read */
+	const ULONG tail = (ULONG)InterlockedCompareExchange(&ring->tail, 0, 0);
+
+	while (head != tail)
+	{
+		const wLogAsyncRecord* record = (const wLogAsyncRecord*)WLog_Async_RingData(ring, head);
+
+		if (record->Type != WLOG_ASYNC_PADDING)
+		{
+			WLog_Async_Deliver(ring, record);
+			count++;
+		}
+
+		head += record->Size;
+		InterlockedExchange(&ring->head, (LONG)head);
+	}
+
+	return count;
+}
+
+static void WLog_Async_ReportDropped(void)
+{
+	char text[64];
+	wLogMessage message = { 0 };
+	const LONG dropped = g_AsyncDropped;
+
+	if ((dropped == g_AsyncReported) || !WLog_IsLevelActive(g_RootLog, WLOG_WARN))
+		return;
+
+	_snprintf(text, sizeof(text), "%" PRIu32 " log messages dropped",
+	          (UINT32)(dropped - g_AsyncReported));
+	g_AsyncReported = dropped;
+	message.Type = WLOG_MESSAGE_TEXT;
+	message.Level = WLOG_WARN;
+	message.LineNumber = __LINE__;
+	message.FileName = __FILE__;
+	message.FunctionName = __FUNCTION__;
+	message.FormatString = text;
+	message.TextString = text;
+	WLog_Write(g_RootLog, &message);
+}
+
+/* Writes all queued messages, returns how many there were */
+static size_t WLog_Async_Drain(void)
+{
+	size_t count = 0;
+	wLogAsyncRing* prev = NULL;
+	wLogAsyncRing* ring;
+
+	EnterCriticalSection(&g_AsyncDrainLock);
+
+	/* An appender that flushes must not drain the record it is writing again */
+	if (g_AsyncDraining)
+	{
+		LeaveCriticalSection(&g_AsyncDrainLock);
+		return 0;
+	}
+
+	g_AsyncDraining = TRUE;
+	ring = g_AsyncRings;
+
+	while (ring)
+	{
+		wLogAsyncRing* next = ring->next;
+		const BOOL closed = ring->closed;
+		count += WLog_Async_DrainRing(ring);
+
+		/* The thread is gone, nothing is added to its ring anymore */
+		if (closed && prev && (ring->head == ring->tail))
+		{
+			prev->next = next;
+			free(ring);
+		}
+		else
+			prev = ring;
+
+		ring = next;
+	}
+
+	WLog_Async_ReportDropped();
+	g_AsyncDraining = FALSE;
+	LeaveCriticalSection(&g_AsyncDrainLock);
+	return count;
+}
+
+static DWORD WINAPI WLog_Async_Thread(LPVOID arg)
+{
+	WINPR_UNUSED(arg);
+
+	while (!g_AsyncStop)
+	{
+		if (WLog_Async_Drain() > 0)
+			continue;
+
+		/* Producers wake the thread only after it announced it is about to sleep */
+		ResetEvent(g_AsyncEvent);
+		InterlockedExchange(&g_AsyncSleeping, TRUE);
+
+		if ((WLog_Async_Drain() == 0) && !g_AsyncStop)
+			WaitForSingleObject(g_AsyncEvent, WLOG_ASYNC_IDLE_TIMEOUT);
+
+		InterlockedExchange(&g_AsyncSleeping, FALSE);
+	}
+
+	return 0;
+}
+
+static BOOL WLog_Async_Start(void)
+{
+	BOOL rc = TRUE;
+	EnterCriticalSection(&g_AsyncStateLock);
+
+	if (!g_AsyncThread)
+	{
+		g_AsyncStop = FALSE;
+
+		if (!g_AsyncEvent)
+			g_AsyncEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+		if (!g_AsyncEvent ||
+		    !(g_AsyncThread = CreateThread(NULL, 0, WLog_Async_Thread, NULL, 0, NULL)))
+			rc = FALSE;
+		else
+			InterlockedExchange(&g_AsyncEnabled, TRUE);
+	}
+
+	LeaveCriticalSection(&g_AsyncStateLock);
+	return rc;
+}
+
+static void WLog_Async_Stop(void)
+{
+	EnterCriticalSection(&g_AsyncStateLock);
+
+	if (g_AsyncThread)
+	{
+		InterlockedExchange(&g_AsyncEnabled, FALSE);
+		g_AsyncStop = TRUE;
+		SetEvent(g_AsyncEvent);
+		WaitForSingleObject(g_AsyncThread, INFINITE);
+		CloseHandle(g_AsyncThread);
+		g_AsyncThread = NULL;
+	}
+
+	LeaveCriticalSection(&g_AsyncStateLock);
+
+	/* Messages queued while the thread stopped */
+	WLog_Async_Drain();
+}
+
+static void WLog_Async_Uninit(void)
+{
+	if (!g_AsyncInitialized)
+		return;
+
+	WLog_Async_Stop();
+
+	/* Exiting threads must not touch the rings anymore */
+#if defined(_WIN32)
+	FlsFree(g_AsyncRingKey);
+#else
+	pthread_key_delete(g_AsyncRingKey);
+#endif
+
+	while (g_AsyncRings)
+	{
+		wLogAsyncRing* ring = g_AsyncRings;
+		g_AsyncRings = ring->next;
+		free(ring);
+	}
+
+	if (g_AsyncEvent)
+		CloseHandle(g_AsyncEvent);
+
+	g_AsyncEvent = NULL;
+	g_AsyncInitialized = FALSE;
+	DeleteCriticalSection(&g_AsyncDrainLock);
+	DeleteCriticalSection(&g_AsyncStateLock);
+}
+
+BOOL WLog_SetAsync(BOOL enable)
+{
+	if (!WLog_GetRoot())
+		return FALSE;
+
+	if (enable)
+		return WLog_Async_Start();
+
+	WLog_Async_Stop();
+	return TRUE;
+}
+
+BOOL WLog_IsAsync(void)
+{
+	return g_AsyncEnabled ? TRUE : FALSE;
+}
+
+BOOL WLog_Flush(void)
+{
+	/* Nothing was queued if the logger was never initialized */
+	if (!g_AsyncInitialized)
+		return TRUE;
+
+	WLog_Async_Drain();
+	return TRUE;
+}
+
+void WLog_Async_Suspend(void)
+{
+	if (!g_AsyncInitialized)
+		return;
+
+	EnterCriticalSection(&g_AsyncDrainLock);
+	WLog_Async_Drain();
+}
+
+void WLog_Async_Resume(void)
+{
+	if (!g_AsyncInitialized)
+		return;
+
+	LeaveCriticalSection(&g_AsyncDrainLock);
+}
+
+UINT32 WLog_GetDroppedMessages(void)
+{
+	return (UINT32)g_AsyncDropped;
+}
+
 BOOL WLog_PrintMessageVA(wLog* log, DWORD type, DWORD level, DWORD line, const char* file,
                          const char* function, va_list args)
 {
@@ -352,7 +868,12 @@ BOOL WLog_PrintMessageVA(wLog* log, DWORD type, DWORD level, DWORD line, const c
 			if (!strchr(message.FormatString, '%'))
 			{
 				message.TextString = (LPSTR)message.FormatString;
-				status = WLog_Write(log, &message);
+
+				if (g_AsyncEnabled)
+					status = WLog_Async_Push(log, &message, message.TextString,
+					                         strlen(message.TextString));
+				else
+					status = WLog_Write(log, &message);
 			}
 			else
 			{
@@ -363,7 +884,12 @@ BOOL WLog_PrintMessageVA(wLog* log, DWORD type, DWORD level, DWORD line, const c
 					return FALSE;
 
 				message.TextString = formattedLogMessage;
-				status = WLog_Write(log, &message);
+
+				if (g_AsyncEnabled)
+					status = WLog_Async_Push(log, &message, formattedLogMessage,
+					                         strlen(formattedLogMessage));
+				else
+					status = WLog_Write(log, &message);
 			}
 
 			break;
@@ -371,7 +897,12 @@ BOOL WLog_PrintMessageVA(wLog* log, DWORD type, DWORD level, DWORD line, const c
 		case WLOG_MESSAGE_DATA:
 			message.Data = va_arg(args, void*);
 			message.Length = va_arg(args, int);
-			status = WLog_WriteData(log, &message);
+
+			if (g_AsyncEnabled && (message.Length >= 0))
+				status = WLog_Async_Push(log, &message, message.Data, (size_t)message.Length);
+			else
+				status = WLog_WriteData(log, &message);
+
 			break;
 
 		case WLOG_MESSAGE_IMAGE:
@@ -386,7 +917,13 @@ BOOL WLog_PrintMessageVA(wLog* log, DWORD type, DWORD level, DWORD line, const c
 			message.PacketData = va_arg(args, void*);
 			message.PacketLength = va_arg(args, int);
 			message.PacketFlags = va_arg(args, int);
-			status = WLog_WritePacket(log, &message);
+
+			if (g_AsyncEnabled && (message.PacketLength >= 0))
+				status = WLog_Async_Push(log, &message, message.PacketData,
+				                         (size_t)message.PacketLength);
+			else
+				status = WLog_WritePacket(log, &message);
+
 			break;
 
 		default:
@@ -81,6 +81,12 @@ struct _wLog
 };
 
 BOOL WLog_Layout_GetMessagePrefix(wLog* log, wLogLayout* layout, wLogMessage* message);
+size_t WLog_Layout_GetThreadId(void);
+UINT64 WLog_Layout_GetTimeStamp(void);
+
+/* Writes the queued messages and keeps them from being written until resumed */
+void WLog_Async_Suspend(void);
+void WLog_Async_Resume(void);
 
 #include "wlog/Layout.h"
 #include "wlog/Appender.h"